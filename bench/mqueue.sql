@@ -0,0 +1,7 @@
+--
+-- mqueue.sql
+--
+-- pgbench script of the concurrent workload; every client keeps sending
+-- chunks of GpuScan to the OpenCL server through mqueue.
+--
+SELECT count(*) FROM pgstrom_bench.t0 WHERE a + b < 2.0;
@@ -0,0 +1,119 @@
+#!/bin/bash
+#
+# run_bench.sh
+#
+# Benchmark suite of PG-Strom; invoked by "make bench". It connects to the
+# database being specified by the libpq environment variables (PGDATABASE,
+# PGHOST, ...), and appends a JSON record for each workload to the output
+# file, to compare the results across commits.
+#
+# BENCH_SCALE     number of rows of the base relation (default: 10000000)
+# BENCH_LOOPS     number of iterations of each workload (default: 3)
+# BENCH_CLIENTS   number of concurrent clients of pgbench (default: 8)
+# BENCH_DURATION  duration of the concurrent workload [sec] (default: 30)
+# BENCH_OUTPUT    output file (default: bench/results.jsonl)
+#
+# Note that pg_strom has to be installed on the database, and superuser
+# privilege is required to reset pg_stat_strom.
+#
+set -e
+
+BENCH_DIR=$(cd $(dirname $0) && pwd)
+BENCH_SCALE=${BENCH_SCALE:-10000000}
+BENCH_LOOPS=${BENCH_LOOPS:-3}
+BENCH_CLIENTS=${BENCH_CLIENTS:-8}
+BENCH_DURATION=${BENCH_DURATION:-30}
+BENCH_OUTPUT=${BENCH_OUTPUT:-$BENCH_DIR/results.jsonl}
+BENCH_COMMIT=$(git -C $BENCH_DIR rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+export PGOPTIONS="-c pg_strom.perfmon=on -c pgstrom_bench.commit=$BENCH_COMMIT"
+
+PSQL="psql -X -q -At -v ON_ERROR_STOP=1"
+
+# run_query <bench> <settings> <query>
+run_query()
+{
+	$PSQL <<-EOSQL | grep '^{' >> $BENCH_OUTPUT
+	$2;
+	SELECT pgstrom_bench.run('$1', \$Q\$$3\$Q\$);
+	EOSQL
+}
+
+# mqueue_counters; sum of the counters of all the message queues. Queues
+# are recycled by the backends, so the delta is approximate.
+mqueue_counters()
+{
+	$PSQL -F ' ' -c "SELECT sum(enqueue), sum(contention), sum(sleep), sum(overflow) FROM pgstrom_mqueue_info()"
+}
+
+echo "PG-Strom benchmark (commit: $BENCH_COMMIT, scale: $BENCH_SCALE)"
+$PSQL -v scale=$BENCH_SCALE -f $BENCH_DIR/setup.sql
+$PSQL -c "SELECT pgstrom_stat_reset()" > /dev/null
+
+#
+# GpuScan with selective and non-selective qualifiers on the heap
+#
+for i in $(seq $BENCH_LOOPS); do
+	run_query gpuscan_selective "SET pgstrom.enable_tcache = off" \
+		"SELECT * FROM pgstrom_bench.t0 WHERE a + b < 2.0"
+	run_query gpuscan_nonselective "SET pgstrom.enable_tcache = off" \
+		"SELECT * FROM pgstrom_bench.t0 WHERE a + b > 2.0"
+done
+
+#
+# Build of the columnar cache, then warm scans on the cache. A new
+# relation is created every time, so the first scan has no cache.
+#
+for i in $(seq $BENCH_LOOPS); do
+	$PSQL <<-EOSQL
+	DROP TABLE IF EXISTS pgstrom_bench.t1;
+	CREATE TABLE pgstrom_bench.t1 AS SELECT * FROM pgstrom_bench.t0;
+	VACUUM ANALYZE pgstrom_bench.t1;
+	EOSQL
+	run_query tcache_build "SET pgstrom.enable_tcache = on" \
+		"SELECT * FROM pgstrom_bench.t1 WHERE a + b < 2.0"
+	run_query tcache_warm "SET pgstrom.enable_tcache = on" \
+		"SELECT * FROM pgstrom_bench.t1 WHERE a + b < 2.0"
+done
+
+#
+# Cold and warm compile of the device program. The qualifier has a random
+# shape to have a kernel source never built; constants are not a part of
+# the source, so only operators are randomized. On-disk kernel cache may
+# hit, if the same shape was built by the prior runs.
+#
+for i in $(seq $BENCH_LOOPS); do
+	QUAL="a"
+	for j in $(seq 12); do
+		case $((RANDOM % 3)) in
+			0) QUAL="($QUAL + b)";;
+			1) QUAL="($QUAL - b)";;
+			2) QUAL="($QUAL * b)";;
+		esac
+	done
+	run_query devprog_cold "SET pgstrom.enable_tcache = off" \
+		"SELECT * FROM pgstrom_bench.t0 WHERE $QUAL < 2.0"
+	run_query devprog_warm "SET pgstrom.enable_tcache = off" \
+		"SELECT * FROM pgstrom_bench.t0 WHERE $QUAL < 2.0"
+done
+
+#
+# Concurrent backends that stress the message queues
+#
+set -- $(mqueue_counters)
+BEFORE_ENQUEUE=${1:-0}; BEFORE_CONTENTION=${2:-0}
+BEFORE_SLEEP=${3:-0}; BEFORE_OVERFLOW=${4:-0}
+TPS=$(pgbench -n -c $BENCH_CLIENTS -j $BENCH_CLIENTS -T $BENCH_DURATION \
+			  -f $BENCH_DIR/mqueue.sql 2>/dev/null \
+		  | sed -n 's/^tps = \([0-9.]*\) (excluding.*$/\1/p')
+set -- $(mqueue_counters)
+printf '{"commit" : "%s", "bench" : "mqueue_concurrent", "clients" : %d, "duration_sec" : %d, "tps" : %s, "enqueue" : %d, "contention" : %d, "sleep" : %d, "overflow" : %d}\n' \
+	$BENCH_COMMIT $BENCH_CLIENTS $BENCH_DURATION ${TPS:-0} \
+	$((${1:-0} - BEFORE_ENQUEUE)) $((${2:-0} - BEFORE_CONTENTION)) \
+	$((${3:-0} - BEFORE_SLEEP)) $((${4:-0} - BEFORE_OVERFLOW)) \
+	>> $BENCH_OUTPUT
+
+# cluster-wide statistics during the benchmark
+$PSQL -c "SELECT pgstrom_bench.stat()" >> $BENCH_OUTPUT
+
+echo "results were appended to $BENCH_OUTPUT"
@@ -0,0 +1,124 @@
+--
+-- setup.sql
+--
+-- Data generator and helper functions of the PG-Strom benchmark suite;
+-- run by run_bench.sh with psql variable 'scale' (number of rows).
+--
+DROP SCHEMA IF EXISTS pgstrom_bench CASCADE;
+CREATE SCHEMA pgstrom_bench;
+
+--
+-- t0 is the base relation of the workloads; a and b are uniformly
+-- distributed in [0, 100), so "a + b < 2.0" picks up 0.02% of rows
+-- and "a + b > 2.0" picks up almost all the rows.
+--
+CREATE TABLE pgstrom_bench.t0 (
+  id    int4,
+  a     float8,
+  b     float8,
+  c     int4,
+  d     text
+);
+INSERT INTO pgstrom_bench.t0
+  SELECT x, random() * 100.0, random() * 100.0,
+         (random() * 1000.0)::int4, md5(x::text)
+    FROM generate_series(1, :scale) x;
+VACUUM ANALYZE pgstrom_bench.t0;
+
+--
+-- find_perfmon
+--
+-- It walks on the plan tree of EXPLAIN (FORMAT JSON), then returns the
+-- first node that has counters of pgstrom_perfmon.
+--
+CREATE FUNCTION pgstrom_bench.find_perfmon(node json)
+  RETURNS json
+AS $$
+DECLARE
+  child   json;
+  found   json;
+BEGIN
+  IF node->>'Total time to load' IS NOT NULL THEN
+    RETURN node;
+  END IF;
+  IF node->'Plans' IS NOT NULL THEN
+    FOR child IN SELECT * FROM json_array_elements(node->'Plans') LOOP
+      found := pgstrom_bench.find_perfmon(child);
+      IF found IS NOT NULL THEN
+        RETURN found;
+      END IF;
+    END LOOP;
+  END IF;
+  RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+--
+-- run
+--
+-- It runs the supplied query using EXPLAIN ANALYZE, then returns a JSON
+-- record with rows/sec and breakdown of pgstrom_perfmon. Counters are
+-- converted to numbers; the key has "_ms" or "_pct" suffix according to
+-- the unit. pgstrom_bench.commit is set by run_bench.sh.
+--
+CREATE FUNCTION pgstrom_bench.run(bench text, query text)
+  RETURNS text
+AS $$
+DECLARE
+  plan        json;
+  node        json;
+  nrows       float8;
+  elapsed     float8;
+  perfmon     json;
+BEGIN
+  EXECUTE 'EXPLAIN (ANALYZE, FORMAT JSON) ' || query INTO plan;
+  plan := plan->0;
+  elapsed := COALESCE(plan->>'Execution Time',
+                      plan->>'Total Runtime')::float8;
+  node := pgstrom_bench.find_perfmon(plan->'Plan');
+  SELECT reltuples INTO nrows FROM pg_class
+   WHERE oid = 'pgstrom_bench.t0'::regclass;
+
+  SELECT json_object_agg(lower(replace(key, ' ', '_')) ||
+                         CASE WHEN value LIKE '% ms' THEN '_ms'
+                              WHEN value LIKE '%\%%' THEN '_pct'
+                              ELSE '' END,
+                         regexp_replace(value, '[^0-9.]', '', 'g')::float8)
+    INTO perfmon
+    FROM json_each_text(node)
+   WHERE value ~ '^[0-9.]+ ?(ms|%)$';
+
+  RETURN json_build_object(
+           'commit',        current_setting('pgstrom_bench.commit'),
+           'bench',         bench,
+           'rows_scanned',  nrows,
+           'rows_returned', (plan->'Plan'->>'Actual Rows')::int8,
+           'elapsed_ms',    elapsed,
+           'rows_per_sec',  nrows / NULLIF(elapsed, 0.0) * 1000.0,
+           'scan_mode',     node->>'Scan Mode',
+           'perfmon',       perfmon)::text;
+END;
+$$ LANGUAGE plpgsql;
+
+--
+-- stat
+--
+-- It returns the cluster-wide statistics being accumulated during the
+-- benchmark as JSON records.
+--
+CREATE FUNCTION pgstrom_bench.stat()
+  RETURNS SETOF text
+AS $$
+  SELECT json_build_object('commit', current_setting('pgstrom_bench.commit'),
+                           'bench', 'pg_stat_strom',
+                           'plan', plan,
+                           'dnum', dnum,
+                           'event', event,
+                           'samples', samples,
+                           'total_ms', total_time,
+                           'avg_ms', avg_time,
+                           'max_ms', max_time,
+                           'histogram', histogram)::text
+    FROM pg_stat_strom
+   ORDER BY plan, dnum, event;
+$$ LANGUAGE sql;
@@ -16,18 +16,25 @@
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "mb/pg_wchar.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/pg_list.h"
 #include "optimizer/clauses.h"
+#include "parser/analyze.h"
+#include "parser/parse_func.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
 #include "utils/inval.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#include "utils/pg_locale.h"
 #include "utils/syscache.h"
 #include "pg_strom.h"
 
 static MemoryContext	devinfo_memcxt;
 static List	   *devtype_info_slot[128];
 static List	   *devfunc_info_slot[1024];
+static List	   *devagg_info_slot[128];
 
 /*
  * Catalog of data types supported by device code
@@ -38,26 +45,28 @@ static List	   *devfunc_info_slot[1024];
 static struct {
 	Oid				type_oid;
 	const char	   *type_base;
-	bool			type_is_builtin;	/* true, if no need to redefine */
+	int				type_flags;	/* DEVTYPE_IS_BUILTIN, if no need to redefine,
+								 * and DEVFUNC_NEEDS_* of the library that
+								 * declares this type */
 } devtype_catalog[] = {
 	/* basic datatypes */
-	{ BOOLOID,			"cl_bool",	true },
-	{ INT2OID,			"cl_short",	false },
-	{ INT4OID,			"cl_int",	false },
-	{ INT8OID,			"cl_long",	false },
-	{ FLOAT4OID,		"cl_float",	false },
-	{ FLOAT8OID,		"cl_double",false },
+	{ BOOLOID,			"cl_bool",	DEVTYPE_IS_BUILTIN },
+	{ INT2OID,			"cl_short",	0 },
+	{ INT4OID,			"cl_int",	0 },
+	{ INT8OID,			"cl_long",	0 },
+	{ FLOAT4OID,		"cl_float",	0 },
+	{ FLOAT8OID,		"cl_double",0 },
 	/* date and time datatypes */
-	{ DATEOID,			"cl_int",	false },
-	{ TIMEOID,			"cl_long",	false },
-	{ TIMESTAMPOID,		"cl_long",	false },
-	{ TIMESTAMPTZOID,	"cl_long",	false },
+	{ DATEOID,			"cl_int",	0 },
+	{ TIMEOID,			"cl_long",	0 },
+	{ TIMESTAMPOID,		"cl_long",	0 },
+	{ TIMESTAMPTZOID,	"cl_long",	0 },
 	/* variable length datatypes */
-	{ BPCHAROID,		"varlena",	false },
-	{ VARCHAROID,		"varlena",	false },
-	{ NUMERICOID,		"varlena",	false },
-	{ BYTEAOID,			"varlena",	false },
-	{ TEXTOID,			"varlena",	false },
+	{ BPCHAROID,		"varlena",	DEVTYPE_IS_BUILTIN | DEVFUNC_NEEDS_TEXTLIB },
+	{ VARCHAROID,		"varlena",	DEVTYPE_IS_BUILTIN | DEVFUNC_NEEDS_TEXTLIB },
+	{ NUMERICOID,		"varlena",	DEVTYPE_IS_BUILTIN | DEVFUNC_NEEDS_NUMERICLIB },
+	{ BYTEAOID,			"varlena",	0 },
+	{ TEXTOID,			"varlena",	DEVTYPE_IS_BUILTIN | DEVFUNC_NEEDS_TEXTLIB },
 };
 
 static void
@@ -158,15 +167,14 @@ pgstrom_devtype_lookup(Oid type_oid)
 			entry->type_name = pstrdup(NameStr(typeform->typname));
 			entry->type_base = pstrdup(devtype_catalog[i].type_base);
 			if (entry->type_flags & DEVTYPE_IS_VARLENA)
+				decl = psprintf("STROMCL_VARLENA_TYPE_TEMPLATE(%s)",
+								entry->type_name);
+			else
 				decl = psprintf("STROMCL_SIMPLE_TYPE_TEMPLATE(%s,%s)",
 								entry->type_name,
 								devtype_catalog[i].type_base);
-			else
-				decl = psprintf("STROMCL_VRALENA_TYPE_TEMPLATE(%s)",
-								entry->type_name);
 			entry->type_decl = decl;
-			if (devtype_catalog[i].type_is_builtin)
-				entry->type_flags |= DEVTYPE_IS_BUILTIN;
+			entry->type_flags |= devtype_catalog[i].type_flags;
 			break;
 		}
 		if (i == lengthof(devtype_catalog))
@@ -204,6 +212,10 @@ pgstrom_devtype_lookup(Oid type_oid)
  * One thing we need to pay attention is namespace of SQL functions.
  * Right now, we support only built-in functions installed in pg_catalog
  * namespace, so we don't put special qualification here.
+ * Functions of the text and numeric libraries take a pointer to the error
+ * code of the row on the first argument, to mark the row to be rechecked
+ * on the host side if the device cannot run the function exactly; like
+ * compressed varlena or numeric overflow.
  */
 typedef struct devfunc_catalog_t {
 	const char *func_name;
@@ -212,12 +224,17 @@ typedef struct devfunc_catalog_t {
 	const char *func_template;	/* a template string if simple function */
 	void	  (*func_callback)(devfunc_info *dfunc,
 							   struct devfunc_catalog_t *procat);
+	int			func_flags;		/* extra DEVFUNC_* flags, if any */
 } devfunc_catalog_t;
 
 static void devfunc_setup_div_oper(devfunc_info *entry,
 								   devfunc_catalog_t *procat);
 static void devfunc_setup_const(devfunc_info *entry,
 								devfunc_catalog_t *procat);
+static void devfunc_setup_numeric_cast(devfunc_info *entry,
+									   devfunc_catalog_t *procat);
+static void devfunc_setup_like(devfunc_info *entry,
+							   devfunc_catalog_t *procat);
 
 static devfunc_catalog_t devfunc_common_catalog[] = {
 	/* Type cast functions */
@@ -502,26 +519,29 @@ static devfunc_catalog_t devfunc_common_catalog[] = {
 
 static devfunc_catalog_t devfunc_numericlib_catalog[] = {
 	/* Type cast functions */
-	{ "int2",    1, {NUMERICOID}, "F:numeric_int2",   NULL },
-	{ "int4",    1, {NUMERICOID}, "F:numeric_int4",   NULL },
-	{ "int8",    1, {NUMERICOID}, "F:numeric_int8",   NULL },
-	{ "float4",  1, {NUMERICOID}, "F:numeric_float4", NULL },
-	{ "float8",  1, {NUMERICOID}, "F:numeric_float8", NULL },
+	{ "int2",    1, {NUMERICOID}, "F:numeric_int2",   devfunc_setup_numeric_cast },
+	{ "int4",    1, {NUMERICOID}, "F:numeric_int4",   devfunc_setup_numeric_cast },
+	{ "int8",    1, {NUMERICOID}, "F:numeric_int8",   devfunc_setup_numeric_cast },
+	{ "float4",  1, {NUMERICOID}, "F:numeric_float4", devfunc_setup_numeric_cast },
+	{ "float8",  1, {NUMERICOID}, "F:numeric_float8", devfunc_setup_numeric_cast },
+	{ "numeric", 1, {INT2OID},    "F:int2_numeric",   devfunc_setup_numeric_cast },
+	{ "numeric", 1, {INT4OID},    "F:int4_numeric",   devfunc_setup_numeric_cast },
+	{ "numeric", 1, {INT8OID},    "F:int8_numeric",   devfunc_setup_numeric_cast },
 	/* numeric operators */
-#if 0
-	/*
-	 * Right now, functions that return variable-length field are not
-	 * supported.
-	 */
 	{ "numeric_add", 2, {NUMERICOID, NUMERICOID}, "F:numeric_add", NULL },
 	{ "numeric_sub", 2, {NUMERICOID, NUMERICOID}, "F:numeric_sub", NULL },
 	{ "numeric_mul", 2, {NUMERICOID, NUMERICOID}, "F:numeric_mul", NULL },
-	{ "numeric_div", 2, {NUMERICOID, NUMERICOID}, "F:numeric_div", NULL },
-	{ "numeric_mod", 2, {NUMERICOID, NUMERICOID}, "F:numeric_mod", NULL },
-	{ "numeric_power", 2,{NUMERICOID, NUMERICOID},"F:numeric_power", NULL},
 	{ "numeric_uplus",  1, {NUMERICOID}, "F:numeric_uplus", NULL },
 	{ "numeric_uminus", 1, {NUMERICOID}, "F:numeric_uminus", NULL },
 	{ "numeric_abs",    1, {NUMERICOID}, "F:numeric_abs", NULL },
+#if 0
+	/*
+	 * Right now, display scale of division and power are not supported
+	 * because select_div_scale() is not implemented on the device.
+	 */
+	{ "numeric_div", 2, {NUMERICOID, NUMERICOID}, "F:numeric_div", NULL },
+	{ "numeric_mod", 2, {NUMERICOID, NUMERICOID}, "F:numeric_mod", NULL },
+	{ "numeric_power", 2,{NUMERICOID, NUMERICOID},"F:numeric_power", NULL},
 #endif
 	{ "numeric_eq", 2, {NUMERICOID, NUMERICOID}, "F:numeric_eq", NULL },
 	{ "numeric_ne", 2, {NUMERICOID, NUMERICOID}, "F:numeric_ne", NULL },
@@ -572,19 +592,40 @@ static devfunc_catalog_t devfunc_timelib_catalog[] = {
 	{ "timestamp_ge", 2, {TIMESTAMPOID, TIMESTAMPOID}, "F:timestamp_ge", NULL},
 };
 
+/*
+ * Device code of text functions has no locale support, so the functions
+ * depending on the collation are available only if "C" collation is used.
+ */
 static devfunc_catalog_t devfunc_textlib_catalog[] = {
 	{ "bpchareq", 2, {BPCHAROID,BPCHAROID}, "F:bpchareq", NULL },
 	{ "bpcharne", 2, {BPCHAROID,BPCHAROID}, "F:bpcharne", NULL },
-	{ "bpcharlt", 2, {BPCHAROID,BPCHAROID}, "F:bpcharlt", NULL },
-	{ "bpcharle", 2, {BPCHAROID,BPCHAROID}, "F:bpcharle", NULL },
-	{ "bpchargt", 2, {BPCHAROID,BPCHAROID}, "F:bpchargt", NULL },
-	{ "bpcharge", 2, {BPCHAROID,BPCHAROID}, "F:bpcharge", NULL },
+	{ "bpcharlt", 2, {BPCHAROID,BPCHAROID}, "F:bpcharlt", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
+	{ "bpcharle", 2, {BPCHAROID,BPCHAROID}, "F:bpcharle", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
+	{ "bpchargt", 2, {BPCHAROID,BPCHAROID}, "F:bpchargt", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
+	{ "bpcharge", 2, {BPCHAROID,BPCHAROID}, "F:bpcharge", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
 	{ "texteq", 2, {TEXTOID, TEXTOID}, "F:texteq", NULL  },
 	{ "textne", 2, {TEXTOID, TEXTOID}, "F:textne", NULL  },
-	{ "textlt", 2, {TEXTOID, TEXTOID}, "F:textlt", NULL  },
-	{ "textle", 2, {TEXTOID, TEXTOID}, "F:textle", NULL  },
-	{ "textgt", 2, {TEXTOID, TEXTOID}, "F:textgt", NULL  },
-	{ "textge", 2, {TEXTOID, TEXTOID}, "F:textge", NULL  },
+	{ "textlt", 2, {TEXTOID, TEXTOID}, "F:textlt", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
+	{ "textle", 2, {TEXTOID, TEXTOID}, "F:textle", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
+	{ "textgt", 2, {TEXTOID, TEXTOID}, "F:textgt", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
+	{ "textge", 2, {TEXTOID, TEXTOID}, "F:textge", NULL,
+	  DEVFUNC_NEEDS_COLLATE_C },
+	/* LIKE and ILIKE operators */
+	{ "textlike",    2, {TEXTOID, TEXTOID}, "F:textlike",
+	  devfunc_setup_like },
+	{ "textnlike",   2, {TEXTOID, TEXTOID}, "F:textnlike",
+	  devfunc_setup_like },
+	{ "texticlike",  2, {TEXTOID, TEXTOID}, "F:texticlike",
+	  devfunc_setup_like, DEVFUNC_NEEDS_COLLATE_C },
+	{ "texticnlike", 2, {TEXTOID, TEXTOID}, "F:texticnlike",
+	  devfunc_setup_like, DEVFUNC_NEEDS_COLLATE_C },
 };
 
 static void
@@ -639,6 +680,71 @@ devfunc_setup_const(devfunc_info *entry, devfunc_catalog_t *procat)
 				   procat->func_template);
 }
 
+/*
+ * devfunc_setup_numeric_cast
+ *
+ * Cast between numeric and other types are constructed on top of the
+ * helper functions of numeric library, because the other types are
+ * declared in the kernel source but the library is not.
+ */
+static void
+devfunc_setup_numeric_cast(devfunc_info *entry, devfunc_catalog_t *procat)
+{
+	devtype_info   *dtype = linitial(entry->func_args);
+	devtype_info   *rtype = entry->func_rettype;
+
+	Assert(procat->func_nargs == 1);
+	entry->func_name = pstrdup(procat->func_template + 2);
+	if (rtype->type_oid == NUMERICOID)
+		entry->func_decl
+			= psprintf("static pg_numeric_t\n"
+					   "pgfn_%s(__private cl_int *errcode, pg_%s_t arg)\n"
+					   "{\n"
+					   "    pg_numeric_t result;\n"
+					   "    result.value  = (cl_long)arg.value;\n"
+					   "    result.scale  = 0;\n"
+					   "    result.isnull = arg.isnull;\n"
+					   "    return result;\n"
+					   "}\n",
+					   entry->func_name,
+					   dtype->type_name);
+	else
+		entry->func_decl
+			= psprintf("static pg_%s_t\n"
+					   "pgfn_%s(__private cl_int *errcode, pg_numeric_t arg)\n"
+					   "{\n"
+					   "    pg_%s_t result;\n"
+					   "    result.isnull = arg.isnull;\n"
+					   "    if (!result.isnull)\n"
+					   "        result.value = numeric_to_%s(errcode, arg,\n"
+					   "                                     &result.isnull);\n"
+					   "    return result;\n"
+					   "}\n",
+					   rtype->type_name,
+					   entry->func_name,
+					   rtype->type_name,
+					   rtype->type_name);
+}
+
+/*
+ * devfunc_setup_like
+ *
+ * '_' of LIKE pattern matches a character, not a byte. Device code knows
+ * UTF-8 and single byte encodings only, so LIKE is not available on the
+ * other multibyte encodings.
+ */
+static void
+devfunc_setup_like(devfunc_info *entry, devfunc_catalog_t *procat)
+{
+	int		encoding = GetDatabaseEncoding();
+
+	if (encoding != PG_UTF8 && pg_database_encoding_max_length() > 1)
+		entry->func_flags = DEVINFO_IS_NEGATIVE;
+	else
+		entry->func_name = psprintf("%s%s", procat->func_template + 2,
+									encoding == PG_UTF8 ? "_utf8" : "");
+}
+
 static void
 devfunc_setup_cast(devfunc_info *entry, devfunc_catalog_t *procat)
 {
@@ -879,13 +985,13 @@ pgstrom_devfunc_lookup_by_name(const char *func_name,
 			  0 },
 			{ devfunc_numericlib_catalog,
 			  lengthof(devfunc_numericlib_catalog),
-			  DEVFUNC_NEEDS_NUMERICLIB },
+			  DEVFUNC_NEEDS_NUMERICLIB | DEVFUNC_NEEDS_ERRCODE },
 			{ devfunc_timelib_catalog,
 			  lengthof(devfunc_timelib_catalog),
 			  DEVFUNC_NEEDS_TIMELIB },
 			{ devfunc_textlib_catalog,
 			  lengthof(devfunc_textlib_catalog),
-			  DEVFUNC_NEEDS_TEXTLIB },
+			  DEVFUNC_NEEDS_TEXTLIB | DEVFUNC_NEEDS_ERRCODE },
 		};
 
 		for (i=0; i < lengthof(catalog_array); i++)
@@ -900,14 +1006,14 @@ pgstrom_devfunc_lookup_by_name(const char *func_name,
 					memcmp(procat->func_argtypes, func_argtypes,
 						   sizeof(Oid) * func_nargs) == 0)
 				{
-					entry->func_flags = flags;
+					entry->func_flags = flags | procat->func_flags;
 					entry->func_rettype = pgstrom_devtype_lookup(func_rettype);
 					Assert(entry->func_rettype != NULL);
 
 					for (k=0; k < func_nargs; k++)
 					{
 						devtype_info   *dtype
-							= pgstrom_devtype_lookup(func_argtypes[i]);
+							= pgstrom_devtype_lookup(func_argtypes[k]);
 						Assert(dtype != NULL);
 						entry->func_args = lappend(entry->func_args, dtype);
 					}
@@ -966,6 +1072,189 @@ pgstrom_devfunc_lookup(Oid func_oid)
 	return dfunc;
 }
 
+/*
+ * Catalog of aggregate functions supported by device code
+ *
+ * Device does not run the aggregate functions by itself. It computes a
+ * partial result per group per chunk, then host side combines the partial
+ * results with another aggregate function. A partial result is represented
+ * as a placeholder function call of pgstrom_pcount, pgstrom_psum, pgstrom_pmin
+ * or pgstrom_pmax, installed in the extension, in the target list of the
+ * GpuPreAgg node; they are never called on the host side.
+ * Aggregate to combine the partial results has to return the same data type
+ * with the original aggregate function.
+ */
+static struct {
+	const char *agg_name;
+	Oid			agg_argtype;	/* InvalidOid, if no arguments */
+	int			agg_kind;		/* one of DEVAGG_* */
+	const char *partial_func;	/* function to represent partial result */
+	Oid			partial_argtype;
+	const char *final_agg;		/* aggregate to combine partial results */
+	Oid			final_argtype;
+} devagg_catalog[] = {
+	/* COUNT(*), COUNT(X) */
+	{ "count", InvalidOid,   DEVAGG_PCOUNT,
+	  "pgstrom_pcount", InvalidOid,   "pgstrom_count", INT8OID },
+	{ "count", ANYOID,       DEVAGG_PCOUNT,
+	  "pgstrom_pcount", ANYOID,       "pgstrom_count", INT8OID },
+	/* SUM(X) */
+	{ "sum",   INT2OID,      DEVAGG_PSUM,
+	  "pgstrom_psum",   INT2OID,      "pgstrom_sum",   INT8OID },
+	{ "sum",   INT4OID,      DEVAGG_PSUM,
+	  "pgstrom_psum",   INT4OID,      "pgstrom_sum",   INT8OID },
+	{ "sum",   FLOAT4OID,    DEVAGG_PSUM,
+	  "pgstrom_psum",   FLOAT4OID,    "pg_catalog.sum", FLOAT4OID },
+	{ "sum",   FLOAT8OID,    DEVAGG_PSUM,
+	  "pgstrom_psum",   FLOAT8OID,    "pg_catalog.sum", FLOAT8OID },
+	/* MIN(X) */
+	{ "min",   INT2OID,      DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", INT2OID },
+	{ "min",   INT4OID,      DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", INT4OID },
+	{ "min",   INT8OID,      DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", INT8OID },
+	{ "min",   FLOAT4OID,    DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", FLOAT4OID },
+	{ "min",   FLOAT8OID,    DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", FLOAT8OID },
+	{ "min",   DATEOID,      DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", DATEOID },
+#ifdef HAVE_INT64_TIMESTAMP
+	{ "min",   TIMEOID,      DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", TIMEOID },
+	{ "min",   TIMESTAMPOID, DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", TIMESTAMPOID },
+	{ "min",   TIMESTAMPTZOID, DEVAGG_PMIN,
+	  "pgstrom_pmin",   ANYELEMENTOID, "pg_catalog.min", TIMESTAMPTZOID },
+#endif
+	/* MAX(X) */
+	{ "max",   INT2OID,      DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", INT2OID },
+	{ "max",   INT4OID,      DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", INT4OID },
+	{ "max",   INT8OID,      DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", INT8OID },
+	{ "max",   FLOAT4OID,    DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", FLOAT4OID },
+	{ "max",   FLOAT8OID,    DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", FLOAT8OID },
+	{ "max",   DATEOID,      DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", DATEOID },
+#ifdef HAVE_INT64_TIMESTAMP
+	{ "max",   TIMEOID,      DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", TIMEOID },
+	{ "max",   TIMESTAMPOID, DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", TIMESTAMPOID },
+	{ "max",   TIMESTAMPTZOID, DEVAGG_PMAX,
+	  "pgstrom_pmax",   ANYELEMENTOID, "pg_catalog.max", TIMESTAMPTZOID },
+#endif
+};
+
+devagg_info *
+pgstrom_devagg_lookup(Oid agg_oid)
+{
+	devagg_info	   *entry;
+	ListCell	   *cell;
+	HeapTuple		tuple;
+	Form_pg_proc	proc;
+	MemoryContext	oldcxt;
+	int				i, hash;
+
+	hash = hash_uint32((uint32) agg_oid) % lengthof(devagg_info_slot);
+	foreach (cell, devagg_info_slot[hash])
+	{
+		entry = lfirst(cell);
+		if (entry->agg_oid == agg_oid)
+		{
+			if (entry->agg_flags & DEVINFO_IS_NEGATIVE)
+				return NULL;
+			return entry;
+		}
+	}
+
+	/*
+	 * Not found, insert a new entry
+	 */
+	tuple = SearchSysCache1(PROCOID, ObjectIdGetDatum(agg_oid));
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for function %u", agg_oid);
+	proc = (Form_pg_proc) GETSTRUCT(tuple);
+
+	oldcxt = MemoryContextSwitchTo(devinfo_memcxt);
+
+	entry = palloc0(sizeof(devagg_info));
+	entry->agg_oid = agg_oid;
+	entry->agg_flags = DEVINFO_IS_NEGATIVE;
+
+	if (proc->proisagg &&
+		proc->pronamespace == PG_CATALOG_NAMESPACE &&
+		proc->pronargs <= 1)
+	{
+		for (i=0; i < lengthof(devagg_catalog); i++)
+		{
+			Oid		partial_func;
+			Oid		final_agg;
+			Oid		argtype;
+
+			if (strcmp(devagg_catalog[i].agg_name,
+					   NameStr(proc->proname)) != 0)
+				continue;
+			if (proc->pronargs == 0
+				? OidIsValid(devagg_catalog[i].agg_argtype)
+				: devagg_catalog[i].agg_argtype != proc->proargtypes.values[0])
+				continue;
+
+			/*
+			 * Device type of the argument; ANY means the argument type is
+			 * checked by the caller.
+			 */
+			argtype = devagg_catalog[i].agg_argtype;
+			if (OidIsValid(argtype) && argtype != ANYOID)
+			{
+				entry->agg_argtype = pgstrom_devtype_lookup(argtype);
+				if (!entry->agg_argtype)
+					break;
+			}
+
+			/*
+			 * Partial and final functions are installed by the extension,
+			 * so they may not exist in this database.
+			 */
+			argtype = devagg_catalog[i].partial_argtype;
+			partial_func = LookupFuncName(
+				stringToQualifiedNameList(devagg_catalog[i].partial_func),
+				OidIsValid(argtype) ? 1 : 0, &argtype, true);
+			argtype = devagg_catalog[i].final_argtype;
+			final_agg = LookupFuncName(
+				stringToQualifiedNameList(devagg_catalog[i].final_agg),
+				1, &argtype, true);
+			if (!OidIsValid(partial_func) || !OidIsValid(final_agg))
+				break;
+			if (get_func_rettype(final_agg) != proc->prorettype)
+				elog(ERROR, "aggregate %s has unexpected result type",
+					 format_procedure(final_agg));
+
+			entry->agg_kind = devagg_catalog[i].agg_kind;
+			entry->partial_type =
+				pgstrom_devtype_lookup(devagg_catalog[i].final_argtype);
+			Assert(entry->partial_type != NULL);
+			entry->partial_func = partial_func;
+			entry->final_agg = final_agg;
+			entry->agg_flags = 0;
+			break;
+		}
+	}
+	devagg_info_slot[hash] = lappend(devagg_info_slot[hash], entry);
+
+	MemoryContextSwitchTo(oldcxt);
+	ReleaseSysCache(tuple);
+
+	if (entry->agg_flags & DEVINFO_IS_NEGATIVE)
+		return NULL;
+	return entry;
+}
+
 typedef struct
 {
 	StringInfoData	str;
@@ -981,7 +1270,10 @@ devtype_lookup_and_track(Oid type_oid, codegen_walker_context *context)
 {
 	devtype_info   *dtype = pgstrom_devtype_lookup(type_oid);
 	if (dtype)
+	{
 		context->type_defs = list_append_unique_ptr(context->type_defs, dtype);
+		context->extra_flags |= (dtype->type_flags & DEVFUNC_INCL_FLAGS);
+	}
 	return dtype;
 }
 
@@ -991,12 +1283,75 @@ devfunc_lookup_and_track(Oid func_oid, codegen_walker_context *context)
 	devfunc_info   *dfunc = pgstrom_devfunc_lookup(func_oid);
 	if (dfunc)
 	{
+		ListCell   *cell;
+
 		context->func_defs = list_append_unique_ptr(context->func_defs, dfunc);
 		context->extra_flags |= (dfunc->func_flags & DEVFUNC_INCL_FLAGS);
+		/* declaration of the function references these types */
+		devtype_lookup_and_track(dfunc->func_rettype->type_oid, context);
+		foreach (cell, dfunc->func_args)
+		{
+			devtype_info   *dtype = lfirst(cell);
+
+			devtype_lookup_and_track(dtype->type_oid, context);
+		}
 	}
 	return dfunc;
 }
 
+/*
+ * devfunc_collation_supported
+ *
+ * Device code has no locale support, so functions that depend on the
+ * collation are available only if LC_COLLATE and LC_CTYPE are "C".
+ * Elsewhere, the input collation does not affect the result.
+ */
+static bool
+devfunc_collation_supported(devfunc_info *dfunc, Oid collid)
+{
+	if (!OidIsValid(collid) ||
+		(dfunc->func_flags & DEVFUNC_NEEDS_COLLATE_C) == 0)
+		return true;
+	return lc_collate_is_c(collid) && lc_ctype_is_c(collid);
+}
+
+/*
+ * devtype_binary_compatible
+ *
+ * RelabelType between the types with same device representation is
+ * a no-op on the device.
+ */
+static bool
+devtype_binary_compatible(Oid source_type, Oid target_type)
+{
+	return (source_type == target_type ||
+			(source_type == VARCHAROID && target_type == TEXTOID));
+}
+
+static bool codegen_expression_walker(Node *node,
+									  codegen_walker_context *context);
+
+static bool
+codegen_function_call(devfunc_info *dfunc, List *args,
+					  codegen_walker_context *context)
+{
+	ListCell   *cell;
+
+	appendStringInfo(&context->str, "pgfn_%s(", dfunc->func_name);
+	if (dfunc->func_flags & DEVFUNC_NEEDS_ERRCODE)
+		appendStringInfo(&context->str, "&errcode%s", args != NIL ? ", " : "");
+	foreach (cell, args)
+	{
+		if (cell != list_head(args))
+			appendStringInfo(&context->str, ", ");
+		if (!codegen_expression_walker(lfirst(cell), context))
+			return false;
+	}
+	appendStringInfoChar(&context->str, ')');
+
+	return true;
+}
+
 static bool
 codegen_expression_walker(Node *node, codegen_walker_context *context)
 {
@@ -1010,21 +1365,17 @@ codegen_expression_walker(Node *node, codegen_walker_context *context)
 	if (IsA(node, Const))
 	{
 		Const  *con = (Const *) node;
-		cl_uint	index = 0;
 
-		if (OidIsValid(con->constcollid) ||
-			!devtype_lookup_and_track(con->consttype, context))
+		if (!devtype_lookup_and_track(con->consttype, context))
 			return false;
 
-		foreach (cell, context->used_params)
-		{
-			if (equal(node, lfirst(cell)))
-			{
-				appendStringInfo(&context->str, "KPARAM_%u", index);
-				return true;
-			}
-			index++;
-		}
+		/*
+		 * Every Const node takes its own slot of kern_parambuf, even if
+		 * identical value already appeared, because the kernel source
+		 * has to depend on the shape of expression only, not the literal
+		 * values; it allows to reuse the device program being built for
+		 * the same kind of queries with different literals.
+		 */
 		context->used_params = lappend(context->used_params,
 									   copyObject(node));
 		appendStringInfo(&context->str, "KPARAM_%u",
@@ -1036,8 +1387,7 @@ codegen_expression_walker(Node *node, codegen_walker_context *context)
 		Param  *param = (Param *) node;
 		int		index = 0;
 
-		if (OidIsValid(param->paramcollid) ||
-			param->paramkind != PARAM_EXTERN ||
+		if (param->paramkind != PARAM_EXTERN ||
 			!devtype_lookup_and_track(param->paramtype, context))
 			return false;
 
@@ -1061,8 +1411,7 @@ codegen_expression_walker(Node *node, codegen_walker_context *context)
 		Var	   *var = (Var *) node;
 		cl_uint	index = 0;
 
-		if (OidIsValid(var->varcollid) ||
-			!devtype_lookup_and_track(var->vartype, context))
+		if (!devtype_lookup_and_track(var->vartype, context))
 			return false;
 
 		foreach (cell, context->used_vars)
@@ -1084,50 +1433,30 @@ codegen_expression_walker(Node *node, codegen_walker_context *context)
 	{
 		FuncExpr   *func = (FuncExpr *) node;
 
-		/* no collation support */
-		if (OidIsValid(func->funccollid) || OidIsValid(func->inputcollid))
-			Assert(false); //return false;
-
 		dfunc = devfunc_lookup_and_track(func->funcid, context);
-		if (!func)
+		if (!dfunc || !devfunc_collation_supported(dfunc, func->inputcollid))
 			return false;
-		appendStringInfo(&context->str, "pgfn_%s(", dfunc->func_name);
-
-		foreach (cell, func->args)
-		{
-			if (cell != list_head(func->args))
-				appendStringInfo(&context->str, ", ");
-			if (!codegen_expression_walker(lfirst(cell), context))
-				return false;
-		}
-		appendStringInfoChar(&context->str, ')');
-
-		return true;
+		return codegen_function_call(dfunc, func->args, context);
 	}
 	else if (IsA(node, OpExpr) ||
 			 IsA(node, DistinctExpr))
 	{
 		OpExpr	   *op = (OpExpr *) node;
 
-		/* no collation support */
-		if (OidIsValid(op->opcollid) || OidIsValid(op->inputcollid))
-			return false;
-
 		dfunc = devfunc_lookup_and_track(get_opcode(op->opno), context);
-		if (!dfunc)
+		if (!dfunc || !devfunc_collation_supported(dfunc, op->inputcollid))
 			return false;
-		appendStringInfo(&context->str, "pgfn_%s(", dfunc->func_name);
-
-		foreach (cell, op->args)
-		{
-			if (cell != list_head(op->args))
-				appendStringInfo(&context->str, ", ");
-			if (!codegen_expression_walker(lfirst(cell), context))
-				return false;
-		}
-		appendStringInfoChar(&context->str, ')');
+		return codegen_function_call(dfunc, op->args, context);
+	}
+	else if (IsA(node, RelabelType))
+	{
+		RelabelType *relabel = (RelabelType *) node;
 
-		return true;
+		if (!devtype_binary_compatible(exprType((Node *) relabel->arg),
+									   relabel->resulttype) ||
+			!devtype_lookup_and_track(relabel->resulttype, context))
+			return false;
+		return codegen_expression_walker((Node *) relabel->arg, context);
 	}
 	else if (IsA(node, NullTest))
 	{
@@ -1293,6 +1622,324 @@ pgstrom_codegen_expression(Node *expr, codegen_context *context)
 	return walker_context.str.data;
 }
 
+/*
+ * Vectorized expression support
+ *
+ * A simple qualifier - an AND list of comparison on the fixed-length
+ * columns, parameters and arithmetic operators on them - can be evaluated
+ * on a vector of PGSTROM_VECTOR_WIDTH rows at once, on the devices that
+ * prefer vector types. Every operator here is strict and has no error
+ * path, so a row passes the qualifier iff all the comparisons are true
+ * and all the referenced values are not null. It allows to evaluate
+ * null-bitmaps by bitwise operation, apart from the vectorized values.
+ */
+typedef struct
+{
+	StringInfoData	str;
+	StringInfoData	decl;		/* declarations of vector variables */
+	codegen_context *context;	/* used_vars/used_params being built */
+	Bitmapset	   *vars_decl;	/* index of used_vars being declared */
+	Bitmapset	   *params_decl;/* index of used_params being declared */
+	int				num_consts;	/* number of Const nodes being walked */
+} codegen_vector_context;
+
+/*
+ * devtype_vector_base
+ *
+ * It returns name of the OpenCL built-in type to construct vector type
+ * of the supplied device type, or NULL if not supported.
+ */
+static const char *
+devtype_vector_base(devtype_info *dtype)
+{
+	if ((dtype->type_flags & DEVTYPE_IS_VARLENA) != 0)
+		return NULL;
+	if (strcmp(dtype->type_base, "cl_short") == 0)
+		return "short";
+	if (strcmp(dtype->type_base, "cl_int") == 0)
+		return "int";
+	if (strcmp(dtype->type_base, "cl_long") == 0)
+		return "long";
+	if (strcmp(dtype->type_base, "cl_float") == 0)
+		return "float";
+	if (strcmp(dtype->type_base, "cl_double") == 0)
+		return "double";
+	return NULL;
+}
+
+/*
+ * devfunc_vector_operator
+ *
+ * It returns the operator of the supplied function if it is a simple binary
+ * operator between same types being available on vector types.
+ */
+static const char *
+devfunc_vector_operator(devfunc_info *dfunc)
+{
+	static const char *vector_opers[] = {
+		"+", "-", "*", "<", "<=", ">", ">=", "==", "!=",
+	};
+	devtype_info   *dtype1;
+	devtype_info   *dtype2;
+	int				i, j;
+
+	if (list_length(dfunc->func_args) != 2)
+		return NULL;
+	dtype1 = linitial(dfunc->func_args);
+	dtype2 = lsecond(dfunc->func_args);
+	if (dtype1 != dtype2 || !devtype_vector_base(dtype1))
+		return NULL;
+
+	for (i=0; i < lengthof(devfunc_common_catalog); i++)
+	{
+		devfunc_catalog_t  *procat = devfunc_common_catalog + i;
+
+		if (strcmp(procat->func_name, dfunc->func_name) != 0 ||
+			procat->func_nargs != 2 ||
+			procat->func_argtypes[0] != dtype1->type_oid ||
+			procat->func_argtypes[1] != dtype2->type_oid ||
+			strncmp(procat->func_template, "b:", 2) != 0)
+			continue;
+
+		for (j=0; j < lengthof(vector_opers); j++)
+		{
+			if (strcmp(procat->func_template + 2, vector_opers[j]) == 0)
+				return vector_opers[j];
+		}
+		break;
+	}
+	return NULL;
+}
+
+static devtype_info *
+codegen_vector_walker(Node *node, codegen_vector_context *vcontext)
+{
+	codegen_context *context = vcontext->context;
+	devtype_info   *dtype;
+	devtype_info   *dtype1;
+	devtype_info   *dtype2;
+	devfunc_info   *dfunc;
+	const char	   *oper;
+	ListCell	   *cell;
+	int				index;
+
+	if (IsA(node, Const) || IsA(node, Param))
+	{
+		Oid		type_oid = exprType(node);
+
+		if (IsA(node, Const) && ((Const *) node)->constisnull)
+			return NULL;
+		dtype = pgstrom_devtype_lookup(type_oid);
+		if (!dtype || !devtype_vector_base(dtype))
+			return NULL;
+
+		/*
+		 * Const nodes are not unified by the scalar version, so n-th Const
+		 * node being walked is the n-th Const of used_params, because both
+		 * versions walk on the same expression in same order.
+		 */
+		index = 0;
+		if (IsA(node, Const))
+		{
+			int		nconsts = 0;
+
+			foreach (cell, context->used_params)
+			{
+				if (IsA(lfirst(cell), Const) &&
+					nconsts++ == vcontext->num_consts)
+					break;
+				index++;
+			}
+			vcontext->num_consts++;
+		}
+		else
+		{
+			foreach (cell, context->used_params)
+			{
+				if (equal(node, lfirst(cell)))
+					break;
+				index++;
+			}
+		}
+		if (!cell)
+			return NULL;	/* should be tracked by scalar version */
+		Assert(equal(node, lfirst(cell)));
+
+		if (!bms_is_member(index, vcontext->params_decl))
+		{
+			appendStringInfo(&vcontext->decl,
+							 "  VECTYPE(%s) kvparam_%u = "
+							 "pg_%s_vecparam(kparams,%u,&mask);\n",
+							 devtype_vector_base(dtype), index,
+							 dtype->type_name, index);
+			vcontext->params_decl = bms_add_member(vcontext->params_decl,
+												   index);
+		}
+		appendStringInfo(&vcontext->str, "kvparam_%u", index);
+		return dtype;
+	}
+	else if (IsA(node, Var))
+	{
+		dtype = pgstrom_devtype_lookup(((Var *) node)->vartype);
+		if (!dtype || !devtype_vector_base(dtype))
+			return NULL;
+
+		index = 0;
+		foreach (cell, context->used_vars)
+		{
+			if (equal(node, lfirst(cell)))
+				break;
+			index++;
+		}
+		if (!cell)
+			return NULL;	/* should be tracked by scalar version */
+
+		if (!bms_is_member(index, vcontext->vars_decl))
+		{
+			appendStringInfo(&vcontext->decl,
+							 "  VECTYPE(%s) kvvar_%u = "
+							 "pg_%s_vecref(kcs,%u,base,&mask);\n",
+							 devtype_vector_base(dtype), index,
+							 dtype->type_name, index);
+			vcontext->vars_decl = bms_add_member(vcontext->vars_decl, index);
+		}
+		appendStringInfo(&vcontext->str, "kvvar_%u", index);
+		return dtype;
+	}
+	else if (IsA(node, OpExpr))
+	{
+		OpExpr	   *op = (OpExpr *) node;
+
+		if (OidIsValid(op->opcollid) || OidIsValid(op->inputcollid) ||
+			list_length(op->args) != 2)
+			return NULL;
+
+		dfunc = pgstrom_devfunc_lookup(get_opcode(op->opno));
+		if (!dfunc || !(oper = devfunc_vector_operator(dfunc)))
+			return NULL;
+
+		appendStringInfoChar(&vcontext->str, '(');
+		dtype1 = codegen_vector_walker(linitial(op->args), vcontext);
+		if (!dtype1)
+			return NULL;
+		appendStringInfo(&vcontext->str, " %s ", oper);
+		dtype2 = codegen_vector_walker(lsecond(op->args), vcontext);
+		if (!dtype2)
+			return NULL;
+		appendStringInfoChar(&vcontext->str, ')');
+		Assert(dtype1 == dtype2);
+
+		return dfunc->func_rettype;
+	}
+	return NULL;
+}
+
+/*
+ * pgstrom_codegen_vector_expression
+ *
+ * It generates a block of code that evaluates the supplied qualifier on
+ * PGSTROM_VECTOR_WIDTH rows from 'base' of the column-store 'kcs', then
+ * clears the bits of 'mask' for rows being filtered. It returns NULL, if
+ * the qualifier is not a simple form to be vectorized.
+ * The supplied context has to be already set up by
+ * pgstrom_codegen_expression() with same expression, because vector
+ * version shares KVAR/KPARAM index with the scalar version.
+ */
+char *
+pgstrom_codegen_vector_expression(Node *expr, codegen_context *context)
+{
+	codegen_vector_context vcontext;
+	List	   *quals;
+	ListCell   *cell;
+	StringInfoData body;
+
+	if (IsA(expr, List))
+		quals = (List *) expr;
+	else if (and_clause(expr))
+		quals = ((BoolExpr *) expr)->args;
+	else
+		quals = list_make1(expr);
+
+	memset(&vcontext, 0, sizeof(codegen_vector_context));
+	initStringInfo(&vcontext.decl);
+	initStringInfo(&vcontext.str);
+	vcontext.context = context;
+	initStringInfo(&body);
+
+	foreach (cell, quals)
+	{
+		Node		   *qual = lfirst(cell);
+		devtype_info   *dtype;
+		const char	   *vbase;
+
+		/* each qualifier has to be a comparison on vector types */
+		if (!IsA(qual, OpExpr) || exprType(qual) != BOOLOID ||
+			list_length(((OpExpr *) qual)->args) != 2)
+			return NULL;
+		dtype = pgstrom_devtype_lookup(exprType(linitial(((OpExpr *)
+														  qual)->args)));
+		if (!dtype || !(vbase = devtype_vector_base(dtype)))
+			return NULL;
+
+		resetStringInfo(&vcontext.str);
+		if (!codegen_vector_walker(qual, &vcontext))
+			return NULL;
+		/* result of comparison is a vector of the signed integer */
+		appendStringInfo(&body, "  mask &= pg_vecmask_%s(%s);\n",
+						 (strcmp(vbase, "float") == 0 ? "int" :
+						  strcmp(vbase, "double") == 0 ? "long" : vbase),
+						 vcontext.str.data);
+	}
+	appendStringInfoString(&vcontext.decl, body.data);
+	pfree(body.data);
+
+	return vcontext.decl.data;
+}
+
+/*
+ * pgstrom_codegen_vector_test
+ *
+ * It returns the vectorized code of WHERE clause of the supplied query,
+ * or NULL if it is not a simple form to be vectorized. It is only used
+ * by the regression test, to check the code generator without devices.
+ */
+Datum
+pgstrom_codegen_vector_test_func(PG_FUNCTION_ARGS)
+{
+	char	   *query_string = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	List	   *raw_list;
+	Query	   *query;
+	List	   *quals;
+	ListCell   *cell;
+	codegen_context context;
+	char	   *vector_code;
+
+	raw_list = pg_parse_query(query_string);
+	if (list_length(raw_list) != 1)
+		elog(ERROR, "only one query is supported");
+	query = parse_analyze(linitial(raw_list), query_string, NULL, 0);
+	if (query->commandType != CMD_SELECT ||
+		!query->jointree || !query->jointree->quals)
+		elog(ERROR, "SELECT query with WHERE clause is required");
+
+	quals = make_ands_implicit((Expr *)
+							   eval_const_expressions(NULL,
+													  query->jointree->quals));
+	foreach (cell, quals)
+	{
+		if (!pgstrom_codegen_available_expression(lfirst(cell)))
+			PG_RETURN_NULL();
+	}
+	memset(&context, 0, sizeof(codegen_context));
+	pgstrom_codegen_expression((Node *) quals, &context);
+	vector_code = pgstrom_codegen_vector_expression((Node *) quals, &context);
+	if (!vector_code)
+		PG_RETURN_NULL();
+
+	PG_RETURN_TEXT_P(cstring_to_text(vector_code));
+}
+PG_FUNCTION_INFO_V1(pgstrom_codegen_vector_test_func);
+
 char *
 pgstrom_codegen_declarations(codegen_context *context)
 {
@@ -1309,6 +1956,9 @@ pgstrom_codegen_declarations(codegen_context *context)
 	{
 		dtype = lfirst(cell);
 
+		/* declared in the common header or libraries */
+		if (dtype->type_flags & DEVTYPE_IS_BUILTIN)
+			continue;
 		if (dtype->type_flags & DEVTYPE_IS_VARLENA)
 			appendStringInfo(&str, "STROMCL_VARLENA_TYPE_TEMPLATE(%s)\n",
 							 dtype->type_name);
@@ -1318,12 +1968,30 @@ pgstrom_codegen_declarations(codegen_context *context)
 	}
 	appendStringInfoChar(&str, '\n');
 
+	/* Put declarations of vector references, if vector kernel is built */
+	index = 0;
+	foreach (cell, context->type_defs)
+	{
+		const char *vbase = devtype_vector_base(lfirst(cell));
+
+		if (!vbase)
+			continue;
+		if (index++ == 0)
+			appendStringInfo(&str, "#ifdef PGSTROM_VECTOR_WIDTH\n");
+		appendStringInfo(&str, "STROMCL_SIMPLE_VECTOR_TEMPLATE(%s,%s)\n",
+						 ((devtype_info *) lfirst(cell))->type_name, vbase);
+	}
+	if (index > 0)
+		appendStringInfo(&str, "#endif\n\n");
+
 	/* Put declarations of device functions */
 	foreach (cell, context->func_defs)
 	{
 		dfunc = lfirst(cell);
 
-		appendStringInfo(&str, "%s\n", dfunc->func_decl);
+		/* functions of the libraries have no declaration here */
+		if (dfunc->func_decl)
+			appendStringInfo(&str, "%s\n", dfunc->func_decl);
 	}
 
 	/* Put param/const definitions */
@@ -1409,8 +2077,7 @@ pgstrom_codegen_available_expression(Expr *expr)
 	{
 		Const  *con = (Const *) expr;
 
-		if (OidIsValid(con->constcollid) ||
-			!pgstrom_devtype_lookup(con->consttype))
+		if (!pgstrom_devtype_lookup(con->consttype))
 			return false;
 		return true;
 	}
@@ -1418,8 +2085,7 @@ pgstrom_codegen_available_expression(Expr *expr)
 	{
 		Param  *param = (Param *) expr;
 
-		if (OidIsValid(param->paramcollid) ||
-			param->paramkind != PARAM_EXTERN ||
+		if (param->paramkind != PARAM_EXTERN ||
 			!pgstrom_devtype_lookup(param->paramtype))
 			return false;
 		return true;
@@ -1428,31 +2094,44 @@ pgstrom_codegen_available_expression(Expr *expr)
 	{
 		Var	   *var = (Var *) expr;
 
-		if (OidIsValid(var->varcollid) ||
-			!pgstrom_devtype_lookup(var->vartype))
+		if (!pgstrom_devtype_lookup(var->vartype))
 			return false;
 		return true;
 	}
 	else if (IsA(expr, FuncExpr))
 	{
 		FuncExpr   *func = (FuncExpr *) expr;
+		devfunc_info *dfunc = pgstrom_devfunc_lookup(func->funcid);
 
-		if (OidIsValid(func->funccollid) || OidIsValid(func->inputcollid))
-			return false;
-		if (!pgstrom_devfunc_lookup(func->funcid))
+		if (!dfunc || !devfunc_collation_supported(dfunc, func->inputcollid))
 			return false;
 		return pgstrom_codegen_available_expression((Expr *) func->args);
 	}
 	else if (IsA(expr, OpExpr) || IsA(expr, DistinctExpr))
 	{
 		OpExpr	   *op = (OpExpr *) expr;
+		devfunc_info *dfunc = pgstrom_devfunc_lookup(get_opcode(op->opno));
 
-		if (OidIsValid(op->opcollid) || OidIsValid(op->inputcollid))
-			return false;
-		if (!pgstrom_devfunc_lookup(get_opcode(op->opno)))
+		if (!dfunc || !devfunc_collation_supported(dfunc, op->inputcollid))
 			return false;
 		return pgstrom_codegen_available_expression((Expr *) op->args);
 	}
+	else if (IsA(expr, RelabelType))
+	{
+		RelabelType *relabel = (RelabelType *) expr;
+
+		if (!devtype_binary_compatible(exprType((Node *) relabel->arg),
+									   relabel->resulttype) ||
+			!pgstrom_devtype_lookup(relabel->resulttype))
+			return false;
+		return pgstrom_codegen_available_expression(relabel->arg);
+	}
+	else if (IsA(expr, BoolExpr))
+	{
+		BoolExpr   *b = (BoolExpr *) expr;
+
+		return pgstrom_codegen_available_expression((Expr *) b->args);
+	}
 	else if (IsA(expr, NullTest))
 	{
 		NullTest   *nulltest = (NullTest *) expr;
@@ -1476,6 +2155,7 @@ codegen_cache_invalidator(Datum arg, int cacheid, uint32 hashvalue)
 	MemoryContextReset(devinfo_memcxt);
 	memset(devtype_info_slot, 0, sizeof(devtype_info_slot));
 	memset(devfunc_info_slot, 0, sizeof(devfunc_info_slot));
+	memset(devagg_info_slot, 0, sizeof(devagg_info_slot));
 }
 
 void
@@ -1483,10 +2163,11 @@ pgstrom_codegen_init(void)
 {
 	memset(devtype_info_slot, 0, sizeof(devtype_info_slot));
 	memset(devfunc_info_slot, 0, sizeof(devfunc_info_slot));
+	memset(devagg_info_slot, 0, sizeof(devagg_info_slot));
 
 	/* create a memory context */
 	devinfo_memcxt = AllocSetContextCreate(CacheMemoryContext,
-										   "device type/func info cache",
+										   "device type/func/agg info cache",
 										   ALLOCSET_DEFAULT_MINSIZE,
 										   ALLOCSET_DEFAULT_INITSIZE,
 										   ALLOCSET_DEFAULT_MAXSIZE);
@@ -13,6 +13,8 @@
  */
 #include "postgres.h"
 #include "access/relscan.h"
+#include "executor/executor.h"
+#include "storage/bufmgr.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
@@ -62,9 +64,14 @@ pgstrom_create_kern_parambuf(List *used_params,
 										   (char *)&con->constvalue,
 										   con->constlen);
 				else
-					appendBinaryStringInfo(&str,
-										   DatumGetPointer(con->constvalue),
-										   VARSIZE(con->constvalue));
+				{
+					/* device cannot handle compressed or toasted datum */
+					struct varlena *vl_val
+						= pg_detoast_datum((struct varlena *)
+										   DatumGetPointer(con->constvalue));
+					appendBinaryStringInfo(&str, (char *)vl_val,
+										   VARSIZE(vl_val));
+				}
 			}
 		}
 		else if (IsA(node, Param))
@@ -81,21 +88,16 @@ pgstrom_create_kern_parambuf(List *used_params,
 				if (!OidIsValid(prm->ptype) && param_info->paramFetch != NULL)
 					(*param_info->paramFetch) (param_info, param->paramid);
 
-				kpbuf = (kern_parambuf *)str.data;
-				if (!OidIsValid(prm->ptype))
-				{
-					kpbuf->poffset[index] = 0;	/* null */
-					continue;
-				}
 				/* safety check in case hook did something unexpected */
-				if (prm->ptype != param->paramtype)
+				if (OidIsValid(prm->ptype) && prm->ptype != param->paramtype)
 					ereport(ERROR,
 							(errcode(ERRCODE_DATATYPE_MISMATCH),
 							 errmsg("type of parameter %d (%s) does not match that when preparing the plan (%s)",
 									param->paramid,
 									format_type_be(prm->ptype),
 									format_type_be(param->paramtype))));
-				if (prm->isnull)
+				kpbuf = (kern_parambuf *)str.data;
+				if (!OidIsValid(prm->ptype) || prm->isnull)
 					kpbuf->poffset[index] = 0;	/* null */
 				else
 				{
@@ -104,16 +106,26 @@ pgstrom_create_kern_parambuf(List *used_params,
 					if (typlen == 0)
 						elog(ERROR, "cache lookup failed for type %u",
 							 prm->ptype);
+					kpbuf->poffset[index] = str.len;
 					if (typlen > 0)
 						appendBinaryStringInfo(&str,
 											   (char *)&prm->value,
 											   typlen);
 					else
-						appendBinaryStringInfo(&str,
-											   DatumGetPointer(prm->value),
-											   VARSIZE(prm->value));
+					{
+						struct varlena *vl_val
+							= pg_detoast_datum((struct varlena *)
+											   DatumGetPointer(prm->value));
+						appendBinaryStringInfo(&str, (char *)vl_val,
+											   VARSIZE(vl_val));
+					}
 				}
 			}
+			else
+			{
+				kpbuf = (kern_parambuf *)str.data;
+				kpbuf->poffset[index] = 0;	/* null */
+			}
 		}
 		else
 			elog(ERROR, "unexpected node: %s", nodeToString(node));
@@ -135,11 +147,13 @@ pgstrom_create_kern_parambuf(List *used_params,
 /*
  * pgstrom_load_row_store_heap
  *
- * It creates a new row-store and loads tuples from the supplied heap.
+ * It creates a new row-store of 'rstore_size' bytes, and loads tuples from
+ * the supplied heap.
  */
 pgstrom_row_store *
 pgstrom_load_row_store_heap(HeapScanDesc scan,
 							ScanDirection direction,
+							Size rstore_size,
 							kern_colmeta *rs_colmeta,
 							kern_colmeta *cs_colmeta,
 							int cs_colnums,
@@ -152,14 +166,12 @@ pgstrom_load_row_store_heap(HeapScanDesc scan,
 	cl_uint		nrows;
 	cl_uint		usage_head;
 	cl_uint		usage_tail;
-	cl_uint		offset;
 	cl_uint	   *p_offset;
 	kern_column_store *kcs_head;
-	int			index;
 
 	Assert(direction != 0);
 
-	rstore = pgstrom_shmem_alloc(ROWSTORE_DEFAULT_SIZE);
+	rstore = pgstrom_shmem_alloc(rstore_size);
 	if (!rstore)
 		elog(ERROR, "out of shared memory");
 
@@ -171,7 +183,7 @@ pgstrom_load_row_store_heap(HeapScanDesc scan,
 	 */
 	rstore->stag = StromTag_RowStore;
 	rstore->kern.length
-		= STROMALIGN_DOWN(ROWSTORE_DEFAULT_SIZE -
+		= STROMALIGN_DOWN(rstore_size -
 						  STROMALIGN(offsetof(kern_column_store,
 											  colmeta[cs_colnums])) -
 						  offsetof(pgstrom_row_store, kern));
@@ -229,6 +241,152 @@ pgstrom_load_row_store_heap(HeapScanDesc scan,
 	 */
 	kcs_head = (kern_column_store *)((char *)(&rstore->kern) +
 									 rstore->kern.length);
+	pgstrom_setup_kern_colstore_head(kcs_head, cs_colmeta, cs_colnums, nrows);
+	rstore->kcs_head = kcs_head;
+	Assert(pgstrom_shmem_sanitycheck(rstore));
+	return rstore;
+}
+
+/*
+ * pgstrom_prefetch_row_store_heap
+ *
+ * It issues read-ahead towards the heap blocks to be loaded by the next
+ * pgstrom_load_row_store_heap(), so disk i/o is overlapped with the chunks
+ * being processed. '*p_prefetch' is the number of blocks already prefetched,
+ * counted from the starting block of the scan (that may not be zero, if
+ * synchronized scan), and 'distance' is read-ahead window in blocks.
+ */
+void
+pgstrom_prefetch_row_store_heap(HeapScanDesc scan,
+								ScanDirection direction,
+								BlockNumber *p_prefetch,
+								BlockNumber distance)
+{
+#ifdef USE_PREFETCH
+	BlockNumber	nblocks = scan->rs_nblocks;
+	BlockNumber	curr;
+	BlockNumber	limit;
+
+	/* read-ahead of backward scan is not supported right now */
+	if (!ScanDirectionIsForward(direction) || nblocks == 0 || distance == 0)
+		return;
+
+	if (!scan->rs_inited)
+		curr = 0;
+	else
+		curr = (scan->rs_cblock + nblocks - scan->rs_startblock) % nblocks;
+	limit = Min(curr + distance, nblocks);
+
+	if (*p_prefetch < curr)
+		*p_prefetch = curr;
+	while (*p_prefetch < limit)
+	{
+		PrefetchBuffer(scan->rs_rd, MAIN_FORKNUM,
+					   (scan->rs_startblock + *p_prefetch) % nblocks);
+		(*p_prefetch)++;
+	}
+#endif
+}
+
+/*
+ * pgstrom_load_row_store_tcache
+ *
+ * It creates a new row-store and copies the first 'nrows' tuples of the
+ * supplied tcache_row_store. Because tcache_row_store is constructed
+ * according to the cached columns, not the columns referenced by device
+ * qualifiers, we cannot hand it to the kernel as is. The caller has to
+ * take a snapshot of 'nrows' under tc_head->lock because tuples can be
+ * appended concurrently; the existing tuples are never moved.
+ */
+pgstrom_row_store *
+pgstrom_load_row_store_tcache(tcache_row_store *trs,
+							  cl_uint nrows,
+							  kern_colmeta *rs_colmeta,
+							  kern_colmeta *cs_colmeta,
+							  int cs_colnums)
+{
+	pgstrom_row_store *rstore;
+	AttrNumber	rs_ncols = trs->kern.ncols;
+	cl_uint		usage_head;
+	cl_uint		usage_tail;
+	cl_uint	   *p_offset;
+	kern_column_store *kcs_head;
+	cl_uint		index;
+
+	Assert(nrows <= trs->kern.nrows);
+
+	rstore = pgstrom_shmem_alloc(ROWSTORE_DEFAULT_SIZE);
+	if (!rstore)
+		elog(ERROR, "out of shared memory");
+
+	rstore->stag = StromTag_RowStore;
+	rstore->kern.length
+		= STROMALIGN_DOWN(ROWSTORE_DEFAULT_SIZE -
+						  STROMALIGN(offsetof(kern_column_store,
+											  colmeta[cs_colnums])) -
+						  offsetof(pgstrom_row_store, kern));
+	rstore->kern.ncols = rs_ncols;
+	rstore->kern.nrows = 0;
+	memcpy(rstore->kern.colmeta,
+		   rs_colmeta,
+		   sizeof(kern_colmeta) * rs_ncols);
+
+	p_offset = (cl_uint *)(&rstore->kern.colmeta[rs_ncols]);
+	usage_head = offsetof(kern_row_store, colmeta[rs_ncols]);
+	usage_tail = rstore->kern.length;
+
+	for (index=0; index < nrows; index++)
+	{
+		rs_tuple   *rs_src = kern_rowstore_get_tuple(&trs->kern, index);
+		rs_tuple   *rs_tup;
+		Size		length;
+
+		if (!rs_src)
+			continue;
+
+		/*
+		 * tcache_row_store is not larger than our row-store, so all the
+		 * tuples should fit this buffer as long as cached tuples are.
+		 */
+		length = HEAPTUPLESIZE + MAXALIGN(rs_src->htup.t_len);
+		if (usage_tail - length < sizeof(cl_uint) + usage_head)
+			elog(ERROR, "row-store overflow during copy from tcache");
+
+		usage_tail -= length;
+		usage_head += sizeof(cl_uint);
+		rs_tup = (rs_tuple *)((char *)&rstore->kern + usage_tail);
+		memcpy(&rs_tup->htup, &rs_src->htup, sizeof(HeapTupleData));
+		rs_tup->htup.t_data = &rs_tup->data;
+		memcpy(&rs_tup->data, &rs_src->data, rs_src->htup.t_len);
+
+		p_offset[rstore->kern.nrows++] = usage_tail;
+	}
+
+	kcs_head = (kern_column_store *)((char *)(&rstore->kern) +
+									 rstore->kern.length);
+	pgstrom_setup_kern_colstore_head(kcs_head, cs_colmeta, cs_colnums,
+									 rstore->kern.nrows);
+	rstore->kcs_head = kcs_head;
+	Assert(pgstrom_shmem_sanitycheck(rstore));
+	return rstore;
+}
+
+/*
+ * pgstrom_setup_kern_colstore_head
+ *
+ * It sets up header portion of kern_column_store, that contains offset
+ * of the column arrays according to the supplied column-metadata and
+ * number of rows.
+ */
+void
+pgstrom_setup_kern_colstore_head(kern_column_store *kcs_head,
+								 kern_colmeta *cs_colmeta,
+								 int cs_colnums,
+								 cl_uint nrows)
+{
+	cl_uint		offset;
+	int			index;
+
 	kcs_head->ncols = cs_colnums;
 	kcs_head->nrows = nrows;
 	memcpy(kcs_head->colmeta, cs_colmeta,
@@ -248,19 +406,121 @@ pgstrom_load_row_store_heap(HeapScanDesc scan,
 									  : sizeof(cl_uint)));
 	}
 	kcs_head->length = offset;
-	rstore->kcs_head = kcs_head;
-	Assert(pgstrom_shmem_sanitycheck(rstore));
-	return rstore;
 }
 
-#if 0
+/*
+ * pgstrom_load_row_store_subplan
+ *
+ * It creates a new row-store and loads tuples fetched from the supplied
+ * sub-plan. Unlike heap scan, we cannot rewind the sub-plan, so a tuple
+ * that does not fit the row-store is copied to '*p_overflow', then put
+ * on the head of the next row-store. It returns NULL if sub-plan returned
+ * no tuples any more.
+ */
 pgstrom_row_store *
-pgstrom_load_row_store_subplan(void)
+pgstrom_load_row_store_subplan(PlanState *subplan,
+							   HeapTuple *p_overflow,
+							   kern_colmeta *rs_colmeta,
+							   kern_colmeta *cs_colmeta,
+							   int cs_colnums,
+							   bool *scan_done)
 {
-	elog(ERROR, "not implemented now");
-	return NULL;
+	pgstrom_row_store *rstore;
+	TupleDesc	tupdesc = ExecGetResultType(subplan);
+	AttrNumber	rs_ncols = tupdesc->natts;
+	TupleTableSlot *slot;
+	HeapTuple	tuple;
+	cl_uint		nrows;
+	cl_uint		usage_head;
+	cl_uint		usage_tail;
+	cl_uint	   *p_offset;
+	kern_column_store *kcs_head;
+
+	rstore = pgstrom_shmem_alloc(ROWSTORE_DEFAULT_SIZE);
+	if (!rstore)
+		elog(ERROR, "out of shared memory");
+
+	/* see the comment in pgstrom_load_row_store_heap */
+	rstore->stag = StromTag_RowStore;
+	rstore->kern.length
+		= STROMALIGN_DOWN(ROWSTORE_DEFAULT_SIZE -
+						  STROMALIGN(offsetof(kern_column_store,
+											  colmeta[cs_colnums])) -
+						  offsetof(pgstrom_row_store, kern));
+	rstore->kern.ncols = rs_ncols;
+	rstore->kern.nrows = 0;
+	memcpy(rstore->kern.colmeta,
+		   rs_colmeta,
+		   sizeof(kern_colmeta) * rs_ncols);
+
+	p_offset = (cl_uint *)(&rstore->kern.colmeta[rs_ncols]);
+	usage_head = offsetof(kern_row_store, colmeta[rs_ncols]);
+	usage_tail = rstore->kern.length;
+	nrows = 0;
+
+	*scan_done = false;
+	for (;;)
+	{
+		Size		length;
+		rs_tuple   *rs_tup;
+
+		if (*p_overflow)
+			tuple = *p_overflow;
+		else
+		{
+			slot = ExecProcNode(subplan);
+			if (TupIsNull(slot))
+			{
+				*scan_done = true;
+				break;
+			}
+			tuple = ExecFetchSlotTuple(slot);
+		}
+
+		length = HEAPTUPLESIZE + MAXALIGN(tuple->t_len);
+		if (usage_tail - length < sizeof(cl_uint) + usage_head)
+		{
+			if (nrows == 0)
+			{
+				pgstrom_shmem_free(rstore);
+				elog(ERROR, "too large tuple for row-store (len: %u)",
+					 tuple->t_len);
+			}
+			/* keep the tuple to be put on the next row-store */
+			if (!*p_overflow)
+				*p_overflow = heap_copytuple(tuple);
+			break;
+		}
+		usage_tail -= length;
+		usage_head += sizeof(cl_uint);
+		rs_tup = (rs_tuple *)((char *)&rstore->kern + usage_tail);
+		memcpy(&rs_tup->htup, tuple, sizeof(HeapTupleData));
+		rs_tup->htup.t_data = &rs_tup->data;
+		memcpy(&rs_tup->data, tuple->t_data, tuple->t_len);
+
+		p_offset[nrows++] = usage_tail;
+
+		if (*p_overflow)
+		{
+			heap_freetuple(*p_overflow);
+			*p_overflow = NULL;
+		}
+	}
+
+	if (nrows == 0)
+	{
+		pgstrom_shmem_free(rstore);
+		return NULL;
+	}
+	rstore->kern.nrows = nrows;
+
+	kcs_head = (kern_column_store *)((char *)(&rstore->kern) +
+									 rstore->kern.length);
+	pgstrom_setup_kern_colstore_head(kcs_head, cs_colmeta, cs_colnums, nrows);
+	rstore->kcs_head = kcs_head;
+	Assert(pgstrom_shmem_sanitycheck(rstore));
+	return rstore;
 }
-#endif
 
 #ifdef USE_ASSERT_CHECKING
 /*
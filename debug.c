@@ -220,6 +220,7 @@ pgstrom_create_testmsg_func(PG_FUNCTION_ARGS)
 	tmsg->msg.respq = pgstrom_get_queue(mqueue);
 	tmsg->msg.cb_process = pgstrom_process_testmsg;
 	tmsg->msg.cb_release = pgstrom_release_testmsg;
+	tmsg->msg.dindex = -1;
 	tmsg->seconds = seconds;
 	strcpy(tmsg->label, test_label);
 
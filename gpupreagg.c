@@ -0,0 +1,2143 @@
+/*
+ * gpupreagg.c
+ *
+ * Aggregate Pre-processing with GPU acceleration
+ * ----
+ * Copyright 2011-2014 (C) KaiGai Kohei <kaigai@kaigai.gr.jp>
+ * Copyright 2014 (C) The PG-Strom Development Team
+ *
+ * This software is an extension of PostgreSQL; You can use, copy,
+ * modify or distribute it under the terms of 'LICENSE' included
+ * within this package.
+ */
+#include "postgres.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/plannodes.h"
+#include "optimizer/cost.h"
+#include "optimizer/planner.h"
+#include "optimizer/tlist.h"
+#include "parser/parsetree.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/typcache.h"
+#include <math.h>
+#include "pg_strom.h"
+#include "opencl_gpupreagg.h"
+
+static planner_hook_type	planner_hook_next;
+static CustomPlanMethods	gpupreagg_plan_methods;
+static bool					enable_gpupreagg;
+
+/*
+ * GpuPreAggPlan is inserted between Agg node and its outer plan. It returns
+ * one row per group per chunk; that consists of the grouping keys and the
+ * partial results of the aggregate functions, then the Agg node combines
+ * the partial results instead of the raw rows.
+ * Its target list has the grouping keys first, then the partial results
+ * being represented as calls of the placeholder functions. The grouping
+ * keys and the arguments of the aggregates reference the target list of
+ * the outer plan.
+ */
+typedef struct {
+	CustomPlan	cplan;
+	const char *kern_source;	/* source of opencl kernel */
+	int			extra_flags;	/* extra libraries to be included */
+	int			numCols;		/* number of grouping keys */
+	AttrNumber *grpColIdx;		/* their indexes in the outer target list */
+	int			numParts;		/* number of partial results */
+	int		   *partKinds;		/* DEVAGG_* of the partial results */
+	AttrNumber *partArgIdx;		/* index of the argument, or 0 if none */
+	double		numGroups;		/* estimated number of groups */
+	Bitmapset  *outer_attnums;	/* outer attnums referenced in device */
+} GpuPreAggPlan;
+
+typedef struct {
+	CustomPlanState		cps;
+	TupleTableSlot	   *outer_slot;
+	HeapTuple			outer_overflow;	/* tuple not fit previous chunk */
+	bool				outer_done;	/* no more outer tuples to be loaded */
+	Oid				   *part_types;	/* types of the partial results */
+
+	pgstrom_queue	   *mqueue;
+	Datum				dprog_key;
+
+	kern_parambuf	   *kparambuf;
+	kern_colmeta	   *rs_colmeta;
+	kern_colmeta	   *cs_colmeta;
+	int					cs_colnums;
+	cl_uint				nrooms;		/* max number of groups per chunk */
+
+	int					num_running;	/* number of chunks in-flight */
+	dlist_head			ready_chunks;	/* chunks already processed */
+	pgstrom_gpupreagg  *curr_chunk;
+	cl_uint				curr_index;
+	cl_uint				curr_nitems;
+	bool				curr_on_host;	/* chunk is aggregated by host */
+
+	cl_uint				num_chunks;	/* statistics */
+	cl_uint				num_host_chunks;
+	double				num_groups;
+
+	pgstrom_perfmon		pfm;	/* sum of performance counter */
+} GpuPreAggState;
+
+/* static functions */
+static void clserv_process_gpupreagg(pgstrom_message *msg);
+static void clserv_put_gpupreagg(pgstrom_message *msg);
+
+/*
+ * gpupreagg_key_type_supported
+ *
+ * Device groups the rows by binary equality of the keys, so only data types
+ * whose binary equality implies equality of the default operator class are
+ * supported.
+ */
+static bool
+gpupreagg_key_type_supported(Oid type_oid)
+{
+	switch (type_oid)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case DATEOID:
+#ifdef HAVE_INT64_TIMESTAMP
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+#endif
+			return true;
+		default:
+			break;
+	}
+	return false;
+}
+
+/*
+ * cost_gpupreagg
+ *
+ * cost estimation for GpuPreAgg. It also estimates number of rows being
+ * returned; one row per group per chunk at most.
+ */
+static void
+cost_gpupreagg(Agg *agg, int numParts,
+			   Cost *p_startup_cost, Cost *p_total_cost, double *p_rows)
+{
+	Plan	   *outer_plan = outerPlan(agg);
+	double		ntuples = Max(outer_plan->plan_rows, 1.0);
+	double		ngroups;
+	double		nchunks;
+	double		chunk_rows;
+	double		nrows_out;
+	Size		tuple_len;
+	Cost		startup_cost;
+	Cost		run_cost;
+	Cost		setup_cost;
+	Cost		dev_op_cost;
+	Cost		dma_per_byte;
+	Cost		kern_per_tuple;
+	Cost		dma_per_tuple;
+
+	if (agg->aggstrategy == AGG_PLAIN)
+		ngroups = 1.0;
+	else
+		ngroups = Max((double) agg->numGroups, 1.0);
+
+	/* number of chunks, as cost_gpusort estimates */
+	tuple_len = (sizeof(cl_uint) + HEAPTUPLESIZE +
+				 MAXALIGN(SizeofHeapTupleHeader) +
+				 MAXALIGN(outer_plan->plan_width));
+	chunk_rows = Max((double) ROWSTORE_DEFAULT_SIZE / (double) tuple_len, 1.0);
+	nchunks = ceil(ntuples / chunk_rows);
+	nrows_out = Min(ntuples, ngroups * nchunks);
+
+	/* cost to run the outer plan */
+	startup_cost = outer_plan->startup_cost;
+	run_cost = outer_plan->total_cost - outer_plan->startup_cost;
+
+	/* cost to load the outer tuples to row-stores */
+	run_cost += cpu_tuple_cost * ntuples;
+
+	/*
+	 * Device costs, in the same scale as cost_gpuscan. An operator per
+	 * grouping key and partial aggregation is charged for each row, and
+	 * DMA transfer of a chunk is overlapped with the kernel execution of
+	 * the prior chunk, except for the first chunk.
+	 */
+	pgstrom_device_costs(&setup_cost, &dev_op_cost, &dma_per_byte);
+	kern_per_tuple = dev_op_cost * (agg->numCols + numParts);
+	dma_per_tuple = dma_per_byte * tuple_len;
+	startup_cost += (setup_cost +
+					 Min(chunk_rows, ntuples) * (kern_per_tuple +
+												 dma_per_tuple));
+	run_cost += Max(kern_per_tuple, dma_per_tuple) * ntuples;
+
+	/* cost to fetch the partial results */
+	run_cost += cpu_tuple_cost * nrows_out;
+
+	*p_startup_cost = startup_cost;
+	*p_total_cost = startup_cost + run_cost;
+	*p_rows = nrows_out;
+}
+
+/*
+ * gpupreagg_pull_aggrefs
+ *
+ * It collects distinct Aggref nodes in the target list and qualifier
+ * of the Agg node.
+ */
+static bool
+gpupreagg_pull_aggrefs(Node *node, List **p_aggrefs)
+{
+	if (!node)
+		return false;
+	if (IsA(node, Aggref))
+	{
+		ListCell   *cell;
+
+		foreach (cell, *p_aggrefs)
+		{
+			if (equal(node, lfirst(cell)))
+				return false;
+		}
+		*p_aggrefs = lappend(*p_aggrefs, node);
+		return false;
+	}
+	return expression_tree_walker(node, gpupreagg_pull_aggrefs, p_aggrefs);
+}
+
+typedef struct
+{
+	Agg		   *agg;
+	List	   *aggrefs;	/* list of the original Aggref */
+	List	   *devaggs;	/* list of devagg_info */
+	List	   *part_tles;	/* target entries of the partial results */
+	bool		not_available;
+} gpupreagg_rewrite_context;
+
+/*
+ * gpupreagg_rewrite_mutator
+ *
+ * It rewrites the expressions of Agg node to reference the GpuPreAgg.
+ * Aggregate functions are replaced by the ones to combine the partial
+ * results, and references to the grouping keys are replaced by the keys
+ * on the target list of GpuPreAgg.
+ */
+static Node *
+gpupreagg_rewrite_mutator(Node *node, gpupreagg_rewrite_context *context)
+{
+	if (!node)
+		return NULL;
+	if (IsA(node, Aggref))
+	{
+		Aggref		   *aggref = (Aggref *) node;
+		Aggref		   *newagg;
+		devagg_info	   *dagg;
+		TargetEntry	   *tle;
+		Var			   *var;
+		int				index = 0;
+		ListCell	   *cell;
+
+		foreach (cell, context->aggrefs)
+		{
+			if (equal(aggref, lfirst(cell)))
+				break;
+			index++;
+		}
+		Assert(index < list_length(context->aggrefs));
+		dagg = list_nth(context->devaggs, index);
+		tle = list_nth(context->part_tles, index);
+
+		var = makeVar(OUTER_VAR,
+					  tle->resno,
+					  exprType((Node *) tle->expr),
+					  exprTypmod((Node *) tle->expr),
+					  exprCollation((Node *) tle->expr),
+					  0);
+		newagg = makeNode(Aggref);
+		memcpy(newagg, aggref, sizeof(Aggref));
+		newagg->aggfnoid = dagg->final_agg;
+		newagg->args = list_make1(makeTargetEntry((Expr *) var, 1,
+												  NULL, false));
+		newagg->aggstar = false;
+		newagg->aggvariadic = false;
+
+		return (Node *) newagg;
+	}
+	else if (IsA(node, Var))
+	{
+		Agg	   *agg = context->agg;
+		Var	   *var = (Var *) copyObject(node);
+		int		i;
+
+		if (var->varno == OUTER_VAR)
+		{
+			for (i=0; i < agg->numCols; i++)
+			{
+				if (agg->grpColIdx[i] == var->varattno)
+				{
+					var->varattno = i + 1;
+					return (Node *) var;
+				}
+			}
+			/* references to non-grouping columns are not supported */
+			context->not_available = true;
+		}
+		return (Node *) var;
+	}
+	return expression_tree_mutator(node, gpupreagg_rewrite_mutator,
+								   (void *) context);
+}
+
+/*
+ * gpupreagg_codegen
+ *
+ * It constructs the device functions according to the grouping keys and
+ * the partial results. Referenced columns are translated to the column-
+ * store in order of attribute number, so the column index of a column is
+ * its rank in 'outer_attnums'.
+ */
+static int
+gpupreagg_colidx(Bitmapset *outer_attnums, AttrNumber anum)
+{
+	Bitmapset  *tempset = bms_copy(outer_attnums);
+	int			colidx = 0;
+	int			x;
+
+	while ((x = bms_first_member(tempset)) >= 0 && x < anum)
+		colidx++;
+	bms_free(tempset);
+
+	return colidx;
+}
+
+static const char *
+gpupreagg_codegen_keyform(Oid type_oid)
+{
+	if (type_oid == FLOAT4OID)
+		return "GPUPREAGG_KEY_FLOAT";
+	if (type_oid == FLOAT8OID)
+		return "GPUPREAGG_KEY_DOUBLE";
+	return "GPUPREAGG_KEY_SIMPLE";
+}
+
+static char *
+gpupreagg_codegen(GpuPreAggPlan *gpreagg, List *part_tles,
+				  codegen_context *context)
+{
+	Plan		   *outer_plan = outerPlan(gpreagg);
+	StringInfoData	str;
+	StringInfoData	hash_decl;
+	StringInfoData	hash_body;
+	StringInfoData	comp_decl;
+	StringInfoData	comp_body;
+	StringInfoData	init_body;
+	StringInfoData	calc_decl;
+	StringInfoData	calc_load;
+	StringInfoData	calc_body;
+	cl_uint			nullmask = 0;
+	ListCell	   *cell;
+	int				i;
+
+	memset(context, 0, sizeof(codegen_context));
+	initStringInfo(&str);
+	initStringInfo(&hash_decl);
+	initStringInfo(&hash_body);
+	initStringInfo(&comp_decl);
+	initStringInfo(&comp_body);
+	initStringInfo(&init_body);
+	initStringInfo(&calc_decl);
+	initStringInfo(&calc_load);
+	initStringInfo(&calc_body);
+
+	/* grouping keys */
+	for (i=0; i < gpreagg->numCols; i++)
+	{
+		AttrNumber		anum = gpreagg->grpColIdx[i];
+		TargetEntry	   *tle = get_tle_by_resno(outer_plan->targetlist, anum);
+		Oid				type_oid = exprType((Node *) tle->expr);
+		devtype_info   *dtype = pgstrom_devtype_lookup(type_oid);
+		int				colidx = gpupreagg_colidx(gpreagg->outer_attnums,
+												  anum);
+		const char	   *keyform = gpupreagg_codegen_keyform(type_oid);
+
+		Assert(dtype != NULL);
+		context->type_defs = list_append_unique_ptr(context->type_defs,
+													dtype);
+		appendStringInfo(&hash_decl,
+						 "  pg_%s_t keyval%d = pg_%s_vref(kcs,%d,rowidx);\n",
+						 dtype->type_name, i, dtype->type_name, colidx);
+		appendStringInfo(&hash_body,
+						 "  if (!keyval%d.isnull)\n"
+						 "    hash = gpupreagg_hash_value(hash, %s(keyval%d.value));\n",
+						 i, keyform, i);
+		appendStringInfo(&comp_decl,
+						 "  pg_%s_t xkeyval%d = pg_%s_vref(kcs,%d,x_index);\n"
+						 "  pg_%s_t ykeyval%d = pg_%s_vref(kcs,%d,y_index);\n",
+						 dtype->type_name, i, dtype->type_name, colidx,
+						 dtype->type_name, i, dtype->type_name, colidx);
+		appendStringInfo(&comp_body,
+						 "  if (xkeyval%d.isnull != ykeyval%d.isnull ||\n"
+						 "      (!xkeyval%d.isnull &&\n"
+						 "       %s(xkeyval%d.value) != %s(ykeyval%d.value)))\n"
+						 "    return false;\n",
+						 i, i, i, keyform, i, keyform, i);
+	}
+
+	/* partial results */
+	i = 0;
+	foreach (cell, part_tles)
+	{
+		TargetEntry	   *tle = lfirst(cell);
+		int				kind = gpreagg->partKinds[i];
+		AttrNumber		anum = gpreagg->partArgIdx[i];
+		Oid				part_type = exprType((Node *) tle->expr);
+		bool			is_double = (part_type == FLOAT4OID ||
+									 part_type == FLOAT8OID);
+		const char	   *base = (is_double ? "double" : "long");
+		const char	   *func = (kind == DEVAGG_PMIN ? "min" :
+								kind == DEVAGG_PMAX ? "max" : "add");
+		char		   *isnull;
+		char		   *value;
+
+		/* initial value of the partial result */
+		if (kind == DEVAGG_PCOUNT || kind == DEVAGG_PSUM)
+			appendStringInfo(&init_body, "  pitem->values[%d] = %s;\n",
+							 i, is_double ? "as_ulong((cl_double) 0.0)" : "0");
+		else if (kind == DEVAGG_PMIN)
+			appendStringInfo(&init_body, "  pitem->values[%d] = %s;\n",
+							 i, is_double
+							 ? "as_ulong((cl_double) NAN)"
+							 : "(cl_ulong) LONG_MAX");
+		else
+			appendStringInfo(&init_body, "  pitem->values[%d] = %s;\n",
+							 i, is_double
+							 ? "as_ulong((cl_double) -INFINITY)"
+							 : "(cl_ulong) LONG_MIN");
+		/* count is not null even if no rows */
+		if (kind != DEVAGG_PCOUNT)
+			nullmask |= (1U << i);
+
+		if (anum == 0)
+		{
+			/* count(*) */
+			Assert(kind == DEVAGG_PCOUNT);
+			isnull = "group < 0";
+			value = "1";
+		}
+		else
+		{
+			TargetEntry	   *arg_tle
+				= get_tle_by_resno(outer_plan->targetlist, anum);
+			devtype_info   *dtype
+				= pgstrom_devtype_lookup(exprType((Node *) arg_tle->expr));
+			int				colidx
+				= gpupreagg_colidx(gpreagg->outer_attnums, anum);
+
+			Assert(dtype != NULL);
+			context->type_defs = list_append_unique_ptr(context->type_defs,
+														dtype);
+			appendStringInfo(&calc_decl, "  pg_%s_t argval%d;\n",
+							 dtype->type_name, i);
+			appendStringInfo(&calc_load,
+							 "    argval%d = pg_%s_vref(kcs,%d,rowidx);\n",
+							 i, dtype->type_name, colidx);
+			appendStringInfo(&calc_body, "  if (group < 0)\n"
+							 "    argval%d.isnull = true;\n", i);
+			isnull = psprintf("argval%d.isnull", i);
+			if (kind == DEVAGG_PCOUNT)
+				value = "1";
+			else
+				value = psprintf("(cl_%s) argval%d.value", base, i);
+		}
+		appendStringInfo(&calc_body,
+						 "  /* %s */\n"
+						 "  gpupreagg_%s_%s(kpresult, %d, group, owner,\n"
+						 "                  %s, %s, local_workmem);\n",
+						 format_procedure(((FuncExpr *) tle->expr)->funcid),
+						 func, base, i, isnull, value);
+		i++;
+	}
+
+	/*
+	 * Put declarations of device types
+	 */
+	appendStringInfo(&str, "%s\n", pgstrom_codegen_declarations(context));
+
+	appendStringInfo(&str,
+					 "static cl_uint\n"
+					 "gpupreagg_keyhash(__global kern_column_store *kcs,\n"
+					 "                  cl_uint rowidx)\n"
+					 "{\n"
+					 "%s"
+					 "  cl_uint hash = 0x9e3779b9;\n"
+					 "\n"
+					 "%s"
+					 "  return hash;\n"
+					 "}\n\n",
+					 hash_decl.data, hash_body.data);
+	appendStringInfo(&str,
+					 "static cl_bool\n"
+					 "gpupreagg_keycomp(__global kern_column_store *kcs,\n"
+					 "                  cl_uint x_index,\n"
+					 "                  cl_uint y_index)\n"
+					 "{\n"
+					 "%s"
+					 "\n"
+					 "%s"
+					 "  return true;\n"
+					 "}\n\n",
+					 comp_decl.data, comp_body.data);
+	appendStringInfo(&str,
+					 "static void\n"
+					 "gpupreagg_init_item(__global kern_preagg_item *pitem)\n"
+					 "{\n"
+					 "  pitem->nullmask = 0x%08xU;\n"
+					 "%s"
+					 "}\n\n",
+					 nullmask, init_body.data);
+	appendStringInfo(&str,
+					 "static void\n"
+					 "gpupreagg_aggcalc(__global kern_preagg_result *kpresult,\n"
+					 "                  __global kern_column_store *kcs,\n"
+					 "                  cl_uint rowidx,\n"
+					 "                  cl_int group,\n"
+					 "                  cl_uint owner,\n"
+					 "                  __local void *local_workmem)\n"
+					 "{\n"
+					 "%s"
+					 "\n"
+					 "  if (group >= 0)\n"
+					 "  {\n"
+					 "%s"
+					 "  }\n"
+					 "%s"
+					 "}\n",
+					 calc_decl.data, calc_load.data, calc_body.data);
+
+	return str.data;
+}
+
+/*
+ * gpupreagg_try_insert
+ *
+ * It tries to insert a GpuPreAgg node under the supplied Agg node, if all
+ * the grouping keys and aggregate functions are supported by device and
+ * its cost is expected to be cheaper.
+ */
+static void
+gpupreagg_try_insert(Agg *agg)
+{
+	GpuPreAggPlan  *gpreagg;
+	Plan		   *outer_plan = outerPlan(agg);
+	List		   *aggrefs = NIL;
+	List		   *devaggs = NIL;
+	List		   *tlist = NIL;
+	List		   *part_tles = NIL;
+	List		   *agg_tlist;
+	List		   *agg_quals;
+	Bitmapset	   *outer_attnums = NULL;
+	gpupreagg_rewrite_context context;
+	codegen_context	codegen;
+	Cost			startup_cost;
+	Cost			total_cost;
+	Cost			agg_cost;
+	Cost			output_cost;
+	double			nrows_out;
+	int				plan_width = 0;
+	int				numParts;
+	ListCell	   *cell;
+	int				i;
+
+	/*
+	 * Sorted aggregate needs sorted input, but GpuPreAgg does not keep
+	 * the order of rows.
+	 */
+	if (agg->aggstrategy != AGG_PLAIN && agg->aggstrategy != AGG_HASHED)
+		return;
+
+	/* check whether all the grouping keys are supported */
+	for (i=0; i < agg->numCols; i++)
+	{
+		TargetEntry	   *tle;
+		TypeCacheEntry *tcache;
+		Oid				type_oid;
+
+		tle = get_tle_by_resno(outer_plan->targetlist, agg->grpColIdx[i]);
+		if (!tle)
+			return;
+		type_oid = exprType((Node *) tle->expr);
+		if (!gpupreagg_key_type_supported(type_oid) ||
+			!pgstrom_devtype_lookup(type_oid))
+			return;
+		tcache = lookup_type_cache(type_oid, TYPECACHE_EQ_OPR);
+		if (tcache->eq_opr != agg->grpOperators[i])
+			return;
+
+		tlist = lappend(tlist, makeTargetEntry((Expr *)
+											   makeVar(OUTER_VAR,
+													   tle->resno,
+													   type_oid,
+													   exprTypmod((Node *)
+																  tle->expr),
+													   exprCollation((Node *)
+																	 tle->expr),
+													   0),
+											   list_length(tlist) + 1,
+											   NULL,
+											   false));
+		plan_width += get_typavgwidth(type_oid, -1);
+		outer_attnums = bms_add_member(outer_attnums, tle->resno);
+	}
+
+	/* check whether all the aggregate functions are supported */
+	gpupreagg_pull_aggrefs((Node *) agg->plan.targetlist, &aggrefs);
+	gpupreagg_pull_aggrefs((Node *) agg->plan.qual, &aggrefs);
+	numParts = list_length(aggrefs);
+	if (numParts > GPUPREAGG_MAX_PARTIALS)
+		return;
+
+	foreach (cell, aggrefs)
+	{
+		Aggref		   *aggref = lfirst(cell);
+		devagg_info	   *dagg;
+		List		   *args = NIL;
+		FuncExpr	   *fexpr;
+
+		if (aggref->aggdirectargs != NIL ||
+			aggref->aggorder != NIL ||
+			aggref->aggdistinct != NIL ||
+			aggref->aggfilter != NULL ||
+			aggref->agglevelsup != 0)
+			return;
+		dagg = pgstrom_devagg_lookup(aggref->aggfnoid);
+		if (!dagg)
+			return;
+
+		if (list_length(aggref->args) == 1)
+		{
+			TargetEntry	   *arg_tle = linitial(aggref->args);
+			Var			   *var = (Var *) arg_tle->expr;
+			devtype_info   *dtype;
+
+			if (!IsA(var, Var) || var->varno != OUTER_VAR)
+				return;
+			dtype = pgstrom_devtype_lookup(var->vartype);
+			if (!dtype || (dtype->type_flags & DEVTYPE_IS_VARLENA) != 0 ||
+				(dagg->agg_argtype && dagg->agg_argtype != dtype))
+				return;
+			args = list_make1(copyObject(var));
+			outer_attnums = bms_add_member(outer_attnums, var->varattno);
+		}
+		else if (aggref->args != NIL || !aggref->aggstar)
+			return;
+
+		fexpr = makeFuncExpr(dagg->partial_func,
+							 dagg->partial_type->type_oid,
+							 args,
+							 InvalidOid,
+							 InvalidOid,
+							 COERCE_EXPLICIT_CALL);
+		part_tles = lappend(part_tles,
+							makeTargetEntry((Expr *) fexpr,
+											list_length(tlist) + 1,
+											NULL,
+											false));
+		tlist = lappend(tlist, llast(part_tles));
+		devaggs = lappend(devaggs, dagg);
+		plan_width += get_typavgwidth(dagg->partial_type->type_oid, -1);
+	}
+
+	/*
+	 * Rewrite the expressions of Agg node. Agg node may reference columns
+	 * being functionally dependent on the grouping keys; we give up them.
+	 */
+	memset(&context, 0, sizeof(gpupreagg_rewrite_context));
+	context.agg = agg;
+	context.aggrefs = aggrefs;
+	context.devaggs = devaggs;
+	context.part_tles = part_tles;
+	agg_tlist = (List *)
+		gpupreagg_rewrite_mutator((Node *) agg->plan.targetlist, &context);
+	agg_quals = (List *)
+		gpupreagg_rewrite_mutator((Node *) agg->plan.qual, &context);
+	if (context.not_available)
+		return;
+
+	/*
+	 * Is GpuPreAgg + Agg cheaper than the Agg? Cost of Agg itself is
+	 * assumed to be proportional to number of input rows.
+	 */
+	cost_gpupreagg(agg, numParts, &startup_cost, &total_cost, &nrows_out);
+	if (!enable_gpupreagg)
+	{
+		startup_cost += disable_cost;
+		total_cost += disable_cost;
+	}
+	agg_cost = ((agg->plan.total_cost - outer_plan->total_cost) *
+				nrows_out / Max(outer_plan->plan_rows, 1.0));
+	if (total_cost + agg_cost >= agg->plan.total_cost)
+		return;
+
+	/*
+	 * OK, construction of GpuPreAggPlan node; on top of CustomPlan node
+	 */
+	gpreagg = palloc0(sizeof(GpuPreAggPlan));
+	gpreagg->cplan.plan.type = T_CustomPlan;
+	gpreagg->cplan.plan.startup_cost = startup_cost;
+	gpreagg->cplan.plan.total_cost = total_cost;
+	gpreagg->cplan.plan.plan_rows = nrows_out;
+	gpreagg->cplan.plan.plan_width = plan_width;
+	gpreagg->cplan.plan.targetlist = tlist;
+	gpreagg->cplan.plan.qual = NIL;
+	gpreagg->cplan.plan.lefttree = outer_plan;
+	gpreagg->cplan.plan.extParam = bms_copy(outer_plan->extParam);
+	gpreagg->cplan.plan.allParam = bms_copy(outer_plan->allParam);
+	gpreagg->cplan.methods = &gpupreagg_plan_methods;
+
+	gpreagg->numCols = agg->numCols;
+	gpreagg->grpColIdx = palloc(sizeof(AttrNumber) * agg->numCols);
+	memcpy(gpreagg->grpColIdx, agg->grpColIdx,
+		   sizeof(AttrNumber) * agg->numCols);
+	gpreagg->numParts = numParts;
+	gpreagg->partKinds = palloc(sizeof(int) * Max(numParts, 1));
+	gpreagg->partArgIdx = palloc(sizeof(AttrNumber) * Max(numParts, 1));
+	i = 0;
+	foreach (cell, aggrefs)
+	{
+		Aggref		   *aggref = lfirst(cell);
+		devagg_info	   *dagg = list_nth(devaggs, i);
+
+		gpreagg->partKinds[i] = dagg->agg_kind;
+		if (aggref->args != NIL)
+		{
+			TargetEntry	   *arg_tle = linitial(aggref->args);
+
+			gpreagg->partArgIdx[i] = ((Var *) arg_tle->expr)->varattno;
+		}
+		else
+			gpreagg->partArgIdx[i] = 0;
+		i++;
+	}
+	gpreagg->numGroups = (agg->aggstrategy == AGG_PLAIN
+						  ? 1.0 : (double) agg->numGroups);
+	gpreagg->outer_attnums = outer_attnums;
+
+	gpreagg->kern_source = gpupreagg_codegen(gpreagg, part_tles, &codegen);
+	gpreagg->extra_flags = codegen.extra_flags | DEVKERNEL_NEEDS_GPUPREAGG;
+
+	/*
+	 * Agg node combines the partial results of GpuPreAgg
+	 */
+	agg->plan.targetlist = agg_tlist;
+	agg->plan.qual = agg_quals;
+	for (i=0; i < agg->numCols; i++)
+		agg->grpColIdx[i] = i + 1;
+	output_cost = agg->plan.total_cost - agg->plan.startup_cost;
+	agg->plan.total_cost = total_cost + agg_cost;
+	agg->plan.startup_cost = Max(agg->plan.total_cost - output_cost,
+								 total_cost);
+	agg->plan.lefttree = &gpreagg->cplan.plan;
+}
+
+/*
+ * gpupreagg_insert_plan
+ *
+ * It walks on the plan tree, then inserts GpuPreAgg under Agg nodes if
+ * possible.
+ */
+static void
+gpupreagg_insert_plan(Plan *plan)
+{
+	ListCell   *cell;
+
+	if (!plan)
+		return;
+
+	switch (nodeTag(plan))
+	{
+		case T_Append:
+			foreach (cell, ((Append *) plan)->appendplans)
+				gpupreagg_insert_plan(lfirst(cell));
+			break;
+
+		case T_MergeAppend:
+			foreach (cell, ((MergeAppend *) plan)->mergeplans)
+				gpupreagg_insert_plan(lfirst(cell));
+			break;
+
+		case T_ModifyTable:
+			foreach (cell, ((ModifyTable *) plan)->plans)
+				gpupreagg_insert_plan(lfirst(cell));
+			break;
+
+		case T_SubqueryScan:
+			gpupreagg_insert_plan(((SubqueryScan *) plan)->subplan);
+			break;
+
+		default:
+			break;
+	}
+	gpupreagg_insert_plan(plan->lefttree);
+	gpupreagg_insert_plan(plan->righttree);
+
+	if (IsA(plan, Agg))
+		gpupreagg_try_insert((Agg *) plan);
+}
+
+static PlannedStmt *
+gpupreagg_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
+{
+	PlannedStmt	   *result;
+	ListCell	   *cell;
+
+	if (planner_hook_next)
+		result = planner_hook_next(parse, cursorOptions, boundParams);
+	else
+		result = standard_planner(parse, cursorOptions, boundParams);
+
+	if (!pgstrom_enabled)
+		return result;
+
+	gpupreagg_insert_plan(result->planTree);
+	foreach (cell, result->subplans)
+		gpupreagg_insert_plan(lfirst(cell));
+
+	return result;
+}
+
+static void
+gpupreagg_set_plan_ref(PlannerInfo *root,
+					   CustomPlan *custom_plan,
+					   int rtoffset)
+{
+	/*
+	 * GpuPreAgg is constructed after set_plan_references(), so nothing to
+	 * do here.
+	 */
+}
+
+static void
+gpupreagg_finalize_plan(PlannerInfo *root,
+						CustomPlan *custom_plan,
+						Bitmapset **paramids,
+						Bitmapset **valid_params,
+						Bitmapset **scan_params)
+{
+	/* nothing to do */
+}
+
+/*
+ * pgstrom_partial_placeholder
+ *
+ * Entrypoint of the partial functions; they just represent the partial
+ * results being computed by GpuPreAgg, so never called on the host side.
+ */
+Datum
+pgstrom_partial_placeholder(PG_FUNCTION_ARGS)
+{
+	elog(ERROR, "%s is not callable; it is a partial result of GpuPreAgg",
+		 format_procedure(fcinfo->flinfo->fn_oid));
+
+	PG_RETURN_NULL();
+}
+PG_FUNCTION_INFO_V1(pgstrom_partial_placeholder);
+
+static CustomPlanState *
+gpupreagg_begin(CustomPlan *node, EState *estate, int eflags)
+{
+	GpuPreAggPlan  *gpreagg = (GpuPreAggPlan *) node;
+	GpuPreAggState *gpas;
+	TupleDesc		tupdesc;
+	AttrNumber		anum;
+	ListCell	   *cell;
+	int				i;
+
+	/* check for unsupported flags */
+	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
+
+	/*
+	 * create a state structure
+	 */
+	gpas = palloc0(sizeof(GpuPreAggState));
+	gpas->cps.ps.type = T_CustomPlanState;
+	gpas->cps.ps.plan = (Plan *) node;
+	gpas->cps.ps.state = estate;
+	gpas->cps.methods = &gpupreagg_plan_methods;
+
+	/*
+	 * create expression context
+	 */
+	ExecAssignExprContext(estate, &gpas->cps.ps);
+
+	/*
+	 * initialize child nodes
+	 */
+	outerPlanState(gpas) = ExecInitNode(outerPlan(node), estate, eflags);
+
+	/*
+	 * tuple table initialization; partial results are not projected but
+	 * constructed on the result slot directly
+	 */
+	ExecInitResultTupleSlot(estate, &gpas->cps.ps);
+	ExecAssignResultTypeFromTL(&gpas->cps.ps);
+	gpas->cps.ps.ps_ProjInfo = NULL;
+
+	tupdesc = ExecGetResultType(outerPlanState(gpas));
+	gpas->outer_slot = ExecInitExtraTupleSlot(estate);
+	ExecSetSlotDescriptor(gpas->outer_slot, tupdesc);
+
+	gpas->part_types = palloc(sizeof(Oid) * Max(gpreagg->numParts, 1));
+	i = 0;
+	foreach (cell, node->plan.targetlist)
+	{
+		TargetEntry	   *tle = lfirst(cell);
+
+		if (tle->resno > gpreagg->numCols)
+			gpas->part_types[i++] = exprType((Node *) tle->expr);
+	}
+	Assert(i == gpreagg->numParts);
+
+	/*
+	 * OK, initialization of common part is over.
+	 * Let's have GPU stuff initialization
+	 */
+	gpas->outer_overflow = NULL;
+	gpas->outer_done = false;
+	gpas->mqueue = pgstrom_create_queue();
+	pgstrom_track_object(&gpas->mqueue->stag);
+
+	gpas->kparambuf = pgstrom_create_kern_parambuf(NIL,
+											gpas->cps.ps.ps_ExprContext);
+	gpas->dprog_key = pgstrom_get_devprog_key(gpreagg->kern_source,
+											  gpreagg->extra_flags);
+	pgstrom_track_object((StromTag *)gpas->dprog_key);
+
+	/*
+	 * Column metadata of the outer row-store; only grouping keys and
+	 * arguments of the aggregates are translated to the column-store.
+	 */
+	gpas->rs_colmeta = palloc(sizeof(kern_colmeta) * tupdesc->natts);
+	gpas->cs_colmeta = palloc(sizeof(kern_colmeta) * tupdesc->natts);
+	gpas->cs_colnums = 0;
+	for (anum=0; anum < tupdesc->natts; anum++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[anum];
+		kern_colmeta   *colmeta = &gpas->rs_colmeta[anum];
+
+		colmeta->flags = 0;
+		if (attr->attnotnull)
+			colmeta->flags |= KERN_COLMETA_ATTNOTNULL;
+		if (bms_is_member(anum + 1, gpreagg->outer_attnums))
+			colmeta->flags |= KERN_COLMETA_ATTREFERENCED;
+
+		if (attr->attalign == 'c')
+			colmeta->attalign = sizeof(cl_char);
+		else if (attr->attalign == 's')
+			colmeta->attalign = sizeof(cl_short);
+		else if (attr->attalign == 'i')
+			colmeta->attalign = sizeof(cl_int);
+		else if (attr->attalign == 'd')
+			colmeta->attalign = sizeof(cl_long);
+		else
+			elog(ERROR, "unexpected attribute alignment: %c", attr->attalign);
+		colmeta->attlen = attr->attlen;
+		colmeta->cs_ofs = -1;	/* to be calculated for each row_store */
+
+		if ((colmeta->flags & KERN_COLMETA_ATTREFERENCED) != 0)
+			memcpy(&gpas->cs_colmeta[gpas->cs_colnums++],
+				   colmeta, sizeof(kern_colmeta));
+	}
+
+	/*
+	 * Room of the groups per chunk; twice of the estimated number of
+	 * groups, to avoid host side aggregation due to underestimation.
+	 */
+	gpas->nrooms = (cl_uint) Min(Max(2.0 * gpreagg->numGroups, 1024.0),
+								 (double) INT_MAX);
+
+	gpas->num_running = 0;
+	dlist_init(&gpas->ready_chunks);
+	gpas->curr_chunk = NULL;
+	gpas->curr_index = 0;
+	gpas->curr_nitems = 0;
+	gpas->curr_on_host = false;
+
+	/* Is perfmon needed? */
+	gpas->pfm.enabled = pgstrom_perfmon_enabled;
+
+	return &gpas->cps;
+}
+
+/*
+ * pgstrom_create_gpupreagg
+ *
+ * It constructs a pgstrom_gpupreagg message towards the supplied row-store.
+ */
+static pgstrom_gpupreagg *
+pgstrom_create_gpupreagg(GpuPreAggState *gpas, pgstrom_row_store *rstore)
+{
+	GpuPreAggPlan	   *gpreagg = (GpuPreAggPlan *) gpas->cps.ps.plan;
+	pgstrom_gpupreagg  *gpupreagg;
+	kern_parambuf	   *kparam;
+	kern_preagg_result *kpresult;
+	cl_uint				nrows = rstore->kern.nrows;
+	cl_uint				nrooms = Min(gpas->nrooms, nrows);
+	cl_uint				nslots = 1;
+	Size				length;
+
+	/* number of hash slots has to be power of 2 and larger than nrows */
+	while (nslots < 2 * nrows)
+		nslots <<= 1;
+
+	length = (STROMALIGN(offsetof(pgstrom_gpupreagg, kern.kparam)) +
+			  STROMALIGN(gpas->kparambuf->length) +
+			  STROMALIGN(offsetof(kern_preagg_result, items) +
+						 KERN_PREAGG_ITEM_LENGTH(gpreagg->numParts) * nrooms));
+	gpupreagg = pgstrom_shmem_alloc(length);
+	if (!gpupreagg)
+	{
+		pgstrom_shmem_free(rstore);
+		elog(ERROR, "out of shared memory");
+	}
+	/* Fields of pgstrom_gpupreagg */
+	memset(gpupreagg, 0, sizeof(pgstrom_gpupreagg));
+	gpupreagg->msg.stag = StromTag_GpuPreAgg;
+	SpinLockInit(&gpupreagg->msg.lock);
+	gpupreagg->msg.refcnt = 1;
+	gpupreagg->msg.respq = pgstrom_get_queue(gpas->mqueue);
+	gpupreagg->msg.cb_process = clserv_process_gpupreagg;
+	gpupreagg->msg.cb_release = clserv_put_gpupreagg;
+	gpupreagg->msg.dindex = -1;
+	gpupreagg->msg.pfm.enabled = gpas->pfm.enabled;
+	gpupreagg->dprog_key = pgstrom_retain_devprog_key(gpas->dprog_key);
+	gpupreagg->rstore = rstore;
+
+	/* kern_parambuf */
+	kparam = &gpupreagg->kern.kparam;
+	memcpy(kparam, gpas->kparambuf, gpas->kparambuf->length);
+	Assert(gpas->kparambuf->length == STROMALIGN(gpas->kparambuf->length));
+
+	/* kern_preagg_result portion */
+	kpresult = KERN_GPUPREAGG_RESULTBUF(&gpupreagg->kern);
+	kpresult->errcode = StromError_Success;
+	kpresult->nrooms = nrooms;
+	kpresult->nitems = 0;
+	kpresult->nparts = gpreagg->numParts;
+	kpresult->nslots = nslots;
+
+	Assert(pgstrom_shmem_sanitycheck(gpupreagg));
+
+	/* track local object */
+	pgstrom_track_object(&gpupreagg->msg.stag);
+
+	return gpupreagg;
+}
+
+static pgstrom_gpupreagg *
+pgstrom_load_gpupreagg(GpuPreAggState *gpas)
+{
+	pgstrom_gpupreagg  *gpupreagg;
+	pgstrom_row_store  *rstore;
+	bool		scan_done;
+	struct timeval tv1, tv2;
+
+	if (gpas->pfm.enabled)
+		gettimeofday(&tv1, NULL);
+	rstore = pgstrom_load_row_store_subplan(outerPlanState(gpas),
+											&gpas->outer_overflow,
+											gpas->rs_colmeta,
+											gpas->cs_colmeta,
+											gpas->cs_colnums,
+											&scan_done);
+	if (scan_done)
+		gpas->outer_done = true;
+	if (!rstore)
+		return NULL;
+	if (gpas->pfm.enabled)
+		gettimeofday(&tv2, NULL);
+
+	gpupreagg = pgstrom_create_gpupreagg(gpas, rstore);
+	if (gpupreagg->msg.pfm.enabled)
+		gpupreagg->msg.pfm.time_to_load += timeval_diff(&tv1, &tv2);
+
+	return gpupreagg;
+}
+
+static void
+gpupreagg_release_chunk(GpuPreAggState *gpas, pgstrom_message *msg)
+{
+	if (msg->pfm.enabled)
+	{
+		pgstrom_perfmon_add(&gpas->pfm, &msg->pfm);
+		pgstrom_perfmon_stat(msg);
+	}
+	Assert(msg->refcnt == 1);
+	pgstrom_untrack_object(&msg->stag);
+	msg->cb_release(msg);
+}
+
+static void
+gpupreagg_release_chunks(GpuPreAggState *gpas)
+{
+	pgstrom_message	   *msg;
+
+	if (gpas->curr_chunk)
+	{
+		gpupreagg_release_chunk(gpas, &gpas->curr_chunk->msg);
+		gpas->curr_chunk = NULL;
+	}
+	gpas->curr_index = 0;
+	gpas->curr_nitems = 0;
+	gpas->curr_on_host = false;
+
+	while (!dlist_is_empty(&gpas->ready_chunks))
+	{
+		msg = dlist_container(pgstrom_message, chain,
+							  dlist_pop_head_node(&gpas->ready_chunks));
+		gpupreagg_release_chunk(gpas, msg);
+	}
+
+	while (gpas->num_running > 0)
+	{
+		msg = pgstrom_dequeue_message(gpas->mqueue);
+		if (!msg)
+			elog(ERROR, "message queue wait timeout");
+		gpas->num_running--;
+		gpupreagg_release_chunk(gpas, msg);
+	}
+}
+
+/*
+ * gpupreagg_next_chunk
+ *
+ * It picks up the next chunk already processed, with launching asynchronous
+ * chunks as gpuscan_exec doing. It returns false if no more chunks.
+ */
+static bool
+gpupreagg_next_chunk(GpuPreAggState *gpas)
+{
+	pgstrom_message	   *msg;
+	pgstrom_gpupreagg  *gpupreagg;
+	kern_preagg_result *kpresult;
+
+	/*
+	 * Release the current gpupreagg chunk being already fetched
+	 */
+	if (gpas->curr_chunk)
+	{
+		gpupreagg_release_chunk(gpas, &gpas->curr_chunk->msg);
+		gpas->curr_chunk = NULL;
+	}
+	gpas->curr_index = 0;
+	gpas->curr_nitems = 0;
+	gpas->curr_on_host = false;
+
+	/*
+	 * Dequeue the current gpupreagg chunks being already processed
+	 */
+	while ((msg = pgstrom_try_dequeue_message(gpas->mqueue)) != NULL)
+	{
+		Assert(gpas->num_running > 0);
+		gpas->num_running--;
+		dlist_push_tail(&gpas->ready_chunks, &msg->chain);
+	}
+
+	/*
+	 * Try to keep number of chunks being asynchronously executed larger
+	 * than minimum multiplicity, unless it does not exceed maximum one
+	 * and OpenCL server does not return a new response.
+	 */
+	while (!gpas->outer_done &&
+		   gpas->num_running <= pgstrom_max_async_chunks)
+	{
+		gpupreagg = pgstrom_load_gpupreagg(gpas);
+		if (!gpupreagg)
+			break;
+
+		if (!pgstrom_enqueue_message(&gpupreagg->msg))
+		{
+			pgstrom_untrack_object(&gpupreagg->msg.stag);
+			gpupreagg->msg.cb_release(&gpupreagg->msg);
+			elog(ERROR, "failed to enqueue pgstrom_gpupreagg message");
+		}
+		gpas->num_running++;
+		gpas->num_chunks++;
+
+		if (gpas->num_running > pgstrom_min_async_chunks &&
+			(msg = pgstrom_try_dequeue_message(gpas->mqueue)) != NULL)
+		{
+			gpas->num_running--;
+			dlist_push_tail(&gpas->ready_chunks, &msg->chain);
+			break;
+		}
+	}
+
+	/*
+	 * Wait for server's response if no available chunks were replied.
+	 */
+	if (dlist_is_empty(&gpas->ready_chunks))
+	{
+		/* OK, no more chunks to be fetched */
+		if (gpas->num_running == 0)
+			return false;
+
+		msg = pgstrom_dequeue_message(gpas->mqueue);
+		if (!msg)
+			elog(ERROR, "message queue wait timeout");
+		gpas->num_running--;
+		dlist_push_tail(&gpas->ready_chunks, &msg->chain);
+	}
+
+	/*
+	 * Picks up next available chunks
+	 */
+	Assert(!dlist_is_empty(&gpas->ready_chunks));
+	gpupreagg = dlist_container(pgstrom_gpupreagg, msg.chain,
+								dlist_pop_head_node(&gpas->ready_chunks));
+	Assert(gpupreagg->msg.stag == StromTag_GpuPreAgg);
+	gpas->curr_chunk = gpupreagg;
+
+	/*
+	 * Raise an error, if chunk-level error was reported. Lack of rooms
+	 * for groups is not an error; we aggregate the chunk on the host
+	 * instead.
+	 */
+	kpresult = KERN_GPUPREAGG_RESULTBUF(&gpupreagg->kern);
+	if (gpupreagg->msg.errcode == StromError_DataStoreNoSpace)
+	{
+		gpas->curr_on_host = true;
+		gpas->curr_nitems = gpupreagg->rstore->kern.nrows;
+		gpas->num_host_chunks++;
+	}
+	else if (gpupreagg->msg.errcode != StromError_Success)
+	{
+		if (gpupreagg->msg.errcode == CL_BUILD_PROGRAM_FAILURE)
+		{
+			const char *buildlog
+				= pgstrom_get_devprog_errmsg(gpupreagg->dprog_key);
+			const char *kern_source
+				= ((GpuPreAggPlan *)gpas->cps.ps.plan)->kern_source;
+
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+					 errmsg("PG-Strom: OpenCL execution error (%s)\n%s",
+							pgstrom_strerror(gpupreagg->msg.errcode),
+							kern_source),
+					 errdetail("%s", buildlog)));
+		}
+		else
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+					 errmsg("PG-Strom: OpenCL execution error (%s)",
+							pgstrom_strerror(gpupreagg->msg.errcode))));
+		}
+	}
+	else
+	{
+		Assert(kpresult->nitems <= kpresult->nrooms);
+		gpas->curr_nitems = kpresult->nitems;
+	}
+	gpas->num_groups += gpas->curr_nitems;
+
+	return true;
+}
+
+/*
+ * gpupreagg_partial_datum
+ *
+ * It translates a partial result being normalized to 64bit value on the
+ * device into datum of the partial result type.
+ */
+static Datum
+gpupreagg_partial_datum(Oid type_oid, cl_ulong value)
+{
+	union {
+		cl_ulong	ival;
+		cl_long		lval;
+		cl_double	dval;
+	} v;
+
+	v.ival = value;
+	switch (type_oid)
+	{
+		case INT2OID:
+			return Int16GetDatum((int16) v.lval);
+		case INT4OID:
+		case DATEOID:
+			return Int32GetDatum((int32) v.lval);
+		case INT8OID:
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return Int64GetDatum((int64) v.lval);
+		case FLOAT4OID:
+			return Float4GetDatum((float4) v.dval);
+		case FLOAT8OID:
+			return Float8GetDatum((float8) v.dval);
+		default:
+			elog(ERROR, "unexpected partial result type: %u", type_oid);
+	}
+	return 0;	/* be compiler quiet */
+}
+
+/*
+ * gpupreagg_host_partial
+ *
+ * It computes a partial result of a row on the host side, for the chunks
+ * with too many groups; each row is returned as a group.
+ */
+static Datum
+gpupreagg_host_partial(GpuPreAggState *gpas, int index, bool *p_isnull)
+{
+	GpuPreAggPlan  *gpreagg = (GpuPreAggPlan *) gpas->cps.ps.plan;
+	AttrNumber		anum = gpreagg->partArgIdx[index];
+	Oid				part_type = gpas->part_types[index];
+	Datum			datum = 0;
+	bool			isnull = false;
+
+	if (anum > 0)
+		datum = slot_getattr(gpas->outer_slot, anum, &isnull);
+
+	if (gpreagg->partKinds[index] == DEVAGG_PCOUNT)
+	{
+		*p_isnull = false;
+		return Int64GetDatum(isnull ? 0 : 1);
+	}
+	*p_isnull = isnull;
+	if (isnull)
+		return 0;
+	if (gpreagg->partKinds[index] == DEVAGG_PSUM && part_type == INT8OID)
+	{
+		TupleDesc	tupdesc = gpas->outer_slot->tts_tupleDescriptor;
+		Oid			arg_type = tupdesc->attrs[anum - 1]->atttypid;
+
+		if (arg_type == INT2OID)
+			return Int64GetDatum((int64) DatumGetInt16(datum));
+		if (arg_type == INT4OID)
+			return Int64GetDatum((int64) DatumGetInt32(datum));
+	}
+	return datum;
+}
+
+static TupleTableSlot *
+gpupreagg_exec(CustomPlanState *node)
+{
+	GpuPreAggState *gpas = (GpuPreAggState *) node;
+	GpuPreAggPlan  *gpreagg = (GpuPreAggPlan *) node->ps.plan;
+	TupleTableSlot *slot = gpas->cps.ps.ps_ResultTupleSlot;
+
+	for (;;)
+	{
+		while (gpas->curr_index < gpas->curr_nitems)
+		{
+			pgstrom_gpupreagg *gpupreagg = gpas->curr_chunk;
+			pgstrom_row_store *rstore = gpupreagg->rstore;
+			kern_preagg_result *kpresult
+				= KERN_GPUPREAGG_RESULTBUF(&gpupreagg->kern);
+			kern_preagg_item *pitem = NULL;
+			rs_tuple   *rs_tup;
+			cl_uint		rowidx;
+			int			i, j;
+
+			if (gpas->curr_on_host)
+				rowidx = gpas->curr_index++;
+			else
+			{
+				pitem = KERN_PREAGG_ITEM(kpresult, gpas->curr_index++);
+				rowidx = pitem->rowidx;
+			}
+			Assert(rowidx < rstore->kern.nrows);
+			rs_tup = kern_rowstore_get_tuple(&rstore->kern, rowidx);
+			ExecStoreTuple(&rs_tup->htup, gpas->outer_slot,
+						   InvalidBuffer, false);
+
+			/* the grouping keys, then the partial results */
+			ExecClearTuple(slot);
+			for (i=0; i < gpreagg->numCols; i++)
+				slot->tts_values[i] = slot_getattr(gpas->outer_slot,
+												   gpreagg->grpColIdx[i],
+												   &slot->tts_isnull[i]);
+			for (j=0; j < gpreagg->numParts; j++, i++)
+			{
+				if (!pitem)
+					slot->tts_values[i]
+						= gpupreagg_host_partial(gpas, j,
+												 &slot->tts_isnull[i]);
+				else if ((pitem->nullmask & (1U << j)) != 0)
+				{
+					slot->tts_values[i] = 0;
+					slot->tts_isnull[i] = true;
+				}
+				else
+				{
+					slot->tts_values[i]
+						= gpupreagg_partial_datum(gpas->part_types[j],
+												  pitem->values[j]);
+					slot->tts_isnull[i] = false;
+				}
+			}
+			return ExecStoreVirtualTuple(slot);
+		}
+
+		if (!gpupreagg_next_chunk(gpas))
+			break;
+	}
+	return NULL;
+}
+
+static Node *
+gpupreagg_exec_multi(CustomPlanState *node)
+{
+	elog(ERROR, "not implemented yet");
+}
+
+static void
+gpupreagg_end(CustomPlanState *node)
+{
+	GpuPreAggState *gpas = (GpuPreAggState *) node;
+
+	/*
+	 * release chunks and device program
+	 */
+	gpupreagg_release_chunks(gpas);
+	if (gpas->outer_overflow)
+		heap_freetuple(gpas->outer_overflow);
+
+	pgstrom_put_devprog_key(gpas->dprog_key);
+	pgstrom_untrack_object((StromTag *)gpas->dprog_key);
+	pgstrom_untrack_object(&gpas->mqueue->stag);
+	pgstrom_close_queue(gpas->mqueue);
+
+	/*
+	 * Free the exprcontext
+	 */
+	ExecFreeExprContext(&gpas->cps.ps);
+
+	/*
+	 * clean out the tuple table
+	 */
+	ExecClearTuple(gpas->cps.ps.ps_ResultTupleSlot);
+	ExecClearTuple(gpas->outer_slot);
+
+	/*
+	 * clean up subtrees
+	 */
+	ExecEndNode(outerPlanState(gpas));
+}
+
+static void
+gpupreagg_rescan(CustomPlanState *node)
+{
+	GpuPreAggState *gpas = (GpuPreAggState *) node;
+
+	gpupreagg_release_chunks(gpas);
+	if (gpas->outer_overflow)
+	{
+		heap_freetuple(gpas->outer_overflow);
+		gpas->outer_overflow = NULL;
+	}
+	gpas->outer_done = false;
+
+	if (outerPlanState(gpas)->chgParam == NULL)
+		ExecReScan(outerPlanState(gpas));
+}
+
+static void
+gpupreagg_explain_rel(CustomPlanState *node, ExplainState *es)
+{
+	/* no target relation for aggregate */
+}
+
+static void
+gpupreagg_explain(CustomPlanState *node, List *ancestors, ExplainState *es)
+{
+	GpuPreAggState *gpas = (GpuPreAggState *) node;
+	GpuPreAggPlan  *gpreagg = (GpuPreAggPlan *) gpas->cps.ps.plan;
+	List		   *context;
+	List		   *result = NIL;
+	bool			useprefix;
+	int				i;
+
+	/* Set up deparsing context */
+	context = deparse_context_for_planstate((Node *) node,
+											ancestors,
+											es->rtable,
+											es->rtable_names);
+	useprefix = (list_length(es->rtable) > 1 || es->verbose);
+
+	for (i=0; i < gpreagg->numCols; i++)
+	{
+		TargetEntry	   *tle;
+
+		tle = get_tle_by_resno(gpreagg->cplan.plan.targetlist, i + 1);
+		Assert(tle != NULL);
+		result = lappend(result,
+						 deparse_expression((Node *) tle->expr, context,
+											useprefix, true));
+	}
+	if (result != NIL)
+		ExplainPropertyList("Group Key", result, es);
+
+	if (es->analyze)
+	{
+		ExplainPropertyLong("Chunks", gpas->num_chunks, es);
+		ExplainPropertyLong("Chunks by Host", gpas->num_host_chunks, es);
+		ExplainPropertyFloat("Partial Groups", gpas->num_groups, 0, es);
+	}
+	show_device_kernel(gpas->dprog_key, es);
+
+	if (es->analyze && gpas->pfm.enabled)
+		pgstrom_perfmon_explain(&gpas->pfm, es);
+}
+
+static Bitmapset *
+gpupreagg_get_relids(CustomPlanState *node)
+{
+	/* nothing to do because core backend walks down outer subtree */
+	return NULL;
+}
+
+static void
+gpupreagg_textout_plan(StringInfo str, const CustomPlan *node)
+{
+	GpuPreAggPlan  *plannode = (GpuPreAggPlan *)node;
+	int				i;
+
+	appendStringInfo(str, " :kern_source ");
+	_outToken(str, plannode->kern_source);
+
+	appendStringInfo(str, " :extra_flags %u", plannode->extra_flags);
+
+	appendStringInfo(str, " :numCols %d", plannode->numCols);
+
+	appendStringInfo(str, " :grpColIdx");
+	for (i=0; i < plannode->numCols; i++)
+		appendStringInfo(str, " %d", plannode->grpColIdx[i]);
+
+	appendStringInfo(str, " :numParts %d", plannode->numParts);
+
+	appendStringInfo(str, " :partKinds");
+	for (i=0; i < plannode->numParts; i++)
+		appendStringInfo(str, " %d", plannode->partKinds[i]);
+
+	appendStringInfo(str, " :partArgIdx");
+	for (i=0; i < plannode->numParts; i++)
+		appendStringInfo(str, " %d", plannode->partArgIdx[i]);
+
+	appendStringInfo(str, " :numGroups %.0f", plannode->numGroups);
+
+	appendStringInfo(str, " :outer_attnums ");
+	_outBitmapset(str, plannode->outer_attnums);
+}
+
+static CustomPlan *
+gpupreagg_copy_plan(const CustomPlan *from)
+{
+	GpuPreAggPlan  *oldnode = (GpuPreAggPlan *)from;
+	GpuPreAggPlan  *newnode = palloc0(sizeof(GpuPreAggPlan));
+	int				numCols = oldnode->numCols;
+	int				numParts = oldnode->numParts;
+
+	CopyCustomPlanCommon((Node *)from, (Node *)newnode);
+	newnode->kern_source = pstrdup(oldnode->kern_source);
+	newnode->extra_flags = oldnode->extra_flags;
+	newnode->numCols = numCols;
+	newnode->grpColIdx = palloc(sizeof(AttrNumber) * Max(numCols, 1));
+	memcpy(newnode->grpColIdx, oldnode->grpColIdx,
+		   sizeof(AttrNumber) * numCols);
+	newnode->numParts = numParts;
+	newnode->partKinds = palloc(sizeof(int) * Max(numParts, 1));
+	memcpy(newnode->partKinds, oldnode->partKinds,
+		   sizeof(int) * numParts);
+	newnode->partArgIdx = palloc(sizeof(AttrNumber) * Max(numParts, 1));
+	memcpy(newnode->partArgIdx, oldnode->partArgIdx,
+		   sizeof(AttrNumber) * numParts);
+	newnode->numGroups = oldnode->numGroups;
+	newnode->outer_attnums = bms_copy(oldnode->outer_attnums);
+
+	return &newnode->cplan;
+}
+
+void
+pgstrom_init_gpupreagg(void)
+{
+	/* GUC definition */
+	DefineCustomBoolVariable("pgstrom.enable_gpupreagg",
+							 "Enables the planner's use of GPU preprocessing of aggregate.",
+							 NULL,
+							 &enable_gpupreagg,
+							 true,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+
+	/* setup plan methods */
+	gpupreagg_plan_methods.CustomName			= "GpuPreAgg";
+	gpupreagg_plan_methods.SetCustomPlanRef		= gpupreagg_set_plan_ref;
+	gpupreagg_plan_methods.SupportBackwardScan	= NULL;
+	gpupreagg_plan_methods.FinalizeCustomPlan	= gpupreagg_finalize_plan;
+	gpupreagg_plan_methods.BeginCustomPlan		= gpupreagg_begin;
+	gpupreagg_plan_methods.ExecCustomPlan		= gpupreagg_exec;
+	gpupreagg_plan_methods.MultiExecCustomPlan	= gpupreagg_exec_multi;
+	gpupreagg_plan_methods.EndCustomPlan		= gpupreagg_end;
+	gpupreagg_plan_methods.ReScanCustomPlan		= gpupreagg_rescan;
+	gpupreagg_plan_methods.ExplainCustomPlanTargetRel = gpupreagg_explain_rel;
+	gpupreagg_plan_methods.ExplainCustomPlan	= gpupreagg_explain;
+	gpupreagg_plan_methods.GetRelidsCustomPlan	= gpupreagg_get_relids;
+	gpupreagg_plan_methods.GetSpecialCustomVar	= NULL;
+	gpupreagg_plan_methods.TextOutCustomPlan	= gpupreagg_textout_plan;
+	gpupreagg_plan_methods.CopyCustomPlan		= gpupreagg_copy_plan;
+
+	/* hook registration */
+	planner_hook_next = planner_hook;
+	planner_hook = gpupreagg_planner;
+}
+
+/*
+ * GpuPreAgg message handler
+ * ------------------------------------------------------------
+ * Note that below routines are executed in the context of OpenCL
+ * intermediation server, thus, usual PostgreSQL internal APIs are
+ * not available, and need to pay attention that routines work in
+ * another process's address space.
+ */
+#define GPUPREAGG_MAX_EVENTS	7
+
+typedef struct
+{
+	pgstrom_message	*msg;
+	cl_program		program;
+	cl_kernel		kern_setup;
+	cl_kernel		kern_grouping;
+	cl_kernel		kern_aggregate;
+	cl_mem			m_gpupreagg;
+	cl_mem			m_rstore;
+	cl_mem			m_cstore;
+	cl_mem			m_workbuf;
+	bool			rstore_mapped;	/* m_rstore is mapped on host memory */
+	Size			dma_length;	/* length of DMA send, for scheduler */
+	cl_int			ev_kern;	/* index of the first kernel event */
+	cl_int			ev_index;
+	cl_event		events[GPUPREAGG_MAX_EVENTS];
+} clstate_gpupreagg;
+
+static void
+clserv_respond_gpupreagg(cl_event event, cl_int ev_status, void *private)
+{
+	clstate_gpupreagg  *clgpa = private;
+	pgstrom_gpupreagg  *gpupreagg = (pgstrom_gpupreagg *)clgpa->msg;
+	kern_preagg_result *kpresult
+		= KERN_GPUPREAGG_RESULTBUF(&gpupreagg->kern);
+	cl_ulong			time_dma = 0;
+	cl_ulong			time_kern = 0;
+
+	/* put error code */
+	if (ev_status != CL_COMPLETE)
+	{
+		elog(LOG, "unexpected CL_EVENT_COMMAND_EXECUTION_STATUS: %d",
+			 ev_status);
+		gpupreagg->msg.errcode = StromError_OpenCLInternal;
+	}
+	else
+	{
+		gpupreagg->msg.errcode = kpresult->errcode;
+	}
+
+	/*
+	 * collect performance statistics; DMA send is events prior to the
+	 * first kernel, kernel execution is from the first kernel to the
+	 * last one, then DMA receive is the last event.
+	 */
+	if (ev_status == CL_COMPLETE)
+	{
+		cl_ulong	dma_send_begin = ~0UL;
+		cl_ulong	dma_send_end = 0;
+		cl_ulong	kern_exec_begin;
+		cl_ulong	kern_exec_end;
+		cl_ulong	dma_recv_begin;
+		cl_ulong	dma_recv_end;
+		cl_ulong	tv_begin;
+		cl_ulong	tv_end;
+		cl_ulong	time_overlap;
+		cl_int		i, rc;
+
+		for (i=0; i < clgpa->ev_kern; i++)
+		{
+			rc = clserv_get_event_profiling(clgpa->events[i],
+											&tv_begin, &tv_end);
+			if (rc != CL_SUCCESS)
+				goto skip_perfmon;
+			dma_send_begin = Min(dma_send_begin, tv_begin);
+			dma_send_end = Max(dma_send_end, tv_end);
+		}
+
+		rc = clserv_get_event_profiling(clgpa->events[clgpa->ev_kern],
+										&kern_exec_begin, &tv_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+		rc = clserv_get_event_profiling(clgpa->events[clgpa->ev_index - 2],
+										&tv_begin, &kern_exec_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+
+		rc = clserv_get_event_profiling(clgpa->events[clgpa->ev_index - 1],
+										&dma_recv_begin, &dma_recv_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+
+		time_dma = ((dma_send_end - dma_send_begin) +
+					(dma_recv_end - dma_recv_begin)) / 1000;
+		time_kern = (kern_exec_end - kern_exec_begin) / 1000;
+		time_overlap = pgstrom_opencl_device_overlap(&gpupreagg->msg,
+													 dma_send_begin,
+													 dma_send_end,
+													 kern_exec_begin,
+													 kern_exec_end,
+													 dma_recv_begin,
+													 dma_recv_end);
+
+		if (gpupreagg->msg.pfm.enabled)
+		{
+			gpupreagg->msg.pfm.time_dma_send
+				+= (dma_send_end - dma_send_begin) / 1000;
+			gpupreagg->msg.pfm.time_kern_exec
+				+= (kern_exec_end - kern_exec_begin) / 1000;
+			gpupreagg->msg.pfm.time_dma_recv
+				+= (dma_recv_end - dma_recv_begin) / 1000;
+			gpupreagg->msg.pfm.time_dma_overlap += time_overlap;
+		}
+
+	skip_perfmon:
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clGetEventProfilingInfo (%s)",
+				 opencl_strerror(rc));
+			gpupreagg->msg.pfm.enabled = false;	/* turn off profiling */
+		}
+	}
+	/* record the commands on the profiling timeline, if enabled */
+	if (ev_status == CL_COMPLETE)
+		clserv_timeline_record(&gpupreagg->msg, clgpa->events, clgpa->ev_index,
+							   clgpa->ev_kern, clgpa->ev_index - 1);
+
+	/* inform the device scheduler of completion */
+	pgstrom_opencl_device_complete(&gpupreagg->msg, clgpa->dma_length,
+								   time_dma, time_kern);
+
+	/* release opencl objects */
+	while (clgpa->ev_index > 0)
+		clReleaseEvent(clgpa->events[--clgpa->ev_index]);
+	clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_workbuf);
+	clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_cstore);
+	if (clgpa->rstore_mapped)
+		clReleaseMemObject(clgpa->m_rstore);
+	else
+		clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_rstore);
+	clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_gpupreagg);
+	clReleaseKernel(clgpa->kern_aggregate);
+	clReleaseKernel(clgpa->kern_grouping);
+	clReleaseKernel(clgpa->kern_setup);
+	clReleaseProgram(clgpa->program);
+	free(clgpa);
+
+	/* respond to the backend side */
+	pgstrom_reply_message(&gpupreagg->msg);
+}
+
+static cl_int
+clserv_enqueue_gpupreagg_kernel(cl_command_queue kcmdq,
+								clstate_gpupreagg *clgpa,
+								cl_kernel kernel,
+								size_t gwork_sz,
+								size_t lwork_sz)
+{
+	cl_int		rc;
+
+	Assert(clgpa->ev_index < GPUPREAGG_MAX_EVENTS);
+	rc = clEnqueueNDRangeKernel(kcmdq,
+								kernel,
+								1,
+								NULL,
+								&gwork_sz,
+								&lwork_sz,
+								clgpa->ev_index,
+								&clgpa->events[0],
+								&clgpa->events[clgpa->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueNDRangeKernel: %s",
+			 opencl_strerror(rc));
+		return rc;
+	}
+	clgpa->ev_index++;
+	return CL_SUCCESS;
+}
+
+static void
+clserv_process_gpupreagg(pgstrom_message *msg)
+{
+	pgstrom_gpupreagg  *gpupreagg = (pgstrom_gpupreagg *) msg;
+	kern_preagg_result *kpresult
+		= KERN_GPUPREAGG_RESULTBUF(&gpupreagg->kern);
+	kern_row_store	   *krstore = &gpupreagg->rstore->kern;
+	kern_column_store  *kcstore_head = gpupreagg->rstore->kcs_head;
+	clstate_gpupreagg  *clgpa;
+	cl_program			program;
+	cl_command_queue	kcmdq;
+	cl_command_queue	kcmdq_send;
+	cl_command_queue	kcmdq_recv;
+	cl_uint				nrows = krstore->nrows;
+	cl_int				i, rc;
+	size_t				setup_lwork_sz;
+	size_t				group_lwork_sz;
+	size_t				agg_lwork_sz;
+
+	Assert(gpupreagg->rstore->stag == StromTag_RowStore);
+
+	/* see comments in clserv_process_gpuscan_row */
+	program = clserv_lookup_device_program(gpupreagg->dprog_key,
+										   &gpupreagg->msg);
+	if (!program)
+		return;		/* message is in waitq, retry it! */
+	if (program == BAD_OPENCL_PROGRAM)
+	{
+		rc = CL_BUILD_PROGRAM_FAILURE;
+		goto error0;
+	}
+
+	/* state object of gpupreagg */
+	clgpa = malloc(sizeof(clstate_gpupreagg));
+	if (!clgpa)
+	{
+		clReleaseProgram(program);
+		rc = CL_OUT_OF_HOST_MEMORY;
+		goto error0;
+	}
+	memset(clgpa, 0, sizeof(clstate_gpupreagg));
+	clgpa->msg = &gpupreagg->msg;
+	clgpa->program = program;
+
+	clgpa->kern_setup = clCreateKernel(clgpa->program,
+									   "gpupreagg_setup_rs",
+									   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error1;
+	}
+	clgpa->kern_grouping = clCreateKernel(clgpa->program,
+										  "gpupreagg_grouping",
+										  &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error2;
+	}
+	clgpa->kern_aggregate = clCreateKernel(clgpa->program,
+										   "gpupreagg_aggregate",
+										   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error3;
+	}
+
+	/*
+	 * Choose a device to execute this kernel
+	 */
+	clgpa->dma_length = (KERN_GPUPREAGG_LENGTH(&gpupreagg->kern) +
+						 krstore->length);
+	i = pgstrom_opencl_device_schedule(&gpupreagg->msg, clgpa->dma_length);
+	kcmdq = opencl_cmdq[i];
+	kcmdq_send = opencl_cmdq_send[i];
+	kcmdq_recv = opencl_cmdq_recv[i];
+
+	/*
+	 * Compute workgroup-size of the kernels; both of kern_row_to_column
+	 * and the local reduction need a multiple of 32.
+	 */
+	setup_lwork_sz = clserv_compute_workgroup_size(clgpa->kern_setup, i,
+												   nrows, sizeof(cl_uint));
+	group_lwork_sz = clserv_compute_workgroup_size(clgpa->kern_grouping, i,
+												   nrows, 0);
+	agg_lwork_sz = clserv_compute_workgroup_size(clgpa->kern_aggregate, i,
+												 nrows, 16);
+	if (setup_lwork_sz == 0 || group_lwork_sz == 0 || agg_lwork_sz == 0)
+	{
+		rc = CL_INVALID_WORK_GROUP_SIZE;
+		goto error5;
+	}
+
+	/* allocation of device memory for kern_gpupreagg argument */
+	clgpa->m_gpupreagg =
+		clserv_create_buffer(gpupreagg->msg.dindex,
+							 KERN_GPUPREAGG_LENGTH(&gpupreagg->kern),
+							 &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error5;
+	}
+
+	/* allocation of device memory for kern_row_store argument */
+	clgpa->m_rstore = clserv_create_device_buffer(gpupreagg->msg.dindex,
+												  krstore,
+												  krstore->length,
+												  &clgpa->rstore_mapped,
+												  &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error6;
+	}
+
+	/* allocation of device memory for kern_column_store argument */
+	clgpa->m_cstore = clserv_create_buffer(gpupreagg->msg.dindex,
+										   kcstore_head->length,
+										   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	/* allocation of device memory for the working buffer */
+	clgpa->m_workbuf =
+		clserv_create_buffer(gpupreagg->msg.dindex,
+							 KERN_GPUPREAGG_WORKBUF_LENGTH(kpresult->nslots,
+														   nrows),
+							 &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error8;
+	}
+
+	/*
+	 * Set up kernel arguments
+	 *
+	 *   gpupreagg_setup_rs(kern_gpupreagg, kern_row_store,
+	 *                      kern_column_store, workbuf, local_workmem)
+	 *   gpupreagg_grouping(kern_gpupreagg, kern_column_store, workbuf)
+	 *   gpupreagg_aggregate(kern_gpupreagg, kern_column_store, workbuf,
+	 *                       local_workmem)
+	 */
+	if ((rc = clSetKernelArg(clgpa->kern_setup, 0, sizeof(cl_mem),
+							 &clgpa->m_gpupreagg)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_setup, 1, sizeof(cl_mem),
+							 &clgpa->m_rstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_setup, 2, sizeof(cl_mem),
+							 &clgpa->m_cstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_setup, 3, sizeof(cl_mem),
+							 &clgpa->m_workbuf)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_setup, 4,
+							 sizeof(cl_uint) * setup_lwork_sz,
+							 NULL)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_grouping, 0, sizeof(cl_mem),
+							 &clgpa->m_gpupreagg)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_grouping, 1, sizeof(cl_mem),
+							 &clgpa->m_cstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_grouping, 2, sizeof(cl_mem),
+							 &clgpa->m_workbuf)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_aggregate, 0, sizeof(cl_mem),
+							 &clgpa->m_gpupreagg)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_aggregate, 1, sizeof(cl_mem),
+							 &clgpa->m_cstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_aggregate, 2, sizeof(cl_mem),
+							 &clgpa->m_workbuf)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgpa->kern_aggregate, 3,
+							 16 * agg_lwork_sz,
+							 NULL)) != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error9;
+	}
+
+	/*
+	 * OK, enqueue DMA transfer, kernel execution, then DMA writeback.
+	 *
+	 * (1) kern_gpupreagg, row-store and header portion of column-store
+	 *     shall be copied to the device memory
+	 * (2) row-store is translated to column-store, grouped and the
+	 *     partial results are computed
+	 * (3) kern_preagg_result shall be written back
+	 */
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clgpa->m_gpupreagg,
+									 0,
+									 KERN_GPUPREAGG_DMA_SENDLEN(&gpupreagg->kern),
+									 &gpupreagg->kern,
+									 0,
+									 NULL,
+									 &clgpa->events[clgpa->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
+		goto error9;
+	}
+	clgpa->ev_index++;
+
+	if (!clgpa->rstore_mapped)
+	{
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clgpa->m_rstore,
+										 0,
+										 krstore->length,
+										 krstore,
+										 0,
+										 NULL,
+										 &clgpa->events[clgpa->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clgpa->ev_index++;
+	}
+
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clgpa->m_cstore,
+									 0,
+									 offsetof(kern_column_store,
+											  colmeta[kcstore_head->ncols]),
+									 kcstore_head,
+									 0,
+									 NULL,
+									 &clgpa->events[clgpa->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	clgpa->ev_index++;
+
+	/*
+	 * Kick the kernels; each kernel waits for completion of all the
+	 * previous commands.
+	 */
+	clgpa->ev_kern = clgpa->ev_index;
+	rc = clserv_enqueue_gpupreagg_kernel(kcmdq, clgpa, clgpa->kern_setup,
+										 ((nrows + setup_lwork_sz - 1) /
+										  setup_lwork_sz) * setup_lwork_sz,
+										 setup_lwork_sz);
+	if (rc != CL_SUCCESS)
+		goto error_sync;
+
+	rc = clserv_enqueue_gpupreagg_kernel(kcmdq, clgpa, clgpa->kern_grouping,
+										 ((nrows + group_lwork_sz - 1) /
+										  group_lwork_sz) * group_lwork_sz,
+										 group_lwork_sz);
+	if (rc != CL_SUCCESS)
+		goto error_sync;
+
+	rc = clserv_enqueue_gpupreagg_kernel(kcmdq, clgpa, clgpa->kern_aggregate,
+										 ((nrows + agg_lwork_sz - 1) /
+										  agg_lwork_sz) * agg_lwork_sz,
+										 agg_lwork_sz);
+	if (rc != CL_SUCCESS)
+		goto error_sync;
+
+	/*
+	 * Write back the result-buffer
+	 */
+	rc = clserv_enqueue_read_buffer(kcmdq_recv,
+									clgpa->m_gpupreagg,
+									((uintptr_t)kpresult -
+									 (uintptr_t)(&gpupreagg->kern)),
+									KERN_GPUPREAGG_DMA_RECVLEN(&gpupreagg->kern),
+									kpresult,
+									1,
+									&clgpa->events[clgpa->ev_index - 1],
+									&clgpa->events[clgpa->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueReadBuffer: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	clgpa->ev_index++;
+
+	/* submit the commands on the transfer and compute queues */
+	clserv_flush_device_queues(gpupreagg->msg.dindex);
+
+	/*
+	 * Last, registers a callback routine that replies the message
+	 * to the backend
+	 */
+	rc = clserv_set_event_callback(clgpa->events[clgpa->ev_index - 1],
+								   clserv_respond_gpupreagg,
+								   clgpa);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetEventCallback: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	return;
+
+error_sync:
+	/* see comments in clserv_process_gpuscan_row */
+	clWaitForEvents(clgpa->ev_index, clgpa->events);
+	while (clgpa->ev_index > 0)
+		clReleaseEvent(clgpa->events[--clgpa->ev_index]);
+error9:
+	clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_workbuf);
+error8:
+	clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_cstore);
+error7:
+	if (clgpa->rstore_mapped)
+		clReleaseMemObject(clgpa->m_rstore);
+	else
+		clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_rstore);
+error6:
+	clserv_release_buffer(gpupreagg->msg.dindex, clgpa->m_gpupreagg);
+error5:
+	pgstrom_opencl_device_complete(&gpupreagg->msg, clgpa->dma_length, 0, 0);
+	clReleaseKernel(clgpa->kern_aggregate);
+error3:
+	clReleaseKernel(clgpa->kern_grouping);
+error2:
+	clReleaseKernel(clgpa->kern_setup);
+error1:
+	clReleaseProgram(clgpa->program);
+	free(clgpa);
+error0:
+	gpupreagg->msg.errcode = rc;
+	pgstrom_reply_message(&gpupreagg->msg);
+}
+
+/*
+ * clserv_put_gpupreagg
+ *
+ * Callback handler when reference counter of pgstrom_gpupreagg object
+ * reached to zero, due to pgstrom_put_message.
+ * It also unlinks associated device program and release row-store.
+ * Also note that this routine can be called under the OpenCL server
+ * context.
+ */
+static void
+clserv_put_gpupreagg(pgstrom_message *msg)
+{
+	pgstrom_gpupreagg  *gpupreagg = (pgstrom_gpupreagg *)msg;
+
+	/* unlink message queue */
+	pgstrom_put_queue(msg->respq);
+
+	/* unlink device program */
+	pgstrom_put_devprog_key(gpupreagg->dprog_key);
+
+	/* release row-store */
+	pgstrom_shmem_free(gpupreagg->rstore);
+
+	pgstrom_shmem_free(gpupreagg);
+}
@@ -11,7 +11,12 @@
  * within this package.
  */
 #include "postgres.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/nbtree.h"
 #include "access/sysattr.h"
+#include "catalog/pg_am.h"
+#include "commands/defrem.h"
 #include "commands/explain.h"
 #include "miscadmin.h"
 #include "nodes/bitmapset.h"
@@ -33,11 +38,36 @@
 #include "utils/spccache.h"
 #include "pg_strom.h"
 #include "opencl_gpuscan.h"
+#include <float.h>
+#include <strings.h>
+
+/*
+ * length of kern_row_store, offsets of rs_tuple and nrooms of kern_resultbuf
+ * are cl_uint, so a chunk has to be kept below 4GB.
+ */
+#define GPUSCAN_CHUNK_BITS_MAX		30			/* 1GB */
 
 static add_scan_path_hook_type	add_scan_path_next;
 static CustomPathMethods		gpuscan_path_methods;
 static CustomPlanMethods		gpuscan_plan_methods;
 static bool						enable_gpuscan;
+static bool						enable_tcache;
+static int						gpuscan_prefetch_chunks;
+static int						gpuscan_chunk_size_min;	/* in KB */
+static int						gpuscan_chunk_size_max;	/* in KB */
+static bool						gpuscan_result_bitmap;
+static bool						gpuscan_device_projection;
+static bool						gpuscan_vector_kernel;
+static double					gpuscan_setup_cost;
+static double					gpuscan_operator_cost;
+static double					gpuscan_dma_cost;	/* per KB */
+static int						gpuscan_shared_chunks;
+
+/*
+ * Device time of a chunk less than this threshold (in usec) is considered
+ * to be hidden by the overhead of message exchange and kernel launch.
+ */
+#define GPUSCAN_CHUNK_MIN_DEVTIME		2000
 
 typedef struct {
 	CustomPath	cpath;
@@ -45,6 +75,7 @@ typedef struct {
 	List	   *host_quals;		/* RestrictInfo run on host */
 	Bitmapset  *dev_attnums;	/* attnums referenced in device */
 	Bitmapset  *host_attnums;	/* attnums referenced in host */
+	bool		is_cached;		/* true, if dev_attnums are on tcache */
 } GpuScanPath;
 
 typedef struct {
@@ -57,6 +88,8 @@ typedef struct {
 	List	   *dev_clauses;	/* clauses to be run on device */
 	Bitmapset  *dev_attnums;	/* attnums referenced in device */
 	Bitmapset  *host_attnums;	/* attnums referenced in host */
+	bool		use_tcache;		/* true, if scan on the columnar cache */
+	double		dev_qual_ops;	/* number of operators per row on device */
 } GpuScanPlan;
 
 /*
@@ -81,14 +114,35 @@ typedef struct {
 #define GpuScanMode_HeapOnlyScan	0x0003
 #define GpuScanMode_CreateCache		0x0004
 
+/*
+ * GpuScanZoneQual - a simple "<column> <op> <const>" form device qualifier
+ * that allows to skip a whole chunk of columnar cache using its zone map.
+ */
+typedef struct {
+	int			cindex;		/* index of tcs->cdata[] */
+	Oid			type_oid;	/* data type of the column */
+	int			strategy;	/* btree strategy number of the operator */
+	Datum		value;		/* constant to be compared */
+} GpuScanZoneQual;
+
 typedef struct {
 	CustomPlanState		cps;
 	Relation			scan_rel;
 	HeapScanDesc		scan_desc;
+	tcache_scandesc	   *tc_scan;	/* valid, if GpuScanMode_HybridScan */
 	TupleTableSlot	   *scan_slot;
+	HeapTupleData		scan_tuple;	/* buffer to fetch a tuple by ctid */
 	List			   *dev_quals;
 
 	int					scan_mode;	/* one of GpuScanMode_* */
+	bool				scan_done;	/* no more chunks to be loaded */
+	BlockNumber			prefetch_blocks;	/* blocks already prefetched */
+	int					chunk_shift;	/* row-store size = 2^chunk_shift */
+	int					chunk_vote;		/* >0 to enlarge, <0 to shrink */
+	cl_uint				chunk_count[SHMEM_BLOCKSZ_BITS_MAX + 1];
+	cl_ulong			result_nrooms;	/* sum of nrooms of the results */
+	cl_ulong			result_nitems;	/* sum of nitems of the results */
+	double				dev_qual_ops;	/* operators per row on device */
 	pgstrom_queue	   *mqueue;
 	Datum				dprog_key;
 
@@ -96,6 +150,13 @@ typedef struct {
 	kern_colmeta	   *rs_colmeta;
 	kern_colmeta	   *cs_colmeta;
 	int					cs_colnums;
+	cl_uint			   *cs_cindex;	/* index of tcs->cdata[], if tcache */
+	int					num_zone_quals;
+	GpuScanZoneQual	   *zone_quals;	/* chunk skipping by zone map */
+	cl_uint				num_skipped;/* number of chunks being skipped */
+	int					proj_ncols;	/* number of projected columns */
+	kern_colmeta	   *proj_colmeta;	/* template of kproj */
+	AttrNumber		   *proj_anums;	/* attnums of the projected columns */
 
 	pgstrom_gpuscan	   *curr_chunk;
 	uint32				curr_index;
@@ -106,8 +167,45 @@ typedef struct {
 } GpuScanState;
 
 /* static functions */
-static void clserv_process_gpuscan_row(pgstrom_message *msg);
-static void clserv_put_gpuscan_row(pgstrom_message *msg);
+static void clserv_process_gpuscan(pgstrom_message *msg);
+static void clserv_put_gpuscan(pgstrom_message *msg);
+static int gpuscan_log2_ceil(Size size);
+static int gpuscan_chunk_shift_clamp(int shift);
+
+/*
+ * pgstrom_device_costs
+ *
+ * It returns the planner costs of the device; a setup cost of the node,
+ * cost of an operator on the device and cost to send a byte by DMA.
+ * The device time is translated into the planner cost with assumption
+ * of PGSTROM_CPU_OPERATOR_USEC per cpu_operator_cost. An operator on
+ * the device is charged by the calibrated kernel time, or estimation
+ * by the device properties if no samples yet. GUC settings override
+ * these settings, if not negative. Other GPU nodes also use these costs,
+ * to be estimated in the same scale as GpuScan.
+ */
+void
+pgstrom_device_costs(Cost *p_setup_cost,
+					 Cost *p_operator_cost,
+					 Cost *p_dma_per_byte)
+{
+	Cost		cost_per_usec = cpu_operator_cost / PGSTROM_CPU_OPERATOR_USEC;
+	double		dma_usec;
+	double		op_usec;
+
+	if (!pgstrom_opencl_device_costs(&dma_usec, &op_usec))
+	{
+		dma_usec = 1.0 / 4096.0;
+		op_usec = PGSTROM_CPU_OPERATOR_USEC / 100.0;
+	}
+	*p_setup_cost = gpuscan_setup_cost;
+	*p_operator_cost = (gpuscan_operator_cost >= 0.0
+						? gpuscan_operator_cost
+						: op_usec * cost_per_usec);
+	*p_dma_per_byte = (gpuscan_dma_cost >= 0.0
+					   ? gpuscan_dma_cost / 1024.0
+					   : dma_usec * cost_per_usec);
+}
 
 /*
  * cost_gpuscan
@@ -117,7 +215,7 @@ static void clserv_put_gpuscan_row(pgstrom_message *msg);
 static void
 cost_gpuscan(GpuScanPath *gpu_path, PlannerInfo *root,
 			 RelOptInfo *baserel, ParamPathInfo *param_info,
-			 List *dev_quals, List *host_quals)
+			 List *dev_quals, List *host_quals, bool is_cached)
 {
 	Path	   *path = &gpu_path->cpath.path;
 	Cost		startup_cost = 0;
@@ -127,6 +225,13 @@ cost_gpuscan(GpuScanPath *gpu_path, PlannerInfo *root,
 	QualCost	host_cost;
 	Cost		gpu_per_tuple;
 	Cost		cpu_per_tuple;
+	Cost		setup_cost;
+	Cost		dev_op_cost;
+	Cost		dma_per_byte;
+	Cost		kern_per_tuple;
+	Cost		dma_per_tuple;
+	double		tuple_bytes;
+	double		chunk_rows;
 	Selectivity	dev_sel;
 
 	/* Should only be applied to base relations */
@@ -146,29 +251,47 @@ cost_gpuscan(GpuScanPath *gpu_path, PlannerInfo *root,
 	get_tablespace_page_costs(baserel->reltablespace,
 							  NULL,
 							  &spc_seq_page_cost);
-	/*
-	 * disk costs
-	 * XXX - needs to adjust after columner cache in case of bare heapscan,
-	 * or partial heapscan if targetlist references out of cached columns
-	 */
-    run_cost += spc_seq_page_cost * baserel->pages;
-
 	/* GPU costs */
 	cost_qual_eval(&dev_cost, dev_quals, root);
 	dev_sel = clauselist_selectivity(root, dev_quals, 0, JOIN_INNER, NULL);
 
 	/*
-	 * XXX - very rough estimation towards GPU startup and device calculation
-	 *       to be adjusted according to device info
-	 *
-	 * TODO: startup cost takes NITEMS_PER_CHUNK * width to be carried, but
-	 * only first chunk because data transfer is concurrently done, if NOT
-	 * integrated GPU
-	 * TODO: per_tuple calculation cost shall be divided by parallelism of
-	 * average opencl spec.
+	 * disk costs
+	 * If columns referenced by device qualifiers are already on the columnar
+	 * cache, we don't need to walk on the heap to load row-stores. Only
+	 * tuples being survived on the device qualifiers are fetched from the
+	 * heap by ctid, for visibility checks and references by host side.
+	 * The cache is sorted by ctid, so we can assume these fetches touch
+	 * the pages in order.
+	 */
+	if (!is_cached)
+		run_cost += spc_seq_page_cost * baserel->pages;
+	else
+	{
+		double	fetched_pages = Min((double) baserel->pages,
+									ceil(dev_sel * baserel->tuples));
+		run_cost += spc_seq_page_cost * fetched_pages;
+	}
+
+	/*
+	 * Device costs
+	 * DMA transfer of a chunk is overlapped with the kernel execution of
+	 * the prior chunk, so a row is charged by the larger one, except for
+	 * the first chunk that has to be sent prior to the kernel execution.
 	 */
-	dev_cost.startup += 10000;
-	dev_cost.per_tuple /= 100;
+	pgstrom_device_costs(&setup_cost, &dev_op_cost, &dma_per_byte);
+	tuple_bytes = (MAXALIGN(SizeofHeapTupleHeader) +
+				   MAXALIGN(baserel->width) + sizeof(cl_uint));
+	kern_per_tuple = (cpu_operator_cost > 0.0
+					  ? dev_cost.per_tuple * (dev_op_cost / cpu_operator_cost)
+					  : 0.0);
+	dma_per_tuple = dma_per_byte * tuple_bytes;
+	chunk_rows = Min(baserel->tuples,
+					 (double)((Size)gpuscan_chunk_size_min << 10) /
+					 tuple_bytes);
+	dev_cost.startup += (setup_cost +
+						 chunk_rows * (kern_per_tuple + dma_per_tuple));
+	dev_cost.per_tuple = Max(kern_per_tuple, dma_per_tuple);
 
 	/* CPU costs */
 	cost_qual_eval(&host_cost, host_quals, root);
@@ -185,7 +308,7 @@ cost_gpuscan(GpuScanPath *gpu_path, PlannerInfo *root,
 	/* total path cost */
 	startup_cost += dev_cost.startup + host_cost.startup;
 	cpu_per_tuple = cpu_tuple_cost + host_cost.per_tuple;
-	gpu_per_tuple = cpu_tuple_cost / 100 + dev_cost.per_tuple;
+	gpu_per_tuple = dev_cost.per_tuple;
 	run_cost += (gpu_per_tuple * baserel->tuples +
 				 cpu_per_tuple * dev_sel * baserel->tuples);
 
@@ -203,6 +326,7 @@ gpuscan_add_scan_path(PlannerInfo *root,
 	List		   *host_quals = NIL;
 	Bitmapset	   *dev_attnums = NULL;
 	Bitmapset	   *host_attnums = NULL;
+	bool			is_cached = false;
 	ListCell	   *cell;
 	codegen_context	context;
 
@@ -250,7 +374,22 @@ gpuscan_add_scan_path(PlannerInfo *root,
 	 * Anyway, it needs investigation of the actual behavior.
 	 */
 
-	/* XXX - check whether columnar cache may be available */
+	/*
+	 * Check whether columnar cache is available. If all the columns being
+	 * referenced by device qualifiers are cached, we can send column-stores
+	 * on the cache to the device, instead of row-stores loaded from heap.
+	 */
+	if (enable_tcache && dev_quals != NIL)
+	{
+		tcache_head	   *tc_head = tcache_get_tchead(rte->relid,
+													dev_attnums,
+													false);
+		if (tc_head)
+		{
+			is_cached = true;
+			tcache_put_tchead(tc_head);
+		}
+	}
 
 	/*
 	 * Construction of a custom-plan node.
@@ -266,22 +405,32 @@ gpuscan_add_scan_path(PlannerInfo *root,
 
 	cost_gpuscan(pathnode, root, baserel,
 				 pathnode->cpath.path.param_info,
-				 dev_quals, host_quals);
+				 dev_quals, host_quals, is_cached);
 
 	pathnode->dev_quals = dev_quals;
 	pathnode->host_quals = host_quals;
 	pathnode->dev_attnums = dev_attnums;
 	pathnode->host_attnums = host_attnums;
+	pathnode->is_cached = is_cached;
 
 	add_path(baserel, &pathnode->cpath.path);
 }
 
+/*
+ * gpuscan_codegen_quals
+ *
+ * It constructs kernel source to evaluate the device qualifiers. If
+ * 'vectorize' is true and qualifiers are simple enough, a vectorized
+ * kernel for column-store is also generated; OpenCL intermediator
+ * launches it on the devices that prefer vector types.
+ */
 static char *
-gpuscan_codegen_quals(PlannerInfo *root, List *dev_quals,
+gpuscan_codegen_quals(PlannerInfo *root, List *dev_quals, bool vectorize,
 					  codegen_context *context)
 {
 	StringInfoData	str;
 	char		   *expr_code;
+	char		   *vector_code = NULL;
 
 	memset(context, 0, sizeof(codegen_context));
 	if (dev_quals == NIL)
@@ -289,6 +438,13 @@ gpuscan_codegen_quals(PlannerInfo *root, List *dev_quals,
 
 	expr_code = pgstrom_codegen_expression((Node *)dev_quals, context);
 	Assert(expr_code != NULL);
+	if (vectorize && gpuscan_vector_kernel)
+	{
+		vector_code = pgstrom_codegen_vector_expression((Node *)dev_quals,
+														context);
+		if (vector_code)
+			context->extra_flags |= DEVKERNEL_NEEDS_VECTOR;
+	}
 
 	initStringInfo(&str);
 
@@ -299,14 +455,14 @@ gpuscan_codegen_quals(PlannerInfo *root, List *dev_quals,
 
 	/* qualifier definition with row-store */
 	appendStringInfo(&str,
-					 "__kernel void\n"
-					 "gpuscan_qual_cs(__global kern_gpuscan *kgscan,\n"
-					 "                __global kern_column_store *kcs,\n"
-					 "                __global kern_toastbuf *toast,\n"
-					 "                __local void *local_workmem)\n"
+					 "static cl_int\n"
+					 "gpuscan_qual_eval(__global kern_gpuscan *kgscan,\n"
+					 "                  __global kern_column_store *kcs,\n"
+					 "                  __global kern_toastbuf *toast,\n"
+					 "                  __local void *local_workmem)\n"
 					 "{\n"
 					 "  pg_bool_t   rc;\n"
-					 "  cl_int      errcode;\n"
+					 "  cl_int      errcode = StromError_Success;\n"
 					 "  __global kern_parambuf *kparams\n"
 					 "    = KERN_GPUSCAN_PARAMBUF(kgscan);\n"
 					 "\n"
@@ -317,29 +473,103 @@ gpuscan_codegen_quals(PlannerInfo *root, List *dev_quals,
 					 "    rc = %s;\n"
 					 "  else\n"
 					 "    rc.isnull = true;\n"
-					 "  gpuscan_set_error(!rc.isnull && rc.value != 0\n"
-					 "                    ? StromError_Success\n"
-					 "                    : StromError_RowFiltered,\n"
-					 "                    local_workmem);\n"
-					 "  gpuscan_writeback_result(kgscan, local_workmem);\n"
+					 "  if (errcode == StromError_Success &&\n"
+					 "      (rc.isnull || rc.value == 0))\n"
+					 "    errcode = StromError_RowFiltered;\n"
+					 "  gpuscan_set_error(errcode, local_workmem);\n"
+					 "  return gpuscan_writeback_result(kgscan, local_workmem);\n"
+					 "}\n"
+					 "\n"
+					 "__kernel void\n"
+					 "gpuscan_qual_cs(__global kern_gpuscan *kgscan,\n"
+					 "                __global kern_column_store *kcs,\n"
+					 "                __global kern_toastbuf *toast,\n"
+					 "                __local void *local_workmem)\n"
+					 "{\n"
+					 "  gpuscan_qual_eval(kgscan,kcs,toast,local_workmem);\n"
 					 "}\n"
 					 "\n"
 					 "__kernel void\n"
 					 "gpuscan_qual_rs(__global kern_gpuscan *kgscan,\n"
 					 "                __global kern_row_store *krs,\n"
 					 "                __global kern_column_store *kcs,\n"
+					 "                __global kern_column_store *kproj,\n"
 					 "                __local void *local_workmem)\n"
 					 "{\n"
+					 "  cl_int      index;\n"
+					 "\n"
 					 "  KDEBUG_INIT(KERN_GPUSCAN_RESULTBUF(kgscan));\n"
 					 "\n"
 					 "  kern_row_to_column(krs,kcs,local_workmem);\n"
-					 "  gpuscan_qual_cs(kgscan,kcs,\n"
-					 "                  (__global kern_toastbuf *)krs,\n"
-					 "                  local_workmem);\n"
+					 "  index = gpuscan_qual_eval(kgscan,kcs,\n"
+					 "                            (__global kern_toastbuf *)krs,\n"
+					 "                            local_workmem);\n"
+					 "  gpuscan_projection(krs,kproj,index);\n"
 					 "}\n", expr_code);
+
+	/* vectorized qualifier with column-store */
+	if (vector_code)
+		appendStringInfo(&str,
+						 "\n"
+						 "#ifdef PGSTROM_VECTOR_WIDTH\n"
+						 "__kernel void\n"
+						 "gpuscan_qual_cs_vec(__global kern_gpuscan *kgscan,\n"
+						 "                    __global kern_column_store *kcs,\n"
+						 "                    __global kern_toastbuf *toast,\n"
+						 "                    __local void *local_workmem)\n"
+						 "{\n"
+						 "  __global kern_parambuf *kparams\n"
+						 "    = KERN_GPUSCAN_PARAMBUF(kgscan);\n"
+						 "  cl_uint     base\n"
+						 "    = get_global_id(0) * PGSTROM_VECTOR_WIDTH;\n"
+						 "  cl_uint     mask\n"
+						 "    = kern_vector_rowmask(kcs->nrows, base);\n"
+						 "\n"
+						 "  KDEBUG_INIT(KERN_GPUSCAN_RESULTBUF(kgscan));\n"
+						 "\n"
+						 "  if (mask != 0)\n"
+						 "  {\n"
+						 "%s"
+						 "  }\n"
+						 "  gpuscan_writeback_vector(kgscan, base, mask,\n"
+						 "                           local_workmem);\n"
+						 "}\n"
+						 "#endif\n", vector_code);
 	return str.data;
 }
 
+/*
+ * gpuscan_projection_available
+ *
+ * It checks whether the supplied attributes to be referenced on the host
+ * side can be written back by the device projection. System columns and
+ * whole-row reference need the heap tuple itself, and projection makes no
+ * sense if all the columns are referenced.
+ */
+static bool
+gpuscan_projection_available(Bitmapset *attnums, int natts)
+{
+	Bitmapset  *tempset;
+	AttrNumber	anum;
+	int			nattrs = 0;
+	bool		result = true;
+
+	if (!gpuscan_device_projection)
+		return false;
+
+	tempset = bms_copy(attnums);
+	while ((anum = bms_first_member(tempset)) >= 0)
+	{
+		anum += FirstLowInvalidHeapAttributeNumber;
+		if (anum <= InvalidAttrNumber)
+			result = false;
+		nattrs++;
+	}
+	bms_free(tempset);
+
+	return (result && nattrs < natts);
+}
+
 static CustomPlan *
 gpuscan_create_plan(PlannerInfo *root, CustomPath *best_path)
 {
@@ -355,8 +585,14 @@ gpuscan_create_plan(PlannerInfo *root, CustomPath *best_path)
 	/*
 	 * See the comments in create_scan_plan(). We may be able to omit
 	 * projection of the table tuples, if possible.
+	 * However, physical tlist makes all the columns referenced, so it
+	 * prevents device projection that writes back only the columns being
+	 * referenced on the host side. Projection on the virtual tuple is
+	 * much cheaper than transfer of the unreferenced columns.
 	 */
-	if (use_physical_tlist(root, rel))
+	if (use_physical_tlist(root, rel) &&
+		(gpath->is_cached || gpath->dev_quals == NIL ||
+		 !gpuscan_projection_available(gpath->host_attnums, rel->max_attr)))
 	{
 		tlist = build_physical_tlist(root, rel);
 		if (tlist == NIL)
@@ -395,7 +631,8 @@ gpuscan_create_plan(PlannerInfo *root, CustomPath *best_path)
 	 * This design is optimized to process column-oriented data format on
 	 * the relation cache.
 	 */
-	kern_source = gpuscan_codegen_quals(root, dev_clauses, &context);
+	kern_source = gpuscan_codegen_quals(root, dev_clauses,
+										gpath->is_cached, &context);
 
 	/*
 	 * Construction of GpuScanPlan node; on top of CustomPlan node
@@ -416,57 +653,17 @@ gpuscan_create_plan(PlannerInfo *root, CustomPath *best_path)
 	gscan->dev_clauses = dev_clauses;
 	gscan->dev_attnums = gpath->dev_attnums;
 	gscan->host_attnums = gpath->host_attnums;
-
-	return &gscan->cplan;
-}
-
-/* copy from outfuncs.c */
-static void
-_outToken(StringInfo str, const char *s)
-{
-	if (s == NULL || *s == '\0')
+	gscan->use_tcache = (gpath->is_cached && kern_source != NULL);
+	/* number of operators, to calibrate the device cost on run-time */
+	if (kern_source != NULL && cpu_operator_cost > 0.0)
 	{
-		appendStringInfoString(str, "<>");
-		return;
-	}
+		QualCost	dev_cost;
 
-	/*
-	 * Look for characters or patterns that are treated specially by read.c
-	 * (either in pg_strtok() or in nodeRead()), and therefore need a
-	 * protective backslash.
-	 */
-	/* These characters only need to be quoted at the start of the string */
-	if (*s == '<' ||
-		*s == '\"' ||
-		isdigit((unsigned char) *s) ||
-		((*s == '+' || *s == '-') &&
-		 (isdigit((unsigned char) s[1]) || s[1] == '.')))
-		appendStringInfoChar(str, '\\');
-	while (*s)
-	{
-		/* These chars must be backslashed anywhere in the string */
-		if (*s == ' ' || *s == '\n' || *s == '\t' ||
-			*s == '(' || *s == ')' || *s == '{' || *s == '}' ||
-			*s == '\\')
-			appendStringInfoChar(str, '\\');
-		appendStringInfoChar(str, *s++);
+		cost_qual_eval(&dev_cost, dev_clauses, root);
+		gscan->dev_qual_ops = dev_cost.per_tuple / cpu_operator_cost;
 	}
-}
 
-/* copied from outfuncs.c */
-static void
-_outBitmapset(StringInfo str, const Bitmapset *bms)
-{
-	Bitmapset  *tmpset;
-	int			x;
-
-	appendStringInfoChar(str, '(');
-	appendStringInfoChar(str, 'b');
-	tmpset = bms_copy(bms);
-	while ((x = bms_first_member(tmpset)) >= 0)
-		appendStringInfo(str, " %d", x);
-	bms_free(tmpset);
-	appendStringInfoChar(str, ')');
+	return &gscan->cplan;
 }
 
 static void
@@ -492,6 +689,10 @@ gpuscan_textout_path(StringInfo str, Node *node)
 	/* host_attnums */
 	appendStringInfo(str, " :host_attnums ");
 	_outBitmapset(str, pathnode->host_attnums);
+
+	/* is_cached */
+	appendStringInfo(str, " :is_cached %s",
+					 pathnode->is_cached ? "true" : "false");
 }
 
 static void
@@ -522,6 +723,108 @@ gpuscan_finalize_plan(PlannerInfo *root,
 	*paramids = bms_add_members(*paramids, *scan_params);
 }
 
+/*
+ * gpuscan_setup_zone_quals
+ *
+ * It picks up device qualifiers in "<column> <op> <const>" form, where <op>
+ * is a btree comparison operator of the default opclass of the column type,
+ * to skip chunks of columnar cache that can never satisfy the qualifier.
+ */
+static void
+gpuscan_setup_zone_quals(GpuScanState *gss, List *dev_clauses)
+{
+	tcache_head	   *tc_head = gss->tc_scan->tc_head;
+	ListCell	   *cell;
+
+	gss->num_zone_quals = 0;
+	gss->zone_quals = palloc(sizeof(GpuScanZoneQual) *
+							 Max(list_length(dev_clauses), 1));
+	foreach (cell, dev_clauses)
+	{
+		OpExpr	   *op = lfirst(cell);
+		Var		   *var;
+		Const	   *con;
+		Oid			opno;
+		Oid			opfamily;
+		Oid			opclass;
+		int			strategy;
+		int			k;
+
+		if (!IsA(op, OpExpr) || list_length(op->args) != 2)
+			continue;
+
+		if (IsA(linitial(op->args), Var) && IsA(lsecond(op->args), Const))
+		{
+			var = linitial(op->args);
+			con = lsecond(op->args);
+			opno = op->opno;
+		}
+		else if (IsA(linitial(op->args), Const) &&
+				 IsA(lsecond(op->args), Var))
+		{
+			var = lsecond(op->args);
+			con = linitial(op->args);
+			opno = get_commutator(op->opno);
+			if (!OidIsValid(opno))
+				continue;
+		}
+		else
+			continue;
+
+		if (var->varattno <= 0 || con->constisnull ||
+			var->vartype != con->consttype ||
+			!tcache_zonemap_supported(var->vartype))
+			continue;
+
+		opclass = GetDefaultOpClass(var->vartype, BTREE_AM_OID);
+		if (!OidIsValid(opclass))
+			continue;
+		opfamily = get_opclass_family(opclass);
+		strategy = get_op_opfamily_strategy(opno, opfamily);
+		if (strategy < BTLessStrategyNumber ||
+			strategy > BTGreaterStrategyNumber)
+			continue;
+
+		for (k=0; k < tc_head->ncols; k++)
+		{
+			int		j = tc_head->i_cached[k];
+
+			if (tc_head->tupdesc->attrs[j]->attnum == var->varattno)
+				break;
+		}
+		if (k == tc_head->ncols)
+			continue;
+
+		gss->zone_quals[gss->num_zone_quals].cindex = k;
+		gss->zone_quals[gss->num_zone_quals].type_oid = var->vartype;
+		gss->zone_quals[gss->num_zone_quals].strategy = strategy;
+		gss->zone_quals[gss->num_zone_quals].value = con->constvalue;
+		gss->num_zone_quals++;
+	}
+}
+
+/*
+ * gpuscan_skip_by_zone_map
+ *
+ * It checks whether the supplied column-store can be skipped without
+ * sending it to the device, according to its zone map.
+ */
+static bool
+gpuscan_skip_by_zone_map(GpuScanState *gss, tcache_column_store *tcs)
+{
+	int		i;
+
+	for (i=0; i < gss->num_zone_quals; i++)
+	{
+		GpuScanZoneQual *zq = &gss->zone_quals[i];
+
+		if (tcache_zonemap_mismatch(tcs, zq->cindex, zq->type_oid,
+									zq->strategy, zq->value))
+			return true;
+	}
+	return false;
+}
+
 static  CustomPlanState *
 gpuscan_begin(CustomPlan *node, EState *estate, int eflags)
 {
@@ -559,6 +862,7 @@ gpuscan_begin(CustomPlan *node, EState *estate, int eflags)
 		ExecInitExpr((Expr *) node->plan.qual, &gss->cps.ps);
 	gss->dev_quals = (List *)
 		ExecInitExpr((Expr *) gsplan->dev_clauses, &gss->cps.ps);
+	gss->dev_qual_ops = gsplan->dev_qual_ops;
 
 	/*
 	 * tuple table initialization
@@ -570,10 +874,19 @@ gpuscan_begin(CustomPlan *node, EState *estate, int eflags)
 	 * initialize scan relation
 	 */
 	gss->scan_rel = ExecOpenScanRelation(estate, scanrelid, eflags);
-	gss->scan_desc = heap_beginscan(gss->scan_rel,
-									estate->es_snapshot,
-									0,
-									NULL);
+	if (gsplan->use_tcache)
+	{
+		gss->scan_desc = NULL;
+		gss->tc_scan = tcache_begin_scan(gss->scan_rel, gsplan->dev_attnums);
+	}
+	else
+	{
+		gss->scan_desc = heap_beginscan(gss->scan_rel,
+										estate->es_snapshot,
+										0,
+										NULL);
+		gss->tc_scan = NULL;
+	}
 	tupdesc = RelationGetDescr(gss->scan_rel);
 	ExecSetSlotDescriptor(gss->scan_slot, tupdesc);
 
@@ -593,7 +906,17 @@ gpuscan_begin(CustomPlan *node, EState *estate, int eflags)
 	 * OK, initialization of common part is over.
 	 * Let's have GPU stuff initialization
 	 */
-	gss->scan_mode = GpuScanMode_HeapOnlyScan;
+	gss->scan_mode = (gss->tc_scan != NULL
+					  ? GpuScanMode_HybridScan
+					  : GpuScanMode_HeapOnlyScan);
+	gss->scan_done = false;
+	gss->prefetch_blocks = 0;
+	gss->chunk_shift = gpuscan_chunk_shift_clamp(
+		gpuscan_log2_ceil(ROWSTORE_DEFAULT_SIZE + sizeof(cl_uint)));
+	gss->chunk_vote = 0;
+	memset(gss->chunk_count, 0, sizeof(gss->chunk_count));
+	gss->result_nrooms = 0;
+	gss->result_nitems = 0;
 	gss->mqueue = pgstrom_create_queue();
 	pgstrom_track_object(&gss->mqueue->stag);
 
@@ -648,6 +971,8 @@ gpuscan_begin(CustomPlan *node, EState *estate, int eflags)
 		int		i;
 
 		gss->cs_colmeta = palloc(sizeof(kern_colmeta) * gss->cs_colnums);
+		if (gss->tc_scan)
+			gss->cs_cindex = palloc(sizeof(cl_uint) * gss->cs_colnums);
 		tempset = bms_copy(gsplan->dev_attnums);
 		for (i=0; (anum = bms_first_member(tempset)) >= 0; i++)
 		{
@@ -657,10 +982,79 @@ gpuscan_begin(CustomPlan *node, EState *estate, int eflags)
 			memcpy(&gss->cs_colmeta[i],
 				   &gss->rs_colmeta[anum - 1],
 				   sizeof(kern_colmeta));
+
+			/*
+			 * Also, we need to know which cdata[] of tcache_column_store
+			 * is mapped to this column, if columnar cache is in use.
+			 */
+			if (gss->tc_scan)
+			{
+				tcache_head *tc_head = gss->tc_scan->tc_head;
+				int		k;
+
+				for (k=0; k < tc_head->ncols; k++)
+				{
+					int		j = tc_head->i_cached[k];
+
+					if (tc_head->tupdesc->attrs[j]->attnum == anum)
+						break;
+				}
+				if (k == tc_head->ncols)
+					elog(ERROR, "column \"%s\" is not on the columnar cache",
+						 NameStr(tupdesc->attrs[anum - 1]->attname));
+				gss->cs_cindex[i] = k;
+			}
 		}
 		Assert(i == gss->cs_colnums);
 		bms_free(tempset);
 	}
+	if (gss->tc_scan)
+		gpuscan_setup_zone_quals(gss, gsplan->dev_clauses);
+
+	/*
+	 * Device projection; kernel writes back the columns being referenced by
+	 * the target-list or host qualifiers onto a column-store, then scan slot
+	 * is filled up virtually with them. It is available only on heap-only
+	 * scan, because tuples on the columnar cache need visibility checks.
+	 */
+	gss->proj_ncols = 0;
+	if (gss->scan_mode == GpuScanMode_HeapOnlyScan && gsplan->kern_source)
+	{
+		Bitmapset  *proj_attnums = NULL;
+		int			i;
+
+		pull_varattnos((Node *) node->plan.targetlist, scanrelid,
+					   &proj_attnums);
+		pull_varattnos((Node *) node->plan.qual, scanrelid,
+					   &proj_attnums);
+		/* device cannot walk on a tuple with cstring */
+		for (anum=0; anum < tupdesc->natts; anum++)
+		{
+			if (tupdesc->attrs[anum]->attlen < -1)
+				break;
+		}
+		if (anum == tupdesc->natts &&
+			gpuscan_projection_available(proj_attnums, tupdesc->natts))
+		{
+			gss->proj_ncols = bms_num_members(proj_attnums);
+			gss->proj_colmeta = palloc(sizeof(kern_colmeta) *
+									   gss->proj_ncols);
+			gss->proj_anums = palloc(sizeof(AttrNumber) * gss->proj_ncols);
+			for (i=0; (anum = bms_first_member(proj_attnums)) >= 0; i++)
+			{
+				anum += FirstLowInvalidHeapAttributeNumber;
+				Assert(anum > 0 && anum <= tupdesc->natts);
+
+				gss->rs_colmeta[anum - 1].flags |= KERN_COLMETA_ATTPROJECTED;
+				memcpy(&gss->proj_colmeta[i],
+					   &gss->rs_colmeta[anum - 1],
+					   sizeof(kern_colmeta));
+				gss->proj_anums[i] = anum;
+			}
+			Assert(i == gss->proj_ncols);
+		}
+		bms_free(proj_attnums);
+	}
 
 	gss->curr_chunk = NULL;
 	gss->curr_index = 0;
@@ -673,19 +1067,117 @@ gpuscan_begin(CustomPlan *node, EState *estate, int eflags)
 	return &gss->cps;
 }
 
+/*
+ * gpuscan_release_store
+ *
+ * It releases a row- or column- store attached to pgstrom_gpuscan.
+ * Note that it can be called under the OpenCL server context.
+ */
+static void
+gpuscan_release_store(StromTag *rc_store)
+{
+	if (!rc_store)
+		return;
+	if (*rc_store == StromTag_RowStore)
+		pgstrom_shmem_free(rc_store);
+	else if (*rc_store == StromTag_TCacheColumnStore)
+		tcache_put_column_store((tcache_column_store *) rc_store);
+	else
+		elog(ERROR, "unexpected data store (stag: %d)", (int) *rc_store);
+}
+
+/*
+ * gpuscan_log2_ceil
+ * gpuscan_chunk_shift_clamp
+ *
+ * It clamps the supplied shift of row-store size into the range being
+ * configured by pgstrom.gpuscan_chunk_size_(min|max).
+ */
+static int
+gpuscan_log2_ceil(Size size)
+{
+	int		shift = 0;
+
+	while ((1UL << shift) < size)
+		shift++;
+	return shift;
+}
+
+static int
+gpuscan_chunk_shift_clamp(int shift)
+{
+	int		min_shift = gpuscan_log2_ceil((Size)gpuscan_chunk_size_min << 10);
+	int		max_shift = gpuscan_log2_ceil((Size)gpuscan_chunk_size_max << 10);
+
+	/* chunk size has to be power of 2, as block of shared memory */
+	if ((1UL << max_shift) > ((Size)gpuscan_chunk_size_max << 10))
+		max_shift--;
+	max_shift = Max(max_shift, min_shift);
+	max_shift = Min(max_shift, GPUSCAN_CHUNK_BITS_MAX);
+	min_shift = Min(min_shift, max_shift);
+
+	return Min(Max(shift, min_shift), max_shift);
+}
+
+/*
+ * gpuscan_adjust_chunk_size
+ *
+ * It adjusts size of the row-store to be loaded next, according to the
+ * performance counter of the chunk being completed. If device time of the
+ * chunk is too short, it cannot hide the overhead of message exchange and
+ * kernel launch, so we enlarge the chunk. If DMA receive (mostly for
+ * kern_resultbuf) dominates, the chunk is too large to overlap the transfer
+ * with execution of other chunks, so we shrink the chunk.
+ * Size is changed after two votes towards same direction, to avoid
+ * oscillation.
+ */
+static void
+gpuscan_adjust_chunk_size(GpuScanState *gss, pgstrom_gpuscan *gscan)
+{
+	pgstrom_perfmon *pfm = &gscan->msg.pfm;
+	cl_ulong	time_dev = (pfm->time_dma_send +
+							pfm->time_kern_exec +
+							pfm->time_dma_recv);
+
+	if (gpuscan_chunk_size_min >= gpuscan_chunk_size_max)
+		return;
+
+	if (time_dev < GPUSCAN_CHUNK_MIN_DEVTIME)
+		gss->chunk_vote = Max(gss->chunk_vote, 0) + 1;
+	else if (pfm->time_dma_recv > pfm->time_dma_send + pfm->time_kern_exec)
+		gss->chunk_vote = Min(gss->chunk_vote, 0) - 1;
+	else
+		gss->chunk_vote = 0;
+
+	if (gss->chunk_vote >= 2)
+	{
+		gss->chunk_shift = gpuscan_chunk_shift_clamp(gss->chunk_shift + 1);
+		gss->chunk_vote = 0;
+	}
+	else if (gss->chunk_vote <= -2)
+	{
+		gss->chunk_shift = gpuscan_chunk_shift_clamp(gss->chunk_shift - 1);
+		gss->chunk_vote = 0;
+	}
+}
+
+/*
+ * pgstrom_create_gpuscan
+ *
+ * It constructs a pgstrom_gpuscan message towards the supplied row- or
+ * column- store. 'extra_length' bytes are allocated on the tail of
+ * the message, for the header of column-store if any.
+ */
 static pgstrom_gpuscan *
-pgstrom_load_gpuscan_row(GpuScanState *gss)
+pgstrom_create_gpuscan(GpuScanState *gss, StromTag *rc_store,
+					   cl_uint nrows, Size extra_length)
 {
 	pgstrom_gpuscan	   *gscan;
-	pgstrom_row_store  *rstore;
 	kern_parambuf	   *kparam;
 	kern_resultbuf	   *kresult;
 	int			extra_flags;
 	cl_uint		length;
-	cl_uint		nrows;
-	bool		scan_done;
 	bool		kernel_debug;
-	struct timeval tv1, tv2;
 
 	/*
 	 * check status of pg_strom.kernel_debug
@@ -696,39 +1188,19 @@ pgstrom_load_gpuscan_row(GpuScanState *gss)
 	else
 		kernel_debug = false;
 
-	/*
-	 * First of all, allocate a row-store buffer and fill it up
-	 * with regular tuples read from the heap.
-	 */
-	if (gss->pfm.enabled)
-		gettimeofday(&tv1, NULL);
-	rstore = pgstrom_load_row_store_heap(gss->scan_desc,
-										 gss->cps.ps.state->es_direction,
-										 gss->rs_colmeta,
-										 gss->cs_colmeta,
-										 gss->cs_colnums,
-										 &scan_done);
-	if (scan_done)
-	{
-		heap_endscan(gss->scan_desc);
-		gss->scan_desc = NULL;
-	}
-	if (gss->pfm.enabled)
-		gettimeofday(&tv2, NULL);
-
 	/*
 	 * OK, let's create a pgstrom_gpuscan structure according to
-	 * the pgstrom_row_store being allocated above.
+	 * the data store being supplied.
 	 */
-	nrows = rstore->kern.nrows;
 	length = (STROMALIGN(offsetof(pgstrom_gpuscan, kern.kparam)) +
 			  STROMALIGN(gss->kparambuf->length) +
 			  STROMALIGN(offsetof(kern_resultbuf, results[nrows])) +
-			  (kernel_debug ? KERNEL_DEBUG_BUFSIZE : 0));
+			  (kernel_debug ? KERNEL_DEBUG_BUFSIZE : 0) +
+			  STROMALIGN(extra_length));
 	gscan = pgstrom_shmem_alloc(length);
 	if (!gscan)
 	{
-		pgstrom_shmem_free(rstore);
+		gpuscan_release_store(rc_store);
 		elog(ERROR, "out of shared memory");
 	}
 	/* Fields of pgstrom_gpuscan */
@@ -737,14 +1209,15 @@ pgstrom_load_gpuscan_row(GpuScanState *gss)
 	SpinLockInit(&gscan->msg.lock);
 	gscan->msg.refcnt = 1;
 	gscan->msg.respq = pgstrom_get_queue(gss->mqueue);
-	gscan->msg.cb_process = clserv_process_gpuscan_row;
-	gscan->msg.cb_release = clserv_put_gpuscan_row;
-	gscan->msg.pfm.enabled = gss->pfm.enabled;
-	if (gscan->msg.pfm.enabled)
-		gscan->msg.pfm.time_to_load += timeval_diff(&tv1, &tv2);
+	gscan->msg.cb_process = clserv_process_gpuscan;
+	gscan->msg.cb_release = clserv_put_gpuscan;
+	gscan->msg.dindex = -1;
+	/* performance counter is also needed to adjust the chunk size */
+	gscan->msg.pfm.enabled = (gss->pfm.enabled ||
+							  (!gss->tc_scan &&
+							   gpuscan_chunk_size_min < gpuscan_chunk_size_max));
 	gscan->dprog_key = pgstrom_retain_devprog_key(gss->dprog_key);
-	dlist_init(&gscan->rc_store);
-	dlist_push_head(&gscan->rc_store, &rstore->chain);
+	gscan->rc_store = rc_store;
 
 	/* kern_parambuf */
 	kparam = &gscan->kern.kparam;
@@ -758,6 +1231,21 @@ pgstrom_load_gpuscan_row(GpuScanState *gss)
 	kresult->debug_nums = 0;
 	kresult->debug_usage = (kernel_debug ? 0 : KERN_DEBUG_UNAVAILABLE);
 	kresult->errcode = 0;
+	kresult->flags = 0;
+
+	/*
+	 * Bitmap mode is preferable if bitmaps are smaller than the row-index
+	 * of the visible rows; being estimated by the previous chunks.
+	 * Two bitmaps consume 2 bits per row, and a row-index consumes 32 bits
+	 * per visible row, so 1/16 of selectivity is the boundary.
+	 * Also note that bitmaps have to fit 'nrooms' of results[].
+	 */
+	if (gpuscan_result_bitmap && nrows >= 2 &&
+		gss->result_nitems * 16 > gss->result_nrooms)
+	{
+		kresult->flags |= KERN_RESULTBUF_FLAGS_BITMAP;
+		memset(kresult->results, 0, KERN_GPUSCAN_BITMAP_LENGTH(&gscan->kern));
+	}
 
 	Assert(pgstrom_shmem_sanitycheck(gscan));
 
@@ -767,69 +1255,546 @@ pgstrom_load_gpuscan_row(GpuScanState *gss)
 	return gscan;
 }
 
-static bool
-gpuscan_next_tuple_row(GpuScanState *gss, TupleTableSlot *slot)
+/*
+ * gpuscan_create_projection
+ *
+ * It allocates a column-store to be written back by the device projection,
+ * for 'nrows' rooms. Null-maps are cleared here, because kernel sets a bit
+ * only for the visible rows.
+ */
+static kern_column_store *
+gpuscan_create_projection(GpuScanState *gss, cl_uint nrows)
 {
-	pgstrom_gpuscan	*gscan = gss->curr_chunk;
-	kern_resultbuf	*kresult;
-	rs_tuple		*rs_tup;
-	cl_int			 rs_index;
-
-	if (!gscan)
-		return false;
-
-	kresult = KERN_GPUSCAN_RESULTBUF(&gscan->kern);
-	if (gss->curr_index < kresult->nitems)
+	kern_column_store  *kproj;
+	int			ncols = gss->proj_ncols;
+	Size		length;
+	Size		offset;
+	int			i;
+
+	length = STROMALIGN(offsetof(kern_column_store, colmeta[ncols]));
+	for (i=0; i < ncols; i++)
 	{
-		pgstrom_row_store *rstore
-			= dlist_container(pgstrom_row_store, chain,
-							  dlist_head_node(&gscan->rc_store));
-		Assert(rstore->stag == StromTag_RowStore);
+		kern_colmeta   *pcmeta = &gss->proj_colmeta[i];
 
-		rs_index = kresult->results[gss->curr_index++];
-		/*
-		 * TODO: if rs_index is negative, we need to recheck on CPU side.
-		 */
-		Assert(rs_index > 0 && rs_index <= rstore->kern.nrows);
-
-		rs_tup = kern_rowstore_get_tuple(&rstore->kern, rs_index - 1);
-		ExecStoreTuple(&rs_tup->htup, slot, InvalidBuffer, false);
-		return true;
+		if ((pcmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
+			length += STROMALIGN((nrows + 7) >> 3);
+		length += STROMALIGN(nrows * KERN_GPUSCAN_PROJ_WIDTH(pcmeta->attlen));
 	}
-	return false;
-}
-
-static TupleTableSlot *
-gpuscan_exec(CustomPlanState *node)
-{
-	GpuScanState   *gss = (GpuScanState *) node;
-	TupleTableSlot *slot = gss->scan_slot;
 
-	ExecClearTuple(slot);
+	kproj = pgstrom_shmem_alloc(length);
+	if (!kproj)
+		elog(ERROR, "out of shared memory");
+	kproj->length = length;
+	kproj->ncols = ncols;
+	kproj->nrows = nrows;
+	memcpy(kproj->colmeta, gss->proj_colmeta, sizeof(kern_colmeta) * ncols);
 
-	while (!gss->curr_chunk || !gpuscan_next_tuple_row(gss, slot))
+	offset = STROMALIGN(offsetof(kern_column_store, colmeta[ncols]));
+	for (i=0; i < ncols; i++)
 	{
-		pgstrom_message	   *msg;
-		pgstrom_gpuscan	   *gscan;
+		kern_colmeta   *pcmeta = &kproj->colmeta[i];
 
-		/*
-		 * Release the current gpuscan chunk being already scanned
-		 */
-		if (gss->curr_chunk)
+		pcmeta->cs_ofs = offset;
+		if ((pcmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
 		{
-			pgstrom_message	   *msg = &gss->curr_chunk->msg;
-
-			if (msg->pfm.enabled)
-				pgstrom_perfmon_add(&gss->pfm, &msg->pfm);
-			Assert(msg->refcnt == 1);
-			pgstrom_untrack_object(&msg->stag);
-			msg->cb_release(msg);
-			gss->curr_chunk = NULL;
-			gss->curr_index = 0;
+			memset((char *)kproj + offset, 0, STROMALIGN((nrows + 7) >> 3));
+			offset += STROMALIGN((nrows + 7) >> 3);
 		}
+		offset += STROMALIGN(nrows * KERN_GPUSCAN_PROJ_WIDTH(pcmeta->attlen));
+	}
+	Assert(offset == length);
 
-		/*
-		 * Dequeue the current gpuscan chunks being already processed
+	return kproj;
+}
+
+static pgstrom_gpuscan *
+pgstrom_load_gpuscan_row(GpuScanState *gss)
+{
+	pgstrom_gpuscan	   *gscan;
+	pgstrom_row_store  *rstore;
+	ScanDirection	direction = gss->cps.ps.state->es_direction;
+	Size			rstore_size = (1UL << gss->chunk_shift) - sizeof(cl_uint);
+	BlockNumber		distance;
+	bool		scan_done;
+	struct timeval tv1, tv2;
+
+	/*
+	 * First of all, allocate a row-store buffer and fill it up
+	 * with regular tuples read from the heap.
+	 * Heap blocks to be loaded by the next chunks are also prefetched,
+	 * so i/o of them is overlapped with execution and fetch of the
+	 * chunks being in-flight.
+	 */
+	if (gss->pfm.enabled)
+		gettimeofday(&tv1, NULL);
+	distance = (gpuscan_prefetch_chunks > 0
+				? (gpuscan_prefetch_chunks + 1) * (rstore_size / BLCKSZ)
+				: 0);
+	pgstrom_prefetch_row_store_heap(gss->scan_desc, direction,
+									&gss->prefetch_blocks, distance);
+	rstore = pgstrom_load_row_store_heap(gss->scan_desc,
+										 direction,
+										 rstore_size,
+										 gss->rs_colmeta,
+										 gss->cs_colmeta,
+										 gss->cs_colnums,
+										 &scan_done);
+	if (scan_done)
+	{
+		heap_endscan(gss->scan_desc);
+		gss->scan_desc = NULL;
+		gss->scan_done = true;
+	}
+	else
+		pgstrom_prefetch_row_store_heap(gss->scan_desc, direction,
+										&gss->prefetch_blocks, distance);
+	if (gss->pfm.enabled)
+		gettimeofday(&tv2, NULL);
+	gss->chunk_count[gss->chunk_shift]++;
+
+	gscan = pgstrom_create_gpuscan(gss, &rstore->stag,
+								   rstore->kern.nrows, 0);
+	if (gss->proj_ncols > 0 && rstore->kern.nrows > 0)
+		gscan->kproj = gpuscan_create_projection(gss, rstore->kern.nrows);
+	if (gss->pfm.enabled)
+		gscan->msg.pfm.time_to_load += timeval_diff(&tv1, &tv2);
+
+	return gscan;
+}
+
+/*
+ * pgstrom_load_gpuscan_column
+ *
+ * It constructs a pgstrom_gpuscan message towards a column-store on the
+ * columnar cache. Unlike row-store, we don't copy the column arrays in
+ * the backend; OpenCL server transfers the arrays being referenced to
+ * the device memory directly, according to the header portion of
+ * kern_column_store and kern_toastbuf set up here.
+ */
+static pgstrom_gpuscan *
+pgstrom_load_gpuscan_column(GpuScanState *gss, tcache_column_store *tcs)
+{
+	pgstrom_gpuscan	   *gscan;
+	kern_column_store  *kcs_head;
+	kern_toastbuf	   *ktoast_head = NULL;
+	int			ncols = gss->cs_colnums;
+	cl_uint		nrows = tcs->nrows;
+	bool		has_varlena = false;
+	Size		kcs_length;
+	Size		ktoast_length;
+	Size		offset;
+	int			i;
+
+	for (i=0; i < ncols; i++)
+	{
+		if (gss->cs_colmeta[i].attlen < 1)
+			has_varlena = true;
+	}
+	kcs_length = STROMALIGN(offsetof(kern_column_store, colmeta[ncols]));
+	ktoast_length = (has_varlena
+					 ? STROMALIGN(offsetof(kern_toastbuf, coldir[ncols]))
+					 : 0);
+
+	/* the message holds its own reference on the column-store */
+	tcache_get_column_store(tcs);
+	gscan = pgstrom_create_gpuscan(gss, &tcs->stag, nrows,
+								   kcs_length + ktoast_length +
+								   STROMALIGN(sizeof(cl_uint) * ncols));
+	/* header portion of kern_column_store */
+	kcs_head = (kern_column_store *)
+		((char *)&gscan->kern + STROMALIGN(KERN_GPUSCAN_LENGTH(&gscan->kern)));
+	pgstrom_setup_kern_colstore_head(kcs_head, gss->cs_colmeta, ncols, nrows);
+	gscan->kcs_head = kcs_head;
+
+	/* encoded column array has its own length, instead of nrows * attlen */
+	if (tcs->is_encoded)
+	{
+		offset = STROMALIGN(offsetof(kern_column_store, colmeta[ncols]));
+		for (i=0; i < ncols; i++)
+		{
+			kern_colmeta   *ccmeta = &kcs_head->colmeta[i];
+			cl_uint			cindex = gss->cs_cindex[i];
+
+			ccmeta->cs_ofs = offset;
+			if ((ccmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
+				offset += STROMALIGN((nrows + 7) / 8);
+			if (tcs->cdata[cindex].enc_length > 0)
+			{
+				ccmeta->flags |= KERN_COLMETA_ATTENCODED;
+				offset += STROMALIGN(tcs->cdata[cindex].enc_length);
+			}
+			else
+				offset += STROMALIGN(nrows * (ccmeta->attlen > 0
+											  ? ccmeta->attlen
+											  : sizeof(cl_uint)));
+		}
+		kcs_head->length = offset;
+	}
+
+	/* header portion of kern_toastbuf, if varlena is referenced */
+	if (has_varlena)
+	{
+		ktoast_head = (kern_toastbuf *)((char *)kcs_head + kcs_length);
+		ktoast_head->magic = TOASTBUF_MAGIC;
+		ktoast_head->ncols = ncols;
+		offset = ktoast_length;
+		for (i=0; i < ncols; i++)
+		{
+			tcache_toastbuf *tbuf = tcs->cdata[gss->cs_cindex[i]].toast;
+
+			if (gss->cs_colmeta[i].attlen > 0 || !tbuf)
+				ktoast_head->coldir[i] = 0;
+			else
+			{
+				ktoast_head->coldir[i] = offset;
+				offset += STROMALIGN(tbuf->tbuf_usage);
+			}
+		}
+	}
+	gscan->ktoast_head = ktoast_head;
+
+	/* index of tcs->cdata[] being referenced */
+	gscan->cs_cindex = (cl_uint *)((char *)kcs_head +
+								   kcs_length + ktoast_length);
+	memcpy(gscan->cs_cindex, gss->cs_cindex, sizeof(cl_uint) * ncols);
+
+	Assert(pgstrom_shmem_sanitycheck(gscan));
+
+	return gscan;
+}
+
+/*
+ * pgstrom_load_gpuscan_tcache
+ *
+ * It picks up the next chunk on the columnar cache. Column-stores are sent
+ * to the kernel as is, and row-stores (tuples not columnized yet) are
+ * copied to a regular row-store to be processed on the row-store path.
+ */
+static pgstrom_gpuscan *
+pgstrom_load_gpuscan_tcache(GpuScanState *gss)
+{
+	tcache_head		   *tc_head = gss->tc_scan->tc_head;
+	pgstrom_gpuscan	   *gscan = NULL;
+	StromTag		   *stag;
+	struct timeval tv1, tv2;
+
+	if (gss->pfm.enabled)
+		gettimeofday(&tv1, NULL);
+
+	while (!gscan)
+	{
+		stag = tcache_scan_next(gss->tc_scan);
+		if (!stag)
+		{
+			gss->scan_done = true;
+			return NULL;
+		}
+
+		if (*stag == StromTag_TCacheColumnStore)
+		{
+			tcache_column_store *tcs = (tcache_column_store *) stag;
+
+			if (tcs->nrows == 0)
+				continue;
+			/* dev_quals are implicitly AND-ed, so any mismatch skips it */
+			if (gpuscan_skip_by_zone_map(gss, tcs))
+			{
+				gss->num_skipped++;
+				continue;
+			}
+			/* columns being evicted are loaded from the heap on demand */
+			tcs = tcache_scan_load_columns(gss->tc_scan, tcs,
+										   gss->cs_cindex,
+										   gss->cs_colnums);
+			PG_TRY();
+			{
+				gscan = pgstrom_load_gpuscan_column(gss, tcs);
+			}
+			PG_CATCH();
+			{
+				tcache_put_column_store(tcs);
+				PG_RE_THROW();
+			}
+			PG_END_TRY();
+			tcache_put_column_store(tcs);
+		}
+		else if (*stag == StromTag_TCacheRowStore)
+		{
+			tcache_row_store   *trs = (tcache_row_store *) stag;
+			pgstrom_row_store  *rstore;
+			cl_uint				nrows;
+
+			/* tuples may be appended concurrently */
+			SpinLockAcquire(&tc_head->lock);
+			nrows = trs->kern.nrows;
+			SpinLockRelease(&tc_head->lock);
+			if (nrows == 0)
+				continue;
+
+			rstore = pgstrom_load_row_store_tcache(trs, nrows,
+												   gss->rs_colmeta,
+												   gss->cs_colmeta,
+												   gss->cs_colnums);
+			gscan = pgstrom_create_gpuscan(gss, &rstore->stag,
+										   rstore->kern.nrows, 0);
+		}
+		else
+			elog(ERROR, "unexpected tcache object (stag: %d)", (int) *stag);
+	}
+
+	if (gscan->msg.pfm.enabled)
+	{
+		gettimeofday(&tv2, NULL);
+		gscan->msg.pfm.time_to_load += timeval_diff(&tv1, &tv2);
+	}
+	return gscan;
+}
+
+/*
+ * gpuscan_fetch_tuple
+ *
+ * It fetches a tuple on the supplied ctid from the heap, if visible.
+ * Contents of the columnar cache are constructed regardless of MVCC
+ * visibility, so we need to check it on the host side.
+ */
+static bool
+gpuscan_fetch_tuple(GpuScanState *gss, ItemPointer ctid,
+					TupleTableSlot *slot)
+{
+	HeapTuple	tuple = &gss->scan_tuple;
+	Buffer		buffer;
+
+	tuple->t_self = *ctid;
+	if (!heap_fetch(gss->scan_rel,
+					gss->cps.ps.state->es_snapshot,
+					tuple, &buffer, false, NULL))
+		return false;
+
+	ExecStoreTuple(tuple, slot, buffer, false);
+	ReleaseBuffer(buffer);
+	return true;
+}
+
+/*
+ * gpuscan_next_result
+ *
+ * It fetches the next row-index from the result buffer; negative value
+ * means the row needs re-check on the host side. In bitmap mode,
+ * 'curr_index' is the next row to be checked, instead of offset of the
+ * results array. '*p_position' is the room of the row being written back
+ * by the device projection.
+ */
+static bool
+gpuscan_next_result(GpuScanState *gss, kern_resultbuf *kresult,
+					cl_int *p_index, cl_uint *p_position)
+{
+	cl_uint	   *bitmap;
+	cl_uint		nwords;
+	cl_uint		index;
+	cl_uint		word;
+
+	if (!KERN_RESULTBUF_IS_BITMAP(kresult))
+	{
+		if (gss->curr_index >= kresult->nitems)
+			return false;
+		*p_position = gss->curr_index;
+		*p_index = kresult->results[gss->curr_index++];
+		return true;
+	}
+
+	bitmap = (cl_uint *) kresult->results;
+	nwords = KERN_RESULTBUF_BITMAP_NWORDS(kresult->nrooms);
+	while (gss->curr_index < kresult->nrooms)
+	{
+		index = gss->curr_index;
+		word = (bitmap[index / 32] | bitmap[nwords + index / 32]);
+		word >>= (index % 32);
+		if (word == 0)
+		{
+			/* skip to the next word */
+			gss->curr_index = (index / 32 + 1) * 32;
+			continue;
+		}
+		index += ffs(word) - 1;
+		gss->curr_index = index + 1;
+		*p_position = index;
+
+		if ((bitmap[index / 32] & (1U << (index % 32))) != 0)
+			*p_index = index + 1;
+		else
+			*p_index = -(index + 1);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * gpuscan_store_projection
+ *
+ * It fills up the scan slot virtually, using the columns being written back
+ * by the device projection. Columns not being referenced are null.
+ */
+static void
+gpuscan_store_projection(GpuScanState *gss, pgstrom_gpuscan *gscan,
+						 cl_uint position, TupleTableSlot *slot)
+{
+	pgstrom_row_store  *rstore = (pgstrom_row_store *) gscan->rc_store;
+	kern_column_store  *kproj = gscan->kproj;
+	TupleDesc	tupdesc = slot->tts_tupleDescriptor;
+	int			i;
+
+	Assert(position < kproj->nrows);
+	ExecClearTuple(slot);
+	memset(slot->tts_isnull, true, sizeof(bool) * tupdesc->natts);
+	for (i=0; i < kproj->ncols; i++)
+	{
+		kern_colmeta   *pcmeta = &kproj->colmeta[i];
+		int				j = gss->proj_anums[i] - 1;
+		char		   *addr = (char *)kproj + pcmeta->cs_ofs;
+
+		if ((pcmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
+		{
+			if (att_isnull(position, (bits8 *) addr))
+				continue;
+			addr += STROMALIGN((kproj->nrows + 7) >> 3);
+		}
+		addr += position * KERN_GPUSCAN_PROJ_WIDTH(pcmeta->attlen);
+		/* offset from the head of kern_row_store, if not a copied value */
+		if (pcmeta->attlen != KERN_GPUSCAN_PROJ_WIDTH(pcmeta->attlen))
+			addr = (char *)&rstore->kern + *((cl_uint *) addr);
+		slot->tts_values[j] = fetch_att(addr,
+										tupdesc->attrs[j]->attbyval,
+										tupdesc->attrs[j]->attlen);
+		slot->tts_isnull[j] = false;
+	}
+	ExecStoreVirtualTuple(slot);
+}
+
+/*
+ * gpuscan_recheck_tuple
+ *
+ * It evaluates the device qualifiers on the host side, for the rows that
+ * device could not run them on, like compressed varlena or overflow of
+ * numeric calculation.
+ */
+static bool
+gpuscan_recheck_tuple(GpuScanState *gss, TupleTableSlot *slot)
+{
+	ExprContext	   *econtext = gss->cps.ps.ps_ExprContext;
+
+	ResetExprContext(econtext);
+	econtext->ecxt_scantuple = slot;
+	return ExecQual(gss->dev_quals, econtext, false);
+}
+
+static bool
+gpuscan_next_tuple(GpuScanState *gss, TupleTableSlot *slot)
+{
+	pgstrom_gpuscan	*gscan = gss->curr_chunk;
+	kern_resultbuf	*kresult;
+	cl_int			 rs_index;
+	cl_uint			 position;
+	bool			 recheck;
+
+	if (!gscan)
+		return false;
+
+	kresult = KERN_GPUSCAN_RESULTBUF(&gscan->kern);
+	while (gpuscan_next_result(gss, kresult, &rs_index, &position))
+	{
+		/* negative index means the row needs recheck on the host side */
+		recheck = (rs_index < 0);
+		if (recheck)
+			rs_index = -rs_index;
+
+		if (*gscan->rc_store == StromTag_RowStore)
+		{
+			pgstrom_row_store *rstore
+				= (pgstrom_row_store *) gscan->rc_store;
+			rs_tuple   *rs_tup;
+
+			Assert(rs_index <= rstore->kern.nrows);
+			/* device projection is not valid on the rows to be rechecked */
+			if (gscan->kproj && !recheck)
+			{
+				gpuscan_store_projection(gss, gscan, position, slot);
+				return true;
+			}
+			rs_tup = kern_rowstore_get_tuple(&rstore->kern, rs_index - 1);
+			if (gss->scan_mode == GpuScanMode_HeapOnlyScan)
+				ExecStoreTuple(&rs_tup->htup, slot, InvalidBuffer, false);
+			/* tuples come from tcache_row_store need visibility checks */
+			else if (!gpuscan_fetch_tuple(gss, &rs_tup->htup.t_self, slot))
+				continue;
+		}
+		else
+		{
+			tcache_column_store *tcs
+				= (tcache_column_store *) gscan->rc_store;
+
+			Assert(*gscan->rc_store == StromTag_TCacheColumnStore);
+			Assert(rs_index <= tcs->nrows);
+			if (!gpuscan_fetch_tuple(gss, &tcs->ctids[rs_index - 1], slot))
+				continue;
+		}
+		if (!recheck || gpuscan_recheck_tuple(gss, slot))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * gpuscan_fetch_next
+ *
+ * It fetches the next tuple that passed the device qualifiers, onto the
+ * scan slot. Chunks are loaded and processed asynchronously.
+ */
+static TupleTableSlot *
+gpuscan_fetch_next(GpuScanState *gss)
+{
+	TupleTableSlot *slot = gss->scan_slot;
+
+	ExecClearTuple(slot);
+
+	while (!gss->curr_chunk || !gpuscan_next_tuple(gss, slot))
+	{
+		pgstrom_message	   *msg;
+		pgstrom_gpuscan	   *gscan;
+
+		/*
+		 * Release the current gpuscan chunk being already scanned
+		 */
+		if (gss->curr_chunk)
+		{
+			pgstrom_message	   *msg = &gss->curr_chunk->msg;
+			kern_resultbuf	   *kresult
+				= KERN_GPUSCAN_RESULTBUF(&gss->curr_chunk->kern);
+
+			gss->result_nrooms += kresult->nrooms;
+			gss->result_nitems += kresult->nitems;
+			if (msg->pfm.enabled)
+			{
+				pgstrom_perfmon_add(&gss->pfm, &msg->pfm);
+				pgstrom_perfmon_stat(msg);
+				if (!gss->tc_scan)
+					gpuscan_adjust_chunk_size(gss, gss->curr_chunk);
+				/* feedback of the kernel time to planner cost */
+				if (msg->pfm.time_kern_exec > 0 &&
+					kresult->nrooms > 0 &&
+					gss->dev_qual_ops > 0.0)
+					pgstrom_opencl_device_calibrate(msg->dindex,
+						(double) msg->pfm.time_kern_exec /
+						((double) kresult->nrooms * gss->dev_qual_ops));
+			}
+			Assert(msg->refcnt == 1);
+			pgstrom_untrack_object(&msg->stag);
+			msg->cb_release(msg);
+			gss->curr_chunk = NULL;
+			gss->curr_index = 0;
+		}
+
+		/*
+		 * Dequeue the current gpuscan chunks being already processed
 		 */
 		while ((msg = pgstrom_try_dequeue_message(gss->mqueue)) != NULL)
 		{
@@ -842,11 +1807,21 @@ gpuscan_exec(CustomPlanState *node)
 		 * Try to keep number of gpuscan chunks being asynchronously executed
 		 * larger than minimum multiplicity, unless it does not exceed
 		 * maximum one and OpenCL server does not return a new response.
+		 * Once minimum multiplicity is kept, we load at most one chunk per
+		 * fetch of a ready chunk, to avoid stall of tuple fetch by loading
+		 * of many chunks at once.
 		 */
-		while (gss->scan_desc != NULL &&
+		while (!gss->scan_done &&
 			   gss->num_running <= pgstrom_max_async_chunks)
 		{
-			pgstrom_gpuscan	*gscan = pgstrom_load_gpuscan_row(gss);
+			pgstrom_gpuscan	*gscan;
+
+			if (gss->tc_scan)
+				gscan = pgstrom_load_gpuscan_tcache(gss);
+			else
+				gscan = pgstrom_load_gpuscan_row(gss);
+			if (!gscan)
+				break;
 
 			if (!pgstrom_enqueue_message(&gscan->msg))
 			{
@@ -855,12 +1830,16 @@ gpuscan_exec(CustomPlanState *node)
 			}
 			gss->num_running++;
 
-			if (gss->num_running > pgstrom_min_async_chunks &&
-				(msg = pgstrom_try_dequeue_message(gss->mqueue)) != NULL)
+			if (gss->num_running > pgstrom_min_async_chunks)
 			{
-				gss->num_running--;
-				dlist_push_head(&gss->ready_chunks, &msg->chain);
-				break;
+				if ((msg = pgstrom_try_dequeue_message(gss->mqueue)) != NULL)
+				{
+					gss->num_running--;
+					dlist_push_head(&gss->ready_chunks, &msg->chain);
+					break;
+				}
+				if (!dlist_is_empty(&gss->ready_chunks))
+					break;
 			}
 		}
 
@@ -921,6 +1900,38 @@ gpuscan_exec(CustomPlanState *node)
 	return slot;
 }
 
+static TupleTableSlot *
+gpuscan_exec(CustomPlanState *node)
+{
+	GpuScanState   *gss = (GpuScanState *) node;
+	ExprContext	   *econtext = gss->cps.ps.ps_ExprContext;
+	List		   *qual = gss->cps.ps.qual;
+	TupleTableSlot *slot;
+
+	for (;;)
+	{
+		ResetExprContext(econtext);
+
+		slot = gpuscan_fetch_next(gss);
+		if (TupIsNull(slot))
+			break;
+
+		/* host qualifiers and projection, as ExecScan() doing */
+		econtext->ecxt_scantuple = slot;
+		if (qual == NIL || ExecQual(qual, econtext, false))
+		{
+			if (gss->cps.ps.ps_ProjInfo)
+				return ExecProject(gss->cps.ps.ps_ProjInfo, NULL);
+			return slot;
+		}
+		InstrCountFiltered1(&gss->cps.ps, 1);
+	}
+
+	if (gss->cps.ps.ps_ProjInfo)
+		return ExecClearTuple(gss->cps.ps.ps_ProjInfo->pi_slot);
+	return slot;
+}
+
 static Node *
 gpuscan_exec_multi(CustomPlanState *node)
 {
@@ -952,10 +1963,12 @@ gpuscan_end(CustomPlanState *node)
 	ExecClearTuple(gss->scan_slot);
 
 	/*
-	 * close heap scan and relation
+	 * close heap scan (or cache scan) and relation
 	 */
 	if (gss->scan_desc)
 		heap_endscan(gss->scan_desc);
+	if (gss->tc_scan)
+		tcache_end_scan(gss->tc_scan);
 	heap_close(gss->scan_rel, NoLock);
 }
 
@@ -1047,6 +2060,44 @@ gpuscan_explain(CustomPlanState *node, List *ancestors, ExplainState *es)
 	}
 	bms_free(tempset);
 	ExplainPropertyText("Device References", str.data, es);
+	ExplainPropertyText("Scan Mode",
+						gss->scan_mode == GpuScanMode_HybridScan
+						? "Hybrid (columnar cache)"
+						: "Heap Only", es);
+	if (gss->proj_ncols > 0)
+	{
+		int			i;
+
+		resetStringInfo(&str);
+		for (i=0; i < gss->proj_ncols; i++)
+			appendStringInfo(&str, "%s%s",
+							 i == 0 ? "" : ", ",
+							 get_relid_attribute_name(relid,
+													  gss->proj_anums[i]));
+		ExplainPropertyText("Device Projection", str.data, es);
+	}
+	if (es->analyze && gss->tc_scan)
+		ExplainPropertyLong("Chunks Skipped by Zone Map",
+							gss->num_skipped, es);
+	if (es->analyze && !gss->tc_scan)
+	{
+		StringInfoData	buf;
+		int				shift;
+
+		initStringInfo(&buf);
+		for (shift=0; shift <= SHMEM_BLOCKSZ_BITS_MAX; shift++)
+		{
+			if (gss->chunk_count[shift] == 0)
+				continue;
+			appendStringInfo(&buf, "%s%luKB x %u",
+							 buf.len > 0 ? ", " : "",
+							 (1UL << shift) >> 10,
+							 gss->chunk_count[shift]);
+		}
+		if (buf.len > 0)
+			ExplainPropertyText("Chunk Sizes", buf.data, es);
+		pfree(buf.data);
+	}
 
 	if (gsplan->cplan.plan.qual != NIL)
 	{
@@ -1106,6 +2157,11 @@ gpuscan_textout_plan(StringInfo str, const CustomPlan *node)
 
 	appendStringInfo(str, " :host_attnums ");
 	_outBitmapset(str, plannode->host_attnums);
+
+	appendStringInfo(str, " :use_tcache %s",
+					 plannode->use_tcache ? "true" : "false");
+
+	appendStringInfo(str, " :dev_qual_ops %.2f", plannode->dev_qual_ops);
 }
 
 static CustomPlan *
@@ -1116,12 +2172,16 @@ gpuscan_copy_plan(const CustomPlan *from)
 
 	CopyCustomPlanCommon((Node *)from, (Node *)newnode);
 	newnode->scanrelid = oldnode->scanrelid;
+	newnode->kern_source = (oldnode->kern_source
+							? pstrdup(oldnode->kern_source) : NULL);
 	newnode->used_params = copyObject(oldnode->used_params);
 	newnode->used_vars = copyObject(oldnode->used_vars);
 	newnode->extra_flags = oldnode->extra_flags;
 	newnode->dev_clauses = oldnode->dev_clauses;
 	newnode->dev_attnums = bms_copy(oldnode->dev_attnums);
 	newnode->host_attnums = bms_copy(oldnode->host_attnums);
+	newnode->use_tcache = oldnode->use_tcache;
+	newnode->dev_qual_ops = oldnode->dev_qual_ops;
 
 	return &newnode->cplan;
 }
@@ -1138,20 +2198,122 @@ pgstrom_init_gpuscan(void)
 							 PGC_USERSET,
 							 GUC_NOT_IN_SAMPLE,
 							 NULL, NULL, NULL);
-
-	/* setup path methods */
-	gpuscan_path_methods.CustomName			= "GpuScan";
-	gpuscan_path_methods.CreateCustomPlan	= gpuscan_create_plan;
-	gpuscan_path_methods.TextOutCustomPath	= gpuscan_textout_path;
-
-	/* setup plan methods */
-	gpuscan_plan_methods.CustomName			= "GpuScan";
-	gpuscan_plan_methods.SetCustomPlanRef	= gpuscan_set_plan_ref;
-	gpuscan_plan_methods.SupportBackwardScan= NULL;
-	gpuscan_plan_methods.FinalizeCustomPlan	= gpuscan_finalize_plan;
-	gpuscan_plan_methods.BeginCustomPlan	= gpuscan_begin;
-	gpuscan_plan_methods.ExecCustomPlan		= gpuscan_exec;
-	gpuscan_plan_methods.MultiExecCustomPlan= gpuscan_exec_multi;
+	DefineCustomBoolVariable("pgstrom.enable_tcache",
+							 "Enables GpuScan to use the columnar cache.",
+							 NULL,
+							 &enable_tcache,
+							 true,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	DefineCustomIntVariable("pgstrom.gpuscan_chunk_size_min",
+							"min size of row-store chunk of GpuScan",
+							NULL,
+							&gpuscan_chunk_size_min,
+							1024,
+							256,
+							1 << (GPUSCAN_CHUNK_BITS_MAX - 10),
+							PGC_USERSET,
+							GUC_NOT_IN_SAMPLE | GUC_UNIT_KB,
+							NULL, NULL, NULL);
+	DefineCustomIntVariable("pgstrom.gpuscan_chunk_size_max",
+							"max size of row-store chunk of GpuScan",
+							NULL,
+							&gpuscan_chunk_size_max,
+							65536,
+							256,
+							1 << (GPUSCAN_CHUNK_BITS_MAX - 10),
+							PGC_USERSET,
+							GUC_NOT_IN_SAMPLE | GUC_UNIT_KB,
+							NULL, NULL, NULL);
+	DefineCustomBoolVariable("pgstrom.gpuscan_result_bitmap",
+							 "Enables GpuScan to return dense results by bitmap",
+							 NULL,
+							 &gpuscan_result_bitmap,
+							 true,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	DefineCustomBoolVariable("pgstrom.gpuscan_device_projection",
+							 "Enables GpuScan to write back only referenced columns",
+							 NULL,
+							 &gpuscan_device_projection,
+							 true,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	DefineCustomBoolVariable("pgstrom.gpuscan_vector_kernel",
+							 "Enables GpuScan to use vectorized kernel on columnar cache",
+							 NULL,
+							 &gpuscan_vector_kernel,
+							 true,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	DefineCustomIntVariable("pgstrom.gpuscan_prefetch_chunks",
+							"number of chunks to be prefetched from heap",
+							NULL,
+							&gpuscan_prefetch_chunks,
+							1,
+							0,
+							16,
+							PGC_USERSET,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
+	DefineCustomRealVariable("pgstrom.gpuscan_setup_cost",
+							 "Cost to set up a GpuScan, including kernel build",
+							 NULL,
+							 &gpuscan_setup_cost,
+							 1000.0,
+							 0.0,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	DefineCustomRealVariable("pgstrom.gpuscan_operator_cost",
+							 "Cost of an operator on device; negative to use calibrated one",
+							 NULL,
+							 &gpuscan_operator_cost,
+							 -1.0,
+							 -1.0,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	DefineCustomRealVariable("pgstrom.gpuscan_dma_cost",
+							 "Cost to send a KB to device; negative to use calibrated one",
+							 NULL,
+							 &gpuscan_dma_cost,
+							 -1.0,
+							 -1.0,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	DefineCustomIntVariable("pgstrom.gpuscan_shared_chunks",
+							"number of columnar cache chunks on a device being shared by concurrent scans",
+							NULL,
+							&gpuscan_shared_chunks,
+							16,
+							0,
+							INT_MAX,
+							PGC_POSTMASTER,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
+
+	/* setup path methods */
+	gpuscan_path_methods.CustomName			= "GpuScan";
+	gpuscan_path_methods.CreateCustomPlan	= gpuscan_create_plan;
+	gpuscan_path_methods.TextOutCustomPath	= gpuscan_textout_path;
+
+	/* setup plan methods */
+	gpuscan_plan_methods.CustomName			= "GpuScan";
+	gpuscan_plan_methods.SetCustomPlanRef	= gpuscan_set_plan_ref;
+	gpuscan_plan_methods.SupportBackwardScan= NULL;
+	gpuscan_plan_methods.FinalizeCustomPlan	= gpuscan_finalize_plan;
+	gpuscan_plan_methods.BeginCustomPlan	= gpuscan_begin;
+	gpuscan_plan_methods.ExecCustomPlan		= gpuscan_exec;
+	gpuscan_plan_methods.MultiExecCustomPlan= gpuscan_exec_multi;
 	gpuscan_plan_methods.EndCustomPlan		= gpuscan_end;
 	gpuscan_plan_methods.ReScanCustomPlan	= gpuscan_rescan;
 	gpuscan_plan_methods.ExplainCustomPlanTargetRel	= gpuscan_explain_rel;
@@ -1184,16 +2346,258 @@ typedef struct
 	cl_mem			m_gpuscan;
 	cl_mem			m_rstore;
 	cl_mem			m_cstore;
+	cl_mem			m_toast;	/* toast buffer, if column-store */
+	cl_mem			m_proj;		/* results of projection, if any */
+	bool			rstore_mapped;	/* m_rstore is mapped on host memory */
+	struct clserv_shared_chunk *schunk;	/* m_cstore is shared, if any */
+	Size			dma_length;	/* length of DMA send, for scheduler */
+	cl_command_queue kcmdq_recv;	/* command queue to enqueue DMA receive */
+	cl_int			ev_first;	/* index of the first event of this scan */
+	cl_int			ev_kern;	/* index of the kernel execution event */
 	cl_int			ev_index;
-	cl_event		events[10];
-} clstate_gpuscan_row;
+	cl_event		events[FLEXIBLE_ARRAY_MEMBER];
+} clstate_gpuscan;
+
+/*
+ * Shared device buffers of columnar cache chunks
+ *
+ * A column-store on the columnar cache is never modified as long as
+ * somebody else holds a reference on it, because tcache_cow_column_store
+ * makes a copy in this case. So, kern_column_store once constructed on
+ * the device can be shared by concurrent GpuScans towards the same chunk
+ * with the same set of referenced columns; the later ones don't need to
+ * send the chunk again, and their kernels just wait for completion of
+ * the DMA send by the first one.
+ * Each device keeps up to pgstrom.gpuscan_shared_chunks chunks in LRU
+ * order. An entry holds its own reference on the column-store and the
+ * events of DMA send, then it is released when evicted from the list and
+ * no scans are running on it. Chunks that are no longer referenced by
+ * anybody else (e.g, already replaced by a copy) are evicted on the next
+ * lookup. Only the OpenCL server touches the list, so a mutex is enough.
+ */
+typedef struct clserv_shared_chunk
+{
+	dlist_node		chain;		/* link to the LRU list of the device */
+	int				dindex;		/* device index of m_cstore */
+	cl_int			refcnt;		/* references by the list and scans */
+	tcache_column_store *tcs;	/* own reference to the column-store */
+	cl_mem			m_cstore;	/* kern_column_store on the device */
+	size_t			length;		/* length of m_cstore */
+	size_t			hlength;	/* length of the header portion */
+	kern_column_store *kcs_head;	/* copy of the header to be compared */
+	cl_uint		   *cs_cindex;	/* copy of referenced columns */
+	cl_int			ev_count;	/* number of DMA send events */
+	cl_event		events[FLEXIBLE_ARRAY_MEMBER];
+} clserv_shared_chunk;
+
+static pthread_mutex_t	clserv_shared_chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static dlist_head		clserv_shared_chunk_list[MAX_NUM_DEVICES];
+static int				clserv_shared_chunk_nums[MAX_NUM_DEVICES];
+static bool				clserv_shared_chunk_ready = false;
+
+/*
+ * clserv_put_shared_chunk
+ *
+ * It decrements reference counter of the supplied shared chunk, then
+ * releases the device buffer and column-store if nobody references it.
+ */
+static void
+clserv_put_shared_chunk(clserv_shared_chunk *schunk)
+{
+	bool	do_release = false;
+	int		i;
+
+	pthread_mutex_lock(&clserv_shared_chunk_lock);
+	Assert(schunk->refcnt > 0);
+	if (--schunk->refcnt == 0)
+		do_release = true;
+	pthread_mutex_unlock(&clserv_shared_chunk_lock);
+
+	if (do_release)
+	{
+		for (i=0; i < schunk->ev_count; i++)
+			clReleaseEvent(schunk->events[i]);
+		clserv_release_buffer(schunk->dindex, schunk->m_cstore);
+		tcache_put_column_store(schunk->tcs);
+		free(schunk);
+	}
+}
+
+/*
+ * clserv_evict_shared_chunk
+ *
+ * It detaches the supplied chunk from the LRU list. The caller has to
+ * hold clserv_shared_chunk_lock, and put the returned chunk after the
+ * lock released.
+ */
+static clserv_shared_chunk *
+clserv_evict_shared_chunk(clserv_shared_chunk *schunk)
+{
+	dlist_delete(&schunk->chain);
+	clserv_shared_chunk_nums[schunk->dindex]--;
+	return schunk;
+}
+
+/*
+ * clserv_shared_chunk_is_stale
+ *
+ * It checks whether nobody references the column-store except for the
+ * shared chunk itself. Such a chunk is never scanned again.
+ */
+static bool
+clserv_shared_chunk_is_stale(clserv_shared_chunk *schunk)
+{
+	tcache_column_store *tcs = schunk->tcs;
+	bool		result;
+
+	SpinLockAcquire(&tcs->refcnt_lock);
+	result = (tcs->refcnt == 1);
+	SpinLockRelease(&tcs->refcnt_lock);
+
+	return result;
+}
+
+/*
+ * clserv_lookup_shared_chunk
+ *
+ * It looks up a shared chunk that has kern_column_store being constructed
+ * on the device already, and acquires a reference on it. NULL shall be
+ * returned if not found.
+ */
+static clserv_shared_chunk *
+clserv_lookup_shared_chunk(pgstrom_gpuscan *gscan, size_t length)
+{
+	tcache_column_store *tcs = (tcache_column_store *)gscan->rc_store;
+	kern_column_store  *kcs_head = gscan->kcs_head;
+	int					dindex = gscan->msg.dindex;
+	size_t				hlength = offsetof(kern_column_store,
+										   colmeta[kcs_head->ncols]);
+	clserv_shared_chunk *result = NULL;
+	clserv_shared_chunk *stale[4];
+	int					nstales = 0;
+	dlist_mutable_iter	iter;
+
+	if (gpuscan_shared_chunks == 0)
+		return NULL;
+
+	pthread_mutex_lock(&clserv_shared_chunk_lock);
+	if (!clserv_shared_chunk_ready)
+	{
+		pthread_mutex_unlock(&clserv_shared_chunk_lock);
+		return NULL;
+	}
+	dlist_foreach_modify(iter, &clserv_shared_chunk_list[dindex])
+	{
+		clserv_shared_chunk *schunk
+			= dlist_container(clserv_shared_chunk, chain, iter.cur);
+
+		if (schunk->tcs == tcs &&
+			schunk->length >= length &&
+			schunk->hlength == hlength &&
+			memcmp(schunk->kcs_head, kcs_head, hlength) == 0 &&
+			memcmp(schunk->cs_cindex, gscan->cs_cindex,
+				   sizeof(cl_uint) * kcs_head->ncols) == 0)
+		{
+			/* move to the head of LRU list */
+			dlist_move_head(&clserv_shared_chunk_list[dindex],
+							&schunk->chain);
+			schunk->refcnt++;
+			result = schunk;
+			break;
+		}
+		else if (nstales < lengthof(stale) &&
+				 clserv_shared_chunk_is_stale(schunk))
+			stale[nstales++] = clserv_evict_shared_chunk(schunk);
+	}
+	pthread_mutex_unlock(&clserv_shared_chunk_lock);
+
+	while (nstales > 0)
+		clserv_put_shared_chunk(stale[--nstales]);
+
+	return result;
+}
+
+/*
+ * clserv_register_shared_chunk
+ *
+ * It registers the device buffer of kern_column_store being constructed
+ * by the supplied DMA send events, to be shared with the later scans.
+ * The returned chunk has a reference for the caller, or NULL shall be
+ * returned if it is not available.
+ */
+static clserv_shared_chunk *
+clserv_register_shared_chunk(pgstrom_gpuscan *gscan, cl_mem m_cstore,
+							 size_t length, cl_event *events, cl_int ev_count)
+{
+	tcache_column_store *tcs = (tcache_column_store *)gscan->rc_store;
+	kern_column_store  *kcs_head = gscan->kcs_head;
+	int					dindex = gscan->msg.dindex;
+	cl_uint				ncols = kcs_head->ncols;
+	size_t				hlength = offsetof(kern_column_store, colmeta[ncols]);
+	clserv_shared_chunk *schunk;
+	clserv_shared_chunk *victim = NULL;
+	int					i;
+
+	if (gpuscan_shared_chunks == 0)
+		return NULL;
+
+	schunk = malloc(offsetof(clserv_shared_chunk, events[ev_count]) +
+					hlength + sizeof(cl_uint) * ncols);
+	if (!schunk)
+		return NULL;	/* not a fatal error, just not shared */
+
+	schunk->dindex = dindex;
+	schunk->refcnt = 2;		/* one for the list, one for the caller */
+	schunk->tcs = tcache_get_column_store(tcs);
+	schunk->m_cstore = m_cstore;
+	schunk->length = length;
+	schunk->hlength = hlength;
+	schunk->kcs_head = (kern_column_store *)
+		((char *)schunk + offsetof(clserv_shared_chunk, events[ev_count]));
+	memcpy(schunk->kcs_head, kcs_head, hlength);
+	schunk->cs_cindex = (cl_uint *)((char *)schunk->kcs_head + hlength);
+	memcpy(schunk->cs_cindex, gscan->cs_cindex, sizeof(cl_uint) * ncols);
+	schunk->ev_count = ev_count;
+	for (i=0; i < ev_count; i++)
+	{
+		clRetainEvent(events[i]);
+		schunk->events[i] = events[i];
+	}
+
+	pthread_mutex_lock(&clserv_shared_chunk_lock);
+	if (!clserv_shared_chunk_ready)
+	{
+		for (i=0; i < MAX_NUM_DEVICES; i++)
+		{
+			dlist_init(&clserv_shared_chunk_list[i]);
+			clserv_shared_chunk_nums[i] = 0;
+		}
+		clserv_shared_chunk_ready = true;
+	}
+	dlist_push_head(&clserv_shared_chunk_list[dindex], &schunk->chain);
+	if (++clserv_shared_chunk_nums[dindex] > gpuscan_shared_chunks)
+	{
+		dlist_node *dnode = dlist_tail_node(&clserv_shared_chunk_list[dindex]);
+
+		victim = clserv_evict_shared_chunk(dlist_container(clserv_shared_chunk,
+														   chain, dnode));
+	}
+	pthread_mutex_unlock(&clserv_shared_chunk_lock);
+
+	if (victim)
+		clserv_put_shared_chunk(victim);
+
+	return schunk;
+}
 
 static void
-clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
+clserv_respond_gpuscan(cl_event event, cl_int ev_status, void *private)
 {
-	clstate_gpuscan_row	*clgss = private;
+	clstate_gpuscan		*clgss = private;
 	pgstrom_gpuscan		*gscan = (pgstrom_gpuscan *)clgss->msg;
 	kern_resultbuf		*kresult = KERN_GPUSCAN_RESULTBUF(&gscan->kern);
+	cl_ulong			time_dma = 0;
+	cl_ulong			time_kern = 0;
 
 	/* put error code */
 	if (ev_status != CL_COMPLETE)
@@ -1206,77 +2610,52 @@ clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
 	{
 		gscan->msg.errcode = kresult->errcode;
 	}
-	/* collect performance statistics */
-	if (gscan->msg.pfm.enabled)
+	/*
+	 * collect performance statistics
+	 *
+	 * events[ev_first ... ev_kern-1] are DMA send, events[ev_kern] is
+	 * kernel execution, then events[ev_kern+1 ... ev_index-1] are DMA
+	 * receive. events[0 ... ev_first-1] are DMA send by another scan if
+	 * the column-store on the device is shared, so they are not counted.
+	 * These are also reported to the device scheduler, so we collect
+	 * them regardless of the perfmon setting.
+	 */
+	if (ev_status == CL_COMPLETE)
 	{
-		cl_ulong	dma_send_begin0;
-		cl_ulong	dma_send_begin1;
-		cl_ulong	dma_send_begin2;
-		cl_ulong	dma_send_end0;
-		cl_ulong	dma_send_end1;
-		cl_ulong	dma_send_end2;
+		cl_ulong	dma_send_begin = ~0UL;
+		cl_ulong	dma_send_end = 0;
 		cl_ulong	kern_exec_begin;
 		cl_ulong	kern_exec_end;
 		cl_ulong	dma_recv_begin;
 		cl_ulong	dma_recv_end;
-		cl_int		rc;
-
-		rc = clGetEventProfilingInfo(clgss->events[0],
-									 CL_PROFILING_COMMAND_START,
-									 sizeof(cl_ulong),
-									 &dma_send_begin0,
-									 NULL);
-		if (rc != CL_SUCCESS)
-			goto skip_perfmon;
-
-		rc = clGetEventProfilingInfo(clgss->events[1],
-									 CL_PROFILING_COMMAND_START,
-									 sizeof(cl_ulong),
-									 &dma_send_begin1,
-									 NULL);
-		if (rc != CL_SUCCESS)
-			goto skip_perfmon;
-
-		rc = clGetEventProfilingInfo(clgss->events[2],
-									 CL_PROFILING_COMMAND_START,
-									 sizeof(cl_ulong),
-									 &dma_send_begin2,
-									 NULL);
-		if (rc != CL_SUCCESS)
-			goto skip_perfmon;
-
-		rc = clGetEventProfilingInfo(clgss->events[0],
-									 CL_PROFILING_COMMAND_END,
-									 sizeof(cl_ulong),
-									 &dma_send_end0,
-									 NULL);
-		if (rc != CL_SUCCESS)
-			goto skip_perfmon;
+		cl_ulong	tv_begin;
+		cl_ulong	tv_end;
+		cl_ulong	time_overlap;
+		cl_int		i, rc;
 
-		rc = clGetEventProfilingInfo(clgss->events[1],
-									 CL_PROFILING_COMMAND_END,
-									 sizeof(cl_ulong),
-									 &dma_send_end1,
-									 NULL);
-		if (rc != CL_SUCCESS)
-			goto skip_perfmon;
-
-		rc = clGetEventProfilingInfo(clgss->events[2],
-									 CL_PROFILING_COMMAND_END,
-									 sizeof(cl_ulong),
-									 &dma_send_end2,
-									 NULL);
-		if (rc != CL_SUCCESS)
-			goto skip_perfmon;
-
-		dma_send_begin0 = Min(dma_send_begin0,
-							  Min(dma_send_begin1,
-								  dma_send_begin2));
-		dma_send_end0 = Max(dma_send_end0,
-							Max(dma_send_end1,
-								dma_send_end2));
+		for (i=clgss->ev_first; i < clgss->ev_kern; i++)
+		{
+			rc = clGetEventProfilingInfo(clgss->events[i],
+										 CL_PROFILING_COMMAND_START,
+										 sizeof(cl_ulong),
+										 &tv_begin,
+										 NULL);
+			if (rc != CL_SUCCESS)
+				goto skip_perfmon;
+
+			rc = clGetEventProfilingInfo(clgss->events[i],
+										 CL_PROFILING_COMMAND_END,
+										 sizeof(cl_ulong),
+										 &tv_end,
+										 NULL);
+			if (rc != CL_SUCCESS)
+				goto skip_perfmon;
+
+			dma_send_begin = Min(dma_send_begin, tv_begin);
+			dma_send_end = Max(dma_send_end, tv_end);
+		}
 
-		rc = clGetEventProfilingInfo(clgss->events[3],
+		rc = clGetEventProfilingInfo(clgss->events[clgss->ev_kern],
 									 CL_PROFILING_COMMAND_START,
 									 sizeof(cl_ulong),
 									 &kern_exec_begin,
@@ -1284,7 +2663,7 @@ clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
 		if (rc != CL_SUCCESS)
 			goto skip_perfmon;
 
-		rc = clGetEventProfilingInfo(clgss->events[3],
+		rc = clGetEventProfilingInfo(clgss->events[clgss->ev_kern],
 									 CL_PROFILING_COMMAND_END,
 									 sizeof(cl_ulong),
 									 &kern_exec_end,
@@ -1292,7 +2671,7 @@ clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
 		if (rc != CL_SUCCESS)
 			goto skip_perfmon;
 
-		rc = clGetEventProfilingInfo(clgss->events[4],
+		rc = clGetEventProfilingInfo(clgss->events[clgss->ev_kern + 1],
 									 CL_PROFILING_COMMAND_START,
 									 sizeof(cl_ulong),
 									 &dma_recv_begin,
@@ -1300,7 +2679,7 @@ clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
 		if (rc != CL_SUCCESS)
 			goto skip_perfmon;
 
-		rc = clGetEventProfilingInfo(clgss->events[4],
+		rc = clGetEventProfilingInfo(clgss->events[clgss->ev_index - 1],
 									 CL_PROFILING_COMMAND_END,
 									 sizeof(cl_ulong),
 									 &dma_recv_end,
@@ -1308,12 +2687,27 @@ clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
 		if (rc != CL_SUCCESS)
 			goto skip_perfmon;
 
-		gscan->msg.pfm.time_dma_send
-			+= (dma_send_end0 - dma_send_begin0) / 1000;
-		gscan->msg.pfm.time_kern_exec
-			+= (kern_exec_end - kern_exec_begin) / 1000;
-		gscan->msg.pfm.time_dma_recv
-			+= (dma_recv_end - dma_recv_begin) / 1000;
+		time_dma = ((dma_send_end - dma_send_begin) +
+					(dma_recv_end - dma_recv_begin)) / 1000;
+		time_kern = (kern_exec_end - kern_exec_begin) / 1000;
+		time_overlap = pgstrom_opencl_device_overlap(&gscan->msg,
+													 dma_send_begin,
+													 dma_send_end,
+													 kern_exec_begin,
+													 kern_exec_end,
+													 dma_recv_begin,
+													 dma_recv_end);
+
+		if (gscan->msg.pfm.enabled)
+		{
+			gscan->msg.pfm.time_dma_send
+				+= (dma_send_end - dma_send_begin) / 1000;
+			gscan->msg.pfm.time_kern_exec
+				+= (kern_exec_end - kern_exec_begin) / 1000;
+			gscan->msg.pfm.time_dma_recv
+				+= (dma_recv_end - dma_recv_begin) / 1000;
+			gscan->msg.pfm.time_dma_overlap += time_overlap;
+		}
 
 	skip_perfmon:
 		if (rc != CL_SUCCESS)
@@ -1323,15 +2717,37 @@ clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
 			gscan->msg.pfm.enabled = false;	/* turn off profiling */
 		}
 	}
+	/* record the commands on the profiling timeline, if enabled */
+	if (ev_status == CL_COMPLETE)
+		clserv_timeline_record(&gscan->msg,
+							   clgss->events + clgss->ev_first,
+							   clgss->ev_index - clgss->ev_first,
+							   clgss->ev_kern - clgss->ev_first,
+							   clgss->ev_kern + 1 - clgss->ev_first);
+
+	/* inform the device scheduler of completion */
+	pgstrom_opencl_device_complete(&gscan->msg, clgss->dma_length,
+								   time_dma, time_kern);
+
 	/* dump debug messages */
 	pgstrom_dump_kernel_debug(LOG, KERN_GPUSCAN_RESULTBUF(&gscan->kern));
 
 	/* release opencl objects */
 	while (clgss->ev_index > 0)
 		clReleaseEvent(clgss->events[--clgss->ev_index]);
-	clReleaseMemObject(clgss->m_cstore);
-	clReleaseMemObject(clgss->m_rstore);
-	clReleaseMemObject(clgss->m_gpuscan);
+	if (clgss->m_toast)
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_toast);
+	if (clgss->m_proj)
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_proj);
+	if (clgss->schunk)
+		clserv_put_shared_chunk(clgss->schunk);
+	else
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_cstore);
+	if (clgss->rstore_mapped)
+		clReleaseMemObject(clgss->m_rstore);
+	else if (clgss->m_rstore)
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_rstore);
+	clserv_release_buffer(gscan->msg.dindex, clgss->m_gpuscan);
 	clReleaseKernel(clgss->kernel);
 	clReleaseProgram(clgss->program);
 	free(clgss);
@@ -1340,38 +2756,228 @@ clserv_respond_gpuscan_row(cl_event event, cl_int ev_status, void *private)
 	pgstrom_reply_message(&gscan->msg);
 }
 
+/*
+ * clserv_fetch_gpuscan
+ *
+ * It is a callback on completion of DMA receive of the header portion of
+ * kern_resultbuf. Because 'nitems' is now visible, it enqueues the second
+ * DMA receive of the results being actually written, then registers a
+ * callback to respond the message. So, length of DMA receive and host side
+ * iteration are proportional to the number of visible rows, not 'nrooms'.
+ * Columns written back by the device projection are also received here;
+ * only the first 'nitems' rooms in index mode.
+ */
 static void
-clserv_process_gpuscan_row(pgstrom_message *msg)
+clserv_fetch_gpuscan(cl_event event, cl_int ev_status, void *private)
 {
-	pgstrom_gpuscan	   *gscan = (pgstrom_gpuscan *)msg;
-	pgstrom_row_store  *rstore;
-	clstate_gpuscan_row *clgss;
-	kern_parambuf	   *kparams;
-	//kern_resultbuf	   *kresults;
+	clstate_gpuscan	   *clgss = private;
+	pgstrom_gpuscan	   *gscan = (pgstrom_gpuscan *)clgss->msg;
+	kern_resultbuf	   *kresult = KERN_GPUSCAN_RESULTBUF(&gscan->kern);
+	kern_column_store  *kproj = gscan->kproj;
+	cl_int				ev_index = clgss->ev_index;
+	cl_int				rc;
+
+	if (ev_status != CL_COMPLETE)
+	{
+		clserv_respond_gpuscan(event, ev_status, clgss);
+		return;
+	}
+
+	/* rest of the result-buffer, unless kernel debug already read it */
+	if (kresult->debug_usage == KERN_DEBUG_UNAVAILABLE &&
+		KERN_GPUSCAN_DMA_RECVLEN_BODY(&gscan->kern) > 0)
+	{
+		rc = clserv_enqueue_read_buffer(clgss->kcmdq_recv,
+										clgss->m_gpuscan,
+										((uintptr_t)kresult->results -
+										 (uintptr_t)(&gscan->kern)),
+										KERN_GPUSCAN_DMA_RECVLEN_BODY(&gscan->kern),
+										kresult->results,
+										1,
+										&clgss->events[clgss->ev_index - 1],
+										&clgss->events[clgss->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueReadBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clgss->ev_index++;
+	}
+
+	/* columns being written back by the device projection */
+	if (clgss->m_proj && kresult->nitems > 0)
+	{
+		cl_uint		nrows = (KERN_RESULTBUF_IS_BITMAP(kresult)
+							 ? kresult->nrooms
+							 : kresult->nitems);
+		cl_uint		i;
+
+		for (i=0; i < kproj->ncols; i++)
+		{
+			kern_colmeta   *pcmeta = &kproj->colmeta[i];
+			Size			length;
+
+			length = nrows * KERN_GPUSCAN_PROJ_WIDTH(pcmeta->attlen);
+			if ((pcmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
+				length += STROMALIGN((kproj->nrows + 7) >> 3);
+
+			rc = clserv_enqueue_read_buffer(clgss->kcmdq_recv,
+											clgss->m_proj,
+											pcmeta->cs_ofs,
+											length,
+											(char *)kproj + pcmeta->cs_ofs,
+											1,
+											&clgss->events[clgss->ev_index - 1],
+											&clgss->events[clgss->ev_index]);
+			if (rc != CL_SUCCESS)
+			{
+				elog(LOG, "failed on clEnqueueReadBuffer: %s",
+					 opencl_strerror(rc));
+				goto error_sync;
+			}
+			clgss->ev_index++;
+		}
+	}
+
+	/* nothing to be received any more */
+	if (clgss->ev_index == ev_index)
+	{
+		clserv_respond_gpuscan(event, ev_status, clgss);
+		return;
+	}
+
+	/* flush the command queue, to avoid waiting for further commands */
+	clFlush(clgss->kcmdq_recv);
+
+	rc = clserv_set_event_callback(clgss->events[clgss->ev_index - 1],
+								   clserv_respond_gpuscan,
+								   clgss);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetEventCallback: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	return;
+
+error_sync:
+	/* wait for the receives already enqueued, prior to release */
+	if (clgss->ev_index > ev_index)
+		clWaitForEvents(clgss->ev_index - ev_index,
+						&clgss->events[ev_index]);
+	clserv_respond_gpuscan(event, rc, clgss);
+}
+
+/*
+ * clserv_launch_gpuscan
+ *
+ * It enqueues the kernel execution and DMA writeback of the result-buffer
+ * once all the DMA send requests were enqueued, then registers a callback
+ * to respond the message. Caller has to handle errors by synchronization
+ * of the events, if not CL_SUCCESS.
+ * Unless kernel debug is enabled, only header of the result-buffer is
+ * written back here; remaining portion is done by clserv_fetch_gpuscan().
+ */
+static cl_int
+clserv_launch_gpuscan(clstate_gpuscan *clgss, cl_command_queue kcmdq,
+					  cl_command_queue kcmdq_recv,
+					  size_t gwork_sz, size_t lwork_sz)
+{
+	pgstrom_gpuscan	   *gscan = (pgstrom_gpuscan *)clgss->msg;
+	kern_resultbuf	   *kresult = KERN_GPUSCAN_RESULTBUF(&gscan->kern);
+	bool				kernel_debug;
+	cl_int				rc;
+
+	clgss->kcmdq_recv = kcmdq_recv;
+	clgss->ev_kern = clgss->ev_index;
+	kernel_debug = (kresult->debug_usage != KERN_DEBUG_UNAVAILABLE);
+	rc = clEnqueueNDRangeKernel(kcmdq,
+								clgss->kernel,
+								1,
+								NULL,
+								&gwork_sz,
+								&lwork_sz,
+								clgss->ev_index,
+								&clgss->events[0],
+								&clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueNDRangeKernel: %s", opencl_strerror(rc));
+		return rc;
+	}
+	clgss->ev_index++;
+
+	/*
+	 * Write back the result-buffer
+	 */
+	rc = clserv_enqueue_read_buffer(kcmdq_recv,
+									clgss->m_gpuscan,
+									((uintptr_t)kresult -
+									 (uintptr_t)(&gscan->kern)),
+									(kernel_debug
+									 ? KERN_GPUSCAN_DMA_RECVLEN(&gscan->kern)
+									 : KERN_GPUSCAN_DMA_RECVLEN_HEAD(&gscan->kern)),
+									kresult,
+									1,
+									&clgss->events[clgss->ev_index - 1],
+									&clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueReadBuffer: %s", opencl_strerror(rc));
+		return rc;
+	}
+	clgss->ev_index++;
+
+	/* submit the commands on the transfer and compute queues */
+	clserv_flush_device_queues(gscan->msg.dindex);
+
+	/*
+	 * Last, registers a callback routine that replies the message
+	 * to the backend
+	 */
+	rc = clserv_set_event_callback(clgss->events[clgss->ev_index - 1],
+								   (kernel_debug && !clgss->m_proj
+									? clserv_respond_gpuscan
+									: clserv_fetch_gpuscan),
+								   clgss);
+	if (rc != CL_SUCCESS)
+		elog(LOG, "failed on clSetEventCallback: %s", opencl_strerror(rc));
+	return rc;
+}
+
+static void
+clserv_process_gpuscan_row(pgstrom_gpuscan *gscan)
+{
+	pgstrom_row_store  *rstore = (pgstrom_row_store *)gscan->rc_store;
+	clstate_gpuscan	   *clgss;
 	kern_row_store	   *krstore;
 	kern_column_store  *kcstore_head;
 	cl_command_queue	kcmdq;
+	cl_command_queue	kcmdq_send;
+	cl_command_queue	kcmdq_recv;
+	kern_column_store  *kproj = gscan->kproj;
 	cl_uint				nrows;
+	cl_uint				nproj = (kproj ? kproj->ncols : 0);
 	cl_uint				i;
 	cl_int				rc;
 	size_t				length;
 	size_t				gwork_sz;
 	size_t				lwork_sz;
 
-	/* only one store shall be attached! */
-	Assert(dlist_head_node(&gscan->rc_store) ==
-		   dlist_tail_node(&gscan->rc_store));
-	rstore = dlist_container(pgstrom_row_store, chain,
-							 dlist_head_node(&gscan->rc_store));
+	Assert(rstore->stag == StromTag_RowStore);
 
-	/* state object of gpuscan with row-store */
-	clgss = malloc(sizeof(clstate_gpuscan_row));
+	/*
+	 * state object of gpuscan with row-store; projection needs DMA send
+	 * of its header and null-maps, and DMA receive of each column.
+	 */
+	length = offsetof(clstate_gpuscan, events[7 + 2 * nproj]);
+	clgss = malloc(length);
 	if (!clgss)
 	{
-		msg->errcode = CL_OUT_OF_HOST_MEMORY;
+		rc = CL_OUT_OF_HOST_MEMORY;
 		goto error0;
 	}
-	memset(clgss, 0, sizeof(clstate_gpuscan_row));
+	memset(clgss, 0, length);
 	clgss->msg = &gscan->msg;
 	krstore = &rstore->kern;
 	kcstore_head = rstore->kcs_head;
@@ -1422,31 +3028,41 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	/*
 	 * Choose a device to execute this kernel
 	 */
-	i = pgstrom_opencl_device_schedule(&gscan->msg);
+	clgss->dma_length = KERN_GPUSCAN_LENGTH(&gscan->kern) + krstore->length;
+	i = pgstrom_opencl_device_schedule(&gscan->msg, clgss->dma_length);
 	kcmdq = opencl_cmdq[i];
+	kcmdq_send = opencl_cmdq_send[i];
+	kcmdq_recv = opencl_cmdq_recv[i];
 
 	/* and, compute an optimal workgroup-size of this kernel */
 	lwork_sz = clserv_compute_workgroup_size(clgss->kernel, i, nrows,
 											 2 * sizeof(cl_uint));
 
 	/* allocation of device memory for kern_gpuscan argument */
-	clgss->m_gpuscan = clCreateBuffer(opencl_context,
-									  CL_MEM_READ_WRITE,
-									  KERN_GPUSCAN_LENGTH(&gscan->kern),
-									  NULL,
-									  &rc);
+	clgss->m_gpuscan = clserv_create_buffer(gscan->msg.dindex,
+											KERN_GPUSCAN_LENGTH(&gscan->kern),
+											&rc);
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
 		goto error3;
 	}
 
-	/* allocation of device memory for kern_row_store argument */
-	clgss->m_rstore = clCreateBuffer(opencl_context,
-									 CL_MEM_READ_WRITE,
-									 krstore->length,
-									 NULL,
-									 &rc);
+	/*
+	 * allocation of device memory for kern_row_store argument.
+	 * If device shares the physical memory with host, row-store on the
+	 * page-locked zone can be referenced by the kernel with no DMA.
+	 */
+	clgss->m_rstore = clserv_create_mapped_buffer(gscan->msg.dindex,
+												  krstore,
+												  krstore->length,
+												  &rc);
+	if (rc == CL_SUCCESS && clgss->m_rstore)
+		clgss->rstore_mapped = true;
+	else
+		clgss->m_rstore = clserv_create_buffer(gscan->msg.dindex,
+											   krstore->length,
+											   &rc);
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
@@ -1454,17 +3070,28 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	}
 
 	/* allocation of device memory for kern_column_store argument */
-	clgss->m_cstore = clCreateBuffer(opencl_context,
-									 CL_MEM_READ_WRITE,
-									 kcstore_head->length,
-									 NULL,
-									 &rc);
+	clgss->m_cstore = clserv_create_buffer(gscan->msg.dindex,
+										   kcstore_head->length,
+										   &rc);
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
 		goto error5;
 	}
 
+	/* allocation of device memory for the results of projection */
+	if (kproj)
+	{
+		clgss->m_proj = clserv_create_buffer(gscan->msg.dindex,
+											 kproj->length,
+											 &rc);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+			goto error6;
+		}
+	}
+
 	/*
 	 * OK, all the device memory and kernel objects acquired.
 	 * Let's prepare kernel invocation.
@@ -1474,6 +3101,7 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	 *   gpuscan_qual_rs(__global kern_gpuscan *gpuscan,
 	 *                   __global kern_row_store *krs,
 	 *                   __global kern_column_store *kcs,
+	 *                   __global kern_column_store *kproj,
 	 *                   __local void *local_workmem)
 	 */
 	rc = clSetKernelArg(clgss->kernel,
@@ -1483,7 +3111,7 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
-		goto error6;
+		goto error7;
 	}
 
 	rc = clSetKernelArg(clgss->kernel,
@@ -1493,7 +3121,7 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
-		goto error6;
+		goto error7;
 	}
 
 	rc = clSetKernelArg(clgss->kernel,
@@ -1503,17 +3131,27 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
-		goto error6;
+		goto error7;
 	}
 
 	rc = clSetKernelArg(clgss->kernel,
-						3,	/* local_workmem */
+						3,	/* kern_column_store for projection, or NULL */
+						sizeof(cl_mem),
+						&clgss->m_proj);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	rc = clSetKernelArg(clgss->kernel,
+						4,	/* local_workmem */
 						2 * sizeof(cl_uint) * lwork_sz,
 						NULL);
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
-		goto error6;
+		goto error7;
 	}
 
 	/*
@@ -1524,50 +3162,51 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	 * (2) kernel shall be launched
 	 * (3) kern_result shall be written back
 	 */
-	kparams = &gscan->kern.kparam;
-	length = kparams->length + offsetof(kern_resultbuf, results[0]);
-
-	rc = clEnqueueWriteBuffer(kcmdq,
-							  clgss->m_gpuscan,
-							  CL_FALSE,
-							  0,
-							  length,
-							  &gscan->kern,
-							  0,
-							  NULL,
-							  &clgss->events[clgss->ev_index++]);
+	length = KERN_GPUSCAN_DMA_SENDLEN(&gscan->kern);
+
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clgss->m_gpuscan,
+									 0,
+									 length,
+									 &gscan->kern,
+									 0,
+									 NULL,
+									 &clgss->events[clgss->ev_index]);
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
-		goto error6;
+		goto error7;
 	}
+	clgss->ev_index++;
 
-	rc = clEnqueueWriteBuffer(kcmdq,
-							  clgss->m_rstore,
-							  CL_FALSE,
-							  0,
-							  krstore->length,
-							  krstore,
-							  0,
-							  NULL,
-							  &clgss->events[clgss->ev_index]);
-	if (rc != CL_SUCCESS)
+	if (!clgss->rstore_mapped)
 	{
-		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
-		goto error_sync;
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clgss->m_rstore,
+										 0,
+										 krstore->length,
+										 krstore,
+										 0,
+										 NULL,
+										 &clgss->events[clgss->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clgss->ev_index++;
 	}
-	clgss->ev_index++;
 
-	rc = clEnqueueWriteBuffer(kcmdq,
-							  clgss->m_cstore,
-							  CL_FALSE,
-							  0,
-							  offsetof(kern_column_store,
-									   colmeta[kcstore_head->ncols]),
-							  kcstore_head,
-							  0,
-							  NULL,
-							  &clgss->events[clgss->ev_index]);
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clgss->m_cstore,
+									 0,
+									 offsetof(kern_column_store,
+											  colmeta[kcstore_head->ncols]),
+									 kcstore_head,
+									 0,
+									 NULL,
+									 &clgss->events[clgss->ev_index]);
 	if (rc != CL_SUCCESS)
 	{
 		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
@@ -1576,76 +3215,529 @@ clserv_process_gpuscan_row(pgstrom_message *msg)
 	clgss->ev_index++;
 
 	/*
-	 * Kick gpuscan_qual_rs() call
+	 * header and cleared null-maps of the column-store for projection;
+	 * values are written by the kernel for visible rows only.
+	 */
+	if (kproj)
+	{
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clgss->m_proj,
+										 0,
+										 offsetof(kern_column_store,
+												  colmeta[kproj->ncols]),
+										 kproj,
+										 0,
+										 NULL,
+										 &clgss->events[clgss->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clgss->ev_index++;
+
+		for (i=0; i < kproj->ncols; i++)
+		{
+			kern_colmeta   *pcmeta = &kproj->colmeta[i];
+
+			if ((pcmeta->flags & KERN_COLMETA_ATTNOTNULL) != 0)
+				continue;
+			rc = clserv_enqueue_write_buffer(kcmdq_send,
+											 clgss->m_proj,
+											 pcmeta->cs_ofs,
+											 STROMALIGN((kproj->nrows + 7) >> 3),
+											 (char *)kproj + pcmeta->cs_ofs,
+											 0,
+											 NULL,
+											 &clgss->events[clgss->ev_index]);
+			if (rc != CL_SUCCESS)
+			{
+				elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+					 opencl_strerror(rc));
+				goto error_sync;
+			}
+			clgss->ev_index++;
+		}
+	}
+
+	/*
+	 * Kick gpuscan_qual_rs() call, then write back the result
 	 */
 	gwork_sz = ((nrows + lwork_sz - 1) / lwork_sz) * lwork_sz;
 
-	rc = clEnqueueNDRangeKernel(kcmdq,
-								clgss->kernel,
-								1,
-								NULL,
-								&gwork_sz,
-								&lwork_sz,
-								3,
-								&clgss->events[clgss->ev_index - 3],
-								&clgss->events[clgss->ev_index]);
+	rc = clserv_launch_gpuscan(clgss, kcmdq, kcmdq_recv,
+							   gwork_sz, lwork_sz);
 	if (rc != CL_SUCCESS)
-	{
-		elog(LOG, "failed on clEnqueueNDRangeKernel: %s", opencl_strerror(rc));
 		goto error_sync;
+	Assert(clgss->ev_index <= 6 + nproj);
+	return;
+
+error_sync:
+	/*
+	 * Once DMA requests were enqueued, we need to synchronize completion
+	 * of a series of jobs to avoid unexpected memory destruction if device
+	 * write back calculation result onto the region already released.
+	 */
+	clWaitForEvents(clgss->ev_index, clgss->events);
+	while (clgss->ev_index > 0)
+		clReleaseEvent(clgss->events[--clgss->ev_index]);
+error7:
+	if (clgss->m_proj)
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_proj);
+error6:
+	clserv_release_buffer(gscan->msg.dindex, clgss->m_cstore);
+error5:
+	if (clgss->rstore_mapped)
+		clReleaseMemObject(clgss->m_rstore);
+	else
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_rstore);
+error4:
+	clserv_release_buffer(gscan->msg.dindex, clgss->m_gpuscan);
+error3:
+	pgstrom_opencl_device_complete(&gscan->msg, clgss->dma_length, 0, 0);
+	clReleaseKernel(clgss->kernel);
+error2:
+	clReleaseProgram(clgss->program);
+error1:
+	free(clgss);
+error0:
+	gscan->msg.errcode = rc;
+	pgstrom_reply_message(&gscan->msg);
+}
+
+/*
+ * clserv_process_gpuscan_column
+ *
+ * It launches the gpuscan_qual_cs kernel towards a column-store on the
+ * columnar cache. Unlike row-store, the device side kern_column_store is
+ * constructed by a series of DMA transfer; header portion was set up by
+ * the backend, then null-bitmap and values array of the referenced columns
+ * are copied from tcache_column_store directly. If varlena columns are
+ * referenced, its toast buffers are also copied to a kern_toastbuf.
+ */
+static void
+clserv_process_gpuscan_column(pgstrom_gpuscan *gscan)
+{
+	tcache_column_store *tcs = (tcache_column_store *)gscan->rc_store;
+	kern_column_store  *kcs_head = gscan->kcs_head;
+	kern_toastbuf	   *ktoast_head = gscan->ktoast_head;
+	clstate_gpuscan	   *clgss;
+	cl_command_queue	kcmdq;
+	cl_command_queue	kcmdq_send;
+	cl_command_queue	kcmdq_recv;
+	cl_uint				ncols = kcs_head->ncols;
+	cl_uint				nrows = kcs_head->nrows;
+	cl_uint				nthreads = nrows;
+	cl_uint				vector_width = 0;
+	cl_uint				i;
+	cl_int				rc;
+	size_t				length;
+	size_t				toast_length = 0;
+	size_t				cstore_length;
+	size_t				gwork_sz;
+	size_t				lwork_sz;
+
+	Assert(tcs->stag == StromTag_TCacheColumnStore);
+
+	/*
+	 * state object of gpuscan with column-store; we need events for
+	 * kern_gpuscan, header of kcs, nullmap and values of each column,
+	 * header of toast, toast buffer of each column, kernel and writeback
+	 * of the result header and body. In addition, events of DMA send
+	 * by another scan, if column-store on the device is shared.
+	 */
+	length = offsetof(clstate_gpuscan, events[7 + 5 * ncols]);
+	clgss = malloc(length);
+	if (!clgss)
+	{
+		rc = CL_OUT_OF_HOST_MEMORY;
+		goto error0;
+	}
+	memset(clgss, 0, length);
+	clgss->msg = &gscan->msg;
+
+	/* see comments in clserv_process_gpuscan_row */
+	clgss->program = clserv_lookup_device_program(gscan->dprog_key,
+												  &gscan->msg);
+	if (!clgss->program)
+	{
+		free(clgss);
+		return;		/* message is in waitq, retry it! */
+	}
+	if (clgss->program == BAD_OPENCL_PROGRAM)
+	{
+		rc = CL_BUILD_PROGRAM_FAILURE;
+		goto error1;
 	}
-	clgss->ev_index++;
 
 	/*
-	 * Write back the result-buffer
+	 * In this case, we use a kernel for column-store; that evaluate the
+	 * supplied qualifier without any format translation.
 	 */
-	rc = clEnqueueReadBuffer(kcmdq,
-							 clgss->m_gpuscan,
-							 CL_FALSE,
-							 ((uintptr_t)KERN_GPUSCAN_RESULTBUF(&gscan->kern) -
-							  (uintptr_t)(&gscan->kern)),
-							 KERN_GPUSCAN_DMA_RECVLEN(&gscan->kern),
-							 KERN_GPUSCAN_RESULTBUF(&gscan->kern),
-							 1,
-							 &clgss->events[clgss->ev_index - 1],
-							 &clgss->events[clgss->ev_index]);
+	clgss->kernel = clCreateKernel(clgss->program,
+								   "gpuscan_qual_cs",
+								   &rc);
 	if (rc != CL_SUCCESS)
 	{
-		elog(LOG, "failed on clEnqueueReadBuffer: %s", opencl_strerror(rc));
-		goto error_sync;
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error2;
+	}
+
+	/* length of toast buffer, if varlena columns are referenced */
+	if (ktoast_head)
+	{
+		toast_length = STROMALIGN(offsetof(kern_toastbuf, coldir[ncols]));
+		for (i=0; i < ncols; i++)
+		{
+			tcache_toastbuf *tbuf = tcs->cdata[gscan->cs_cindex[i]].toast;
+
+			if (ktoast_head->coldir[i] == 0)
+				continue;
+			toast_length = Max(toast_length,
+							   ktoast_head->coldir[i] +
+							   STROMALIGN(tbuf->tbuf_usage));
+		}
 	}
-	clgss->ev_index++;
 
 	/*
-	 * Last, registers a callback routine that replies the message
-	 * to the backend
+	 * Choose a device to execute this kernel
+	 */
+	clgss->dma_length = (KERN_GPUSCAN_LENGTH(&gscan->kern) +
+						 kcs_head->length + toast_length);
+	i = pgstrom_opencl_device_schedule(&gscan->msg, clgss->dma_length);
+	kcmdq = opencl_cmdq[i];
+	kcmdq_send = opencl_cmdq_send[i];
+	kcmdq_recv = opencl_cmdq_recv[i];
+
+	/*
+	 * Switch to the vectorized kernel if the device prefers vector types
+	 * and no encoded columns are referenced; a work-item processes
+	 * 'vector_width' rows in this case.
 	 */
-	rc = clSetEventCallback(clgss->events[clgss->ev_index - 1],
-							CL_COMPLETE,
-							clserv_respond_gpuscan_row,
-							clgss);
+	if (pgstrom_get_devprog_vector_width(gscan->dprog_key) > 1 &&
+		!tcs->is_encoded &&
+		pgstrom_get_device_info(i)->dev_preferred_vector_width_int > 1)
+	{
+		cl_kernel	vkernel = clCreateKernel(clgss->program,
+											 "gpuscan_qual_cs_vec",
+											 &rc);
+		if (rc == CL_SUCCESS)
+		{
+			clReleaseKernel(clgss->kernel);
+			clgss->kernel = vkernel;
+			vector_width = pgstrom_get_devprog_vector_width(gscan->dprog_key);
+			nthreads = (nrows + vector_width - 1) / vector_width;
+		}
+		else
+			elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+	}
+
+	/* and, compute an optimal workgroup-size of this kernel */
+	lwork_sz = clserv_compute_workgroup_size(clgss->kernel, i, nthreads,
+											 2 * sizeof(cl_uint));
+
+	/* allocation of device memory for kern_gpuscan argument */
+	clgss->m_gpuscan = clserv_create_buffer(gscan->msg.dindex,
+											KERN_GPUSCAN_LENGTH(&gscan->kern),
+											&rc);
 	if (rc != CL_SUCCESS)
 	{
-		elog(LOG, "failed on clSetEventCallback: %s", opencl_strerror(rc));
-		goto error_sync;
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error3;
 	}
-	//Assert(clgss->ev_index == 5);
-	return;
 
-error_sync:
 	/*
-	 * Once DMA requests were enqueued, we need to synchronize completion
-	 * of a series of jobs to avoid unexpected memory destruction if device
-	 * write back calculation result onto the region already released.
+	 * allocation of device memory for kern_column_store argument, or
+	 * shares the one being constructed by another scan on this chunk.
+	 * In the latter case, the kernel has to wait for completion of the
+	 * DMA send by the other scan, instead of its own DMA send.
+	 */
+	cstore_length = kcs_head->length + (vector_width > 0
+										? KERN_VECTOR_PADDING : 0);
+	if (!ktoast_head)
+		clgss->schunk = clserv_lookup_shared_chunk(gscan, cstore_length);
+	if (clgss->schunk)
+	{
+		clserv_shared_chunk *schunk = clgss->schunk;
+
+		clgss->m_cstore = schunk->m_cstore;
+		for (i=0; i < schunk->ev_count; i++)
+		{
+			clRetainEvent(schunk->events[i]);
+			clgss->events[clgss->ev_index++] = schunk->events[i];
+		}
+		clgss->ev_first = clgss->ev_index;
+	}
+	else
+	{
+		clgss->m_cstore = clserv_create_buffer(gscan->msg.dindex,
+											   cstore_length,
+											   &rc);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+			goto error4;
+		}
+	}
+
+	/* allocation of device memory for kern_toastbuf argument, if needed */
+	if (ktoast_head)
+	{
+		clgss->m_toast = clserv_create_buffer(gscan->msg.dindex,
+											  toast_length,
+											  &rc);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+			goto error5;
+		}
+	}
+
+	/*
+	 * OK, all the device memory and kernel objects acquired.
+	 * Let's prepare kernel invocation.
+	 *
+	 * The kernel call is:
+	 *   __kernel void
+	 *   gpuscan_qual_cs(__global kern_gpuscan *gpuscan,
+	 *                   __global kern_column_store *kcs,
+	 *                   __global kern_toastbuf *toast,
+	 *                   __local void *local_workmem)
+	 *
+	 * If no varlena columns are referenced, toast buffer is never
+	 * touched, so we give the column-store instead.
+	 */
+	rc = clSetKernelArg(clgss->kernel,
+						0,	/* kern_gpuscan * */
+						sizeof(cl_mem),
+						&clgss->m_gpuscan);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error6;
+	}
+
+	rc = clSetKernelArg(clgss->kernel,
+						1,	/* kern_column_store */
+						sizeof(cl_mem),
+						&clgss->m_cstore);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error6;
+	}
+
+	rc = clSetKernelArg(clgss->kernel,
+						2,	/* kern_toastbuf */
+						sizeof(cl_mem),
+						clgss->m_toast ? &clgss->m_toast : &clgss->m_cstore);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error6;
+	}
+
+	rc = clSetKernelArg(clgss->kernel,
+						3,	/* local_workmem */
+						2 * sizeof(cl_uint) * lwork_sz,
+						NULL);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error6;
+	}
+
+	/*
+	 * OK, enqueue DMA transfer of kern_gpuscan and header portion of
+	 * the column-store first.
+	 */
+	length = KERN_GPUSCAN_DMA_SENDLEN(&gscan->kern);
+
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clgss->m_gpuscan,
+									 0,
+									 length,
+									 &gscan->kern,
+									 0,
+									 NULL,
+									 &clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
+		goto error6;
+	}
+	clgss->ev_index++;
+
+	/*
+	 * Unless column-store on the device is shared, enqueue DMA transfer
+	 * of its header portion. Once constructed, it is registered to be
+	 * shared with the later scans, if no varlena columns are referenced.
+	 */
+	if (!clgss->schunk)
+	{
+		cl_int		ev_cstore = clgss->ev_index;
+
+		length = offsetof(kern_column_store, colmeta[ncols]);
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clgss->m_cstore,
+										 0,
+										 length,
+										 kcs_head,
+										 0,
+										 NULL,
+										 &clgss->events[clgss->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clgss->ev_index++;
+
+		/*
+		 * Then, null-bitmap and values array of the referenced columns
+		 */
+		for (i=0; i < ncols; i++)
+		{
+			kern_colmeta   *ccmeta = &kcs_head->colmeta[i];
+			cl_uint			cindex = gscan->cs_cindex[i];
+			size_t			offset = ccmeta->cs_ofs;
+
+			if ((ccmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
+			{
+				Assert(tcs->cdata[cindex].isnull != NULL);
+				rc = clserv_enqueue_write_buffer(kcmdq_send,
+												 clgss->m_cstore,
+												 offset,
+												 (nrows + 7) / 8,
+												 tcs->cdata[cindex].isnull,
+												 0,
+												 NULL,
+												 &clgss->events[clgss->ev_index]);
+				if (rc != CL_SUCCESS)
+				{
+					elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+						 opencl_strerror(rc));
+					goto error_sync;
+				}
+				clgss->ev_index++;
+				offset += STROMALIGN((nrows + 7) / 8);
+			}
+
+			if ((ccmeta->flags & KERN_COLMETA_ATTENCODED) != 0)
+				length = tcs->cdata[cindex].enc_length;
+			else
+				length = nrows * (ccmeta->attlen > 0
+								  ? ccmeta->attlen
+								  : sizeof(cl_uint));
+			rc = clserv_enqueue_write_buffer(kcmdq_send,
+											 clgss->m_cstore,
+											 offset,
+											 length,
+											 tcs->cdata[cindex].values,
+											 0,
+											 NULL,
+											 &clgss->events[clgss->ev_index]);
+			if (rc != CL_SUCCESS)
+			{
+				elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+					 opencl_strerror(rc));
+				goto error_sync;
+			}
+			clgss->ev_index++;
+		}
+
+		if (!ktoast_head)
+			clgss->schunk =
+				clserv_register_shared_chunk(gscan,
+											 clgss->m_cstore,
+											 cstore_length,
+											 clgss->events + ev_cstore,
+											 clgss->ev_index - ev_cstore);
+	}
+
+	/*
+	 * Last, toast buffers of the referenced varlena columns
+	 */
+	if (ktoast_head)
+	{
+		length = offsetof(kern_toastbuf, coldir[ncols]);
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clgss->m_toast,
+										 0,
+										 length,
+										 ktoast_head,
+										 0,
+										 NULL,
+										 &clgss->events[clgss->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clgss->ev_index++;
+
+		for (i=0; i < ncols; i++)
+		{
+			tcache_toastbuf *tbuf = tcs->cdata[gscan->cs_cindex[i]].toast;
+
+			if (ktoast_head->coldir[i] == 0)
+				continue;
+
+			rc = clserv_enqueue_write_buffer(kcmdq_send,
+											 clgss->m_toast,
+											 ktoast_head->coldir[i],
+											 tbuf->tbuf_usage,
+											 tbuf,
+											 0,
+											 NULL,
+											 &clgss->events[clgss->ev_index]);
+			if (rc != CL_SUCCESS)
+			{
+				elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+					 opencl_strerror(rc));
+				goto error_sync;
+			}
+			clgss->ev_index++;
+		}
+	}
+
+	/*
+	 * Kick gpuscan_qual_cs() call, then write back the result
 	 */
+	gwork_sz = ((nthreads + lwork_sz - 1) / lwork_sz) * lwork_sz;
+
+	rc = clserv_launch_gpuscan(clgss, kcmdq, kcmdq_recv,
+							   gwork_sz, lwork_sz);
+	if (rc != CL_SUCCESS)
+		goto error_sync;
+	Assert(clgss->ev_index <= 6 + 5 * ncols);
+	return;
+
+error_sync:
+	/* see comments in clserv_process_gpuscan_row */
 	clWaitForEvents(clgss->ev_index, clgss->events);
+	while (clgss->ev_index > 0)
+		clReleaseEvent(clgss->events[--clgss->ev_index]);
 error6:
-	clReleaseMemObject(clgss->m_cstore);
+	if (clgss->m_toast)
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_toast);
 error5:
-	clReleaseMemObject(clgss->m_rstore);
+	if (clgss->schunk)
+	{
+		/* events of DMA send by another scan, if not released yet */
+		while (clgss->ev_index > 0)
+			clReleaseEvent(clgss->events[--clgss->ev_index]);
+		clserv_put_shared_chunk(clgss->schunk);
+	}
+	else
+		clserv_release_buffer(gscan->msg.dindex, clgss->m_cstore);
 error4:
-	clReleaseMemObject(clgss->m_gpuscan);
+	clserv_release_buffer(gscan->msg.dindex, clgss->m_gpuscan);
 error3:
+	pgstrom_opencl_device_complete(&gscan->msg, clgss->dma_length, 0, 0);
 	clReleaseKernel(clgss->kernel);
 error2:
 	clReleaseProgram(clgss->program);
@@ -1657,19 +3749,41 @@ error0:
 }
 
 /*
- * clserv_put_gpuscan_row
+ * clserv_process_gpuscan
+ *
+ * entrypoint of the gpuscan message; it calls a proper handler according
+ * to the class of data store being attached.
+ */
+static void
+clserv_process_gpuscan(pgstrom_message *msg)
+{
+	pgstrom_gpuscan	   *gscan = (pgstrom_gpuscan *)msg;
+
+	if (*gscan->rc_store == StromTag_RowStore)
+		clserv_process_gpuscan_row(gscan);
+	else if (*gscan->rc_store == StromTag_TCacheColumnStore)
+		clserv_process_gpuscan_column(gscan);
+	else
+	{
+		elog(LOG, "unexpected data store (stag: %d)", (int)*gscan->rc_store);
+		gscan->msg.errcode = StromError_BadRequestMessage;
+		pgstrom_reply_message(&gscan->msg);
+	}
+}
+
+/*
+ * clserv_put_gpuscan
  *
  * Callback handler when reference counter of pgstrom_gpuscan object
  * reached to zero, due to pgstrom_put_message.
- * It also unlinks associated device program and release row-store.
- * Also note that this routine can be called under the OpenCL server
- * context.
+ * It also unlinks associated device program and release row- or column-
+ * store. Also note that this routine can be called under the OpenCL
+ * server context.
  */
 static void
-clserv_put_gpuscan_row(pgstrom_message *msg)
+clserv_put_gpuscan(pgstrom_message *msg)
 {
 	pgstrom_gpuscan	   *gscan = (pgstrom_gpuscan *)msg;
-	dlist_mutable_iter	iter;
 
 	/* unlink message queue */
 	pgstrom_put_queue(msg->respq);
@@ -1677,13 +3791,12 @@ clserv_put_gpuscan_row(pgstrom_message *msg)
 	/* unlink device program */
 	pgstrom_put_devprog_key(gscan->dprog_key);
 
-	/* release row-store */
-	dlist_foreach_modify(iter, &gscan->rc_store)
-	{
-		pgstrom_row_store  *rstore
-			= dlist_container(pgstrom_row_store, chain, iter.cur);
-		Assert(rstore->stag == StromTag_RowStore);
-		pgstrom_shmem_free(rstore);
-	}
+	/* release row- or column- store */
+	gpuscan_release_store(gscan->rc_store);
+
+	/* release results of projection, if any */
+	if (gscan->kproj)
+		pgstrom_shmem_free(gscan->kproj);
+
 	pgstrom_shmem_free(gscan);
 }
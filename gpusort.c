@@ -0,0 +1,1915 @@
+/*
+ * gpusort.c
+ *
+ * Sort acceleration by GPU processors
+ * ----
+ * Copyright 2011-2014 (C) KaiGai Kohei <kaigai@kaigai.gr.jp>
+ * Copyright 2014 (C) The PG-Strom Development Team
+ *
+ * This software is an extension of PostgreSQL; You can use, copy,
+ * modify or distribute it under the terms of 'LICENSE' included
+ * within this package.
+ */
+#include "postgres.h"
+#include "access/nbtree.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "lib/binaryheap.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/plannodes.h"
+#include "optimizer/cost.h"
+#include "optimizer/planner.h"
+#include "optimizer/tlist.h"
+#include "parser/parsetree.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/sortsupport.h"
+#include "utils/tuplestore.h"
+#include <math.h>
+#include "pg_strom.h"
+#include "opencl_gpusort.h"
+
+static planner_hook_type	planner_hook_next;
+static CustomPlanMethods	gpusort_plan_methods;
+static bool					enable_gpusort;
+
+/*
+ * GpuSortPlan replaces a Sort node being already constructed, so it has
+ * same sort-key definition with Sort node; referencing the target-list of
+ * the outer plan by sortColIdx.
+ */
+typedef struct {
+	CustomPlan	cplan;
+	const char *kern_source;	/* source of opencl kernel */
+	int			extra_flags;	/* extra libraries to be included */
+	int			numCols;		/* number of sort-key columns */
+	AttrNumber *sortColIdx;		/* their indexes in the target list */
+	Oid		   *sortOperators;	/* OIDs of operators to sort them by */
+	Oid		   *collations;		/* OIDs of collations */
+	bool	   *nullsFirst;		/* NULLS FIRST/LAST directions */
+	Bitmapset  *sortkey_attnums;/* outer attnums referenced in device */
+} GpuSortPlan;
+
+/*
+ * Source of the final merge stage; either a chunk being sorted by device
+ * or a sorted run being spilled out to tuplestore.
+ */
+typedef struct {
+	pgstrom_gpusort	   *chunk;	/* chunk sorted by device, or NULL */
+	cl_uint				index;	/* next index on the chunk results */
+	Tuplestorestate	   *tstore;	/* sorted run, or NULL */
+	TupleTableSlot	   *slot;	/* current tuple of this source */
+} gpusort_source;
+
+/*
+ * GpuSort loads the outer relation into row-stores, then each of them is
+ * sorted by device as a chunk. The sorted chunks are merged on the host
+ * side using binary heap, in the same manner as MergeAppend doing.
+ * If the sorted chunks being kept occupies too much shared memory, they
+ * are merged into a sorted run being spilled out to tuplestore, to
+ * release the shared memory; then the final merge stage handles both of
+ * the chunks and the runs.
+ */
+typedef struct {
+	CustomPlanState		cps;
+	SortSupport			sortkeys;	/* array of length numCols */
+	HeapTuple			outer_overflow;	/* tuple not fit previous chunk */
+	bool				outer_done;	/* no more outer tuples to be loaded */
+
+	pgstrom_queue	   *mqueue;
+	Datum				dprog_key;
+
+	kern_parambuf	   *kparambuf;
+	kern_colmeta	   *rs_colmeta;
+	kern_colmeta	   *cs_colmeta;
+	int					cs_colnums;
+
+	int					num_running;	/* number of chunks in-flight */
+	dlist_head			sorted_chunks;	/* chunks already sorted */
+	Size				sorted_usage;	/* shmem usage by sorted_chunks */
+	List			   *sorted_runs;	/* list of Tuplestorestate */
+	int					num_chunks;		/* statistics */
+	int					num_runs;		/* statistics */
+
+	bool				sort_done;
+	int					num_sources;
+	gpusort_source	   *sources;
+	binaryheap		   *heap;
+	bool				heap_advance;	/* need to advance the top source */
+
+	pgstrom_perfmon		pfm;	/* sum of performance counter */
+} GpuSortState;
+
+/* static functions */
+static void clserv_process_gpusort(pgstrom_message *msg);
+static void clserv_put_gpusort(pgstrom_message *msg);
+
+/*
+ * gpusort_key_type_supported
+ *
+ * Device compares the sort keys with native operators, so only data types
+ * whose btree ordering is identical to the ordering of the base type are
+ * supported.
+ */
+static bool
+gpusort_key_type_supported(Oid type_oid)
+{
+	switch (type_oid)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+		case DATEOID:
+#ifdef HAVE_INT64_TIMESTAMP
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+#endif
+			return true;
+		default:
+			break;
+	}
+	return false;
+}
+
+/*
+ * gpusort_sortop_direction
+ *
+ * It checks whether the supplied sort operator is "<" or ">" of the default
+ * btree operator class of the key type. It returns 1 for ascending order,
+ * -1 for descending order, or 0 if not supported.
+ */
+static int
+gpusort_sortop_direction(Oid sortop, Oid type_oid)
+{
+	Oid			opfamily;
+	Oid			opcintype;
+	Oid			opclass;
+	int16		strategy;
+
+	if (!get_ordering_op_properties(sortop, &opfamily, &opcintype, &strategy))
+		return 0;
+	if (opcintype != type_oid)
+		return 0;
+	opclass = GetDefaultOpClass(type_oid, BTREE_AM_OID);
+	if (!OidIsValid(opclass) || get_opclass_family(opclass) != opfamily)
+		return 0;
+	if (strategy == BTLessStrategyNumber)
+		return 1;
+	if (strategy == BTGreaterStrategyNumber)
+		return -1;
+	return 0;
+}
+
+/*
+ * cost_gpusort
+ *
+ * cost estimation for GpuSort; to be compared with the cost of Sort node
+ * being replaced.
+ */
+static void
+cost_gpusort(Plan *outer_plan, Cost *p_startup_cost, Cost *p_total_cost)
+{
+	double		ntuples = Max(outer_plan->plan_rows, 2.0);
+	Size		tuple_len;
+	double		chunk_rows;
+	double		nchunks;
+	double		nsteps;
+	Cost		startup_cost;
+	Cost		run_cost;
+	Cost		comparison_cost = 2.0 * cpu_operator_cost;
+	Cost		setup_cost;
+	Cost		dev_op_cost;
+	Cost		dma_per_byte;
+
+	/* cost to run the outer plan */
+	startup_cost = outer_plan->total_cost;
+
+	/* cost to load the outer tuples to row-stores */
+	tuple_len = (sizeof(cl_uint) + HEAPTUPLESIZE +
+				 MAXALIGN(SizeofHeapTupleHeader) +
+				 MAXALIGN(outer_plan->plan_width));
+	chunk_rows = Max((double) ROWSTORE_DEFAULT_SIZE / (double) tuple_len, 1.0);
+	nchunks = ceil(ntuples / chunk_rows);
+	startup_cost += cpu_tuple_cost * ntuples;
+
+	/*
+	 * Device costs, in the same scale as cost_gpuscan. Device sorts each
+	 * chunk by bitonic sorting network, that takes (log2 N)^2 steps of
+	 * comparison; two operators per comparison as host side. Each chunk
+	 * is sent to the device, then an index array is written back.
+	 */
+	pgstrom_device_costs(&setup_cost, &dev_op_cost, &dma_per_byte);
+	nsteps = LOG2(Min(chunk_rows, ntuples));
+	startup_cost += setup_cost;
+	startup_cost += 2.0 * dev_op_cost * ntuples * nsteps * nsteps;
+	startup_cost += dma_per_byte * (tuple_len + sizeof(cl_uint)) * ntuples;
+
+	/* cost to merge the sorted chunks on the host */
+	if (nchunks > 1.0)
+		startup_cost += comparison_cost * ntuples * LOG2(nchunks);
+
+	/* cost to fetch the merged tuples */
+	run_cost = cpu_operator_cost * ntuples;
+
+	*p_startup_cost = startup_cost;
+	*p_total_cost = startup_cost + run_cost;
+}
+
+/*
+ * gpusort_codegen_comparison
+ *
+ * It constructs a comparison function of the sort keys. Sort keys are
+ * translated to the column-store in order of attribute number, so the
+ * column index of a sort key is its rank in 'sortkey_attnums'.
+ */
+static char *
+gpusort_codegen_comparison(Sort *sort, Bitmapset *sortkey_attnums,
+						   codegen_context *context)
+{
+	StringInfoData	str;
+	StringInfoData	decl;
+	StringInfoData	body;
+	Plan		   *outer_plan = outerPlan(sort);
+	int				i;
+
+	memset(context, 0, sizeof(codegen_context));
+	initStringInfo(&str);
+	initStringInfo(&decl);
+	initStringInfo(&body);
+
+	for (i=0; i < sort->numCols; i++)
+	{
+		TargetEntry	   *tle;
+		devtype_info   *dtype;
+		AttrNumber		anum = sort->sortColIdx[i];
+		Oid				type_oid;
+		int				colidx = 0;
+		int				x;
+		Bitmapset	   *tempset;
+		bool			is_float;
+		bool			is_desc;
+
+		tle = get_tle_by_resno(outer_plan->targetlist, anum);
+		if (!tle)
+			elog(ERROR, "could not find sort key %d in the target list", anum);
+		type_oid = exprType((Node *) tle->expr);
+		dtype = pgstrom_devtype_lookup(type_oid);
+		Assert(dtype != NULL);
+		context->type_defs = list_append_unique_ptr(context->type_defs,
+													dtype);
+		/* column index on the kern_column_store */
+		tempset = bms_copy(sortkey_attnums);
+		while ((x = bms_first_member(tempset)) >= 0 && x < anum)
+			colidx++;
+		bms_free(tempset);
+
+		is_float = (type_oid == FLOAT4OID || type_oid == FLOAT8OID);
+		is_desc = (gpusort_sortop_direction(sort->sortOperators[i],
+											type_oid) < 0);
+
+		appendStringInfo(&decl,
+						 "  pg_%s_t xkeyval%d;\n"
+						 "  pg_%s_t ykeyval%d;\n",
+						 dtype->type_name, i,
+						 dtype->type_name, i);
+		appendStringInfo(
+			&body,
+			"  xkeyval%d = pg_%s_vref(kcs,%d,x_index);\n"
+			"  ykeyval%d = pg_%s_vref(kcs,%d,y_index);\n"
+			"  if (!xkeyval%d.isnull && !ykeyval%d.isnull)\n"
+			"  {\n"
+			"    comp = %s(xkeyval%d.value, ykeyval%d.value);\n"
+			"    if (comp != 0)\n"
+			"      return %scomp;\n"
+			"  }\n"
+			"  else if (xkeyval%d.isnull && !ykeyval%d.isnull)\n"
+			"    return %d;\n"
+			"  else if (!xkeyval%d.isnull && ykeyval%d.isnull)\n"
+			"    return %d;\n",
+			i, dtype->type_name, colidx,
+			i, dtype->type_name, colidx,
+			i, i,
+			is_float ? "GPUSORT_COMPARE_FLOAT" : "GPUSORT_COMPARE_SIMPLE",
+			i, i,
+			is_desc ? "-" : "",
+			i, i, sort->nullsFirst[i] ? -1 : 1,
+			i, i, sort->nullsFirst[i] ? 1 : -1);
+	}
+
+	/*
+	 * Put declarations of device types
+	 */
+	appendStringInfo(&str, "%s\n", pgstrom_codegen_declarations(context));
+
+	appendStringInfo(&str,
+					 "static cl_int\n"
+					 "gpusort_comp(__global kern_column_store *kcs,\n"
+					 "             cl_int x_index,\n"
+					 "             cl_int y_index)\n"
+					 "{\n"
+					 "%s"
+					 "  cl_int comp;\n"
+					 "\n"
+					 "%s"
+					 "  return 0;\n"
+					 "}\n",
+					 decl.data, body.data);
+	pfree(decl.data);
+	pfree(body.data);
+
+	return str.data;
+}
+
+/*
+ * gpusort_try_replace
+ *
+ * It tries to replace the supplied Sort node by GpuSort, if all the sort
+ * keys are supported by device and its cost is expected to be cheaper.
+ */
+static Plan *
+gpusort_try_replace(Sort *sort)
+{
+	GpuSortPlan	   *gsplan;
+	Plan		   *outer_plan = outerPlan(sort);
+	Bitmapset	   *sortkey_attnums = NULL;
+	codegen_context	context;
+	Cost			startup_cost;
+	Cost			total_cost;
+	int				i;
+
+	/* check whether all the sort keys are supported */
+	for (i=0; i < sort->numCols; i++)
+	{
+		TargetEntry	   *tle;
+		Oid				type_oid;
+
+		tle = get_tle_by_resno(outer_plan->targetlist, sort->sortColIdx[i]);
+		if (!tle)
+			return &sort->plan;
+		type_oid = exprType((Node *) tle->expr);
+		if (!gpusort_key_type_supported(type_oid) ||
+			!pgstrom_devtype_lookup(type_oid) ||
+			gpusort_sortop_direction(sort->sortOperators[i], type_oid) == 0)
+			return &sort->plan;
+		sortkey_attnums = bms_add_member(sortkey_attnums,
+										 sort->sortColIdx[i]);
+	}
+
+	/* is GpuSort cheaper than the Sort? */
+	cost_gpusort(outer_plan, &startup_cost, &total_cost);
+	if (!enable_gpusort)
+	{
+		startup_cost += disable_cost;
+		total_cost += disable_cost;
+	}
+	if (total_cost >= sort->plan.total_cost)
+		return &sort->plan;
+
+	/*
+	 * OK, construction of GpuSortPlan node; on top of CustomPlan node
+	 */
+	gsplan = palloc0(sizeof(GpuSortPlan));
+	memcpy(&gsplan->cplan.plan, &sort->plan, sizeof(Plan));
+	gsplan->cplan.plan.type = T_CustomPlan;
+	gsplan->cplan.plan.startup_cost = startup_cost;
+	gsplan->cplan.plan.total_cost = total_cost;
+	gsplan->cplan.methods = &gpusort_plan_methods;
+
+	gsplan->kern_source = gpusort_codegen_comparison(sort, sortkey_attnums,
+													 &context);
+	gsplan->extra_flags = context.extra_flags | DEVKERNEL_NEEDS_GPUSORT;
+	gsplan->numCols = sort->numCols;
+	gsplan->sortColIdx = sort->sortColIdx;
+	gsplan->sortOperators = sort->sortOperators;
+	gsplan->collations = sort->collations;
+	gsplan->nullsFirst = sort->nullsFirst;
+	gsplan->sortkey_attnums = sortkey_attnums;
+
+	return &gsplan->cplan.plan;
+}
+
+/*
+ * gpusort_replace_plan
+ *
+ * It walks on the plan tree, then replaces Sort nodes by GpuSort if
+ * possible. GpuSort does not support backward scan and mark/restore,
+ * so we don't touch Sort nodes being the inner side of MergeJoin.
+ */
+static Plan *
+gpusort_replace_plan(Plan *plan, bool mark_required)
+{
+	ListCell   *cell;
+
+	if (!plan)
+		return NULL;
+
+	switch (nodeTag(plan))
+	{
+		case T_MergeJoin:
+			plan->lefttree = gpusort_replace_plan(plan->lefttree, false);
+			plan->righttree = gpusort_replace_plan(plan->righttree, true);
+			return plan;
+
+		case T_Append:
+			foreach (cell, ((Append *) plan)->appendplans)
+				lfirst(cell) = gpusort_replace_plan(lfirst(cell), false);
+			break;
+
+		case T_MergeAppend:
+			foreach (cell, ((MergeAppend *) plan)->mergeplans)
+				lfirst(cell) = gpusort_replace_plan(lfirst(cell), false);
+			break;
+
+		case T_ModifyTable:
+			foreach (cell, ((ModifyTable *) plan)->plans)
+				lfirst(cell) = gpusort_replace_plan(lfirst(cell), false);
+			break;
+
+		case T_SubqueryScan:
+			((SubqueryScan *) plan)->subplan
+				= gpusort_replace_plan(((SubqueryScan *) plan)->subplan,
+									   false);
+			break;
+
+		case T_Material:
+			/* Material node needs no mark/restore support of child */
+			mark_required = false;
+			break;
+
+		default:
+			break;
+	}
+	plan->lefttree = gpusort_replace_plan(plan->lefttree, false);
+	plan->righttree = gpusort_replace_plan(plan->righttree, false);
+
+	if (IsA(plan, Sort) && !mark_required)
+		return gpusort_try_replace((Sort *) plan);
+
+	return plan;
+}
+
+static PlannedStmt *
+gpusort_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
+{
+	PlannedStmt	   *result;
+	ListCell	   *cell;
+
+	if (planner_hook_next)
+		result = planner_hook_next(parse, cursorOptions, boundParams);
+	else
+		result = standard_planner(parse, cursorOptions, boundParams);
+
+	/*
+	 * Scrollable cursor needs backward scan support of the top-level
+	 * plan, but GpuSort does not support it.
+	 */
+	if (!pgstrom_enabled || (cursorOptions & CURSOR_OPT_SCROLL) != 0)
+		return result;
+
+	result->planTree = gpusort_replace_plan(result->planTree, false);
+	foreach (cell, result->subplans)
+		lfirst(cell) = gpusort_replace_plan(lfirst(cell), false);
+
+	return result;
+}
+
+static void
+gpusort_set_plan_ref(PlannerInfo *root,
+					 CustomPlan *custom_plan,
+					 int rtoffset)
+{
+	/*
+	 * GpuSort is constructed after set_plan_references(), so nothing to
+	 * do here.
+	 */
+}
+
+static void
+gpusort_finalize_plan(PlannerInfo *root,
+					  CustomPlan *custom_plan,
+					  Bitmapset **paramids,
+					  Bitmapset **valid_params,
+					  Bitmapset **scan_params)
+{
+	/* nothing to do */
+}
+
+static CustomPlanState *
+gpusort_begin(CustomPlan *node, EState *estate, int eflags)
+{
+	GpuSortPlan	   *gsplan = (GpuSortPlan *) node;
+	GpuSortState   *gss;
+	TupleDesc		tupdesc;
+	AttrNumber		anum;
+	int				i;
+
+	/* check for unsupported flags */
+	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
+
+	/*
+	 * create a state structure
+	 */
+	gss = palloc0(sizeof(GpuSortState));
+	gss->cps.ps.type = T_CustomPlanState;
+	gss->cps.ps.plan = (Plan *) node;
+	gss->cps.ps.state = estate;
+	gss->cps.methods = &gpusort_plan_methods;
+
+	/*
+	 * create expression context
+	 */
+	ExecAssignExprContext(estate, &gss->cps.ps);
+
+	/*
+	 * initialize child nodes
+	 */
+	outerPlanState(gss) = ExecInitNode(outerPlan(node), estate, eflags);
+
+	/*
+	 * tuple table initialization; GpuSort does not project, so tuples
+	 * are returned on the slot of sources
+	 */
+	ExecInitResultTupleSlot(estate, &gss->cps.ps);
+	ExecAssignResultTypeFromTL(&gss->cps.ps);
+	gss->cps.ps.ps_ProjInfo = NULL;
+
+	/*
+	 * initialize sort keys to merge the sorted chunks
+	 */
+	gss->sortkeys = palloc0(sizeof(SortSupportData) * gsplan->numCols);
+	for (i=0; i < gsplan->numCols; i++)
+	{
+		SortSupport	sortKey = gss->sortkeys + i;
+
+		sortKey->ssup_cxt = CurrentMemoryContext;
+		sortKey->ssup_collation = gsplan->collations[i];
+		sortKey->ssup_nulls_first = gsplan->nullsFirst[i];
+		sortKey->ssup_attno = gsplan->sortColIdx[i];
+
+		PrepareSortSupportFromOrderingOp(gsplan->sortOperators[i], sortKey);
+	}
+
+	/*
+	 * OK, initialization of common part is over.
+	 * Let's have GPU stuff initialization
+	 */
+	gss->outer_overflow = NULL;
+	gss->outer_done = false;
+	gss->mqueue = pgstrom_create_queue();
+	pgstrom_track_object(&gss->mqueue->stag);
+
+	gss->kparambuf = pgstrom_create_kern_parambuf(NIL,
+												gss->cps.ps.ps_ExprContext);
+	gss->dprog_key = pgstrom_get_devprog_key(gsplan->kern_source,
+											 gsplan->extra_flags);
+	pgstrom_track_object((StromTag *)gss->dprog_key);
+
+	/*
+	 * Column metadata of the outer row-store; only sort keys are
+	 * translated to the column-store on the device.
+	 */
+	tupdesc = ExecGetResultType(outerPlanState(gss));
+	gss->rs_colmeta = palloc(sizeof(kern_colmeta) * tupdesc->natts);
+	gss->cs_colmeta = palloc(sizeof(kern_colmeta) * tupdesc->natts);
+	gss->cs_colnums = 0;
+	for (anum=0; anum < tupdesc->natts; anum++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[anum];
+		kern_colmeta   *colmeta = &gss->rs_colmeta[anum];
+
+		colmeta->flags = 0;
+		if (attr->attnotnull)
+			colmeta->flags |= KERN_COLMETA_ATTNOTNULL;
+		if (bms_is_member(anum + 1, gsplan->sortkey_attnums))
+			colmeta->flags |= KERN_COLMETA_ATTREFERENCED;
+
+		if (attr->attalign == 'c')
+			colmeta->attalign = sizeof(cl_char);
+		else if (attr->attalign == 's')
+			colmeta->attalign = sizeof(cl_short);
+		else if (attr->attalign == 'i')
+			colmeta->attalign = sizeof(cl_int);
+		else if (attr->attalign == 'd')
+			colmeta->attalign = sizeof(cl_long);
+		else
+			elog(ERROR, "unexpected attribute alignment: %c", attr->attalign);
+		colmeta->attlen = attr->attlen;
+		colmeta->cs_ofs = -1;	/* to be calculated for each row_store */
+
+		if ((colmeta->flags & KERN_COLMETA_ATTREFERENCED) != 0)
+			memcpy(&gss->cs_colmeta[gss->cs_colnums++],
+				   colmeta, sizeof(kern_colmeta));
+	}
+
+	gss->num_running = 0;
+	dlist_init(&gss->sorted_chunks);
+	gss->sorted_usage = 0;
+	gss->sorted_runs = NIL;
+	gss->num_chunks = 0;
+	gss->num_runs = 0;
+
+	gss->sort_done = false;
+	gss->num_sources = 0;
+	gss->sources = NULL;
+	gss->heap = NULL;
+	gss->heap_advance = false;
+
+	/* Is perfmon needed? */
+	gss->pfm.enabled = pgstrom_perfmon_enabled;
+
+	return &gss->cps;
+}
+
+/*
+ * pgstrom_create_gpusort
+ *
+ * It constructs a pgstrom_gpusort message towards the supplied row-store.
+ * The result buffer has 2^N rooms being equal or larger than nrows.
+ */
+static pgstrom_gpusort *
+pgstrom_create_gpusort(GpuSortState *gss, pgstrom_row_store *rstore)
+{
+	pgstrom_gpusort	   *gsort;
+	kern_parambuf	   *kparam;
+	kern_resultbuf	   *kresult;
+	cl_uint				nrooms = 2 * PGSTROM_WORKGROUP_UNITSZ;
+	Size				length;
+
+	while (nrooms < rstore->kern.nrows)
+		nrooms <<= 1;
+
+	length = (STROMALIGN(offsetof(pgstrom_gpusort, kern.kparam)) +
+			  STROMALIGN(gss->kparambuf->length) +
+			  STROMALIGN(offsetof(kern_resultbuf, results[nrooms])));
+	gsort = pgstrom_shmem_alloc(length);
+	if (!gsort)
+	{
+		pgstrom_shmem_free(rstore);
+		elog(ERROR, "out of shared memory");
+	}
+	/* Fields of pgstrom_gpusort */
+	memset(gsort, 0, sizeof(pgstrom_gpusort));
+	gsort->msg.stag = StromTag_GpuSort;
+	SpinLockInit(&gsort->msg.lock);
+	gsort->msg.refcnt = 1;
+	gsort->msg.respq = pgstrom_get_queue(gss->mqueue);
+	gsort->msg.cb_process = clserv_process_gpusort;
+	gsort->msg.cb_release = clserv_put_gpusort;
+	gsort->msg.dindex = -1;
+	gsort->msg.pfm.enabled = gss->pfm.enabled;
+	gsort->dprog_key = pgstrom_retain_devprog_key(gss->dprog_key);
+	gsort->rstore = rstore;
+
+	/* kern_parambuf */
+	kparam = &gsort->kern.kparam;
+	memcpy(kparam, gss->kparambuf, gss->kparambuf->length);
+	Assert(gss->kparambuf->length == STROMALIGN(gss->kparambuf->length));
+
+	/* kern_resultbuf portion */
+	kresult = KERN_GPUSORT_RESULTBUF(&gsort->kern);
+	kresult->nrooms = nrooms;
+	kresult->nitems = rstore->kern.nrows;
+	kresult->debug_nums = 0;
+	kresult->debug_usage = KERN_DEBUG_UNAVAILABLE;
+	kresult->errcode = 0;
+	kresult->flags = 0;
+
+	Assert(pgstrom_shmem_sanitycheck(gsort));
+
+	/* track local object */
+	pgstrom_track_object(&gsort->msg.stag);
+
+	return gsort;
+}
+
+static pgstrom_gpusort *
+pgstrom_load_gpusort(GpuSortState *gss)
+{
+	pgstrom_gpusort	   *gsort;
+	pgstrom_row_store  *rstore;
+	bool		scan_done;
+	struct timeval tv1, tv2;
+
+	if (gss->pfm.enabled)
+		gettimeofday(&tv1, NULL);
+	rstore = pgstrom_load_row_store_subplan(outerPlanState(gss),
+											&gss->outer_overflow,
+											gss->rs_colmeta,
+											gss->cs_colmeta,
+											gss->cs_colnums,
+											&scan_done);
+	if (scan_done)
+		gss->outer_done = true;
+	if (!rstore)
+		return NULL;
+	if (gss->pfm.enabled)
+		gettimeofday(&tv2, NULL);
+
+	gsort = pgstrom_create_gpusort(gss, rstore);
+	if (gsort->msg.pfm.enabled)
+		gsort->msg.pfm.time_to_load += timeval_diff(&tv1, &tv2);
+
+	return gsort;
+}
+
+static Size
+gpusort_chunk_usage(pgstrom_gpusort *gsort)
+{
+	return (offsetof(pgstrom_gpusort, kern) +
+			KERN_GPUSORT_LENGTH(&gsort->kern) +
+			ROWSTORE_DEFAULT_SIZE);
+}
+
+static void
+gpusort_release_chunk(GpuSortState *gss, pgstrom_gpusort *gsort)
+{
+	if (gsort->msg.pfm.enabled)
+	{
+		pgstrom_perfmon_add(&gss->pfm, &gsort->msg.pfm);
+		pgstrom_perfmon_stat(&gsort->msg);
+	}
+	Assert(gsort->msg.refcnt == 1);
+	pgstrom_untrack_object(&gsort->msg.stag);
+	gsort->msg.cb_release(&gsort->msg);
+}
+
+/*
+ * gpusort_check_error
+ *
+ * It raises an error, if chunk-level error was reported.
+ */
+static void
+gpusort_check_error(GpuSortState *gss, pgstrom_gpusort *gsort)
+{
+	if (gsort->msg.errcode == StromError_Success)
+		return;
+
+	if (gsort->msg.errcode == CL_BUILD_PROGRAM_FAILURE)
+	{
+		const char *buildlog
+			= pgstrom_get_devprog_errmsg(gsort->dprog_key);
+		const char *kern_source
+			= ((GpuSortPlan *)gss->cps.ps.plan)->kern_source;
+
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("PG-Strom: OpenCL execution error (%s)\n%s",
+						pgstrom_strerror(gsort->msg.errcode),
+						kern_source),
+				 errdetail("%s", buildlog)));
+	}
+	else
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("PG-Strom: OpenCL execution error (%s)",
+						pgstrom_strerror(gsort->msg.errcode))));
+	}
+}
+
+/*
+ * Routines to merge the sorted sources, using binary heap; copied from
+ * nodeMergeAppend.c but sources are either sorted chunks or runs.
+ */
+static bool
+gpusort_source_fetch(gpusort_source *source)
+{
+	if (source->chunk)
+	{
+		pgstrom_gpusort	   *gsort = source->chunk;
+		kern_resultbuf	   *kresult = KERN_GPUSORT_RESULTBUF(&gsort->kern);
+		rs_tuple		   *rs_tup;
+
+		if (source->index >= kresult->nitems)
+		{
+			ExecClearTuple(source->slot);
+			return false;
+		}
+		rs_tup = kern_rowstore_get_tuple(&gsort->rstore->kern,
+										 kresult->results[source->index++]);
+		Assert(rs_tup != NULL);
+		ExecStoreTuple(&rs_tup->htup, source->slot, InvalidBuffer, false);
+		return true;
+	}
+	return tuplestore_gettupleslot(source->tstore, true, false, source->slot);
+}
+
+static int32
+gpusort_heap_compare(Datum a, Datum b, void *arg)
+{
+	GpuSortState   *gss = (GpuSortState *) arg;
+	GpuSortPlan	   *gsplan = (GpuSortPlan *) gss->cps.ps.plan;
+	TupleTableSlot *s1 = gss->sources[DatumGetInt32(a)].slot;
+	TupleTableSlot *s2 = gss->sources[DatumGetInt32(b)].slot;
+	int				i;
+
+	Assert(!TupIsNull(s1));
+	Assert(!TupIsNull(s2));
+
+	for (i=0; i < gsplan->numCols; i++)
+	{
+		SortSupport	sortKey = gss->sortkeys + i;
+		AttrNumber	attno = sortKey->ssup_attno;
+		Datum		datum1,
+					datum2;
+		bool		isNull1,
+					isNull2;
+		int			compare;
+
+		datum1 = slot_getattr(s1, attno, &isNull1);
+		datum2 = slot_getattr(s2, attno, &isNull2);
+
+		compare = ApplySortComparator(datum1, isNull1,
+									  datum2, isNull2,
+									  sortKey);
+		if (compare != 0)
+			return -compare;
+	}
+	return 0;
+}
+
+/*
+ * gpusort_merge_begin
+ *
+ * It sets up sources of the merge stage with the sorted chunks and runs
+ * being kept.
+ */
+static void
+gpusort_merge_begin(GpuSortState *gss, bool with_runs)
+{
+	TupleDesc		tupdesc = ExecGetResultType(outerPlanState(gss));
+	MemoryContext	oldcxt;
+	dlist_mutable_iter iter;
+	ListCell	   *cell;
+	int				i = 0;
+
+	oldcxt = MemoryContextSwitchTo(gss->cps.ps.state->es_query_cxt);
+	gss->num_sources = 0;
+	dlist_foreach_modify(iter, &gss->sorted_chunks)
+		gss->num_sources++;
+	if (with_runs)
+		gss->num_sources += list_length(gss->sorted_runs);
+
+	gss->sources = palloc0(sizeof(gpusort_source) *
+						   Max(gss->num_sources, 1));
+	gss->heap = binaryheap_allocate(Max(gss->num_sources, 1),
+									gpusort_heap_compare,
+									gss);
+	dlist_foreach_modify(iter, &gss->sorted_chunks)
+	{
+		pgstrom_gpusort *gsort
+			= dlist_container(pgstrom_gpusort, msg.chain, iter.cur);
+
+		dlist_delete(&gsort->msg.chain);
+		gss->sources[i].chunk = gsort;
+		gss->sources[i].index = 0;
+		gss->sources[i].slot = MakeSingleTupleTableSlot(tupdesc);
+		i++;
+	}
+	gss->sorted_usage = 0;
+	if (with_runs)
+	{
+		foreach (cell, gss->sorted_runs)
+		{
+			gss->sources[i].tstore = lfirst(cell);
+			gss->sources[i].slot = MakeSingleTupleTableSlot(tupdesc);
+			i++;
+		}
+		list_free(gss->sorted_runs);
+		gss->sorted_runs = NIL;
+	}
+	Assert(i == gss->num_sources);
+
+	for (i=0; i < gss->num_sources; i++)
+	{
+		if (gpusort_source_fetch(&gss->sources[i]))
+			binaryheap_add_unordered(gss->heap, Int32GetDatum(i));
+	}
+	binaryheap_build(gss->heap);
+	gss->heap_advance = false;
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * gpusort_merge_next
+ *
+ * It returns the next tuple in order of sort keys, or NULL if no more
+ * tuples. The source being exhausted is released immediately.
+ */
+static TupleTableSlot *
+gpusort_merge_next(GpuSortState *gss)
+{
+	int		i;
+
+	if (gss->heap_advance)
+	{
+		i = DatumGetInt32(binaryheap_first(gss->heap));
+		if (gpusort_source_fetch(&gss->sources[i]))
+			binaryheap_replace_first(gss->heap, Int32GetDatum(i));
+		else
+		{
+			(void) binaryheap_remove_first(gss->heap);
+			if (gss->sources[i].chunk)
+			{
+				gpusort_release_chunk(gss, gss->sources[i].chunk);
+				gss->sources[i].chunk = NULL;
+			}
+			else
+			{
+				tuplestore_end(gss->sources[i].tstore);
+				gss->sources[i].tstore = NULL;
+			}
+		}
+		gss->heap_advance = false;
+	}
+	if (binaryheap_empty(gss->heap))
+		return NULL;
+
+	i = DatumGetInt32(binaryheap_first(gss->heap));
+	gss->heap_advance = true;
+	return gss->sources[i].slot;
+}
+
+static void
+gpusort_merge_end(GpuSortState *gss)
+{
+	int		i;
+
+	for (i=0; i < gss->num_sources; i++)
+	{
+		gpusort_source *source = &gss->sources[i];
+
+		if (source->chunk)
+			gpusort_release_chunk(gss, source->chunk);
+		if (source->tstore)
+			tuplestore_end(source->tstore);
+		ExecDropSingleTupleTableSlot(source->slot);
+	}
+	if (gss->sources)
+		pfree(gss->sources);
+	if (gss->heap)
+		binaryheap_free(gss->heap);
+	gss->num_sources = 0;
+	gss->sources = NULL;
+	gss->heap = NULL;
+	gss->heap_advance = false;
+}
+
+/*
+ * gpusort_spill_chunks
+ *
+ * It merges the sorted chunks being kept into a sorted run, then spills it
+ * out to tuplestore to release the shared memory occupied by the chunks.
+ */
+static void
+gpusort_spill_chunks(GpuSortState *gss)
+{
+	Tuplestorestate *tstore;
+	TupleTableSlot	*slot;
+	MemoryContext	oldcxt;
+
+	gpusort_merge_begin(gss, false);
+
+	oldcxt = MemoryContextSwitchTo(gss->cps.ps.state->es_query_cxt);
+	tstore = tuplestore_begin_heap(false, false, work_mem);
+	while ((slot = gpusort_merge_next(gss)) != NULL)
+		tuplestore_puttupleslot(tstore, slot);
+	gss->sorted_runs = lappend(gss->sorted_runs, tstore);
+	MemoryContextSwitchTo(oldcxt);
+
+	gpusort_merge_end(gss);
+	gss->num_runs++;
+}
+
+static void
+gpusort_push_sorted_chunk(GpuSortState *gss, pgstrom_message *msg)
+{
+	pgstrom_gpusort	   *gsort = (pgstrom_gpusort *) msg;
+
+	Assert(gss->num_running > 0);
+	gss->num_running--;
+	Assert(gsort->msg.stag == StromTag_GpuSort);
+	gpusort_check_error(gss, gsort);
+	dlist_push_tail(&gss->sorted_chunks, &gsort->msg.chain);
+	gss->sorted_usage += gpusort_chunk_usage(gsort);
+}
+
+/*
+ * gpusort_process_chunks
+ *
+ * It loads all the outer tuples into chunks, then sort them by device.
+ * If the sorted chunks being kept exceed the half of pgstrom.shmem_totalsize,
+ * they are spilled out as a sorted run, because shared memory segment is
+ * also consumed by other concurrent sessions.
+ */
+static void
+gpusort_process_chunks(GpuSortState *gss)
+{
+	pgstrom_gpusort	   *gsort;
+	pgstrom_message	   *msg;
+
+	while (!gss->outer_done || gss->num_running > 0)
+	{
+		/* keep chunks in-flight as much as possible */
+		while (!gss->outer_done &&
+			   gss->num_running < pgstrom_max_async_chunks)
+		{
+			gsort = pgstrom_load_gpusort(gss);
+			if (!gsort)
+				break;
+
+			if (!pgstrom_enqueue_message(&gsort->msg))
+			{
+				pgstrom_untrack_object(&gsort->msg.stag);
+				gsort->msg.cb_release(&gsort->msg);
+				elog(ERROR, "failed to enqueue pgstrom_gpusort message");
+			}
+			gss->num_running++;
+			gss->num_chunks++;
+		}
+
+		/* wait for completion of a chunk at least */
+		if (gss->num_running > 0)
+		{
+			msg = pgstrom_dequeue_message(gss->mqueue);
+			if (!msg)
+				elog(ERROR, "message queue wait timeout");
+			gpusort_push_sorted_chunk(gss, msg);
+		}
+		while ((msg = pgstrom_try_dequeue_message(gss->mqueue)) != NULL)
+			gpusort_push_sorted_chunk(gss, msg);
+
+		if (gss->sorted_usage > pgstrom_shmem_totalsize / 2)
+			gpusort_spill_chunks(gss);
+	}
+}
+
+static TupleTableSlot *
+gpusort_exec(CustomPlanState *node)
+{
+	GpuSortState   *gss = (GpuSortState *) node;
+
+	if (!gss->sort_done)
+	{
+		gpusort_process_chunks(gss);
+		gpusort_merge_begin(gss, true);
+		gss->sort_done = true;
+	}
+	return gpusort_merge_next(gss);
+}
+
+static Node *
+gpusort_exec_multi(CustomPlanState *node)
+{
+	elog(ERROR, "not implemented yet");
+}
+
+/*
+ * gpusort_release_all
+ *
+ * It releases all the chunks, runs and merge sources.
+ */
+static void
+gpusort_release_all(GpuSortState *gss)
+{
+	pgstrom_message	   *msg;
+	ListCell		   *cell;
+
+	gpusort_merge_end(gss);
+
+	while (!dlist_is_empty(&gss->sorted_chunks))
+	{
+		msg = dlist_container(pgstrom_message, chain,
+							  dlist_pop_head_node(&gss->sorted_chunks));
+		gpusort_release_chunk(gss, (pgstrom_gpusort *) msg);
+	}
+	gss->sorted_usage = 0;
+
+	while (gss->num_running > 0)
+	{
+		msg = pgstrom_dequeue_message(gss->mqueue);
+		if (!msg)
+			elog(ERROR, "message queue wait timeout");
+		gss->num_running--;
+		gpusort_release_chunk(gss, (pgstrom_gpusort *) msg);
+	}
+
+	foreach (cell, gss->sorted_runs)
+		tuplestore_end(lfirst(cell));
+	list_free(gss->sorted_runs);
+	gss->sorted_runs = NIL;
+
+	if (gss->outer_overflow)
+	{
+		heap_freetuple(gss->outer_overflow);
+		gss->outer_overflow = NULL;
+	}
+}
+
+static void
+gpusort_end(CustomPlanState *node)
+{
+	GpuSortState   *gss = (GpuSortState *) node;
+
+	/*
+	 * release chunks, runs and device program
+	 */
+	gpusort_release_all(gss);
+
+	pgstrom_put_devprog_key(gss->dprog_key);
+	pgstrom_untrack_object((StromTag *)gss->dprog_key);
+	pgstrom_untrack_object(&gss->mqueue->stag);
+	pgstrom_close_queue(gss->mqueue);
+
+	/*
+	 * Free the exprcontext
+	 */
+	ExecFreeExprContext(&gss->cps.ps);
+
+	/*
+	 * clean out the tuple table
+	 */
+	ExecClearTuple(gss->cps.ps.ps_ResultTupleSlot);
+
+	/*
+	 * clean up subtrees
+	 */
+	ExecEndNode(outerPlanState(gss));
+}
+
+static void
+gpusort_rescan(CustomPlanState *node)
+{
+	GpuSortState   *gss = (GpuSortState *) node;
+
+	/*
+	 * Unlike Sort node, the sorted results are consumed during the merge
+	 * stage, so we always have to sort the outer relation again.
+	 */
+	gpusort_release_all(gss);
+	gss->outer_done = false;
+	gss->sort_done = false;
+
+	if (outerPlanState(gss)->chgParam == NULL)
+		ExecReScan(outerPlanState(gss));
+}
+
+static void
+gpusort_explain_rel(CustomPlanState *node, ExplainState *es)
+{
+	/* no target relation for sort */
+}
+
+static void
+gpusort_explain(CustomPlanState *node, List *ancestors, ExplainState *es)
+{
+	GpuSortState   *gss = (GpuSortState *) node;
+	GpuSortPlan	   *gsplan = (GpuSortPlan *) gss->cps.ps.plan;
+	List		   *context;
+	List		   *result = NIL;
+	bool			useprefix;
+	int				i;
+
+	/* Set up deparsing context */
+	context = deparse_context_for_planstate((Node *) node,
+											ancestors,
+											es->rtable,
+											es->rtable_names);
+	useprefix = (list_length(es->rtable) > 1 || es->verbose);
+
+	for (i=0; i < gsplan->numCols; i++)
+	{
+		TargetEntry	   *tle;
+		char		   *exprstr;
+
+		tle = get_tle_by_resno(gsplan->cplan.plan.targetlist,
+							   gsplan->sortColIdx[i]);
+		if (!tle)
+			elog(ERROR, "no tlist entry for key %d", gsplan->sortColIdx[i]);
+		exprstr = deparse_expression((Node *) tle->expr, context,
+									 useprefix, true);
+		result = lappend(result, exprstr);
+	}
+	ExplainPropertyList("Sort Key", result, es);
+
+	if (es->analyze)
+	{
+		ExplainPropertyLong("Sorted Chunks", gss->num_chunks, es);
+		ExplainPropertyLong("Spilled Runs", gss->num_runs, es);
+	}
+	show_device_kernel(gss->dprog_key, es);
+
+	if (es->analyze && gss->pfm.enabled)
+		pgstrom_perfmon_explain(&gss->pfm, es);
+}
+
+static Bitmapset *
+gpusort_get_relids(CustomPlanState *node)
+{
+	/* nothing to do because core backend walks down outer subtree */
+	return NULL;
+}
+
+static void
+gpusort_textout_plan(StringInfo str, const CustomPlan *node)
+{
+	GpuSortPlan	   *plannode = (GpuSortPlan *)node;
+	int				i;
+
+	appendStringInfo(str, " :kern_source ");
+	_outToken(str, plannode->kern_source);
+
+	appendStringInfo(str, " :extra_flags %u", plannode->extra_flags);
+
+	appendStringInfo(str, " :numCols %d", plannode->numCols);
+
+	appendStringInfo(str, " :sortColIdx");
+	for (i=0; i < plannode->numCols; i++)
+		appendStringInfo(str, " %d", plannode->sortColIdx[i]);
+
+	appendStringInfo(str, " :sortOperators");
+	for (i=0; i < plannode->numCols; i++)
+		appendStringInfo(str, " %u", plannode->sortOperators[i]);
+
+	appendStringInfo(str, " :collations");
+	for (i=0; i < plannode->numCols; i++)
+		appendStringInfo(str, " %u", plannode->collations[i]);
+
+	appendStringInfo(str, " :nullsFirst");
+	for (i=0; i < plannode->numCols; i++)
+		appendStringInfo(str, " %s",
+						 plannode->nullsFirst[i] ? "true" : "false");
+
+	appendStringInfo(str, " :sortkey_attnums ");
+	_outBitmapset(str, plannode->sortkey_attnums);
+}
+
+static CustomPlan *
+gpusort_copy_plan(const CustomPlan *from)
+{
+	GpuSortPlan	   *oldnode = (GpuSortPlan *)from;
+	GpuSortPlan	   *newnode = palloc0(sizeof(GpuSortPlan));
+	int				numCols = oldnode->numCols;
+
+	CopyCustomPlanCommon((Node *)from, (Node *)newnode);
+	newnode->kern_source = pstrdup(oldnode->kern_source);
+	newnode->extra_flags = oldnode->extra_flags;
+	newnode->numCols = numCols;
+	newnode->sortColIdx = palloc(sizeof(AttrNumber) * numCols);
+	memcpy(newnode->sortColIdx, oldnode->sortColIdx,
+		   sizeof(AttrNumber) * numCols);
+	newnode->sortOperators = palloc(sizeof(Oid) * numCols);
+	memcpy(newnode->sortOperators, oldnode->sortOperators,
+		   sizeof(Oid) * numCols);
+	newnode->collations = palloc(sizeof(Oid) * numCols);
+	memcpy(newnode->collations, oldnode->collations,
+		   sizeof(Oid) * numCols);
+	newnode->nullsFirst = palloc(sizeof(bool) * numCols);
+	memcpy(newnode->nullsFirst, oldnode->nullsFirst,
+		   sizeof(bool) * numCols);
+	newnode->sortkey_attnums = bms_copy(oldnode->sortkey_attnums);
+
+	return &newnode->cplan;
+}
+
+void
+pgstrom_init_gpusort(void)
+{
+	/* GUC definition */
+	DefineCustomBoolVariable("pgstrom.enable_gpusort",
+							 "Enables the planner's use of GPU sort plans.",
+							 NULL,
+							 &enable_gpusort,
+							 true,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+
+	/* setup plan methods */
+	gpusort_plan_methods.CustomName				= "GpuSort";
+	gpusort_plan_methods.SetCustomPlanRef		= gpusort_set_plan_ref;
+	gpusort_plan_methods.SupportBackwardScan	= NULL;
+	gpusort_plan_methods.FinalizeCustomPlan		= gpusort_finalize_plan;
+	gpusort_plan_methods.BeginCustomPlan		= gpusort_begin;
+	gpusort_plan_methods.ExecCustomPlan			= gpusort_exec;
+	gpusort_plan_methods.MultiExecCustomPlan	= gpusort_exec_multi;
+	gpusort_plan_methods.EndCustomPlan			= gpusort_end;
+	gpusort_plan_methods.ReScanCustomPlan		= gpusort_rescan;
+	gpusort_plan_methods.ExplainCustomPlanTargetRel	= gpusort_explain_rel;
+	gpusort_plan_methods.ExplainCustomPlan		= gpusort_explain;
+	gpusort_plan_methods.GetRelidsCustomPlan	= gpusort_get_relids;
+	gpusort_plan_methods.GetSpecialCustomVar	= NULL;
+	gpusort_plan_methods.TextOutCustomPlan		= gpusort_textout_plan;
+	gpusort_plan_methods.CopyCustomPlan			= gpusort_copy_plan;
+
+	/* hook registration */
+	planner_hook_next = planner_hook;
+	planner_hook = gpusort_planner;
+}
+
+/*
+ * GpuSort message handler
+ * ------------------------------------------------------------
+ * Note that below routines are executed in the context of OpenCL
+ * intermediation server, thus, usual PostgreSQL internal APIs are
+ * not available, and need to pay attention that routines work in
+ * another process's address space.
+ */
+typedef struct
+{
+	pgstrom_message	*msg;
+	cl_program		program;
+	cl_kernel		kern_setup;
+	cl_kernel		kern_local;
+	cl_kernel		kern_step;
+	cl_kernel		kern_merge;
+	cl_mem			m_gpusort;
+	cl_mem			m_rstore;
+	cl_mem			m_cstore;
+	bool			rstore_mapped;	/* m_rstore is mapped on host memory */
+	Size			dma_length;	/* length of DMA send, for scheduler */
+	cl_int			ev_kern;	/* index of the first kernel event */
+	cl_int			ev_index;
+	cl_int			ev_max;
+	cl_event		events[FLEXIBLE_ARRAY_MEMBER];
+} clstate_gpusort;
+
+static void
+clserv_respond_gpusort(cl_event event, cl_int ev_status, void *private)
+{
+	clstate_gpusort	   *clgss = private;
+	pgstrom_gpusort	   *gsort = (pgstrom_gpusort *)clgss->msg;
+	kern_resultbuf	   *kresult = KERN_GPUSORT_RESULTBUF(&gsort->kern);
+	cl_ulong			time_dma = 0;
+	cl_ulong			time_kern = 0;
+
+	/* put error code */
+	if (ev_status != CL_COMPLETE)
+	{
+		elog(LOG, "unexpected CL_EVENT_COMMAND_EXECUTION_STATUS: %d",
+			 ev_status);
+		gsort->msg.errcode = StromError_OpenCLInternal;
+	}
+	else
+	{
+		gsort->msg.errcode = kresult->errcode;
+	}
+
+	/*
+	 * collect performance statistics; DMA send is events prior to the
+	 * first kernel, kernel execution is from the first kernel to the
+	 * last one, then DMA receive is the last event.
+	 */
+	if (ev_status == CL_COMPLETE)
+	{
+		cl_ulong	dma_send_begin = ~0UL;
+		cl_ulong	dma_send_end = 0;
+		cl_ulong	kern_exec_begin;
+		cl_ulong	kern_exec_end;
+		cl_ulong	dma_recv_begin;
+		cl_ulong	dma_recv_end;
+		cl_ulong	tv_begin;
+		cl_ulong	tv_end;
+		cl_ulong	time_overlap;
+		cl_int		i, rc;
+
+		for (i=0; i < clgss->ev_kern; i++)
+		{
+			rc = clserv_get_event_profiling(clgss->events[i],
+											&tv_begin, &tv_end);
+			if (rc != CL_SUCCESS)
+				goto skip_perfmon;
+			dma_send_begin = Min(dma_send_begin, tv_begin);
+			dma_send_end = Max(dma_send_end, tv_end);
+		}
+
+		rc = clserv_get_event_profiling(clgss->events[clgss->ev_kern],
+										&kern_exec_begin, &tv_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+		rc = clserv_get_event_profiling(clgss->events[clgss->ev_index - 2],
+										&tv_begin, &kern_exec_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+
+		rc = clserv_get_event_profiling(clgss->events[clgss->ev_index - 1],
+										&dma_recv_begin, &dma_recv_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+
+		time_dma = ((dma_send_end - dma_send_begin) +
+					(dma_recv_end - dma_recv_begin)) / 1000;
+		time_kern = (kern_exec_end - kern_exec_begin) / 1000;
+		time_overlap = pgstrom_opencl_device_overlap(&gsort->msg,
+													 dma_send_begin,
+													 dma_send_end,
+													 kern_exec_begin,
+													 kern_exec_end,
+													 dma_recv_begin,
+													 dma_recv_end);
+
+		if (gsort->msg.pfm.enabled)
+		{
+			gsort->msg.pfm.time_dma_send
+				+= (dma_send_end - dma_send_begin) / 1000;
+			gsort->msg.pfm.time_kern_exec
+				+= (kern_exec_end - kern_exec_begin) / 1000;
+			gsort->msg.pfm.time_dma_recv
+				+= (dma_recv_end - dma_recv_begin) / 1000;
+			gsort->msg.pfm.time_dma_overlap += time_overlap;
+		}
+
+	skip_perfmon:
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clGetEventProfilingInfo (%s)",
+				 opencl_strerror(rc));
+			gsort->msg.pfm.enabled = false;	/* turn off profiling */
+		}
+	}
+	/* record the commands on the profiling timeline, if enabled */
+	if (ev_status == CL_COMPLETE)
+		clserv_timeline_record(&gsort->msg, clgss->events, clgss->ev_index,
+							   clgss->ev_kern, clgss->ev_index - 1);
+
+	/* inform the device scheduler of completion */
+	pgstrom_opencl_device_complete(&gsort->msg, clgss->dma_length,
+								   time_dma, time_kern);
+
+	/* release opencl objects */
+	while (clgss->ev_index > 0)
+		clReleaseEvent(clgss->events[--clgss->ev_index]);
+	clserv_release_buffer(gsort->msg.dindex, clgss->m_cstore);
+	if (clgss->rstore_mapped)
+		clReleaseMemObject(clgss->m_rstore);
+	else
+		clserv_release_buffer(gsort->msg.dindex, clgss->m_rstore);
+	clserv_release_buffer(gsort->msg.dindex, clgss->m_gpusort);
+	clReleaseKernel(clgss->kern_merge);
+	clReleaseKernel(clgss->kern_step);
+	clReleaseKernel(clgss->kern_local);
+	clReleaseKernel(clgss->kern_setup);
+	clReleaseProgram(clgss->program);
+	free(clgss);
+
+	/* respond to the backend side */
+	pgstrom_reply_message(&gsort->msg);
+}
+
+/*
+ * clserv_enqueue_gpusort_kernel
+ *
+ * It enqueues a kernel of the bitonic sorting that depends on the last
+ * event being enqueued.
+ */
+static cl_int
+clserv_enqueue_gpusort_kernel(cl_command_queue kcmdq,
+							  clstate_gpusort *clgss,
+							  cl_kernel kernel,
+							  size_t gwork_sz,
+							  size_t lwork_sz)
+{
+	cl_int		rc;
+
+	Assert(clgss->ev_index < clgss->ev_max);
+	rc = clEnqueueNDRangeKernel(kcmdq,
+								kernel,
+								1,
+								NULL,
+								&gwork_sz,
+								&lwork_sz,
+								1,
+								&clgss->events[clgss->ev_index - 1],
+								&clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueNDRangeKernel: %s",
+			 opencl_strerror(rc));
+		return rc;
+	}
+	clgss->ev_index++;
+	return CL_SUCCESS;
+}
+
+static void
+clserv_process_gpusort(pgstrom_message *msg)
+{
+	pgstrom_gpusort	   *gsort = (pgstrom_gpusort *) msg;
+	kern_resultbuf	   *kresult = KERN_GPUSORT_RESULTBUF(&gsort->kern);
+	kern_row_store	   *krstore = &gsort->rstore->kern;
+	kern_column_store  *kcstore_head = gsort->rstore->kcs_head;
+	clstate_gpusort	   *clgss;
+	cl_program			program;
+	cl_command_queue	kcmdq;
+	cl_command_queue	kcmdq_send;
+	cl_command_queue	kcmdq_recv;
+	cl_uint				nrows = krstore->nrows;
+	cl_uint				nrooms = kresult->nrooms;
+	cl_uint				blksz;
+	cl_uint				step;
+	cl_int				ev_max;
+	cl_int				i, rc;
+	size_t				gwork_sz;
+	size_t				lwork_sz;
+	size_t				sort_lwork_sz;
+
+	Assert(gsort->rstore->stag == StromTag_RowStore);
+
+	/* see comments in clserv_process_gpuscan_row */
+	program = clserv_lookup_device_program(gsort->dprog_key, &gsort->msg);
+	if (!program)
+		return;		/* message is in waitq, retry it! */
+	if (program == BAD_OPENCL_PROGRAM)
+	{
+		rc = CL_BUILD_PROGRAM_FAILURE;
+		goto error0;
+	}
+
+	/*
+	 * Number of events; 3 for DMA send, 2 for setup and local sort,
+	 * (log2(nrooms) - log2(local block))^2 / 2 at most for global steps
+	 * and merges, and 1 for DMA receive.
+	 */
+	ev_max = 6;
+	for (blksz = 4 * PGSTROM_WORKGROUP_UNITSZ; blksz <= nrooms; blksz <<= 1)
+		for (step = blksz; step > PGSTROM_WORKGROUP_UNITSZ; step >>= 1)
+			ev_max++;
+
+	/* state object of gpusort */
+	clgss = malloc(offsetof(clstate_gpusort, events[ev_max]));
+	if (!clgss)
+	{
+		clReleaseProgram(program);
+		rc = CL_OUT_OF_HOST_MEMORY;
+		goto error0;
+	}
+	memset(clgss, 0, offsetof(clstate_gpusort, events[ev_max]));
+	clgss->msg = &gsort->msg;
+	clgss->program = program;
+	clgss->ev_max = ev_max;
+
+	clgss->kern_setup = clCreateKernel(clgss->program,
+									   "gpusort_setup_rs",
+									   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error1;
+	}
+	clgss->kern_local = clCreateKernel(clgss->program,
+									   "gpusort_bitonic_local",
+									   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error2;
+	}
+	clgss->kern_step = clCreateKernel(clgss->program,
+									  "gpusort_bitonic_step",
+									  &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error3;
+	}
+	clgss->kern_merge = clCreateKernel(clgss->program,
+									   "gpusort_bitonic_merge",
+									   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error4;
+	}
+
+	/*
+	 * Choose a device to execute this kernel
+	 */
+	clgss->dma_length = (KERN_GPUSORT_LENGTH(&gsort->kern) +
+						 krstore->length);
+	i = pgstrom_opencl_device_schedule(&gsort->msg, clgss->dma_length);
+	kcmdq = opencl_cmdq[i];
+	kcmdq_send = opencl_cmdq_send[i];
+	kcmdq_recv = opencl_cmdq_recv[i];
+
+	/*
+	 * Compute workgroup-size of the kernels. Bitonic sorting on the local
+	 * memory needs power-of-2 workgroup size, being equal or less than
+	 * half of nrooms.
+	 */
+	lwork_sz = clserv_compute_workgroup_size(clgss->kern_setup, i, nrows,
+											 sizeof(cl_uint));
+	sort_lwork_sz = Min(clserv_compute_workgroup_size(clgss->kern_local, i,
+													  nrooms / 2,
+													  2 * sizeof(cl_int)),
+						clserv_compute_workgroup_size(clgss->kern_merge, i,
+													  nrooms / 2,
+													  2 * sizeof(cl_int)));
+	if (lwork_sz == 0 || sort_lwork_sz == 0)
+	{
+		rc = CL_INVALID_WORK_GROUP_SIZE;
+		goto error6;
+	}
+	while ((sort_lwork_sz & (sort_lwork_sz - 1)) != 0)
+		sort_lwork_sz &= (sort_lwork_sz - 1);
+	sort_lwork_sz = Min(sort_lwork_sz, nrooms / 2);
+
+	/* allocation of device memory for kern_gpusort argument */
+	clgss->m_gpusort = clserv_create_buffer(gsort->msg.dindex,
+											KERN_GPUSORT_LENGTH(&gsort->kern),
+											&rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error6;
+	}
+
+	/* allocation of device memory for kern_row_store argument */
+	clgss->m_rstore = clserv_create_device_buffer(gsort->msg.dindex,
+												  krstore,
+												  krstore->length,
+												  &clgss->rstore_mapped,
+												  &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	/* allocation of device memory for kern_column_store argument */
+	clgss->m_cstore = clserv_create_buffer(gsort->msg.dindex,
+										   kcstore_head->length,
+										   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error8;
+	}
+
+	/*
+	 * Set up kernel arguments being not changed during the sorting
+	 *
+	 *   gpusort_setup_rs(kern_gpusort, kern_row_store,
+	 *                    kern_column_store, local_workmem)
+	 *   gpusort_bitonic_local(kern_gpusort, kern_column_store,
+	 *                         local_workmem)
+	 *   gpusort_bitonic_step(kern_gpusort, kern_column_store,
+	 *                        blksz, step)
+	 *   gpusort_bitonic_merge(kern_gpusort, kern_column_store,
+	 *                         blksz, local_workmem)
+	 */
+	if ((rc = clSetKernelArg(clgss->kern_setup, 0, sizeof(cl_mem),
+							 &clgss->m_gpusort)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_setup, 1, sizeof(cl_mem),
+							 &clgss->m_rstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_setup, 2, sizeof(cl_mem),
+							 &clgss->m_cstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_setup, 3,
+							 sizeof(cl_uint) * lwork_sz,
+							 NULL)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_local, 0, sizeof(cl_mem),
+							 &clgss->m_gpusort)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_local, 1, sizeof(cl_mem),
+							 &clgss->m_cstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_local, 2,
+							 2 * sizeof(cl_int) * sort_lwork_sz,
+							 NULL)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_step, 0, sizeof(cl_mem),
+							 &clgss->m_gpusort)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_step, 1, sizeof(cl_mem),
+							 &clgss->m_cstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_merge, 0, sizeof(cl_mem),
+							 &clgss->m_gpusort)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_merge, 1, sizeof(cl_mem),
+							 &clgss->m_cstore)) != CL_SUCCESS ||
+		(rc = clSetKernelArg(clgss->kern_merge, 3,
+							 2 * sizeof(cl_int) * sort_lwork_sz,
+							 NULL)) != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error9;
+	}
+
+	/*
+	 * OK, enqueue DMA transfer, kernel execution, then DMA writeback.
+	 *
+	 * (1) kern_gpusort, row-store and header portion of column-store
+	 *     shall be copied to the device memory
+	 * (2) row-store is translated to column-store, then sorted by the
+	 *     bitonic sorting network
+	 * (3) kern_resultbuf shall be written back
+	 */
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clgss->m_gpusort,
+									 0,
+									 KERN_GPUSORT_DMA_SENDLEN(&gsort->kern),
+									 &gsort->kern,
+									 0,
+									 NULL,
+									 &clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
+		goto error9;
+	}
+	clgss->ev_index++;
+
+	if (!clgss->rstore_mapped)
+	{
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clgss->m_rstore,
+										 0,
+										 krstore->length,
+										 krstore,
+										 0,
+										 NULL,
+										 &clgss->events[clgss->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clgss->ev_index++;
+	}
+
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clgss->m_cstore,
+									 0,
+									 offsetof(kern_column_store,
+											  colmeta[kcstore_head->ncols]),
+									 kcstore_head,
+									 0,
+									 NULL,
+									 &clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	clgss->ev_index++;
+
+	/*
+	 * Kick gpusort_setup_rs() call
+	 */
+	gwork_sz = ((nrows + lwork_sz - 1) / lwork_sz) * lwork_sz;
+
+	clgss->ev_kern = clgss->ev_index;
+	rc = clEnqueueNDRangeKernel(kcmdq,
+								clgss->kern_setup,
+								1,
+								NULL,
+								&gwork_sz,
+								&lwork_sz,
+								clgss->ev_index,
+								&clgss->events[0],
+								&clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueNDRangeKernel: %s",
+			 opencl_strerror(rc));
+		goto error_sync;
+	}
+	clgss->ev_index++;
+
+	/*
+	 * Kick bitonic sorting; local sort, then global steps and local merge
+	 * for each block size larger than the local block.
+	 */
+	rc = clserv_enqueue_gpusort_kernel(kcmdq, clgss, clgss->kern_local,
+									   nrooms / 2, sort_lwork_sz);
+	if (rc != CL_SUCCESS)
+		goto error_sync;
+
+	for (blksz = 4 * sort_lwork_sz; blksz <= nrooms; blksz <<= 1)
+	{
+		for (step = blksz / 2; step > sort_lwork_sz; step >>= 1)
+		{
+			if ((rc = clSetKernelArg(clgss->kern_step, 2, sizeof(cl_uint),
+									 &blksz)) != CL_SUCCESS ||
+				(rc = clSetKernelArg(clgss->kern_step, 3, sizeof(cl_uint),
+									 &step)) != CL_SUCCESS)
+			{
+				elog(LOG, "failed on clSetKernelArg: %s",
+					 opencl_strerror(rc));
+				goto error_sync;
+			}
+			rc = clserv_enqueue_gpusort_kernel(kcmdq, clgss,
+											   clgss->kern_step,
+											   nrooms / 2, sort_lwork_sz);
+			if (rc != CL_SUCCESS)
+				goto error_sync;
+		}
+		rc = clSetKernelArg(clgss->kern_merge, 2, sizeof(cl_uint), &blksz);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+			goto error_sync;
+		}
+		rc = clserv_enqueue_gpusort_kernel(kcmdq, clgss, clgss->kern_merge,
+										   nrooms / 2, sort_lwork_sz);
+		if (rc != CL_SUCCESS)
+			goto error_sync;
+	}
+
+	/*
+	 * Write back the result-buffer
+	 */
+	Assert(clgss->ev_index < clgss->ev_max);
+	rc = clserv_enqueue_read_buffer(kcmdq_recv,
+									clgss->m_gpusort,
+									((uintptr_t)
+									 KERN_GPUSORT_RESULTBUF(&gsort->kern) -
+									 (uintptr_t)(&gsort->kern)),
+									KERN_GPUSORT_DMA_RECVLEN(&gsort->kern),
+									KERN_GPUSORT_RESULTBUF(&gsort->kern),
+									1,
+									&clgss->events[clgss->ev_index - 1],
+									&clgss->events[clgss->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueReadBuffer: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	clgss->ev_index++;
+
+	/* submit the commands on the transfer and compute queues */
+	clserv_flush_device_queues(gsort->msg.dindex);
+
+	/*
+	 * Last, registers a callback routine that replies the message
+	 * to the backend
+	 */
+	rc = clserv_set_event_callback(clgss->events[clgss->ev_index - 1],
+								   clserv_respond_gpusort,
+								   clgss);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetEventCallback: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	return;
+
+error_sync:
+	/* see comments in clserv_process_gpuscan_row */
+	clWaitForEvents(clgss->ev_index, clgss->events);
+	while (clgss->ev_index > 0)
+		clReleaseEvent(clgss->events[--clgss->ev_index]);
+error9:
+	clserv_release_buffer(gsort->msg.dindex, clgss->m_cstore);
+error8:
+	if (clgss->rstore_mapped)
+		clReleaseMemObject(clgss->m_rstore);
+	else
+		clserv_release_buffer(gsort->msg.dindex, clgss->m_rstore);
+error7:
+	clserv_release_buffer(gsort->msg.dindex, clgss->m_gpusort);
+error6:
+	pgstrom_opencl_device_complete(&gsort->msg, clgss->dma_length, 0, 0);
+	clReleaseKernel(clgss->kern_merge);
+error4:
+	clReleaseKernel(clgss->kern_step);
+error3:
+	clReleaseKernel(clgss->kern_local);
+error2:
+	clReleaseKernel(clgss->kern_setup);
+error1:
+	clReleaseProgram(clgss->program);
+	free(clgss);
+error0:
+	gsort->msg.errcode = rc;
+	pgstrom_reply_message(&gsort->msg);
+}
+
+/*
+ * clserv_put_gpusort
+ *
+ * Callback handler when reference counter of pgstrom_gpusort object
+ * reached to zero, due to pgstrom_put_message.
+ * It also unlinks associated device program and release row-store.
+ * Also note that this routine can be called under the OpenCL server
+ * context.
+ */
+static void
+clserv_put_gpusort(pgstrom_message *msg)
+{
+	pgstrom_gpusort	   *gsort = (pgstrom_gpusort *)msg;
+
+	/* unlink message queue */
+	pgstrom_put_queue(msg->respq);
+
+	/* unlink device program */
+	pgstrom_put_devprog_key(gsort->dprog_key);
+
+	/* release row-store */
+	pgstrom_shmem_free(gsort->rstore);
+
+	pgstrom_shmem_free(gsort);
+}
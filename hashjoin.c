@@ -0,0 +1,2272 @@
+/*
+ * hashjoin.c
+ *
+ * Hash-join accelerated by GPU processors
+ * ----
+ * Copyright 2011-2014 (C) KaiGai Kohei <kaigai@kaigai.gr.jp>
+ * Copyright 2014 (C) The PG-Strom Development Team
+ *
+ * This software is an extension of PostgreSQL; You can use, copy,
+ * modify or distribute it under the terms of 'LICENSE' included
+ * within this package.
+ */
+#include "postgres.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/plannodes.h"
+#include "nodes/relation.h"
+#include "optimizer/clauses.h"
+#include "optimizer/cost.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/planmain.h"
+#include "optimizer/restrictinfo.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "pg_strom.h"
+#include "opencl_hashjoin.h"
+
+static add_join_path_hook_type	add_join_path_next;
+static CustomPathMethods		gpuhashjoin_path_methods;
+static CustomPlanMethods		gpuhashjoin_plan_methods;
+static bool						enable_gpuhashjoin;
+
+typedef struct {
+	CustomPath	cpath;
+	JoinType	jointype;
+	Path	   *outerjoinpath;	/* outer path */
+	Path	   *innerjoinpath;	/* inner path; to be hashed */
+	List	   *hash_clauses;	/* RestrictInfo run on device */
+	List	   *host_clauses;	/* RestrictInfo run on host */
+	double		row_population_ratio;	/* estimated pairs per outer row */
+} GpuHashJoinPath;
+
+typedef struct {
+	CustomPlan	cplan;
+	JoinType	jointype;
+	const char *kern_source;	/* source of opencl kernel */
+	int			extra_flags;	/* extra libraries to be included */
+	List	   *used_params;	/* list of Const/Param in use */
+	List	   *hash_clauses;	/* clauses to be run on device */
+	List	   *outer_keys;		/* hash keys of outer relation */
+	List	   *inner_keys;		/* hash keys of inner relation */
+	Bitmapset  *outer_attnums;	/* outer attnums referenced in device */
+	double		row_population_ratio;	/* estimated pairs per outer row */
+} GpuHashJoinPlan;
+
+/*
+ * GpuHashJoin loads the inner relation prior to the first fetch, then
+ * builds a hash table on the shared memory segment. Outer relation is
+ * loaded to row-stores, then each of them is sent to the OpenCL server
+ * with the hash table by a pgstrom_gpuhashjoin message. The device kernel
+ * probes the hash table, and writes back pairs of the matched outer and
+ * inner rows to be joined. Projection and the join qualifiers that are
+ * not hashable are evaluated on the host side.
+ */
+typedef struct {
+	CustomPlanState		cps;
+	JoinType			jointype;
+	List			   *outer_keys;	/* list of ExprState */
+	List			   *inner_keys;	/* list of ExprState */
+	Oid				   *outer_key_types;
+	Oid				   *inner_key_types;
+	cl_ulong		   *key_values;	/* working buffer to normalize keys */
+	TupleTableSlot	   *outer_slot;
+	TupleTableSlot	   *inner_slot;
+	HeapTuple			outer_overflow;	/* tuple not fit previous chunk */
+	bool				outer_done;	/* no more outer tuples to be loaded */
+
+	pgstrom_queue	   *mqueue;
+	Datum				dprog_key;
+
+	kern_parambuf	   *kparambuf;
+	kern_colmeta	   *rs_colmeta;
+	kern_colmeta	   *cs_colmeta;
+	int					cs_colnums;
+	double				row_population_ratio;
+
+	pgstrom_hash_table *htable;		/* hash table of inner relation */
+	HeapTuple		   *inner_tuples;	/* tuples referenced by hash-items */
+
+	pgstrom_gpuhashjoin *curr_chunk;
+	cl_int			   *curr_results;	/* pairs of outer/inner index */
+	cl_uint				curr_nitems;
+	cl_uint				curr_index;
+	cl_int			   *host_results;	/* results by host probing, if any */
+	int					num_running;
+	int					num_host_probed;
+	dlist_head			ready_chunks;
+
+	pgstrom_perfmon		pfm;	/* sum of performance counter */
+} GpuHashJoinState;
+
+/* static functions */
+static void clserv_process_gpuhashjoin(pgstrom_message *msg);
+static void clserv_put_gpuhashjoin(pgstrom_message *msg);
+static void gpuhashjoin_put_hash_table(pgstrom_message *msg);
+
+/*
+ * gpuhashjoin_key_type_supported
+ *
+ * Device compares the hash keys in normalized binary form, so only data
+ * types whose equality is identical to binary equality are supported.
+ */
+static bool
+gpuhashjoin_key_type_supported(Oid type_oid)
+{
+	switch (type_oid)
+	{
+		case BOOLOID:
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case DATEOID:
+#ifdef HAVE_INT64_TIMESTAMP
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+#endif
+			return true;
+		default:
+			break;
+	}
+	return false;
+}
+
+static bool
+gpuhashjoin_key_types_compatible(Oid type1, Oid type2)
+{
+	if (!gpuhashjoin_key_type_supported(type1) ||
+		!gpuhashjoin_key_type_supported(type2))
+		return false;
+	if (type1 == type2)
+		return true;
+	/* integer family is compared in sign-extended 64bit form */
+	if ((type1 == INT2OID || type1 == INT4OID || type1 == INT8OID) &&
+		(type2 == INT2OID || type2 == INT4OID || type2 == INT8OID))
+		return true;
+	return false;
+}
+
+/*
+ * gpuhashjoin_normalize_key
+ *
+ * It translates a datum of hash key into the normalized form; being
+ * compatible to the device code, (cl_ulong)((cl_long) KEY.value).
+ */
+static cl_ulong
+gpuhashjoin_normalize_key(Oid type_oid, Datum value)
+{
+	switch (type_oid)
+	{
+		case BOOLOID:
+			return (cl_ulong)(DatumGetBool(value) ? 1 : 0);
+		case INT2OID:
+			return (cl_ulong)((cl_long) DatumGetInt16(value));
+		case INT4OID:
+		case DATEOID:
+			return (cl_ulong)((cl_long) DatumGetInt32(value));
+		case INT8OID:
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return (cl_ulong) DatumGetInt64(value);
+		default:
+			elog(ERROR, "unexpected hash key type: %s",
+				 format_type_be(type_oid));
+	}
+	return 0;	/* be compiler quiet */
+}
+
+/*
+ * gpuhashjoin_max_htable_size
+ *
+ * The hash table is sent to the device memory as a buffer object, so it
+ * has to be smaller than the max allocation size of all the devices.
+ */
+static Size
+gpuhashjoin_max_htable_size(void)
+{
+	Size	max_size = 0;
+	int		i, n = pgstrom_get_device_nums();
+
+	for (i=0; i < n; i++)
+	{
+		const pgstrom_device_info *dinfo = pgstrom_get_device_info(i);
+
+		if (i == 0 || dinfo->dev_max_mem_alloc_size < max_size)
+			max_size = dinfo->dev_max_mem_alloc_size;
+	}
+	return Min(max_size, (Size) UINT_MAX);
+}
+
+/*
+ * cost_gpuhashjoin
+ *
+ * cost estimation for GpuHashJoin. It returns false, if the hash table
+ * is expected not to fit the device memory.
+ */
+static bool
+cost_gpuhashjoin(GpuHashJoinPath *gpath, PlannerInfo *root,
+				 RelOptInfo *joinrel, SpecialJoinInfo *sjinfo)
+{
+	Path	   *path = &gpath->cpath.path;
+	Path	   *outer_path = gpath->outerjoinpath;
+	Path	   *inner_path = gpath->innerjoinpath;
+	Cost		startup_cost = 0;
+	Cost		run_cost = 0;
+	double		outer_rows = outer_path->rows;
+	double		inner_rows = inner_path->rows;
+	double		hash_rows;
+	int			num_hashkeys = list_length(gpath->hash_clauses);
+	QualCost	hash_cost;
+	QualCost	host_cost;
+	Selectivity	hash_sel;
+	Cost		cpu_per_tuple;
+	Cost		setup_cost;
+	Cost		dev_op_cost;
+	Cost		dma_per_byte;
+	Cost		kern_per_tuple;
+	Cost		dma_per_tuple;
+	Size		htable_size;
+	Size		tuple_len;
+	double		chunk_rows;
+
+	/* Mark the path with the correct row estimate */
+	path->rows = joinrel->rows;
+
+	if (!enable_gpuhashjoin)
+		startup_cost += disable_cost;
+
+	/*
+	 * Inner relation is hashed on the host side, then the hash table is
+	 * sent to the device with each outer chunk, so it has to fit a buffer
+	 * object of the device memory.
+	 */
+	htable_size = (STROMALIGN(offsetof(kern_hash_table,
+									   slots[(Size) inner_rows])) +
+				   KERN_HASH_ITEM_LENGTH(num_hashkeys) * (Size) inner_rows);
+	if (htable_size > gpuhashjoin_max_htable_size())
+		return false;
+
+	/* cost to run the inner path and to build its hash table */
+	startup_cost += outer_path->startup_cost + inner_path->total_cost;
+	startup_cost += (cpu_operator_cost * num_hashkeys +
+					 cpu_tuple_cost) * inner_rows;
+
+	/* cost to run the outer path */
+	run_cost += outer_path->total_cost - outer_path->startup_cost;
+
+	/*
+	 * Device costs, in the same scale as cost_gpuscan. Hash clauses are
+	 * evaluated on the device for each outer row, and the hash table is
+	 * sent with each outer chunk. DMA transfer of a chunk is overlapped
+	 * with the kernel execution of the prior chunk, except for the first
+	 * chunk.
+	 */
+	pgstrom_device_costs(&setup_cost, &dev_op_cost, &dma_per_byte);
+	cost_qual_eval(&hash_cost, gpath->hash_clauses, root);
+	tuple_len = (sizeof(cl_uint) + MAXALIGN(SizeofHeapTupleHeader) +
+				 MAXALIGN(outer_path->parent->width));
+	chunk_rows = Max((double) ROWSTORE_DEFAULT_SIZE / (double) tuple_len, 1.0);
+	kern_per_tuple = (cpu_operator_cost > 0.0
+					  ? hash_cost.per_tuple * (dev_op_cost / cpu_operator_cost)
+					  : 0.0);
+	dma_per_tuple = (dma_per_byte * tuple_len +
+					 dma_per_byte * (double) htable_size / chunk_rows);
+	startup_cost += (hash_cost.startup + setup_cost +
+					 Min(chunk_rows, outer_rows) * (kern_per_tuple +
+													dma_per_tuple));
+	run_cost += Max(kern_per_tuple, dma_per_tuple) * outer_rows;
+
+	/*
+	 * CPU costs to fetch the joined pairs, then to evaluate the host
+	 * qualifiers and projection
+	 */
+	hash_sel = clauselist_selectivity(root, gpath->hash_clauses,
+									  0, JOIN_INNER, sjinfo);
+	hash_rows = clamp_row_est(outer_rows * inner_rows * hash_sel);
+	gpath->row_population_ratio = hash_rows / Max(outer_rows, 1.0);
+
+	cost_qual_eval(&host_cost, gpath->host_clauses, root);
+	startup_cost += host_cost.startup;
+	cpu_per_tuple = cpu_tuple_cost + host_cost.per_tuple;
+	run_cost += cpu_per_tuple * hash_rows;
+
+	path->startup_cost = startup_cost;
+	path->total_cost = startup_cost + run_cost;
+
+	return true;
+}
+
+/*
+ * gpuhashjoin_hash_clause
+ *
+ * It checks whether the supplied RestrictInfo is a hashable clause that
+ * can be probed by device; equality operator between outer and inner
+ * relations, and key types are supported by device.
+ */
+static bool
+gpuhashjoin_hash_clause(RestrictInfo *rinfo,
+						RelOptInfo *outerrel,
+						RelOptInfo *innerrel)
+{
+	OpExpr	   *op = (OpExpr *) rinfo->clause;
+	Expr	   *outer_key;
+	Expr	   *inner_key;
+
+	if (!rinfo->can_join || !OidIsValid(rinfo->hashjoinoperator))
+		return false;
+	Assert(is_opclause(op) && list_length(op->args) == 2);
+
+	/*
+	 * Check whether the clause has the form "outer op inner" or
+	 * "inner op outer". Don't touch rinfo->outer_is_left here, because
+	 * this RestrictInfo is shared with other join paths.
+	 */
+	if (bms_is_subset(rinfo->left_relids, outerrel->relids) &&
+		bms_is_subset(rinfo->right_relids, innerrel->relids))
+	{
+		outer_key = linitial(op->args);
+		inner_key = lsecond(op->args);
+	}
+	else if (bms_is_subset(rinfo->left_relids, innerrel->relids) &&
+			 bms_is_subset(rinfo->right_relids, outerrel->relids))
+	{
+		outer_key = lsecond(op->args);
+		inner_key = linitial(op->args);
+	}
+	else
+		return false;
+
+	if (!gpuhashjoin_key_types_compatible(exprType((Node *) outer_key),
+										  exprType((Node *) inner_key)))
+		return false;
+
+	/* outer key is evaluated on device, but inner key is on host */
+	if (!pgstrom_codegen_available_expression(outer_key))
+		return false;
+
+	return true;
+}
+
+static void
+gpuhashjoin_add_join_path(PlannerInfo *root,
+						  RelOptInfo *joinrel,
+						  RelOptInfo *outerrel,
+						  RelOptInfo *innerrel,
+						  JoinType jointype,
+						  SpecialJoinInfo *sjinfo,
+						  List *restrictlist,
+						  List *mergeclause_list,
+						  SemiAntiJoinFactors *semifactors,
+						  Relids param_source_rels,
+						  Relids extra_lateral_rels)
+{
+	GpuHashJoinPath	   *pathnode;
+	Path			   *outer_path;
+	Path			   *inner_path;
+	List			   *hash_clauses = NIL;
+	List			   *host_clauses = NIL;
+	ListCell		   *cell;
+
+	/* call the secondary hook */
+	if (add_join_path_next)
+		add_join_path_next(root, joinrel, outerrel, innerrel,
+						   jointype, sjinfo, restrictlist,
+						   mergeclause_list, semifactors,
+						   param_source_rels, extra_lateral_rels);
+
+	/* Is PG-Strom enabled? */
+	if (!pgstrom_enabled)
+		return;
+
+	/* right now, only inner join is supported */
+	if (jointype != JOIN_INNER)
+		return;
+
+	/*
+	 * GpuHashJoin does not support parameterized paths right now, so we
+	 * pick up the cheapest total paths unless they need outer relations.
+	 */
+	outer_path = outerrel->cheapest_total_path;
+	inner_path = innerrel->cheapest_total_path;
+	if (!outer_path || !inner_path ||
+		PATH_REQ_OUTER(outer_path) || PATH_REQ_OUTER(inner_path) ||
+		!bms_is_empty(extra_lateral_rels))
+		return;
+
+	/* check whether join clauses can be probed on the device */
+	foreach (cell, restrictlist)
+	{
+		RestrictInfo   *rinfo = lfirst(cell);
+
+		if (gpuhashjoin_hash_clause(rinfo, outerrel, innerrel))
+			hash_clauses = lappend(hash_clauses, rinfo);
+		else
+			host_clauses = lappend(host_clauses, rinfo);
+	}
+	if (hash_clauses == NIL)
+		return;
+
+	/*
+	 * Construction of a custom-plan node.
+	 */
+	pathnode = palloc0(sizeof(GpuHashJoinPath));
+	pathnode->cpath.path.type = T_CustomPath;
+	pathnode->cpath.path.pathtype = T_CustomPlan;
+	pathnode->cpath.path.parent = joinrel;
+	pathnode->cpath.path.param_info = NULL;
+	pathnode->cpath.path.pathkeys = NIL;	/* result is unsorted */
+	pathnode->cpath.methods = &gpuhashjoin_path_methods;
+	pathnode->jointype = jointype;
+	pathnode->outerjoinpath = outer_path;
+	pathnode->innerjoinpath = inner_path;
+	pathnode->hash_clauses = hash_clauses;
+	pathnode->host_clauses = host_clauses;
+
+	if (!cost_gpuhashjoin(pathnode, root, joinrel, sjinfo))
+	{
+		pfree(pathnode);
+		return;
+	}
+	add_path(joinrel, &pathnode->cpath.path);
+}
+
+/*
+ * fix_join_expr_mutator
+ *
+ * It replaces Var nodes (and PlaceHolderVar nodes in the target-list) by
+ * OUTER_VAR or INNER_VAR references towards the target-list of the sub-
+ * plans, like fix_join_expr() in setrefs.c.
+ */
+typedef struct {
+	List	   *outer_tlist;
+	List	   *inner_tlist;
+} fix_join_expr_context;
+
+static Var *
+search_tlist_for_var(Node *node, List *tlist, Index newvarno)
+{
+	ListCell   *cell;
+
+	foreach (cell, tlist)
+	{
+		TargetEntry	   *tle = lfirst(cell);
+
+		if (IsA(node, Var) && IsA(tle->expr, Var))
+		{
+			Var	   *var = (Var *) node;
+			Var	   *tvar = (Var *) tle->expr;
+
+			if (var->varno == tvar->varno &&
+				var->varattno == tvar->varattno &&
+				var->varlevelsup == tvar->varlevelsup)
+			{
+				Var	   *newvar = copyObject(var);
+
+				newvar->varno = newvarno;
+				newvar->varattno = tle->resno;
+				return newvar;
+			}
+		}
+		else if (equal(node, tle->expr))
+			return makeVarFromTargetEntry(newvarno, tle);
+	}
+	return NULL;
+}
+
+static Node *
+fix_join_expr_mutator(Node *node, fix_join_expr_context *context)
+{
+	Var	   *newvar;
+
+	if (!node)
+		return NULL;
+	if (IsA(node, Var) || IsA(node, PlaceHolderVar))
+	{
+		newvar = search_tlist_for_var(node, context->outer_tlist, OUTER_VAR);
+		if (newvar)
+			return (Node *) newvar;
+		newvar = search_tlist_for_var(node, context->inner_tlist, INNER_VAR);
+		if (newvar)
+			return (Node *) newvar;
+		if (IsA(node, Var))
+			elog(ERROR, "variable not found in subplan target lists");
+		/* PlaceHolderVar not on the target-list; try its contents */
+	}
+	return expression_tree_mutator(node, fix_join_expr_mutator,
+								   (void *) context);
+}
+
+static int
+gpuhashjoin_sort_vars_cmp(const void *a, const void *b)
+{
+	Var	   *var1 = *((Var **) a);
+	Var	   *var2 = *((Var **) b);
+
+	return (int) var1->varattno - (int) var2->varattno;
+}
+
+/*
+ * gpuhashjoin_codegen_probe
+ *
+ * It constructs a kernel code to probe the hash table by the outer keys.
+ * The outer keys have to reference the outer row-store, so Var nodes are
+ * replaced by OUTER_VAR prior to code generation.
+ */
+static char *
+gpuhashjoin_codegen_probe(PlannerInfo *root, List *outer_keys,
+						  List *outer_tlist, codegen_context *context,
+						  Bitmapset **p_outer_attnums)
+{
+	fix_join_expr_context fjcontext;
+	StringInfoData	str;
+	List		   *dev_keys;
+	List		   *key_codes = NIL;
+	Var			  **vars;
+	ListCell	   *cell;
+	ListCell	   *lc;
+	int				index;
+
+	fjcontext.outer_tlist = outer_tlist;
+	fjcontext.inner_tlist = NIL;
+	dev_keys = (List *) fix_join_expr_mutator((Node *) outer_keys,
+											  &fjcontext);
+	/*
+	 * kern_row_to_column() puts the referenced columns on the column-store
+	 * in order of attribute number, so KVAR_n has to point the n-th smallest
+	 * attribute being referenced. We walks on the keys once to collect Var
+	 * nodes, then construct the code again with the sorted Var nodes.
+	 */
+	memset(context, 0, sizeof(codegen_context));
+	foreach (cell, dev_keys)
+	{
+		if (!pgstrom_codegen_expression(lfirst(cell), context))
+			elog(ERROR, "Bug? hash key is not executable on device: %s",
+				 nodeToString(lfirst(cell)));
+	}
+	vars = palloc(sizeof(Var *) * list_length(context->used_vars));
+	index = 0;
+	foreach (cell, context->used_vars)
+		vars[index++] = lfirst(cell);
+	qsort(vars, index, sizeof(Var *), gpuhashjoin_sort_vars_cmp);
+
+	memset(context, 0, sizeof(codegen_context));
+	*p_outer_attnums = NULL;
+	while (--index >= 0)
+	{
+		context->used_vars = lcons(vars[index], context->used_vars);
+		*p_outer_attnums = bms_add_member(*p_outer_attnums,
+										  vars[index]->varattno);
+	}
+	pfree(vars);
+
+	foreach (cell, dev_keys)
+		key_codes = lappend(key_codes,
+							pgstrom_codegen_expression(lfirst(cell),
+													   context));
+
+	initStringInfo(&str);
+
+	/*
+	 * Put declarations of device types, functions and macro definitions
+	 */
+	appendStringInfo(&str, "%s\n", pgstrom_codegen_declarations(context));
+
+	/* hash table probing with row-store */
+	appendStringInfo(&str,
+					 "__kernel void\n"
+					 "gpuhashjoin_probe_rs(__global kern_hashjoin *khjoin,\n"
+					 "                     __global kern_hash_table *khtable,\n"
+					 "                     __global kern_row_store *krs,\n"
+					 "                     __global kern_column_store *kcs,\n"
+					 "                     __local void *local_workmem)\n"
+					 "{\n"
+					 "  __global kern_parambuf *kparams\n"
+					 "    = KERN_HASHJOIN_PARAMBUF(khjoin);\n"
+					 "  __global kern_resultbuf *kresults\n"
+					 "    = KERN_HASHJOIN_RESULTBUF(khjoin);\n"
+					 "  __global kern_toastbuf *toast\n"
+					 "    = (__global kern_toastbuf *)krs;\n"
+					 "  cl_ulong    keys[%d];\n"
+					 "  cl_int      errcode = StromError_Success;\n"
+					 "\n"
+					 "  KDEBUG_INIT(kresults);\n"
+					 "\n"
+					 "  kern_row_to_column(krs,kcs,local_workmem);\n"
+					 "  if (get_global_id(0) >= kcs->nrows)\n"
+					 "    return;\n",
+					 list_length(dev_keys));
+
+	index = 0;
+	forboth (cell, dev_keys, lc, key_codes)
+	{
+		devtype_info   *dtype = pgstrom_devtype_lookup(exprType(lfirst(cell)));
+
+		Assert(dtype != NULL);
+		appendStringInfo(&str,
+						 "  {\n"
+						 "    pg_%s_t kval = %s;\n"
+						 "\n"
+						 "    if (kval.isnull)\n"
+						 "      return;\n"
+						 "    keys[%d] = (cl_ulong)((cl_long)kval.value);\n"
+						 "  }\n",
+						 dtype->type_name, (char *) lfirst(lc), index);
+		index++;
+	}
+	/* device could not compute the keys; this chunk is probed by host */
+	appendStringInfo(&str,
+					 "  if (errcode != StromError_Success)\n"
+					 "  {\n"
+					 "    atomic_cmpxchg(&kresults->errcode,\n"
+					 "                   StromError_Success,\n"
+					 "                   StromError_RowReCheck);\n"
+					 "    return;\n"
+					 "  }\n"
+					 "  gpuhashjoin_probe(kresults,khtable,keys);\n"
+					 "}\n");
+	return str.data;
+}
+
+static CustomPlan *
+gpuhashjoin_create_plan(PlannerInfo *root, CustomPath *best_path)
+{
+	GpuHashJoinPath	   *gpath = (GpuHashJoinPath *) best_path;
+	GpuHashJoinPlan	   *ghjoin;
+	Plan			   *outer_plan;
+	Plan			   *inner_plan;
+	Relids				outer_relids = gpath->outerjoinpath->parent->relids;
+	List			   *tlist;
+	List			   *hash_clauses;
+	List			   *host_clauses;
+	List			   *outer_keys = NIL;
+	List			   *inner_keys = NIL;
+	Bitmapset		   *outer_attnums;
+	ListCell		   *cell;
+	char			   *kern_source;
+	codegen_context		context;
+
+	outer_plan = create_plan_recurse(root, gpath->outerjoinpath);
+	inner_plan = create_plan_recurse(root, gpath->innerjoinpath);
+	tlist = build_path_tlist(root, &best_path->path);
+
+	/* Sort clauses into best execution order */
+	host_clauses = order_qual_clauses(root, gpath->host_clauses);
+
+	/* Reduce RestrictInfo list to bare expressions; ignore pseudoconstants */
+	host_clauses = extract_actual_clauses(host_clauses, false);
+	hash_clauses = extract_actual_clauses(gpath->hash_clauses, false);
+
+	/* pick up outer and inner keys from the hash clauses */
+	foreach (cell, gpath->hash_clauses)
+	{
+		RestrictInfo   *rinfo = lfirst(cell);
+		OpExpr		   *op = (OpExpr *) rinfo->clause;
+
+		if (bms_is_subset(rinfo->left_relids, outer_relids))
+		{
+			outer_keys = lappend(outer_keys, linitial(op->args));
+			inner_keys = lappend(inner_keys, lsecond(op->args));
+		}
+		else
+		{
+			outer_keys = lappend(outer_keys, lsecond(op->args));
+			inner_keys = lappend(inner_keys, linitial(op->args));
+		}
+	}
+
+	/*
+	 * Construct OpenCL kernel code - it translates the outer row-store
+	 * into column-store, then evaluates the outer keys and probes the
+	 * inner hash table.
+	 */
+	kern_source = gpuhashjoin_codegen_probe(root, outer_keys,
+											outer_plan->targetlist,
+											&context, &outer_attnums);
+
+	/*
+	 * Construction of GpuHashJoinPlan node; on top of CustomPlan node
+	 */
+	ghjoin = palloc0(sizeof(GpuHashJoinPlan));
+	ghjoin->cplan.plan.type = T_CustomPlan;
+	ghjoin->cplan.plan.targetlist = tlist;
+	ghjoin->cplan.plan.qual = host_clauses;
+	ghjoin->cplan.plan.lefttree = outer_plan;
+	ghjoin->cplan.plan.righttree = inner_plan;
+	ghjoin->cplan.methods = &gpuhashjoin_plan_methods;
+
+	ghjoin->jointype = gpath->jointype;
+	ghjoin->kern_source = kern_source;
+	ghjoin->extra_flags = context.extra_flags | DEVKERNEL_NEEDS_HASHJOIN;
+	ghjoin->used_params = context.used_params;
+	ghjoin->hash_clauses = hash_clauses;
+	ghjoin->outer_keys = outer_keys;
+	ghjoin->inner_keys = inner_keys;
+	ghjoin->outer_attnums = outer_attnums;
+	ghjoin->row_population_ratio = gpath->row_population_ratio;
+
+	return &ghjoin->cplan;
+}
+
+static void
+gpuhashjoin_textout_path(StringInfo str, Node *node)
+{
+	GpuHashJoinPath	   *pathnode = (GpuHashJoinPath *) node;
+	char			   *temp;
+
+	appendStringInfo(str, " :jointype %d", (int) pathnode->jointype);
+
+	/* outerjoinpath */
+	temp = nodeToString(pathnode->outerjoinpath);
+	appendStringInfo(str, " :outerjoinpath %s", temp);
+	pfree(temp);
+
+	/* innerjoinpath */
+	temp = nodeToString(pathnode->innerjoinpath);
+	appendStringInfo(str, " :innerjoinpath %s", temp);
+	pfree(temp);
+
+	/* hash_clauses */
+	temp = nodeToString(pathnode->hash_clauses);
+	appendStringInfo(str, " :hash_clauses %s", temp);
+	pfree(temp);
+
+	/* host_clauses */
+	temp = nodeToString(pathnode->host_clauses);
+	appendStringInfo(str, " :host_clauses %s", temp);
+	pfree(temp);
+
+	appendStringInfo(str, " :row_population_ratio %.2f",
+					 pathnode->row_population_ratio);
+}
+
+static Node *
+gpuhashjoin_fix_join_expr(PlannerInfo *root, Node *node,
+						  fix_join_expr_context *context, int rtoffset)
+{
+	node = fix_join_expr_mutator(node, context);
+	return (Node *) fix_scan_expr(root, node, rtoffset);
+}
+
+static void
+gpuhashjoin_set_plan_ref(PlannerInfo *root,
+						 CustomPlan *custom_plan,
+						 int rtoffset)
+{
+	GpuHashJoinPlan	   *ghjoin = (GpuHashJoinPlan *) custom_plan;
+	fix_join_expr_context context;
+
+	context.outer_tlist = outerPlan(custom_plan)->targetlist;
+	context.inner_tlist = innerPlan(custom_plan)->targetlist;
+
+	ghjoin->cplan.plan.targetlist = (List *)
+		gpuhashjoin_fix_join_expr(root, (Node *)ghjoin->cplan.plan.targetlist,
+								  &context, rtoffset);
+	ghjoin->cplan.plan.qual = (List *)
+		gpuhashjoin_fix_join_expr(root, (Node *)ghjoin->cplan.plan.qual,
+								  &context, rtoffset);
+	ghjoin->hash_clauses = (List *)
+		gpuhashjoin_fix_join_expr(root, (Node *)ghjoin->hash_clauses,
+								  &context, rtoffset);
+	ghjoin->outer_keys = (List *)
+		gpuhashjoin_fix_join_expr(root, (Node *)ghjoin->outer_keys,
+								  &context, rtoffset);
+	ghjoin->inner_keys = (List *)
+		gpuhashjoin_fix_join_expr(root, (Node *)ghjoin->inner_keys,
+								  &context, rtoffset);
+}
+
+static void
+gpuhashjoin_finalize_plan(PlannerInfo *root,
+						  CustomPlan *custom_plan,
+						  Bitmapset **paramids,
+						  Bitmapset **valid_params,
+						  Bitmapset **scan_params)
+{
+	/* nothing to do */
+}
+
+static CustomPlanState *
+gpuhashjoin_begin(CustomPlan *node, EState *estate, int eflags)
+{
+	GpuHashJoinPlan	   *ghjoin = (GpuHashJoinPlan *) node;
+	GpuHashJoinState   *ghjs;
+	TupleDesc			tupdesc;
+	int32				extra_flags;
+	ListCell		   *cell;
+	AttrNumber			anum;
+	int					i;
+
+	/* check for unsupported flags */
+	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
+
+	/*
+	 * create a state structure
+	 */
+	ghjs = palloc0(sizeof(GpuHashJoinState));
+	ghjs->cps.ps.type = T_CustomPlanState;
+	ghjs->cps.ps.plan = (Plan *) node;
+	ghjs->cps.ps.state = estate;
+	ghjs->cps.methods = &gpuhashjoin_plan_methods;
+	ghjs->jointype = ghjoin->jointype;
+
+	/*
+	 * create expression context
+	 */
+	ExecAssignExprContext(estate, &ghjs->cps.ps);
+
+	/*
+	 * initialize child expressions
+	 */
+	ghjs->cps.ps.targetlist = (List *)
+		ExecInitExpr((Expr *) node->plan.targetlist, &ghjs->cps.ps);
+	ghjs->cps.ps.qual = (List *)
+		ExecInitExpr((Expr *) node->plan.qual, &ghjs->cps.ps);
+	ghjs->outer_keys = (List *)
+		ExecInitExpr((Expr *) ghjoin->outer_keys, &ghjs->cps.ps);
+	ghjs->inner_keys = (List *)
+		ExecInitExpr((Expr *) ghjoin->inner_keys, &ghjs->cps.ps);
+
+	ghjs->outer_key_types = palloc(sizeof(Oid) *
+								   list_length(ghjoin->outer_keys));
+	i = 0;
+	foreach (cell, ghjoin->outer_keys)
+		ghjs->outer_key_types[i++] = exprType(lfirst(cell));
+	ghjs->inner_key_types = palloc(sizeof(Oid) *
+								   list_length(ghjoin->inner_keys));
+	i = 0;
+	foreach (cell, ghjoin->inner_keys)
+		ghjs->inner_key_types[i++] = exprType(lfirst(cell));
+	ghjs->key_values = palloc(sizeof(cl_ulong) *
+							  list_length(ghjoin->outer_keys));
+
+	/*
+	 * initialize child nodes
+	 */
+	outerPlanState(ghjs) = ExecInitNode(outerPlan(node), estate, eflags);
+	innerPlanState(ghjs) = ExecInitNode(innerPlan(node), estate, eflags);
+
+	/*
+	 * tuple table initialization
+	 */
+	ExecInitResultTupleSlot(estate, &ghjs->cps.ps);
+	ghjs->outer_slot = ExecInitExtraTupleSlot(estate);
+	ExecSetSlotDescriptor(ghjs->outer_slot,
+						  ExecGetResultType(outerPlanState(ghjs)));
+	ghjs->inner_slot = ExecInitExtraTupleSlot(estate);
+	ExecSetSlotDescriptor(ghjs->inner_slot,
+						  ExecGetResultType(innerPlanState(ghjs)));
+
+	/*
+	 * Initialize result tuple type and projection info.
+	 */
+	ExecAssignResultTypeFromTL(&ghjs->cps.ps);
+	ExecAssignProjectionInfo(&ghjs->cps.ps, NULL);
+
+	/*
+	 * OK, initialization of common part is over.
+	 * Let's have GPU stuff initialization
+	 */
+	ghjs->outer_overflow = NULL;
+	ghjs->outer_done = false;
+	ghjs->mqueue = pgstrom_create_queue();
+	pgstrom_track_object(&ghjs->mqueue->stag);
+
+	ghjs->kparambuf = pgstrom_create_kern_parambuf(ghjoin->used_params,
+												ghjs->cps.ps.ps_ExprContext);
+	extra_flags = ghjoin->extra_flags;
+	if (pgstrom_kernel_debug)
+		extra_flags |= DEVKERNEL_NEEDS_DEBUG;
+	ghjs->dprog_key = pgstrom_get_devprog_key(ghjoin->kern_source,
+											  extra_flags);
+	pgstrom_track_object((StromTag *)ghjs->dprog_key);
+
+	/*
+	 * Column metadata of the outer row-store; attributes being referenced
+	 * by the outer keys are translated to the column-store on the device.
+	 */
+	tupdesc = ExecGetResultType(outerPlanState(ghjs));
+	ghjs->rs_colmeta = palloc(sizeof(kern_colmeta) * tupdesc->natts);
+	ghjs->cs_colmeta = palloc(sizeof(kern_colmeta) * tupdesc->natts);
+	ghjs->cs_colnums = 0;
+	for (anum=0; anum < tupdesc->natts; anum++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[anum];
+		kern_colmeta   *colmeta = &ghjs->rs_colmeta[anum];
+
+		colmeta->flags = 0;
+		if (attr->attnotnull)
+			colmeta->flags |= KERN_COLMETA_ATTNOTNULL;
+		if (bms_is_member(anum + 1, ghjoin->outer_attnums))
+			colmeta->flags |= KERN_COLMETA_ATTREFERENCED;
+
+		if (attr->attalign == 'c')
+			colmeta->attalign = sizeof(cl_char);
+		else if (attr->attalign == 's')
+			colmeta->attalign = sizeof(cl_short);
+		else if (attr->attalign == 'i')
+			colmeta->attalign = sizeof(cl_int);
+		else if (attr->attalign == 'd')
+			colmeta->attalign = sizeof(cl_long);
+		else
+			elog(ERROR, "unexpected attribute alignment: %c", attr->attalign);
+		colmeta->attlen = attr->attlen;
+		colmeta->cs_ofs = -1;	/* to be calculated for each row_store */
+
+		if ((colmeta->flags & KERN_COLMETA_ATTREFERENCED) != 0)
+			memcpy(&ghjs->cs_colmeta[ghjs->cs_colnums++],
+				   colmeta, sizeof(kern_colmeta));
+	}
+	ghjs->row_population_ratio = ghjoin->row_population_ratio;
+
+	ghjs->htable = NULL;
+	ghjs->inner_tuples = NULL;
+	ghjs->curr_chunk = NULL;
+	ghjs->curr_results = NULL;
+	ghjs->curr_nitems = 0;
+	ghjs->curr_index = 0;
+	ghjs->host_results = NULL;
+	ghjs->num_running = 0;
+	ghjs->num_host_probed = 0;
+	dlist_init(&ghjs->ready_chunks);
+
+	/* Is perfmon needed? */
+	ghjs->pfm.enabled = pgstrom_perfmon_enabled;
+
+	return &ghjs->cps;
+}
+
+/*
+ * gpuhashjoin_eval_keys
+ *
+ * It evaluates the supplied hash keys, then put them on 'keys' being
+ * normalized. It returns false if any of keys are NULL; that never match
+ * with any other keys.
+ */
+static bool
+gpuhashjoin_eval_keys(List *key_states, Oid *key_types,
+					  ExprContext *econtext, cl_ulong *keys)
+{
+	MemoryContext	oldcxt;
+	ListCell	   *cell;
+	bool			result = true;
+	int				i = 0;
+
+	oldcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+	foreach (cell, key_states)
+	{
+		ExprState  *kstate = lfirst(cell);
+		Datum		value;
+		bool		isnull;
+
+		value = ExecEvalExpr(kstate, econtext, &isnull, NULL);
+		if (isnull)
+		{
+			result = false;
+			break;
+		}
+		keys[i] = gpuhashjoin_normalize_key(key_types[i], value);
+		i++;
+	}
+	MemoryContextSwitchTo(oldcxt);
+
+	return result;
+}
+
+/*
+ * gpuhashjoin_build_hashtable
+ *
+ * It loads all the tuples from the inner relation, then builds a hash
+ * table on the shared memory segment. The inner tuples themselves are
+ * kept in the backend private memory, and the hash-items have index of
+ * them.
+ */
+static void
+gpuhashjoin_build_hashtable(GpuHashJoinState *ghjs)
+{
+	PlanState	   *inner_ps = innerPlanState(ghjs);
+	ExprContext	   *econtext = ghjs->cps.ps.ps_ExprContext;
+	int				nkeys = list_length(ghjs->inner_keys);
+	Size			item_len = KERN_HASH_ITEM_LENGTH(nkeys);
+	pgstrom_hash_table *htable;
+	MemoryContext	oldcxt;
+	cl_ulong	   *keybuf;
+	cl_uint			nitems = 0;
+	cl_uint			nrooms = 1024;
+	cl_uint			nslots;
+	cl_uint			offset;
+	cl_uint			i;
+	Size			length;
+	struct timeval	tv1, tv2;
+
+	if (ghjs->pfm.enabled)
+		gettimeofday(&tv1, NULL);
+
+	oldcxt = MemoryContextSwitchTo(ghjs->cps.ps.state->es_query_cxt);
+	ghjs->inner_tuples = palloc(sizeof(HeapTuple) * nrooms);
+	keybuf = palloc(sizeof(cl_ulong) * nkeys * nrooms);
+	for (;;)
+	{
+		TupleTableSlot *slot = ExecProcNode(inner_ps);
+
+		if (TupIsNull(slot))
+			break;
+
+		if (nitems == nrooms)
+		{
+			nrooms *= 2;
+			ghjs->inner_tuples = repalloc(ghjs->inner_tuples,
+										  sizeof(HeapTuple) * nrooms);
+			keybuf = repalloc(keybuf, sizeof(cl_ulong) * nkeys * nrooms);
+		}
+		ResetExprContext(econtext);
+		econtext->ecxt_innertuple = slot;
+		/* inner tuples with null keys never match on inner join */
+		if (!gpuhashjoin_eval_keys(ghjs->inner_keys,
+								   ghjs->inner_key_types,
+								   econtext,
+								   keybuf + nkeys * nitems))
+			continue;
+		ghjs->inner_tuples[nitems++] = ExecCopySlotTuple(slot);
+	}
+	MemoryContextSwitchTo(oldcxt);
+
+	/*
+	 * Construction of the hash table on the shared memory segment
+	 */
+	nslots = Max(nitems, 128);
+	length = (offsetof(pgstrom_hash_table, kern) +
+			  STROMALIGN(offsetof(kern_hash_table, slots[nslots])) +
+			  item_len * nitems);
+	if (length >= (Size) UINT_MAX)
+		elog(ERROR, "hash table of inner relation is too large");
+
+	htable = pgstrom_shmem_alloc(length);
+	if (!htable)
+		elog(ERROR, "out of shared memory");
+	memset(&htable->msg, 0, sizeof(pgstrom_message));
+	htable->msg.stag = StromTag_HashJoinTable;
+	SpinLockInit(&htable->msg.lock);
+	htable->msg.refcnt = 1;
+	htable->msg.cb_release = gpuhashjoin_put_hash_table;
+	htable->msg.dindex = -1;
+	pgstrom_track_object(&htable->msg.stag);
+
+	htable->kern.length = length - offsetof(pgstrom_hash_table, kern);
+	htable->kern.nslots = nslots;
+	htable->kern.nkeys = nkeys;
+	htable->kern.nitems = nitems;
+	memset(htable->kern.slots, 0, sizeof(cl_uint) * nslots);
+
+	offset = STROMALIGN(offsetof(kern_hash_table, slots[nslots]));
+	for (i=0; i < nitems; i++)
+	{
+		kern_hash_item *khitem
+			= (kern_hash_item *)((char *)&htable->kern + offset);
+		cl_ulong	   *keys = keybuf + nkeys * i;
+		cl_uint			hindex;
+
+		khitem->hash = kern_hash_keys(keys, nkeys);
+		khitem->rindex = i;
+		khitem->__padding = 0;
+		memcpy(khitem->keydata, keys, sizeof(cl_ulong) * nkeys);
+
+		hindex = khitem->hash % nslots;
+		khitem->next = htable->kern.slots[hindex];
+		htable->kern.slots[hindex] = offset;
+		offset += item_len;
+	}
+	Assert(offset == htable->kern.length);
+	Assert(pgstrom_shmem_sanitycheck(htable));
+	pfree(keybuf);
+
+	ghjs->htable = htable;
+
+	if (ghjs->pfm.enabled)
+	{
+		gettimeofday(&tv2, NULL);
+		ghjs->pfm.time_to_load += timeval_diff(&tv1, &tv2);
+	}
+}
+
+/*
+ * gpuhashjoin_release_hashtable
+ *
+ * It unlinks the hash table and inner tuples, if any.
+ */
+static void
+gpuhashjoin_release_hashtable(GpuHashJoinState *ghjs)
+{
+	pgstrom_hash_table *htable = ghjs->htable;
+	cl_uint		i;
+
+	if (!htable)
+		return;
+
+	for (i=0; i < htable->kern.nitems; i++)
+		heap_freetuple(ghjs->inner_tuples[i]);
+	pfree(ghjs->inner_tuples);
+	ghjs->inner_tuples = NULL;
+
+	pgstrom_untrack_object(&htable->msg.stag);
+	pgstrom_put_message(&htable->msg);
+	ghjs->htable = NULL;
+}
+
+/*
+ * pgstrom_create_gpuhashjoin
+ *
+ * It constructs a pgstrom_gpuhashjoin message towards the supplied outer
+ * row-store. The result buffer has room for pairs according to the row
+ * population ratio by planner estimation. If device found more pairs
+ * than estimation, this chunk shall be probed on the host again.
+ */
+static pgstrom_gpuhashjoin *
+pgstrom_create_gpuhashjoin(GpuHashJoinState *ghjs, pgstrom_row_store *rstore)
+{
+	pgstrom_gpuhashjoin *ghjoin;
+	kern_parambuf	   *kparam;
+	kern_resultbuf	   *kresult;
+	pgstrom_hash_table *htable = ghjs->htable;
+	int			extra_flags;
+	double		npairs;
+	cl_uint		nrooms;
+	Size		length;
+	bool		kernel_debug;
+
+	/*
+	 * check status of pg_strom.kernel_debug
+	 */
+	extra_flags = pgstrom_get_devprog_extra_flags(ghjs->dprog_key);
+	if ((extra_flags & DEVKERNEL_NEEDS_DEBUG) != 0)
+		kernel_debug = true;
+	else
+		kernel_debug = false;
+
+	/* expected number of pairs, with a margin */
+	npairs = ((double) rstore->kern.nrows *
+			  Max(ghjs->row_population_ratio, 1.0) * 1.2 + 32.0);
+	nrooms = 2 * (cl_uint) Min(npairs, (double) (INT_MAX / 4));
+
+	length = (STROMALIGN(offsetof(pgstrom_gpuhashjoin, kern.kparam)) +
+			  STROMALIGN(ghjs->kparambuf->length) +
+			  STROMALIGN(offsetof(kern_resultbuf, results[nrooms])) +
+			  (kernel_debug ? KERNEL_DEBUG_BUFSIZE : 0));
+	ghjoin = pgstrom_shmem_alloc(length);
+	if (!ghjoin)
+	{
+		pgstrom_shmem_free(rstore);
+		elog(ERROR, "out of shared memory");
+	}
+	/* Fields of pgstrom_gpuhashjoin */
+	memset(ghjoin, 0, sizeof(pgstrom_gpuhashjoin));
+	ghjoin->msg.stag = StromTag_HashJoin;
+	SpinLockInit(&ghjoin->msg.lock);
+	ghjoin->msg.refcnt = 1;
+	ghjoin->msg.respq = pgstrom_get_queue(ghjs->mqueue);
+	ghjoin->msg.cb_process = clserv_process_gpuhashjoin;
+	ghjoin->msg.cb_release = clserv_put_gpuhashjoin;
+	ghjoin->msg.dindex = -1;
+	ghjoin->msg.pfm.enabled = ghjs->pfm.enabled;
+	ghjoin->dprog_key = pgstrom_retain_devprog_key(ghjs->dprog_key);
+	ghjoin->rstore = rstore;
+
+	/* the message holds its own reference on the hash table */
+	SpinLockAcquire(&htable->msg.lock);
+	htable->msg.refcnt++;
+	SpinLockRelease(&htable->msg.lock);
+	ghjoin->htable = htable;
+
+	/* kern_parambuf */
+	kparam = &ghjoin->kern.kparam;
+	memcpy(kparam, ghjs->kparambuf, ghjs->kparambuf->length);
+	Assert(ghjs->kparambuf->length == STROMALIGN(ghjs->kparambuf->length));
+
+	/* kern_resultbuf portion */
+	kresult = KERN_HASHJOIN_RESULTBUF(&ghjoin->kern);
+	kresult->nrooms = nrooms;
+	kresult->nitems = 0;
+	kresult->debug_nums = 0;
+	kresult->debug_usage = (kernel_debug ? 0 : KERN_DEBUG_UNAVAILABLE);
+	kresult->errcode = 0;
+	kresult->flags = 0;
+
+	Assert(pgstrom_shmem_sanitycheck(ghjoin));
+
+	/* track local object */
+	pgstrom_track_object(&ghjoin->msg.stag);
+
+	return ghjoin;
+}
+
+static pgstrom_gpuhashjoin *
+pgstrom_load_gpuhashjoin(GpuHashJoinState *ghjs)
+{
+	pgstrom_gpuhashjoin *ghjoin;
+	pgstrom_row_store  *rstore;
+	bool		scan_done;
+	struct timeval tv1, tv2;
+
+	if (ghjs->pfm.enabled)
+		gettimeofday(&tv1, NULL);
+	rstore = pgstrom_load_row_store_subplan(outerPlanState(ghjs),
+											&ghjs->outer_overflow,
+											ghjs->rs_colmeta,
+											ghjs->cs_colmeta,
+											ghjs->cs_colnums,
+											&scan_done);
+	if (scan_done)
+		ghjs->outer_done = true;
+	if (!rstore)
+		return NULL;
+	if (ghjs->pfm.enabled)
+		gettimeofday(&tv2, NULL);
+
+	ghjoin = pgstrom_create_gpuhashjoin(ghjs, rstore);
+	if (ghjoin->msg.pfm.enabled)
+		ghjoin->msg.pfm.time_to_load += timeval_diff(&tv1, &tv2);
+
+	return ghjoin;
+}
+
+/*
+ * gpuhashjoin_probe_host
+ *
+ * It probes the hash table by the outer row-store on the host side, if
+ * device could not write back all the pairs due to lack of result buffer,
+ * or could not compute the hash keys of some rows.
+ */
+static void
+gpuhashjoin_probe_host(GpuHashJoinState *ghjs, pgstrom_gpuhashjoin *ghjoin)
+{
+	kern_row_store	   *krs = &ghjoin->rstore->kern;
+	kern_hash_table	   *khtable = &ghjoin->htable->kern;
+	ExprContext		   *econtext = ghjs->cps.ps.ps_ExprContext;
+	cl_ulong		   *keys = ghjs->key_values;
+	cl_int			   *results;
+	cl_uint				nrooms;
+	cl_uint				nitems = 0;
+	cl_uint				i;
+	MemoryContext		oldcxt;
+
+	oldcxt = MemoryContextSwitchTo(ghjs->cps.ps.state->es_query_cxt);
+	nrooms = KERN_HASHJOIN_RESULTBUF(&ghjoin->kern)->nitems + 32;
+	results = palloc(sizeof(cl_int) * 2 * nrooms);
+	for (i=0; i < krs->nrows; i++)
+	{
+		rs_tuple	   *rs_tup = kern_rowstore_get_tuple(krs, i);
+		kern_hash_item *khitem = NULL;
+		cl_uint			hash;
+
+		if (!rs_tup)
+			continue;
+		ExecStoreTuple(&rs_tup->htup, ghjs->outer_slot, InvalidBuffer, false);
+		ResetExprContext(econtext);
+		econtext->ecxt_outertuple = ghjs->outer_slot;
+		if (!gpuhashjoin_eval_keys(ghjs->outer_keys,
+								   ghjs->outer_key_types,
+								   econtext, keys))
+			continue;
+
+		hash = kern_hash_keys(keys, khtable->nkeys);
+		while ((khitem = kern_hash_lookup(khtable, khitem,
+										  hash, keys)) != NULL)
+		{
+			if (nitems == nrooms)
+			{
+				nrooms *= 2;
+				results = repalloc(results, sizeof(cl_int) * 2 * nrooms);
+			}
+			results[2 * nitems] = i + 1;
+			results[2 * nitems + 1] = khitem->rindex + 1;
+			nitems++;
+		}
+	}
+	MemoryContextSwitchTo(oldcxt);
+
+	ghjs->host_results = results;
+	ghjs->curr_results = results;
+	ghjs->curr_nitems = nitems;
+	ghjs->num_host_probed++;
+}
+
+/*
+ * gpuhashjoin_release_chunks
+ *
+ * It releases the current chunk and the chunks already replied, then
+ * waits for completion of the chunks being in-flight, to release them.
+ */
+static void
+gpuhashjoin_release_chunk(GpuHashJoinState *ghjs, pgstrom_message *msg)
+{
+	if (msg->pfm.enabled)
+	{
+		pgstrom_perfmon_add(&ghjs->pfm, &msg->pfm);
+		pgstrom_perfmon_stat(msg);
+	}
+	Assert(msg->refcnt == 1);
+	pgstrom_untrack_object(&msg->stag);
+	msg->cb_release(msg);
+}
+
+static void
+gpuhashjoin_release_chunks(GpuHashJoinState *ghjs)
+{
+	pgstrom_message	   *msg;
+
+	if (ghjs->curr_chunk)
+	{
+		gpuhashjoin_release_chunk(ghjs, &ghjs->curr_chunk->msg);
+		ghjs->curr_chunk = NULL;
+	}
+	if (ghjs->host_results)
+	{
+		pfree(ghjs->host_results);
+		ghjs->host_results = NULL;
+	}
+	ghjs->curr_results = NULL;
+	ghjs->curr_nitems = 0;
+	ghjs->curr_index = 0;
+
+	while (!dlist_is_empty(&ghjs->ready_chunks))
+	{
+		msg = dlist_container(pgstrom_message, chain,
+							  dlist_pop_head_node(&ghjs->ready_chunks));
+		gpuhashjoin_release_chunk(ghjs, msg);
+	}
+
+	while (ghjs->num_running > 0)
+	{
+		msg = pgstrom_dequeue_message(ghjs->mqueue);
+		if (!msg)
+			elog(ERROR, "message queue wait timeout");
+		ghjs->num_running--;
+		gpuhashjoin_release_chunk(ghjs, msg);
+	}
+}
+
+/*
+ * gpuhashjoin_next_chunk
+ *
+ * It picks up the next chunk already probed, with launching asynchronous
+ * chunks as gpuscan_exec doing. It returns false if no more chunks.
+ */
+static bool
+gpuhashjoin_next_chunk(GpuHashJoinState *ghjs)
+{
+	pgstrom_message	   *msg;
+	pgstrom_gpuhashjoin *ghjoin;
+	kern_resultbuf	   *kresult;
+
+	/*
+	 * Release the current gpuhashjoin chunk being already scanned
+	 */
+	if (ghjs->curr_chunk)
+	{
+		gpuhashjoin_release_chunk(ghjs, &ghjs->curr_chunk->msg);
+		ghjs->curr_chunk = NULL;
+	}
+	if (ghjs->host_results)
+	{
+		pfree(ghjs->host_results);
+		ghjs->host_results = NULL;
+	}
+	ghjs->curr_results = NULL;
+	ghjs->curr_nitems = 0;
+	ghjs->curr_index = 0;
+
+	/*
+	 * Dequeue the current gpuhashjoin chunks being already processed
+	 */
+	while ((msg = pgstrom_try_dequeue_message(ghjs->mqueue)) != NULL)
+	{
+		Assert(ghjs->num_running > 0);
+		ghjs->num_running--;
+		dlist_push_tail(&ghjs->ready_chunks, &msg->chain);
+	}
+
+	/*
+	 * Try to keep number of chunks being asynchronously executed larger
+	 * than minimum multiplicity, unless it does not exceed maximum one
+	 * and OpenCL server does not return a new response.
+	 */
+	while (!ghjs->outer_done &&
+		   ghjs->num_running <= pgstrom_max_async_chunks)
+	{
+		ghjoin = pgstrom_load_gpuhashjoin(ghjs);
+		if (!ghjoin)
+			break;
+
+		if (!pgstrom_enqueue_message(&ghjoin->msg))
+		{
+			pgstrom_untrack_object(&ghjoin->msg.stag);
+			ghjoin->msg.cb_release(&ghjoin->msg);
+			elog(ERROR, "failed to enqueue pgstrom_gpuhashjoin message");
+		}
+		ghjs->num_running++;
+
+		if (ghjs->num_running > pgstrom_min_async_chunks &&
+			(msg = pgstrom_try_dequeue_message(ghjs->mqueue)) != NULL)
+		{
+			ghjs->num_running--;
+			dlist_push_tail(&ghjs->ready_chunks, &msg->chain);
+			break;
+		}
+	}
+
+	/*
+	 * Wait for server's response if no available chunks were replied.
+	 */
+	if (dlist_is_empty(&ghjs->ready_chunks))
+	{
+		/* OK, no more chunks to be probed */
+		if (ghjs->num_running == 0)
+			return false;
+
+		msg = pgstrom_dequeue_message(ghjs->mqueue);
+		if (!msg)
+			elog(ERROR, "message queue wait timeout");
+		ghjs->num_running--;
+		dlist_push_tail(&ghjs->ready_chunks, &msg->chain);
+	}
+
+	/*
+	 * Picks up next available chunks
+	 */
+	Assert(!dlist_is_empty(&ghjs->ready_chunks));
+	ghjoin = dlist_container(pgstrom_gpuhashjoin, msg.chain,
+							 dlist_pop_head_node(&ghjs->ready_chunks));
+	Assert(ghjoin->msg.stag == StromTag_HashJoin);
+	ghjs->curr_chunk = ghjoin;
+
+	/*
+	 * Raise an error, if chunk-level error was reported. Lack of result
+	 * buffer is not an error; we probe the chunk on the host instead.
+	 */
+	kresult = KERN_HASHJOIN_RESULTBUF(&ghjoin->kern);
+	if (ghjoin->msg.errcode == StromError_DataStoreNoSpace ||
+		ghjoin->msg.errcode == StromError_RowReCheck)
+		gpuhashjoin_probe_host(ghjs, ghjoin);
+	else if (ghjoin->msg.errcode != StromError_Success)
+	{
+		if (ghjoin->msg.errcode == CL_BUILD_PROGRAM_FAILURE)
+		{
+			const char *buildlog
+				= pgstrom_get_devprog_errmsg(ghjoin->dprog_key);
+			const char *kern_source
+				= ((GpuHashJoinPlan *)ghjs->cps.ps.plan)->kern_source;
+
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+					 errmsg("PG-Strom: OpenCL execution error (%s)\n%s",
+							pgstrom_strerror(ghjoin->msg.errcode),
+							kern_source),
+					 errdetail("%s", buildlog)));
+		}
+		else
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INTERNAL_ERROR),
+					 errmsg("PG-Strom: OpenCL execution error (%s)",
+							pgstrom_strerror(ghjoin->msg.errcode))));
+		}
+	}
+	else
+	{
+		Assert(2 * kresult->nitems <= kresult->nrooms);
+		ghjs->curr_results = kresult->results;
+		ghjs->curr_nitems = kresult->nitems;
+	}
+	return true;
+}
+
+static TupleTableSlot *
+gpuhashjoin_exec(CustomPlanState *node)
+{
+	GpuHashJoinState   *ghjs = (GpuHashJoinState *) node;
+	ExprContext		   *econtext = ghjs->cps.ps.ps_ExprContext;
+	List			   *joinqual = ghjs->cps.ps.qual;
+
+	/* load the inner relation and build its hash table on the first call */
+	if (!ghjs->htable)
+		gpuhashjoin_build_hashtable(ghjs);
+	/* no need to scan the outer relation, if inner is empty */
+	if (ghjs->htable->kern.nitems == 0)
+		return NULL;
+
+	for (;;)
+	{
+		while (ghjs->curr_index < ghjs->curr_nitems)
+		{
+			pgstrom_row_store *rstore = ghjs->curr_chunk->rstore;
+			cl_int	   *pair = &ghjs->curr_results[2 * ghjs->curr_index++];
+			rs_tuple   *rs_tup;
+
+			Assert(pair[0] > 0 && pair[0] <= rstore->kern.nrows);
+			Assert(pair[1] > 0 && pair[1] <= ghjs->htable->kern.nitems);
+			rs_tup = kern_rowstore_get_tuple(&rstore->kern, pair[0] - 1);
+			ExecStoreTuple(&rs_tup->htup, ghjs->outer_slot,
+						   InvalidBuffer, false);
+			ExecStoreTuple(ghjs->inner_tuples[pair[1] - 1], ghjs->inner_slot,
+						   InvalidBuffer, false);
+
+			ResetExprContext(econtext);
+			econtext->ecxt_outertuple = ghjs->outer_slot;
+			econtext->ecxt_innertuple = ghjs->inner_slot;
+			if (joinqual == NIL || ExecQual(joinqual, econtext, false))
+				return ExecProject(ghjs->cps.ps.ps_ProjInfo, NULL);
+			InstrCountFiltered1(node, 1);
+		}
+
+		if (!gpuhashjoin_next_chunk(ghjs))
+			break;
+	}
+	return NULL;
+}
+
+static Node *
+gpuhashjoin_exec_multi(CustomPlanState *node)
+{
+	elog(ERROR, "not implemented yet");
+}
+
+static void
+gpuhashjoin_end(CustomPlanState *node)
+{
+	GpuHashJoinState   *ghjs = (GpuHashJoinState *) node;
+
+	/*
+	 * release chunks, hash table and device program
+	 */
+	gpuhashjoin_release_chunks(ghjs);
+	gpuhashjoin_release_hashtable(ghjs);
+	if (ghjs->outer_overflow)
+		heap_freetuple(ghjs->outer_overflow);
+
+	pgstrom_put_devprog_key(ghjs->dprog_key);
+	pgstrom_untrack_object((StromTag *)ghjs->dprog_key);
+	pgstrom_untrack_object(&ghjs->mqueue->stag);
+	pgstrom_close_queue(ghjs->mqueue);
+
+	/*
+	 * Free the exprcontext
+	 */
+	ExecFreeExprContext(&ghjs->cps.ps);
+
+	/*
+	 * clean out the tuple table
+	 */
+	ExecClearTuple(ghjs->cps.ps.ps_ResultTupleSlot);
+	ExecClearTuple(ghjs->outer_slot);
+	ExecClearTuple(ghjs->inner_slot);
+
+	/*
+	 * clean up subtrees
+	 */
+	ExecEndNode(outerPlanState(ghjs));
+	ExecEndNode(innerPlanState(ghjs));
+}
+
+static void
+gpuhashjoin_rescan(CustomPlanState *node)
+{
+	GpuHashJoinState   *ghjs = (GpuHashJoinState *) node;
+
+	gpuhashjoin_release_chunks(ghjs);
+	if (ghjs->outer_overflow)
+	{
+		heap_freetuple(ghjs->outer_overflow);
+		ghjs->outer_overflow = NULL;
+	}
+	ghjs->outer_done = false;
+
+	/*
+	 * We can reuse the hash table unless parameters of the inner plan
+	 * were changed. Elsewhere, the inner plan shall be re-scanned by the
+	 * first ExecProcNode on rebuild.
+	 */
+	if (innerPlanState(ghjs)->chgParam != NULL)
+		gpuhashjoin_release_hashtable(ghjs);
+
+	if (outerPlanState(ghjs)->chgParam == NULL)
+		ExecReScan(outerPlanState(ghjs));
+}
+
+static void
+gpuhashjoin_explain_rel(CustomPlanState *node, ExplainState *es)
+{
+	/* no target relation for join */
+}
+
+static void
+gpuhashjoin_explain(CustomPlanState *node, List *ancestors, ExplainState *es)
+{
+	GpuHashJoinState   *ghjs = (GpuHashJoinState *) node;
+	GpuHashJoinPlan	   *ghjoin = (GpuHashJoinPlan *) ghjs->cps.ps.plan;
+	char				buf[256];
+
+	show_scan_qual(ghjoin->hash_clauses,
+				   "Hash Cond", &ghjs->cps.ps, ancestors, es);
+	if (ghjoin->cplan.plan.qual != NIL)
+	{
+		show_scan_qual(ghjoin->cplan.plan.qual,
+					   "Join Filter", &ghjs->cps.ps, ancestors, es);
+		show_instrumentation_count("Rows Removed by Join Filter",
+								   1, &ghjs->cps.ps, es);
+	}
+	if (es->analyze && ghjs->htable)
+	{
+		ExplainPropertyLong("Hash Items", ghjs->htable->kern.nitems, es);
+		snprintf(buf, sizeof(buf), "%uKB",
+				 (ghjs->htable->kern.length + 1023) / 1024);
+		ExplainPropertyText("Hash Table Size", buf, es);
+		ExplainPropertyLong("Chunks Probed on Host",
+							ghjs->num_host_probed, es);
+	}
+	show_device_kernel(ghjs->dprog_key, es);
+
+	if (es->analyze && ghjs->pfm.enabled)
+		pgstrom_perfmon_explain(&ghjs->pfm, es);
+}
+
+static Bitmapset *
+gpuhashjoin_get_relids(CustomPlanState *node)
+{
+	/* nothing to do because core backend walks down inner/outer subtree */
+	return NULL;
+}
+
+static void
+gpuhashjoin_textout_plan(StringInfo str, const CustomPlan *node)
+{
+	GpuHashJoinPlan	   *plannode = (GpuHashJoinPlan *)node;
+	char			   *temp;
+
+	appendStringInfo(str, " :jointype %d", (int) plannode->jointype);
+
+	appendStringInfo(str, " :kern_source ");
+	_outToken(str, plannode->kern_source);
+
+	appendStringInfo(str, " :extra_flags %u", plannode->extra_flags);
+
+	temp = nodeToString(plannode->used_params);
+	appendStringInfo(str, " :used_params %s", temp);
+	pfree(temp);
+
+	temp = nodeToString(plannode->hash_clauses);
+	appendStringInfo(str, " :hash_clauses %s", temp);
+	pfree(temp);
+
+	temp = nodeToString(plannode->outer_keys);
+	appendStringInfo(str, " :outer_keys %s", temp);
+	pfree(temp);
+
+	temp = nodeToString(plannode->inner_keys);
+	appendStringInfo(str, " :inner_keys %s", temp);
+	pfree(temp);
+
+	appendStringInfo(str, " :outer_attnums ");
+	_outBitmapset(str, plannode->outer_attnums);
+
+	appendStringInfo(str, " :row_population_ratio %.2f",
+					 plannode->row_population_ratio);
+}
+
+static CustomPlan *
+gpuhashjoin_copy_plan(const CustomPlan *from)
+{
+	GpuHashJoinPlan	   *oldnode = (GpuHashJoinPlan *)from;
+	GpuHashJoinPlan	   *newnode = palloc0(sizeof(GpuHashJoinPlan));
+
+	CopyCustomPlanCommon((Node *)from, (Node *)newnode);
+	newnode->jointype = oldnode->jointype;
+	newnode->kern_source = pstrdup(oldnode->kern_source);
+	newnode->extra_flags = oldnode->extra_flags;
+	newnode->used_params = copyObject(oldnode->used_params);
+	newnode->hash_clauses = copyObject(oldnode->hash_clauses);
+	newnode->outer_keys = copyObject(oldnode->outer_keys);
+	newnode->inner_keys = copyObject(oldnode->inner_keys);
+	newnode->outer_attnums = bms_copy(oldnode->outer_attnums);
+	newnode->row_population_ratio = oldnode->row_population_ratio;
+
+	return &newnode->cplan;
+}
+
+void
+pgstrom_init_gpuhashjoin(void)
+{
+	/* GUC definition */
+	DefineCustomBoolVariable("pgstrom.enable_gpuhashjoin",
+							 "Enables the planner's use of GPU hash-join plans.",
+							 NULL,
+							 &enable_gpuhashjoin,
+							 true,
+							 PGC_USERSET,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+
+	/* setup path methods */
+	gpuhashjoin_path_methods.CustomName			= "GpuHashJoin";
+	gpuhashjoin_path_methods.CreateCustomPlan	= gpuhashjoin_create_plan;
+	gpuhashjoin_path_methods.TextOutCustomPath	= gpuhashjoin_textout_path;
+
+	/* setup plan methods */
+	gpuhashjoin_plan_methods.CustomName			= "GpuHashJoin";
+	gpuhashjoin_plan_methods.SetCustomPlanRef	= gpuhashjoin_set_plan_ref;
+	gpuhashjoin_plan_methods.SupportBackwardScan= NULL;
+	gpuhashjoin_plan_methods.FinalizeCustomPlan	= gpuhashjoin_finalize_plan;
+	gpuhashjoin_plan_methods.BeginCustomPlan	= gpuhashjoin_begin;
+	gpuhashjoin_plan_methods.ExecCustomPlan		= gpuhashjoin_exec;
+	gpuhashjoin_plan_methods.MultiExecCustomPlan= gpuhashjoin_exec_multi;
+	gpuhashjoin_plan_methods.EndCustomPlan		= gpuhashjoin_end;
+	gpuhashjoin_plan_methods.ReScanCustomPlan	= gpuhashjoin_rescan;
+	gpuhashjoin_plan_methods.ExplainCustomPlanTargetRel
+		= gpuhashjoin_explain_rel;
+	gpuhashjoin_plan_methods.ExplainCustomPlan	= gpuhashjoin_explain;
+	gpuhashjoin_plan_methods.GetRelidsCustomPlan= gpuhashjoin_get_relids;
+	gpuhashjoin_plan_methods.GetSpecialCustomVar= NULL;
+	gpuhashjoin_plan_methods.TextOutCustomPlan	= gpuhashjoin_textout_plan;
+	gpuhashjoin_plan_methods.CopyCustomPlan		= gpuhashjoin_copy_plan;
+
+	/* hook registration */
+	add_join_path_next = add_join_path_hook;
+	add_join_path_hook = gpuhashjoin_add_join_path;
+}
+
+/*
+ * GpuHashJoin message handler
+ * ------------------------------------------------------------
+ * Note that below routines are executed in the context of OpenCL
+ * intermediation server, thus, usual PostgreSQL internal APIs are
+ * not available, and need to pay attention that routines work in
+ * another process's address space.
+ */
+typedef struct
+{
+	pgstrom_message	*msg;
+	cl_program		program;
+	cl_kernel		kernel;
+	cl_mem			m_hashjoin;
+	cl_mem			m_htable;
+	cl_mem			m_rstore;
+	cl_mem			m_cstore;
+	bool			htable_mapped;	/* m_htable is mapped on host memory */
+	bool			rstore_mapped;	/* m_rstore is mapped on host memory */
+	Size			dma_length;	/* length of DMA send, for scheduler */
+	cl_int			ev_kern;	/* index of the kernel execution event */
+	cl_int			ev_index;
+	cl_event		events[6];
+} clstate_gpuhashjoin;
+
+static void
+clserv_respond_gpuhashjoin(cl_event event, cl_int ev_status, void *private)
+{
+	clstate_gpuhashjoin	*clghj = private;
+	pgstrom_gpuhashjoin	*ghjoin = (pgstrom_gpuhashjoin *)clghj->msg;
+	kern_resultbuf		*kresult = KERN_HASHJOIN_RESULTBUF(&ghjoin->kern);
+	cl_ulong			time_dma = 0;
+	cl_ulong			time_kern = 0;
+
+	/* put error code */
+	if (ev_status != CL_COMPLETE)
+	{
+		elog(LOG, "unexpected CL_EVENT_COMMAND_EXECUTION_STATUS: %d",
+			 ev_status);
+		ghjoin->msg.errcode = StromError_OpenCLInternal;
+	}
+	else
+	{
+		ghjoin->msg.errcode = kresult->errcode;
+	}
+
+	/*
+	 * collect performance statistics; see the comments in
+	 * clserv_respond_gpuscan
+	 */
+	if (ev_status == CL_COMPLETE)
+	{
+		cl_ulong	dma_send_begin = ~0UL;
+		cl_ulong	dma_send_end = 0;
+		cl_ulong	kern_exec_begin;
+		cl_ulong	kern_exec_end;
+		cl_ulong	dma_recv_begin;
+		cl_ulong	dma_recv_end;
+		cl_ulong	tv_begin;
+		cl_ulong	tv_end;
+		cl_ulong	time_overlap;
+		cl_int		i, rc;
+
+		for (i=0; i < clghj->ev_kern; i++)
+		{
+			rc = clserv_get_event_profiling(clghj->events[i],
+											&tv_begin, &tv_end);
+			if (rc != CL_SUCCESS)
+				goto skip_perfmon;
+			dma_send_begin = Min(dma_send_begin, tv_begin);
+			dma_send_end = Max(dma_send_end, tv_end);
+		}
+
+		rc = clserv_get_event_profiling(clghj->events[clghj->ev_kern],
+										&kern_exec_begin, &kern_exec_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+
+		rc = clserv_get_event_profiling(clghj->events[clghj->ev_kern + 1],
+										&dma_recv_begin, &dma_recv_end);
+		if (rc != CL_SUCCESS)
+			goto skip_perfmon;
+
+		time_dma = ((dma_send_end - dma_send_begin) +
+					(dma_recv_end - dma_recv_begin)) / 1000;
+		time_kern = (kern_exec_end - kern_exec_begin) / 1000;
+		time_overlap = pgstrom_opencl_device_overlap(&ghjoin->msg,
+													 dma_send_begin,
+													 dma_send_end,
+													 kern_exec_begin,
+													 kern_exec_end,
+													 dma_recv_begin,
+													 dma_recv_end);
+
+		if (ghjoin->msg.pfm.enabled)
+		{
+			ghjoin->msg.pfm.time_dma_send
+				+= (dma_send_end - dma_send_begin) / 1000;
+			ghjoin->msg.pfm.time_kern_exec
+				+= (kern_exec_end - kern_exec_begin) / 1000;
+			ghjoin->msg.pfm.time_dma_recv
+				+= (dma_recv_end - dma_recv_begin) / 1000;
+			ghjoin->msg.pfm.time_dma_overlap += time_overlap;
+		}
+
+	skip_perfmon:
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clGetEventProfilingInfo (%s)",
+				 opencl_strerror(rc));
+			ghjoin->msg.pfm.enabled = false;	/* turn off profiling */
+		}
+	}
+	/* record the commands on the profiling timeline, if enabled */
+	if (ev_status == CL_COMPLETE)
+		clserv_timeline_record(&ghjoin->msg, clghj->events, clghj->ev_index,
+							   clghj->ev_kern, clghj->ev_kern + 1);
+
+	/* inform the device scheduler of completion */
+	pgstrom_opencl_device_complete(&ghjoin->msg, clghj->dma_length,
+								   time_dma, time_kern);
+
+	/* dump debug messages */
+	pgstrom_dump_kernel_debug(LOG, kresult);
+
+	/* release opencl objects */
+	while (clghj->ev_index > 0)
+		clReleaseEvent(clghj->events[--clghj->ev_index]);
+	clserv_release_buffer(ghjoin->msg.dindex, clghj->m_cstore);
+	if (clghj->rstore_mapped)
+		clReleaseMemObject(clghj->m_rstore);
+	else
+		clserv_release_buffer(ghjoin->msg.dindex, clghj->m_rstore);
+	if (clghj->htable_mapped)
+		clReleaseMemObject(clghj->m_htable);
+	else
+		clserv_release_buffer(ghjoin->msg.dindex, clghj->m_htable);
+	clserv_release_buffer(ghjoin->msg.dindex, clghj->m_hashjoin);
+	clReleaseKernel(clghj->kernel);
+	clReleaseProgram(clghj->program);
+	free(clghj);
+
+	/* respond to the backend side */
+	pgstrom_reply_message(&ghjoin->msg);
+}
+
+static void
+clserv_process_gpuhashjoin(pgstrom_message *msg)
+{
+	pgstrom_gpuhashjoin *ghjoin = (pgstrom_gpuhashjoin *) msg;
+	kern_hash_table	   *khtable = &ghjoin->htable->kern;
+	kern_row_store	   *krstore = &ghjoin->rstore->kern;
+	kern_column_store  *kcstore_head = ghjoin->rstore->kcs_head;
+	clstate_gpuhashjoin *clghj;
+	cl_command_queue	kcmdq;
+	cl_command_queue	kcmdq_send;
+	cl_command_queue	kcmdq_recv;
+	cl_uint				nrows = krstore->nrows;
+	cl_uint				i;
+	cl_int				rc;
+	size_t				gwork_sz;
+	size_t				lwork_sz;
+
+	Assert(ghjoin->rstore->stag == StromTag_RowStore);
+
+	/* state object of gpuhashjoin */
+	clghj = malloc(sizeof(clstate_gpuhashjoin));
+	if (!clghj)
+	{
+		rc = CL_OUT_OF_HOST_MEMORY;
+		goto error0;
+	}
+	memset(clghj, 0, sizeof(clstate_gpuhashjoin));
+	clghj->msg = &ghjoin->msg;
+
+	/* see comments in clserv_process_gpuscan_row */
+	clghj->program = clserv_lookup_device_program(ghjoin->dprog_key,
+												  &ghjoin->msg);
+	if (!clghj->program)
+	{
+		free(clghj);
+		return;		/* message is in waitq, retry it! */
+	}
+	if (clghj->program == BAD_OPENCL_PROGRAM)
+	{
+		rc = CL_BUILD_PROGRAM_FAILURE;
+		goto error1;
+	}
+
+	clghj->kernel = clCreateKernel(clghj->program,
+								   "gpuhashjoin_probe_rs",
+								   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateKernel: %s", opencl_strerror(rc));
+		goto error2;
+	}
+
+	/*
+	 * Choose a device to execute this kernel. Hash table is sent to the
+	 * device for each chunk, so it is also a part of DMA send.
+	 */
+	clghj->dma_length = (KERN_HASHJOIN_LENGTH(&ghjoin->kern) +
+						 khtable->length + krstore->length);
+	i = pgstrom_opencl_device_schedule(&ghjoin->msg, clghj->dma_length);
+	kcmdq = opencl_cmdq[i];
+	kcmdq_send = opencl_cmdq_send[i];
+	kcmdq_recv = opencl_cmdq_recv[i];
+
+	/* and, compute an optimal workgroup-size of this kernel */
+	lwork_sz = clserv_compute_workgroup_size(clghj->kernel, i, nrows,
+											 sizeof(cl_uint));
+
+	/* allocation of device memory for kern_hashjoin argument */
+	clghj->m_hashjoin = clserv_create_buffer(ghjoin->msg.dindex,
+											 KERN_HASHJOIN_LENGTH(&ghjoin->kern),
+											 &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error3;
+	}
+
+	/* allocation of device memory for kern_hash_table argument */
+	clghj->m_htable = clserv_create_device_buffer(ghjoin->msg.dindex,
+												  khtable,
+												  khtable->length,
+												  &clghj->htable_mapped,
+												  &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error4;
+	}
+
+	/* allocation of device memory for kern_row_store argument */
+	clghj->m_rstore = clserv_create_device_buffer(ghjoin->msg.dindex,
+												  krstore,
+												  krstore->length,
+												  &clghj->rstore_mapped,
+												  &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error5;
+	}
+
+	/* allocation of device memory for kern_column_store argument */
+	clghj->m_cstore = clserv_create_buffer(ghjoin->msg.dindex,
+										   kcstore_head->length,
+										   &rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clCreateBuffer: %s", opencl_strerror(rc));
+		goto error6;
+	}
+
+	/*
+	 * OK, all the device memory and kernel objects acquired.
+	 * Let's prepare kernel invocation.
+	 *
+	 * The kernel call is:
+	 *   __kernel void
+	 *   gpuhashjoin_probe_rs(__global kern_hashjoin *khjoin,
+	 *                        __global kern_hash_table *khtable,
+	 *                        __global kern_row_store *krs,
+	 *                        __global kern_column_store *kcs,
+	 *                        __local void *local_workmem)
+	 */
+	rc = clSetKernelArg(clghj->kernel,
+						0,	/* kern_hashjoin */
+						sizeof(cl_mem),
+						&clghj->m_hashjoin);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	rc = clSetKernelArg(clghj->kernel,
+						1,	/* kern_hash_table */
+						sizeof(cl_mem),
+						&clghj->m_htable);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	rc = clSetKernelArg(clghj->kernel,
+						2,	/* kern_row_store */
+						sizeof(cl_mem),
+						&clghj->m_rstore);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	rc = clSetKernelArg(clghj->kernel,
+						3,	/* kern_column_store */
+						sizeof(cl_mem),
+						&clghj->m_cstore);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	rc = clSetKernelArg(clghj->kernel,
+						4,	/* local_workmem */
+						sizeof(cl_uint) * lwork_sz,
+						NULL);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetKernelArg: %s", opencl_strerror(rc));
+		goto error7;
+	}
+
+	/*
+	 * OK, enqueue DMA transfer, kernel execution, then DMA writeback.
+	 *
+	 * (1) kern_hashjoin, hash table, row-store and header portion of
+	 *     column-store shall be copied to the device memory
+	 * (2) kernel shall be launched
+	 * (3) kern_resultbuf shall be written back
+	 */
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clghj->m_hashjoin,
+									 0,
+									 KERN_HASHJOIN_DMA_SENDLEN(&ghjoin->kern),
+									 &ghjoin->kern,
+									 0,
+									 NULL,
+									 &clghj->events[clghj->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
+		goto error7;
+	}
+	clghj->ev_index++;
+
+	if (!clghj->htable_mapped)
+	{
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clghj->m_htable,
+										 0,
+										 khtable->length,
+										 khtable,
+										 0,
+										 NULL,
+										 &clghj->events[clghj->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clghj->ev_index++;
+	}
+
+	if (!clghj->rstore_mapped)
+	{
+		rc = clserv_enqueue_write_buffer(kcmdq_send,
+										 clghj->m_rstore,
+										 0,
+										 krstore->length,
+										 krstore,
+										 0,
+										 NULL,
+										 &clghj->events[clghj->ev_index]);
+		if (rc != CL_SUCCESS)
+		{
+			elog(LOG, "failed on clEnqueueWriteBuffer: %s",
+				 opencl_strerror(rc));
+			goto error_sync;
+		}
+		clghj->ev_index++;
+	}
+
+	rc = clserv_enqueue_write_buffer(kcmdq_send,
+									 clghj->m_cstore,
+									 0,
+									 offsetof(kern_column_store,
+											  colmeta[kcstore_head->ncols]),
+									 kcstore_head,
+									 0,
+									 NULL,
+									 &clghj->events[clghj->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueWriteBuffer: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	clghj->ev_index++;
+
+	/*
+	 * Kick gpuhashjoin_probe_rs() call
+	 */
+	gwork_sz = ((nrows + lwork_sz - 1) / lwork_sz) * lwork_sz;
+
+	clghj->ev_kern = clghj->ev_index;
+	rc = clEnqueueNDRangeKernel(kcmdq,
+								clghj->kernel,
+								1,
+								NULL,
+								&gwork_sz,
+								&lwork_sz,
+								clghj->ev_index,
+								&clghj->events[0],
+								&clghj->events[clghj->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueNDRangeKernel: %s",
+			 opencl_strerror(rc));
+		goto error_sync;
+	}
+	clghj->ev_index++;
+
+	/*
+	 * Write back the result-buffer
+	 */
+	rc = clserv_enqueue_read_buffer(kcmdq_recv,
+									clghj->m_hashjoin,
+									((uintptr_t)
+									 KERN_HASHJOIN_RESULTBUF(&ghjoin->kern) -
+									 (uintptr_t)(&ghjoin->kern)),
+									KERN_HASHJOIN_DMA_RECVLEN(&ghjoin->kern),
+									KERN_HASHJOIN_RESULTBUF(&ghjoin->kern),
+									1,
+									&clghj->events[clghj->ev_index - 1],
+									&clghj->events[clghj->ev_index]);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clEnqueueReadBuffer: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	clghj->ev_index++;
+	Assert(clghj->ev_index <= lengthof(clghj->events));
+
+	/* submit the commands on the transfer and compute queues */
+	clserv_flush_device_queues(ghjoin->msg.dindex);
+
+	/*
+	 * Last, registers a callback routine that replies the message
+	 * to the backend
+	 */
+	rc = clserv_set_event_callback(clghj->events[clghj->ev_index - 1],
+								   clserv_respond_gpuhashjoin,
+								   clghj);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clSetEventCallback: %s", opencl_strerror(rc));
+		goto error_sync;
+	}
+	return;
+
+error_sync:
+	/* see comments in clserv_process_gpuscan_row */
+	clWaitForEvents(clghj->ev_index, clghj->events);
+	while (clghj->ev_index > 0)
+		clReleaseEvent(clghj->events[--clghj->ev_index]);
+error7:
+	clserv_release_buffer(ghjoin->msg.dindex, clghj->m_cstore);
+error6:
+	if (clghj->rstore_mapped)
+		clReleaseMemObject(clghj->m_rstore);
+	else
+		clserv_release_buffer(ghjoin->msg.dindex, clghj->m_rstore);
+error5:
+	if (clghj->htable_mapped)
+		clReleaseMemObject(clghj->m_htable);
+	else
+		clserv_release_buffer(ghjoin->msg.dindex, clghj->m_htable);
+error4:
+	clserv_release_buffer(ghjoin->msg.dindex, clghj->m_hashjoin);
+error3:
+	pgstrom_opencl_device_complete(&ghjoin->msg, clghj->dma_length, 0, 0);
+	clReleaseKernel(clghj->kernel);
+error2:
+	clReleaseProgram(clghj->program);
+error1:
+	free(clghj);
+error0:
+	ghjoin->msg.errcode = rc;
+	pgstrom_reply_message(&ghjoin->msg);
+}
+
+/*
+ * clserv_put_gpuhashjoin
+ *
+ * Callback handler when reference counter of pgstrom_gpuhashjoin object
+ * reached to zero, due to pgstrom_put_message.
+ * It also unlinks associated device program, hash table and release
+ * the outer row-store. Also note that this routine can be called under
+ * the OpenCL server context.
+ */
+static void
+clserv_put_gpuhashjoin(pgstrom_message *msg)
+{
+	pgstrom_gpuhashjoin *ghjoin = (pgstrom_gpuhashjoin *)msg;
+
+	/* unlink message queue */
+	pgstrom_put_queue(msg->respq);
+
+	/* unlink device program */
+	pgstrom_put_devprog_key(ghjoin->dprog_key);
+
+	/* unlink hash table */
+	pgstrom_put_message(&ghjoin->htable->msg);
+
+	/* release outer row-store */
+	pgstrom_shmem_free(ghjoin->rstore);
+
+	pgstrom_shmem_free(ghjoin);
+}
+
+/*
+ * gpuhashjoin_put_hash_table
+ *
+ * Callback handler when reference counter of pgstrom_hash_table reached
+ * to zero. It can be called under the OpenCL server context.
+ */
+static void
+gpuhashjoin_put_hash_table(pgstrom_message *msg)
+{
+	Assert(msg->stag == StromTag_HashJoinTable);
+	pgstrom_shmem_free(msg);
+}
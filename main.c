@@ -11,16 +11,90 @@
  * within this package.
  */
 #include "postgres.h"
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
 #include "fmgr.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "optimizer/clauses.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/timestamp.h"
 #include <limits.h>
 #include "pg_strom.h"
 
 PG_MODULE_MAGIC;
 
+/*
+ * Cluster-wide statistics of the performance monitor
+ *
+ * Performance counters of each message are accumulated on the shared
+ * memory when the message is released, for each kind of plan, device and
+ * event. The latency histogram has PGSTROM_STAT_NBUCKETS buckets in log2
+ * scale; the first bucket counts samples less than 8us, the i-th bucket
+ * counts samples in [2^(i+2), 2^(i+3)) usec, and the last bucket also
+ * counts all the longer samples.
+ */
+#define PGSTROM_STAT_NBUCKETS		20
+
+#define PGSTROM_STAT_GPUSCAN		0
+#define PGSTROM_STAT_HASHJOIN		1
+#define PGSTROM_STAT_GPUSORT		2
+#define PGSTROM_STAT_GPUPREAGG		3
+#define PGSTROM_STAT_NKINDS			4
+
+#define PGSTROM_STAT_LOAD			0
+#define PGSTROM_STAT_SENDQ			1
+#define PGSTROM_STAT_KERN_BUILD		2
+#define PGSTROM_STAT_DMA_SEND		3
+#define PGSTROM_STAT_KERN_EXEC		4
+#define PGSTROM_STAT_DMA_RECV		5
+#define PGSTROM_STAT_RECVQ			6
+#define PGSTROM_STAT_NEVENTS		7
+
+static const char *pgstrom_stat_kind_names[PGSTROM_STAT_NKINDS] = {
+	"GpuScan",
+	"GpuHashJoin",
+	"GpuSort",
+	"GpuPreAgg",
+};
+
+static const char *pgstrom_stat_event_names[PGSTROM_STAT_NEVENTS] = {
+	"load",
+	"send-mq",
+	"kernel build",
+	"DMA send",
+	"kernel exec",
+	"DMA recv",
+	"recv-mq",
+};
+
+typedef struct {
+	cl_ulong	num_samples;
+	cl_ulong	total_time;		/* usec */
+	cl_ulong	max_time;		/* usec */
+	cl_ulong	hist[PGSTROM_STAT_NBUCKETS];
+} pgstrom_stat_event;
+
+typedef struct {
+	slock_t		lock;
+	pgstrom_stat_event events[PGSTROM_STAT_NEVENTS];
+} pgstrom_stat_slot;
+
+static struct {
+	slock_t		lock;			/* lock of stat_reset */
+	TimestampTz	stat_reset;		/* timestamp of the last reset */
+	pgstrom_stat_slot slots[PGSTROM_STAT_NKINDS][MAX_NUM_DEVICES];
+} *pgstrom_stat_shm_values;
+
+static shmem_startup_hook_type shmem_startup_hook_next;
+
+static void pgstrom_init_perfmon_stat(void);
+
 /*
  * miscellaneous GUC parameters
  */
@@ -105,11 +179,18 @@ _PG_init(void)
 	/* registration of OpenCL background worker process */
 	pgstrom_init_opencl_server();
 
+	/* initialization of T-tree columnar cache and columnizer workers */
+	pgstrom_init_tcache();
+
 	/* registration of custom-plan providers */
 	pgstrom_init_gpuscan();
+	pgstrom_init_gpuhashjoin();
+	pgstrom_init_gpusort();
+	pgstrom_init_gpupreagg();
 
 	/* miscellaneous initializations */
 	pgstrom_init_misc_guc();
+	pgstrom_init_perfmon_stat();
 	pgstrom_init_debug();
 	pgstrom_codegen_init();
 }
@@ -143,6 +224,8 @@ pgstrom_strerror(cl_int errcode)
 			return "OpenCL internal error";
 		case StromError_OutOfSharedMemory:
 			return "out of shared memory";
+		case StromError_DataStoreNoSpace:
+			return "no space left on data store";
 		case StromError_DivisionByZero:
 			return "division by zero";
 		default:
@@ -222,6 +305,55 @@ show_instrumentation_count(const char *qlabel, int which,
 	}
 }
 
+/* copied from outfuncs.c */
+void
+_outToken(StringInfo str, const char *s)
+{
+	if (s == NULL || *s == '\0')
+	{
+		appendStringInfoString(str, "<>");
+		return;
+	}
+
+	/*
+	 * Look for characters or patterns that are treated specially by read.c
+	 * (either in pg_strtok() or in nodeRead()), and therefore need a
+	 * protective backslash.
+	 */
+	/* These characters only need to be quoted at the start of the string */
+	if (*s == '<' ||
+		*s == '\"' ||
+		isdigit((unsigned char) *s) ||
+		((*s == '+' || *s == '-') &&
+		 (isdigit((unsigned char) s[1]) || s[1] == '.')))
+		appendStringInfoChar(str, '\\');
+	while (*s)
+	{
+		/* These chars must be backslashed anywhere in the string */
+		if (*s == ' ' || *s == '\n' || *s == '\t' ||
+			*s == '(' || *s == ')' || *s == '{' || *s == '}' ||
+			*s == '\\')
+			appendStringInfoChar(str, '\\');
+		appendStringInfoChar(str, *s++);
+	}
+}
+
+/* copied from outfuncs.c */
+void
+_outBitmapset(StringInfo str, const Bitmapset *bms)
+{
+	Bitmapset  *tmpset;
+	int			x;
+
+	appendStringInfoChar(str, '(');
+	appendStringInfoChar(str, 'b');
+	tmpset = bms_copy(bms);
+	while ((x = bms_first_member(tmpset)) >= 0)
+		appendStringInfo(str, " %d", x);
+	bms_free(tmpset);
+	appendStringInfoChar(str, ')');
+}
+
 void
 show_device_kernel(Datum dprog_key, ExplainState *es)
 {
@@ -258,6 +390,8 @@ show_device_kernel(Datum dprog_key, ExplainState *es)
 		appendStringInfo(&str, "#include \"opencl_gpusort.h\"\n");
 	if (extra_flags & DEVKERNEL_NEEDS_HASHJOIN)
 		appendStringInfo(&str, "#include \"opencl_hashjoin.h\"\n");
+	if (extra_flags & DEVKERNEL_NEEDS_GPUPREAGG)
+		appendStringInfo(&str, "#include \"opencl_gpupreagg.h\"\n");
 	appendStringInfo(&str, "\n%s", kernel_source);
 
 	ExplainPropertyText("Kernel Source", str.data, es);
@@ -280,6 +414,7 @@ pgstrom_perfmon_add(pgstrom_perfmon *pfm_sum, pgstrom_perfmon *pfm_item)
 	pfm_sum->time_dma_send	+= pfm_item->time_dma_send;
 	pfm_sum->time_kern_exec	+= pfm_item->time_kern_exec;
 	pfm_sum->time_dma_recv	+= pfm_item->time_dma_recv;
+	pfm_sum->time_dma_overlap += pfm_item->time_dma_overlap;
 	pfm_sum->time_in_recvq	+= pfm_item->time_in_recvq;
 }
 
@@ -328,7 +463,289 @@ pgstrom_perfmon_explain(pgstrom_perfmon *pfm, ExplainState *es)
 			 (double)pfm->time_dma_recv / 1000.0);
 	ExplainPropertyText("Total time of DMA recv", buf, es);
 
+	snprintf(buf, sizeof(buf), "%.3f ms",
+			 (double)pfm->time_dma_overlap / 1000.0);
+	ExplainPropertyText("Total time of DMA overlap", buf, es);
+
+	if (pfm->time_dma_send + pfm->time_dma_recv > 0)
+	{
+		snprintf(buf, sizeof(buf), "%.1f%%",
+				 100.0 * (double)pfm->time_dma_overlap /
+				 (double)(pfm->time_dma_send + pfm->time_dma_recv));
+		ExplainPropertyText("DMA overlap ratio", buf, es);
+	}
+
 	snprintf(buf, sizeof(buf), "%.3f ms",
 			 (double)pfm->time_in_recvq / n / 1000.0);
 	ExplainPropertyText("Avg time in recv-mq", buf, es);
 }
+
+static inline void
+pgstrom_stat_event_add(pgstrom_stat_event *event, cl_ulong time)
+{
+	int		index = 0;
+
+	while (index < PGSTROM_STAT_NBUCKETS - 1 && (time >> (index + 3)) != 0)
+		index++;
+
+	event->num_samples++;
+	event->total_time += time;
+	event->max_time = Max(event->max_time, time);
+	event->hist[index]++;
+}
+
+/*
+ * pgstrom_perfmon_stat
+ *
+ * It accumulates the performance counter of the supplied message on the
+ * cluster-wide statistics; it shall be called when the message is released.
+ * Counters of the message may be enabled regardless of pg_strom.perfmon,
+ * to adjust the chunk size of GpuScan, so it also checks the GUC.
+ */
+void
+pgstrom_perfmon_stat(pgstrom_message *message)
+{
+	pgstrom_perfmon	   *pfm = &message->pfm;
+	pgstrom_stat_slot  *slot;
+	pgstrom_stat_event *events;
+	int		kind;
+
+	if (!pfm->enabled || !pgstrom_perfmon_enabled)
+		return;
+	if (message->dindex < 0 || message->dindex >= MAX_NUM_DEVICES)
+		return;
+
+	switch (message->stag)
+	{
+		case StromTag_GpuScan:
+			kind = PGSTROM_STAT_GPUSCAN;
+			break;
+		case StromTag_HashJoin:
+			kind = PGSTROM_STAT_HASHJOIN;
+			break;
+		case StromTag_GpuSort:
+			kind = PGSTROM_STAT_GPUSORT;
+			break;
+		case StromTag_GpuPreAgg:
+			kind = PGSTROM_STAT_GPUPREAGG;
+			break;
+		default:
+			return;
+	}
+	slot = &pgstrom_stat_shm_values->slots[kind][message->dindex];
+	events = slot->events;
+
+	SpinLockAcquire(&slot->lock);
+	pgstrom_stat_event_add(&events[PGSTROM_STAT_LOAD], pfm->time_to_load);
+	pgstrom_stat_event_add(&events[PGSTROM_STAT_SENDQ], pfm->time_in_sendq);
+	/* kernel build happens only on the first message, if not cached */
+	if (pfm->time_kern_build > 0)
+		pgstrom_stat_event_add(&events[PGSTROM_STAT_KERN_BUILD],
+							   pfm->time_kern_build);
+	pgstrom_stat_event_add(&events[PGSTROM_STAT_DMA_SEND], pfm->time_dma_send);
+	pgstrom_stat_event_add(&events[PGSTROM_STAT_KERN_EXEC],
+						   pfm->time_kern_exec);
+	pgstrom_stat_event_add(&events[PGSTROM_STAT_DMA_RECV], pfm->time_dma_recv);
+	pgstrom_stat_event_add(&events[PGSTROM_STAT_RECVQ], pfm->time_in_recvq);
+	SpinLockRelease(&slot->lock);
+}
+
+/*
+ * pgstrom_stat_info
+ *
+ * It shows the cluster-wide statistics of the performance monitor, for
+ * each kind of plan, device and event being sampled at least once.
+ */
+typedef struct {
+	TimestampTz	stat_reset;
+	pgstrom_stat_event events[PGSTROM_STAT_NKINDS]
+							 [MAX_NUM_DEVICES]
+							 [PGSTROM_STAT_NEVENTS];
+} pgstrom_stat_snapshot;
+
+Datum
+pgstrom_stat_info(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *fncxt;
+	pgstrom_stat_snapshot *snapshot;
+	pgstrom_stat_event *stat;
+	HeapTuple	tuple;
+	Datum		values[10];
+	bool		isnull[10];
+	Datum		hist[PGSTROM_STAT_NBUCKETS];
+	const pgstrom_device_info *dev_info;
+	int			num_devices;
+	int			kind, dindex, event;
+	int			i;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc		tupdesc;
+		MemoryContext	oldcxt;
+
+		fncxt = SRF_FIRSTCALL_INIT();
+		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
+
+		tupdesc = CreateTemplateTupleDesc(10, false);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "plan",
+						   TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "dnum",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "device",
+						   TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "event",
+						   TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 5, "samples",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 6, "total_time",
+						   FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 7, "avg_time",
+						   FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 8, "max_time",
+						   FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 9, "histogram",
+						   INT8ARRAYOID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 10, "stats_reset",
+						   TIMESTAMPTZOID, -1, 0);
+		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* take a snapshot of the statistics, slot by slot */
+		num_devices = Min(pgstrom_get_device_nums(), MAX_NUM_DEVICES);
+		snapshot = palloc(sizeof(pgstrom_stat_snapshot));
+		SpinLockAcquire(&pgstrom_stat_shm_values->lock);
+		snapshot->stat_reset = pgstrom_stat_shm_values->stat_reset;
+		SpinLockRelease(&pgstrom_stat_shm_values->lock);
+		for (kind=0; kind < PGSTROM_STAT_NKINDS; kind++)
+		{
+			for (dindex=0; dindex < num_devices; dindex++)
+			{
+				pgstrom_stat_slot *slot
+					= &pgstrom_stat_shm_values->slots[kind][dindex];
+
+				SpinLockAcquire(&slot->lock);
+				memcpy(snapshot->events[kind][dindex], slot->events,
+					   sizeof(slot->events));
+				SpinLockRelease(&slot->lock);
+			}
+		}
+
+		fncxt->user_fctx = snapshot;
+		fncxt->max_calls = (PGSTROM_STAT_NKINDS *
+							num_devices *
+							PGSTROM_STAT_NEVENTS);
+		MemoryContextSwitchTo(oldcxt);
+	}
+	fncxt = SRF_PERCALL_SETUP();
+	snapshot = fncxt->user_fctx;
+	num_devices = fncxt->max_calls / (PGSTROM_STAT_NKINDS *
+									  PGSTROM_STAT_NEVENTS);
+
+	/* skip the events never sampled */
+	for (;;)
+	{
+		if (fncxt->call_cntr >= fncxt->max_calls)
+			SRF_RETURN_DONE(fncxt);
+
+		event = fncxt->call_cntr % PGSTROM_STAT_NEVENTS;
+		dindex = (fncxt->call_cntr / PGSTROM_STAT_NEVENTS) % num_devices;
+		kind = fncxt->call_cntr / (PGSTROM_STAT_NEVENTS * num_devices);
+		stat = &snapshot->events[kind][dindex][event];
+		if (stat->num_samples > 0)
+			break;
+		fncxt->call_cntr++;
+	}
+	dev_info = pgstrom_get_device_info(dindex);
+
+	memset(isnull, 0, sizeof(isnull));
+	values[0] = CStringGetTextDatum(pgstrom_stat_kind_names[kind]);
+	values[1] = Int32GetDatum(dindex);
+	if (dev_info)
+		values[2] = CStringGetTextDatum(dev_info->dev_name);
+	else
+		isnull[2] = true;
+	values[3] = CStringGetTextDatum(pgstrom_stat_event_names[event]);
+	values[4] = Int64GetDatum(stat->num_samples);
+	/* times are shown in msec, as EXPLAIN ANALYZE doing */
+	values[5] = Float8GetDatum((double)stat->total_time / 1000.0);
+	values[6] = Float8GetDatum((double)stat->total_time /
+							   (double)stat->num_samples / 1000.0);
+	values[7] = Float8GetDatum((double)stat->max_time / 1000.0);
+	for (i=0; i < PGSTROM_STAT_NBUCKETS; i++)
+		hist[i] = Int64GetDatum(stat->hist[i]);
+	values[8] = PointerGetDatum(construct_array(hist, PGSTROM_STAT_NBUCKETS,
+												INT8OID, sizeof(int64),
+												FLOAT8PASSBYVAL, 'd'));
+	values[9] = TimestampTzGetDatum(snapshot->stat_reset);
+
+	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
+
+	SRF_RETURN_NEXT(fncxt, HeapTupleGetDatum(tuple));
+}
+PG_FUNCTION_INFO_V1(pgstrom_stat_info);
+
+/*
+ * pgstrom_stat_reset
+ *
+ * It resets all the cluster-wide statistics of the performance monitor.
+ */
+Datum
+pgstrom_stat_reset(PG_FUNCTION_ARGS)
+{
+	int		kind, dindex;
+
+	if (!superuser())
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser to reset PG-Strom statistics")));
+
+	for (kind=0; kind < PGSTROM_STAT_NKINDS; kind++)
+	{
+		for (dindex=0; dindex < MAX_NUM_DEVICES; dindex++)
+		{
+			pgstrom_stat_slot *slot
+				= &pgstrom_stat_shm_values->slots[kind][dindex];
+
+			SpinLockAcquire(&slot->lock);
+			memset(slot->events, 0, sizeof(slot->events));
+			SpinLockRelease(&slot->lock);
+		}
+	}
+	SpinLockAcquire(&pgstrom_stat_shm_values->lock);
+	pgstrom_stat_shm_values->stat_reset = GetCurrentTimestamp();
+	SpinLockRelease(&pgstrom_stat_shm_values->lock);
+
+	PG_RETURN_VOID();
+}
+PG_FUNCTION_INFO_V1(pgstrom_stat_reset);
+
+static void
+pgstrom_startup_perfmon_stat(void)
+{
+	bool	found;
+	int		kind, dindex;
+
+	if (shmem_startup_hook_next)
+		(*shmem_startup_hook_next)();
+
+	pgstrom_stat_shm_values
+		= ShmemInitStruct("pgstrom_stat_shm_values",
+						  MAXALIGN(sizeof(*pgstrom_stat_shm_values)),
+						  &found);
+	Assert(!found);
+	memset(pgstrom_stat_shm_values, 0, sizeof(*pgstrom_stat_shm_values));
+	SpinLockInit(&pgstrom_stat_shm_values->lock);
+	for (kind=0; kind < PGSTROM_STAT_NKINDS; kind++)
+	{
+		for (dindex=0; dindex < MAX_NUM_DEVICES; dindex++)
+			SpinLockInit(&pgstrom_stat_shm_values->slots[kind][dindex].lock);
+	}
+	pgstrom_stat_shm_values->stat_reset = GetCurrentTimestamp();
+}
+
+static void
+pgstrom_init_perfmon_stat(void)
+{
+	RequestAddinShmemSpace(MAXALIGN(sizeof(*pgstrom_stat_shm_values)));
+	shmem_startup_hook_next = shmem_startup_hook;
+	shmem_startup_hook = pgstrom_startup_perfmon_stat;
+}
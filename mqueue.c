@@ -14,12 +14,16 @@
 #include "catalog/pg_type.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include "storage/barrier.h"
 #include "storage/ipc.h"
 #include "storage/shmem.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
 #include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include "pg_strom.h"
 
 static pthread_mutexattr_t	mutex_attr;
@@ -27,6 +31,30 @@ static pthread_rwlockattr_t	rwlock_attr;
 static pthread_condattr_t	cond_attr;
 static int		pgstrom_mqueue_timeout;
 
+/*
+ * Server message queue
+ *
+ * Every backend enqueues messages and every server thread dequeues them,
+ * so the server message queue is a bounded multi-producer/multi-consumer
+ * ring buffer without locks. Each slot has a sequence number; a slot at
+ * position 'pos' is free to enqueue if seq == pos, and is filled to be
+ * dequeued if seq == pos + 1. Producers and consumers reserve a range of
+ * slots by compare-and-swap of tail and head, thus a batch of messages
+ * costs one atomic operation unless they conflict.
+ * Messages that don't fit the ring are linked to the overflow list being
+ * protected by spinlock; it is rare because the ring is large enough for
+ * usual number of asynchronous chunks.
+ * Consumers sleep on a futex only when the ring is empty, and producers
+ * issue a system call to wake them up only when somebody sleeps.
+ */
+#define SERV_MQUEUE_NSLOTS		4096	/* must be power of 2 */
+#define SERV_MQUEUE_PADDING		64		/* to avoid false sharing */
+
+typedef struct {
+	volatile uint64		seq;
+	pgstrom_message	   *msg;
+} serv_mqueue_slot;
+
 /* variables related to shared memory segment */
 static shmem_startup_hook_type shmem_startup_hook_next;
 static struct {
@@ -36,6 +64,21 @@ static struct {
 	uint32			num_free;
 	uint32			num_active;
 	pgstrom_queue	serv_mqueue;	/* queue to OpenCL server */
+
+	/* lock-free ring buffer of the server message queue */
+	char			__pad0[SERV_MQUEUE_PADDING];
+	volatile uint64	serv_tail;		/* next position to be enqueued */
+	char			__pad1[SERV_MQUEUE_PADDING];
+	volatile uint64	serv_head;		/* next position to be dequeued */
+	char			__pad2[SERV_MQUEUE_PADDING];
+	volatile uint32	serv_futex;		/* futex word to wake up consumers */
+	volatile uint32	serv_waiters;	/* number of sleeping consumers */
+	volatile uint32	serv_producers;	/* number of producers in progress */
+	volatile uint32	serv_num_overflow;	/* length of serv_overflow */
+	slock_t			serv_overflow_lock;
+	dlist_head		serv_overflow;	/* messages not fit the ring */
+	char			__pad3[SERV_MQUEUE_PADDING];
+	serv_mqueue_slot serv_slots[SERV_MQUEUE_NSLOTS];
 } *mqueue_shm_values;
 
 /* number of message queues per block */
@@ -43,6 +86,186 @@ static struct {
 	((SHMEM_BLOCKSZ - sizeof(cl_uint)					\
 	  - sizeof(dlist_node))	/ sizeof(pgstrom_queue))
 
+/* max number of messages being enqueued at once */
+#define MQUEUE_BATCH_SIZE		32
+
+/*
+ * mqueue_lock
+ *
+ * It acquires the lock of response message queue, and counts up number of
+ * contention if somebody already holds the lock.
+ */
+static inline void
+mqueue_lock(pgstrom_queue *mqueue)
+{
+	if (pthread_mutex_trylock(&mqueue->lock) != 0)
+	{
+		pthread_mutex_lock(&mqueue->lock);
+		mqueue->num_contention++;
+	}
+}
+
+static inline long
+mqueue_futex(volatile uint32 *uaddr, int futex_op, uint32 value,
+			 const struct timespec *timeout)
+{
+	return syscall(SYS_futex, uaddr, futex_op, value, timeout, NULL, 0);
+}
+
+/*
+ * serv_mqueue_push
+ *
+ * It puts messages on the ring buffer as many as possible, then returns
+ * number of messages actually enqueued; zero means the ring is full.
+ */
+static int
+serv_mqueue_push(pgstrom_message **msgs, int nmsgs)
+{
+	serv_mqueue_slot *slots = mqueue_shm_values->serv_slots;
+	uint64		pos;
+	int			i, n;
+
+	for (;;)
+	{
+		pos = mqueue_shm_values->serv_tail;
+		pg_read_barrier();
+		for (n=0; n < nmsgs; n++)
+		{
+			serv_mqueue_slot *slot
+				= &slots[(pos + n) & (SERV_MQUEUE_NSLOTS - 1)];
+
+			if (slot->seq != pos + n)
+				break;
+		}
+		if (n == 0)
+		{
+			/*
+			 * the slot is still in use by a consumer if it is behind
+			 * the tail, or tail is already moved by other producer.
+			 */
+			if ((int64)(slots[pos & (SERV_MQUEUE_NSLOTS - 1)].seq - pos) < 0)
+				return 0;
+		}
+		else if (__sync_bool_compare_and_swap(&mqueue_shm_values->serv_tail,
+											  pos, pos + n))
+			break;
+		__sync_fetch_and_add(&mqueue_shm_values->serv_mqueue.num_contention,
+							 1);
+	}
+
+	/* OK, slots from pos to pos + n are reserved by us */
+	for (i=0; i < n; i++)
+	{
+		serv_mqueue_slot *slot = &slots[(pos + i) & (SERV_MQUEUE_NSLOTS - 1)];
+
+		slot->msg = msgs[i];
+		pg_write_barrier();
+		slot->seq = pos + i + 1;
+	}
+	return n;
+}
+
+/*
+ * serv_mqueue_pop
+ *
+ * It fetches messages from the ring buffer up to nmsgs, then returns
+ * number of messages actually dequeued; zero means the ring is empty.
+ */
+static int
+serv_mqueue_pop(pgstrom_message **msgs, int nmsgs)
+{
+	serv_mqueue_slot *slots = mqueue_shm_values->serv_slots;
+	uint64		pos;
+	int			i, n;
+
+	for (;;)
+	{
+		pos = mqueue_shm_values->serv_head;
+		pg_read_barrier();
+		for (n=0; n < nmsgs; n++)
+		{
+			serv_mqueue_slot *slot
+				= &slots[(pos + n) & (SERV_MQUEUE_NSLOTS - 1)];
+
+			if (slot->seq != pos + n + 1)
+				break;
+		}
+		if (n == 0)
+		{
+			/* ring is empty, or a producer is still writing the slot */
+			if ((int64)(slots[pos & (SERV_MQUEUE_NSLOTS - 1)].seq -
+						(pos + 1)) < 0)
+				return 0;
+		}
+		else if (__sync_bool_compare_and_swap(&mqueue_shm_values->serv_head,
+											  pos, pos + n))
+			break;
+		__sync_fetch_and_add(&mqueue_shm_values->serv_mqueue.num_contention,
+							 1);
+	}
+
+	/* OK, slots from pos to pos + n are reserved by us */
+	for (i=0; i < n; i++)
+	{
+		serv_mqueue_slot *slot = &slots[(pos + i) & (SERV_MQUEUE_NSLOTS - 1)];
+
+		msgs[i] = slot->msg;
+		pg_memory_barrier();
+		slot->seq = pos + i + SERV_MQUEUE_NSLOTS;
+	}
+	return n;
+}
+
+/*
+ * serv_mqueue_try_dequeue
+ *
+ * It fetches messages from the server message queue without blocking.
+ * Messages in the overflow list are older than the ones in the ring,
+ * so we pick up them first.
+ */
+static int
+serv_mqueue_try_dequeue(pgstrom_message **msgs, int nmsgs)
+{
+	int		n = 0;
+
+	if (mqueue_shm_values->serv_num_overflow > 0)
+	{
+		SpinLockAcquire(&mqueue_shm_values->serv_overflow_lock);
+		while (n < nmsgs && !dlist_is_empty(&mqueue_shm_values->serv_overflow))
+		{
+			dlist_node *dnode
+				= dlist_pop_head_node(&mqueue_shm_values->serv_overflow);
+
+			msgs[n++] = dlist_container(pgstrom_message, chain, dnode);
+			mqueue_shm_values->serv_num_overflow--;
+		}
+		SpinLockRelease(&mqueue_shm_values->serv_overflow_lock);
+	}
+	if (n < nmsgs)
+		n += serv_mqueue_pop(msgs + n, nmsgs - n);
+	if (n > 0)
+		__sync_fetch_and_add(&mqueue_shm_values->serv_mqueue.num_dequeue, n);
+	return n;
+}
+
+/*
+ * serv_mqueue_wakeup
+ *
+ * It wakes up consumers being sleeping, if any.
+ */
+static void
+serv_mqueue_wakeup(int nwakes)
+{
+	/* ensure waiters can see the messages, prior to check serv_waiters */
+	pg_memory_barrier();
+	if (mqueue_shm_values->serv_waiters > 0)
+	{
+		__sync_fetch_and_add(&mqueue_shm_values->serv_futex, 1);
+		mqueue_futex(&mqueue_shm_values->serv_futex, FUTEX_WAKE,
+					 nwakes, NULL);
+	}
+}
+
 /*
  * pgstrom_create_queue
  *
@@ -122,61 +345,129 @@ pgstrom_create_queue(void)
 	mqueue->refcnt = 1;
 	dlist_init(&mqueue->qhead);
 	mqueue->closed = false;
+	mqueue->num_enqueue = 0;
+	mqueue->num_dequeue = 0;
+	mqueue->num_contention = 0;
+	mqueue->num_sleep = 0;
+	mqueue->num_overflow = 0;
 	SpinLockRelease(&mqueue_shm_values->lock);
 
 	return mqueue;
 }
 
 /*
- * pgstrom_enqueue_message
+ * pgstrom_enqueue_message_batch
  *
- * It enqueues a message towardss OpenCL intermediation server.
+ * It enqueues a batch of messages towards OpenCL intermediation server.
+ * All or none of the messages are enqueued.
  */
-bool
-pgstrom_enqueue_message(pgstrom_message *message)
+static bool
+pgstrom_enqueue_message_batch(pgstrom_message **msgs, int nmsgs)
 {
 	pgstrom_queue  *mqueue = &mqueue_shm_values->serv_mqueue;
-	int		rc;
+	int		i, n;
 
-	pthread_mutex_lock(&mqueue->lock);
+	/*
+	 * serv_producers prevents pgstrom_close_server_queue() to clean up
+	 * the queued messages prior to completion of this enqueue.
+	 */
+	__sync_fetch_and_add(&mqueue_shm_values->serv_producers, 1);
 	if (mqueue->closed)
 	{
-		pthread_mutex_unlock(&mqueue->lock);
+		__sync_fetch_and_sub(&mqueue_shm_values->serv_producers, 1);
 		return false;
 	}
 
-	/* performance monitoring */
-	if (message->pfm.enabled)
-		gettimeofday(&message->pfm.tv, NULL);
+	for (i=0; i < nmsgs; i++)
+	{
+		pgstrom_message	*message = msgs[i];
 
-	/*
-	 * We assume the message being enqueued in the server message-queue is
-	 * already acquired by the server process, not only backend process.
-	 * So, we ensure the messages shall not be released during server jobs.
-	 * Increment of reference counter prevent unexpected resource free by
-	 * elog(ERROR, ...).
-	 * 
-	 * Please note that the server process may enqueue messages again.
-	 * In this case, we don't need to increment reference counter of the
-	 * message again (because server process already acquires this message!).
-	 * So, it shall be increment only when backend process tries to enqueue
-	 * a message.
-	 */
-	SpinLockAcquire(&message->lock);
-	Assert(message->refcnt > 0);
-	if (!pgstrom_i_am_clserv)
-		message->refcnt++;
-	dlist_push_tail(&mqueue->qhead, &message->chain);
-	SpinLockRelease(&message->lock);
+		/* performance monitoring */
+		if (message->pfm.enabled)
+			gettimeofday(&message->pfm.tv, NULL);
+
+		/*
+		 * We assume the message being enqueued in the server message-queue
+		 * is already acquired by the server process, not only backend
+		 * process. So, we ensure the messages shall not be released during
+		 * server jobs. Increment of reference counter prevent unexpected
+		 * resource free by elog(ERROR, ...).
+		 *
+		 * Please note that the server process may enqueue messages again.
+		 * In this case, we don't need to increment reference counter of
+		 * the message again (because server process already acquires this
+		 * message!). So, it shall be increment only when backend process
+		 * tries to enqueue a message.
+		 */
+		SpinLockAcquire(&message->lock);
+		Assert(message->refcnt > 0);
+		if (!pgstrom_i_am_clserv)
+			message->refcnt++;
+		SpinLockRelease(&message->lock);
+	}
+
+	for (i=0; i < nmsgs; i += n)
+	{
+		n = serv_mqueue_push(msgs + i, nmsgs - i);
+		if (n == 0)
+		{
+			/* ring is full, so rest of messages are linked to overflow */
+			SpinLockAcquire(&mqueue_shm_values->serv_overflow_lock);
+			for (n=i; n < nmsgs; n++)
+				dlist_push_tail(&mqueue_shm_values->serv_overflow,
+								&msgs[n]->chain);
+			mqueue_shm_values->serv_num_overflow += nmsgs - i;
+			SpinLockRelease(&mqueue_shm_values->serv_overflow_lock);
+			__sync_fetch_and_add(&mqueue->num_overflow, nmsgs - i);
+			break;
+		}
+	}
+	__sync_fetch_and_add(&mqueue->num_enqueue, nmsgs);
+	__sync_fetch_and_sub(&mqueue_shm_values->serv_producers, 1);
 
 	/* notification to waiter */
-	rc = pthread_cond_signal(&mqueue->cond);
-	Assert(rc == 0);
-	pthread_mutex_unlock(&mqueue->lock);
+	serv_mqueue_wakeup(nmsgs);
 
 	return true;
 }
 
+/*
+ * pgstrom_enqueue_message
+ *
+ * It enqueues a message towardss OpenCL intermediation server.
+ */
+bool
+pgstrom_enqueue_message(pgstrom_message *message)
+{
+	return pgstrom_enqueue_message_batch(&message, 1);
+}
+
+/*
+ * pgstrom_enqueue_message_list
+ *
+ * It enqueues all the messages linked to the supplied list towards OpenCL
+ * intermediation server, then the list becomes empty. Messages are
+ * enqueued in batch, so it is cheaper than individual enqueue.
+ */
+void
+pgstrom_enqueue_message_list(dlist_head *mlist)
+{
+	pgstrom_message	*msgs[MQUEUE_BATCH_SIZE];
+	int		nmsgs;
+
+	while (!dlist_is_empty(mlist))
+	{
+		nmsgs = 0;
+		while (nmsgs < MQUEUE_BATCH_SIZE && !dlist_is_empty(mlist))
+		{
+			dlist_node *dnode = dlist_pop_head_node(mlist);
+
+			msgs[nmsgs++] = dlist_container(pgstrom_message, chain, dnode);
+		}
+		pgstrom_enqueue_message_batch(msgs, nmsgs);
+	}
+}
+
 /*
  * pgstrom_reply_message
  *
@@ -191,7 +482,7 @@ pgstrom_reply_message(pgstrom_message *message)
 
 	Assert(pgstrom_i_am_clserv);
 	Assert(respq != &mqueue_shm_values->serv_mqueue);
-	pthread_mutex_lock(&respq->lock);
+	mqueue_lock(respq);
 	if (respq->closed)
 	{
 		pthread_mutex_unlock(&respq->lock);
@@ -215,6 +506,7 @@ pgstrom_reply_message(pgstrom_message *message)
 		{
 			message->refcnt--;	/* we never call on_release handler here */
 			dlist_push_tail(&respq->qhead, &message->chain);
+			respq->num_enqueue++;
 			SpinLockRelease(&message->lock);
 
 			/* notification towards the waiter process */
@@ -242,29 +534,32 @@ pgstrom_reply_message(pgstrom_message *message)
 	}
 }
 
+#define POOLING_INTERVAL	200000000	/* 200msec */
+
 /*
  * pgstrom_sync_dequeue_message
  *
- * It fetches a message from the message queue. If empty, it waits for new
- * messages will come, or returns NULL if it exceeds timeout or it got
- * a signal being pending.
+ * It fetches a message from the response message queue. If empty, it waits
+ * for new messages will come, or returns NULL if it exceeds timeout or it
+ * got a signal being pending.
  */
 static pgstrom_message *
 pgstrom_sync_dequeue_message(pgstrom_queue *mqueue)
 {
-#define POOLING_INTERVAL	200000000	/* 200msec */
 	pgstrom_message *result = NULL;
 	struct timeval	basetv;
 	struct timespec	timeout;
 	ulong	timeleft = ((ulong)pgstrom_mqueue_timeout) * 1000000UL;
 	int		rc;
 
+	Assert(mqueue != &mqueue_shm_values->serv_mqueue);
+
 	rc = gettimeofday(&basetv, NULL);
 	Assert(rc == 0);
 	timeout.tv_sec = basetv.tv_sec;
 	timeout.tv_nsec = basetv.tv_usec * 1000UL;
 
-	pthread_mutex_lock(&mqueue->lock);
+	mqueue_lock(mqueue);
 	for (;;)
 	{
 		/* dequeue a message from the message queue */
@@ -274,6 +569,7 @@ pgstrom_sync_dequeue_message(pgstrom_queue *mqueue)
 				= dlist_pop_head_node(&mqueue->qhead);
 
 			result = dlist_container(pgstrom_message, chain, dnode);
+			mqueue->num_dequeue++;
 			pthread_mutex_unlock(&mqueue->lock);
 			break;
 		}
@@ -300,24 +596,73 @@ pgstrom_sync_dequeue_message(pgstrom_queue *mqueue)
 				timeout.tv_sec += timeout.tv_nsec / 1000000000;
 				timeout.tv_nsec = timeout.tv_nsec % 1000000000;
 			}
+			mqueue->num_sleep++;
 			rc = pthread_cond_timedwait(&mqueue->cond,
 										&mqueue->lock,
 										&timeout);
 			Assert(rc == 0 || rc == ETIMEDOUT);
-
-			/*
-			 * XXX - we need to have detailed investigation here,
-			 * whether this implementation is best design or not.
-			 * It assumes backend side blocks until all the messages
-			 * are backed.
-			 */
-			if (pgstrom_i_am_clserv && pgstrom_clserv_exit_pending)
-				timeleft = 0;
 		}
 	}
 	return result;
 }
 
+/*
+ * pgstrom_sync_dequeue_server_messages
+ *
+ * It fetches messages from the server message queue up to nmsgs. If empty,
+ * it sleeps on the futex until new messages will come, or returns 0 if it
+ * exceeds timeout or server is going to exit.
+ */
+static int
+pgstrom_sync_dequeue_server_messages(pgstrom_message **msgs, int nmsgs)
+{
+	pgstrom_queue  *mqueue = &mqueue_shm_values->serv_mqueue;
+	struct timespec	timeout;
+	ulong	timeleft = ((ulong)pgstrom_mqueue_timeout) * 1000000UL;
+	ulong	interval;
+	uint32	futex_val;
+	int		n;
+
+	for (;;)
+	{
+		n = serv_mqueue_try_dequeue(msgs, nmsgs);
+		if (n > 0 || timeleft == 0)
+			break;
+
+		/*
+		 * Announce we are going to sleep, then check the queue again,
+		 * because a producer might enqueue a message before it.
+		 */
+		__sync_fetch_and_add(&mqueue_shm_values->serv_waiters, 1);
+		futex_val = mqueue_shm_values->serv_futex;
+		n = serv_mqueue_try_dequeue(msgs, nmsgs);
+		if (n > 0)
+		{
+			__sync_fetch_and_sub(&mqueue_shm_values->serv_waiters, 1);
+			break;
+		}
+		interval = Min(timeleft, POOLING_INTERVAL);
+		timeleft -= interval;
+		timeout.tv_sec = interval / 1000000000;
+		timeout.tv_nsec = interval % 1000000000;
+
+		__sync_fetch_and_add(&mqueue->num_sleep, 1);
+		mqueue_futex(&mqueue_shm_values->serv_futex, FUTEX_WAIT,
+					 futex_val, &timeout);
+		__sync_fetch_and_sub(&mqueue_shm_values->serv_waiters, 1);
+
+		/*
+		 * XXX - we need to have detailed investigation here,
+		 * whether this implementation is best design or not.
+		 * It assumes backend side blocks until all the messages
+		 * are backed.
+		 */
+		if (pgstrom_clserv_exit_pending)
+			timeleft = 0;
+	}
+	return n;
+}
+
 /*
  * pgstrom_dequeue_message
  *
@@ -339,6 +684,56 @@ pgstrom_dequeue_message(pgstrom_queue *mqueue)
 	return msg;
 }
 
+static void
+pgstrom_account_server_messages(pgstrom_message **msgs, int nmsgs)
+{
+	struct timeval		tv;
+	int		i;
+
+	for (i=0; i < nmsgs; i++)
+	{
+		if (msgs[i]->pfm.enabled)
+		{
+			gettimeofday(&tv, NULL);
+			msgs[i]->pfm.time_in_sendq += timeval_diff(&msgs[i]->pfm.tv, &tv);
+		}
+	}
+}
+
+/*
+ * pgstrom_dequeue_server_messages
+ *
+ * dequeue messages from the server message queue up to nmsgs, and returns
+ * number of messages actually dequeued.
+ */
+int
+pgstrom_dequeue_server_messages(pgstrom_message **msgs, int nmsgs)
+{
+	int		n;
+
+	Assert(pgstrom_i_am_clserv);
+	n = pgstrom_sync_dequeue_server_messages(msgs, nmsgs);
+	pgstrom_account_server_messages(msgs, n);
+	return n;
+}
+
+/*
+ * pgstrom_try_dequeue_server_messages
+ *
+ * It is almost equivalent to pgstrom_dequeue_server_messages(), however,
+ * it never wait for new messages, will return immediately.
+ */
+int
+pgstrom_try_dequeue_server_messages(pgstrom_message **msgs, int nmsgs)
+{
+	int		n;
+
+	Assert(pgstrom_i_am_clserv);
+	n = serv_mqueue_try_dequeue(msgs, nmsgs);
+	pgstrom_account_server_messages(msgs, n);
+	return n;
+}
+
 /*
  * pgstrom_dequeue_server_message
  *
@@ -348,15 +743,9 @@ pgstrom_message *
 pgstrom_dequeue_server_message(void)
 {
 	pgstrom_message	   *msg;
-	struct timeval		tv;
 
-	Assert(pgstrom_i_am_clserv);
-	msg = pgstrom_sync_dequeue_message(&mqueue_shm_values->serv_mqueue);
-	if (msg && msg->pfm.enabled)
-	{
-		gettimeofday(&tv, NULL);
-		msg->pfm.time_in_sendq += timeval_diff(&msg->pfm.tv, &tv);
-	}
+	if (pgstrom_dequeue_server_messages(&msg, 1) == 0)
+		return NULL;
 	return msg;
 }
 
@@ -371,13 +760,15 @@ pgstrom_try_dequeue_message(pgstrom_queue *mqueue)
 {
 	pgstrom_message *result = NULL;
 
-	pthread_mutex_lock(&mqueue->lock);
+	Assert(mqueue != &mqueue_shm_values->serv_mqueue);
+	mqueue_lock(mqueue);
 	if (!dlist_is_empty(&mqueue->qhead))
 	{
 		dlist_node *dnode
 			= dlist_pop_head_node(&mqueue->qhead);
 
 		result = dlist_container(pgstrom_message, chain, dnode);
+		mqueue->num_dequeue++;
 	}
 	pthread_mutex_unlock(&mqueue->lock);
 
@@ -393,9 +784,8 @@ pgstrom_try_dequeue_message(pgstrom_queue *mqueue)
 void
 pgstrom_cancel_server_loop(void)
 {
-	pgstrom_queue  *mqueue = &mqueue_shm_values->serv_mqueue;
-
-	pthread_cond_broadcast(&mqueue->cond);
+	__sync_fetch_and_add(&mqueue_shm_values->serv_futex, 1);
+	mqueue_futex(&mqueue_shm_values->serv_futex, FUTEX_WAKE, INT_MAX, NULL);
 }
 
 /*
@@ -413,17 +803,24 @@ pgstrom_close_server_queue(void)
 	Assert(pgstrom_i_am_clserv);
 
 	pgstrom_close_queue(svqueue);
+	pg_memory_barrier();
+
+	/* wait for completion of the producers that didn't see closed */
+	while (mqueue_shm_values->serv_producers > 0)
+		pg_usleep(1000L);
+
 	/*
 	 * Once server message queue is closed, messages being already queued
 	 * are immediately replied to the backend with error code.
 	 */
-	while ((msg = pgstrom_try_dequeue_message(svqueue)) != NULL)
+	while (serv_mqueue_try_dequeue(&msg, 1) > 0)
 	{
 		msg->errcode = StromError_ServerNotReady;
 		pgstrom_reply_message(msg);
 	}
 }
 
+
 /*
  * pgstrom_close_queue
  *
@@ -556,6 +953,11 @@ typedef struct {
 	pid_t		owner;
 	char		state;	/* 'a' = active, 'c' = closed, 'f' = free*/
 	int			refcnt;
+	cl_ulong	num_enqueue;
+	cl_ulong	num_dequeue;
+	cl_ulong	num_contention;
+	cl_ulong	num_sleep;
+	cl_ulong	num_overflow;
 } mqueue_info;
 
 Datum
@@ -564,8 +966,8 @@ pgstrom_mqueue_info(PG_FUNCTION_ARGS)
 	FuncCallContext *fncxt;
 	mqueue_info	   *mq_info;
 	HeapTuple		tuple;
-	Datum			values[4];
-	bool			isnull[4];
+	Datum			values[9];
+	bool			isnull[9];
 	char			buf[256];
 	int				i;
 
@@ -579,7 +981,7 @@ pgstrom_mqueue_info(PG_FUNCTION_ARGS)
 		fncxt = SRF_FIRSTCALL_INIT();
 		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
 
-		tupdesc = CreateTemplateTupleDesc(4, false);
+		tupdesc = CreateTemplateTupleDesc(9, false);
 		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "mqueue",
 						   TEXTOID, -1, 0);
 		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "owner",
@@ -588,6 +990,16 @@ pgstrom_mqueue_info(PG_FUNCTION_ARGS)
 						   TEXTOID, -1, 0);
 		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "refcnt",
 						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 5, "enqueue",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 6, "dequeue",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 7, "contention",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 8, "sleep",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 9, "overflow",
+						   INT8OID, -1, 0);
 		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
 
 		SpinLockAcquire(&mqueue_shm_values->lock);
@@ -599,6 +1011,13 @@ pgstrom_mqueue_info(PG_FUNCTION_ARGS)
 			mq_info->owner = mqueue_shm_values->serv_mqueue.owner;
 			mq_info->state = mqueue_shm_values->serv_mqueue.closed ? 'c' : 'a';
 			mq_info->refcnt = mqueue_shm_values->serv_mqueue.refcnt;
+			mq_info->num_enqueue = mqueue_shm_values->serv_mqueue.num_enqueue;
+			mq_info->num_dequeue = mqueue_shm_values->serv_mqueue.num_dequeue;
+			mq_info->num_contention
+				= mqueue_shm_values->serv_mqueue.num_contention;
+			mq_info->num_sleep = mqueue_shm_values->serv_mqueue.num_sleep;
+			mq_info->num_overflow
+				= mqueue_shm_values->serv_mqueue.num_overflow;
 			mq_list = lappend(mq_list, mq_info);
 
 			/* backend mqueues */
@@ -618,6 +1037,11 @@ pgstrom_mqueue_info(PG_FUNCTION_ARGS)
 
 					pthread_mutex_lock(&mqueues[i].lock);
 					mq_info->refcnt = mqueues[i].refcnt;
+					mq_info->num_enqueue = mqueues[i].num_enqueue;
+					mq_info->num_dequeue = mqueues[i].num_dequeue;
+					mq_info->num_contention = mqueues[i].num_contention;
+					mq_info->num_sleep = mqueues[i].num_sleep;
+					mq_info->num_overflow = mqueues[i].num_overflow;
 					pthread_mutex_unlock(&mqueues[i].lock);
 
 					mq_list = lappend(mq_list, mq_info);
@@ -654,6 +1078,11 @@ pgstrom_mqueue_info(PG_FUNCTION_ARGS)
 			   (mq_info->state == 'f' ? "free" : "unknown"))));
 	values[2] = CStringGetTextDatum(buf);
 	values[3] = Int32GetDatum(mq_info->refcnt);
+	values[4] = Int64GetDatum(mq_info->num_enqueue);
+	values[5] = Int64GetDatum(mq_info->num_dequeue);
+	values[6] = Int64GetDatum(mq_info->num_contention);
+	values[7] = Int64GetDatum(mq_info->num_sleep);
+	values[8] = Int64GetDatum(mq_info->num_overflow);
 
 	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
 
@@ -671,6 +1100,7 @@ pgstrom_startup_mqueue(void)
 {
 	pgstrom_queue  *mqueue;
 	bool	found;
+	int		i;
 
 	if (shmem_startup_hook_next)
 		(*shmem_startup_hook_next)();
@@ -693,6 +1123,14 @@ pgstrom_startup_mqueue(void)
         elog(ERROR, "failed on pthread_cond_init for server mqueue");
     dlist_init(&mqueue->qhead);
     mqueue->closed = false;
+
+	/* ring buffer of the server message queue */
+	for (i=0; i < SERV_MQUEUE_NSLOTS; i++)
+		mqueue_shm_values->serv_slots[i].seq = i;
+	mqueue_shm_values->serv_head = 0;
+	mqueue_shm_values->serv_tail = 0;
+	SpinLockInit(&mqueue_shm_values->serv_overflow_lock);
+	dlist_init(&mqueue_shm_values->serv_overflow);
 }
 
 /*
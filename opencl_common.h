@@ -155,9 +155,9 @@ typedef struct varatt_indirect
 	(*((__global cl_uchar *) (PTR)) != 0)
 
 #define VARSIZE_4B(PTR) \
-	(((__global varattrib_4b *) (PTR))->va_4byte.va_header & 0x3FFFFFFF)
+	((((__global varattrib_4b *) (PTR))->va_4byte.va_header >> 2) & 0x3FFFFFFF)
 #define VARSIZE_1B(PTR) \
-	(((__global varattrib_1b *) (PTR))->va_header & 0x7F)
+	((((__global varattrib_1b *) (PTR))->va_header >> 1) & 0x7F)
 #define VARTAG_1B_E(PTR) \
 	(((__global varattrib_1b_e *) (PTR))->va_tag)
 
@@ -166,6 +166,21 @@ typedef struct varatt_indirect
 	 (VARATT_IS_1B(PTR) ? VARSIZE_1B(PTR) :			\
 	  VARSIZE_4B(PTR)))
 
+/*
+ * Contents of in-line and uncompressed varlena; either of 1-byte or 4-bytes
+ * header. Caller has to check VARATT_IS_COMPRESSED and VARATT_IS_EXTERNAL
+ * prior to the reference.
+ */
+#define VARHDRSZ_SHORT			offsetof(varattrib_1b, va_data)
+#define VARDATA_4B(PTR)		(((__global varattrib_4b *) (PTR))->va_4byte.va_data)
+#define VARDATA_1B(PTR)		(((__global varattrib_1b *) (PTR))->va_data)
+#define VARDATA_ANY(PTR) \
+	(VARATT_IS_1B(PTR) ? VARDATA_1B(PTR) : VARDATA_4B(PTR))
+#define VARSIZE_ANY_EXHDR(PTR)								\
+	(VARATT_IS_1B_E(PTR) ? VARSIZE_EXTERNAL(PTR) - VARHDRSZ_EXTERNAL :	\
+	 (VARATT_IS_1B(PTR) ? VARSIZE_1B(PTR) - VARHDRSZ_SHORT :			\
+	  VARSIZE_4B(PTR) - VARHDRSZ))
+
 #else	/* OPENCL_DEVICE_CODE */
 #include "access/htup_details.h"
 #include "storage/itemptr.h"
@@ -191,6 +206,7 @@ typedef struct varatt_indirect
 #define StromError_BadRequestMessage	101	/* Bad request message */
 #define StromError_OpenCLInternal		102	/* OpenCL internal error */
 #define StromError_OutOfSharedMemory	105	/* out of shared memory */
+#define StromError_DataStoreNoSpace		106	/* no space left on data store */
 #define StromError_DivisionByZero		200	/* Division by zero */
 
 /* significant error; that abort transaction on the host code */
@@ -218,17 +234,28 @@ typedef struct {
  *
  * if 'debug_usage' is not initialized to zero, it means this result-
  * buffer does not have debug buffer.
+ *
+ * If KERN_RESULTBUF_FLAGS_BITMAP is set on 'flags', 'results' is not an
+ * array of row-index, but two bitmaps of 'nrooms' bits; the first one
+ * informs rows being visible, and the second one informs rows that need
+ * re-check on the host side. Host has to clear them prior to execution.
  */
 #define KERN_DEBUG_UNAVAILABLE	0xffffffff
+#define KERN_RESULTBUF_FLAGS_BITMAP		0x0001
 typedef struct {
 	cl_uint		nrooms;		/* max number of results rooms */
 	cl_uint		nitems;		/* number of results being written */
 	cl_uint		debug_nums;	/* number of debug messages */
 	cl_uint		debug_usage;/* current usage of debug buffer */
 	cl_int		errcode;	/* chunk-level error */
+	cl_uint		flags;		/* one of KERN_RESULTBUF_FLAGS_* */
 	cl_int		results[FLEXIBLE_ARRAY_MEMBER];
 } kern_resultbuf;
 
+#define KERN_RESULTBUF_BITMAP_NWORDS(nrooms)	(((nrooms) + 31) / 32)
+#define KERN_RESULTBUF_IS_BITMAP(kresult)		\
+	(((kresult)->flags & KERN_RESULTBUF_FLAGS_BITMAP) != 0)
+
 /*
  * kern_debug
  *
@@ -404,6 +431,11 @@ typedef struct {
 #define HEAP_XMAX_EXCL_LOCK		0x0040	/* xmax is exclusive locker */
 #define HEAP_XMAX_LOCK_ONLY		0x0080	/* xmax, if valid, is only a locker */
 
+/*
+ * information stored in t_infomask2:
+ */
+#define HEAP_NATTS_MASK			0x07FF	/* 11 bits for number of attributes */
+
 #endif
 
 /*
@@ -413,6 +445,13 @@ typedef struct {
 #define STROMALIGN(LEN)			TYPEALIGN(STROMALIGN_LEN,LEN)
 #define STROMALIGN_DOWN(LEN)	TYPEALIGN_DOWN(STROMALIGN_LEN,LEN)
 
+/*
+ * max width of vectorized kernels, and padding of the column-store to
+ * allow vector load on the tail of column arrays
+ */
+#define KERN_VECTOR_MAXWIDTH	16
+#define KERN_VECTOR_PADDING		(KERN_VECTOR_MAXWIDTH * sizeof(cl_long))
+
 /*
  * kern_colmeta
  *
@@ -421,6 +460,8 @@ typedef struct {
  */
 #define KERN_COLMETA_ATTNOTNULL			0x01
 #define KERN_COLMETA_ATTREFERENCED		0x02
+#define KERN_COLMETA_ATTENCODED			0x04	/* see kern_colenc */
+#define KERN_COLMETA_ATTPROJECTED		0x08	/* written back by projection */
 typedef struct {
 	/* set of KERN_COLMETA_* flags */
 	cl_uchar		flags;
@@ -594,6 +635,99 @@ typedef struct {
 	cl_uint			coldir[FLEXIBLE_ARRAY_MEMBER];
 } kern_toastbuf;
 
+/*
+ * kern_colenc
+ *
+ * Column array of a column-store that came from the columnar cache may be
+ * encoded, if KERN_COLMETA_ATTENCODED is set. In this case, the column
+ * array (next to the nulls map, if any) begins with kern_colenc instead of
+ * the raw values, and both of host and device code fetch a particular
+ * item using kern_colenc_fetch(). Nulls map is never encoded, so a null
+ * value has to be checked prior to the fetch.
+ *
+ * KERN_COLENC_FOR (frame-of-reference; fixed-length integers)
+ *   data[] is bit-packed array of 'nbits' width deltas from 'base'.
+ * KERN_COLENC_RLE (run-length; fixed-length up to 8 bytes)
+ *   data[nitems] is values of runs, then cl_uint array of the row-index
+ *   that terminates each run follows.
+ * KERN_COLENC_DICT (dictionary; varlena)
+ *   data[] begins with cl_uint array of 'nitems' offsets in the toast
+ *   buffer, then bit-packed array of 'nbits' width codes follows.
+ */
+#define KERN_COLENC_NONE		0
+#define KERN_COLENC_FOR			1
+#define KERN_COLENC_RLE			2
+#define KERN_COLENC_DICT		3
+
+typedef struct {
+	cl_uint			encoding;	/* one of KERN_COLENC_* */
+	cl_uint			nitems;		/* number of runs or dictionary items */
+	cl_uint			nbits;		/* width of packed items, if FOR or DICT */
+	cl_uint			__padding;
+	cl_long			base;		/* base value, if FOR */
+	cl_ulong		data[FLEXIBLE_ARRAY_MEMBER];
+} kern_colenc;
+
+#define KERN_COLENC_DICT_CODES(kcenc)				\
+	((kcenc)->data + ((kcenc)->nitems + 1) / 2)
+#define KERN_COLENC_NWORDS(nbits,nrows)				\
+	((((cl_ulong)(nbits) * (cl_ulong)(nrows)) + 63) / 64)
+
+static inline cl_ulong
+kern_colenc_unpack(__global cl_ulong *words, cl_uint nbits, cl_uint index)
+{
+	cl_ulong	pos = (cl_ulong) nbits * (cl_ulong) index;
+	cl_uint		shift = (cl_uint)(pos & 63);
+	cl_ulong	value;
+
+	if (nbits == 0)
+		return 0;
+	value = words[pos >> 6] >> shift;
+	if (shift + nbits > 64)
+		value |= words[(pos >> 6) + 1] << (64 - shift);
+	if (nbits < 64)
+		value &= (((cl_ulong) 1) << nbits) - 1;
+	return value;
+}
+
+static inline cl_ulong
+kern_colenc_fetch(__global kern_colenc *kcenc, cl_uint rowidx)
+{
+	if (kcenc->encoding == KERN_COLENC_FOR)
+	{
+		cl_ulong	delta = kern_colenc_unpack(kcenc->data,
+											   kcenc->nbits, rowidx);
+		return (cl_ulong)(kcenc->base + (cl_long) delta);
+	}
+	else if (kcenc->encoding == KERN_COLENC_RLE)
+	{
+		__global cl_uint *run_end
+			= (__global cl_uint *)(kcenc->data + kcenc->nitems);
+		cl_uint		lo = 0;
+		cl_uint		hi = kcenc->nitems - 1;
+
+		/* binary search of the run that contains rowidx */
+		while (lo < hi)
+		{
+			cl_uint	mid = (lo + hi) / 2;
+
+			if (run_end[mid] > rowidx)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		return kcenc->data[lo];
+	}
+	else if (kcenc->encoding == KERN_COLENC_DICT)
+	{
+		__global cl_uint *dict = (__global cl_uint *) kcenc->data;
+		cl_ulong	code = kern_colenc_unpack(KERN_COLENC_DICT_CODES(kcenc),
+											  kcenc->nbits, rowidx);
+		return dict[code];
+	}
+	return 0;
+}
+
 #ifdef OPENCL_DEVICE_CODE
 
 /* template for native types */
@@ -603,7 +737,7 @@ typedef struct {
 		bool	isnull;								\
 	} pg_##NAME##_t;
 
-#define STROMCL_VARLENA_DATATYPE_TEMPLACE(NAME)		\
+#define STROMCL_VARLENA_DATATYPE_TEMPLATE(NAME)		\
 	STROMCL_SIMPLE_DATATYPE_TEMPLATE(NAME, __global varlena *)
 
 #define STROMCL_SIMPLE_VARREF_TEMPLATE(NAME,BASE)			\
@@ -613,9 +747,23 @@ typedef struct {
 					 cl_uint rowidx)						\
 	{														\
 		pg_##NAME##_t result;								\
-		__global BASE *addr									\
-			= kern_get_datum(kcs,colidx,rowidx);			\
+		__global BASE *addr;								\
+															\
+		if (kern_colmeta_is_encoded(kcs,colidx))			\
+		{													\
+			union {											\
+				cl_ulong	datum;							\
+				BASE		value;							\
+			} temp;											\
 															\
+			result.isnull = !kern_get_encoded_datum(kcs,	\
+													colidx,	\
+													rowidx,	\
+													&temp.datum); \
+			result.value = temp.value;						\
+			return result;									\
+		}													\
+		addr = kern_get_datum(kcs,colidx,rowidx);			\
 		if (!addr)											\
 			result.isnull = true;							\
 		else												\
@@ -634,18 +782,31 @@ typedef struct {
 					 cl_uint rowidx)						\
 	{														\
 		pg_##NAME##_t result;								\
-		__global cl_uint *p_offset							\
-			= kern_get_datum(kcs,colidx,rowidx);			\
+		cl_uint		offset;									\
 															\
-		if (!p_offset)										\
-			result.isnull = true;							\
+		if (kern_colmeta_is_encoded(kcs,colidx))			\
+		{													\
+			cl_ulong	datum;								\
+															\
+			result.isnull = !kern_get_encoded_datum(kcs,	\
+													colidx,	\
+													rowidx,	\
+													&datum); \
+			offset = (cl_uint) datum;						\
+		}													\
 		else												\
 		{													\
-			cl_uint	offset = *p_offset;						\
+			__global cl_uint *p_offset						\
+				= kern_get_datum(kcs,colidx,rowidx);		\
 															\
+			result.isnull = !p_offset;						\
+			offset = (!p_offset ? 0 : *p_offset);			\
+		}													\
+															\
+		if (!result.isnull)									\
+		{													\
 			if (toast->magic == TOASTBUF_MAGIC)				\
 				offset += toast->coldir[colidx];			\
-			result.isnull = false;							\
 			result.value = ((__global varlena *)			\
 							((uintptr_t)toast + offset));	\
 		}													\
@@ -680,7 +841,6 @@ typedef struct {
 					  cl_uint param_id)						\
 	{														\
 		pg_##NAME##_t result;								\
-		__global varlena *addr;								\
 															\
 		if (param_id < kparam->nparams &&					\
 			kparam->poffset[param_id] > 0)					\
@@ -700,11 +860,99 @@ typedef struct {
 	STROMCL_SIMPLE_VARREF_TEMPLATE(NAME,BASE)		\
 	STROMCL_SIMPLE_PARAMREF_TEMPLATE(NAME,BASE)
 
-#define STROMCL_VRALENA_TYPE_TEMPLATE(NAME)			\
+#define STROMCL_VARLENA_TYPE_TEMPLATE(NAME)			\
 	STROMCL_VARLENA_DATATYPE_TEMPLATE(NAME)			\
 	STROMCL_VARLENA_VARREF_TEMPLATE(NAME)			\
 	STROMCL_VARLENA_PARAMREF_TEMPLATE(NAME)
 
+/*
+ * Vectorized references
+ *
+ * PGSTROM_VECTOR_WIDTH is given by OpenCL intermediator on build time
+ * according to the preferred vector width of the devices, if the program
+ * contains vectorized kernels. A work-item processes PGSTROM_VECTOR_WIDTH
+ * rows from 'base', and a bitmask of the rows being still visible is
+ * carried with the vector values; null-bitmap of the column is merged to
+ * the bitmask by a bitwise operation.
+ * Note that vector load may reach to the tail of the column array, so the
+ * OpenCL intermediator put KERN_VECTOR_PADDING on the buffer.
+ */
+#ifdef PGSTROM_VECTOR_WIDTH
+#define __VECTYPE(BASE,WIDTH)	BASE##WIDTH
+#define _VECTYPE(BASE,WIDTH)	__VECTYPE(BASE,WIDTH)
+#define VECTYPE(BASE)			_VECTYPE(BASE,PGSTROM_VECTOR_WIDTH)
+#define VLOAD					_VECTYPE(vload,PGSTROM_VECTOR_WIDTH)
+#define VSTORE					_VECTYPE(vstore,PGSTROM_VECTOR_WIDTH)
+
+static inline cl_uint
+kern_vector_rowmask(cl_uint nrows, cl_uint base)
+{
+	if (base >= nrows)
+		return 0;
+	if (nrows - base >= PGSTROM_VECTOR_WIDTH)
+		return (1U << PGSTROM_VECTOR_WIDTH) - 1;
+	return (1U << (nrows - base)) - 1;
+}
+
+#define STROMCL_SIMPLE_VECREF_TEMPLATE(NAME,VBASE)			\
+	static inline VECTYPE(VBASE)							\
+	pg_##NAME##_vecref(__global kern_column_store *kcs,		\
+					   cl_uint colidx,						\
+					   cl_uint base,						\
+					   cl_uint *p_mask)						\
+	{														\
+		__global kern_colmeta *cmeta = &kcs->colmeta[colidx]; \
+		__global cl_char *addr								\
+			= (__global cl_char *)kcs + cmeta->cs_ofs;		\
+															\
+		if ((cmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)	\
+		{													\
+			*p_mask &= (((__global cl_uint *)addr)[base >> 5] \
+						>> (base & 31));					\
+			addr += STROMALIGN((kcs->nrows + 7) >> 3);		\
+		}													\
+		return VLOAD(base / PGSTROM_VECTOR_WIDTH,			\
+					 (__global VBASE *)addr);				\
+	}
+
+#define STROMCL_SIMPLE_VECPARAM_TEMPLATE(NAME,VBASE)		\
+	static inline VECTYPE(VBASE)							\
+	pg_##NAME##_vecparam(__global kern_parambuf *kparams,	\
+						 cl_uint param_id,					\
+						 cl_uint *p_mask)					\
+	{														\
+		pg_##NAME##_t param									\
+			= pg_##NAME##_param(kparams, param_id);			\
+															\
+		if (param.isnull)									\
+			*p_mask = 0;									\
+		return (VECTYPE(VBASE))(param.value);				\
+	}
+
+#define STROMCL_SIMPLE_VECTOR_TEMPLATE(NAME,VBASE)	\
+	STROMCL_SIMPLE_VECREF_TEMPLATE(NAME,VBASE)		\
+	STROMCL_SIMPLE_VECPARAM_TEMPLATE(NAME,VBASE)
+
+/* bitmask of the lanes being true, on a result of vector comparison */
+#define STROMCL_VECMASK_TEMPLATE(VBASE)						\
+	static inline cl_uint									\
+	pg_vecmask_##VBASE(VECTYPE(VBASE) cond)					\
+	{														\
+		VBASE		temp[PGSTROM_VECTOR_WIDTH];				\
+		cl_uint		mask = 0;								\
+		cl_uint		i;										\
+															\
+		VSTORE(cond, 0, temp);								\
+		for (i=0; i < PGSTROM_VECTOR_WIDTH; i++)			\
+			mask |= (temp[i] != 0 ? (1U << i) : 0);			\
+		return mask;										\
+	}
+
+STROMCL_VECMASK_TEMPLATE(short)
+STROMCL_VECMASK_TEMPLATE(int)
+STROMCL_VECMASK_TEMPLATE(long)
+#endif	/* PGSTROM_VECTOR_WIDTH */
+
 
 /*
  * Common function to translate a row-store into column-store.
@@ -908,6 +1156,45 @@ kern_get_datum(__global kern_column_store *kcs,
 	return (__global void *)((uintptr_t)kcs + offset);
 }
 
+/*
+ * kern_get_encoded_datum
+ *
+ * Reference to a particular datum on the encoded column array. Because
+ * it has no address to be returned, it puts the datum on '*p_datum' in
+ * the lower bytes, then returns false if it is a null-value.
+ */
+static bool
+kern_get_encoded_datum(__global kern_column_store *kcs,
+					   cl_uint colidx,
+					   cl_uint rowidx,
+					   cl_ulong *p_datum)
+{
+	__global kern_colmeta *colmeta;
+	cl_uint		offset;
+
+	if (colidx >= kcs->ncols || rowidx >= kcs->nrows)
+		return false;
+
+	colmeta = &kcs->colmeta[colidx];
+	offset = colmeta->cs_ofs;
+	if ((colmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
+	{
+		if (att_isnull(rowidx, (__global char *)kcs + offset))
+			return false;
+		offset += STROMALIGN((kcs->nrows + 7) >> 3);
+	}
+	*p_datum = kern_colenc_fetch((__global kern_colenc *)
+								 ((uintptr_t)kcs + offset), rowidx);
+	return true;
+}
+
+static inline bool
+kern_colmeta_is_encoded(__global kern_column_store *kcs, cl_uint colidx)
+{
+	return (colidx < kcs->ncols &&
+			(kcs->colmeta[colidx].flags & KERN_COLMETA_ATTENCODED) != 0);
+}
+
 /* ------------------------------------------------------------
  *
  * Declarations of common built-in types and functions
@@ -39,6 +39,80 @@ static struct {
 	{ (param), sizeof(((pgstrom_device_info *) NULL)->field),			\
 	  offsetof(pgstrom_device_info, field), (is_cstring) }
 
+/*
+ * lookup_device_numa_node
+ *
+ * It tries to identify the NUMA node the device is attached to, according
+ * to the PCI address being reported by vendor extensions. -1 shall be
+ * returned if unknown.
+ */
+#define CL_DEVICE_PCI_BUS_ID_NV			0x4008
+#define CL_DEVICE_PCI_SLOT_ID_NV		0x4009
+#define CL_DEVICE_TOPOLOGY_AMD			0x4037
+#define CL_DEVICE_TOPOLOGY_TYPE_PCIE_AMD	1
+
+static int
+lookup_device_numa_node(cl_device_id device_id, pgstrom_device_info *dev_info)
+{
+	cl_uint		pci_bus;
+	cl_uint		pci_device;
+	cl_uint		pci_func;
+	char		path[MAXPGPATH];
+	FILE	   *filp;
+	int			numa_node = -1;
+
+	if (strstr(dev_info->dev_device_extensions,
+			   "cl_nv_device_attribute_query") != NULL)
+	{
+		cl_uint		bus_id;
+		cl_uint		slot_id;
+
+		if (clGetDeviceInfo(device_id, CL_DEVICE_PCI_BUS_ID_NV,
+							sizeof(cl_uint), &bus_id, NULL) != CL_SUCCESS ||
+			clGetDeviceInfo(device_id, CL_DEVICE_PCI_SLOT_ID_NV,
+							sizeof(cl_uint), &slot_id, NULL) != CL_SUCCESS)
+			return -1;
+		pci_bus = bus_id;
+		pci_device = (slot_id >> 3);
+		pci_func = (slot_id & 0x07);
+	}
+	else if (strstr(dev_info->dev_device_extensions,
+					"cl_amd_device_attribute_query") != NULL)
+	{
+		/* same layout as cl_device_topology_amd */
+		struct {
+			cl_uint		type;
+			cl_char		unused[17];
+			cl_char		bus;
+			cl_char		device;
+			cl_char		function;
+		} topology;
+
+		if (clGetDeviceInfo(device_id, CL_DEVICE_TOPOLOGY_AMD,
+							sizeof(topology), &topology,
+							NULL) != CL_SUCCESS ||
+			topology.type != CL_DEVICE_TOPOLOGY_TYPE_PCIE_AMD)
+			return -1;
+		pci_bus = (cl_uchar) topology.bus;
+		pci_device = (cl_uchar) topology.device;
+		pci_func = (cl_uchar) topology.function;
+	}
+	else
+		return -1;
+
+	snprintf(path, sizeof(path),
+			 "/sys/bus/pci/devices/0000:%02x:%02x.%x/numa_node",
+			 pci_bus, pci_device, pci_func);
+	filp = fopen(path, "r");
+	if (!filp)
+		return -1;
+	if (fscanf(filp, "%d", &numa_node) != 1)
+		numa_node = -1;
+	fclose(filp);
+
+	return numa_node;
+}
+
 pgstrom_device_info *
 collect_opencl_device_info(cl_device_id device_id)
 {
@@ -192,6 +266,7 @@ collect_opencl_device_info(cl_device_id device_id)
 		}
 	}
 	dev_info->buflen = offset;
+	dev_info->dev_numa_node = lookup_device_numa_node(device_id, dev_info);
 
 	/*
 	 * Check device capability is enough to run PG-Strom
@@ -415,8 +490,8 @@ pgstrom_opencl_device_info(PG_FUNCTION_ARGS)
 	}
 	fncxt = SRF_PERCALL_SETUP();
 
-	dindex = fncxt->call_cntr / 55;
-	pindex = fncxt->call_cntr % 55;
+	dindex = fncxt->call_cntr / 56;
+	pindex = fncxt->call_cntr % 56;
 
 	if (dindex == pgstrom_get_device_nums())
 		SRF_RETURN_DONE(fncxt);
@@ -696,6 +771,13 @@ pgstrom_opencl_device_info(PG_FUNCTION_ARGS)
 			key = "driver version";
 			value = dinfo->driver_version;
 			break;
+		case 55:
+			key = "numa node";
+			if (dinfo->dev_numa_node < 0)
+				value = "unknown";
+			else
+				value = psprintf("%d", dinfo->dev_numa_node);
+			break;
 		default:
 			elog(ERROR, "unexpected property index");
 			break;
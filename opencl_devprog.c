@@ -20,11 +20,15 @@
 #include "utils/builtins.h"
 #include "utils/guc.h"
 #include "utils/pg_crc.h"
+#include <fcntl.h>
 #include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "pg_strom.h"
 
 static shmem_startup_hook_type shmem_startup_hook_next;
 static int	reclaim_threshold;
+static bool	kernel_cache_enabled;
 
 #define DEVPROG_HASH_SIZE	2048
 
@@ -39,6 +43,8 @@ typedef struct {
 	StromTag	stag;		/* = StromTag_DevProgram */
 	dlist_node	hash_chain;
 	dlist_node	lru_chain;
+	uint64		num_lookups;	/* number of lookups on this program */
+	uint64		num_hits;		/* number of lookups found this program */
 	/*
 	 * NOTE: above members are protected by opencl_devprog_shm_values->lock.
 	 */
@@ -47,7 +53,13 @@ typedef struct {
 	dlist_head	waitq;		/* wait queue of program build */
 	cl_program	program;	/* valid only OpenCL intermediator */
 	bool		build_running;	/* true, if async build is running */
+	uint32		build_count;	/* number of builds completed */
 	char	   *errmsg;		/* error message if build error */
+	/* the fields below are touched by the thread that builds the program */
+	pg_crc32	bin_key;	/* key of the kernel binary cache */
+	bool		bin_loaded;	/* true, if program is built from binary */
+	bool		bin_broken;	/* true, if cached binary is not available */
+	cl_uint		vector_width;	/* PGSTROM_VECTOR_WIDTH, or 0 if none */
 
 	/* The fields below are read-only once constructed */
 	pg_crc32	crc;
@@ -109,6 +121,245 @@ pgstrom_reclaim_devprog(void)
 	SpinLockRelease(&opencl_devprog_shm_values->lock);
 }
 
+/*
+ * Kernel binary cache
+ *
+ * Build of OpenCL programs takes several seconds, so the binaries being
+ * built are saved on the directory below $PGDATA, to skip compile after
+ * restart of the server. Key of the cache is CRC of the sources (including
+ * the common libraries), build options, and name and driver version of
+ * the devices, because a binary is meaningful only for a particular device
+ * and driver. Each file also holds the source of the device program, so
+ * we can ensure it is exactly what we are looking for.
+ */
+#define DEVPROG_CACHE_DIR		"pg_strom_cache"
+#define DEVPROG_CACHE_MAGIC		0x5354524d	/* "STRM" */
+
+typedef struct {
+	uint32		magic;
+	pg_crc32	bin_key;
+	int32		extra_flags;
+	uint32		num_devices;
+	uint64		source_len;
+	uint64		binary_len[FLEXIBLE_ARRAY_MEMBER];
+	/* source of the program, then binaries of the devices */
+} devprog_cache_header;
+
+static pg_crc32
+clserv_devprog_cache_key(const char **sources, const size_t *lengths,
+						 cl_uint count, const char *build_opts)
+{
+	pg_crc32	crc;
+	cl_uint		i;
+
+	INIT_CRC32(crc);
+	for (i=0; i < count; i++)
+		COMP_CRC32(crc, sources[i], lengths[i]);
+	COMP_CRC32(crc, build_opts, strlen(build_opts));
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		const pgstrom_device_info *dinfo = pgstrom_get_device_info(i);
+
+		COMP_CRC32(crc, dinfo->dev_name, strlen(dinfo->dev_name));
+		COMP_CRC32(crc, dinfo->driver_version,
+				   strlen(dinfo->driver_version));
+	}
+	FIN_CRC32(crc);
+
+	return crc;
+}
+
+static void
+clserv_devprog_cache_path(char *path, size_t pathlen, pg_crc32 bin_key,
+						  bool is_temp)
+{
+	if (!is_temp)
+		snprintf(path, pathlen, "%s/%08x.bin",
+				 DEVPROG_CACHE_DIR, bin_key);
+	else
+		snprintf(path, pathlen, "%s/%08x.bin.%u",
+				 DEVPROG_CACHE_DIR, bin_key, (unsigned int) getpid());
+}
+
+/*
+ * clserv_devprog_load_binary
+ *
+ * It tries to construct a program object from the cached binary. NULL
+ * shall be returned if not available.
+ */
+static cl_program
+clserv_devprog_load_binary(devprog_entry *dprog)
+{
+	devprog_cache_header *header = NULL;
+	const unsigned char *binaries[MAX_NUM_DEVICES];
+	size_t		lengths[MAX_NUM_DEVICES];
+	cl_int		status[MAX_NUM_DEVICES];
+	cl_program	program = NULL;
+	char		path[MAXPGPATH];
+	struct stat	stbuf;
+	char	   *pos;
+	cl_uint		i;
+	cl_int		rc;
+	int			fdesc;
+
+	clserv_devprog_cache_path(path, sizeof(path), dprog->bin_key, false);
+	fdesc = open(path, O_RDONLY);
+	if (fdesc < 0)
+		return NULL;	/* not cached yet */
+	if (fstat(fdesc, &stbuf) != 0 ||
+		stbuf.st_size < offsetof(devprog_cache_header,
+								 binary_len[opencl_num_devices]))
+		goto out;
+
+	header = malloc(stbuf.st_size);
+	if (!header)
+		goto out;
+	if (read(fdesc, header, stbuf.st_size) != stbuf.st_size)
+		goto out;
+
+	/* is it exactly what we are looking for? */
+	if (header->magic != DEVPROG_CACHE_MAGIC ||
+		header->bin_key != dprog->bin_key ||
+		header->extra_flags != dprog->extra_flags ||
+		header->num_devices != opencl_num_devices ||
+		header->source_len != dprog->source_len)
+		goto out;
+	pos = (char *)&header->binary_len[opencl_num_devices];
+	if (memcmp(pos, dprog->source, dprog->source_len) != 0)
+		goto out;
+	pos += dprog->source_len;
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		if (pos + header->binary_len[i] > (char *)header + stbuf.st_size)
+			goto out;
+		binaries[i] = (const unsigned char *) pos;
+		lengths[i] = header->binary_len[i];
+		pos += header->binary_len[i];
+	}
+
+	program = clCreateProgramWithBinary(opencl_context,
+										opencl_num_devices,
+										opencl_devices,
+										lengths,
+										binaries,
+										status,
+										&rc);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "clCreateProgramWithBinary failed: %s",
+			 opencl_strerror(rc));
+		program = NULL;
+		unlink(path);
+	}
+out:
+	if (header)
+		free(header);
+	close(fdesc);
+
+	return program;
+}
+
+/*
+ * clserv_devprog_save_binary
+ *
+ * It saves binaries of the program being built from the source. The file
+ * is written on a temporary file then renamed, so concurrent loader never
+ * see a half-written file.
+ */
+static void
+clserv_devprog_save_binary(devprog_entry *dprog, cl_program program)
+{
+	devprog_cache_header *header;
+	unsigned char *binaries[MAX_NUM_DEVICES];
+	size_t		lengths[MAX_NUM_DEVICES];
+	size_t		total_len;
+	char		path[MAXPGPATH];
+	char		temp[MAXPGPATH];
+	char	   *pos;
+	cl_uint		i;
+	cl_int		rc;
+	int			fdesc;
+
+	rc = clGetProgramInfo(program,
+						  CL_PROGRAM_BINARY_SIZES,
+						  sizeof(size_t) * opencl_num_devices,
+						  lengths,
+						  NULL);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "clGetProgramInfo failed: %s", opencl_strerror(rc));
+		return;
+	}
+	total_len = (offsetof(devprog_cache_header,
+						  binary_len[opencl_num_devices]) +
+				 dprog->source_len);
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		if (lengths[i] == 0)
+			return;		/* binary is not available on this driver */
+		total_len += lengths[i];
+	}
+
+	header = malloc(total_len);
+	if (!header)
+		return;
+	header->magic = DEVPROG_CACHE_MAGIC;
+	header->bin_key = dprog->bin_key;
+	header->extra_flags = dprog->extra_flags;
+	header->num_devices = opencl_num_devices;
+	header->source_len = dprog->source_len;
+	pos = (char *)&header->binary_len[opencl_num_devices];
+	memcpy(pos, dprog->source, dprog->source_len);
+	pos += dprog->source_len;
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		header->binary_len[i] = lengths[i];
+		binaries[i] = (unsigned char *) pos;
+		pos += lengths[i];
+	}
+	rc = clGetProgramInfo(program,
+						  CL_PROGRAM_BINARIES,
+						  sizeof(unsigned char *) * opencl_num_devices,
+						  binaries,
+						  NULL);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "clGetProgramInfo failed: %s", opencl_strerror(rc));
+		goto out;
+	}
+
+	if (mkdir(DEVPROG_CACHE_DIR, S_IRWXU) != 0 && errno != EEXIST)
+	{
+		elog(LOG, "could not create directory \"%s\": %m",
+			 DEVPROG_CACHE_DIR);
+		goto out;
+	}
+	clserv_devprog_cache_path(temp, sizeof(temp), dprog->bin_key, true);
+	clserv_devprog_cache_path(path, sizeof(path), dprog->bin_key, false);
+	fdesc = open(temp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fdesc < 0)
+	{
+		elog(LOG, "could not create file \"%s\": %m", temp);
+		goto out;
+	}
+	if (write(fdesc, header, total_len) != total_len)
+	{
+		elog(LOG, "could not write file \"%s\": %m", temp);
+		close(fdesc);
+		unlink(temp);
+		goto out;
+	}
+	close(fdesc);
+	if (rename(temp, path) != 0)
+	{
+		elog(LOG, "could not rename file \"%s\" to \"%s\": %m",
+			 temp, path);
+		unlink(temp);
+	}
+out:
+	free(header);
+}
+
 /*
  * clserv_devprog_build_callback
  *
@@ -121,7 +372,7 @@ clserv_devprog_build_callback(cl_program program, void *cb_private)
 {
 	devprog_entry *dprog = (devprog_entry *) cb_private;
 	cl_build_status	status;
-	dlist_mutable_iter iter;
+	dlist_iter	iter;
 	struct timeval	tv;
 	char		   *errmsg = NULL;
 	cl_int			i, rc;
@@ -182,23 +433,25 @@ clserv_devprog_build_callback(cl_program program, void *cb_private)
 	/*
 	 * OK, source build was successfully done for all the devices
 	 */
+	if (kernel_cache_enabled && !dprog->bin_loaded)
+		clserv_devprog_save_binary(dprog, program);
+
 	SpinLockAcquire(&dprog->lock);
 	Assert(dprog->program == program);
-	dlist_foreach_modify(iter, &dprog->waitq)
+	dlist_foreach(iter, &dprog->waitq)
 	{
 		pgstrom_message	*msg
 			= dlist_container(pgstrom_message, chain, iter.cur);
 
-		dlist_delete(&msg->chain);
-
 		if (msg->pfm.enabled)
 		{
 			gettimeofday(&tv, NULL);
 			msg->pfm.time_kern_build += timeval_diff(&msg->pfm.tv, &tv);
 		}
-		pgstrom_enqueue_message(msg);
 	}
+	pgstrom_enqueue_message_list(&dprog->waitq);
 	dprog->build_running = false;
+	dprog->build_count++;
 	SpinLockRelease(&dprog->lock);
 	return;
 
@@ -206,16 +459,34 @@ clserv_devprog_build_callback(cl_program program, void *cb_private)
 out_error:
 	SpinLockAcquire(&dprog->lock);
 	Assert(dprog->program == program);
-	dprog->errmsg = errmsg;
-	dlist_foreach_modify(iter, &dprog->waitq)
+	if (dprog->bin_loaded)
 	{
-		pgstrom_message *msg
-			= dlist_container(pgstrom_message, chain, iter.cur);
+		char	path[MAXPGPATH];
 
-		dlist_delete(&msg->chain);
-        pgstrom_enqueue_message(msg);
-    }
+		/*
+		 * Cached binary is broken, or not compatible with the device.
+		 * We remove the binary and retry build from the source.
+		 */
+		clserv_devprog_cache_path(path, sizeof(path), dprog->bin_key, false);
+		unlink(path);
+		elog(LOG, "cached kernel binary \"%s\" was broken, rebuild it", path);
+		if (errmsg)
+			pgstrom_shmem_free(errmsg);
+		dprog->bin_loaded = false;
+		dprog->bin_broken = true;
+		pgstrom_enqueue_message_list(&dprog->waitq);
+		dprog->build_running = false;
+		dprog->build_count++;
+		rc = clReleaseProgram(program);
+		Assert(rc == CL_SUCCESS);
+		dprog->program = NULL;
+		SpinLockRelease(&dprog->lock);
+		return;
+	}
+	dprog->errmsg = errmsg;
+	pgstrom_enqueue_message_list(&dprog->waitq);
 	dprog->build_running = false;
+	dprog->build_count++;
 	rc = clReleaseProgram(program);
 	Assert(rc == CL_SUCCESS);
 	dprog->program = BAD_OPENCL_PROGRAM;
@@ -240,6 +511,37 @@ out_error:
  * In case of (3), it returns BAD_OPENCL_PROGRAM to inform caller the
  * supplied program has compile errors, or something broken.
  */
+/*
+ * clserv_devprog_vector_width
+ *
+ * It determines width of the vectorized kernels; the least preferred vector
+ * width for int among the devices that prefer vector types. Programs are
+ * built for all the devices at once, so the width has to be common, but
+ * OpenCL intermediator launches the vectorized kernels only on the devices
+ * that prefer vector types. It returns 0, if no devices prefer them.
+ */
+static cl_uint
+clserv_devprog_vector_width(void)
+{
+	const pgstrom_device_info *dinfo;
+	cl_uint		width = KERN_VECTOR_MAXWIDTH + 1;
+	cl_uint		i;
+
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		dinfo = pgstrom_get_device_info(i);
+		if (!dinfo || dinfo->dev_preferred_vector_width_int < 2)
+			continue;
+		width = Min(width, dinfo->dev_preferred_vector_width_int);
+	}
+	if (width > KERN_VECTOR_MAXWIDTH)
+		return (width == KERN_VECTOR_MAXWIDTH + 1 ? 0 : KERN_VECTOR_MAXWIDTH);
+	/* vector types have 2, 4, 8 or 16 width */
+	while ((width & (width - 1)) != 0)
+		width &= (width - 1);
+	return width;
+}
+
 cl_program
 clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 {
@@ -262,26 +564,39 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 		pgstrom_reclaim_devprog();
 
 	SpinLockAcquire(&dprog->lock);
-	if (!dprog->program)
+	if (!dprog->program && !dprog->build_running)
 	{
-		cl_program	program;
+		cl_program	program = NULL;
 		const char *sources[32];
 		size_t		lengths[32];
 		char		build_opts[256];
+		char		vector_opts[40];
 		cl_uint		count = 0;
+		uint32		build_count;
+
+		/*
+		 * Construction of the program object may involve file i/o to
+		 * load the cached binary, so we release the lock after marking
+		 * build is running. Concurrent lookups are chained on the waitq.
+		 */
+		dprog->build_running = true;
+		if (message)
+			dlist_push_tail(&dprog->waitq, &message->chain);
+		SpinLockRelease(&dprog->lock);
 
 		/* common opencl header */
 		sources[count] = pgstrom_opencl_common_code;
 		lengths[count] = strlen(pgstrom_opencl_common_code);
 		count++;
 #if 0
-		/* opencl timelib */
+		/* opencl timelib (not implemented yet) */
 		if (dprog->extra_flags & DEVFUNC_NEEDS_TIMELIB)
 		{
 			sources[count] = pgstrom_opencl_timelib_code;
 			lengths[count] = strlen(pgstrom_opencl_timelib_code);
 			count++;
 		}
+#endif
 		/* opencl textlib */
 		if (dprog->extra_flags & DEVFUNC_NEEDS_TEXTLIB)
 		{
@@ -296,7 +611,6 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 			lengths[count] = strlen(pgstrom_opencl_numericlib_code);
 			count++;
 		}
-#endif
 		/* gpuscan device implementation */
 		if (dprog->extra_flags & DEVKERNEL_NEEDS_GPUSCAN)
 		{
@@ -304,7 +618,6 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 			lengths[count] = strlen(pgstrom_opencl_gpuscan_code);
 			count++;
 		}
-#if 0
 		/* gpusort device implementation */
 		if (dprog->extra_flags & DEVKERNEL_NEEDS_GPUSORT)
 		{
@@ -319,30 +632,74 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 			lengths[count] = strlen(pgstrom_opencl_hashjoin_code);
 			count++;
 		}
-#endif
+		/* gpupreagg device implementation */
+		if (dprog->extra_flags & DEVKERNEL_NEEDS_GPUPREAGG)
+		{
+			sources[count] = pgstrom_opencl_gpupreagg_code;
+			lengths[count] = strlen(pgstrom_opencl_gpupreagg_code);
+			count++;
+		}
 		/* source code of this program */
 		sources[count] = dprog->source;
 		lengths[count] = dprog->source_len;
 		count++;
 
+		/* width of the vectorized kernels, if any */
+		dprog->vector_width = 0;
+		vector_opts[0] = '\0';
+		if ((dprog->extra_flags & DEVKERNEL_NEEDS_VECTOR) != 0)
+		{
+			dprog->vector_width = clserv_devprog_vector_width();
+			if (dprog->vector_width > 0)
+				snprintf(vector_opts, sizeof(vector_opts),
+						 "-DPGSTROM_VECTOR_WIDTH=%u ", dprog->vector_width);
+		}
+
+		Assert(SIZEOF_VOID_P == 8 || SIZEOF_VOID_P == 4);
+		snprintf(build_opts, sizeof(build_opts),
+				 "-DOPENCL_DEVICE_CODE -DHOSTPTRLEN=%u %s%s"
+#ifdef PGSTROM_DEBUG
+				 "-Werror -cl-opt-disable"
+#endif
+				 , SIZEOF_VOID_P,
+				 ((dprog->extra_flags & DEVKERNEL_NEEDS_DEBUG) != 0
+				  ? "-DPGSTROM_KERNEL_DEBUG=1 " : ""),
+				 vector_opts);
+
+		/* try to load the binary being built in the past */
+		if (kernel_cache_enabled)
+		{
+			dprog->bin_key = clserv_devprog_cache_key(sources, lengths,
+													  count, build_opts);
+			if (!dprog->bin_broken)
+				program = clserv_devprog_load_binary(dprog);
+		}
+		dprog->bin_loaded = (program != NULL);
+
 		/* OK, construct a program object */
-		program = clCreateProgramWithSource(opencl_context,
-											count,
-											sources,
-											lengths,
-											&rc);
-		if (rc != CL_SUCCESS)
+		if (!program)
 		{
-			elog(LOG, "clCreateProgramWithSource failed: %s",
-				 opencl_strerror(rc));
-			dprog->program = BAD_OPENCL_PROGRAM;
-			goto out_unlock;
+			program = clCreateProgramWithSource(opencl_context,
+												count,
+												sources,
+												lengths,
+												&rc);
+			if (rc != CL_SUCCESS)
+			{
+				elog(LOG, "clCreateProgramWithSource failed: %s",
+					 opencl_strerror(rc));
+				/* waiting messages shall get error responses */
+				SpinLockAcquire(&dprog->lock);
+				dprog->program = BAD_OPENCL_PROGRAM;
+				dprog->build_running = false;
+				pgstrom_enqueue_message_list(&dprog->waitq);
+				SpinLockRelease(&dprog->lock);
+				return NULL;
+			}
 		}
+		SpinLockAcquire(&dprog->lock);
 		dprog->program = program;
-		dprog->build_running = true;
-		if (message)
-			dlist_push_tail(&dprog->waitq, &message->chain);
-
+		build_count = dprog->build_count;
 		/*
 		 * NOTE: clBuildProgram() kicks kernel build asynchronously or
 		 * synchronously depending on the OpenCL driver. In our trial,
@@ -350,20 +707,11 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 		 * driver has synchronous manner.
 		 * Its callback function on build completion acquires the lock
 		 * of device-program, we have to release it prior to the call of
-		 * clBuildProgram().
+		 * clBuildProgram(). Even if program is constructed from binary,
+		 * clBuildProgram() is still needed, but it takes little time.
 		 */
 		SpinLockRelease(&dprog->lock);
 
-		Assert(SIZEOF_VOID_P == 8 || SIZEOF_VOID_P == 4);
-		snprintf(build_opts, sizeof(build_opts),
-				 "-DOPENCL_DEVICE_CODE -DHOSTPTRLEN=%u %s"
-#ifdef PGSTROM_DEBUG
-				 "-Werror -cl-opt-disable"
-#endif
-				 , SIZEOF_VOID_P,
-				 ((dprog->extra_flags & DEVKERNEL_NEEDS_DEBUG) != 0
-				  ? "-DPGSTROM_KERNEL_DEBUG=1 " : ""));
-
 		rc = clBuildProgram(program,
 							opencl_num_devices,
 							opencl_devices,
@@ -372,7 +720,7 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 							dprog);
 		if (rc != CL_SUCCESS)
 		{
-			dlist_mutable_iter iter;
+			dlist_iter	iter;
 
 			elog(LOG, "clBuildProgram failed: %s", opencl_strerror(rc));
 
@@ -391,17 +739,21 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 			 * NOTE: In case of synchronous build failure, program-build
 			 * callback is already called; that makes response message
 			 * with error code, so this message should be no longer handled
-			 * by OpenCL server. (This callback clears 'build_running').
+			 * by OpenCL server. (This callback increments 'build_count').
 			 * In this case, we returns the caller NULL, to break its
 			 * cb_process handler immediately, without duplicated message
 			 * queuing.
+			 * 'build_running' is not a reliable sign here, because the
+			 * callback may re-enqueue the messages to retry build from
+			 * the source, then another thread may already begin a new
+			 * build of this entry with another cl_program object.
 			 */
-			if (!dprog->build_running)
+			if (dprog->build_count != build_count)
 			{
-				Assert(dlist_is_empty(&dprog->waitq));
 				SpinLockRelease(&dprog->lock);
 				return NULL;
 			}
+			Assert(dprog->program == program && dprog->build_running);
 
 			/*
 			 * otherwise, all the waiting messages shall be enqueued again
@@ -412,12 +764,11 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 			rc = clReleaseProgram(program);
 			Assert(rc == CL_SUCCESS);
 
-			dlist_foreach_modify(iter, &dprog->waitq)
+			dlist_foreach(iter, &dprog->waitq)
 			{
 				pgstrom_message *msg
 					= dlist_container(pgstrom_message, chain, iter.cur);
 
-				dlist_delete(&msg->chain);
 				if (msg->pfm.enabled)
 				{
 					gettimeofday(&tv, NULL);
@@ -425,8 +776,8 @@ clserv_lookup_device_program(Datum dprog_key, pgstrom_message *message)
 						+= timeval_diff(&msg->pfm.tv, &tv);
 					gettimeofday(&msg->pfm.tv, NULL);
 				}
-				pgstrom_enqueue_message(msg);
 			}
+			pgstrom_enqueue_message_list(&dprog->waitq);
 			goto out_unlock;
 		}
 		return NULL;
@@ -514,6 +865,8 @@ retry:
 		{
 			dlist_move_head(&opencl_devprog_shm_values->lru_list,
 							&entry->lru_chain);
+			entry->num_lookups++;
+			entry->num_hits++;
 			SpinLockAcquire(&entry->lock);
 			entry->refcnt++;
 			SpinLockRelease(&entry->lock);
@@ -549,12 +902,19 @@ retry:
 		elog(ERROR, "out of shared memory");
 
 	dprog->stag = StromTag_DevProgram;
+	dprog->num_lookups = 1;		/* this lookup is a cache miss */
+	dprog->num_hits = 0;
 	SpinLockInit(&dprog->lock);
 	dprog->refcnt = 1;
 	dlist_init(&dprog->waitq);
 	dprog->program = NULL;
 	dprog->build_running = false;
+	dprog->build_count = 0;
     dprog->errmsg = NULL;
+	dprog->bin_key = 0;
+	dprog->bin_loaded = false;
+	dprog->bin_broken = false;
+	dprog->vector_width = 0;
 	dprog->crc = crc;
 	dprog->extra_flags = extra_flags;
 	dprog->source_len = source_len;
@@ -641,6 +1001,22 @@ pgstrom_get_devprog_extra_flags(Datum dprog_key)
 	return dprog->extra_flags;
 }
 
+/*
+ * pgstrom_get_devprog_vector_width
+ *
+ * it returns width of the vectorized kernels in the device program, or 0
+ * if not built. It is valid only after the program is built.
+ */
+cl_uint
+pgstrom_get_devprog_vector_width(Datum dprog_key)
+{
+	devprog_entry  *dprog = (devprog_entry *) DatumGetPointer(dprog_key);
+
+	if (!dprog)
+		return 0;
+	return dprog->vector_width;
+}
+
 /*
  * pgstrom_get_devprog_kernel_source
  *
@@ -669,6 +1045,8 @@ typedef struct {
 	pg_crc32	crc;
 	int32		flags;
 	Size		length;
+	uint64		lookups;
+	uint64		hits;
 	text	   *source;
 	text	   *errmsg;
 } devprog_info;
@@ -679,8 +1057,8 @@ pgstrom_opencl_program_info(PG_FUNCTION_ARGS)
 	FuncCallContext *fncxt;
 	devprog_info	*dp_info;
 	HeapTuple		tuple;
-	Datum			values[8];
-	bool			isnull[8];
+	Datum			values[11];
+	bool			isnull[11];
 	char			buf[256];
 
 	if (SRF_IS_FIRSTCALL())
@@ -692,7 +1070,7 @@ pgstrom_opencl_program_info(PG_FUNCTION_ARGS)
 		fncxt = SRF_FIRSTCALL_INIT();
 		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
 
-		tupdesc = CreateTemplateTupleDesc(8, false);
+		tupdesc = CreateTemplateTupleDesc(11, false);
 		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "key",
 						   TEXTOID, -1, 0);
 		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "refcnt",
@@ -705,9 +1083,15 @@ pgstrom_opencl_program_info(PG_FUNCTION_ARGS)
 						   INT4OID, -1, 0);
 		TupleDescInitEntry(tupdesc, (AttrNumber) 6, "length",
 						   INT4OID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 7, "source",
+		TupleDescInitEntry(tupdesc, (AttrNumber) 7, "lookups",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 8, "hits",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 9, "hit_ratio",
+						   FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 10, "source",
 						   TEXTOID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 8, "errmsg",
+		TupleDescInitEntry(tupdesc, (AttrNumber) 11, "errmsg",
 						   TEXTOID, -1, 0);
 		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
 
@@ -740,6 +1124,8 @@ pgstrom_opencl_program_info(PG_FUNCTION_ARGS)
 					dp_info->crc = entry->crc;
 					dp_info->flags = entry->extra_flags;
 					dp_info->length = entry->source_len;
+					dp_info->lookups = entry->num_lookups;
+					dp_info->hits = entry->num_hits;
 					dp_info->source = cstring_to_text(entry->source);
 					if (entry->errmsg)
 						dp_info->errmsg = cstring_to_text(entry->errmsg);
@@ -781,11 +1167,18 @@ pgstrom_opencl_program_info(PG_FUNCTION_ARGS)
 	values[3] = CStringGetTextDatum(buf);
 	values[4] = Int32GetDatum(dp_info->flags);
 	values[5] = Int32GetDatum(dp_info->length);
-	values[6] = PointerGetDatum(dp_info->source);
+	values[6] = Int64GetDatum(dp_info->lookups);
+	values[7] = Int64GetDatum(dp_info->hits);
+	if (dp_info->lookups > 0)
+		values[8] = Float8GetDatum((double) dp_info->hits /
+								   (double) dp_info->lookups);
+	else
+		isnull[8] = true;
+	values[9] = PointerGetDatum(dp_info->source);
 	if (dp_info->errmsg)
-		values[7] = PointerGetDatum(dp_info->errmsg);
+		values[10] = PointerGetDatum(dp_info->errmsg);
 	else
-		isnull[7] = true;
+		isnull[10] = true;
 
 	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
 
@@ -828,6 +1221,16 @@ pgstrom_startup_opencl_devprog(void)
 void
 pgstrom_init_opencl_devprog(void)
 {
+	/* cache of the kernel binaries */
+	DefineCustomBoolVariable("pgstrom.kernel_cache",
+							 "Enables on-disk cache of kernel binaries",
+							 NULL,
+							 &kernel_cache_enabled,
+							 true,
+							 PGC_POSTMASTER,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+
 	/* threshold to reclaim the cached opencl programs */
 	DefineCustomIntVariable("pgstrom.devprog_reclaim_threshold",
 							"threahold to reclaim device program objects",
@@ -603,6 +603,14 @@ static cl_program (*p_clCreateProgramWithSource)(
 	const char **strings,
 	const size_t *lengths,
 	cl_int *errcode_ret) = NULL;
+static cl_program (*p_clCreateProgramWithBinary)(
+	cl_context context,
+	cl_uint num_devices,
+	const cl_device_id *device_list,
+	const size_t *lengths,
+	const unsigned char **binaries,
+	cl_int *binary_status,
+	cl_int *errcode_ret) = NULL;
 static cl_int (*p_clRetainProgram)(cl_program program) = NULL;
 static cl_int (*p_clReleaseProgram)(cl_program program) = NULL;
 static cl_int (*p_clBuildProgram)(
@@ -642,6 +650,24 @@ clCreateProgramWithSource(cl_context context,
 										  errcode_ret);
 }
 
+cl_program
+clCreateProgramWithBinary(cl_context context,
+						  cl_uint num_devices,
+						  const cl_device_id *device_list,
+						  const size_t *lengths,
+						  const unsigned char **binaries,
+						  cl_int *binary_status,
+						  cl_int *errcode_ret)
+{
+	return (*p_clCreateProgramWithBinary)(context,
+										  num_devices,
+										  device_list,
+										  lengths,
+										  binaries,
+										  binary_status,
+										  errcode_ret);
+}
+
 cl_int
 clRetainProgram(cl_program program)
 {
@@ -1142,6 +1168,7 @@ pgstrom_init_opencl_entry(void)
 		LOOKUP_OPENCL_FUNCTION(clGetSamplerInfo);
 		/* Program Objects */
 		LOOKUP_OPENCL_FUNCTION(clCreateProgramWithSource);
+		LOOKUP_OPENCL_FUNCTION(clCreateProgramWithBinary);
 		LOOKUP_OPENCL_FUNCTION(clRetainProgram);
 		LOOKUP_OPENCL_FUNCTION(clReleaseProgram);
 		LOOKUP_OPENCL_FUNCTION(clBuildProgram);
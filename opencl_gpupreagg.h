@@ -0,0 +1,467 @@
+/*
+ * opencl_gpupreagg.h
+ *
+ * Preprocess of aggregate using GPU acceleration, to reduce number of
+ * rows to be processed by CPU.
+ * --
+ * Copyright 2011-2014 (C) KaiGai Kohei <kaigai@kaigai.gr.jp>
+ * Copyright 2014 (C) The PG-Strom Development Team
+ *
+ * This software is an extension of PostgreSQL; You can use, copy,
+ * modify or distribute it under the terms of 'LICENSE' included
+ * within this package.
+ */
+#ifndef OPENCL_GPUPREAGG_H
+#define OPENCL_GPUPREAGG_H
+
+/*
+ * Pre-aggregation of a chunk using GPU/MIC acceleration
+ *
+ * The kern_gpupreagg has a kern_parambuf, then kern_preagg_result follows.
+ * Device groups the rows on the row-store by the grouping keys, using a
+ * hash table on the device memory, then computes partial results of the
+ * aggregate functions for each group. Each group is written back as a
+ * kern_preagg_item that has index of a representative row of the group
+ * (0-origin) to fetch the grouping keys on the host side, and the partial
+ * results being normalized to 64bit integer or floating point values.
+ *
+ * +-----------------+
+ * | kern_parambuf   |
+ * |      :          |
+ * +-----------------+
+ * | errcode         |
+ * | nrooms          | max number of groups in this chunk
+ * | nitems          | number of groups in this chunk
+ * | nparts (= M)    | number of partial results per group
+ * | nslots          | number of hash slots; has to be power of 2
+ * | items[]         |
+ * | +---------------|
+ * | | rowidx        | index of the representative row
+ * | | nullmask      | bitmap of partial results being null
+ * | | values[0]     |
+ * | |    :          |
+ * | | values[M-1]   |
+ * | +---------------|
+ * | |    :          |
+ * +-+---------------+
+ *
+ * If number of groups exceeds 'nrooms', StromError_DataStoreNoSpace shall
+ * be returned, then host side computes partial results by itself.
+ *
+ * The device code consists of three kernels, and also needs a working
+ * buffer on the device memory; that is not transferred to the host.
+ * (1) gpupreagg_setup_rs translates the row-store into column-store, and
+ *     clears the hash slots.
+ * (2) gpupreagg_grouping assigns a group to each row. A row that put its
+ *     index on an empty hash slot becomes the representative of a new
+ *     group, and the other rows with same grouping keys belong to the
+ *     group.
+ * (3) gpupreagg_aggregate computes the partial results. Rows in a work-
+ *     group are reduced on the local memory first, then only one thread
+ *     per group per work-group updates the partial results on the global
+ *     memory with atomic operations. It allows to reduce the contention
+ *     where number of groups is small.
+ */
+typedef struct {
+	cl_uint			rowidx;		/* index of the representative row */
+	cl_uint			nullmask;	/* bitmap of partial results being null */
+	cl_ulong		values[FLEXIBLE_ARRAY_MEMBER];	/* cl_long or cl_double */
+} kern_preagg_item;
+
+typedef struct {
+	cl_int			errcode;	/* chunk-level error */
+	cl_uint			nrooms;		/* max number of groups */
+	cl_uint			nitems;		/* number of groups */
+	cl_uint			nparts;		/* number of partial results per group */
+	cl_uint			nslots;		/* number of hash slots */
+	cl_uint			__padding;
+	cl_ulong		items[FLEXIBLE_ARRAY_MEMBER];
+} kern_preagg_result;
+
+#define GPUPREAGG_MAX_PARTIALS		32
+
+#define KERN_PREAGG_ITEM_LENGTH(nparts)				\
+	offsetof(kern_preagg_item, values[(nparts)])
+#define KERN_PREAGG_ITEM(kpresult, index)							\
+	((__global kern_preagg_item *)									\
+	 ((__global char *)(kpresult)->items +							\
+	  KERN_PREAGG_ITEM_LENGTH((kpresult)->nparts) * (index)))
+#define KERN_PREAGG_RESULT_LENGTH(kpresult)							\
+	(offsetof(kern_preagg_result, items) +							\
+	 KERN_PREAGG_ITEM_LENGTH((kpresult)->nparts) * (kpresult)->nrooms)
+
+typedef struct {
+	kern_parambuf	kparam;
+	/*
+	 * as above, kern_preagg_result shall be located next to the parambuf
+	 */
+} kern_gpupreagg;
+
+#define KERN_GPUPREAGG_PARAMBUF(kgpreagg)			\
+	((__global kern_parambuf *)(&(kgpreagg)->kparam))
+#define KERN_GPUPREAGG_RESULTBUF(kgpreagg)			\
+	((__global kern_preagg_result *)				\
+	 ((char *)(kgpreagg) + (kgpreagg)->kparam.length))
+#define KERN_GPUPREAGG_LENGTH(kgpreagg)				\
+	(offsetof(kern_gpupreagg, kparam) +				\
+	 (kgpreagg)->kparam.length +					\
+	 KERN_PREAGG_RESULT_LENGTH(KERN_GPUPREAGG_RESULTBUF(kgpreagg)))
+#define KERN_GPUPREAGG_DMA_SENDLEN(kgpreagg)		\
+	((kgpreagg)->kparam.length +					\
+	 offsetof(kern_preagg_result, items))
+#define KERN_GPUPREAGG_DMA_RECVLEN(kgpreagg)		\
+	KERN_PREAGG_RESULT_LENGTH(KERN_GPUPREAGG_RESULTBUF(kgpreagg))
+
+/*
+ * Length of the working buffer on the device; hash slots, index of the
+ * representative row and group of each row.
+ */
+#define KERN_GPUPREAGG_WORKBUF_LENGTH(nslots, nrows)	\
+	(sizeof(cl_uint) * ((nslots) + 2 * (nrows)))
+
+#ifdef OPENCL_DEVICE_CODE
+
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+
+/*
+ * Functions being generated on the fly according to the grouping keys
+ * and the aggregate functions.
+ *
+ * gpupreagg_keyhash - returns a hash value of the grouping keys
+ * gpupreagg_keycomp - returns true, if both rows have same grouping keys
+ * gpupreagg_init_item - sets initial partial results of a new group
+ * gpupreagg_aggcalc - computes the partial results of the row, using
+ *                     the gpupreagg_<kind>_<base> functions below
+ */
+static cl_uint
+gpupreagg_keyhash(__global kern_column_store *kcs,
+				  cl_uint rowidx);
+static cl_bool
+gpupreagg_keycomp(__global kern_column_store *kcs,
+				  cl_uint x_index,
+				  cl_uint y_index);
+static void
+gpupreagg_init_item(__global kern_preagg_item *pitem);
+static void
+gpupreagg_aggcalc(__global kern_preagg_result *kpresult,
+				  __global kern_column_store *kcs,
+				  cl_uint rowidx,
+				  cl_int group,
+				  cl_uint owner,
+				  __local void *local_workmem);
+
+/*
+ * gpupreagg_hash_value
+ *
+ * It updates the hash value with the supplied key being normalized to
+ * 64bit integer; a finalizer of MurmurHash3 as kern_hash_keys doing.
+ */
+static inline cl_uint
+gpupreagg_hash_value(cl_uint hash, cl_ulong x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdUL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53UL;
+	x ^= x >> 33;
+	return ((hash << 5) | (hash >> 27)) ^ (cl_uint)(x ^ (x >> 32));
+}
+
+/* normalization of the grouping keys; binary equality is sufficient */
+#define GPUPREAGG_KEY_SIMPLE(x)		((cl_ulong)(x))
+#define GPUPREAGG_KEY_FLOAT(x)		((cl_ulong)as_uint(x))
+#define GPUPREAGG_KEY_DOUBLE(x)		as_ulong(x)
+
+/*
+ * Combine operators with same semantics of the host side aggregates;
+ * NaN is larger than any other floating point values.
+ */
+#define GPUPREAGG_ADD(x,y)			((x) + (y))
+#define GPUPREAGG_MIN(x,y)			((x) < (y) ? (x) : (y))
+#define GPUPREAGG_MAX(x,y)			((x) > (y) ? (x) : (y))
+#define GPUPREAGG_FMIN(x,y)			\
+	(isnan(x) ? (y) : (isnan(y) ? (x) : fmin((x),(y))))
+#define GPUPREAGG_FMAX(x,y)			\
+	(isnan(x) ? (x) : (isnan(y) ? (y) : fmax((x),(y))))
+
+/*
+ * Atomic update of the partial results on the global memory. OpenCL does
+ * not have atomic operations on floating point values, so we emulate them
+ * with compare-and-swap.
+ */
+static inline void
+gpupreagg_atomic_add_long(volatile __global cl_ulong *ptr, cl_long value)
+{
+	atom_add((volatile __global cl_long *)ptr, value);
+}
+
+static inline void
+gpupreagg_atomic_min_long(volatile __global cl_ulong *ptr, cl_long value)
+{
+	cl_long		oldval = (cl_long) *ptr;
+	cl_long		curval;
+
+	while (value < oldval)
+	{
+		curval = atom_cmpxchg((volatile __global cl_long *)ptr,
+							  oldval, value);
+		if (curval == oldval)
+			break;
+		oldval = curval;
+	}
+}
+
+static inline void
+gpupreagg_atomic_max_long(volatile __global cl_ulong *ptr, cl_long value)
+{
+	cl_long		oldval = (cl_long) *ptr;
+	cl_long		curval;
+
+	while (value > oldval)
+	{
+		curval = atom_cmpxchg((volatile __global cl_long *)ptr,
+							  oldval, value);
+		if (curval == oldval)
+			break;
+		oldval = curval;
+	}
+}
+
+#define GPUPREAGG_ATOMIC_FLOAT_TEMPLATE(NAME,OPER)						\
+	static inline void													\
+	gpupreagg_atomic_##NAME##_double(volatile __global cl_ulong *ptr,	\
+									 cl_double value)					\
+	{																	\
+		cl_ulong	oldval = *ptr;										\
+		cl_ulong	newval;												\
+		cl_ulong	curval;												\
+																		\
+		for (;;)														\
+		{																\
+			newval = as_ulong(OPER(as_double(oldval), value));			\
+			if (newval == oldval)										\
+				break;													\
+			curval = atom_cmpxchg(ptr, oldval, newval);					\
+			if (curval == oldval)										\
+				break;													\
+			oldval = curval;											\
+		}																\
+	}
+
+GPUPREAGG_ATOMIC_FLOAT_TEMPLATE(add,GPUPREAGG_ADD)
+GPUPREAGG_ATOMIC_FLOAT_TEMPLATE(min,GPUPREAGG_FMIN)
+GPUPREAGG_ATOMIC_FLOAT_TEMPLATE(max,GPUPREAGG_FMAX)
+
+/*
+ * gpupreagg_<kind>_<base>
+ *
+ * It reduces values of the rows in same group on the local memory, then
+ * the owner thread of the group (the first thread in the work-group that
+ * has the group) updates the partial result on the global memory.
+ * All the threads in a work-group have to call this function, even if it
+ * has no valid row (group < 0), because of the barrier synchronization.
+ * The local memory has to have 16 * get_local_size(0) bytes; a cl_int for
+ * group, a cl_char for null flag and a 64bit value for each thread.
+ */
+#define GPUPREAGG_REDUCTION_TEMPLATE(KIND,BASE,OPER)					\
+	static void															\
+	gpupreagg_##KIND##_##BASE(__global kern_preagg_result *kpresult,	\
+							  cl_uint pindex,							\
+							  cl_int group,								\
+							  cl_uint owner,							\
+							  cl_bool isnull,							\
+							  cl_##BASE value,							\
+							  __local void *local_workmem)				\
+	{																	\
+		__local cl_int	   *l_group = local_workmem;					\
+		__local cl_char	   *l_isnull;									\
+		__local cl_##BASE  *l_value;									\
+		size_t		lid = get_local_id(0);								\
+		size_t		lsz = get_local_size(0);							\
+		size_t		i;													\
+																		\
+		l_isnull = (__local cl_char *)(l_group + lsz);					\
+		l_value = (__local cl_##BASE *)									\
+			(l_isnull + TYPEALIGN(sizeof(cl_long), lsz));				\
+		l_isnull[lid] = isnull;											\
+		l_value[lid] = value;											\
+		barrier(CLK_LOCAL_MEM_FENCE);									\
+																		\
+		if (group >= 0 && owner == lid)									\
+		{																\
+			__global kern_preagg_item *pitem;							\
+			cl_bool		r_isnull = true;								\
+			cl_##BASE	r_value;										\
+																		\
+			for (i=lid; i < lsz; i++)									\
+			{															\
+				if (l_group[i] != group || l_isnull[i])					\
+					continue;											\
+				if (r_isnull)											\
+					r_value = l_value[i];								\
+				else													\
+					r_value = OPER(r_value, l_value[i]);				\
+				r_isnull = false;										\
+			}															\
+			if (!r_isnull)												\
+			{															\
+				pitem = KERN_PREAGG_ITEM(kpresult, group);				\
+				gpupreagg_atomic_##KIND##_##BASE(&pitem->values[pindex],	\
+												 r_value);				\
+				atomic_and(&pitem->nullmask, ~(1U << pindex));			\
+			}															\
+		}																\
+		barrier(CLK_LOCAL_MEM_FENCE);									\
+	}
+
+GPUPREAGG_REDUCTION_TEMPLATE(add,long,GPUPREAGG_ADD)
+GPUPREAGG_REDUCTION_TEMPLATE(min,long,GPUPREAGG_MIN)
+GPUPREAGG_REDUCTION_TEMPLATE(max,long,GPUPREAGG_MAX)
+GPUPREAGG_REDUCTION_TEMPLATE(add,double,GPUPREAGG_ADD)
+GPUPREAGG_REDUCTION_TEMPLATE(min,double,GPUPREAGG_FMIN)
+GPUPREAGG_REDUCTION_TEMPLATE(max,double,GPUPREAGG_FMAX)
+
+/*
+ * gpupreagg_setup_rs
+ *
+ * It translates the row-store into column-store, and clears the hash
+ * slots. It requires the local memory of sizeof(cl_uint) *
+ * get_local_size(0) for kern_row_to_column.
+ */
+__kernel void
+gpupreagg_setup_rs(__global kern_gpupreagg *kgpreagg,
+				   __global kern_row_store *krs,
+				   __global kern_column_store *kcs,
+				   __global cl_uint *g_workbuf,
+				   __local void *local_workmem)
+{
+	__global kern_preagg_result *kpresult
+		= KERN_GPUPREAGG_RESULTBUF(kgpreagg);
+	size_t		i;
+
+	kern_row_to_column(krs, kcs, local_workmem);
+
+	for (i = get_global_id(0); i < kpresult->nslots; i += get_global_size(0))
+		g_workbuf[i] = 0;
+}
+
+/*
+ * gpupreagg_grouping
+ *
+ * It assigns a group to each row, using open-addressing hash table.
+ * Number of hash slots has to be larger than number of rows, to ensure
+ * a row can find an empty slot.
+ */
+__kernel void
+gpupreagg_grouping(__global kern_gpupreagg *kgpreagg,
+				   __global kern_column_store *kcs,
+				   __global cl_uint *g_workbuf)
+{
+	__global kern_preagg_result *kpresult
+		= KERN_GPUPREAGG_RESULTBUF(kgpreagg);
+	__global cl_uint   *g_slots = g_workbuf;
+	__global cl_uint   *g_leader = g_slots + kpresult->nslots;
+	__global cl_int	   *g_group = (__global cl_int *)(g_leader + kcs->nrows);
+	__global kern_preagg_item *pitem;
+	cl_uint		rowidx = get_global_id(0);
+	cl_uint		index;
+	cl_uint		curr;
+	cl_uint		group;
+
+	if (rowidx >= kcs->nrows)
+		return;
+
+	index = gpupreagg_keyhash(kcs, rowidx) & (kpresult->nslots - 1);
+	for (;;)
+	{
+		curr = atomic_cmpxchg(&g_slots[index], 0, rowidx + 1);
+		if (curr == 0)
+		{
+			/* this row becomes the representative of a new group */
+			group = atomic_inc(&kpresult->nitems);
+			if (group < kpresult->nrooms)
+			{
+				pitem = KERN_PREAGG_ITEM(kpresult, group);
+				pitem->rowidx = rowidx;
+				gpupreagg_init_item(pitem);
+				g_group[rowidx] = group;
+			}
+			else
+			{
+				atomic_cmpxchg(&kpresult->errcode,
+							   StromError_Success,
+							   StromError_DataStoreNoSpace);
+				g_group[rowidx] = -1;
+			}
+			g_leader[rowidx] = rowidx;
+			return;
+		}
+		if (gpupreagg_keycomp(kcs, rowidx, curr - 1))
+		{
+			g_leader[rowidx] = curr - 1;
+			return;
+		}
+		index = (index + 1) & (kpresult->nslots - 1);
+	}
+}
+
+/*
+ * gpupreagg_aggregate
+ *
+ * It computes the partial results of each group. It requires the local
+ * memory of 16 * get_local_size(0) bytes.
+ */
+__kernel void
+gpupreagg_aggregate(__global kern_gpupreagg *kgpreagg,
+					__global kern_column_store *kcs,
+					__global cl_uint *g_workbuf,
+					__local void *local_workmem)
+{
+	__global kern_preagg_result *kpresult
+		= KERN_GPUPREAGG_RESULTBUF(kgpreagg);
+	__global cl_uint   *g_leader = g_workbuf + kpresult->nslots;
+	__global cl_int	   *g_group = (__global cl_int *)(g_leader + kcs->nrows);
+	__local cl_int	   *l_group = local_workmem;
+	cl_uint		rowidx = get_global_id(0);
+	cl_uint		lid = get_local_id(0);
+	cl_int		group = -1;
+	cl_uint		owner;
+	cl_uint		i;
+
+	/* no need to compute, if host side takes this chunk */
+	if (kpresult->errcode != StromError_Success)
+		return;
+
+	if (rowidx < kcs->nrows)
+		group = g_group[g_leader[rowidx]];
+	l_group[lid] = group;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* the first thread of the group in this work-group is the owner */
+	for (owner = lid, i = 0; i < lid; i++)
+	{
+		if (l_group[i] == group)
+		{
+			owner = i;
+			break;
+		}
+	}
+	gpupreagg_aggcalc(kpresult, kcs, rowidx, group, owner, local_workmem);
+}
+
+#else	/* OPENCL_DEVICE_CODE */
+
+/*
+ * Host side representation of kern_gpupreagg. It has a program-id to be
+ * executed on the OpenCL device, and a row-store to be aggregated, in
+ * addition to the kern_gpupreagg buffer.
+ */
+typedef struct {
+	pgstrom_message	msg;		/* = StromTag_GpuPreAgg */
+	Datum			dprog_key;	/* key of device program */
+	pgstrom_row_store *rstore;	/* row-store to be aggregated */
+	kern_gpupreagg	kern;
+} pgstrom_gpupreagg;
+
+#endif	/* OPENCL_DEVICE_CODE */
+#endif	/* OPENCL_GPUPREAGG_H */
@@ -45,12 +45,14 @@
  * | +--------------+    |    |
  * | | debug_usage  |    |    |
  * | +--------------+    |    |
- * | | errcode      |    |    V
+ * | | errcode      |    |    |
+ * | +--------------+    |    |
+ * | | flags        |    |    V
  * | +--------------+    |  -----
  * | | results[0]   |    |
  * | | results[1]   |    |  Area to be written back from OpenCL device.
- * | |     :        |    |  Reverse DMA shall be issued here.
- * | | results[N-1] |    V
+ * | |     :        |    |  Reverse DMA shall be issued here; header first,
+ * | | results[N-1] |    V  then 'nitems' results (or bitmap) only.
  * | +--------------+  --+--
  * | | debug buffer |    |
  * | /  (if used)   /    |
@@ -59,6 +61,8 @@
  * +-+--------------+  -----
  *
  * Gpuscan kernel code assumes all the fields shall be initialized to zero.
+ * In bitmap mode, the bitmaps are also sent to the device with header,
+ * because kernel sets bits on them.
  */
 typedef struct {
 	kern_parambuf	kparam;
@@ -78,15 +82,40 @@ typedef struct {
 			  results[KERN_GPUSCAN_RESULTBUF(kgscan)->nrooms]) +		\
 	 (KERN_GPUSCAN_RESULTBUF(kgscan)->debug_usage == KERN_DEBUG_UNAVAILABLE ? \
 	  0 : KERNEL_DEBUG_BUFSIZE))
+#define KERN_GPUSCAN_BITMAP_LENGTH(kgscan)								\
+	(KERN_RESULTBUF_IS_BITMAP(KERN_GPUSCAN_RESULTBUF(kgscan))			\
+	 ? 2 * sizeof(cl_uint) *											\
+	 KERN_RESULTBUF_BITMAP_NWORDS(KERN_GPUSCAN_RESULTBUF(kgscan)->nrooms)	\
+	 : 0)
 #define KERN_GPUSCAN_DMA_SENDLEN(kgscan)		\
 	((kgscan)->kparam.length +					\
-	 offsetof(kern_resultbuf, results[0]))
+	 offsetof(kern_resultbuf, results[0]) +		\
+	 KERN_GPUSCAN_BITMAP_LENGTH(kgscan))
 
 #define KERN_GPUSCAN_DMA_RECVLEN(kgscan)								\
 	(offsetof(kern_resultbuf,											\
 			  results[KERN_GPUSCAN_RESULTBUF(kgscan)->nrooms]) +		\
 	 (KERN_GPUSCAN_RESULTBUF(kgscan)->debug_usage == KERN_DEBUG_UNAVAILABLE ? \
 	  0 : KERNEL_DEBUG_BUFSIZE))
+/*
+ * Unless kernel debug is enabled, the result buffer is written back in two
+ * steps; header portion to know 'nitems', then the results being actually
+ * written; that is 'nitems' row-index or bitmaps.
+ */
+/*
+ * Width of an item on the column-store for projection; length of fixed-
+ * length values being copied, or offset from the head of row-store.
+ */
+#define KERN_GPUSCAN_PROJ_WIDTH(attlen)			\
+	((attlen) == 1 || (attlen) == 2 || (attlen) == 4 ||	\
+	 (attlen) == 8 || (attlen) == 16 ? (attlen) : sizeof(cl_uint))
+
+#define KERN_GPUSCAN_DMA_RECVLEN_HEAD(kgscan)	\
+	offsetof(kern_resultbuf, results[0])
+#define KERN_GPUSCAN_DMA_RECVLEN_BODY(kgscan)							\
+	(KERN_RESULTBUF_IS_BITMAP(KERN_GPUSCAN_RESULTBUF(kgscan))			\
+	 ? KERN_GPUSCAN_BITMAP_LENGTH(kgscan)								\
+	 : sizeof(cl_int) * KERN_GPUSCAN_RESULTBUF(kgscan)->nitems)
 
 #ifdef OPENCL_DEVICE_CODE
 /* macro for error setting */
@@ -184,9 +213,11 @@ gpuscan_writeback_statement_error(__global kern_resultbuf *kresbuf,
 /*
  * gpuscan_writeback_row_error
  *
- * It writes back the calculation result of gpuscan.
+ * It writes back the calculation result of gpuscan. It returns position of
+ * the row in the results, if visible; that is also used for projection.
+ * Elsewhere, -1 shall be returned.
  */
-static void
+static cl_int
 gpuscan_writeback_row_error(__global kern_resultbuf *kresbuf,
 							__local void *workmem)
 {
@@ -254,30 +285,212 @@ gpuscan_writeback_row_error(__global kern_resultbuf *kresbuf,
 	 * Write back the row-index that passed evaluation of the qualifier,
 	 * or needs re-check on the host side. In case of re-check, row-index
 	 * shall be a negative number.
+	 * In bitmap mode, it sets a bit of the row on the either bitmap.
 	 */
 	if (get_global_id(0) >= kresbuf->nrooms)
-		return;
+		return -1;
 
-	if (local_error[wkgrp_id] == StromError_Success)
+	if (KERN_RESULTBUF_IS_BITMAP(kresbuf))
+	{
+		__global cl_uint *bitmap = (__global cl_uint *)kresbuf->results;
+		cl_uint		index = get_global_id(0);
+
+		if (local_error[wkgrp_id] == StromError_Success)
+		{
+			atomic_or(&bitmap[index / 32], 1U << (index % 32));
+			return index;
+		}
+		else if (local_error[wkgrp_id] == StromError_RowReCheck)
+		{
+			bitmap += KERN_RESULTBUF_BITMAP_NWORDS(kresbuf->nrooms);
+			atomic_or(&bitmap[index / 32], 1U << (index % 32));
+		}
+	}
+	else if (local_error[wkgrp_id] == StromError_Success)
 	{
 		i = local_temp[wkgrp_id];
 		kresbuf->results[i - 1] = (get_global_id(0) + 1);
+		return i - 1;
 	}
 	else if (local_error[wkgrp_id] == StromError_RowReCheck)
 	{
 		i = local_temp[wkgrp_id];
 		kresbuf->results[i - 1] = -(get_global_id(0) + 1);
 	}
+	return -1;
 }
 
-static inline void
+static inline cl_int
 gpuscan_writeback_result(__global kern_gpuscan *kgpuscan,
 						 __local void *local_workmem)
 {
 	__global kern_resultbuf *kresbuf = KERN_GPUSCAN_RESULTBUF(kgpuscan);
 
 	gpuscan_writeback_statement_error(kresbuf, local_workmem);
-	gpuscan_writeback_row_error(kresbuf, local_workmem);
+	return gpuscan_writeback_row_error(kresbuf, local_workmem);
+}
+
+#ifdef PGSTROM_VECTOR_WIDTH
+/*
+ * gpuscan_writeback_vector
+ *
+ * It writes back the visible rows being evaluated by vectorized kernel;
+ * 'mask' is a bitmask of PGSTROM_VECTOR_WIDTH rows from 'base'. Because
+ * vectorized qualifier has no error path, row-level error is not handled.
+ * Note that all the work-items have to call this function, even if no rows
+ * are assigned, because it synchronizes the work-group.
+ */
+static void
+gpuscan_writeback_vector(__global kern_gpuscan *kgpuscan,
+						 cl_uint base, cl_uint mask,
+						 __local void *workmem)
+{
+	__global kern_resultbuf *kresbuf = KERN_GPUSCAN_RESULTBUF(kgpuscan);
+	__local cl_uint *local_temp = workmem;
+	cl_uint		wkgrp_sz = get_local_size(0);
+	cl_uint		wkgrp_id = get_local_id(0);
+	cl_uint		nitems = 0;
+	cl_uint		offset;
+	cl_uint		i;
+
+	for (i=0; i < PGSTROM_VECTOR_WIDTH; i++)
+		nitems += ((mask >> i) & 1);
+
+	/* inclusive prefix sum of nitems in the work-group */
+	local_temp[wkgrp_id] = nitems;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (i=1; i < wkgrp_sz; i <<= 1)
+	{
+		cl_uint	temp = (wkgrp_id >= i ? local_temp[wkgrp_id - i] : 0);
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+		local_temp[wkgrp_id] += temp;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	/* acquire rooms for the work-group */
+	if (wkgrp_id == 0)
+		local_temp[wkgrp_sz] = atomic_add(&kresbuf->nitems,
+										  local_temp[wkgrp_sz - 1]);
+	barrier(CLK_LOCAL_MEM_FENCE);
+	offset = local_temp[wkgrp_sz] + local_temp[wkgrp_id] - nitems;
+
+	if (mask == 0)
+		return;
+	if (KERN_RESULTBUF_IS_BITMAP(kresbuf))
+	{
+		__global cl_uint *bitmap = (__global cl_uint *)kresbuf->results;
+
+		/* base is aligned to PGSTROM_VECTOR_WIDTH, so never across words */
+		atomic_or(&bitmap[base / 32], mask << (base % 32));
+	}
+	else
+	{
+		for (i=0; i < PGSTROM_VECTOR_WIDTH; i++)
+		{
+			if ((mask & (1U << i)) != 0)
+				kresbuf->results[offset++] = base + i + 1;
+		}
+	}
+}
+#endif	/* PGSTROM_VECTOR_WIDTH */
+
+/*
+ * gpuscan_projection
+ *
+ * It writes back the attributes of a visible row, being referenced by
+ * target-list or host qualifiers (KERN_COLMETA_ATTPROJECTED), onto the
+ * 'index'-th rooms of the column-store for projection. It allows host to
+ * fill up the scan slot virtually from the column arrays, instead of
+ * deforming the wide heap tuple. Null-map has to be cleared by host,
+ * because visible rows are not contiguous.
+ * 'kproj' may be NULL, if projection is not in use.
+ */
+static void
+gpuscan_projection(__global kern_row_store *krs,
+				   __global kern_column_store *kproj,
+				   cl_int index)
+{
+	__global rs_tuple  *rs_tup;
+	cl_uint		offset;
+	cl_uint		natts;
+	cl_uint		i, j;
+
+	if (!kproj || index < 0)
+		return;
+	rs_tup = kern_rowstore_get_tuple(krs, get_global_id(0));
+	if (!rs_tup)
+		return;
+	offset = rs_tup->data.t_hoff;
+
+	natts = min(krs->ncols, (cl_uint)(rs_tup->data.t_infomask2 &
+									  HEAP_NATTS_MASK));
+	for (i=0, j=0; i < krs->ncols && j < kproj->ncols; i++)
+	{
+		__global kern_colmeta  *rcmeta = &krs->colmeta[i];
+		__global kern_colmeta  *pcmeta;
+		__global char		   *src;
+		__global char		   *dest;
+
+		/* attributes added later than the tuple are also null */
+		if (i >= natts ||
+			((rs_tup->data.t_infomask & HEAP_HASNULL) != 0 &&
+			 att_isnull(i, rs_tup->data.t_bits)))
+		{
+			/* null is a cleared bit on the null-map */
+			if ((rcmeta->flags & KERN_COLMETA_ATTPROJECTED) != 0)
+				j++;
+			continue;
+		}
+
+		if (rcmeta->attlen > 0)
+			offset = TYPEALIGN(rcmeta->attalign, offset);
+		else if (!VARATT_NOT_PAD_BYTE((uintptr_t)&rs_tup->data + offset))
+			offset = TYPEALIGN(rcmeta->attalign, offset);
+		src = ((__global char *)&rs_tup->data) + offset;
+		offset += (rcmeta->attlen > 0 ?
+				   rcmeta->attlen :
+				   VARSIZE_ANY(src));
+
+		if ((rcmeta->flags & KERN_COLMETA_ATTPROJECTED) == 0)
+			continue;
+
+		pcmeta = &kproj->colmeta[j++];
+		dest = ((__global char *)kproj) + pcmeta->cs_ofs;
+		if ((pcmeta->flags & KERN_COLMETA_ATTNOTNULL) == 0)
+		{
+			atomic_or(((__global cl_uint *)dest) + index / 32,
+					  1U << (index % 32));
+			dest += STROMALIGN((kproj->nrows + 7) >> 3);
+		}
+		dest += index * KERN_GPUSCAN_PROJ_WIDTH(pcmeta->attlen);
+
+		/* see the comment in kern_row_to_column() */
+		switch (pcmeta->attlen)
+		{
+			case 1:
+				*((__global cl_char *)dest) = *((__global cl_char *)src);
+				break;
+			case 2:
+				*((__global cl_short *)dest) = *((__global cl_short *)src);
+				break;
+			case 4:
+				*((__global cl_int *)dest) = *((__global cl_int *)src);
+				break;
+			case 8:
+				*((__global cl_long *)dest) = *((__global cl_long *)src);
+				break;
+			case 16:
+				*((__global cl_long *)dest) = *((__global cl_long *)src);
+				*(((__global cl_long *)dest) + 1)
+					= *(((__global cl_long *)src) + 1);
+				break;
+			default:
+				*((__global cl_uint *)dest)
+					= (cl_uint)((uintptr_t)src - (uintptr_t)krs);
+				break;
+		}
+	}
 }
 
 #else	/* OPENCL_DEVICE_CODE */
@@ -287,11 +500,23 @@ gpuscan_writeback_result(__global kern_gpuscan *kgpuscan,
  * executed on the OpenCL device, and either of row- or column- store
  * to be processed, in addition to the kern_gpuscan buffer including
  * kern_parambuf for constant values.
+ *
+ * In case of column-store (tcache_column_store), header portion of the
+ * kern_column_store and kern_toastbuf to be constructed on the device
+ * memory, and index of the cached columns being referenced, are put on
+ * the tail of this message; next to the kern_gpuscan buffer.
+ *
+ * In case of row-store, 'kproj' is a column-store to write back attributes
+ * being referenced by the host, if only a part of them are referenced.
  */
 typedef struct {
 	pgstrom_message	msg;	/* = StromTag_GpuScan */
 	Datum			dprog_key;	/* key of device program */
-	dlist_head		rc_store;	/* a row- or column store */
+	StromTag	   *rc_store;	/* a row- or column store */
+	kern_column_store *kcs_head;	/* header of kcs, if column-store */
+	kern_toastbuf  *ktoast_head;	/* header of toast, or NULL */
+	cl_uint		   *cs_cindex;		/* index of tcs->cdata[] in use */
+	kern_column_store *kproj;		/* results of projection, or NULL */
 	kern_gpuscan	kern;
 } pgstrom_gpuscan;
 
@@ -13,7 +13,244 @@
 #ifndef OPENCL_GPUSORT_H
 #define OPENCL_GPUSORT_H
 
+/*
+ * Sort of a chunk using GPU/MIC acceleration
+ *
+ * The kern_gpusort has same layout with kern_gpuscan; a kern_resultbuf
+ * is located next to the kern_parambuf. Device sorts the rows on the
+ * row-store according to the sort keys, then writes back the sorted
+ * index of rows (0-origin) on the results[] array. 'nrooms' has to be
+ * power of 2 and equal or larger than number of rows, because bitonic
+ * sorting network works on 2^N items. The entries larger than number of
+ * rows are considered as larger than any other rows, so the first nrows
+ * entries of the results[] are the valid sorted indexes on write-back.
+ *
+ * The device code consists of four kernels.
+ * (1) gpusort_setup_rs translates the row-store into column-store, to be
+ *     referenced by the comparison function.
+ * (2) gpusort_bitonic_local sorts every block of 2 * get_local_size(0)
+ *     items on the local memory.
+ * (3) gpusort_bitonic_step runs a comparison step whose distance is
+ *     larger than the local block, on the global memory.
+ * (4) gpusort_bitonic_merge runs the rest of comparison steps whose
+ *     distance is equal or smaller than local size, on the local memory.
+ * Host side launches (3) and (4) for each block size larger than the
+ * local block, until the block size reaches 'nrooms'.
+ */
+typedef struct {
+	kern_parambuf	kparam;
+	/*
+	 * as above, kern_resultbuf shall be located next to the parambuf
+	 */
+} kern_gpusort;
+
+#define KERN_GPUSORT_PARAMBUF(kgsort)			\
+	((__global kern_parambuf *)(&(kgsort)->kparam))
+#define KERN_GPUSORT_RESULTBUF(kgsort)			\
+	((__global kern_resultbuf *)((char *)(kgsort) + (kgsort)->kparam.length))
+#define KERN_GPUSORT_LENGTH(kgsort)										\
+	(offsetof(kern_gpusort, kparam) +									\
+	 (kgsort)->kparam.length +											\
+	 offsetof(kern_resultbuf,											\
+			  results[KERN_GPUSORT_RESULTBUF(kgsort)->nrooms]))
+#define KERN_GPUSORT_DMA_SENDLEN(kgsort)		\
+	((kgsort)->kparam.length +					\
+	 offsetof(kern_resultbuf, results[0]))
+#define KERN_GPUSORT_DMA_RECVLEN(kgsort)		\
+	(offsetof(kern_resultbuf,					\
+			  results[KERN_GPUSORT_RESULTBUF(kgsort)->nrooms]))
 
 #ifdef OPENCL_DEVICE_CODE
-#endif
+
+/* comparison macros with same semantics of btree comparison */
+#define GPUSORT_COMPARE_SIMPLE(x,y)				\
+	((x) < (y) ? -1 : ((x) > (y) ? 1 : 0))
+#define GPUSORT_COMPARE_FLOAT(x,y)				\
+	(isnan(x) ? (isnan(y) ? 0 : 1) :			\
+	 (isnan(y) ? -1 : GPUSORT_COMPARE_SIMPLE(x,y)))
+
+/*
+ * gpusort_comp
+ *
+ * Comparison function being generated on the fly according to the sort
+ * keys. It returns a negative, zero or positive value if the x-th row
+ * is smaller, equal or larger than the y-th row.
+ */
+static cl_int
+gpusort_comp(__global kern_column_store *kcs,
+			 cl_int x_index,
+			 cl_int y_index);
+
+static inline cl_int
+gpusort_compare(__global kern_column_store *kcs,
+				cl_int x_index,
+				cl_int y_index)
+{
+	/* padding entries are larger than any other rows */
+	if (x_index >= kcs->nrows)
+		return (y_index >= kcs->nrows ? 0 : 1);
+	if (y_index >= kcs->nrows)
+		return -1;
+	return gpusort_comp(kcs, x_index, y_index);
+}
+
+static inline void
+gpusort_compare_swap(__global kern_column_store *kcs,
+					 cl_int *x_index,
+					 cl_int *y_index,
+					 cl_bool ascending)
+{
+	cl_int	comp = gpusort_compare(kcs, *x_index, *y_index);
+
+	if (ascending ? comp > 0 : comp < 0)
+	{
+		cl_int	temp = *x_index;
+
+		*x_index = *y_index;
+		*y_index = temp;
+	}
+}
+
+/*
+ * gpusort_local_steps
+ *
+ * It runs comparison steps from 'step' to 1 on the local memory. Each
+ * thread handles a pair of items, so the local memory has to have
+ * 2 * get_local_size(0) items.
+ */
+static void
+gpusort_local_steps(__global kern_column_store *kcs,
+					__local cl_int *local_idx,
+					size_t base, size_t blksz, size_t step)
+{
+	size_t		lid = get_local_id(0);
+
+	for (; step > 0; step >>= 1)
+	{
+		size_t	pos = 2 * lid - (lid & (step - 1));
+		cl_int	x_index = local_idx[pos];
+		cl_int	y_index = local_idx[pos + step];
+
+		gpusort_compare_swap(kcs, &x_index, &y_index,
+							 ((base + pos) & blksz) == 0);
+		local_idx[pos] = x_index;
+		local_idx[pos + step] = y_index;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+/*
+ * gpusort_setup_rs
+ *
+ * It translates the row-store into column-store. It requires the local
+ * memory of sizeof(cl_uint) * get_local_size(0) for kern_row_to_column.
+ */
+__kernel void
+gpusort_setup_rs(__global kern_gpusort *kgsort,
+				 __global kern_row_store *krs,
+				 __global kern_column_store *kcs,
+				 __local void *local_workmem)
+{
+	kern_row_to_column(krs, kcs, local_workmem);
+}
+
+/*
+ * gpusort_bitonic_local
+ *
+ * It sorts every block of 2 * get_local_size(0) items. Blocks are sorted
+ * in ascending and descending order alternately, to form bitonic sequences
+ * for the next step. It requires the local memory of 2 * sizeof(cl_int) *
+ * get_local_size(0).
+ */
+__kernel void
+gpusort_bitonic_local(__global kern_gpusort *kgsort,
+					  __global kern_column_store *kcs,
+					  __local void *local_workmem)
+{
+	__global kern_resultbuf *kresults = KERN_GPUSORT_RESULTBUF(kgsort);
+	__local cl_int *local_idx = local_workmem;
+	size_t		lid = get_local_id(0);
+	size_t		lsz = get_local_size(0);
+	size_t		base = 2 * lsz * get_group_id(0);
+	size_t		blksz;
+
+	/* initial permutation is identical */
+	local_idx[lid] = base + lid;
+	local_idx[lid + lsz] = base + lid + lsz;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (blksz = 2; blksz <= 2 * lsz; blksz <<= 1)
+		gpusort_local_steps(kcs, local_idx, base, blksz, blksz / 2);
+
+	kresults->results[base + lid] = local_idx[lid];
+	kresults->results[base + lid + lsz] = local_idx[lid + lsz];
+}
+
+/*
+ * gpusort_bitonic_step
+ *
+ * A comparison step of bitonic sorting network on the global memory,
+ * being used for steps larger than the local block.
+ */
+__kernel void
+gpusort_bitonic_step(__global kern_gpusort *kgsort,
+					 __global kern_column_store *kcs,
+					 cl_uint blksz,
+					 cl_uint step)
+{
+	__global kern_resultbuf *kresults = KERN_GPUSORT_RESULTBUF(kgsort);
+	size_t		gid = get_global_id(0);
+	size_t		pos = 2 * gid - (gid & (step - 1));
+	cl_int		x_index = kresults->results[pos];
+	cl_int		y_index = kresults->results[pos + step];
+
+	gpusort_compare_swap(kcs, &x_index, &y_index, (pos & blksz) == 0);
+	kresults->results[pos] = x_index;
+	kresults->results[pos + step] = y_index;
+}
+
+/*
+ * gpusort_bitonic_merge
+ *
+ * The rest of comparison steps for the supplied block size, whose
+ * distance is equal or smaller than local size. It requires the local
+ * memory of 2 * sizeof(cl_int) * get_local_size(0).
+ */
+__kernel void
+gpusort_bitonic_merge(__global kern_gpusort *kgsort,
+					  __global kern_column_store *kcs,
+					  cl_uint blksz,
+					  __local void *local_workmem)
+{
+	__global kern_resultbuf *kresults = KERN_GPUSORT_RESULTBUF(kgsort);
+	__local cl_int *local_idx = local_workmem;
+	size_t		lid = get_local_id(0);
+	size_t		lsz = get_local_size(0);
+	size_t		base = 2 * lsz * get_group_id(0);
+
+	local_idx[lid] = kresults->results[base + lid];
+	local_idx[lid + lsz] = kresults->results[base + lid + lsz];
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	gpusort_local_steps(kcs, local_idx, base, blksz, lsz);
+
+	kresults->results[base + lid] = local_idx[lid];
+	kresults->results[base + lid + lsz] = local_idx[lid + lsz];
+}
+
+#else	/* OPENCL_DEVICE_CODE */
+
+/*
+ * Host side representation of kern_gpusort. It has a program-id to be
+ * executed on the OpenCL device, and a row-store to be sorted, in addition
+ * to the kern_gpusort buffer.
+ */
+typedef struct {
+	pgstrom_message	msg;		/* = StromTag_GpuSort */
+	Datum			dprog_key;	/* key of device program */
+	pgstrom_row_store *rstore;	/* row-store to be sorted */
+	kern_gpusort	kern;
+} pgstrom_gpusort;
+
+#endif	/* OPENCL_DEVICE_CODE */
 #endif	/* OPENCL_GPUSORT_H */
@@ -13,21 +13,228 @@
 #ifndef OPENCL_HASHJOIN_H
 #define OPENCL_HASHJOIN_H
 
+/*
+ * Hash table of the inner relation
+ *
+ * The inner relation is loaded and hashed on the host side, then put on
+ * the shared memory segment as a kern_hash_table; that shall be sent to
+ * the device as is, for probing by the outer row-stores.
+ * Only fixed-length keys whose equality is identical to binary equality
+ * are supported, so we put the key values normalized to 64bit integer on
+ * the hash items, instead of the raw datum.
+ *
+ * +-----------------+
+ * | length          |
+ * +-----------------+
+ * | nslots (= N)    |
+ * +-----------------+
+ * | nkeys (= M)     |
+ * +-----------------+
+ * | nitems          |
+ * +-----------------+
+ * | slots[0]        |
+ * | slots[1]   o--------+ offset of the first hash-item from the head of
+ * |    :            |   | the hash table, or 0 if this slot is empty.
+ * | slots[N-1]      |   |
+ * +-----------------+   |
+ * |      :          |   |
+ * +-----------------+ <-+
+ * | kern_hash_item  |
+ * | +---------------|
+ * | | next     o--------+ offset of the next hash-item in the same slot
+ * | | hash          |   |
+ * | | rindex        |   | index of the inner tuple kept by the backend
+ * | | keydata[0]    |   |
+ * | |    :          |   |
+ * | | keydata[M-1]  |   |
+ * +-+---------------+   |
+ * |      :          |   |
+ * +-----------------+ <-+
+ * | kern_hash_item  |
+ * |      :          |
+ * +-----------------+
+ */
 typedef struct {
-	MessageTag		mtag;
 	cl_uint			next;	/* offset of next hash-item, or 0 if not exists */
 	cl_uint			hash;	/* 32-bit hash value */
-	cl_char			keydata[FLEXIBLE_ARRAY_MEMBER];
+	cl_uint			rindex;	/* index of the inner tuple on the host */
+	cl_uint			__padding;
+	cl_ulong		keydata[FLEXIBLE_ARRAY_MEMBER];
 } kern_hash_item;
 
 typedef struct {
-	MessageTag		mtag;
-	cl_uint			nslots;
-	cl_uint			nkeys;
-	kern_colmeta	keyatts[FLEXIBLE_ARRAY_MEMBER];
+	cl_uint			length;	/* length of this hash table */
+	cl_uint			nslots;	/* number of hash slots */
+	cl_uint			nkeys;	/* number of hash keys */
+	cl_uint			nitems;	/* number of hash items */
+	cl_uint			slots[FLEXIBLE_ARRAY_MEMBER];
 } kern_hash_table;
 
+#define KERN_HASH_ITEM_LENGTH(nkeys)				\
+	STROMALIGN(offsetof(kern_hash_item, keydata[(nkeys)]))
+
+/*
+ * kern_hash_keys
+ *
+ * It computes a 32bit hash value of the normalized key values. This logic
+ * is shared by host and device code, so both sides need to normalize the
+ * keys in same manner; signed integers are sign-extended to 64bit.
+ */
+static inline cl_uint
+kern_hash_keys(cl_ulong *keys, cl_uint nkeys)
+{
+	cl_uint		hash = 0x9e3779b9;
+	cl_ulong	x;
+	cl_uint		i;
+
+	for (i=0; i < nkeys; i++)
+	{
+		/* finalizer of MurmurHash3 (64bit) */
+		x = keys[i];
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdUL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53UL;
+		x ^= x >> 33;
+		hash = ((hash << 5) | (hash >> 27)) ^ (cl_uint)(x ^ (x >> 32));
+	}
+	return hash;
+}
+
+/*
+ * kern_hash_lookup
+ *
+ * It returns the next hash-item that matches with the supplied keys, or
+ * NULL if no more items. If 'khitem' is NULL, it begins from the head of
+ * the hash slot.
+ */
+static inline __global kern_hash_item *
+kern_hash_lookup(__global kern_hash_table *khtable,
+				 __global kern_hash_item *khitem,
+				 cl_uint hash, cl_ulong *keys)
+{
+	cl_uint		offset;
+	cl_uint		i;
+
+	if (!khitem)
+		offset = khtable->slots[hash % khtable->nslots];
+	else
+		offset = khitem->next;
+
+	while (offset != 0)
+	{
+		khitem = (__global kern_hash_item *)((uintptr_t)khtable + offset);
+		if (khitem->hash == hash)
+		{
+			for (i=0; i < khtable->nkeys; i++)
+			{
+				if (khitem->keydata[i] != keys[i])
+					break;
+			}
+			if (i == khtable->nkeys)
+				return khitem;
+		}
+		offset = khitem->next;
+	}
+	return NULL;
+}
+
+/*
+ * Hash-join probing using GPU/MIC acceleration
+ *
+ * The kern_hashjoin has same layout with kern_gpuscan; a kern_resultbuf
+ * is located next to the kern_parambuf. Unlike gpuscan, each result is
+ * a pair of the outer row index on the row-store and the inner row index
+ * on the hash-item (both of them are 1-origin), so 'nitems' means number
+ * of pairs being written, and number of pairs we can write back is half
+ * of 'nrooms'.
+ */
+typedef struct {
+	kern_parambuf	kparam;
+	/*
+	 * as above, kern_resultbuf shall be located next to the parambuf
+	 */
+} kern_hashjoin;
+
+#define KERN_HASHJOIN_PARAMBUF(khjoin)			\
+	((__global kern_parambuf *)(&(khjoin)->kparam))
+#define KERN_HASHJOIN_RESULTBUF(khjoin)			\
+	((__global kern_resultbuf *)((char *)(khjoin) + (khjoin)->kparam.length))
+#define KERN_HASHJOIN_LENGTH(khjoin)									\
+	(offsetof(kern_hashjoin, kparam) +									\
+	 (khjoin)->kparam.length +											\
+	 offsetof(kern_resultbuf,											\
+			  results[KERN_HASHJOIN_RESULTBUF(khjoin)->nrooms]) +		\
+	 (KERN_HASHJOIN_RESULTBUF(khjoin)->debug_usage == KERN_DEBUG_UNAVAILABLE ? \
+	  0 : KERNEL_DEBUG_BUFSIZE))
+#define KERN_HASHJOIN_DMA_SENDLEN(khjoin)		\
+	((khjoin)->kparam.length +					\
+	 offsetof(kern_resultbuf, results[0]))
+#define KERN_HASHJOIN_DMA_RECVLEN(khjoin)								\
+	(offsetof(kern_resultbuf,											\
+			  results[KERN_HASHJOIN_RESULTBUF(khjoin)->nrooms]) +		\
+	 (KERN_HASHJOIN_RESULTBUF(khjoin)->debug_usage == KERN_DEBUG_UNAVAILABLE ? \
+	  0 : KERNEL_DEBUG_BUFSIZE))
 
 #ifdef OPENCL_DEVICE_CODE
-#endif
+/*
+ * gpuhashjoin_probe
+ *
+ * It walks on the hash slot of the supplied keys, then writes back pairs
+ * of the current outer row and the matched inner rows. If the result
+ * buffer has no room any more, StromError_DataStoreNoSpace shall be set
+ * to inform the host side to probe this chunk by itself.
+ */
+static void
+gpuhashjoin_probe(__global kern_resultbuf *kresults,
+				  __global kern_hash_table *khtable,
+				  cl_ulong *keys)
+{
+	__global kern_hash_item *khitem = NULL;
+	cl_uint		hash = kern_hash_keys(keys, khtable->nkeys);
+	cl_uint		index;
+
+	while ((khitem = kern_hash_lookup(khtable, khitem, hash, keys)) != NULL)
+	{
+		index = atomic_inc(&kresults->nitems);
+		if (2 * index + 1 >= kresults->nrooms)
+		{
+			atomic_cmpxchg(&kresults->errcode,
+						   StromError_Success,
+						   StromError_DataStoreNoSpace);
+			return;
+		}
+		kresults->results[2 * index] = get_global_id(0) + 1;
+		kresults->results[2 * index + 1] = khitem->rindex + 1;
+	}
+}
+
+#else	/* OPENCL_DEVICE_CODE */
+
+/*
+ * Host side representation of kern_hash_table. It is a reference counter
+ * object based on pgstrom_message, because hash table is shared by all
+ * the gpuhashjoin messages being in-flight, and the backend may unlink
+ * it prior to the OpenCL server on error. It is never enqueued.
+ */
+typedef struct {
+	pgstrom_message	msg;	/* = StromTag_HashJoinTable */
+	kern_hash_table	kern;
+} pgstrom_hash_table;
+
+/*
+ * Host side representation of kern_hashjoin. It has a program-id to be
+ * executed on the OpenCL device, the outer row-store to be probed and
+ * the inner hash table, in addition to the kern_hashjoin buffer including
+ * kern_parambuf for constant values.
+ */
+typedef struct {
+	pgstrom_message	msg;	/* = StromTag_HashJoin */
+	Datum			dprog_key;	/* key of device program */
+	pgstrom_hash_table *htable;	/* inner hash table */
+	pgstrom_row_store  *rstore;	/* outer row-store */
+	kern_hashjoin	kern;
+} pgstrom_gpuhashjoin;
+
+#endif	/* OPENCL_DEVICE_CODE */
 #endif	/* OPENCL_HASHJOIN_H */
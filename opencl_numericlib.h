@@ -0,0 +1,463 @@
+/*
+ * opencl_numericlib.h
+ *
+ * Collection of numeric functions for OpenCL devices
+ * --
+ * Copyright 2011-2014 (C) KaiGai Kohei <kaigai@kaigai.gr.jp>
+ * Copyright 2014 (C) The PG-Strom Development Team
+ *
+ * This software is an extension of PostgreSQL; You can use, copy,
+ * modify or distribute it under the terms of 'LICENSE' included
+ * within this package.
+ */
+#ifndef OPENCL_NUMERICLIB_H
+#define OPENCL_NUMERICLIB_H
+#ifdef OPENCL_DEVICE_CODE
+
+/*
+ * Device representation of numeric
+ *
+ * Device code handles numeric as a fixed-point value; 'value' is scaled
+ * by 10^scale, and 'scale' is display scale of the original numeric.
+ * A numeric is decoded from the varlena form on the column-store or the
+ * parameter buffer, and arithmetic operators work on this form, so no
+ * varlena needs to be constructed on the device.
+ * Values that cannot be represented in this form (NaN, out of 64bit range
+ * or compressed/external varlena) have negative scale; functions mark the
+ * row to recheck on the host side, if these values are supplied. Also,
+ * overflow during arithmetic and casts are dealt with the same manner.
+ */
+typedef struct {
+	cl_long		value;		/* fixed-point value scaled by 10^scale */
+	cl_int		scale;		/* display scale, or negative if invalid */
+	bool		isnull;
+} pg_numeric_t;
+
+#define PG_NUMERIC_INVALID_SCALE	(-1)
+#define PG_NUMERIC_IS_VALID(num)	((num).scale >= 0)
+
+/* on-disk format of numeric; see utils/adt/numeric.c */
+#define NUMERIC_NBASE					10000
+#define NUMERIC_DEC_DIGITS				4
+#define NUMERIC_SIGN_MASK				0xC000
+#define NUMERIC_POS						0x0000
+#define NUMERIC_NEG						0x4000
+#define NUMERIC_SHORT					0x8000
+#define NUMERIC_NAN						0xC000
+#define NUMERIC_DSCALE_MASK				0x3FFF
+#define NUMERIC_SHORT_SIGN_MASK			0x2000
+#define NUMERIC_SHORT_DSCALE_MASK		0x1F80
+#define NUMERIC_SHORT_DSCALE_SHIFT		7
+#define NUMERIC_SHORT_WEIGHT_SIGN_MASK	0x0040
+#define NUMERIC_SHORT_WEIGHT_MASK		0x003F
+
+/* references to the raw varlena form */
+STROMCL_VARLENA_DATATYPE_TEMPLATE(numeric_varlena)
+STROMCL_VARLENA_VARREF_TEMPLATE(numeric_varlena)
+STROMCL_VARLENA_PARAMREF_TEMPLATE(numeric_varlena)
+
+/*
+ * numeric_mul10
+ *
+ * It multiplies 'value' by 10^n, or returns false on overflow.
+ */
+static inline bool
+numeric_mul10(cl_long *value, cl_int n)
+{
+	while (n-- > 0)
+	{
+		if (*value > LONG_MAX / 10 || *value < -(LONG_MAX / 10))
+			return false;
+		*value *= 10;
+	}
+	return true;
+}
+
+/*
+ * numeric_from_varlena
+ *
+ * It decodes a numeric datum in the varlena form. Note that the datum may
+ * be unaligned if it has 1-byte header, so we fetch the fields by bytes.
+ */
+static pg_numeric_t
+numeric_from_varlena(pg_numeric_varlena_t arg)
+{
+	pg_numeric_t	result;
+	__global cl_uchar *data;
+	cl_int		len;
+	cl_int		ndigits;
+	cl_int		weight;
+	cl_int		dscale;
+	cl_int		expo;
+	cl_uint		header;
+	bool		negative;
+	cl_long		value = 0;
+	cl_int		i;
+
+	result.isnull = arg.isnull;
+	result.value = 0;
+	result.scale = PG_NUMERIC_INVALID_SCALE;
+	if (arg.isnull ||
+		VARATT_IS_COMPRESSED(arg.value) ||
+		VARATT_IS_EXTERNAL(arg.value))
+		return result;
+
+	data = (__global cl_uchar *) VARDATA_ANY(arg.value);
+	len = VARSIZE_ANY_EXHDR(arg.value);
+	if (len < sizeof(cl_ushort))
+		return result;
+	header = (cl_uint)data[0] | ((cl_uint)data[1] << 8);
+
+	if ((header & NUMERIC_SIGN_MASK) == NUMERIC_NAN)
+		return result;
+	else if ((header & NUMERIC_SIGN_MASK) == NUMERIC_SHORT)
+	{
+		negative = ((header & NUMERIC_SHORT_SIGN_MASK) != 0);
+		dscale = ((header & NUMERIC_SHORT_DSCALE_MASK)
+				  >> NUMERIC_SHORT_DSCALE_SHIFT);
+		weight = ((header & NUMERIC_SHORT_WEIGHT_SIGN_MASK) != 0
+				  ? ~NUMERIC_SHORT_WEIGHT_MASK : 0)
+			| (header & NUMERIC_SHORT_WEIGHT_MASK);
+		data += sizeof(cl_ushort);
+		len -= sizeof(cl_ushort);
+	}
+	else
+	{
+		if (len < sizeof(cl_ushort) + sizeof(cl_short))
+			return result;
+		negative = ((header & NUMERIC_SIGN_MASK) == NUMERIC_NEG);
+		dscale = (header & NUMERIC_DSCALE_MASK);
+		weight = (cl_short)((cl_ushort)data[2] | ((cl_ushort)data[3] << 8));
+		data += sizeof(cl_ushort) + sizeof(cl_short);
+		len -= sizeof(cl_ushort) + sizeof(cl_short);
+	}
+	ndigits = len / sizeof(cl_short);
+
+	/* digits in NBASE */
+	for (i=0; i < ndigits; i++)
+	{
+		cl_int	digit = (cl_int)data[2*i] | ((cl_int)data[2*i+1] << 8);
+
+		if (value > (LONG_MAX - digit) / NUMERIC_NBASE)
+			return result;
+		value = value * NUMERIC_NBASE + digit;
+	}
+
+	/*
+	 * value is digits * NBASE^(weight - ndigits + 1) here; scale it to the
+	 * unit of 10^-dscale. Digits below the display scale have to be zero.
+	 */
+	if (value != 0)
+	{
+		expo = NUMERIC_DEC_DIGITS * (weight - ndigits + 1) + dscale;
+		if (expo > 0)
+		{
+			if (!numeric_mul10(&value, expo))
+				return result;
+		}
+		else
+		{
+			while (expo++ < 0)
+			{
+				if (value % 10 != 0)
+					return result;
+				value /= 10;
+			}
+		}
+	}
+	result.value = (negative ? -value : value);
+	result.scale = dscale;
+
+	return result;
+}
+
+static pg_numeric_t
+pg_numeric_vref(__global kern_column_store *kcs,
+				__global kern_toastbuf *toast,
+				cl_uint colidx,
+				cl_uint rowidx)
+{
+	return numeric_from_varlena(pg_numeric_varlena_vref(kcs, toast,
+														colidx, rowidx));
+}
+
+static pg_numeric_t
+pg_numeric_param(__global kern_parambuf *kparam,
+				 cl_uint param_id)
+{
+	return numeric_from_varlena(pg_numeric_varlena_param(kparam, param_id));
+}
+
+/*
+ * numeric_check_arg
+ *
+ * It marks the row to recheck and returns false, if the supplied (not null)
+ * argument is not representable on the device.
+ */
+static inline bool
+numeric_check_arg(__private cl_int *errcode, pg_numeric_t arg)
+{
+	if (!PG_NUMERIC_IS_VALID(arg))
+	{
+		*errcode = StromError_RowReCheck;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * numeric_align_scale
+ *
+ * It adjusts scale of the arguments to the larger one.
+ */
+static inline bool
+numeric_align_scale(pg_numeric_t *arg1, pg_numeric_t *arg2)
+{
+	if (arg1->scale < arg2->scale)
+	{
+		if (!numeric_mul10(&arg1->value, arg2->scale - arg1->scale))
+			return false;
+		arg1->scale = arg2->scale;
+	}
+	else if (arg1->scale > arg2->scale)
+	{
+		if (!numeric_mul10(&arg2->value, arg1->scale - arg2->scale))
+			return false;
+		arg2->scale = arg1->scale;
+	}
+	return true;
+}
+
+/*
+ * Arithmetic operators; display scale of the result follows the rule of
+ * numeric_add, numeric_sub and numeric_mul.
+ */
+static pg_numeric_t
+pgfn_numeric_add(__private cl_int *errcode,
+				 pg_numeric_t arg1, pg_numeric_t arg2)
+{
+	pg_numeric_t	result;
+
+	result.isnull = (arg1.isnull | arg2.isnull);
+	result.scale = PG_NUMERIC_INVALID_SCALE;
+	if (!result.isnull &&
+		numeric_check_arg(errcode, arg1) &&
+		numeric_check_arg(errcode, arg2))
+	{
+		if (!numeric_align_scale(&arg1, &arg2))
+			*errcode = StromError_RowReCheck;
+		else
+		{
+			result.value = arg1.value + arg2.value;
+			if (((arg1.value ^ result.value) &
+				 (arg2.value ^ result.value)) < 0)
+				*errcode = StromError_RowReCheck;
+			else
+				result.scale = arg1.scale;
+		}
+	}
+	return result;
+}
+
+static pg_numeric_t
+pgfn_numeric_sub(__private cl_int *errcode,
+				 pg_numeric_t arg1, pg_numeric_t arg2)
+{
+	pg_numeric_t	result;
+
+	result.isnull = (arg1.isnull | arg2.isnull);
+	result.scale = PG_NUMERIC_INVALID_SCALE;
+	if (!result.isnull &&
+		numeric_check_arg(errcode, arg1) &&
+		numeric_check_arg(errcode, arg2))
+	{
+		if (!numeric_align_scale(&arg1, &arg2))
+			*errcode = StromError_RowReCheck;
+		else
+		{
+			result.value = arg1.value - arg2.value;
+			if (((arg1.value ^ arg2.value) &
+				 (arg1.value ^ result.value)) < 0)
+				*errcode = StromError_RowReCheck;
+			else
+				result.scale = arg1.scale;
+		}
+	}
+	return result;
+}
+
+static pg_numeric_t
+pgfn_numeric_mul(__private cl_int *errcode,
+				 pg_numeric_t arg1, pg_numeric_t arg2)
+{
+	pg_numeric_t	result;
+
+	result.isnull = (arg1.isnull | arg2.isnull);
+	result.scale = PG_NUMERIC_INVALID_SCALE;
+	if (!result.isnull &&
+		numeric_check_arg(errcode, arg1) &&
+		numeric_check_arg(errcode, arg2))
+	{
+		result.value = arg1.value * arg2.value;
+		if (mul_hi(arg1.value, arg2.value) != (result.value >> 63))
+			*errcode = StromError_RowReCheck;
+		else
+			result.scale = arg1.scale + arg2.scale;
+	}
+	return result;
+}
+
+static pg_numeric_t
+pgfn_numeric_uplus(__private cl_int *errcode, pg_numeric_t arg)
+{
+	if (!arg.isnull)
+		numeric_check_arg(errcode, arg);
+	return arg;
+}
+
+static pg_numeric_t
+pgfn_numeric_uminus(__private cl_int *errcode, pg_numeric_t arg)
+{
+	if (!arg.isnull && numeric_check_arg(errcode, arg))
+	{
+		if (arg.value == LONG_MIN)
+		{
+			*errcode = StromError_RowReCheck;
+			arg.scale = PG_NUMERIC_INVALID_SCALE;
+		}
+		else
+			arg.value = -arg.value;
+	}
+	return arg;
+}
+
+static pg_numeric_t
+pgfn_numeric_abs(__private cl_int *errcode, pg_numeric_t arg)
+{
+	if (!arg.isnull && numeric_check_arg(errcode, arg) && arg.value < 0)
+		return pgfn_numeric_uminus(errcode, arg);
+	return arg;
+}
+
+/*
+ * Comparison operators
+ */
+#define STROMCL_NUMERIC_COMPARE_TEMPLATE(NAME,OPER)				\
+	static pg_bool_t											\
+	pgfn_##NAME(__private cl_int *errcode,						\
+				pg_numeric_t arg1, pg_numeric_t arg2)			\
+	{															\
+		pg_bool_t	result;										\
+																\
+		result.isnull = (arg1.isnull | arg2.isnull);			\
+		if (!result.isnull)										\
+		{														\
+			if (!numeric_check_arg(errcode, arg1) ||			\
+				!numeric_check_arg(errcode, arg2))				\
+				result.isnull = true;							\
+			else if (!numeric_align_scale(&arg1, &arg2))		\
+			{													\
+				*errcode = StromError_RowReCheck;				\
+				result.isnull = true;							\
+			}													\
+			else												\
+				result.value = (arg1.value OPER arg2.value);	\
+		}														\
+		return result;											\
+	}
+
+STROMCL_NUMERIC_COMPARE_TEMPLATE(numeric_eq, ==)
+STROMCL_NUMERIC_COMPARE_TEMPLATE(numeric_ne, !=)
+STROMCL_NUMERIC_COMPARE_TEMPLATE(numeric_lt, <)
+STROMCL_NUMERIC_COMPARE_TEMPLATE(numeric_le, <=)
+STROMCL_NUMERIC_COMPARE_TEMPLATE(numeric_gt, >)
+STROMCL_NUMERIC_COMPARE_TEMPLATE(numeric_ge, >=)
+
+/*
+ * Type cast helpers
+ *
+ * The code generator constructs cast functions on top of these helpers,
+ * because data types other than numeric are declared in the kernel source.
+ * Cast to integer rounds the value half away from zero, as round_var()
+ * doing, then out of range value is rechecked to raise an error on the
+ * host side. Cast to floating point is exact only if both of the fixed-
+ * point value and 10^scale are exactly represented in double, because a
+ * single division is correctly rounded; elsewhere, the row is rechecked.
+ * Caller has to check the argument is not null.
+ */
+static cl_long
+numeric_to_integer(__private cl_int *errcode, pg_numeric_t arg,
+				   cl_long min_value, cl_long max_value, bool *p_isnull)
+{
+	cl_long		divisor = 1;
+	cl_long		result;
+	cl_long		rem;
+
+	if (!numeric_check_arg(errcode, arg) ||
+		arg.scale > 18 || !numeric_mul10(&divisor, arg.scale))
+	{
+		*errcode = StromError_RowReCheck;
+		*p_isnull = true;
+		return 0;
+	}
+	result = arg.value / divisor;
+	rem = arg.value % divisor;
+	if (2 * abs(rem) >= divisor)
+		result += (arg.value < 0 ? -1 : 1);
+	if (result < min_value || result > max_value)
+	{
+		*errcode = StromError_RowReCheck;
+		*p_isnull = true;
+		return 0;
+	}
+	return result;
+}
+
+static inline cl_short
+numeric_to_int2(__private cl_int *errcode, pg_numeric_t arg, bool *p_isnull)
+{
+	return (cl_short) numeric_to_integer(errcode, arg,
+										 SHRT_MIN, SHRT_MAX, p_isnull);
+}
+
+static inline cl_int
+numeric_to_int4(__private cl_int *errcode, pg_numeric_t arg, bool *p_isnull)
+{
+	return (cl_int) numeric_to_integer(errcode, arg,
+									   INT_MIN, INT_MAX, p_isnull);
+}
+
+static inline cl_long
+numeric_to_int8(__private cl_int *errcode, pg_numeric_t arg, bool *p_isnull)
+{
+	return numeric_to_integer(errcode, arg, LONG_MIN, LONG_MAX, p_isnull);
+}
+
+static cl_double
+numeric_to_float8(__private cl_int *errcode, pg_numeric_t arg, bool *p_isnull)
+{
+	cl_double	divisor = 1.0;
+	cl_int		i;
+
+	if (!numeric_check_arg(errcode, arg) ||
+		arg.scale > 22 ||
+		arg.value > (1L << 53) || arg.value < -(1L << 53))
+	{
+		*errcode = StromError_RowReCheck;
+		*p_isnull = true;
+		return 0.0;
+	}
+	for (i=0; i < arg.scale; i++)
+		divisor *= 10.0;
+	return (cl_double) arg.value / divisor;
+}
+
+static inline cl_float
+numeric_to_float4(__private cl_int *errcode, pg_numeric_t arg, bool *p_isnull)
+{
+	/* same as float4in() being applied on the text form */
+	return (cl_float) numeric_to_float8(errcode, arg, p_isnull);
+}
+
+#endif	/* OPENCL_DEVICE_CODE */
+#endif	/* OPENCL_NUMERICLIB_H */
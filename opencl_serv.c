@@ -11,6 +11,7 @@
  * within this package.
  */
 #include "postgres.h"
+#include "access/hash.h"
 #include "access/htup_details.h"
 #include "access/tupdesc.h"
 #include "catalog/pg_type.h"
@@ -19,86 +20,1737 @@
 #include "miscadmin.h"
 #include "postmaster/bgworker.h"
 #include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
 #include "utils/builtins.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
 #include "pg_strom.h"
 #include <limits.h>
 #include <signal.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 /* flags set by signal handlers */
 static int		opencl_platform_index;
 static int		opencl_num_threads;
+static int		opencl_device_pool_size;
+static bool		opencl_dma_queues;
+static int		opencl_timeline_size;
 
 /* OpenCL resources for quick reference */
-#define MAX_NUM_DEVICES		128
+/* quick references */
+cl_platform_id		opencl_platform_id;
+cl_context			opencl_context;
+cl_uint				opencl_num_devices;
+cl_device_id		opencl_devices[MAX_NUM_DEVICES];
+cl_command_queue	opencl_cmdq[MAX_NUM_DEVICES];		/* kernel execution */
+cl_command_queue	opencl_cmdq_send[MAX_NUM_DEVICES];	/* DMA send */
+cl_command_queue	opencl_cmdq_recv[MAX_NUM_DEVICES];	/* DMA receive */
+
+/* signal flag */
+volatile bool		pgstrom_clserv_exit_pending = false;
+/* true, if OpenCL intermidiation server */
+volatile bool		pgstrom_i_am_clserv = false;
+
+static void
+pgstrom_opencl_sigterm(SIGNAL_ARGS)
+{
+	pgstrom_clserv_exit_pending = true;
+	pgstrom_cancel_server_loop();
+	elog(LOG, "got sigterm");
+}
+
+static void
+pgstrom_opencl_sighup(SIGNAL_ARGS)
+{
+	pgstrom_clserv_exit_pending = true;
+	pgstrom_cancel_server_loop();
+	elog(LOG, "got sighup");
+}
+
+/*
+ * Per-device scheduler state
+ *
+ * Every device has its own state to track the messages in-flight and
+ * the recent cost of DMA transfer and kernel execution, to estimate when
+ * a new message can be completed on the device. These estimations are
+ * updated on completion of each message, using exponential moving average
+ * of the time reported by the profiling interface of the events.
+ * Because the state is also referenced by backends for pgstrom_device_
+ * queue_info(), it is located on the shared memory segment.
+ */
+#define CLSERV_OVERLAP_NSLOTS		8
+
+typedef struct {
+	pgstrom_queue *respq;		/* response queue of the plan state */
+	cl_ulong	kern_begin;
+	cl_ulong	kern_end;
+	cl_ulong	recv_begin;
+	cl_ulong	recv_end;
+} clserv_overlap_slot;
+
+typedef struct {
+	cl_uint		num_inflight;	/* number of messages in-flight */
+	Size		bytes_inflight;	/* total length of messages in-flight */
+	cl_ulong	num_scheduled;	/* total number of scheduled messages */
+	cl_ulong	num_completed;	/* total number of completed messages */
+	cl_ulong	num_stolen;		/* number of messages stolen by the device */
+	double		dma_cost;		/* estimated DMA cost [usec/byte] */
+	double		kern_cost;		/* estimated kernel cost [usec/byte] */
+	/* statistics of device buffer pool */
+	Size		pool_limit;		/* max length of cached buffers */
+	Size		pool_usage;		/* total length of cached buffers */
+	cl_uint		pool_nums;		/* number of cached buffers */
+	cl_ulong	pool_hits;		/* number of buffers reused */
+	cl_ulong	pool_misses;	/* number of buffers newly created */
+	cl_ulong	pool_trims;		/* number of buffers released by trim */
+	/* device time of the last completed message of the recent plan
+	 * states, to measure overlap */
+	clserv_overlap_slot overlap[CLSERV_OVERLAP_NSLOTS];
+	cl_uint		overlap_next;	/* slot to be replaced next */
+	/* calibration of the planner cost, by the backend's perfmon */
+	double		op_cost;		/* kernel time per operator per row [usec] */
+	cl_ulong	op_samples;		/* number of samples of op_cost */
+} clserv_device_state;
+
+static shmem_startup_hook_type shmem_startup_hook_next;
+static struct {
+	slock_t		lock;
+	cl_uint		num_devices;
+	cl_uint		rr_index;		/* round-robin index for tie-break */
+	clserv_device_state	dev_state[MAX_NUM_DEVICES];
+} *clserv_sched_shm_values;
+
+/*
+ * Profiling timeline
+ *
+ * If pgstrom.opencl_timeline_size is not zero, the time of every command
+ * (DMA send, kernel execution and DMA receive) of the completed messages
+ * being reported by the profiling interface is recorded on the ring buffer
+ * on the shared memory, to show what happens on the device queues. Older
+ * entries are overwritten by newer ones. Time is in nanoseconds of the
+ * device clock, so it is not comparable across devices.
+ * Role of each command is given by the respond handler, according to the
+ * index of the event, because the kind of command does not tell us which
+ * transfer is a DMA send or a DMA receive.
+ */
+#define CLSERV_TIMELINE_KERNEL		0
+#define CLSERV_TIMELINE_DMA_SEND	1
+#define CLSERV_TIMELINE_DMA_RECV	2
+
+typedef struct {
+	cl_ulong		seqno;		/* serial number of the entry */
+	cl_ulong		chunk_id;	/* serial number of the message */
+	StromTag		stag;		/* class of the message */
+	cl_int			dindex;		/* device index the command ran on */
+	cl_int			role;		/* one of CLSERV_TIMELINE_* */
+	cl_ulong		tv_queued;
+	cl_ulong		tv_submit;
+	cl_ulong		tv_start;
+	cl_ulong		tv_end;
+} clserv_timeline_entry;
+
+typedef struct {
+	slock_t		lock;
+	cl_uint		nrooms;			/* capacity of the ring buffer */
+	cl_ulong	nitems;			/* number of entries ever recorded */
+	cl_ulong	chunk_id;		/* last serial number of the messages */
+	clserv_timeline_entry entries[FLEXIBLE_ARRAY_MEMBER];
+} clserv_timeline_buffer;
+
+#define CLSERV_TIMELINE_LENGTH(nrooms)						\
+	MAXALIGN(offsetof(clserv_timeline_buffer, entries) +	\
+			 sizeof(clserv_timeline_entry) * (nrooms))
+
+static clserv_timeline_buffer *clserv_timeline_shm_values = NULL;
+
+static void clserv_wakeup_device_worker(int dindex);
+
+/* weight of the latest sample in moving average */
+#define CLSERV_SCHED_SAMPLE_WEIGHT		0.25
+/* initial estimation of DMA cost; assumes 4GB/s of PCI-E bus */
+#define CLSERV_SCHED_INIT_DMA_COST		(1.0 / 4096.0)
+/* penalty of DMA transfer across NUMA nodes */
+#define CLSERV_SCHED_REMOTE_PENALTY		1.5
+
+/*
+ * clserv_device_score
+ *
+ * Relative throughput of the device according to its properties; it
+ * assumes a GPU compute unit handles 32 rows at once.
+ */
+static inline double
+clserv_device_score(const pgstrom_device_info *dev_info)
+{
+	double		score = ((double)dev_info->dev_max_compute_units *
+						 (double)dev_info->dev_max_clock_frequency);
+
+	if ((dev_info->dev_type & CL_DEVICE_TYPE_GPU) != 0)
+		score *= 32.0;
+	return Max(score, 1.0);
+}
+
+/*
+ * clserv_estimate_completion
+ *
+ * It estimates the time [usec] to complete a message with the supplied
+ * length on the device; all the messages in-flight shall be done prior
+ * to the new one. Caller must hold the lock.
+ */
+static inline double
+clserv_estimate_completion(clserv_device_state *dstate, Size length)
+{
+	return ((double)(dstate->bytes_inflight + length) *
+			(dstate->dma_cost + dstate->kern_cost));
+}
+
+/* device index the current worker thread is bound to, or -1 */
+static __thread int	clserv_worker_dindex = -1;
+
+/*
+ * pgstrom_opencl_device_schedule
+ *
+ * It suggests which opencl device shall be the target of kernel execution.
+ * If the message is already pinned to a particular device (e.g, device
+ * already holds its buffers), we don't move it. If the caller is a worker
+ * thread of a particular device, the message is executed on the device,
+ * because worker pulls messages only when its device is not saturated.
+ * Elsewhere, we choose the device that has the earliest estimated
+ * completion time of the supplied message, according to the length of
+ * in-flight messages and recent cost of DMA transfer and kernel execution.
+ * Devices attached to another NUMA node than the zone of the message are
+ * penalized, because its DMA has to go across the interconnect.
+ * The chosen device shall be saved on the message, then caller has to
+ * call pgstrom_opencl_device_complete() on its completion.
+ */
+int
+pgstrom_opencl_device_schedule(pgstrom_message *message, Size length)
+{
+	clserv_device_state *dstate;
+	double		est_best = -1.0;
+	int			dindex = message->dindex;
+	int			numa_node = pgstrom_shmem_numa_node(message);
+	int			i, j;
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	if ((dindex < 0 || dindex >= opencl_num_devices) &&
+		clserv_worker_dindex >= 0)
+		dindex = clserv_worker_dindex;
+	else if (dindex < 0 || dindex >= opencl_num_devices)
+	{
+		/* rotate the start point to avoid bias in case of tie */
+		j = clserv_sched_shm_values->rr_index++ % opencl_num_devices;
+		for (i=0; i < opencl_num_devices; i++)
+		{
+			const pgstrom_device_info *dinfo = pgstrom_get_device_info(j);
+			double	est;
+
+			dstate = &clserv_sched_shm_values->dev_state[j];
+			est = clserv_estimate_completion(dstate, length);
+			if (numa_node >= 0 && dinfo->dev_numa_node >= 0 &&
+				numa_node != dinfo->dev_numa_node)
+				est *= CLSERV_SCHED_REMOTE_PENALTY;
+			if (est_best < 0.0 || est < est_best)
+			{
+				est_best = est;
+				dindex = j;
+			}
+			j = (j + 1) % opencl_num_devices;
+		}
+	}
+	dstate = &clserv_sched_shm_values->dev_state[dindex];
+	dstate->num_inflight++;
+	dstate->bytes_inflight += length;
+	dstate->num_scheduled++;
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+
+	message->dindex = dindex;
+
+	return dindex;
+}
+
+/*
+ * pgstrom_opencl_device_complete
+ *
+ * It informs completion of the message being scheduled to a particular
+ * device, with the time consumed by DMA transfer and kernel execution.
+ * Zero shall be given on the time if not available, then estimation
+ * shall not be updated.
+ */
+void
+pgstrom_opencl_device_complete(pgstrom_message *message, Size length,
+							   cl_ulong time_dma, cl_ulong time_kern)
+{
+	clserv_device_state *dstate;
+	double		weight = CLSERV_SCHED_SAMPLE_WEIGHT;
+
+	Assert(message->dindex >= 0 && message->dindex < opencl_num_devices);
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	dstate = &clserv_sched_shm_values->dev_state[message->dindex];
+	Assert(dstate->num_inflight > 0 && dstate->bytes_inflight >= length);
+	dstate->num_inflight--;
+	dstate->bytes_inflight -= length;
+	dstate->num_completed++;
+	if (length > 0 && (time_dma > 0 || time_kern > 0))
+	{
+		dstate->dma_cost = ((1.0 - weight) * dstate->dma_cost +
+							weight * (double)time_dma / (double)length);
+		dstate->kern_cost = ((1.0 - weight) * dstate->kern_cost +
+							 weight * (double)time_kern / (double)length);
+	}
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+
+	/* device may get unsaturated, so wake up its worker */
+	clserv_wakeup_device_worker(message->dindex);
+}
+
+/*
+ * pgstrom_opencl_device_calibrate
+ *
+ * It updates the calibration of the planner cost on the device, using the
+ * kernel execution time per operator per row [usec] being observed by
+ * the performance counter on the backend side.
+ */
+void
+pgstrom_opencl_device_calibrate(int dindex, double op_usec)
+{
+	clserv_device_state *dstate;
+	double		weight = CLSERV_SCHED_SAMPLE_WEIGHT;
+
+	if (dindex < 0 || op_usec <= 0.0)
+		return;
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	if (dindex < clserv_sched_shm_values->num_devices)
+	{
+		dstate = &clserv_sched_shm_values->dev_state[dindex];
+		if (dstate->op_samples++ == 0)
+			dstate->op_cost = op_usec;
+		else
+			dstate->op_cost = ((1.0 - weight) * dstate->op_cost +
+							   weight * op_usec);
+	}
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+}
+
+/*
+ * pgstrom_opencl_device_costs
+ *
+ * It returns the time [usec] to transfer a byte to the device, and to run
+ * an operator on a row, when all the devices work in parallel. It uses the
+ * calibrated values if any; elsewhere, the operator cost is estimated from
+ * the device properties relative to a CPU core that takes
+ * PGSTROM_CPU_OPERATOR_USEC per operator at PGSTROM_CPU_REFERENCE_MHZ.
+ * DMA is free on the devices that share the physical memory with host,
+ * because the buffers are mapped. It returns false if no devices.
+ */
+bool
+pgstrom_opencl_device_costs(double *p_dma_usec, double *p_op_usec)
+{
+	double		dma_rate = 0.0;		/* bytes per usec */
+	double		op_rate = 0.0;		/* operators per usec */
+	bool		dma_free = false;
+	int			i, num_devices;
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	num_devices = clserv_sched_shm_values->num_devices;
+	for (i=0; i < num_devices; i++)
+	{
+		clserv_device_state *dstate = &clserv_sched_shm_values->dev_state[i];
+		const pgstrom_device_info *dev_info = pgstrom_get_device_info(i);
+
+		if (!dev_info)
+			continue;
+		if (dstate->op_samples > 0)
+			op_rate += 1.0 / dstate->op_cost;
+		else
+			op_rate += (clserv_device_score(dev_info) /
+						(PGSTROM_CPU_OPERATOR_USEC *
+						 PGSTROM_CPU_REFERENCE_MHZ));
+		if (dev_info->dev_host_unified_memory)
+			dma_free = true;
+		else if (dstate->dma_cost > 0.0)
+			dma_rate += 1.0 / dstate->dma_cost;
+	}
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+
+	if (op_rate <= 0.0)
+		return false;
+	*p_op_usec = 1.0 / op_rate;
+	*p_dma_usec = (dma_free || dma_rate <= 0.0 ? 0.0 : 1.0 / dma_rate);
+	return true;
+}
+
+/* length of the overlapped portion of two intervals */
+static inline cl_ulong
+clserv_interval_overlap(cl_ulong begin1, cl_ulong end1,
+						cl_ulong begin2, cl_ulong end2)
+{
+	cl_ulong	begin = Max(begin1, begin2);
+	cl_ulong	end = Min(end1, end2);
+
+	return (begin < end ? end - begin : 0);
+}
+
+/*
+ * pgstrom_opencl_device_overlap
+ *
+ * It returns the time [usec] the supplied message overlapped with the
+ * message of the same plan state completed prior to it on the same device;
+ * DMA send of this message with kernel execution of the previous one, and
+ * kernel execution of this message with DMA receive of the previous one.
+ * Both of them are what separate transfer and compute queues are expected
+ * to achieve. Plan state is identified by its response queue, and the last
+ * message of the recent plan states is kept for each device, so messages
+ * of concurrent queries are never compared with each other.
+ * Arguments are device time in nanoseconds, so they are comparable
+ * with the previous ones as long as the message is run on same device.
+ */
+cl_ulong
+pgstrom_opencl_device_overlap(pgstrom_message *message,
+							  cl_ulong dma_send_begin, cl_ulong dma_send_end,
+							  cl_ulong kern_exec_begin, cl_ulong kern_exec_end,
+							  cl_ulong dma_recv_begin, cl_ulong dma_recv_end)
+{
+	clserv_device_state *dstate;
+	clserv_overlap_slot *slot = NULL;
+	cl_ulong	overlap = 0;
+	int			i;
+
+	Assert(message->dindex >= 0 && message->dindex < opencl_num_devices);
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	dstate = &clserv_sched_shm_values->dev_state[message->dindex];
+	for (i=0; i < CLSERV_OVERLAP_NSLOTS; i++)
+	{
+		if (dstate->overlap[i].respq == message->respq)
+		{
+			slot = &dstate->overlap[i];
+			overlap = (clserv_interval_overlap(dma_send_begin, dma_send_end,
+											   slot->kern_begin,
+											   slot->kern_end) +
+					   clserv_interval_overlap(kern_exec_begin, kern_exec_end,
+											   slot->recv_begin,
+											   slot->recv_end));
+			break;
+		}
+	}
+	if (!slot)
+	{
+		/* first message of the plan state; replaces the oldest one */
+		slot = &dstate->overlap[dstate->overlap_next];
+		dstate->overlap_next = ((dstate->overlap_next + 1) %
+								CLSERV_OVERLAP_NSLOTS);
+		slot->respq = message->respq;
+	}
+	slot->kern_begin = kern_exec_begin;
+	slot->kern_end = kern_exec_end;
+	slot->recv_begin = dma_recv_begin;
+	slot->recv_end = dma_recv_end;
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+
+	return overlap / 1000;
+}
+
+/*
+ * clserv_flush_device_queues
+ *
+ * It submits the commands enqueued on the command queues of the device.
+ * Commands on a queue may wait for events of the other queues, so all
+ * of them have to be flushed, in order of DMA send, kernel execution and
+ * DMA receive.
+ */
+void
+clserv_flush_device_queues(int dindex)
+{
+	clFlush(opencl_cmdq_send[dindex]);
+	if (opencl_cmdq[dindex] != opencl_cmdq_send[dindex])
+		clFlush(opencl_cmdq[dindex]);
+	if (opencl_cmdq_recv[dindex] != opencl_cmdq_send[dindex])
+		clFlush(opencl_cmdq_recv[dindex]);
+}
+
+/*
+ * Per-device worker threads
+ *
+ * Each device has its own worker threads (at least one) to submit messages
+ * onto its command queue, so a slow message, like synchronous setup of
+ * kernels and buffers, on a device never stalls the other devices.
+ * A worker pulls a batch of messages from the server message queue only
+ * when its device is not saturated, and links the rest of the batch to
+ * the local queue of its device. If the server message queue is empty,
+ * an idle worker steals a message from the longest local queue of the
+ * other devices, so every command queue is kept busy.
+ * Completion of the commands is notified by OpenCL runtime on its own
+ * thread; we hand over the notification to the completion thread, because
+ * the response handler is not cheap to run in the runtime's thread.
+ */
+#define CLSERV_DEQUEUE_BATCH		4
+/* number of messages in-flight to keep a command queue busy */
+#define CLSERV_DEVICE_SATURATION	8
+#define CLSERV_WORKER_INTERVAL		200000000	/* 200msec */
+
+typedef struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	dlist_head		mlist;		/* messages pulled, but not processed yet */
+	cl_uint			nitems;		/* length of mlist */
+} clserv_device_queue;
+
+static clserv_device_queue	clserv_device_queues[MAX_NUM_DEVICES];
+
+typedef struct clserv_completion {
+	struct clserv_completion *next;
+	cl_event		event;
+	cl_int			ev_status;
+	void		  (*callback)(cl_event, cl_int, void *);
+	void		   *private;
+} clserv_completion;
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	clserv_completion *head;
+	clserv_completion *tail;
+	bool			running;	/* false, if completion thread is not up */
+} clserv_completion_queue = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	NULL,
+	NULL,
+	false,
+};
+
+static void
+clserv_wakeup_device_worker(int dindex)
+{
+	clserv_device_queue *dqueue = &clserv_device_queues[dindex];
+
+	pthread_mutex_lock(&dqueue->lock);
+	pthread_cond_signal(&dqueue->cond);
+	pthread_mutex_unlock(&dqueue->lock);
+}
+
+static void
+clserv_timedwait(pthread_cond_t *cond, pthread_mutex_t *lock, long interval)
+{
+	struct timeval	tv;
+	struct timespec	timeout;
+
+	gettimeofday(&tv, NULL);
+	timeout.tv_sec = tv.tv_sec;
+	timeout.tv_nsec = tv.tv_usec * 1000L + interval;
+	if (timeout.tv_nsec >= 1000000000L)
+	{
+		timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+		timeout.tv_nsec = timeout.tv_nsec % 1000000000L;
+	}
+	pthread_cond_timedwait(cond, lock, &timeout);
+}
+
+/*
+ * clserv_steal_message
+ *
+ * It steals a message from the tail of the longest local queue of the
+ * other devices.
+ */
+static pgstrom_message *
+clserv_steal_message(int dindex)
+{
+	clserv_device_queue *dqueue;
+	pgstrom_message	*msg = NULL;
+	cl_uint		nitems_max = 0;
+	int			victim = -1;
+	int			i;
+
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		/* unlocked read; it is just a hint */
+		if (i != dindex && clserv_device_queues[i].nitems > nitems_max)
+		{
+			nitems_max = clserv_device_queues[i].nitems;
+			victim = i;
+		}
+	}
+	if (victim < 0)
+		return NULL;
+
+	dqueue = &clserv_device_queues[victim];
+	pthread_mutex_lock(&dqueue->lock);
+	if (!dlist_is_empty(&dqueue->mlist))
+	{
+		msg = dlist_container(pgstrom_message, chain,
+							  dlist_pop_tail_node(&dqueue->mlist));
+		dqueue->nitems--;
+	}
+	pthread_mutex_unlock(&dqueue->lock);
+
+	if (msg)
+	{
+		SpinLockAcquire(&clserv_sched_shm_values->lock);
+		clserv_sched_shm_values->dev_state[dindex].num_stolen++;
+		SpinLockRelease(&clserv_sched_shm_values->lock);
+	}
+	return msg;
+}
+
+/*
+ * clserv_next_message
+ *
+ * It picks up the next message to be processed by the worker of the
+ * supplied device, or returns NULL if nothing to do right now.
+ */
+static pgstrom_message *
+clserv_next_message(int dindex)
+{
+	clserv_device_queue *dqueue = &clserv_device_queues[dindex];
+	pgstrom_message	*msgs[CLSERV_DEQUEUE_BATCH];
+	pgstrom_message	*msg = NULL;
+	int			i, nmsgs;
+
+	/* messages already pulled by this device */
+	pthread_mutex_lock(&dqueue->lock);
+	if (!dlist_is_empty(&dqueue->mlist))
+	{
+		msg = dlist_container(pgstrom_message, chain,
+							  dlist_pop_head_node(&dqueue->mlist));
+		dqueue->nitems--;
+		pthread_mutex_unlock(&dqueue->lock);
+		return msg;
+	}
+
+	/*
+	 * Don't pull new messages if the device is already saturated; the
+	 * other devices can take them. We will be woken up on completion.
+	 */
+	if (clserv_sched_shm_values->dev_state[dindex].num_inflight
+		>= CLSERV_DEVICE_SATURATION)
+	{
+		clserv_timedwait(&dqueue->cond, &dqueue->lock,
+						 CLSERV_WORKER_INTERVAL);
+		pthread_mutex_unlock(&dqueue->lock);
+		return NULL;
+	}
+	pthread_mutex_unlock(&dqueue->lock);
+
+	/* pull a batch of messages from the server message queue */
+	nmsgs = pgstrom_try_dequeue_server_messages(msgs, CLSERV_DEQUEUE_BATCH);
+	if (nmsgs == 0)
+	{
+		/* steal a message from the other device, if any */
+		msg = clserv_steal_message(dindex);
+		if (msg)
+			return msg;
+		/* wait for new messages */
+		nmsgs = pgstrom_dequeue_server_messages(msgs, 1);
+		if (nmsgs == 0)
+			return NULL;
+	}
+
+	if (nmsgs > 1)
+	{
+		pthread_mutex_lock(&dqueue->lock);
+		for (i=1; i < nmsgs; i++)
+			dlist_push_tail(&dqueue->mlist, &msgs[i]->chain);
+		dqueue->nitems += nmsgs - 1;
+		pthread_mutex_unlock(&dqueue->lock);
+	}
+	return msgs[0];
+}
+
+/*
+ * pgstrom_opencl_event_loop
+ *
+ * main loop of the worker thread of OpenCL intermediation server. each
+ * message class has its own processing logic, so all we do here is just
+ * call the callback routine.
+ */
+static void *
+pgstrom_opencl_event_loop(void *arg)
+{
+	pgstrom_message	   *msg;
+
+	clserv_worker_dindex = (int)(intptr_t) arg;
+
+	while (!pgstrom_clserv_exit_pending)
+	{
+		CHECK_FOR_INTERRUPTS();
+		msg = clserv_next_message(clserv_worker_dindex);
+		if (!msg)
+			continue;
+		msg->cb_process(msg);
+	}
+	return NULL;
+}
+
+/*
+ * clserv_drain_device_queues
+ *
+ * It moves messages in the local queues of the devices back to the server
+ * message queue, to be cleaned up on shutdown.
+ */
+static void
+clserv_drain_device_queues(void)
+{
+	int		i;
+
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		clserv_device_queue *dqueue = &clserv_device_queues[i];
+
+		pthread_mutex_lock(&dqueue->lock);
+		pgstrom_enqueue_message_list(&dqueue->mlist);
+		dqueue->nitems = 0;
+		pthread_mutex_unlock(&dqueue->lock);
+	}
+}
+
+/*
+ * clserv_completion_trampoline
+ *
+ * It is invoked by OpenCL runtime on completion of the event, then hands
+ * over the notification to the completion thread. If we cannot, callback
+ * is invoked immediately.
+ */
+static void
+clserv_completion_trampoline(cl_event event, cl_int ev_status, void *private)
+{
+	clserv_completion *comp = private;
+
+	comp->event = event;
+	comp->ev_status = ev_status;
+	comp->next = NULL;
+
+	pthread_mutex_lock(&clserv_completion_queue.lock);
+	if (clserv_completion_queue.running)
+	{
+		if (clserv_completion_queue.tail)
+			clserv_completion_queue.tail->next = comp;
+		else
+			clserv_completion_queue.head = comp;
+		clserv_completion_queue.tail = comp;
+		pthread_cond_signal(&clserv_completion_queue.cond);
+		pthread_mutex_unlock(&clserv_completion_queue.lock);
+	}
+	else
+	{
+		pthread_mutex_unlock(&clserv_completion_queue.lock);
+		(*comp->callback)(comp->event, comp->ev_status, comp->private);
+		free(comp);
+	}
+}
+
+/*
+ * clserv_set_event_callback
+ *
+ * It registers a callback routine to be invoked on the completion thread
+ * when the supplied event gets CL_COMPLETE. Usage is same as
+ * clSetEventCallback(), but command execution status is always CL_COMPLETE.
+ */
+cl_int
+clserv_set_event_callback(cl_event event,
+						  void (CL_CALLBACK *callback)(cl_event, cl_int,
+													   void *),
+						  void *private)
+{
+	clserv_completion *comp;
+	cl_int		rc;
+
+	comp = malloc(sizeof(clserv_completion));
+	if (!comp)
+		return CL_OUT_OF_HOST_MEMORY;
+	memset(comp, 0, sizeof(clserv_completion));
+	comp->callback = callback;
+	comp->private = private;
+
+	rc = clSetEventCallback(event,
+							CL_COMPLETE,
+							clserv_completion_trampoline,
+							comp);
+	if (rc != CL_SUCCESS)
+		free(comp);
+	return rc;
+}
+
+/*
+ * pgstrom_opencl_completion_loop
+ *
+ * main loop of the completion thread; it invokes the callbacks being
+ * handed over by clserv_completion_trampoline(). It continues until
+ * all the pending notifications are processed after shutdown request.
+ */
+static void *
+pgstrom_opencl_completion_loop(void *arg)
+{
+	clserv_completion *comp;
+
+	pthread_mutex_lock(&clserv_completion_queue.lock);
+	for (;;)
+	{
+		comp = clserv_completion_queue.head;
+		if (!comp)
+		{
+			if (!clserv_completion_queue.running)
+				break;
+			clserv_timedwait(&clserv_completion_queue.cond,
+							 &clserv_completion_queue.lock,
+							 CLSERV_WORKER_INTERVAL);
+			continue;
+		}
+		clserv_completion_queue.head = comp->next;
+		if (!clserv_completion_queue.head)
+			clserv_completion_queue.tail = NULL;
+		pthread_mutex_unlock(&clserv_completion_queue.lock);
+
+		(*comp->callback)(comp->event, comp->ev_status, comp->private);
+		free(comp);
+
+		pthread_mutex_lock(&clserv_completion_queue.lock);
+	}
+	pthread_mutex_unlock(&clserv_completion_queue.lock);
+
+	return NULL;
+}
+
+/*
+ * clserv_setup_device_schedule
+ *
+ * It sets up initial estimation of the device cost, according to the
+ * rough computing power of the device, until actual samples come.
+ */
+static void
+clserv_setup_device_schedule(List *dev_list)
+{
+	ListCell   *cell;
+	int			index = 0;
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	foreach (cell, dev_list)
+	{
+		pgstrom_device_info	*dev_info = lfirst(cell);
+		clserv_device_state *dstate
+			= &clserv_sched_shm_values->dev_state[index++];
+
+		dstate->dma_cost = CLSERV_SCHED_INIT_DMA_COST;
+		dstate->kern_cost = 1000.0 / clserv_device_score(dev_info);
+
+		/* 1/4 of the device memory, if not configured */
+		if (opencl_device_pool_size > 0)
+			dstate->pool_limit = ((Size)opencl_device_pool_size << 20);
+		else
+			dstate->pool_limit = dev_info->dev_global_mem_size / 4;
+	}
+	clserv_sched_shm_values->num_devices = index;
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+}
+
+/*
+ * Device buffer pool
+ *
+ * Device memory acquisition by clCreateBuffer() on every chunk is not
+ * a cheap operation, so we keep the released buffer objects for each
+ * device to reuse them for the next chunk.
+ * Length of the buffer is rounded up to power of two, like buddy class
+ * of shmem.c, and cached buffers are chained on the list of its class.
+ * Once total length of the cached buffers exceeds the limit, or a new
+ * buffer cannot be allocated on the device, the cached buffers are
+ * released from the largest class.
+ * The list is private to the OpenCL server, but its statistics are kept
+ * on the device scheduler state to be shown by pgstrom_device_pool_info().
+ */
+#define CLSERV_POOL_MIN_BITS		SHMEM_BLOCKSZ_BITS
+#define CLSERV_POOL_MAX_BITS		SHMEM_BLOCKSZ_BITS_MAX
+#define CLSERV_POOL_NUM_CLASSES		\
+	(CLSERV_POOL_MAX_BITS - CLSERV_POOL_MIN_BITS + 1)
+
+typedef struct clserv_pool_entry {
+	struct clserv_pool_entry *next;
+	cl_mem		mem;
+} clserv_pool_entry;
+
+static clserv_pool_entry *clserv_pool_list[MAX_NUM_DEVICES]
+										  [CLSERV_POOL_NUM_CLASSES];
+
+static int
+clserv_pool_class(size_t length)
+{
+	int		shift = CLSERV_POOL_MIN_BITS;
+
+	while (shift < CLSERV_POOL_MAX_BITS && (1UL << shift) < length)
+		shift++;
+	return shift;
+}
+
+/*
+ * clserv_trim_buffer_pool
+ *
+ * It releases the cached buffers of the device from the largest class,
+ * until total length of the cached buffers gets less than or equal to
+ * the supplied threshold.
+ */
+static void
+clserv_trim_buffer_pool(int dindex, Size threshold)
+{
+	clserv_device_state *dstate;
+	clserv_pool_entry *entry;
+	clserv_pool_entry *trimmed = NULL;
+	int			index;
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	dstate = &clserv_sched_shm_values->dev_state[dindex];
+	for (index = CLSERV_POOL_NUM_CLASSES - 1;
+		 index >= 0 && dstate->pool_usage > threshold;
+		 index--)
+	{
+		while (clserv_pool_list[dindex][index] &&
+			   dstate->pool_usage > threshold)
+		{
+			entry = clserv_pool_list[dindex][index];
+			clserv_pool_list[dindex][index] = entry->next;
+			dstate->pool_usage -= (1UL << (index + CLSERV_POOL_MIN_BITS));
+			dstate->pool_nums--;
+			dstate->pool_trims++;
+
+			entry->next = trimmed;
+			trimmed = entry;
+		}
+	}
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+
+	/* release device memory out of the lock */
+	while (trimmed)
+	{
+		entry = trimmed;
+		trimmed = entry->next;
+		clReleaseMemObject(entry->mem);
+		free(entry);
+	}
+}
+
+/*
+ * clserv_create_buffer
+ *
+ * It returns a read-writable buffer object on the device; that has at
+ * least 'length' bytes. A cached buffer shall be reused if any, elsewhere
+ * a new one shall be created.
+ */
+cl_mem
+clserv_create_buffer(int dindex, size_t length, cl_int *errcode)
+{
+	clserv_device_state *dstate;
+	clserv_pool_entry *entry;
+	cl_mem		mem;
+	cl_int		rc;
+	int			shift = clserv_pool_class(length);
+
+	Assert(pgstrom_i_am_clserv);
+	Assert(dindex >= 0 && dindex < opencl_num_devices);
+
+	/* too large to cache, so create a buffer as is */
+	if ((1UL << shift) < length)
+		return clCreateBuffer(opencl_context,
+							  CL_MEM_READ_WRITE,
+							  length,
+							  NULL,
+							  errcode);
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	dstate = &clserv_sched_shm_values->dev_state[dindex];
+	entry = clserv_pool_list[dindex][shift - CLSERV_POOL_MIN_BITS];
+	if (entry)
+	{
+		clserv_pool_list[dindex][shift - CLSERV_POOL_MIN_BITS] = entry->next;
+		dstate->pool_usage -= (1UL << shift);
+		dstate->pool_nums--;
+		dstate->pool_hits++;
+	}
+	else
+		dstate->pool_misses++;
+	SpinLockRelease(&clserv_sched_shm_values->lock);
 
-/* quick references */
-cl_platform_id		opencl_platform_id;
-cl_context			opencl_context;
-cl_uint				opencl_num_devices;
-cl_device_id		opencl_devices[MAX_NUM_DEVICES];
-cl_command_queue	opencl_cmdq[MAX_NUM_DEVICES];
+	if (entry)
+	{
+		mem = entry->mem;
+		free(entry);
+		*errcode = CL_SUCCESS;
+		return mem;
+	}
 
-/* signal flag */
-volatile bool		pgstrom_clserv_exit_pending = false;
-/* true, if OpenCL intermidiation server */
-volatile bool		pgstrom_i_am_clserv = false;
+	mem = clCreateBuffer(opencl_context,
+						 CL_MEM_READ_WRITE,
+						 (1UL << shift),
+						 NULL,
+						 &rc);
+	if (rc == CL_MEM_OBJECT_ALLOCATION_FAILURE ||
+		rc == CL_OUT_OF_RESOURCES)
+	{
+		/* memory pressure on the device, so retry after trimming */
+		clserv_trim_buffer_pool(dindex, 0);
+		mem = clCreateBuffer(opencl_context,
+							 CL_MEM_READ_WRITE,
+							 (1UL << shift),
+							 NULL,
+							 &rc);
+	}
+	*errcode = rc;
+	return mem;
+}
 
-static void
-pgstrom_opencl_sigterm(SIGNAL_ARGS)
+/*
+ * clserv_release_buffer
+ *
+ * It puts back the buffer object acquired by clserv_create_buffer()
+ * into the buffer pool of the device, or releases it if pool is full.
+ */
+void
+clserv_release_buffer(int dindex, cl_mem mem)
 {
-	pgstrom_clserv_exit_pending = true;
-	pgstrom_cancel_server_loop();
-	elog(LOG, "got sigterm");
+	clserv_device_state *dstate;
+	clserv_pool_entry *entry;
+	size_t		length;
+	int			shift;
+	cl_int		rc;
+
+	Assert(pgstrom_i_am_clserv);
+	Assert(dindex >= 0 && dindex < opencl_num_devices);
+
+	rc = clGetMemObjectInfo(mem,
+							CL_MEM_SIZE,
+							sizeof(length),
+							&length,
+							NULL);
+	if (rc != CL_SUCCESS)
+	{
+		elog(LOG, "failed on clGetMemObjectInfo: %s", opencl_strerror(rc));
+		goto release;
+	}
+	shift = clserv_pool_class(length);
+	if ((1UL << shift) != length)
+		goto release;	/* not a buffer being pooled */
+
+	entry = malloc(sizeof(clserv_pool_entry));
+	if (!entry)
+		goto release;
+	entry->mem = mem;
+
+	SpinLockAcquire(&clserv_sched_shm_values->lock);
+	dstate = &clserv_sched_shm_values->dev_state[dindex];
+	if (dstate->pool_usage + length > dstate->pool_limit)
+	{
+		SpinLockRelease(&clserv_sched_shm_values->lock);
+		if (length > dstate->pool_limit)
+		{
+			free(entry);
+			goto release;
+		}
+		clserv_trim_buffer_pool(dindex, dstate->pool_limit - length);
+		SpinLockAcquire(&clserv_sched_shm_values->lock);
+	}
+	entry->next = clserv_pool_list[dindex][shift - CLSERV_POOL_MIN_BITS];
+	clserv_pool_list[dindex][shift - CLSERV_POOL_MIN_BITS] = entry;
+	dstate->pool_usage += length;
+	dstate->pool_nums++;
+	SpinLockRelease(&clserv_sched_shm_values->lock);
+	return;
+
+release:
+	clReleaseMemObject(mem);
 }
 
-static void
-pgstrom_opencl_sighup(SIGNAL_ARGS)
+/*
+ * clserv_zone - OpenCL objects on a zone of the shared memory segment
+ *
+ * Each zone is registered as a buffer object with CL_MEM_USE_HOST_PTR,
+ * then mapped once on the server startup and kept mapped; because the
+ * region being mapped is page-locked by the driver, DMA transfer from/to
+ * the mapped address needs no staging copy. The zone is mapped for read,
+ * so kernels are still allowed to read its sub-buffers concurrently.
+ * Sub-buffers being referenced by the kernels directly, on the devices
+ * that share physical memory with host, are cached by the region.
+ */
+#define CLSERV_ZONE_NSUBBUFS		256
+
+typedef struct {
+	size_t		offset;		/* offset of the region from the zone head */
+	size_t		length;		/* length of the region */
+	cl_mem		mem;		/* sub-buffer, or NULL if empty */
+} clserv_subbuf_entry;
+
+typedef struct {
+	cl_mem		mem;		/* buffer object on the whole of zone */
+	char	   *mapped;		/* host address of the zone being mapped */
+	slock_t		lock;		/* lock of the subbuf cache */
+	clserv_subbuf_entry subbuf[CLSERV_ZONE_NSUBBUFS];
+} clserv_zone;
+
+/*
+ * clserv_zone_mapped_address
+ *
+ * It returns the mapped address of the supplied host memory, if it is on
+ * the shared memory segment, or the original host pointer elsewhere.
+ */
+static void *
+clserv_zone_mapped_address(const void *host_ptr)
 {
-	pgstrom_clserv_exit_pending = true;
-	pgstrom_cancel_server_loop();
-	elog(LOG, "got sighup");
+	clserv_zone *zone;
+	Size		offset;
+
+	zone = pgstrom_shmem_zone_private(host_ptr, &offset);
+	if (!zone)
+		return (void *) host_ptr;
+	return zone->mapped + offset;
 }
 
 /*
- * pgstrom_opencl_event_loop
+ * clserv_enqueue_write_buffer
  *
- * main loop of OpenCL intermediation server. each message class has its own
- * processing logic, so all we do here is just call the callback routine.
+ * It enqueues a DMA transfer from the host memory to the device buffer.
+ * Host memory on the shared memory segment is transferred from the pinned
+ * mapping of the zone.
  */
-static void *
-pgstrom_opencl_event_loop(void *arg)
+cl_int
+clserv_enqueue_write_buffer(cl_command_queue kcmdq,
+							cl_mem buffer,
+							size_t offset,
+							size_t length,
+							const void *host_ptr,
+							cl_uint num_events,
+							const cl_event *event_wait_list,
+							cl_event *event)
 {
-	pgstrom_message	   *msg;
+	return clEnqueueWriteBuffer(kcmdq,
+								buffer,
+								CL_FALSE,
+								offset,
+								length,
+								clserv_zone_mapped_address(host_ptr),
+								num_events,
+								event_wait_list,
+								event);
+}
 
-	while (!pgstrom_clserv_exit_pending)
+/*
+ * clserv_enqueue_read_buffer
+ *
+ * It enqueues a DMA transfer from the device buffer to the host memory.
+ * Same as clserv_enqueue_write_buffer(), host memory on the shared memory
+ * segment is the target of the transfer through the pinned mapping.
+ */
+cl_int
+clserv_enqueue_read_buffer(cl_command_queue kcmdq,
+						   cl_mem buffer,
+						   size_t offset,
+						   size_t length,
+						   void *host_ptr,
+						   cl_uint num_events,
+						   const cl_event *event_wait_list,
+						   cl_event *event)
+{
+	return clEnqueueReadBuffer(kcmdq,
+							   buffer,
+							   CL_FALSE,
+							   offset,
+							   length,
+							   clserv_zone_mapped_address(host_ptr),
+							   num_events,
+							   event_wait_list,
+							   event);
+}
+
+/*
+ * clserv_create_mapped_buffer
+ *
+ * If the device shares physical memory with the host, and the supplied
+ * region is on the shared memory segment, it returns a sub-buffer of the
+ * zone on the region; kernel can reference the host memory without any
+ * DMA transfer. Sub-buffers are read-only, so a sub-buffer is cached and
+ * shared by the concurrent messages on the same region.
+ * Elsewhere, it returns NULL with CL_SUCCESS, then caller has to acquire
+ * a device buffer and transfer the region as usual.
+ * Note that this buffer has to be released by clReleaseMemObject(), not
+ * clserv_release_buffer().
+ */
+cl_mem
+clserv_create_mapped_buffer(int dindex, const void *host_ptr, size_t length,
+							cl_int *errcode)
+{
+	const pgstrom_device_info *dev_info = pgstrom_get_device_info(dindex);
+	clserv_zone	   *zone;
+	clserv_subbuf_entry *entry;
+	cl_buffer_region region;
+	cl_mem			mem;
+	cl_mem			mem_old;
+	Size			offset;
+	Size			align;
+	int				index;
+
+	*errcode = CL_SUCCESS;
+	if (!dev_info || !dev_info->dev_host_unified_memory)
+		return NULL;
+
+	zone = pgstrom_shmem_zone_private(host_ptr, &offset);
+	if (!zone)
+		return NULL;
+
+	/* origin of sub-buffer has to be aligned to the device requirement */
+	align = Max(dev_info->dev_mem_base_addr_align / BITS_PER_BYTE, 1);
+	if (offset % align != 0 || (uintptr_t)host_ptr % align != 0)
+		return NULL;
+
+	index = DatumGetUInt32(hash_uint32((uint32)(offset / align) ^
+									   (uint32) length)) % CLSERV_ZONE_NSUBBUFS;
+	entry = &zone->subbuf[index];
+
+	SpinLockAcquire(&zone->lock);
+	if (entry->mem && entry->offset == offset && entry->length == length)
 	{
-		CHECK_FOR_INTERRUPTS();
-		msg = pgstrom_dequeue_server_message();
-		if (!msg)
+		mem = entry->mem;
+		clRetainMemObject(mem);
+		SpinLockRelease(&zone->lock);
+		return mem;
+	}
+	SpinLockRelease(&zone->lock);
+
+	/* not cached yet, so create a new one out of the lock */
+	region.origin = offset;
+	region.size = length;
+	mem = clCreateSubBuffer(zone->mem,
+							CL_MEM_READ_ONLY,
+							CL_BUFFER_CREATE_TYPE_REGION,
+							&region,
+							errcode);
+	if (*errcode != CL_SUCCESS)
+		return NULL;
+
+	/* the cache keeps its own reference, and replaces the older one */
+	clRetainMemObject(mem);
+	SpinLockAcquire(&zone->lock);
+	mem_old = entry->mem;
+	entry->offset = offset;
+	entry->length = length;
+	entry->mem = mem;
+	SpinLockRelease(&zone->lock);
+
+	if (mem_old)
+		clReleaseMemObject(mem_old);
+
+	return mem;
+}
+
+/*
+ * clserv_create_device_buffer
+ *
+ * It acquires a device buffer for the supplied host memory; a buffer
+ * object mapped on the host memory if possible, or a pooled device buffer.
+ * '*mapped' informs the caller which way was taken, because it affects
+ * the way to release the buffer and need of DMA transfer.
+ */
+cl_mem
+clserv_create_device_buffer(int dindex, const void *host_ptr, size_t length,
+							bool *mapped, cl_int *errcode)
+{
+	cl_mem		mem;
+
+	mem = clserv_create_mapped_buffer(dindex, host_ptr, length, errcode);
+	if (*errcode == CL_SUCCESS && mem)
+	{
+		*mapped = true;
+		return mem;
+	}
+	*mapped = false;
+	return clserv_create_buffer(dindex, length, errcode);
+}
+
+/*
+ * clserv_get_event_profiling
+ *
+ * It fetches the start and end time of the command associated with the
+ * supplied event, in nanoseconds.
+ */
+cl_int
+clserv_get_event_profiling(cl_event event, cl_ulong *tv_begin,
+						   cl_ulong *tv_end)
+{
+	cl_int		rc;
+
+	rc = clGetEventProfilingInfo(event,
+								 CL_PROFILING_COMMAND_START,
+								 sizeof(cl_ulong),
+								 tv_begin,
+								 NULL);
+	if (rc != CL_SUCCESS)
+		return rc;
+
+	return clGetEventProfilingInfo(event,
+								   CL_PROFILING_COMMAND_END,
+								   sizeof(cl_ulong),
+								   tv_end,
+								   NULL);
+}
+
+/*
+ * clserv_timeline_record
+ *
+ * It records the commands associated with the supplied events of the
+ * completed message on the profiling timeline, if enabled. events[0 ...
+ * ev_kern-1] are DMA send, events[ev_kern ... ev_recv-1] are kernel
+ * execution, then events[ev_recv ... nevents-1] are DMA receive.
+ */
+void
+clserv_timeline_record(pgstrom_message *message,
+					   cl_event *events, cl_int nevents,
+					   cl_int ev_kern, cl_int ev_recv)
+{
+	clserv_timeline_entry entry;
+	cl_ulong	chunk_id;
+	cl_int		i, rc;
+
+	if (!clserv_timeline_shm_values || nevents < 1)
+		return;
+
+	SpinLockAcquire(&clserv_timeline_shm_values->lock);
+	chunk_id = ++clserv_timeline_shm_values->chunk_id;
+	SpinLockRelease(&clserv_timeline_shm_values->lock);
+
+	for (i=0; i < nevents; i++)
+	{
+		memset(&entry, 0, sizeof(clserv_timeline_entry));
+		entry.chunk_id = chunk_id;
+		entry.stag = message->stag;
+		entry.dindex = message->dindex;
+		if (i < ev_kern)
+			entry.role = CLSERV_TIMELINE_DMA_SEND;
+		else if (i < ev_recv)
+			entry.role = CLSERV_TIMELINE_KERNEL;
+		else
+			entry.role = CLSERV_TIMELINE_DMA_RECV;
+
+		rc = clGetEventProfilingInfo(events[i],
+									 CL_PROFILING_COMMAND_QUEUED,
+									 sizeof(cl_ulong),
+									 &entry.tv_queued,
+									 NULL);
+		if (rc != CL_SUCCESS)
 			continue;
-		msg->cb_process(msg);
+		rc = clGetEventProfilingInfo(events[i],
+									 CL_PROFILING_COMMAND_SUBMIT,
+									 sizeof(cl_ulong),
+									 &entry.tv_submit,
+									 NULL);
+		if (rc != CL_SUCCESS)
+			continue;
+		rc = clserv_get_event_profiling(events[i],
+										&entry.tv_start,
+										&entry.tv_end);
+		if (rc != CL_SUCCESS)
+			continue;
+
+		SpinLockAcquire(&clserv_timeline_shm_values->lock);
+		entry.seqno = clserv_timeline_shm_values->nitems++;
+		memcpy(&clserv_timeline_shm_values->entries
+			   [entry.seqno % clserv_timeline_shm_values->nrooms],
+			   &entry, sizeof(clserv_timeline_entry));
+		SpinLockRelease(&clserv_timeline_shm_values->lock);
 	}
-	return NULL;
 }
 
 /*
- * pgstrom_opencl_device_schedule
+ * clserv_timeline_fetch
  *
- * It suggests which opencl device shall be the target of kernel execution.
- * We plan to select an optimal device according to NUMA characteristics
- * and current waiting queue length, however, it is simple round robin
- * right now.
+ * It fetches the entry of the timeline with the supplied serial number,
+ * or the oldest one being still kept if already overwritten. It returns
+ * false if no more entries prior to 'seqno_max'.
  */
-int
-pgstrom_opencl_device_schedule(pgstrom_message *message)
+static bool
+clserv_timeline_fetch(cl_ulong seqno, cl_ulong seqno_max,
+					  clserv_timeline_entry *entry)
+{
+	cl_uint		nrooms = clserv_timeline_shm_values->nrooms;
+
+	SpinLockAcquire(&clserv_timeline_shm_values->lock);
+	if (clserv_timeline_shm_values->nitems > seqno + nrooms)
+		seqno = clserv_timeline_shm_values->nitems - nrooms;
+	if (seqno >= seqno_max)
+	{
+		SpinLockRelease(&clserv_timeline_shm_values->lock);
+		return false;
+	}
+	memcpy(entry, &clserv_timeline_shm_values->entries[seqno % nrooms],
+		   sizeof(clserv_timeline_entry));
+	SpinLockRelease(&clserv_timeline_shm_values->lock);
+
+	return true;
+}
+
+static const char *
+clserv_timeline_plan_name(StromTag stag)
+{
+	switch (stag)
+	{
+		case StromTag_GpuScan:
+			return "GpuScan";
+		case StromTag_HashJoin:
+			return "GpuHashJoin";
+		case StromTag_GpuSort:
+			return "GpuSort";
+		case StromTag_GpuPreAgg:
+			return "GpuPreAgg";
+		default:
+			break;
+	}
+	return "unknown";
+}
+
+static const char *
+clserv_timeline_command_name(cl_int role)
+{
+	switch (role)
+	{
+		case CLSERV_TIMELINE_KERNEL:
+			return "kernel";
+		case CLSERV_TIMELINE_DMA_SEND:
+			return "DMA send";
+		case CLSERV_TIMELINE_DMA_RECV:
+			return "DMA recv";
+		default:
+			break;
+	}
+	return "other";
+}
+
+/*
+ * pgstrom_opencl_timeline
+ *
+ * shows the entries of the profiling timeline in order of their record,
+ * as SQL function. It is also available to export the timeline in CSV
+ * format using COPY command.
+ */
+Datum
+pgstrom_opencl_timeline(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *fncxt;
+	clserv_timeline_entry entry;
+	cl_ulong   *p_seqno;
+	HeapTuple	tuple;
+	Datum		values[9];
+	bool		isnull[9];
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc		tupdesc;
+		MemoryContext	oldcxt;
+
+		fncxt = SRF_FIRSTCALL_INIT();
+		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
+
+		tupdesc = CreateTemplateTupleDesc(9, false);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "seqno",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "dnum",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "plan",
+						   TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "chunk",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 5, "command",
+						   TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 6, "tv_queued",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 7, "tv_submit",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 8, "tv_start",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 9, "tv_end",
+						   INT8OID, -1, 0);
+		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* p_seqno[0] is the next entry, p_seqno[1] is the upper limit */
+		p_seqno = palloc0(sizeof(cl_ulong) * 2);
+		if (clserv_timeline_shm_values)
+		{
+			SpinLockAcquire(&clserv_timeline_shm_values->lock);
+			p_seqno[1] = clserv_timeline_shm_values->nitems;
+			SpinLockRelease(&clserv_timeline_shm_values->lock);
+		}
+		fncxt->user_fctx = p_seqno;
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+	fncxt = SRF_PERCALL_SETUP();
+	p_seqno = fncxt->user_fctx;
+
+	if (!clserv_timeline_shm_values ||
+		!clserv_timeline_fetch(p_seqno[0], p_seqno[1], &entry))
+		SRF_RETURN_DONE(fncxt);
+	p_seqno[0] = entry.seqno + 1;
+
+	memset(isnull, 0, sizeof(isnull));
+	values[0] = Int64GetDatum(entry.seqno);
+	values[1] = Int32GetDatum(entry.dindex);
+	values[2] = CStringGetTextDatum(clserv_timeline_plan_name(entry.stag));
+	values[3] = Int64GetDatum(entry.chunk_id);
+	values[4] = CStringGetTextDatum(clserv_timeline_command_name(entry.role));
+	values[5] = Int64GetDatum(entry.tv_queued);
+	values[6] = Int64GetDatum(entry.tv_submit);
+	values[7] = Int64GetDatum(entry.tv_start);
+	values[8] = Int64GetDatum(entry.tv_end);
+
+	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
+
+	SRF_RETURN_NEXT(fncxt, HeapTupleGetDatum(tuple));
+}
+PG_FUNCTION_INFO_V1(pgstrom_opencl_timeline);
+
+/*
+ * pgstrom_opencl_timeline_trace
+ *
+ * returns the profiling timeline in the trace event format of Chrome,
+ * as SQL function. Each device is shown as a process, and kernel, DMA
+ * send and DMA receive are shown as threads of the device.
+ */
+Datum
+pgstrom_opencl_timeline_trace(PG_FUNCTION_ARGS)
+{
+	static const cl_int lane_roles[] = {
+		CLSERV_TIMELINE_KERNEL,
+		CLSERV_TIMELINE_DMA_SEND,
+		CLSERV_TIMELINE_DMA_RECV,
+	};
+	StringInfoData	str;
+	clserv_timeline_entry entry;
+	cl_ulong	seqno = 0;
+	cl_ulong	seqno_max = 0;
+	bool		is_first = true;
+	int			i, j;
+
+	initStringInfo(&str);
+	appendStringInfo(&str, "{\"traceEvents\":[");
+	for (i=0; i < pgstrom_get_device_nums(); i++)
+	{
+		for (j=0; j < lengthof(lane_roles); j++)
+		{
+			appendStringInfo(&str, "%s\n{\"name\":\"thread_name\","
+							 "\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+							 "\"args\":{\"name\":\"%s\"}}",
+							 is_first ? "" : ",", i, lane_roles[j],
+							 clserv_timeline_command_name(lane_roles[j]));
+			is_first = false;
+		}
+	}
+
+	if (clserv_timeline_shm_values)
+	{
+		SpinLockAcquire(&clserv_timeline_shm_values->lock);
+		seqno_max = clserv_timeline_shm_values->nitems;
+		SpinLockRelease(&clserv_timeline_shm_values->lock);
+
+		while (clserv_timeline_fetch(seqno, seqno_max, &entry))
+		{
+			appendStringInfo(&str, "%s\n{\"name\":\"%s\",\"cat\":\"%s\","
+							 "\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+							 "\"ts\":%.3f,\"dur\":%.3f,"
+							 "\"args\":{\"chunk\":" UINT64_FORMAT ","
+							 "\"queued\":%.3f,\"submit\":%.3f}}",
+							 is_first ? "" : ",",
+							 clserv_timeline_command_name(entry.role),
+							 clserv_timeline_plan_name(entry.stag),
+							 entry.dindex, entry.role,
+							 (double)entry.tv_start / 1000.0,
+							 (double)(entry.tv_end - entry.tv_start) / 1000.0,
+							 entry.chunk_id,
+							 (double)entry.tv_queued / 1000.0,
+							 (double)entry.tv_submit / 1000.0);
+			is_first = false;
+			seqno = entry.seqno + 1;
+
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	appendStringInfo(&str, "\n]}\n");
+
+	PG_RETURN_TEXT_P(cstring_to_text(str.data));
+}
+PG_FUNCTION_INFO_V1(pgstrom_opencl_timeline_trace);
+
+/*
+ * pgstrom_device_pool_info
+ *
+ * shows the statistics of device buffer pool as SQL function
+ */
+Datum
+pgstrom_device_pool_info(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *fncxt;
+	clserv_device_state *dstate;
+	HeapTuple		tuple;
+	Datum			values[7];
+	bool			isnull[7];
+	int				dindex;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc		tupdesc;
+		MemoryContext	oldcxt;
+		clserv_device_state *dstates;
+		int				num_devices;
+
+		fncxt = SRF_FIRSTCALL_INIT();
+		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
+
+		tupdesc = CreateTemplateTupleDesc(7, false);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "dnum",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "pool_limit",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "pool_usage",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "num_cached",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 5, "hits",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 6, "misses",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 7, "trims",
+						   INT8OID, -1, 0);
+		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* take a snapshot of the device state */
+		SpinLockAcquire(&clserv_sched_shm_values->lock);
+		num_devices = clserv_sched_shm_values->num_devices;
+		dstates = palloc(sizeof(clserv_device_state) * Max(num_devices, 1));
+		memcpy(dstates, clserv_sched_shm_values->dev_state,
+			   sizeof(clserv_device_state) * num_devices);
+		SpinLockRelease(&clserv_sched_shm_values->lock);
+
+		fncxt->user_fctx = dstates;
+		fncxt->max_calls = num_devices;
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+	fncxt = SRF_PERCALL_SETUP();
+
+	if (fncxt->call_cntr >= fncxt->max_calls)
+		SRF_RETURN_DONE(fncxt);
+
+	dindex = fncxt->call_cntr;
+	dstate = (clserv_device_state *)fncxt->user_fctx + dindex;
+
+	memset(isnull, 0, sizeof(isnull));
+	values[0] = Int32GetDatum(dindex);
+	values[1] = Int64GetDatum(dstate->pool_limit);
+	values[2] = Int64GetDatum(dstate->pool_usage);
+	values[3] = Int32GetDatum(dstate->pool_nums);
+	values[4] = Int64GetDatum(dstate->pool_hits);
+	values[5] = Int64GetDatum(dstate->pool_misses);
+	values[6] = Int64GetDatum(dstate->pool_trims);
+
+	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
+
+	SRF_RETURN_NEXT(fncxt, HeapTupleGetDatum(tuple));
+}
+PG_FUNCTION_INFO_V1(pgstrom_device_pool_info);
+
+/*
+ * pgstrom_device_queue_info
+ *
+ * shows the state of per-device scheduler as SQL function
+ */
+Datum
+pgstrom_device_queue_info(PG_FUNCTION_ARGS)
 {
-	static int index = 0;
+	FuncCallContext *fncxt;
+	clserv_device_state *dstate;
+	const pgstrom_device_info *dev_info;
+	HeapTuple		tuple;
+	Datum			values[11];
+	bool			isnull[11];
+	int				dindex;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc		tupdesc;
+		MemoryContext	oldcxt;
+		clserv_device_state *dstates;
+		int				num_devices;
+
+		fncxt = SRF_FIRSTCALL_INIT();
+		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
+
+		tupdesc = CreateTemplateTupleDesc(11, false);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "dnum",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "name",
+						   TEXTOID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "inflight",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "inflight_bytes",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 5, "scheduled",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 6, "completed",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 7, "dma_cost",
+						   FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 8, "kern_cost",
+						   FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 9, "stolen",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 10, "op_cost",
+						   FLOAT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 11, "op_samples",
+						   INT8OID, -1, 0);
+		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/* take a snapshot of the scheduler state */
+		SpinLockAcquire(&clserv_sched_shm_values->lock);
+		num_devices = clserv_sched_shm_values->num_devices;
+		dstates = palloc(sizeof(clserv_device_state) * Max(num_devices, 1));
+		memcpy(dstates, clserv_sched_shm_values->dev_state,
+			   sizeof(clserv_device_state) * num_devices);
+		SpinLockRelease(&clserv_sched_shm_values->lock);
 
-	return index++ % opencl_num_devices;
+		fncxt->user_fctx = dstates;
+		fncxt->max_calls = num_devices;
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+	fncxt = SRF_PERCALL_SETUP();
+
+	if (fncxt->call_cntr >= fncxt->max_calls)
+		SRF_RETURN_DONE(fncxt);
+
+	dindex = fncxt->call_cntr;
+	dstate = (clserv_device_state *)fncxt->user_fctx + dindex;
+	dev_info = pgstrom_get_device_info(dindex);
+
+	memset(isnull, 0, sizeof(isnull));
+	values[0] = Int32GetDatum(dindex);
+	if (dev_info)
+		values[1] = CStringGetTextDatum(dev_info->dev_name);
+	else
+		isnull[1] = true;
+	values[2] = Int32GetDatum(dstate->num_inflight);
+	values[3] = Int64GetDatum(dstate->bytes_inflight);
+	values[4] = Int64GetDatum(dstate->num_scheduled);
+	values[5] = Int64GetDatum(dstate->num_completed);
+	/* usec/byte is too small to display, so shows usec/MB */
+	values[6] = Float8GetDatum(dstate->dma_cost * (double)(1UL << 20));
+	values[7] = Float8GetDatum(dstate->kern_cost * (double)(1UL << 20));
+	values[8] = Int64GetDatum(dstate->num_stolen);
+	/* also usec per million rows for each operator */
+	if (dstate->op_samples > 0)
+		values[9] = Float8GetDatum(dstate->op_cost * 1000000.0);
+	else
+		isnull[9] = true;
+	values[10] = Int64GetDatum(dstate->op_samples);
+
+	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
+
+	SRF_RETURN_NEXT(fncxt, HeapTupleGetDatum(tuple));
 }
+PG_FUNCTION_INFO_V1(pgstrom_device_queue_info);
 
 /*
  * pgstrom_collect_device_info
@@ -203,19 +1855,36 @@ construct_opencl_device_info(int platform_index)
 			elog(ERROR, "clCreateContext failed: %s", opencl_strerror(rc));
 
 		/*
-		 * Create an OpenCL command queue for each device
+		 * Create OpenCL command queues for each device. Unless disabled,
+		 * DMA send and receive have their own queues apart from kernel
+		 * execution, connected by events, so DMA of the neighbor chunks
+		 * can run concurrently with the kernel execution.
 		 */
 		for (j=0; j < opencl_num_devices; j++)
 		{
-			opencl_cmdq[j] =
-				clCreateCommandQueue(opencl_context,
-									 opencl_devices[j],
-									 CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE |
-									 CL_QUEUE_PROFILING_ENABLE,
-									 &rc);
-			if (rc != CL_SUCCESS)
-				elog(ERROR, "clCreateCommandQueue failed: %s",
-					 opencl_strerror(rc));
+			cl_command_queue   *cmdq_array[3];
+			int					k, nqueues = (opencl_dma_queues ? 3 : 1);
+
+			cmdq_array[0] = opencl_cmdq;
+			cmdq_array[1] = opencl_cmdq_send;
+			cmdq_array[2] = opencl_cmdq_recv;
+			for (k=0; k < nqueues; k++)
+			{
+				cmdq_array[k][j] =
+					clCreateCommandQueue(opencl_context,
+										 opencl_devices[j],
+										 CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE |
+										 CL_QUEUE_PROFILING_ENABLE,
+										 &rc);
+				if (rc != CL_SUCCESS)
+					elog(ERROR, "clCreateCommandQueue failed: %s",
+						 opencl_strerror(rc));
+			}
+			if (!opencl_dma_queues)
+			{
+				opencl_cmdq_send[j] = opencl_cmdq[j];
+				opencl_cmdq_recv[j] = opencl_cmdq[j];
+			}
 		}
 	}
 	return result;
@@ -225,27 +1894,44 @@ construct_opencl_device_info(int platform_index)
  * on_shmem_zone_callback
  *
  * It is a callback function for each zone on shared memory segment
- * initialization. It assigns a buffer object of OpenCL for each zone
- * for asynchronous memory transfer later.
+ * initialization. It assigns a buffer object of OpenCL for each zone,
+ * and maps it for asynchronous memory transfer later.
  */
 static void *
 on_shmem_zone_callback(void *address, Size length)
 {
-	cl_mem		host_mem;
+	clserv_zone *zone;
 	cl_int		rc;
 
-	host_mem = clCreateBuffer(opencl_context,
-							  CL_MEM_READ_WRITE |
-							  CL_MEM_USE_HOST_PTR,
-							  length,
-							  address,
-							  &rc);
+	zone = MemoryContextAllocZero(TopMemoryContext, sizeof(clserv_zone));
+	SpinLockInit(&zone->lock);
+	zone->mem = clCreateBuffer(opencl_context,
+							   CL_MEM_READ_WRITE |
+							   CL_MEM_USE_HOST_PTR,
+							   length,
+							   address,
+							   &rc);
 	if (rc != CL_SUCCESS)
 		elog(ERROR, "clCreateBuffer failed on host memory (%p-%p): %s",
 			 address, (char *)address + length - 1, opencl_strerror(rc));
+
+	/* zone is kept mapped until the server exits */
+	zone->mapped = clEnqueueMapBuffer(opencl_cmdq[0],
+									  zone->mem,
+									  CL_TRUE,
+									  CL_MAP_READ,
+									  0,
+									  length,
+									  0,
+									  NULL,
+									  NULL,
+									  &rc);
+	if (rc != CL_SUCCESS)
+		elog(ERROR, "clEnqueueMapBuffer failed on host memory (%p-%p): %s",
+			 address, (char *)address + length - 1, opencl_strerror(rc));
 	elog(LOG, "PG-Strom: zone %p-%p was mapped (len: %luMB)",
 		 address, (char *)address + length - 1, length >> 20);
-	return host_mem;
+	return zone;
 }
 
 /*
@@ -287,19 +1973,19 @@ init_opencl_devices_and_shmem(void)
 		 zone_length);
 	pgstrom_setup_shmem(zone_length, on_shmem_zone_callback);
 	pgstrom_setup_opencl_devinfo(devList);
+	clserv_setup_device_schedule(devList);
 }
 
 /*
  * pgstrom_opencl_main
  *
  * Main routine of opencl intermediation server.
- *
- * TODO: enhancement to use multi-threaded message handler.
  */
 static void
 pgstrom_opencl_main(Datum main_arg)
 {
 	pthread_t  *threads;
+	pthread_t	comp_thread;
 	int			i;
 
 	/* mark this process is OpenCL intermediator */
@@ -326,11 +2012,15 @@ pgstrom_opencl_main(Datum main_arg)
 	 * OK, ready to launch server thread. In the default, it creates
 	 * same number with online CPUs, but user can give an explicit
 	 * number using "pgstrom.opencl_num_threads" parameter.
+	 * Worker threads are assigned to the devices in round-robin, and
+	 * every device has at least one worker thread.
 	 *
 	 * NOTE: sysconf(_SC_NPROCESSORS_ONLN) may not be portable.
 	 */
 	if (opencl_num_threads == 0)
 		opencl_num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (opencl_num_threads < opencl_num_devices)
+		opencl_num_threads = opencl_num_devices;
 	Assert(opencl_num_threads > 0);
 
 	threads = malloc(sizeof(pthread_t) * opencl_num_threads);
@@ -340,12 +2030,35 @@ pgstrom_opencl_main(Datum main_arg)
 		return;
 	}
 
+	for (i=0; i < opencl_num_devices; i++)
+	{
+		clserv_device_queue *dqueue = &clserv_device_queues[i];
+
+		if (pthread_mutex_init(&dqueue->lock, NULL) != 0 ||
+			pthread_cond_init(&dqueue->cond, NULL) != 0)
+			elog(ERROR, "failed on initialization of device queue");
+		dlist_init(&dqueue->mlist);
+		dqueue->nitems = 0;
+	}
+
+	/* launch the completion thread */
+	clserv_completion_queue.running = true;
+	if (pthread_create(&comp_thread,
+					   NULL,
+					   pgstrom_opencl_completion_loop,
+					   NULL) != 0)
+	{
+		clserv_completion_queue.running = false;
+		elog(LOG, "failed to create completion thread");
+		return;
+	}
+
 	for (i=0; i < opencl_num_threads; i++)
 	{
 		if (pthread_create(&threads[i],
 						   NULL,
 						   pgstrom_opencl_event_loop,
-						   NULL) != 0)
+						   (void *)(intptr_t)(i % opencl_num_devices)) != 0)
 			break;
 	}
 
@@ -360,11 +2073,23 @@ pgstrom_opencl_main(Datum main_arg)
 		pgstrom_cancel_server_loop();
 	}
 	else
-		elog(LOG, "PG-Strom: %d of server threads are up", opencl_num_threads);
+		elog(LOG, "PG-Strom: %d of server threads are up for %u devices",
+			 opencl_num_threads, opencl_num_devices);
 
 	while (--i >= 0)
 		pthread_join(threads[i], NULL);
 
+	/*
+	 * Stop the completion thread after the pending notifications are
+	 * processed. Notifications arrived later are processed by OpenCL
+	 * runtime's thread.
+	 */
+	pthread_mutex_lock(&clserv_completion_queue.lock);
+	clserv_completion_queue.running = false;
+	pthread_cond_signal(&clserv_completion_queue.cond);
+	pthread_mutex_unlock(&clserv_completion_queue.lock);
+	pthread_join(comp_thread, NULL);
+
 #ifdef PGSTROM_DEBUG
 	/* revert setting */
 	Log_error_verbosity = PGERROR_DEFAULT;
@@ -380,9 +2105,40 @@ pgstrom_opencl_main(Datum main_arg)
 	 *       building; that holds some messages and callback enqueues
 	 *       the messages again.
 	 */
+	clserv_drain_device_queues();
 	pgstrom_close_server_queue();
 }
 
+static void
+pgstrom_startup_opencl_server(void)
+{
+	bool	found;
+
+	if (shmem_startup_hook_next)
+		(*shmem_startup_hook_next)();
+
+	clserv_sched_shm_values
+		= ShmemInitStruct("clserv_sched_shm_values",
+						  MAXALIGN(sizeof(*clserv_sched_shm_values)),
+						  &found);
+	Assert(!found);
+	memset(clserv_sched_shm_values, 0, sizeof(*clserv_sched_shm_values));
+	SpinLockInit(&clserv_sched_shm_values->lock);
+
+	if (opencl_timeline_size > 0)
+	{
+		clserv_timeline_shm_values
+			= ShmemInitStruct("clserv_timeline_shm_values",
+							  CLSERV_TIMELINE_LENGTH(opencl_timeline_size),
+							  &found);
+		Assert(!found);
+		memset(clserv_timeline_shm_values, 0,
+			   offsetof(clserv_timeline_buffer, entries));
+		SpinLockInit(&clserv_timeline_shm_values->lock);
+		clserv_timeline_shm_values->nrooms = opencl_timeline_size;
+	}
+}
+
 void
 pgstrom_init_opencl_server(void)
 {
@@ -410,6 +2166,37 @@ pgstrom_init_opencl_server(void)
 							PGC_POSTMASTER,
 							GUC_NOT_IN_SAMPLE,
 							NULL, NULL, NULL);
+	/* max length of device buffer pool for each device */
+	DefineCustomIntVariable("pgstrom.device_pool_size",
+							"max length of device buffer pool [MB]",
+							NULL,
+							&opencl_device_pool_size,
+							0,		/* 1/4 of device memory */
+							0,
+							INT_MAX,
+							PGC_POSTMASTER,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
+	/* separate command queues for DMA transfer */
+	DefineCustomBoolVariable("pgstrom.opencl_dma_queues",
+							 "use separate command queues for DMA transfer",
+							 NULL,
+							 &opencl_dma_queues,
+							 true,
+							 PGC_POSTMASTER,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+	/* number of entries of the profiling timeline */
+	DefineCustomIntVariable("pgstrom.opencl_timeline_size",
+							"number of commands kept on profiling timeline",
+							NULL,
+							&opencl_timeline_size,
+							0,		/* disabled */
+							0,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
 
 	/* launch a background worker process */	
 	memset(&worker, 0, sizeof(BackgroundWorker));
@@ -421,4 +2208,11 @@ pgstrom_init_opencl_server(void)
 	worker.bgw_main = pgstrom_opencl_main;
 	worker.bgw_main_arg = 0;
 	RegisterBackgroundWorker(&worker);
+
+	/* acquires shared memory region for device scheduler */
+	RequestAddinShmemSpace(MAXALIGN(sizeof(*clserv_sched_shm_values)));
+	if (opencl_timeline_size > 0)
+		RequestAddinShmemSpace(CLSERV_TIMELINE_LENGTH(opencl_timeline_size));
+	shmem_startup_hook_next = shmem_startup_hook;
+	shmem_startup_hook = pgstrom_startup_opencl_server;
 }
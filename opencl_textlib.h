@@ -0,0 +1,277 @@
+/*
+ * opencl_textlib.h
+ *
+ * Collection of text functions for OpenCL devices
+ * --
+ * Copyright 2011-2014 (C) KaiGai Kohei <kaigai@kaigai.gr.jp>
+ * Copyright 2014 (C) The PG-Strom Development Team
+ *
+ * This software is an extension of PostgreSQL; You can use, copy,
+ * modify or distribute it under the terms of 'LICENSE' included
+ * within this package.
+ */
+#ifndef OPENCL_TEXTLIB_H
+#define OPENCL_TEXTLIB_H
+#ifdef OPENCL_DEVICE_CODE
+
+/*
+ * Data types of text family
+ *
+ * These types are declared here, not by the code generator, because the
+ * functions below are built prior to the kernel source. varchar is binary
+ * compatible to text, so it shares the representation; it allows to put
+ * a varchar value on the argument of text functions as is.
+ */
+STROMCL_VARLENA_TYPE_TEMPLATE(text)
+STROMCL_VARLENA_TYPE_TEMPLATE(bpchar)
+typedef pg_text_t	pg_varchar_t;
+STROMCL_VARLENA_VARREF_TEMPLATE(varchar)
+STROMCL_VARLENA_PARAMREF_TEMPLATE(varchar)
+
+/*
+ * textlib_get_datum
+ *
+ * It fetches the contents and length of the supplied varlena; both of
+ * 1-byte and 4-bytes header are acceptable. Compressed or external datum
+ * cannot be handled on the device, so the row is marked to recheck on the
+ * host side.
+ */
+static inline bool
+textlib_get_datum(__private cl_int *errcode,
+				  __global varlena *vl_val,
+				  __global cl_char **p_str,
+				  cl_int *p_len)
+{
+	if (VARATT_IS_COMPRESSED(vl_val) || VARATT_IS_EXTERNAL(vl_val))
+	{
+		*errcode = StromError_RowReCheck;
+		return false;
+	}
+	*p_str = VARDATA_ANY(vl_val);
+	*p_len = VARSIZE_ANY_EXHDR(vl_val);
+	return true;
+}
+
+/*
+ * textlib_compare
+ *
+ * Comparison of two strings in the "C" collation; as varstr_cmp() doing,
+ * bytes are compared as unsigned char, then longer one is larger.
+ */
+static cl_int
+textlib_compare(__global cl_char *s1, cl_int len1,
+				__global cl_char *s2, cl_int len2)
+{
+	cl_int		len = min(len1, len2);
+	cl_int		i;
+
+	for (i=0; i < len; i++)
+	{
+		cl_uchar	c1 = s1[i];
+		cl_uchar	c2 = s2[i];
+
+		if (c1 != c2)
+			return (c1 < c2 ? -1 : 1);
+	}
+	return (len1 < len2 ? -1 : (len1 > len2 ? 1 : 0));
+}
+
+/*
+ * bpchar_truelen
+ *
+ * Length of bpchar string without trailing spaces, like bcTruelen()
+ */
+static inline cl_int
+bpchar_truelen(__global cl_char *str, cl_int len)
+{
+	while (len > 0 && str[len - 1] == ' ')
+		len--;
+	return len;
+}
+
+#define STROMCL_TEXT_COMPARE_TEMPLATE(NAME,TYPE,OPER,TRUELEN)		\
+	static pg_bool_t												\
+	pgfn_##NAME(__private cl_int *errcode,							\
+				pg_##TYPE##_t arg1, pg_##TYPE##_t arg2)				\
+	{																\
+		pg_bool_t	result;											\
+		__global cl_char *s1;										\
+		__global cl_char *s2;										\
+		cl_int		len1;											\
+		cl_int		len2;											\
+																	\
+		result.isnull = (arg1.isnull | arg2.isnull);				\
+		if (!result.isnull)											\
+		{															\
+			if (!textlib_get_datum(errcode, arg1.value, &s1, &len1) ||	\
+				!textlib_get_datum(errcode, arg2.value, &s2, &len2))	\
+				result.isnull = true;								\
+			else													\
+			{														\
+				len1 = TRUELEN(s1, len1);							\
+				len2 = TRUELEN(s2, len2);							\
+				result.value = (textlib_compare(s1, len1,			\
+												s2, len2) OPER 0);	\
+			}														\
+		}															\
+		return result;												\
+	}
+
+#define textlib_no_truelen(str,len)		(len)
+
+STROMCL_TEXT_COMPARE_TEMPLATE(texteq, text, ==, textlib_no_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(textne, text, !=, textlib_no_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(textlt, text, <,  textlib_no_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(textle, text, <=, textlib_no_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(textgt, text, >,  textlib_no_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(textge, text, >=, textlib_no_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(bpchareq, bpchar, ==, bpchar_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(bpcharne, bpchar, !=, bpchar_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(bpcharlt, bpchar, <,  bpchar_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(bpcharle, bpchar, <=, bpchar_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(bpchargt, bpchar, >,  bpchar_truelen)
+STROMCL_TEXT_COMPARE_TEMPLATE(bpcharge, bpchar, >=, bpchar_truelen)
+
+/*
+ * LIKE and ILIKE support
+ *
+ * Pattern matching with '%' (any sequence), '_' (any character) and '\'
+ * (the default escape character), as MatchText() doing. If 'utf8' is
+ * true, '_' consumes a multibyte character of UTF-8; elsewhere, every
+ * byte is a character. Case folding of ILIKE is applied only on ASCII
+ * characters, so the code generator offloads ILIKE only when both of
+ * LC_COLLATE and LC_CTYPE are "C".
+ * A pattern ending with the escape character is an error on the host
+ * side, so the row is rechecked to raise the error.
+ */
+static inline cl_int
+textlib_charlen(__global cl_char *str, bool utf8)
+{
+	cl_uchar	c = *str;
+
+	if (!utf8 || c < 0x80)
+		return 1;
+	if ((c & 0xe0) == 0xc0)
+		return 2;
+	if ((c & 0xf0) == 0xe0)
+		return 3;
+	if ((c & 0xf8) == 0xf0)
+		return 4;
+	return 1;
+}
+
+static inline cl_uchar
+textlib_tolower(cl_uchar c, bool icase)
+{
+	if (icase && c >= 'A' && c <= 'Z')
+		return c + ('a' - 'A');
+	return c;
+}
+
+static bool
+textlib_like_match(__private cl_int *errcode,
+				   __global cl_char *str, cl_int slen,
+				   __global cl_char *pat, cl_int plen,
+				   bool utf8, bool icase)
+{
+	cl_int		si = 0;
+	cl_int		pi = 0;
+	cl_int		s_mark = -1;
+	cl_int		p_mark = -1;
+
+	for (;;)
+	{
+		if (pi < plen && pat[pi] == '%')
+		{
+			/* consecutive wildcards are same as a wildcard */
+			while (pi < plen && pat[pi] == '%')
+				pi++;
+			/* trailing wildcard matches the rest of string */
+			if (pi == plen)
+				return true;
+			p_mark = pi;
+			s_mark = si;
+			continue;
+		}
+		if (si >= slen)
+			break;
+
+		if (pi < plen)
+		{
+			cl_uchar	pc = pat[pi];
+			cl_int		pstep = 1;
+
+			if (pc == '_')
+			{
+				pi++;
+				si += textlib_charlen(str + si, utf8);
+				continue;
+			}
+			if (pc == '\\')
+			{
+				if (pi + 1 >= plen)
+				{
+					*errcode = StromError_RowReCheck;
+					return false;
+				}
+				pc = pat[pi + 1];
+				pstep = 2;
+			}
+			if (textlib_tolower(str[si], icase) == textlib_tolower(pc, icase))
+			{
+				si++;
+				pi += pstep;
+				continue;
+			}
+		}
+		/* mismatch; retry with the next character of the last wildcard */
+		if (p_mark < 0)
+			return false;
+		s_mark += textlib_charlen(str + s_mark, utf8);
+		si = s_mark;
+		pi = p_mark;
+	}
+	/* the rest of pattern has to be wildcards */
+	while (pi < plen && pat[pi] == '%')
+		pi++;
+	return (pi == plen);
+}
+
+#define STROMCL_TEXT_LIKE_TEMPLATE(NAME,UTF8,ICASE,NEGATE)			\
+	static pg_bool_t												\
+	pgfn_##NAME(__private cl_int *errcode,							\
+				pg_text_t arg1, pg_text_t arg2)						\
+	{																\
+		pg_bool_t	result;											\
+		__global cl_char *str;										\
+		__global cl_char *pat;										\
+		cl_int		slen;											\
+		cl_int		plen;											\
+																	\
+		result.isnull = (arg1.isnull | arg2.isnull);				\
+		if (!result.isnull)											\
+		{															\
+			if (!textlib_get_datum(errcode, arg1.value, &str, &slen) ||	\
+				!textlib_get_datum(errcode, arg2.value, &pat, &plen))	\
+				result.isnull = true;								\
+			else													\
+				result.value = (NEGATE !=							\
+								textlib_like_match(errcode,			\
+												   str, slen,		\
+												   pat, plen,		\
+												   UTF8, ICASE));	\
+		}															\
+		return result;												\
+	}
+
+STROMCL_TEXT_LIKE_TEMPLATE(textlike,         false, false, false)
+STROMCL_TEXT_LIKE_TEMPLATE(textnlike,        false, false, true)
+STROMCL_TEXT_LIKE_TEMPLATE(texticlike,       false, true,  false)
+STROMCL_TEXT_LIKE_TEMPLATE(texticnlike,      false, true,  true)
+STROMCL_TEXT_LIKE_TEMPLATE(textlike_utf8,    true,  false, false)
+STROMCL_TEXT_LIKE_TEMPLATE(textnlike_utf8,   true,  false, true)
+STROMCL_TEXT_LIKE_TEMPLATE(texticlike_utf8,  true,  true,  false)
+STROMCL_TEXT_LIKE_TEMPLATE(texticnlike_utf8, true,  true,  true)
+
+#endif	/* OPENCL_DEVICE_CODE */
+#endif	/* OPENCL_TEXTLIB_H */
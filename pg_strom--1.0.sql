@@ -3,6 +3,7 @@
 --
 CREATE TYPE __pgstrom_shmem_info AS (
   zone    int4,
+  numa_node int4,
   size    text,
   active  int8,
   free    int8
@@ -12,6 +13,17 @@ CREATE FUNCTION pgstrom_shmem_info()
   AS 'MODULE_PATHNAME'
   LANGUAGE C STRICT;
 
+CREATE TYPE __pgstrom_shmem_slab_info AS (
+  chunksz int4,
+  slabs   int8,
+  active  int8,
+  free    int8
+);
+CREATE FUNCTION pgstrom_shmem_slab_info()
+  RETURNS SETOF __pgstrom_shmem_slab_info
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C STRICT;
+
 CREATE TYPE __pgstrom_opencl_device_info AS (
   dnum      int4,
   pnum		int4,
@@ -30,6 +42,9 @@ CREATE TYPE __pgstrom_opencl_program_info AS (
   crc		text,
   flags		int4,
   length	int4,
+  lookups	int8,
+  hits		int8,
+  hit_ratio	float8,
   source	text,
   errmsg	text
 );
@@ -42,13 +57,96 @@ CREATE TYPE __pgstrom_mqueue_info AS (
   mqueue	text,
   owner		int4,
   state     text,
-  refcnt	int4
+  refcnt	int4,
+  enqueue	int8,
+  dequeue	int8,
+  contention int8,
+  sleep		int8,
+  overflow	int8
 );
 CREATE FUNCTION pgstrom_mqueue_info()
   RETURNS SETOF __pgstrom_mqueue_info
   AS 'MODULE_PATHNAME'
   LANGUAGE C STRICT;
 
+CREATE TYPE __pgstrom_device_queue_info AS (
+  dnum           int4,
+  name           text,
+  inflight       int4,
+  inflight_bytes int8,
+  scheduled      int8,
+  completed      int8,
+  dma_cost       float8,
+  kern_cost      float8,
+  stolen         int8,
+  op_cost        float8,
+  op_samples     int8
+);
+CREATE FUNCTION pgstrom_device_queue_info()
+  RETURNS SETOF __pgstrom_device_queue_info
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C STRICT;
+
+CREATE TYPE __pgstrom_opencl_timeline AS (
+  seqno     int8,
+  dnum      int4,
+  plan      text,
+  chunk     int8,
+  command   text,
+  tv_queued int8,
+  tv_submit int8,
+  tv_start  int8,
+  tv_end    int8
+);
+CREATE FUNCTION pgstrom_opencl_timeline()
+  RETURNS SETOF __pgstrom_opencl_timeline
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C STRICT;
+
+CREATE FUNCTION pgstrom_opencl_timeline_trace()
+  RETURNS text
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C STRICT;
+
+CREATE TYPE __pgstrom_device_pool_info AS (
+  dnum        int4,
+  pool_limit  int8,
+  pool_usage  int8,
+  num_cached  int4,
+  hits        int8,
+  misses      int8,
+  trims       int8
+);
+CREATE FUNCTION pgstrom_device_pool_info()
+  RETURNS SETOF __pgstrom_device_pool_info
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C STRICT;
+
+CREATE TYPE __pgstrom_stat_info AS (
+  plan        text,
+  dnum        int4,
+  device      text,
+  event       text,
+  samples     int8,
+  total_time  float8,
+  avg_time    float8,
+  max_time    float8,
+  histogram   int8[],
+  stats_reset timestamptz
+);
+CREATE FUNCTION pgstrom_stat_info()
+  RETURNS SETOF __pgstrom_stat_info
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C STRICT;
+
+CREATE VIEW pg_stat_strom AS
+  SELECT * FROM pgstrom_stat_info();
+
+CREATE FUNCTION pgstrom_stat_reset()
+  RETURNS void
+  AS 'MODULE_PATHNAME'
+  LANGUAGE C STRICT;
+
 CREATE FUNCTION pgstrom_shmem_alloc(int8)
   RETURNS int8
   AS 'MODULE_PATHNAME', 'pgstrom_shmem_alloc_func'
@@ -88,3 +186,66 @@ CREATE FUNCTION pgstrom_release_testmsg(int8)
   RETURNS bool
   AS 'MODULE_PATHNAME', 'pgstrom_release_testmsg_func'
   LANGUAGE C STRICT;
+
+CREATE FUNCTION pgstrom_codegen_vector_test(text)
+  RETURNS text
+  AS 'MODULE_PATHNAME', 'pgstrom_codegen_vector_test_func'
+  LANGUAGE C STRICT;
+
+--
+-- Partial aggregate functions for GpuPreAgg
+--
+-- These functions represent partial results being computed on the device,
+-- so they are never called on the host side. Aggregate functions below
+-- combine the partial results.
+--
+CREATE FUNCTION pgstrom_pcount()
+  RETURNS int8
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE FUNCTION pgstrom_pcount("any")
+  RETURNS int8
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE FUNCTION pgstrom_psum(int2)
+  RETURNS int8
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE FUNCTION pgstrom_psum(int4)
+  RETURNS int8
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE FUNCTION pgstrom_psum(float4)
+  RETURNS float4
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE FUNCTION pgstrom_psum(float8)
+  RETURNS float8
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE FUNCTION pgstrom_pmin(anyelement)
+  RETURNS anyelement
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE FUNCTION pgstrom_pmax(anyelement)
+  RETURNS anyelement
+  AS 'MODULE_PATHNAME', 'pgstrom_partial_placeholder'
+  LANGUAGE C;
+
+CREATE AGGREGATE pgstrom_count(int8) (
+  sfunc = pg_catalog.int8pl,
+  stype = int8,
+  initcond = '0'
+);
+
+CREATE AGGREGATE pgstrom_sum(int8) (
+  sfunc = pg_catalog.int8pl,
+  stype = int8
+);
@@ -112,10 +112,14 @@ typedef struct {
 	cl_uint		dev_vendor_id;
 	char	   *dev_version;
 	char	   *driver_version;
+	cl_int		dev_numa_node;	/* NUMA node the device is attached, or -1 */
 	Size		buflen;
 	char		buffer[FLEXIBLE_ARRAY_MEMBER];
 } pgstrom_device_info;
 
+/* max number of OpenCL devices being supported */
+#define MAX_NUM_DEVICES		128
+
 /*
  * Tag of shared memory object classes
  */
@@ -132,6 +136,8 @@ typedef enum {
 	StromTag_GpuScan,
 	StromTag_GpuSort,
 	StromTag_HashJoin,
+	StromTag_HashJoinTable,
+	StromTag_GpuPreAgg,
 	StromTag_TestMessage,
 } StromTag;
 
@@ -147,10 +153,21 @@ typedef struct {
 	cl_ulong	time_dma_send;	/* time to send host=>device data */
 	cl_ulong	time_kern_exec;	/* time to execute kernel */
 	cl_ulong	time_dma_recv;	/* time to receive device=>host data */
+	cl_ulong	time_dma_overlap;/* time of DMA/kernel overlapped with
+								  * the neighbor chunks */
 	cl_ulong	time_in_recvq;	/* waiting time in the response mqueue */
 	struct timeval	tv;	/* result of gettimeofday(2) when enqueued */
 } pgstrom_perfmon;
 
+/*
+ * Assumption of the host CPU to translate device time into the planner
+ * cost; a CPU core at PGSTROM_CPU_REFERENCE_MHZ takes
+ * PGSTROM_CPU_OPERATOR_USEC to run an operator being charged by
+ * cpu_operator_cost.
+ */
+#define PGSTROM_CPU_REFERENCE_MHZ	2000.0
+#define PGSTROM_CPU_OPERATOR_USEC	0.01
+
 #define timeval_diff(tv1,tv2)						\
 	(((tv2)->tv_sec * 1000000L + (tv2)->tv_usec) -	\
 	 ((tv1)->tv_sec * 1000000L + (tv1)->tv_usec))
@@ -162,6 +179,9 @@ typedef struct {
  * OpenCL background server. A message queue is constructed with refcnt=1,
  * then its reference counter shall be incremented for each message enqueue
  * to be returned
+ * Note that messages towards the OpenCL server are not linked to qhead,
+ * but kept in a lock-free ring buffer in mqueue.c; so lock, cond and qhead
+ * of the server queue are only used to manage refcnt and closed.
  */
 typedef struct {
 	StromTag		stag;
@@ -172,6 +192,12 @@ typedef struct {
 	pthread_cond_t	cond;
 	dlist_head		qhead;
 	bool			closed;
+	/* statistics */
+	cl_ulong		num_enqueue;	/* number of enqueued messages */
+	cl_ulong		num_dequeue;	/* number of dequeued messages */
+	cl_ulong		num_contention;	/* number of lock or CAS conflicts */
+	cl_ulong		num_sleep;		/* number of waits for messages */
+	cl_ulong		num_overflow;	/* number of messages not fit the ring */
 } pgstrom_queue;
 
 typedef struct pgstrom_message {
@@ -183,6 +209,7 @@ typedef struct pgstrom_message {
 	pgstrom_queue  *respq;	/* mqueue for response message */
 	void	(*cb_process)(struct pgstrom_message *message);
 	void	(*cb_release)(struct pgstrom_message *message);
+	cl_int			dindex;	/* device index being scheduled, or -1 */
 	pgstrom_perfmon	pfm;
 } pgstrom_message;
 
@@ -239,13 +266,18 @@ typedef struct {
 #define DEVFUNC_NEEDS_TEXTLIB		0x0010
 #define DEVFUNC_NEEDS_NUMERICLIB	0x0020
 #define DEVFUNC_INCL_FLAGS			0x0038
+#define DEVFUNC_NEEDS_ERRCODE		0x0040	/* takes errcode argument */
+#define DEVFUNC_NEEDS_COLLATE_C		0x0080	/* only "C" collation */
 #define DEVKERNEL_NEEDS_DEBUG		0x0100
 #define DEVKERNEL_NEEDS_GPUSCAN		0x0200
 #define DEVKERNEL_NEEDS_GPUSORT		0x0400
 #define DEVKERNEL_NEEDS_HASHJOIN	0x0800
+#define DEVKERNEL_NEEDS_GPUPREAGG	0x1000
+#define DEVKERNEL_NEEDS_VECTOR		0x2000
 
 struct devtype_info;
 struct devfunc_info;
+struct devagg_info;
 
 typedef struct devtype_info {
 	Oid			type_oid;
@@ -267,6 +299,21 @@ typedef struct devfunc_info {
 	const char *func_decl;	/* declaration of function */
 } devfunc_info;
 
+#define DEVAGG_PCOUNT		1	/* number of (non-null) rows */
+#define DEVAGG_PSUM			2	/* sum of values */
+#define DEVAGG_PMIN			3	/* minimum value */
+#define DEVAGG_PMAX			4	/* maximum value */
+
+typedef struct devagg_info {
+	int32		agg_flags;
+	Oid			agg_oid;		/* OID of the original aggregate */
+	int			agg_kind;		/* one of DEVAGG_* */
+	devtype_info *agg_argtype;	/* NULL, if no argument or any type */
+	devtype_info *partial_type;	/* type of partial result */
+	Oid			partial_func;	/* function to represent partial result */
+	Oid			final_agg;		/* aggregate to combine partial results */
+} devagg_info;
+
 /*
  * T-Tree Columner Cache
  */
@@ -280,9 +327,13 @@ typedef struct {
 	slock_t			refcnt_lock;
 	int				refcnt;
 	dlist_node		chain;
+	dlist_node		build_chain;/* link to the build_log of tcache_head */
+	cl_uint			build_seq;	/* serial number on the build_log */
 	cl_uint			usage;
 	BlockNumber		blkno_max;
 	BlockNumber		blkno_min;
+	bool			is_claimed;	/* true, if a columnizer is working on */
+	cl_uint			nvacuumed;	/* number of tuples modified by vacuum */
 	kern_column_store *kcs_head; /* template of in-kernel column store */
 	kern_row_store	kern;
 } tcache_row_store;
@@ -312,21 +363,51 @@ typedef struct {
 	uint32			nrows;	/* number of rows being cached */
 	uint32			njunks;	/* number of junk rows to be removed later */
 	bool			is_sorted;
+	bool			is_encoded;	/* true, if arrays are sized to nrows and
+								 * some of columns are encoded. It is never
+								 * modified except for system columns. */
 	BlockNumber		blkno_max;
 	BlockNumber		blkno_min;
+	Size			length;	/* allocated length, for memory accounting */
 	ItemPointerData		*ctids;
 	HeapTupleHeaderData	*theads;
 	struct {
 		uint8	   *isnull;		/* nullmap, if NOT NULL is not set */
-		char	   *values;		/* array of values in columnar format */
+		char	   *values;		/* array of values in columnar format, or
+								 * NULL if this column is not resident */
 		tcache_toastbuf *toast;	/* toast buffer, if varlena variable */
+		uint32		enc_length;	/* length of kern_colenc on 'values', or 0
+								 * if it is a raw array */
+		uint32		usage;		/* access frequency of this column array;
+								 * updated without locks, so approximate */
+		/*
+		 * zone map of this chunk; it may be wider than the actual range
+		 * once records got removed, but never narrower.
+		 */
+		uint32		nnulls;		/* number of null values */
+		bool		has_range;	/* true, if min/max_value are valid */
+		Datum		min_value;	/* least value in this chunk */
+		Datum		max_value;	/* greatest value in this chunk */
 	} cdata[FLEXIBLE_ARRAY_MEMBER];
 } tcache_column_store;
 
 #define NUM_ROWS_PER_COLSTORE	(1 << 18)	/* 256K records */
 
+/*
+ * Residency of column arrays is fixed when a column-store is constructed.
+ * Non-resident ones are evicted or not loaded yet; scans load them from
+ * the heap on demand, using tcache_scan_load_columns().
+ */
+#define TCACHE_COLUMN_IS_RESIDENT(tcs,cindex)	\
+	((tcs)->cdata[(cindex)].values != NULL)
+
 /*
  * tcache_node - leaf or 
+ *
+ * A tcache_node is never modified once it gets published as a part of
+ * the tree; writer makes a copy of the node (copy-on-write) to change it.
+ * 'refcnt' is incremented by its parent node (or tc_head->tcs_root), by
+ * the working version of writer and by scans that pin a snapshot.
  */
 struct tcache_node {
 	StromTag		stag;	/* = StromTag_TCacheNode */
@@ -336,9 +417,11 @@ struct tcache_node {
 	struct tcache_node *left;	/* node with less ctids */
 	int				r_depth;
 	int				l_depth;
-	/* above fields are protected by lwlock of tc_head */
+	uint32			version;	/* version of tree this node was made in */
+	/* above fields are read-only once the node is published */
 
 	slock_t			lock;
+	int				refcnt;
 	tcache_column_store	*tcs;
 };
 typedef struct tcache_node tcache_node;
@@ -351,6 +434,19 @@ typedef struct tcache_node tcache_node;
 #define TCACHE_STATE_NOW_BUILD		2
 #define TCACHE_STATE_READY			3
 
+/*
+ * Initial build of tcache is split into ranges of TCACHE_BUILD_NBLOCKS
+ * blocks. Backends that scan the relation during the build load the
+ * ranges concurrently, up to TCACHE_BUILD_NLOADERS processes, with loader
+ * workers launched on beginning of the build. Each range is published to
+ * the scans as soon as it gets loaded, up to TCACHE_BUILD_NSCANS scans
+ * that walk on the build_log with their own cursor.
+ */
+#define TCACHE_BUILD_NBLOCKS		256
+#define TCACHE_BUILD_NLOADERS		16
+#define TCACHE_BUILD_NSCANS			16
+#define TCACHE_BUILD_NO_CURSOR		((cl_uint) ~0U)
+
 typedef struct {
 	StromTag	stag;			/* StromTag_TCacheHead */
 	dlist_node	chain;			/* link to the hash or free list */
@@ -366,19 +462,23 @@ typedef struct {
 	 * Usually, newly written tuples are put on the row-store, then
 	 * it shall be moved to column-store by columnizer background
 	 * worker process.
-	 * To simplifies the implementation, we right now adopt a giant-
-	 * lock approach; regular backend code takes shared-lock during
-	 * its execution, but columnizer process takes exclusive-lock
-	 * during its translation. Usually, row -> column translation
-	 * shall be done chunk-by-chunk, so this shared lock does not
-	 * take so long time.
-	 * Also note that an writer operation within a particular row-
-	 * or column- store is protected by its individual spinlock,
-	 * but it never takes giant locks.
+	 * The T-tree of column-stores is versioned. Scans pin a snapshot;
+	 * a pair of tcs_root and the row-stores not columnized yet, under
+	 * tc_head->lock, then walk on it without any further locks.
+	 * Writers (columnizers) construct the next version
+	 * on cow_root by copy-on-write of the nodes being modified, then
+	 * publish it by replacing tcs_root. Older nodes are reclaimed when
+	 * the last scan that pinned them is finished.
+	 * lwlock is never held by scans. Writers hold exclusive-lock while
+	 * they construct a new version, and short term operations that
+	 * update a published version in-place (hint bits, vacuum) take
+	 * shared-lock.
 	 */
-	LWLock			lwlock;		/* read-write lock per execution (long) */
-	tcache_node	   *tcs_root;	/* root node of this cache */
-	
+	LWLock			lwlock;		/* serialization of writers */
+	tcache_node	   *tcs_root;	/* root node of the latest version */
+	uint32			tcs_version;/* version number of tcs_root */
+	tcache_node	   *cow_root;	/* root node of the working version */
+	uint32			cow_version;/* version number of cow_root */
 
 	slock_t			lock;		/* short term locking for fields below */
 	int				state;
@@ -387,12 +487,33 @@ typedef struct {
 	dlist_head		pending_list; /* list of pending tcahe_node */
 	dlist_head		trs_list; /* list of pending tcache_row_store */
 	tcache_row_store *trs_curr;	/* current available row-store */
+	BlockNumber	build_nblocks;	/* number of blocks to be loaded */
+	BlockNumber	build_next;		/* head of the next range to be claimed */
+	struct {
+		bool		owned;	/* true, if a loader is attached on */
+		BlockNumber	blkno;	/* head of the range being loaded, or invalid.
+							 * A valid range on the slot not owned was
+							 * abandoned by an aborted loader; it shall be
+							 * loaded again by the next one. */
+	} build_slot[TCACHE_BUILD_NLOADERS];
+	dlist_head	build_log;		/* row-stores of the ranges already loaded,
+								 * in order of publication to the scans */
+	cl_uint		build_log_head;	/* build_seq of the head of build_log; the
+								 * entries prior to it are already released */
+	cl_uint		build_log_tail;	/* build_seq of the next entry */
+	cl_uint		build_cursor[TCACHE_BUILD_NSCANS];
+								/* build_seq of the entry being read by
+								 * each scan, or TCACHE_BUILD_NO_CURSOR */
+	NameData	build_dbname;	/* database to be connected by the loaders */
 
 	/* fields below are read-only once constructed (no lock needed) */
 	Oid			datoid;		/* database oid of this cache */
 	Oid			reloid;		/* relation oid of this cache */
 	int			ncols;		/* number of columns being cached */
 	AttrNumber *i_cached;	/* index of tupdesc->attrs for cached columns */
+	uint32	   *col_usage;	/* access frequency of each cached column; new
+							 * column-stores have arrays of the columns
+							 * being referenced recently. (lock) */
 	TupleDesc	tupdesc;	/* duplication of TupleDesc of underlying table.
 							 * all the values, except for constr, are on
 							 * the shared memory region, so its visible to
@@ -414,8 +535,17 @@ typedef struct {
  */
 typedef struct {
 	Relation		rel;
-	HeapScanDesc	heapscan;	/* valid, if state == TC_STATE_NOW_BUILD */
+	bool			is_building;/* true, if state was TC_STATE_NOW_BUILD */
+	bool			build_eof;	/* true, if walked out of the build_log */
+	int				build_cursor;/* index of build_cursor, or -1 if the scan
+								 * waits for completion of the build */
 	tcache_head	   *tc_head;
+	MemoryContext	memcxt;		/* memory context of this scan */
+	tcache_node	   *tc_root;	/* root node of the pinned snapshot */
+	uint32			tc_version;	/* version number of the snapshot */
+	int				trs_nums;	/* number of row-stores in the snapshot */
+	int				trs_index;	/* next row-store, or -1 on column-stores */
+	tcache_row_store **trs_snap;/* row-stores in the snapshot */
 	tcache_column_store	*tcs_curr;
 	tcache_row_store	*trs_curr;
 	int				index_curr;
@@ -438,16 +568,22 @@ typedef struct {
 	(SHMEM_BLOCKSZ_BITS_MAX - SHMEM_BLOCKSZ_BITS)
 #define SHMEM_BLOCKSZ			(1UL << SHMEM_BLOCKSZ_BITS)
 
+extern Size pgstrom_shmem_totalsize;
+
 extern void *pgstrom_shmem_alloc(Size size);
+extern void *pgstrom_shmem_alloc_numa(Size size, int numa_node);
 extern void *pgstrom_shmem_alloc_alap(Size required, Size *allocated);
 extern void pgstrom_shmem_free(void *address);
 extern bool pgstrom_shmem_sanitycheck(const void *address);
+extern void *pgstrom_shmem_zone_private(const void *address, Size *offset);
+extern int pgstrom_shmem_numa_node(const void *address);
 extern void pgstrom_setup_shmem(Size zone_length,
 								void *(*callback)(void *address,
 												  Size length));
 extern void pgstrom_init_shmem(void);
 
 extern Datum pgstrom_shmem_info(PG_FUNCTION_ARGS);
+extern Datum pgstrom_shmem_slab_info(PG_FUNCTION_ARGS);
 
 /*
  * mqueue.c
@@ -457,7 +593,11 @@ extern bool pgstrom_enqueue_message(pgstrom_message *message);
 extern void pgstrom_reply_message(pgstrom_message *message);
 extern pgstrom_message *pgstrom_dequeue_message(pgstrom_queue *queue);
 extern pgstrom_message *pgstrom_try_dequeue_message(pgstrom_queue *queue);
+extern void pgstrom_enqueue_message_list(dlist_head *mlist);
 extern pgstrom_message *pgstrom_dequeue_server_message(void);
+extern int pgstrom_dequeue_server_messages(pgstrom_message **msgs, int nmsgs);
+extern int pgstrom_try_dequeue_server_messages(pgstrom_message **msgs,
+											   int nmsgs);
 extern void pgstrom_close_server_queue(void);
 extern void pgstrom_cancel_server_loop(void);
 extern void pgstrom_close_queue(pgstrom_queue *queue);
@@ -476,10 +616,34 @@ pgstrom_create_kern_parambuf(List *used_params,
 extern pgstrom_row_store *
 pgstrom_load_row_store_heap(HeapScanDesc scan,
                             ScanDirection direction,
+                            Size rstore_size,
                             kern_colmeta *rs_colmeta,
                             kern_colmeta *cs_colmeta,
                             int cs_colnums,
                             bool *scan_done);
+extern void
+pgstrom_prefetch_row_store_heap(HeapScanDesc scan,
+                                ScanDirection direction,
+                                BlockNumber *p_prefetch,
+                                BlockNumber distance);
+extern pgstrom_row_store *
+pgstrom_load_row_store_tcache(tcache_row_store *trs,
+							  cl_uint nrows,
+							  kern_colmeta *rs_colmeta,
+							  kern_colmeta *cs_colmeta,
+							  int cs_colnums);
+extern pgstrom_row_store *
+pgstrom_load_row_store_subplan(PlanState *subplan,
+							   HeapTuple *p_overflow,
+							   kern_colmeta *rs_colmeta,
+							   kern_colmeta *cs_colmeta,
+							   int cs_colnums,
+							   bool *scan_done);
+extern void
+pgstrom_setup_kern_colstore_head(kern_column_store *kcs_head,
+								 kern_colmeta *cs_colmeta,
+								 int cs_colnums,
+								 cl_uint nrows);
 #ifdef USE_ASSERT_CHECKING
 extern void SanityCheck_kern_column_store(kern_row_store *krs,
 										  kern_column_store *kcs);
@@ -498,8 +662,27 @@ extern void pgstrom_init_restrack(void);
 /*
  * gpuscan.c
  */
+extern void pgstrom_device_costs(Cost *p_setup_cost,
+								 Cost *p_operator_cost,
+								 Cost *p_dma_per_byte);
 extern void pgstrom_init_gpuscan(void);
 
+/*
+ * hashjoin.c
+ */
+extern void pgstrom_init_gpuhashjoin(void);
+
+/*
+ * gpusort.c
+ */
+extern void pgstrom_init_gpusort(void);
+
+/*
+ * gpupreagg.c
+ */
+extern void pgstrom_init_gpupreagg(void);
+extern Datum pgstrom_partial_placeholder(PG_FUNCTION_ARGS);
+
 /*
  * opencl_devinfo.c
  */
@@ -531,6 +714,7 @@ extern void pgstrom_put_devprog_key(Datum dprog_key);
 extern Datum pgstrom_retain_devprog_key(Datum dprog_key);
 extern const char *pgstrom_get_devprog_errmsg(Datum dprog_key);
 extern int32 pgstrom_get_devprog_extra_flags(Datum dprog_key);
+extern cl_uint pgstrom_get_devprog_vector_width(Datum dprog_key);
 extern const char *pgstrom_get_devprog_kernel_source(Datum dprog_key);
 extern void pgstrom_init_opencl_devprog(void);
 extern Datum pgstrom_opencl_program_info(PG_FUNCTION_ARGS);
@@ -549,10 +733,69 @@ extern cl_context			opencl_context;
 extern cl_uint				opencl_num_devices;
 extern cl_device_id			opencl_devices[];
 extern cl_command_queue		opencl_cmdq[];
+extern cl_command_queue		opencl_cmdq_send[];
+extern cl_command_queue		opencl_cmdq_recv[];
 extern volatile bool		pgstrom_clserv_exit_pending;
 extern volatile bool		pgstrom_i_am_clserv;
 
-extern int pgstrom_opencl_device_schedule(pgstrom_message *message);
+extern int pgstrom_opencl_device_schedule(pgstrom_message *message,
+										  Size length);
+extern void pgstrom_opencl_device_complete(pgstrom_message *message,
+										   Size length,
+										   cl_ulong time_dma,
+										   cl_ulong time_kern);
+extern cl_ulong pgstrom_opencl_device_overlap(pgstrom_message *message,
+											  cl_ulong dma_send_begin,
+											  cl_ulong dma_send_end,
+											  cl_ulong kern_exec_begin,
+											  cl_ulong kern_exec_end,
+											  cl_ulong dma_recv_begin,
+											  cl_ulong dma_recv_end);
+extern void clserv_flush_device_queues(int dindex);
+extern void pgstrom_opencl_device_calibrate(int dindex, double op_usec);
+extern bool pgstrom_opencl_device_costs(double *p_dma_usec,
+										double *p_op_usec);
+extern Datum pgstrom_device_queue_info(PG_FUNCTION_ARGS);
+extern cl_mem clserv_create_buffer(int dindex, size_t length,
+								   cl_int *errcode);
+extern void clserv_release_buffer(int dindex, cl_mem mem);
+extern cl_int clserv_enqueue_write_buffer(cl_command_queue kcmdq,
+										 cl_mem buffer,
+										 size_t offset,
+										 size_t length,
+										 const void *host_ptr,
+										 cl_uint num_events,
+										 const cl_event *event_wait_list,
+										 cl_event *event);
+extern cl_int clserv_enqueue_read_buffer(cl_command_queue kcmdq,
+										cl_mem buffer,
+										size_t offset,
+										size_t length,
+										void *host_ptr,
+										cl_uint num_events,
+										const cl_event *event_wait_list,
+										cl_event *event);
+extern cl_mem clserv_create_mapped_buffer(int dindex,
+										  const void *host_ptr,
+										  size_t length,
+										  cl_int *errcode);
+extern cl_mem clserv_create_device_buffer(int dindex,
+										  const void *host_ptr,
+										  size_t length,
+										  bool *mapped,
+										  cl_int *errcode);
+extern cl_int clserv_get_event_profiling(cl_event event,
+										 cl_ulong *tv_begin,
+										 cl_ulong *tv_end);
+extern void clserv_timeline_record(pgstrom_message *message,
+								   cl_event *events, cl_int nevents,
+								   cl_int ev_kern, cl_int ev_recv);
+extern Datum pgstrom_opencl_timeline(PG_FUNCTION_ARGS);
+extern Datum pgstrom_opencl_timeline_trace(PG_FUNCTION_ARGS);
+extern cl_int clserv_set_event_callback(cl_event event,
+						void (CL_CALLBACK *callback)(cl_event, cl_int, void *),
+						void *private);
+extern Datum pgstrom_device_pool_info(PG_FUNCTION_ARGS);
 extern void pgstrom_init_opencl_server(void);
 
 /*
@@ -568,10 +811,14 @@ typedef struct {
 
 extern devtype_info *pgstrom_devtype_lookup(Oid type_oid);
 extern devfunc_info *pgstrom_devfunc_lookup(Oid func_oid);
+extern devagg_info *pgstrom_devagg_lookup(Oid agg_oid);
 extern char *pgstrom_codegen_expression(Node *expr, codegen_context *context);
+extern char *pgstrom_codegen_vector_expression(Node *expr,
+											   codegen_context *context);
 extern char *pgstrom_codegen_declarations(codegen_context *context);
 extern bool pgstrom_codegen_available_expression(Expr *expr);
 extern void pgstrom_codegen_init(void);
+extern Datum pgstrom_codegen_vector_test_func(PG_FUNCTION_ARGS);
 
 /*
  * gpuscan.c
@@ -586,12 +833,23 @@ extern StromTag *tcache_scan_next(tcache_scandesc *tc_scan);
 extern StromTag *tcache_scan_prev(tcache_scandesc *tc_scan);
 extern void tcache_end_scan(tcache_scandesc *tc_scan);
 extern void tcache_rescan(tcache_scandesc *tc_scan);
+extern tcache_column_store *tcache_scan_load_columns(tcache_scandesc *tc_scan,
+												tcache_column_store *tcs,
+												cl_uint *cindex, int nrefs);
 
 
 extern tcache_head *tcache_get_tchead(Oid reloid, Bitmapset *required,
 									  bool create_on_demand);
 extern void tcache_put_tchead(tcache_head *tc_head);
+extern void tcache_abort_tchead(tcache_head *tc_head);
+extern void pgstrom_tcache_loader_main(Datum main_arg);
+
 
+extern tcache_column_store *tcache_get_column_store(tcache_column_store *tcs);
+extern void tcache_put_column_store(tcache_column_store *tcs);
+extern bool tcache_zonemap_supported(Oid type_oid);
+extern bool tcache_zonemap_mismatch(tcache_column_store *tcs, int cindex,
+									Oid type_oid, int strategy, Datum value);
 
 extern tcache_row_store *tcache_create_row_store(TupleDesc tupdesc,
 												 int ncols,
@@ -630,10 +888,15 @@ extern void show_scan_qual(List *qual, const char *qlabel,
 extern void show_instrumentation_count(const char *qlabel, int which,
 									   PlanState *planstate, ExplainState *es);
 extern void show_device_kernel(Datum dprog_key, ExplainState *es);
+extern void _outToken(StringInfo str, const char *s);
+extern void _outBitmapset(StringInfo str, const Bitmapset *bms);
 extern void pgstrom_perfmon_add(pgstrom_perfmon *pfm_sum,
 								pgstrom_perfmon *pfm_item);
 extern void pgstrom_perfmon_explain(pgstrom_perfmon *pfm,
 									ExplainState *es);
+extern void pgstrom_perfmon_stat(pgstrom_message *message);
+extern Datum pgstrom_stat_info(PG_FUNCTION_ARGS);
+extern Datum pgstrom_stat_reset(PG_FUNCTION_ARGS);
 
 /*
  * debug.c
@@ -653,6 +916,11 @@ extern void pgstrom_init_debug(void);
  * opencl_*.h
  */
 extern const char *pgstrom_opencl_common_code;
+extern const char *pgstrom_opencl_textlib_code;
+extern const char *pgstrom_opencl_numericlib_code;
 extern const char *pgstrom_opencl_gpuscan_code;
+extern const char *pgstrom_opencl_gpusort_code;
+extern const char *pgstrom_opencl_hashjoin_code;
+extern const char *pgstrom_opencl_gpupreagg_code;
 
 #endif	/* PG_STROM_H */
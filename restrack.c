@@ -41,9 +41,12 @@ typedef struct {
 #define IS_TRACKABLE_OBJECT(stag)					\
 	(*((StromTag *)stag) == StromTag_MsgQueue ||	\
 	 *((StromTag *)stag) == StromTag_DevProgram ||	\
+	 *((StromTag *)stag) == StromTag_TCacheHead ||	\
 	 *((StromTag *)stag) == StromTag_GpuScan ||		\
 	 *((StromTag *)stag) == StromTag_GpuSort ||		\
 	 *((StromTag *)stag) == StromTag_HashJoin||		\
+	 *((StromTag *)stag) == StromTag_HashJoinTable ||	\
+	 *((StromTag *)stag) == StromTag_GpuPreAgg ||	\
 	 *((StromTag *)stag) == StromTag_TestMessage)
 
 static dlist_head		tracker_free;
@@ -112,6 +115,12 @@ pgstrom_restrack_callback(ResourceReleasePhase phase,
 
 				pgstrom_put_devprog_key(dprog_key);
 			}
+			else if (*entry->object == StromTag_TCacheHead)
+			{
+				tcache_head	   *tc_head = (tcache_head *)entry->object;
+
+				tcache_abort_tchead(tc_head);
+			}
 			else
 			{
 				Assert(IS_TRACKABLE_OBJECT(entry->object));
@@ -149,6 +158,8 @@ pgstrom_track_object(StromTag *stag)
 		{
 			if (*stag == StromTag_MsgQueue)
 				pgstrom_close_queue((pgstrom_queue *)stag);
+			else if (*stag == StromTag_TCacheHead)
+				tcache_put_tchead((tcache_head *)stag);
 			else
 				pgstrom_put_message((pgstrom_message *)stag);
 			PG_RE_THROW();
@@ -26,6 +26,8 @@
 #include "pg_strom.h"
 #include <limits.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 /*
  * management of shared memory segment in PG-Strom
@@ -33,13 +35,17 @@
  * Once a shared memory segment is allocated, PG-Strom split it into
  * multiple zones. A zone usually has more than 500MB, according to
  * the capability of OpenCL driver to map a parciular area as page-locked
- * memory. Also, it shall be associated with a particular NUMA node for
- * better memory access latency, in the future version.
- * 
+ * memory. Also, each zone is bound to a particular NUMA node using mbind(2)
+ * for better memory access latency, and allocation prefers the zones local
+ * to the calling process.
+ *
  * A zone contains a certain number of fixed-length (= SHMEM_BLOCKSZ) blocks. 
  * Block allocation system allocates 2^n blocks for the request.
- * On the other hand, context based allocation also allows to assign smaller
- * chunks on blocks being allocated by block allocation system.
+ * On the other hand, small request of pgstrom_shmem_alloc() is assigned
+ * on slabs; a slab is a block being split into the chunks of same size
+ * class. Slabs of each size class are shared by all the processes, and
+ * backend also keeps a few chunks being released locally, to reduce lock
+ * contention.
  */
 typedef struct
 {
@@ -59,23 +65,57 @@ typedef struct
 typedef struct
 {
 	slock_t		lock;
+	int			numa_node;		/* NUMA node being bound, or -1 */
 	long		num_blocks;		/* number of total blocks */
 	long		num_active[SHMEM_BLOCKSZ_BITS_RANGE + 1];
 	long		num_free[SHMEM_BLOCKSZ_BITS_RANGE + 1];
 	dlist_head	free_list[SHMEM_BLOCKSZ_BITS_RANGE + 1];
-	void	   *private;		/* cl_mem being mapped (Only OpenCL server) */
+	void	   *private;		/* OpenCL objects of the zone (Only OpenCL server) */
 	void	   *block_baseaddr;
 	shmem_block	blocks[FLEXIBLE_ARRAY_MEMBER];
 } shmem_zone;
 
+/*
+ * shmem_slab - a block being split into chunks of a particular size class.
+ * It is always located on the head of a block, so the slab of a chunk can
+ * be found by alignment, and it also means chunk never has block aligned
+ * address, unlike the result of block allocation.
+ */
+#define SHMEM_SLAB_MIN_BITS		5		/* 32B */
+#define SHMEM_SLAB_MAX_BITS		11		/* 2KB */
+#define SHMEM_SLAB_NCLASSES		(SHMEM_SLAB_MAX_BITS - SHMEM_SLAB_MIN_BITS + 1)
+#define SHMEM_SLAB_MAGIC		0x51ab51ab
+#define SHMEM_SLAB_HEADSZ		64
+#define SHMEM_SLAB_CACHESZ		16		/* chunks per class on backend */
+
+typedef struct
+{
+	dlist_node	partial_chain;	/* link to slab_partial_list, if has free
+								 * chunks */
+	cl_uint		magic;
+	cl_uint		slab_class;
+	cl_uint		nitems;
+	cl_uint		nfree;
+	void	   *free_chunk;		/* singly linked list of free chunks */
+} shmem_slab;
+
+#define SLAB_CHUNK_IS_VALID(address)						\
+	((Size)(address) % SHMEM_BLOCKSZ >= SHMEM_SLAB_HEADSZ &&	\
+	 ((shmem_slab *)TYPEALIGN_DOWN(SHMEM_BLOCKSZ,			\
+						(Size)(address)))->magic == SHMEM_SLAB_MAGIC)
+
 typedef struct
 {
-	/* for context management */
-	slock_t		context_lock;
-	dlist_head	context_list;
+	/* for slab management */
+	slock_t		slab_lock;
+	dlist_head	slab_partial_list[SHMEM_SLAB_NCLASSES];
+	long		slab_num_slabs[SHMEM_SLAB_NCLASSES];
+	long		slab_num_active[SHMEM_SLAB_NCLASSES];
+	long		slab_num_free[SHMEM_SLAB_NCLASSES];
 
 	/* for zone management */
 	bool		is_ready;
+	int			num_numa_nodes;	/* 0, if NUMA binding is not in use */
 	int			num_zones;
 	void	   *zone_baseaddr;
 	Size		zone_length;
@@ -95,10 +135,121 @@ typedef struct
 
 /* static variables */
 static shmem_startup_hook_type shmem_startup_hook_next;
-static Size			pgstrom_shmem_totalsize;
+Size				pgstrom_shmem_totalsize;
 static int			pgstrom_shmem_maxzones;
+static bool			pgstrom_shmem_numa_aware;
 static shmem_head  *pgstrom_shmem_head;
 
+/* chunks of the slabs being cached in this backend */
+static struct {
+	int		nitems;
+	void   *items[SHMEM_SLAB_CACHESZ];
+} slab_cache[SHMEM_SLAB_NCLASSES];
+static bool	slab_cache_registered = false;
+
+static void *pgstrom_shmem_slab_alloc(Size size);
+static void pgstrom_shmem_slab_free(void *address);
+static void pgstrom_shmem_slab_release(void *address);
+
+/*
+ * find_slab_class
+ *
+ * It returns the size class of slab for the supplied size.
+ */
+static inline int
+find_slab_class(Size size)
+{
+	int		sclass = 0;
+
+	Assert(size > 0 && size <= (1UL << SHMEM_SLAB_MAX_BITS));
+	while ((1UL << (sclass + SHMEM_SLAB_MIN_BITS)) < size)
+		sclass++;
+	return sclass;
+}
+
+/*
+ * NUMA support
+ *
+ * We use system calls directly, instead of libnuma, to avoid an additional
+ * dependency; all we need is mbind(2) to bind zones and getcpu(2) to know
+ * the NUMA node of the calling process.
+ */
+#define SHMEM_MAX_NUMA_NODES	64
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED			1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE			(1 << 1)
+#endif
+
+/*
+ * pgstrom_numa_num_nodes
+ *
+ * It returns number of NUMA nodes on the system, or 0 if unknown.
+ */
+static int
+pgstrom_numa_num_nodes(void)
+{
+	char		path[MAXPGPATH];
+	struct stat	stbuf;
+	int			i, num_nodes = 0;
+
+	for (i=0; i < SHMEM_MAX_NUMA_NODES; i++)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", i);
+		if (stat(path, &stbuf) == 0 && S_ISDIR(stbuf.st_mode))
+			num_nodes = i + 1;
+	}
+	return num_nodes;
+}
+
+/*
+ * pgstrom_numa_bind_zone
+ *
+ * It binds the supplied memory area to a particular NUMA node. We use
+ * MPOL_PREFERRED rather than MPOL_BIND, because page-locked area causes
+ * SIGBUS instead of fallback if the node runs out of memory.
+ */
+static bool
+pgstrom_numa_bind_zone(void *address, Size length, int numa_node)
+{
+#ifdef SYS_mbind
+	unsigned long	nodemask[SHMEM_MAX_NUMA_NODES / (8 * sizeof(long))];
+
+	Assert(numa_node >= 0 && numa_node < SHMEM_MAX_NUMA_NODES);
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[numa_node / (8 * sizeof(long))]
+		|= (1UL << (numa_node % (8 * sizeof(long))));
+
+	if (syscall(SYS_mbind, address, length, MPOL_PREFERRED,
+				nodemask, SHMEM_MAX_NUMA_NODES + 1, MPOL_MF_MOVE) == 0)
+		return true;
+	elog(LOG, "PG-Strom: failed to bind zone %p-%p on NUMA node %d: %m",
+		 address, (char *)address + length - 1, numa_node);
+#endif
+	return false;
+}
+
+/*
+ * pgstrom_numa_current_node
+ *
+ * It returns the NUMA node the calling process is running on, or -1 if
+ * unknown. Process may be migrated to another node, so the result is just
+ * a hint for allocation.
+ */
+static int
+pgstrom_numa_current_node(void)
+{
+#ifdef SYS_getcpu
+	unsigned int	cpu;
+	unsigned int	node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return (int) node;
+#endif
+	return -1;
+}
+
 /*
  * find_least_pot
  *
@@ -298,14 +449,39 @@ pgstrom_shmem_zone_block_free(shmem_zone *zone, void *address)
  * a particular shared memory zone. It tries to split a larger memory blocks
  * if suitable memory blocks are not free. If no memory blocks are available,
  * it goes into another zone to allocate memory.
+ * pgstrom_shmem_alloc prefers the zones local to the calling process, and
+ * pgstrom_shmem_alloc_numa prefers the zones on the supplied NUMA node.
+ * Zones of the other nodes are used only if no local zones have room.
  */
 void *
 pgstrom_shmem_alloc(Size size)
+{
+	int		numa_node = -1;
+
+	/* small request is assigned on slabs */
+	if (size > 0 && size <= (1UL << SHMEM_SLAB_MAX_BITS))
+	{
+		int		sclass = find_slab_class(size);
+
+		if (!pgstrom_i_am_clserv && slab_cache[sclass].nitems > 0)
+			return slab_cache[sclass].items[--slab_cache[sclass].nitems];
+		return pgstrom_shmem_slab_alloc(size);
+	}
+
+	if (pgstrom_shmem_head->num_numa_nodes > 1)
+		numa_node = pgstrom_numa_current_node();
+	return pgstrom_shmem_alloc_numa(size, numa_node);
+}
+
+void *
+pgstrom_shmem_alloc_numa(Size size, int numa_node)
 {
 	static int	zone_index = 0;
+	int			num_zones;
 	int			start;
+	int			loop;
 	shmem_zone *zone;
-	void	   *address;
+	void	   *address = NULL;
 
 	/* does shared memory segment already set up? */
 	if (!pgstrom_shmem_head->is_ready)
@@ -314,34 +490,229 @@ pgstrom_shmem_alloc(Size size)
 		return NULL;
 	}
 
-
 	/* unable to allocate 0-byte or too large */
 	if (size == 0 || size > (1UL << SHMEM_BLOCKSZ_BITS_MAX))
 		return NULL;
 
 	/*
-	 * find a zone we should allocate.
+	 * find a zone we should allocate; the first loop walks on the zones
+	 * on the preferable NUMA node, then the second loop walks on the
+	 * rest of zones.
 	 *
-	 * XXX - To be put more wise zone selection
-	 *  - NUMA aware
-	 *  - Memory reclaim when no blocks are available
+	 * XXX - memory reclaim when no blocks are available
 	 */
-	start = zone_index;
-	do {
-		zone = pgstrom_shmem_head->zones[zone_index];
-		SpinLockAcquire(&zone->lock);
+	num_zones = pgstrom_shmem_head->num_zones;
+	if (numa_node < 0 || pgstrom_shmem_head->num_numa_nodes <= 1)
+		numa_node = -1;
+	start = zone_index % num_zones;
+	for (loop = (numa_node < 0 ? 1 : 0); !address && loop < 2; loop++)
+	{
+		int		index = start;
 
-		address = pgstrom_shmem_zone_block_alloc(zone, size);
+		do {
+			zone = pgstrom_shmem_head->zones[index];
+			if (loop == 0
+				? zone->numa_node == numa_node
+				: (numa_node < 0 || zone->numa_node != numa_node))
+			{
+				SpinLockAcquire(&zone->lock);
+				address = pgstrom_shmem_zone_block_alloc(zone, size);
+				SpinLockRelease(&zone->lock);
 
-		SpinLockRelease(&zone->lock);
+				if (address)
+				{
+					zone_index = index;
+					break;
+				}
+			}
+			index = (index + 1) % num_zones;
+		} while (index != start);
+	}
+	return address;
+}
 
-		if (address)
-			break;
+/*
+ * pgstrom_shmem_numa_node
+ *
+ * It returns the NUMA node of the zone that contains the supplied address,
+ * or -1 if the zone is not bound to a particular node.
+ */
+int
+pgstrom_shmem_numa_node(const void *address)
+{
+	void	   *zone_baseaddr = pgstrom_shmem_head->zone_baseaddr;
+	Size		zone_length = pgstrom_shmem_head->zone_length;
+	int			zone_index;
+
+	if (!ADDRESS_IN_SHMEM(address))
+		return -1;
+
+	zone_index = ((Size)address - (Size)zone_baseaddr) / zone_length;
+	if (zone_index >= pgstrom_shmem_head->num_zones)
+		return -1;
+	return pgstrom_shmem_head->zones[zone_index]->numa_node;
+}
+
+/*
+ * pgstrom_shmem_slab_alloc
+ *
+ * It allocates a chunk on the slabs of the size class. Request larger than
+ * the largest size class is assigned on a block of the zones local to the
+ * calling process, as slabs are.
+ */
+static void *
+pgstrom_shmem_slab_alloc(Size size)
+{
+	shmem_head *head = pgstrom_shmem_head;
+	shmem_slab *slab;
+	dlist_node *dnode;
+	void	   *chunk;
+	Size		chunksz;
+	int			sclass;
+	int			i;
+
+	if (size == 0)
+		return NULL;
+	if (size > (1UL << SHMEM_SLAB_MAX_BITS))
+		return pgstrom_shmem_alloc_numa(size,
+										pgstrom_shmem_head->num_numa_nodes > 1
+										? pgstrom_numa_current_node() : -1);
+
+	sclass = find_slab_class(size);
+	chunksz = (1UL << (sclass + SHMEM_SLAB_MIN_BITS));
+
+	SpinLockAcquire(&head->slab_lock);
+	if (dlist_is_empty(&head->slab_partial_list[sclass]))
+	{
+		/* block allocation shall not be done under the spinlock */
+		SpinLockRelease(&head->slab_lock);
+
+		slab = pgstrom_shmem_alloc(SHMEM_BLOCKSZ - sizeof(cl_uint));
+		if (!slab)
+			return NULL;
+		memset(slab, 0, sizeof(shmem_slab));
+		slab->magic = SHMEM_SLAB_MAGIC;
+		slab->slab_class = sclass;
+		slab->nitems = ((SHMEM_BLOCKSZ - sizeof(cl_uint) -
+						 SHMEM_SLAB_HEADSZ) / chunksz);
+		slab->nfree = slab->nitems;
+		slab->free_chunk = NULL;
+		for (i = slab->nitems - 1; i >= 0; i--)
+		{
+			chunk = (char *)slab + SHMEM_SLAB_HEADSZ + chunksz * i;
+			*((void **) chunk) = slab->free_chunk;
+			slab->free_chunk = chunk;
+		}
+
+		SpinLockAcquire(&head->slab_lock);
+		dlist_push_head(&head->slab_partial_list[sclass],
+						&slab->partial_chain);
+		head->slab_num_slabs[sclass]++;
+		head->slab_num_free[sclass] += slab->nitems;
+	}
+	dnode = dlist_head_node(&head->slab_partial_list[sclass]);
+	slab = dlist_container(shmem_slab, partial_chain, dnode);
+	Assert(slab->magic == SHMEM_SLAB_MAGIC && slab->nfree > 0);
+
+	chunk = slab->free_chunk;
+	slab->free_chunk = *((void **) chunk);
+	if (--slab->nfree == 0)
+	{
+		dlist_delete(&slab->partial_chain);
+		memset(&slab->partial_chain, 0, sizeof(dlist_node));
+	}
+	head->slab_num_active[sclass]++;
+	head->slab_num_free[sclass]--;
+	SpinLockRelease(&head->slab_lock);
+
+	return chunk;
+}
+
+/*
+ * pgstrom_shmem_slab_free
+ *
+ * It releases a chunk on a slab. Chunks are cached on the local backend
+ * first, for later allocation without locks; the
+ * cache is flushed on process exit.
+ */
+static void
+pgstrom_shmem_slab_cache_flush(int code, Datum arg)
+{
+	int		i, j;
+
+	for (i=0; i < SHMEM_SLAB_NCLASSES; i++)
+	{
+		for (j=0; j < slab_cache[i].nitems; j++)
+			pgstrom_shmem_slab_release(slab_cache[i].items[j]);
+		slab_cache[i].nitems = 0;
+	}
+}
 
-		zone_index = (zone_index + 1) % pgstrom_shmem_head->num_zones;
-	} while (zone_index != start);
+static void
+pgstrom_shmem_slab_free(void *address)
+{
+	shmem_slab *slab = (shmem_slab *) TYPEALIGN_DOWN(SHMEM_BLOCKSZ,
+													  (Size) address);
+	int			sclass = slab->slab_class;
+
+	Assert(SLAB_CHUNK_IS_VALID(address));
 
-	return address;	
+	if (!pgstrom_i_am_clserv &&
+		slab_cache[sclass].nitems < SHMEM_SLAB_CACHESZ)
+	{
+		if (!slab_cache_registered)
+		{
+			on_shmem_exit(pgstrom_shmem_slab_cache_flush, 0);
+			slab_cache_registered = true;
+		}
+		slab_cache[sclass].items[slab_cache[sclass].nitems++] = address;
+		return;
+	}
+	pgstrom_shmem_slab_release(address);
+}
+
+static void
+pgstrom_shmem_slab_release(void *address)
+{
+	shmem_head	   *head = pgstrom_shmem_head;
+	shmem_slab	   *slab = (shmem_slab *) TYPEALIGN_DOWN(SHMEM_BLOCKSZ,
+														  (Size) address);
+	int				sclass = slab->slab_class;
+	bool			do_release = false;
+
+	Assert(SLAB_CHUNK_IS_VALID(address));
+
+	SpinLockAcquire(&head->slab_lock);
+	*((void **) address) = slab->free_chunk;
+	slab->free_chunk = address;
+	if (slab->nfree++ == 0)
+		dlist_push_head(&head->slab_partial_list[sclass],
+						&slab->partial_chain);
+	head->slab_num_active[sclass]--;
+	head->slab_num_free[sclass]++;
+
+	/*
+	 * Empty slab goes back to the block allocator, unless it is the last
+	 * one of the size class; to avoid allocation and release repeatedly.
+	 */
+	if (slab->nfree == slab->nitems &&
+		(dlist_head_node(&head->slab_partial_list[sclass])
+		 != &slab->partial_chain ||
+		 dlist_has_next(&head->slab_partial_list[sclass],
+						&slab->partial_chain)))
+	{
+		dlist_delete(&slab->partial_chain);
+		head->slab_num_slabs[sclass]--;
+		head->slab_num_free[sclass] -= slab->nitems;
+		do_release = true;
+	}
+	SpinLockRelease(&head->slab_lock);
+
+	if (do_release)
+	{
+		slab->magic = 0;
+		pgstrom_shmem_free(slab);
+	}
 }
 
 /*
@@ -375,7 +746,12 @@ pgstrom_shmem_free(void *address)
 	Size		zone_length = pgstrom_shmem_head->zone_length;
 	int			zone_index;
 
-	Assert((Size)address % SHMEM_BLOCKSZ == 0);
+	/* chunk on a slab never has block aligned address */
+	if ((Size)address % SHMEM_BLOCKSZ != 0)
+	{
+		pgstrom_shmem_slab_free(address);
+		return;
+	}
 
 	zone_index = ((Size)address - (Size)zone_baseaddr) / zone_length;
 	Assert(zone_index >= 0 && zone_index < pgstrom_shmem_head->num_zones);
@@ -386,6 +762,42 @@ pgstrom_shmem_free(void *address)
 	SpinLockRelease(&zone->lock);
 }
 
+/*
+ * pgstrom_shmem_zone_private
+ *
+ * It returns the private datum of the zone that contains the supplied
+ * address, and offset of the address from the head of area being given
+ * to the callback on pgstrom_setup_shmem(). NULL shall be returned, if
+ * the address is out of the shared memory segment.
+ * Note that the private datum is only valid on the process that set up
+ * the shared memory segment; the OpenCL server.
+ */
+void *
+pgstrom_shmem_zone_private(const void *address, Size *offset)
+{
+	shmem_zone *zone;
+	void	   *zone_baseaddr = pgstrom_shmem_head->zone_baseaddr;
+	Size		zone_length = pgstrom_shmem_head->zone_length;
+	int			zone_index;
+
+	if (!ADDRESS_IN_SHMEM(address))
+		return NULL;
+
+	zone_index = ((Size)address - (Size)zone_baseaddr) / zone_length;
+	if (zone_index >= pgstrom_shmem_head->num_zones)
+		return NULL;
+
+	zone = pgstrom_shmem_head->zones[zone_index];
+	if ((Size)address < (Size)zone->block_baseaddr ||
+		(Size)address >= ((Size)zone->block_baseaddr +
+						  zone->num_blocks * SHMEM_BLOCKSZ))
+		return NULL;
+
+	if (offset)
+		*offset = (Size)address - (Size)zone->block_baseaddr;
+	return zone->private;
+}
+
 /*
  * pgstrom_shmem_sanitycheck
  *
@@ -404,7 +816,9 @@ pgstrom_shmem_sanitycheck(const void *address)
 	int				block_index;
 	cl_uint		   *p_magic;
 
-	Assert((Size)address % SHMEM_BLOCKSZ == 0);
+	/* chunk on a slab has no magic of its own, so check the slab */
+	if ((Size)address % SHMEM_BLOCKSZ != 0)
+		return SLAB_CHUNK_IS_VALID(address);
 
 	zone_index = ((Size)address - (Size)zone_baseaddr) / zone_length;
 	Assert(zone_index >= 0 && zone_index < pgstrom_shmem_head->num_zones);
@@ -432,6 +846,7 @@ pgstrom_shmem_sanitycheck(const void *address)
 typedef struct
 {
 	int		zone;
+	int		numa_node;
 	int		shift;
 	int		num_active;
 	int		num_free;
@@ -490,6 +905,7 @@ collect_shmem_block_info(shmem_zone *zone, int zone_index)
 		shmem_block_info *block_info
 			= palloc(sizeof(shmem_block_info));
 		block_info->zone = zone_index;
+		block_info->numa_node = zone->numa_node;
 		block_info->shift = i;
 		block_info->num_active = num_active[i];
 		block_info->num_free = num_free[i];
@@ -505,8 +921,8 @@ pgstrom_shmem_info(PG_FUNCTION_ARGS)
 	FuncCallContext	   *fncxt;
 	shmem_block_info   *block_info;
 	HeapTuple	tuple;
-	Datum		values[4];
-	bool		isnull[4];
+	Datum		values[5];
+	bool		isnull[5];
 	int			shift;
 	char		buf[32];
 
@@ -521,14 +937,16 @@ pgstrom_shmem_info(PG_FUNCTION_ARGS)
 		fncxt = SRF_FIRSTCALL_INIT();
 		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
 
-		tupdesc = CreateTemplateTupleDesc(4, false);
+		tupdesc = CreateTemplateTupleDesc(5, false);
 		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "zone",
 						   INT4OID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "size",
+		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "numa_node",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "size",
 						   TEXTOID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "active",
+		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "active",
 						   INT8OID, -1, 0);
-		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "free",
+		TupleDescInitEntry(tupdesc, (AttrNumber) 5, "free",
 						   INT8OID, -1, 0);
 		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
 
@@ -565,6 +983,10 @@ pgstrom_shmem_info(PG_FUNCTION_ARGS)
 
 	memset(isnull, 0, sizeof(isnull));
 	values[0] = Int32GetDatum(block_info->zone);
+	if (block_info->numa_node < 0)
+		isnull[1] = true;
+	else
+		values[1] = Int32GetDatum(block_info->numa_node);
 	shift = block_info->shift + SHMEM_BLOCKSZ_BITS;
 	if (shift < 20)
 		snprintf(buf, sizeof(buf), "%zuK", 1UL << (shift - 10));
@@ -574,9 +996,9 @@ pgstrom_shmem_info(PG_FUNCTION_ARGS)
 		snprintf(buf, sizeof(buf), "%zuG", 1UL << (shift - 30));
 	else
 		snprintf(buf, sizeof(buf), "%zuT", 1UL << (shift - 40));
-	values[1] = CStringGetTextDatum(buf);
-	values[2] = Int64GetDatum(block_info->num_active);
-	values[3] = Int64GetDatum(block_info->num_free);
+	values[2] = CStringGetTextDatum(buf);
+	values[3] = Int64GetDatum(block_info->num_active);
+	values[4] = Int64GetDatum(block_info->num_free);
 
 	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
 
@@ -584,6 +1006,62 @@ pgstrom_shmem_info(PG_FUNCTION_ARGS)
 }
 PG_FUNCTION_INFO_V1(pgstrom_shmem_info);
 
+/*
+ * pgstrom_shmem_slab_info
+ *
+ * It shows usage of the slabs for each size class.
+ */
+Datum
+pgstrom_shmem_slab_info(PG_FUNCTION_ARGS)
+{
+	FuncCallContext	   *fncxt;
+	shmem_head		   *head = pgstrom_shmem_head;
+	HeapTuple	tuple;
+	Datum		values[4];
+	bool		isnull[4];
+	int			sclass;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc		tupdesc;
+		MemoryContext	oldcxt;
+
+		fncxt = SRF_FIRSTCALL_INIT();
+		oldcxt = MemoryContextSwitchTo(fncxt->multi_call_memory_ctx);
+
+		tupdesc = CreateTemplateTupleDesc(4, false);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "chunksz",
+						   INT4OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 2, "slabs",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 3, "active",
+						   INT8OID, -1, 0);
+		TupleDescInitEntry(tupdesc, (AttrNumber) 4, "free",
+						   INT8OID, -1, 0);
+		fncxt->tuple_desc = BlessTupleDesc(tupdesc);
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+	fncxt = SRF_PERCALL_SETUP();
+
+	sclass = fncxt->call_cntr;
+	if (sclass >= SHMEM_SLAB_NCLASSES)
+		SRF_RETURN_DONE(fncxt);
+
+	memset(isnull, 0, sizeof(isnull));
+	values[0] = Int32GetDatum(1UL << (sclass + SHMEM_SLAB_MIN_BITS));
+	SpinLockAcquire(&head->slab_lock);
+	values[1] = Int64GetDatum(head->slab_num_slabs[sclass]);
+	values[2] = Int64GetDatum(head->slab_num_active[sclass]);
+	values[3] = Int64GetDatum(head->slab_num_free[sclass]);
+	SpinLockRelease(&head->slab_lock);
+
+	tuple = heap_form_tuple(fncxt->tuple_desc, values, isnull);
+
+	SRF_RETURN_NEXT(fncxt, HeapTupleGetDatum(tuple));
+}
+PG_FUNCTION_INFO_V1(pgstrom_shmem_slab_info);
+
 void
 pgstrom_setup_shmem(Size zone_length,
 					void *(*callback)(void *address, Size length))
@@ -592,6 +1070,7 @@ pgstrom_setup_shmem(Size zone_length,
 	long			zone_index;
 	long			num_zones;
 	long			num_blocks;
+	int				num_numa_nodes = 0;
 	Size			offset;
 
 	pg_memory_barrier();
@@ -608,6 +1087,16 @@ pgstrom_setup_shmem(Size zone_length,
 							&pgstrom_shmem_head->zones[num_zones]);
 	pgstrom_shmem_head->zone_length = zone_length;
 
+	/*
+	 * Zones are distributed to NUMA nodes evenly. Binding has to be done
+	 * prior to the first touch of the zone, because pages already faulted
+	 * on shared mapping are not moved.
+	 */
+	if (pgstrom_shmem_numa_aware)
+		num_numa_nodes = pgstrom_numa_num_nodes();
+	if (num_numa_nodes > 1)
+		elog(LOG, "PG-Strom: %d NUMA nodes are available", num_numa_nodes);
+
 	offset = 0;
 	for (zone_index = 0; zone_index < num_zones; zone_index++)
 	{
@@ -637,6 +1126,17 @@ pgstrom_setup_shmem(Size zone_length,
 			((char *)pgstrom_shmem_head->zone_baseaddr + offset);
 		Assert((Size)zone % SHMEM_BLOCKSZ == 0);
 
+		if (num_numa_nodes > 1)
+		{
+			int		numa_node = (zone_index * num_numa_nodes) / num_zones;
+
+			if (!pgstrom_numa_bind_zone(zone, length, numa_node))
+				numa_node = -1;
+			zone->numa_node = numa_node;
+		}
+		else
+			zone->numa_node = -1;
+
 		SpinLockInit(&zone->lock);
 		zone->num_blocks = num_blocks;
 		for (i=0; i < SHMEM_BLOCKSZ_BITS_RANGE+1; i++)
@@ -673,14 +1173,16 @@ pgstrom_setup_shmem(Size zone_length,
 				shift--;
 		}
 		/* per zone initialization */
-		(*callback)(zone->block_baseaddr,
-					zone->num_blocks * SHMEM_BLOCKSZ);
+		zone->private = (*callback)(zone->block_baseaddr,
+									zone->num_blocks * SHMEM_BLOCKSZ);
 		/* put zone on the pgstrom_shmem_head */
 		pgstrom_shmem_head->zones[zone_index] = zone;
 		offset += length;
 	}
 	Assert(zone_index <= num_zones);
 	pgstrom_shmem_head->num_zones = zone_index;
+	pgstrom_shmem_head->num_numa_nodes = (num_numa_nodes > 1
+										  ? num_numa_nodes : 0);
 
 	/* OK, now ready to use shared memory segment */
 	pgstrom_shmem_head->is_ready = true;
@@ -691,6 +1193,7 @@ pgstrom_startup_shmem(void)
 {
 	Size	length;
 	bool	found;
+	int		i;
 
 	if (shmem_startup_hook_next)
 		(*shmem_startup_hook_next)();
@@ -702,7 +1205,17 @@ pgstrom_startup_shmem(void)
 										 length, &found);
 	Assert(!found);
 
-	memset(pgstrom_shmem_head, 0, length);
+	/*
+	 * Only header portion is cleared here. Zones are initialized by
+	 * pgstrom_setup_shmem(), and should not be touched prior to NUMA
+	 * binding.
+	 */
+	memset(pgstrom_shmem_head, 0,
+		   offsetof(shmem_head, zones[pgstrom_shmem_maxzones]));
+
+	SpinLockInit(&pgstrom_shmem_head->slab_lock);
+	for (i=0; i < SHMEM_SLAB_NCLASSES; i++)
+		dlist_init(&pgstrom_shmem_head->slab_partial_list[i]);
 }
 
 void
@@ -736,6 +1249,15 @@ pgstrom_init_shmem(void)
 							GUC_NOT_IN_SAMPLE,
 							NULL, NULL, NULL);
 
+	DefineCustomBoolVariable("pgstrom.shmem_numa_aware",
+							 "binds shared memory zones to NUMA nodes",
+							 NULL,
+							 &pgstrom_shmem_numa_aware,
+							 true,
+							 PGC_POSTMASTER,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+
 	pgstrom_shmem_totalsize = ((Size)shmem_totalsize) << 20;
 
 	/* Acquire shared memory segment */
@@ -0,0 +1,29 @@
+--
+-- codegen_vector
+--
+-- Simple qualifiers on vector types have to be vectorized; the vector
+-- version of the kernel is used on the columnar cache. It checks the code
+-- generator only, so no devices are required, but pg_strom has to be
+-- loaded by shared_preload_libraries as usual.
+--
+CREATE EXTENSION pg_strom;
+CREATE TABLE codegen_vector_t (a int4, b int8, c float8, d text);
+
+-- equality and inequality
+SELECT pgstrom_codegen_vector_test('SELECT * FROM codegen_vector_t WHERE a = 10')
+       LIKE '%(kvvar_0 == kvparam_0)%' AS vectorized;
+SELECT pgstrom_codegen_vector_test('SELECT * FROM codegen_vector_t WHERE a <> 10')
+       LIKE '%(kvvar_0 != kvparam_0)%' AS vectorized;
+
+-- comparison and arithmetic operators
+SELECT pgstrom_codegen_vector_test('SELECT * FROM codegen_vector_t WHERE b < 10::int8')
+       LIKE '%(kvvar_0 < kvparam_0)%' AS vectorized;
+SELECT pgstrom_codegen_vector_test('SELECT * FROM codegen_vector_t WHERE c + c >= 1.0')
+       LIKE '%((kvvar_0 + kvvar_0) >= kvparam_0)%' AS vectorized;
+
+-- varlena is not vectorized
+SELECT pgstrom_codegen_vector_test('SELECT * FROM codegen_vector_t WHERE d = ''abc''')
+       IS NULL AS not_vectorized;
+
+DROP TABLE codegen_vector_t;
+DROP EXTENSION pg_strom;
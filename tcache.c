@@ -12,7 +12,11 @@
  */
 #include "postgres.h"
 #include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/skey.h"
 #include "access/sysattr.h"
+#include "access/tupmacs.h"
+#include "access/xact.h"
 #include "catalog/dependency.h"
 #include "catalog/indexing.h"
 #include "catalog/objectaccess.h"
@@ -22,6 +26,8 @@
 #include "catalog/pg_namespace.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_trigger.h"
+#include "catalog/pg_type.h"
+#include "commands/dbcommands.h"
 #include "commands/trigger.h"
 #include "miscadmin.h"
 #include "postmaster/bgworker.h"
@@ -55,11 +61,23 @@ typedef struct {
 	dlist_head	pending_list;	/* list of tc_head pending for columnization */
 	dlist_head	slot[TCACHE_HASH_SIZE];
 
+	/* total amount of column-stores, protected by usage_lock */
+	slock_t		usage_lock;
+	Size		usage;
+
 	/* properties of columnizers */
 	dlist_head	inactive_list;	/* list of inactive columnizers */
 	tcache_columnizer columnizers[FLEXIBLE_ARRAY_MEMBER];
 } tcache_common;
 
+/*
+ * tcache_build_entry - a build slot owned by this backend
+ */
+typedef struct {
+	tcache_head	   *tc_head;
+	int				slot;	/* index of build_slot, or -1 */
+} tcache_build_entry;
+
 /*
  * static variables
  */
@@ -68,17 +86,26 @@ static object_access_hook_type object_access_hook_next;
 static heap_page_prune_hook_type heap_page_prune_hook_next;
 static tcache_common  *tc_common = NULL;
 static int	num_columnizers;
+static bool	tcache_compression;
+static int	tcache_reclaim_threshold;
+static int	tcache_num_loaders;
+static List *tcache_build_entries = NIL;
+static List *tcache_build_scans = NIL;
 
 /*
  * static declarations
  */
-static tcache_column_store *tcache_create_column_store(tcache_head *tc_head);
+static tcache_column_store *tcache_create_column_store(tcache_head *tc_head,
+													   const bool *resident);
+static void tcache_decode_column_values(char *dest, tcache_column_store *tcs,
+										int cindex, int attlen);
 static tcache_column_store *tcache_duplicate_column_store(tcache_head *tc_head,
 												  tcache_column_store *tcs_old,
+												  const bool *resident,
 												  bool duplicate_toastbuf);
-static tcache_column_store *tcache_get_column_store(tcache_column_store *tcs);
-static void tcache_put_column_store(tcache_column_store *tcs);
-
+static void tcache_discard_column_array(tcache_column_store *tcs,
+										int cindex);
+static void tcache_account_usage(int64 delta);
 
 static tcache_toastbuf *tcache_create_toast_buffer(Size required);
 static tcache_toastbuf *tcache_duplicate_toast_buffer(tcache_toastbuf *tbuf,
@@ -88,11 +115,11 @@ static void tcache_put_toast_buffer(tcache_toastbuf *tbuf);
 
 static tcache_node *tcache_find_next_node(tcache_head *tc_head,
 										  BlockNumber blkno);
-static tcache_column_store *tcache_find_next_column_store(tcache_head *tc_head,
+static tcache_column_store *tcache_find_next_column_store(tcache_node *tc_root,
 														  BlockNumber blkno);
 //static tcache_node *tcache_find_prev_node(tcache_head *tc_head,
 //										  BlockNumber blkno_cur);
-static tcache_column_store *tcache_find_prev_column_store(tcache_head *tc_head,
+static tcache_column_store *tcache_find_prev_column_store(tcache_node *tc_root,
 														  BlockNumber blkno);
 
 static void tcache_copy_cs_varlena(tcache_column_store *tcs_dst, int base_dst,
@@ -102,6 +129,7 @@ static void tcache_rebalance_tree(tcache_head *tc_head,
 								  tcache_node *tc_node,
 								  tcache_node **p_upper);
 
+static void tcache_enqueue_pending(tcache_head *tc_head);
 static void pgstrom_wakeup_columnizer(bool wakeup_all);
 
 /*
@@ -132,6 +160,9 @@ TCacheHeadLockedByMe(tcache_head *tc_head, bool be_exclusive)
  */
 #define dnode_is_linked(dnode)		(!(dnode)->prev || !(dnode)->next)
 
+#define TCACHE_NODE_DEPTH(tc_node) \
+	(!(tc_node) ? 0 : Max((tc_node)->l_depth, (tc_node)->r_depth))
+
 static inline int
 tcache_hash_index(Oid datoid, Oid reloid)
 {
@@ -279,6 +310,34 @@ bitmapcopy(uint8 *dstmap, int dindex, uint8 *srcmap, int sindex, int nbits)
 	}
 }
 
+/*
+ * tcache_account_usage
+ *
+ * It tracks total amount of shared memory consumed by column-stores.
+ * A dedicated spinlock is used because it may be called under tc_head->lock,
+ * thus we cannot acquire tc_common->lock here.
+ */
+static void
+tcache_account_usage(int64 delta)
+{
+	SpinLockAcquire(&tc_common->usage_lock);
+	Assert(delta >= 0 || tc_common->usage >= (Size)(-delta));
+	tc_common->usage += delta;
+	SpinLockRelease(&tc_common->usage_lock);
+}
+
+static bool
+tcache_usage_exceeds_threshold(void)
+{
+	Size	usage;
+
+	SpinLockAcquire(&tc_common->usage_lock);
+	usage = tc_common->usage;
+	SpinLockRelease(&tc_common->usage_lock);
+
+	return (usage > (pgstrom_shmem_totalsize / 100) * tcache_reclaim_threshold);
+}
+
 
 
 
@@ -287,11 +346,17 @@ bitmapcopy(uint8 *dstmap, int dindex, uint8 *srcmap, int sindex, int nbits)
 
 
 /*
- * 
+ * tcache_create_column_store
  *
+ * It allocates an empty column-store that has arrays of the columns marked
+ * on 'resident'. If NULL is given, columns being referenced recently (thus
+ * col_usage is not zero) become resident.
+ *
+ * NOTE: it may be called under tc_head->lock, so col_usage is referenced
+ * without locks.
  */
 static tcache_column_store *
-tcache_create_column_store(tcache_head *tc_head)
+tcache_create_column_store(tcache_head *tc_head, const bool *resident)
 {
 	Form_pg_attribute attr;
 	tcache_column_store *tcs;
@@ -299,6 +364,9 @@ tcache_create_column_store(tcache_head *tc_head)
 	Size	offset;
 	int		i, j;
 
+#define COLUMN_IS_RESIDENT(cindex)						\
+	(resident ? resident[(cindex)] : tc_head->col_usage[(cindex)] > 0)
+
 	/* estimate length of column store */
 	length = MAXALIGN(offsetof(tcache_column_store, cdata[tc_head->ncols]));
 	length += MAXALIGN(sizeof(ItemPointerData) * NUM_ROWS_PER_COLSTORE);
@@ -310,6 +378,8 @@ tcache_create_column_store(tcache_head *tc_head)
 
 		Assert(j >= 0 && j < tc_head->tupdesc->natts);
 		attr = tc_head->tupdesc->attrs[j];
+		if (!COLUMN_IS_RESIDENT(i))
+			continue;
 		if (!attr->attnotnull)
 			length += MAXALIGN(NUM_ROWS_PER_COLSTORE / BITS_PER_BYTE);
 		length += MAXALIGN((attr->attlen > 0
@@ -327,6 +397,7 @@ tcache_create_column_store(tcache_head *tc_head)
 	SpinLockInit(&tcs->refcnt_lock);
 	tcs->refcnt = 1;
 	tcs->ncols = tc_head->ncols;
+	tcs->length = length;
 
 	offset = MAXALIGN(offsetof(tcache_column_store,
 							   cdata[tcs->ncols]));
@@ -345,6 +416,17 @@ tcache_create_column_store(tcache_head *tc_head)
 
 		Assert(j >= 0 && j < tc_head->tupdesc->natts);
 		attr = tc_head->tupdesc->attrs[j];
+		tcs->cdata[i].toast = NULL;	/* to be set later on demand */
+		tcs->cdata[i].enc_length = 0;
+		tcs->cdata[i].nnulls = 0;
+		tcs->cdata[i].has_range = false;
+		if (!COLUMN_IS_RESIDENT(i))
+		{
+			tcs->cdata[i].isnull = NULL;
+			tcs->cdata[i].values = NULL;
+			tcs->cdata[i].usage = 0;
+			continue;
+		}
 		if (attr->attnotnull)
 			tcs->cdata[i].isnull = NULL;
 		else
@@ -356,22 +438,43 @@ tcache_create_column_store(tcache_head *tc_head)
 		offset += MAXALIGN((attr->attlen > 0
 							? attr->attlen
 							: sizeof(cl_uint)) * NUM_ROWS_PER_COLSTORE);
-		tcs->cdata[i].toast = NULL;	/* to be set later on demand */
+		tcs->cdata[i].usage = 1;
 	}
 	Assert(offset == length);
+#undef COLUMN_IS_RESIDENT
+
+	tcache_account_usage(length);
 
 	return tcs;
 }
 
+/*
+ * tcache_duplicate_column_store
+ *
+ * It makes a raw copy of the supplied column-store. If 'resident' is given,
+ * the copy has arrays of the columns marked on, and the arrays not resident
+ * on the original one are left for the caller to be filled up.
+ */
 static tcache_column_store *
 tcache_duplicate_column_store(tcache_head *tc_head,
 							  tcache_column_store *tcs_old,
+							  const bool *resident,
 							  bool duplicate_toastbuf)
 {
-	tcache_column_store *tcs_new = tcache_create_column_store(tc_head);
+	tcache_column_store *tcs_new;
 	int		nrows = tcs_old->nrows;
 	int		i, j;
 
+	if (!resident)
+	{
+		bool   *temp = alloca(sizeof(bool) * tcs_old->ncols);
+
+		for (i=0; i < tcs_old->ncols; i++)
+			temp[i] = TCACHE_COLUMN_IS_RESIDENT(tcs_old, i);
+		resident = temp;
+	}
+	tcs_new = tcache_create_column_store(tc_head, resident);
+
 	PG_TRY();
 	{
 		memcpy(tcs_new->ctids,
@@ -384,6 +487,10 @@ tcache_duplicate_column_store(tcache_head *tc_head,
 		{
 			Form_pg_attribute	attr;
 
+			if (!TCACHE_COLUMN_IS_RESIDENT(tcs_new, i) ||
+				!TCACHE_COLUMN_IS_RESIDENT(tcs_old, i))
+				continue;
+
 			j = tc_head->i_cached[i];
 			attr = tc_head->tupdesc->attrs[j];
 
@@ -395,29 +502,50 @@ tcache_duplicate_column_store(tcache_head *tc_head,
 					   (nrows + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
 			}
 
-			if (attr->attlen > 0)
+			if (tcs_old->cdata[i].enc_length > 0)
+			{
+				/* duplicated one is always raw column-store */
+				tcache_decode_column_values(tcs_new->cdata[i].values,
+											tcs_old, i, attr->attlen);
+			}
+			else if (attr->attlen > 0)
 			{
 				memcpy(tcs_new->cdata[i].values,
 					   tcs_old->cdata[i].values,
 					   attr->attlen * nrows);
 			}
-			else if (!duplicate_toastbuf)
+			else
 			{
 				memcpy(tcs_new->cdata[i].values,
 					   tcs_old->cdata[i].values,
 					   sizeof(cl_uint) * nrows);
-				tcs_new->cdata[i].toast
-					= tcache_get_toast_buffer(tcs_old->cdata[i].toast);
 			}
-			else
+
+			if (attr->attlen < 0 && tcs_old->cdata[i].toast)
 			{
-				Size	tbuf_length = tcs_old->cdata[i].toast->tbuf_length;
+				if (!duplicate_toastbuf)
+					tcs_new->cdata[i].toast
+						= tcache_get_toast_buffer(tcs_old->cdata[i].toast);
+				else
+				{
+					tcache_toastbuf *tbuf_old = tcs_old->cdata[i].toast;
 
-				tcs_new->cdata[i].toast
-					= tcache_duplicate_toast_buffer(tcs_old->cdata[i].toast,
-													tbuf_length);
+					tcs_new->cdata[i].toast
+						= tcache_duplicate_toast_buffer(tbuf_old,
+														tbuf_old->tbuf_length);
+				}
 			}
+			tcs_new->cdata[i].nnulls = tcs_old->cdata[i].nnulls;
+			tcs_new->cdata[i].has_range = tcs_old->cdata[i].has_range;
+			tcs_new->cdata[i].min_value = tcs_old->cdata[i].min_value;
+			tcs_new->cdata[i].max_value = tcs_old->cdata[i].max_value;
+			tcs_new->cdata[i].usage = tcs_old->cdata[i].usage;
 		}
+		tcs_new->nrows = tcs_old->nrows;
+		tcs_new->njunks = tcs_old->njunks;
+		tcs_new->is_sorted = tcs_old->is_sorted;
+		tcs_new->blkno_max = tcs_old->blkno_max;
+		tcs_new->blkno_min = tcs_old->blkno_min;
 	}
 	PG_CATCH();
 	{
@@ -429,7 +557,7 @@ tcache_duplicate_column_store(tcache_head *tc_head,
 	return tcs_new;
 }
 
-static tcache_column_store *
+tcache_column_store *
 tcache_get_column_store(tcache_column_store *tcs)
 {
 	SpinLockAcquire(&tcs->refcnt_lock);
@@ -440,7 +568,7 @@ tcache_get_column_store(tcache_column_store *tcs)
 	return tcs;
 }
 
-static void
+void
 tcache_put_column_store(tcache_column_store *tcs)
 {
 	bool	do_release = false;
@@ -459,129 +587,947 @@ tcache_put_column_store(tcache_column_store *tcs)
 			if (tcs->cdata[i].toast)
 				tcache_put_toast_buffer(tcs->cdata[i].toast);
 		}
+		tcache_account_usage(-((int64) tcs->length));
 		pgstrom_shmem_free(tcs);
 	}
 }
 
 /*
- * create, duplicate, get and put of toast_buffer
+ * tcache_discard_column_array
+ *
+ * It makes a column array of writable column-store non-resident. Its area
+ * is not released until the column-store itself is released.
  */
-static tcache_toastbuf *
-tcache_create_toast_buffer(Size required)
+static void
+tcache_discard_column_array(tcache_column_store *tcs, int cindex)
 {
-	tcache_toastbuf *tbuf;
-	Size		allocated;
-
-	required = Max(required, TCACHE_TOASTBUF_INITSIZE);
+	Assert(!tcs->is_encoded);
+	if (tcs->cdata[cindex].toast)
+		tcache_put_toast_buffer(tcs->cdata[cindex].toast);
+	tcs->cdata[cindex].toast = NULL;
+	tcs->cdata[cindex].isnull = NULL;
+	tcs->cdata[cindex].values = NULL;
+	tcs->cdata[cindex].nnulls = 0;
+	tcs->cdata[cindex].has_range = false;
+	tcs->cdata[cindex].usage = 0;
+}
 
-	tbuf = pgstrom_shmem_alloc_alap(required, &allocated);
-	if (!tbuf)
-		elog(ERROR, "out of shared memory");
+/*
+ * tcache_zonemap_supported
+ * tcache_zonemap_compare
+ *
+ * Zone map (min/max of each chunk) is maintained for fixed-length and
+ * pass-by-value data types with built-in ordering only, because columnizer
+ * background worker cannot call comparison functions of arbitrary types.
+ */
+bool
+tcache_zonemap_supported(Oid type_oid)
+{
+	switch (type_oid)
+	{
+		case INT2OID:
+		case INT4OID:
+		case OIDOID:
+		case DATEOID:
+		case FLOAT4OID:
+#if SIZEOF_DATUM == 8
+		case INT8OID:
+		case FLOAT8OID:
+#ifdef HAVE_INT64_TIMESTAMP
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+#endif
+#endif
+			return true;
+		default:
+			break;
+	}
+	return false;
+}
 
-	SpinLockInit(&tbuf->refcnt_lock);
-	tbuf->refcnt = 1;
-	tbuf->tbuf_length = allocated;
-	tbuf->tbuf_usage = offsetof(tcache_toastbuf, data[0]);
-	tbuf->tbuf_junk = 0;
+static int
+tcache_zonemap_compare(Oid type_oid, Datum a, Datum b)
+{
+	switch (type_oid)
+	{
+		case INT2OID:
+			return (DatumGetInt16(a) < DatumGetInt16(b) ? -1 :
+					DatumGetInt16(a) > DatumGetInt16(b) ? 1 : 0);
+		case INT4OID:
+		case DATEOID:
+			return (DatumGetInt32(a) < DatumGetInt32(b) ? -1 :
+					DatumGetInt32(a) > DatumGetInt32(b) ? 1 : 0);
+		case OIDOID:
+			return (DatumGetObjectId(a) < DatumGetObjectId(b) ? -1 :
+					DatumGetObjectId(a) > DatumGetObjectId(b) ? 1 : 0);
+		case FLOAT4OID:
+			return float4_cmp_internal(DatumGetFloat4(a), DatumGetFloat4(b));
+#if SIZEOF_DATUM == 8
+		case INT8OID:
+#ifdef HAVE_INT64_TIMESTAMP
+		case TIMEOID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+#endif
+			return (DatumGetInt64(a) < DatumGetInt64(b) ? -1 :
+					DatumGetInt64(a) > DatumGetInt64(b) ? 1 : 0);
+		case FLOAT8OID:
+			return float8_cmp_internal(DatumGetFloat8(a), DatumGetFloat8(b));
+#endif
+		default:
+			elog(ERROR, "zone map is not supported on type %u", type_oid);
+	}
+	return 0;	/* be compiler quiet */
+}
 
-	return tbuf;
+/*
+ * tcache_zonemap_update
+ * tcache_zonemap_rebuild
+ * tcache_zonemap_merge
+ *
+ * maintenance of zone map for a particular column of column-store. update
+ * expands the range by a new value, rebuild re-computes the range from
+ * the records on the column-store, and merge takes union of two ranges.
+ */
+static inline void
+tcache_zonemap_update(tcache_column_store *tcs, int cindex,
+					  Form_pg_attribute attr, Datum value, bool isnull)
+{
+	if (isnull)
+		tcs->cdata[cindex].nnulls++;
+	else if (!tcache_zonemap_supported(attr->atttypid))
+		return;
+	else if (!tcs->cdata[cindex].has_range)
+	{
+		tcs->cdata[cindex].min_value = value;
+		tcs->cdata[cindex].max_value = value;
+		tcs->cdata[cindex].has_range = true;
+	}
+	else
+	{
+		if (tcache_zonemap_compare(attr->atttypid, value,
+								   tcs->cdata[cindex].min_value) < 0)
+			tcs->cdata[cindex].min_value = value;
+		if (tcache_zonemap_compare(attr->atttypid, value,
+								   tcs->cdata[cindex].max_value) > 0)
+			tcs->cdata[cindex].max_value = value;
+	}
 }
 
-static tcache_toastbuf *
-tcache_duplicate_toast_buffer(tcache_toastbuf *tbuf_old, Size required)
+static void
+tcache_zonemap_rebuild(tcache_head *tc_head, tcache_column_store *tcs)
 {
-	tcache_toastbuf *tbuf_new;
+	int		i, j, k;
 
-	Assert(required >= tbuf_old->tbuf_usage);
+	for (i=0; i < tcs->ncols; i++)
+	{
+		Form_pg_attribute attr;
 
-	tbuf_new = tcache_create_toast_buffer(required);
-	memcpy(tbuf_new->data,
-		   tbuf_old->data,
-		   tbuf_old->tbuf_usage - offsetof(tcache_toastbuf, data[0]));
-	tbuf_new->tbuf_usage = tbuf_old->tbuf_usage;
-	tbuf_new->tbuf_junk = tbuf_old->tbuf_junk;
+		j = tc_head->i_cached[i];
+		attr = tc_head->tupdesc->attrs[j];
 
-	return tbuf_new;
+		tcs->cdata[i].nnulls = 0;
+		tcs->cdata[i].has_range = false;
+		if (!TCACHE_COLUMN_IS_RESIDENT(tcs, i))
+			continue;
+		for (k=0; k < tcs->nrows; k++)
+		{
+			bool	isnull = false;
+			Datum	value = 0;
+
+			if (tcs->cdata[i].isnull &&
+				att_isnull(k, tcs->cdata[i].isnull))
+				isnull = true;
+			else if (attr->attlen > 0 && attr->attbyval)
+				value = fetch_att(tcs->cdata[i].values + attr->attlen * k,
+								  true, attr->attlen);
+			else if (!tcs->cdata[i].isnull)
+				break;	/* no zone map and no nulls */
+			tcache_zonemap_update(tcs, i, attr, value, isnull);
+		}
+	}
 }
 
-static tcache_toastbuf *
-tcache_get_toast_buffer(tcache_toastbuf *tbuf)
+static void
+tcache_zonemap_merge(tcache_head *tc_head,
+					 tcache_column_store *tcs_dst,
+					 tcache_column_store *tcs_src)
 {
-	SpinLockAcquire(&tbuf->refcnt_lock);
-	Assert(tbuf->refcnt > 0);
-	tbuf->refcnt++;
-	SpinLockRelease(&tbuf->refcnt_lock);
+	int		i, j;
 
-	return tbuf;
+	for (i=0; i < tcs_dst->ncols; i++)
+	{
+		Form_pg_attribute attr;
+
+		j = tc_head->i_cached[i];
+		attr = tc_head->tupdesc->attrs[j];
+
+		if (!TCACHE_COLUMN_IS_RESIDENT(tcs_dst, i))
+			continue;
+		tcs_dst->cdata[i].nnulls += tcs_src->cdata[i].nnulls;
+		if (tcs_src->cdata[i].has_range)
+		{
+			tcache_zonemap_update(tcs_dst, i, attr,
+								  tcs_src->cdata[i].min_value, false);
+			tcache_zonemap_update(tcs_dst, i, attr,
+								  tcs_src->cdata[i].max_value, false);
+		}
+	}
 }
 
-static void
-tcache_put_toast_buffer(tcache_toastbuf *tbuf)
+/*
+ * tcache_zonemap_mismatch
+ *
+ * It returns true, if no records in the supplied column-store can satisfy
+ * a condition of "<column> <op> <value>", where <op> is a btree operator
+ * of the strategy supplied. So, caller can skip the chunk as a whole.
+ */
+bool
+tcache_zonemap_mismatch(tcache_column_store *tcs, int cindex,
+						Oid type_oid, int strategy, Datum value)
 {
-	bool	do_release = false;
+	int		cmp_min;
+	int		cmp_max;
 
-	SpinLockAcquire(&tbuf->refcnt_lock);
-	Assert(tbuf->refcnt > 0);
-	if (--tbuf->refcnt == 0)
-		do_release = true;
-	SpinLockRelease(&tbuf->refcnt_lock);
+	Assert(cindex >= 0 && cindex < tcs->ncols);
+	if (!tcs->cdata[cindex].has_range)
+	{
+		/* all the values are null, so strict operators never match */
+		return (tcs->nrows > 0 && tcs->cdata[cindex].nnulls == tcs->nrows);
+	}
+	cmp_min = tcache_zonemap_compare(type_oid,
+									 tcs->cdata[cindex].min_value, value);
+	cmp_max = tcache_zonemap_compare(type_oid,
+									 tcs->cdata[cindex].max_value, value);
+	switch (strategy)
+	{
+		case BTLessStrategyNumber:
+			return cmp_min >= 0;
+		case BTLessEqualStrategyNumber:
+			return cmp_min > 0;
+		case BTEqualStrategyNumber:
+			return cmp_min > 0 || cmp_max < 0;
+		case BTGreaterEqualStrategyNumber:
+			return cmp_max < 0;
+		case BTGreaterStrategyNumber:
+			return cmp_max <= 0;
+		default:
+			break;
+	}
+	return false;
+}
 
-	if (do_release)
-		pgstrom_shmem_free(tbuf);
+/*
+ * Lightweight encoding of column-store
+ *
+ * Once a column-store gets sealed; it is filled more than half and is not
+ * the rightmost node where the columnizer usually appends records, it is
+ * replaced by an encoded one whose arrays are sized to its nrows. Each
+ * fixed-length column is encoded with frame-of-reference or run-length
+ * encoding, and each varlena column is encoded with a dictionary on the
+ * deduplicated toast buffer, whichever is smaller than the raw array.
+ * Device code evaluates qualifiers on the encoded arrays as is; see the
+ * kern_colenc in opencl_common.h.
+ * An encoded column-store is never modified except for system columns,
+ * and tcache_duplicate_column_store() always decodes it. So, writers that
+ * make a column-store writable always get a raw one.
+ */
+typedef struct {
+	int			encoding;	/* one of KERN_COLENC_* */
+	Size		length;		/* length of the values array */
+	cl_long		base;		/* base value, if FOR */
+	cl_uint		nbits;		/* width of packed items, if FOR or DICT */
+	cl_uint		nitems;		/* number of runs or dictionary items */
+	cl_uint	   *codes;		/* code of each row, if DICT */
+	cl_uint	   *dict;		/* offset on the source toast buffer, if DICT */
+	Size		toast_usage;	/* usage of deduplicated toast, if DICT */
+	tcache_toastbuf *toast;	/* deduplicated toast buffer, if DICT */
+} tcache_colenc_plan;
+
+typedef struct {
+	cl_uint		offset;		/* offset on the toast buffer */
+	cl_uint		rowidx;		/* index of the row */
+} tcache_colenc_item;
+
+static inline cl_long
+tcache_colenc_getval(char *addr, int attlen)
+{
+	switch (attlen)
+	{
+		case sizeof(cl_char):
+			return *((cl_char *) addr);
+		case sizeof(cl_short):
+			return *((cl_short *) addr);
+		case sizeof(cl_int):
+			return *((cl_int *) addr);
+		case sizeof(cl_long):
+			return *((cl_long *) addr);
+		default:
+			elog(ERROR, "unexpected attlen for column encoding: %d", attlen);
+	}
+	return 0;	/* be compiler quiet */
 }
 
+static inline void
+tcache_colenc_setval(char *addr, int attlen, cl_ulong datum)
+{
+	switch (attlen)
+	{
+		case sizeof(cl_char):
+			*((cl_char *) addr) = (cl_char) datum;
+			break;
+		case sizeof(cl_short):
+			*((cl_short *) addr) = (cl_short) datum;
+			break;
+		case sizeof(cl_int):
+			*((cl_int *) addr) = (cl_int) datum;
+			break;
+		case sizeof(cl_long):
+			*((cl_long *) addr) = (cl_long) datum;
+			break;
+		default:
+			elog(ERROR, "unexpected attlen for column encoding: %d", attlen);
+	}
+}
 
+static inline cl_uint
+tcache_colenc_width(cl_ulong range)
+{
+	cl_uint		nbits = 0;
 
+	while (range != 0)
+	{
+		nbits++;
+		range >>= 1;
+	}
+	return nbits;
+}
 
+static inline void
+tcache_colenc_pack(cl_ulong *words, cl_uint nbits, cl_uint index,
+				   cl_ulong value)
+{
+	cl_ulong	pos = (cl_ulong) nbits * (cl_ulong) index;
+	cl_uint		shift = (cl_uint)(pos & 63);
 
+	if (nbits == 0)
+		return;
+	words[pos >> 6] |= value << shift;
+	if (shift + nbits > 64)
+		words[(pos >> 6) + 1] |= value >> (64 - shift);
+}
 
 /*
- * tcache_create_row_store
- *
- *
- *
+ * tcache_colenc_plan_fixed
  *
+ * It chooses an encoding of fixed-length column; frame-of-reference or
+ * run-length encoding. Null values are never referenced, so they are
+ * packed as zero on FOR, and continue the current run on RLE.
  */
-tcache_row_store *
-tcache_create_row_store(TupleDesc tupdesc, int ncols, AttrNumber *i_cached)
+static void
+tcache_colenc_plan_fixed(tcache_column_store *tcs, int cindex, int attlen,
+						 tcache_colenc_plan *plan)
 {
-	tcache_row_store   *trs;
-	int			i, j;
+	char	   *values = tcs->cdata[cindex].values;
+	uint8	   *nullmap = tcs->cdata[cindex].isnull;
+	cl_long		min_value = 0;
+	cl_long		max_value = 0;
+	cl_long		prev_value = 0;
+	cl_uint		nruns = 0;
+	Size		len_for;
+	Size		len_rle;
+	cl_uint		i;
+
+	plan->encoding = KERN_COLENC_NONE;
+	plan->length = attlen * tcs->nrows;
+	if (attlen != sizeof(cl_char) &&
+		attlen != sizeof(cl_short) &&
+		attlen != sizeof(cl_int) &&
+		attlen != sizeof(cl_long))
+		return;
 
-	trs = pgstrom_shmem_alloc(ROWSTORE_DEFAULT_SIZE);
-	if (!trs)
-		elog(ERROR, "out of shared memory");
+	for (i=0; i < tcs->nrows; i++)
+	{
+		cl_long		value;
 
-	/*
-	 * We put header portion of kern_column_store next to the kern_row_store
-	 * as source of copy for in-kernel column store. It has offset of column
-	 * array, but contents shall be set up by kernel prior to evaluation of
-	 * qualifier expression.
-	 */
-	trs->stag = StromTag_TCacheRowStore;
-	SpinLockInit(&trs->refcnt_lock);
-	trs->refcnt = 1;
-	memset(&trs->chain, 0, sizeof(dlist_node));
-	trs->usage
-		= STROMALIGN_DOWN(ROWSTORE_DEFAULT_SIZE -
-						  STROMALIGN(offsetof(kern_column_store,
-											  colmeta[ncols])) -
-						  offsetof(tcache_row_store, kern));
-	trs->blkno_max = 0;
-	trs->blkno_min = MaxBlockNumber;
-	trs->kern.length = trs->usage;
-	trs->kern.ncols = tupdesc->natts;
-	trs->kern.nrows = 0;
-	trs->kcs_head = (kern_column_store *)
-		((char *)&trs->kern + trs->kern.length);
+		if (nullmap && att_isnull(i, nullmap))
+			continue;
 
-	/* construct colmeta structure */
-	for (i=0, j=0; i < tupdesc->natts; i++)
+		value = tcache_colenc_getval(values + attlen * i, attlen);
+		if (nruns == 0)
+		{
+			min_value = max_value = value;
+			nruns = 1;
+		}
+		else
+		{
+			if (value < min_value)
+				min_value = value;
+			if (value > max_value)
+				max_value = value;
+			if (value != prev_value)
+				nruns++;
+		}
+		prev_value = value;
+	}
+	if (nruns == 0)
+		nruns = 1;	/* all nulls; a run of zero */
+
+	plan->base = min_value;
+	plan->nbits = tcache_colenc_width((cl_ulong) max_value -
+									  (cl_ulong) min_value);
+	plan->nitems = nruns;
+	len_for = (offsetof(kern_colenc, data) +
+			   sizeof(cl_ulong) * KERN_COLENC_NWORDS(plan->nbits,
+													 tcs->nrows));
+	len_rle = (offsetof(kern_colenc, data) +
+			   (sizeof(cl_ulong) + sizeof(cl_uint)) * nruns);
+
+	if (len_rle < len_for && len_rle < plan->length)
 	{
-		Form_pg_attribute attr = tupdesc->attrs[i];
-		kern_colmeta	colmeta;
+		plan->encoding = KERN_COLENC_RLE;
+		plan->length = len_rle;
+	}
+	else if (len_for < plan->length)
+	{
+		plan->encoding = KERN_COLENC_FOR;
+		plan->length = len_for;
+	}
+}
 
-		memset(&colmeta, 0, sizeof(kern_colmeta));
+static void
+tcache_colenc_build_fixed(tcache_column_store *tcs, int cindex, int attlen,
+						  tcache_colenc_plan *plan, kern_colenc *kcenc)
+{
+	char	   *values = tcs->cdata[cindex].values;
+	uint8	   *nullmap = tcs->cdata[cindex].isnull;
+	cl_uint	   *run_end = (cl_uint *)(kcenc->data + plan->nitems);
+	int			k = -1;
+	cl_uint		i;
+
+	memset(kcenc, 0, plan->length);
+	kcenc->encoding = plan->encoding;
+	kcenc->nitems = plan->nitems;
+	kcenc->nbits = plan->nbits;
+	kcenc->base = plan->base;
+
+	for (i=0; i < tcs->nrows; i++)
+	{
+		cl_long		value;
+
+		if (nullmap && att_isnull(i, nullmap))
+			continue;
+
+		value = tcache_colenc_getval(values + attlen * i, attlen);
+		if (plan->encoding == KERN_COLENC_FOR)
+			tcache_colenc_pack(kcenc->data, plan->nbits, i,
+							   (cl_ulong) value - (cl_ulong) plan->base);
+		else if (k < 0 || (cl_long) kcenc->data[k] != value)
+		{
+			/* leading nulls belong to the first run */
+			if (k >= 0)
+				run_end[k] = i;
+			kcenc->data[++k] = (cl_ulong) value;
+		}
+	}
+	if (plan->encoding == KERN_COLENC_RLE)
+	{
+		if (k < 0)
+			kcenc->data[++k] = 0;
+		run_end[k] = tcs->nrows;
+		Assert(k + 1 == plan->nitems);
+	}
+}
+
+static int
+tcache_colenc_item_compare(const void *a, const void *b, void *arg)
+{
+	char	   *tbuf = arg;
+	char	   *vptr_a = tbuf + ((const tcache_colenc_item *) a)->offset;
+	char	   *vptr_b = tbuf + ((const tcache_colenc_item *) b)->offset;
+	Size		vsize_a = VARSIZE_ANY(vptr_a);
+	Size		vsize_b = VARSIZE_ANY(vptr_b);
+
+	if (vsize_a != vsize_b)
+		return (vsize_a < vsize_b ? -1 : 1);
+	return memcmp(vptr_a, vptr_b, vsize_a);
+}
+
+/*
+ * tcache_colenc_plan_varlena
+ *
+ * It tries to build a dictionary of varlena column. Two datum are
+ * identical if they have same binary representation, so it never
+ * calls type specific comparison functions.
+ */
+static void
+tcache_colenc_plan_varlena(tcache_column_store *tcs, int cindex,
+						   tcache_colenc_plan *plan)
+{
+	tcache_toastbuf *tbuf = tcs->cdata[cindex].toast;
+	cl_uint	   *values = (cl_uint *) tcs->cdata[cindex].values;
+	uint8	   *nullmap = tcs->cdata[cindex].isnull;
+	tcache_colenc_item *items;
+	cl_uint		nitems = 0;
+	cl_uint		ndict = 0;
+	Size		length;
+	cl_uint		i;
+
+	plan->encoding = KERN_COLENC_NONE;
+	plan->length = sizeof(cl_uint) * tcs->nrows;
+	if (!tbuf)
+		return;
+
+	items = palloc(sizeof(tcache_colenc_item) * Max(tcs->nrows, 1));
+	for (i=0; i < tcs->nrows; i++)
+	{
+		if (nullmap && att_isnull(i, nullmap))
+			continue;
+		items[nitems].offset = values[i];
+		items[nitems].rowidx = i;
+		nitems++;
+	}
+	qsort_arg(items, nitems, sizeof(tcache_colenc_item),
+			  tcache_colenc_item_compare, tbuf);
+
+	plan->codes = palloc0(sizeof(cl_uint) * Max(tcs->nrows, 1));
+	plan->dict = palloc(sizeof(cl_uint) * Max(nitems, 1));
+	plan->toast_usage = offsetof(tcache_toastbuf, data[0]);
+	for (i=0; i < nitems; i++)
+	{
+		if (i == 0 || tcache_colenc_item_compare(&items[i - 1],
+												 &items[i], tbuf) != 0)
+		{
+			plan->dict[ndict++] = items[i].offset;
+			plan->toast_usage +=
+				MAXALIGN(VARSIZE_ANY((char *)tbuf + items[i].offset));
+		}
+		plan->codes[items[i].rowidx] = ndict - 1;
+	}
+	pfree(items);
+
+	plan->nitems = ndict;
+	plan->nbits = tcache_colenc_width(ndict > 0 ? ndict - 1 : 0);
+	length = (offsetof(kern_colenc, data) +
+			  sizeof(cl_ulong) * ((ndict + 1) / 2) +
+			  sizeof(cl_ulong) * KERN_COLENC_NWORDS(plan->nbits,
+													tcs->nrows));
+	/* dictionary also saves the toast buffer */
+	if (length + plan->toast_usage < plan->length + tbuf->tbuf_usage)
+	{
+		plan->encoding = KERN_COLENC_DICT;
+		plan->length = length;
+	}
+	else
+	{
+		pfree(plan->codes);
+		pfree(plan->dict);
+		plan->codes = NULL;
+		plan->dict = NULL;
+	}
+}
+
+/*
+ * tcache_colenc_alloc_toast
+ *
+ * A deduplicated toast buffer is allocated just enough for the dictionary,
+ * unlike tcache_create_toast_buffer. It is an optimization, so it returns
+ * NULL instead of an error on out of shared memory.
+ */
+static tcache_toastbuf *
+tcache_colenc_alloc_toast(Size required)
+{
+	tcache_toastbuf *tbuf;
+	Size		allocated;
+
+	tbuf = pgstrom_shmem_alloc_alap(required, &allocated);
+	if (!tbuf)
+		return NULL;
+
+	SpinLockInit(&tbuf->refcnt_lock);
+	tbuf->refcnt = 1;
+	tbuf->tbuf_length = allocated;
+	tbuf->tbuf_usage = offsetof(tcache_toastbuf, data[0]);
+	tbuf->tbuf_junk = 0;
+
+	return tbuf;
+}
+
+static void
+tcache_colenc_build_varlena(tcache_column_store *tcs, int cindex,
+							tcache_colenc_plan *plan, kern_colenc *kcenc)
+{
+	tcache_toastbuf *tbuf_src = tcs->cdata[cindex].toast;
+	tcache_toastbuf *tbuf_dst = plan->toast;
+	cl_uint	   *dict = (cl_uint *) kcenc->data;
+	cl_ulong   *codes;
+	cl_uint		i;
+
+	memset(kcenc, 0, plan->length);
+	kcenc->encoding = KERN_COLENC_DICT;
+	kcenc->nitems = plan->nitems;
+	kcenc->nbits = plan->nbits;
+
+	for (i=0; i < plan->nitems; i++)
+	{
+		char   *vptr = (char *)tbuf_src + plan->dict[i];
+		Size	vsize = VARSIZE_ANY(vptr);
+
+		Assert(tbuf_dst->tbuf_usage + MAXALIGN(vsize) <=
+			   tbuf_dst->tbuf_length);
+		memcpy((char *)tbuf_dst + tbuf_dst->tbuf_usage, vptr, vsize);
+		dict[i] = tbuf_dst->tbuf_usage;
+		tbuf_dst->tbuf_usage += MAXALIGN(vsize);
+	}
+
+	codes = KERN_COLENC_DICT_CODES(kcenc);
+	for (i=0; i < tcs->nrows; i++)
+		tcache_colenc_pack(codes, plan->nbits, i, plan->codes[i]);
+}
+
+/*
+ * tcache_encode_column_store
+ *
+ * It makes an encoded copy of the supplied raw column-store. It returns
+ * NULL, if no columns are worth to be encoded or out of shared memory.
+ */
+static tcache_column_store *
+tcache_encode_column_store(tcache_head *tc_head, tcache_column_store *tcs_old)
+{
+	tcache_colenc_plan *plans;
+	tcache_column_store *tcs_new = NULL;
+	cl_uint		nrows = tcs_old->nrows;
+	bool		has_encoding = false;
+	Size		length;
+	Size		offset;
+	int			i, j;
+
+	Assert(!tcs_old->is_encoded);
+
+	plans = palloc0(sizeof(tcache_colenc_plan) * tcs_old->ncols);
+	length = MAXALIGN(offsetof(tcache_column_store, cdata[tcs_old->ncols]));
+	length += MAXALIGN(sizeof(ItemPointerData) * nrows);
+	length += MAXALIGN(sizeof(HeapTupleHeaderData) * nrows);
+	for (i=0; i < tcs_old->ncols; i++)
+	{
+		Form_pg_attribute attr;
+
+		j = tc_head->i_cached[i];
+		attr = tc_head->tupdesc->attrs[j];
+
+		if (!TCACHE_COLUMN_IS_RESIDENT(tcs_old, i))
+			continue;
+		if (tcs_old->cdata[i].isnull)
+			length += MAXALIGN((nrows + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
+		if (attr->attlen > 0)
+			tcache_colenc_plan_fixed(tcs_old, i, attr->attlen, &plans[i]);
+		else
+			tcache_colenc_plan_varlena(tcs_old, i, &plans[i]);
+		if (plans[i].encoding != KERN_COLENC_NONE)
+			has_encoding = true;
+		length += MAXALIGN(plans[i].length);
+	}
+	if (!has_encoding)
+		goto out;
+
+	/* deduplicated toast buffers first */
+	for (i=0; i < tcs_old->ncols; i++)
+	{
+		if (plans[i].encoding != KERN_COLENC_DICT)
+			continue;
+		plans[i].toast = tcache_colenc_alloc_toast(plans[i].toast_usage);
+		if (!plans[i].toast)
+			goto out;
+	}
+
+	tcs_new = pgstrom_shmem_alloc(length);
+	if (!tcs_new)
+		goto out;
+	memset(tcs_new, 0, offsetof(tcache_column_store, cdata[tcs_old->ncols]));
+
+	tcs_new->stag = StromTag_TCacheColumnStore;
+	SpinLockInit(&tcs_new->refcnt_lock);
+	tcs_new->refcnt = 1;
+	tcs_new->ncols = tcs_old->ncols;
+	tcs_new->length = length;
+	tcs_new->nrows = tcs_old->nrows;
+	tcs_new->njunks = tcs_old->njunks;
+	tcs_new->is_sorted = tcs_old->is_sorted;
+	tcs_new->is_encoded = true;
+	tcs_new->blkno_max = tcs_old->blkno_max;
+	tcs_new->blkno_min = tcs_old->blkno_min;
+
+	offset = MAXALIGN(offsetof(tcache_column_store, cdata[tcs_new->ncols]));
+	tcs_new->ctids = (ItemPointerData *)((char *)tcs_new + offset);
+	memcpy(tcs_new->ctids, tcs_old->ctids, sizeof(ItemPointerData) * nrows);
+	offset += MAXALIGN(sizeof(ItemPointerData) * nrows);
+
+	tcs_new->theads = (HeapTupleHeaderData *)((char *)tcs_new + offset);
+	memcpy(tcs_new->theads, tcs_old->theads,
+		   sizeof(HeapTupleHeaderData) * nrows);
+	offset += MAXALIGN(sizeof(HeapTupleHeaderData) * nrows);
+
+	for (i=0; i < tcs_new->ncols; i++)
+	{
+		Form_pg_attribute attr;
+
+		j = tc_head->i_cached[i];
+		attr = tc_head->tupdesc->attrs[j];
+
+		/* non-resident column stays as is; cdata[] is already zeroed */
+		if (!TCACHE_COLUMN_IS_RESIDENT(tcs_old, i))
+			continue;
+
+		if (!tcs_old->cdata[i].isnull)
+			tcs_new->cdata[i].isnull = NULL;
+		else
+		{
+			tcs_new->cdata[i].isnull = (uint8 *)((char *)tcs_new + offset);
+			memcpy(tcs_new->cdata[i].isnull, tcs_old->cdata[i].isnull,
+				   (nrows + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
+			offset += MAXALIGN((nrows + BITS_PER_BYTE - 1) / BITS_PER_BYTE);
+		}
+		tcs_new->cdata[i].values = ((char *)tcs_new + offset);
+
+		if (plans[i].encoding == KERN_COLENC_NONE)
+		{
+			memcpy(tcs_new->cdata[i].values,
+				   tcs_old->cdata[i].values,
+				   plans[i].length);
+			tcs_new->cdata[i].enc_length = 0;
+			if (!tcs_old->cdata[i].toast)
+				tcs_new->cdata[i].toast = NULL;
+			else
+				tcs_new->cdata[i].toast
+					= tcache_get_toast_buffer(tcs_old->cdata[i].toast);
+		}
+		else if (plans[i].encoding == KERN_COLENC_DICT)
+		{
+			tcache_colenc_build_varlena(tcs_old, i, &plans[i],
+										(kern_colenc *)
+										tcs_new->cdata[i].values);
+			tcs_new->cdata[i].enc_length = plans[i].length;
+			tcs_new->cdata[i].toast = plans[i].toast;
+			plans[i].toast = NULL;	/* moved to tcs_new */
+		}
+		else
+		{
+			tcache_colenc_build_fixed(tcs_old, i, attr->attlen, &plans[i],
+									  (kern_colenc *)
+									  tcs_new->cdata[i].values);
+			tcs_new->cdata[i].enc_length = plans[i].length;
+			tcs_new->cdata[i].toast = NULL;
+		}
+		offset += MAXALIGN(plans[i].length);
+
+		tcs_new->cdata[i].nnulls = tcs_old->cdata[i].nnulls;
+		tcs_new->cdata[i].has_range = tcs_old->cdata[i].has_range;
+		tcs_new->cdata[i].min_value = tcs_old->cdata[i].min_value;
+		tcs_new->cdata[i].max_value = tcs_old->cdata[i].max_value;
+		tcs_new->cdata[i].usage = tcs_old->cdata[i].usage;
+	}
+	Assert(offset == length);
+	tcache_account_usage(length);
+
+out:
+	for (i=0; i < tcs_old->ncols; i++)
+	{
+		if (plans[i].toast)
+			tcache_put_toast_buffer(plans[i].toast);
+		if (plans[i].codes)
+			pfree(plans[i].codes);
+		if (plans[i].dict)
+			pfree(plans[i].dict);
+	}
+	pfree(plans);
+
+	return tcs_new;
+}
+
+/*
+ * tcache_decode_column_values
+ *
+ * It decodes an encoded column array into the supplied raw array; null
+ * values are put as zero, as do_insert_tuple() doing.
+ */
+static void
+tcache_decode_column_values(char *dest, tcache_column_store *tcs,
+							int cindex, int attlen)
+{
+	kern_colenc *kcenc = (kern_colenc *) tcs->cdata[cindex].values;
+	uint8	   *nullmap = tcs->cdata[cindex].isnull;
+	int			unitsz = (attlen > 0 ? attlen : sizeof(cl_uint));
+	cl_uint		i;
+
+	Assert(tcs->cdata[cindex].enc_length > 0);
+	for (i=0; i < tcs->nrows; i++)
+	{
+		cl_ulong	datum = 0;
+
+		if (!nullmap || !att_isnull(i, nullmap))
+			datum = kern_colenc_fetch(kcenc, i);
+		tcache_colenc_setval(dest + unitsz * i, unitsz, datum);
+	}
+}
+
+/*
+ * tcache_encode_tcnode_recurse
+ *
+ * It walks down the nodes of the working version, then replaces sealed
+ * column-stores by encoded ones. Nodes of older versions are shared with
+ * the published tree, so they are not touched.
+ */
+static void
+tcache_encode_tcnode_recurse(tcache_head *tc_head, tcache_node *tc_node,
+							 bool is_rightmost)
+{
+	tcache_column_store *tcs_old;
+	tcache_column_store *tcs_new;
+
+	if (!tc_node || tc_node->version != tc_head->cow_version)
+		return;
+
+	tcache_encode_tcnode_recurse(tc_head, tc_node->left, false);
+	tcache_encode_tcnode_recurse(tc_head, tc_node->right, is_rightmost);
+
+	tcs_old = tc_node->tcs;
+	if (tcs_old->is_encoded ||
+		(is_rightmost && !tc_node->right) ||
+		tcs_old->nrows < NUM_ROWS_PER_COLSTORE / 2)
+		return;
+
+	tcs_new = tcache_encode_column_store(tc_head, tcs_old);
+	if (!tcs_new)
+		return;
+
+	SpinLockAcquire(&tc_node->lock);
+	tc_node->tcs = tcs_new;
+	SpinLockRelease(&tc_node->lock);
+	tcache_put_column_store(tcs_old);
+}
+
+/*
+ * create, duplicate, get and put of toast_buffer
+ */
+static tcache_toastbuf *
+tcache_create_toast_buffer(Size required)
+{
+	tcache_toastbuf *tbuf;
+	Size		allocated;
+
+	required = Max(required, TCACHE_TOASTBUF_INITSIZE);
+
+	tbuf = pgstrom_shmem_alloc_alap(required, &allocated);
+	if (!tbuf)
+		elog(ERROR, "out of shared memory");
+
+	SpinLockInit(&tbuf->refcnt_lock);
+	tbuf->refcnt = 1;
+	tbuf->tbuf_length = allocated;
+	tbuf->tbuf_usage = offsetof(tcache_toastbuf, data[0]);
+	tbuf->tbuf_junk = 0;
+
+	return tbuf;
+}
+
+static tcache_toastbuf *
+tcache_duplicate_toast_buffer(tcache_toastbuf *tbuf_old, Size required)
+{
+	tcache_toastbuf *tbuf_new;
+
+	Assert(required >= tbuf_old->tbuf_usage);
+
+	tbuf_new = tcache_create_toast_buffer(required);
+	memcpy(tbuf_new->data,
+		   tbuf_old->data,
+		   tbuf_old->tbuf_usage - offsetof(tcache_toastbuf, data[0]));
+	tbuf_new->tbuf_usage = tbuf_old->tbuf_usage;
+	tbuf_new->tbuf_junk = tbuf_old->tbuf_junk;
+
+	return tbuf_new;
+}
+
+static tcache_toastbuf *
+tcache_get_toast_buffer(tcache_toastbuf *tbuf)
+{
+	SpinLockAcquire(&tbuf->refcnt_lock);
+	Assert(tbuf->refcnt > 0);
+	tbuf->refcnt++;
+	SpinLockRelease(&tbuf->refcnt_lock);
+
+	return tbuf;
+}
+
+static void
+tcache_put_toast_buffer(tcache_toastbuf *tbuf)
+{
+	bool	do_release = false;
+
+	SpinLockAcquire(&tbuf->refcnt_lock);
+	Assert(tbuf->refcnt > 0);
+	if (--tbuf->refcnt == 0)
+		do_release = true;
+	SpinLockRelease(&tbuf->refcnt_lock);
+
+	if (do_release)
+		pgstrom_shmem_free(tbuf);
+}
+
+
+
+
+
+
+/*
+ * tcache_create_row_store
+ *
+ *
+ *
+ *
+ */
+tcache_row_store *
+tcache_create_row_store(TupleDesc tupdesc, int ncols, AttrNumber *i_cached)
+{
+	tcache_row_store   *trs;
+	int			i, j;
+
+	trs = pgstrom_shmem_alloc(ROWSTORE_DEFAULT_SIZE);
+	if (!trs)
+		elog(ERROR, "out of shared memory");
+
+	/*
+	 * We put header portion of kern_column_store next to the kern_row_store
+	 * as source of copy for in-kernel column store. It has offset of column
+	 * array, but contents shall be set up by kernel prior to evaluation of
+	 * qualifier expression.
+	 */
+	trs->stag = StromTag_TCacheRowStore;
+	SpinLockInit(&trs->refcnt_lock);
+	trs->refcnt = 1;
+	memset(&trs->chain, 0, sizeof(dlist_node));
+	trs->usage
+		= STROMALIGN_DOWN(ROWSTORE_DEFAULT_SIZE -
+						  STROMALIGN(offsetof(kern_column_store,
+											  colmeta[ncols])) -
+						  offsetof(tcache_row_store, kern));
+	trs->blkno_max = 0;
+	trs->blkno_min = MaxBlockNumber;
+	trs->is_claimed = false;
+	trs->nvacuumed = 0;
+	trs->kern.length = trs->usage;
+	trs->kern.ncols = tupdesc->natts;
+	trs->kern.nrows = 0;
+	trs->kcs_head = (kern_column_store *)
+		((char *)&trs->kern + trs->kern.length);
+
+	/* construct colmeta structure */
+	for (i=0, j=0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = tupdesc->attrs[i];
+		kern_colmeta	colmeta;
+
+		memset(&colmeta, 0, sizeof(kern_colmeta));
 		if (i == i_cached[j])
 			colmeta.flags |= KERN_COLMETA_ATTREFERENCED;
 		if (attr->attnotnull)
@@ -648,10 +1594,12 @@ tcache_put_row_store(tcache_row_store *trs)
 /*
  * tcache_alloc_tcnode
  *
- * allocate a tcache_node according to the supplied tcache_head
+ * allocate a tcache_node according to the supplied tcache_head. A new node
+ * belongs to the working version of writer, and has an empty column-store
+ * if 'with_tcs' is true.
  */
 static tcache_node *
-tcache_alloc_tcnode(tcache_head *tc_head)
+tcache_alloc_tcnode(tcache_head *tc_head, bool with_tcs)
 {
 	dlist_node	   *dnode;
 	tcache_node	   *tc_node = NULL;
@@ -675,12 +1623,13 @@ tcache_alloc_tcnode(tcache_head *tc_head)
 		}
 		dnode = dlist_pop_head_node(&tc_head->free_list);
 		tc_node = dlist_container(tcache_node, chain, dnode);
-		memset(&tc_node, 0, sizeof(tcache_node));
+		memset(tc_node, 0, sizeof(tcache_node));
 
+		tc_node->version = tc_head->cow_version;
 		SpinLockInit(&tc_node->lock);
-		tc_node->tcs = tcache_create_column_store(tc_head);
-		if (!tc_node->tcs)
-			elog(ERROR, "out of shared memory");
+		tc_node->refcnt = 1;
+		if (with_tcs)
+			tc_node->tcs = tcache_create_column_store(tc_head, NULL);
 	}
 	PG_CATCH();
 	{
@@ -712,29 +1661,207 @@ tcache_free_node_nolock(tcache_head *tc_head, tcache_node *tc_node)
 	dlist_push_head(&tc_head->free_list, &tc_node->chain);
 }
 
+/*
+ * tcache_get_tcnode / tcache_put_tcnode
+ *
+ * get and put reference to a tcache_node. Once reference counter reached
+ * zero, it also puts references to its children, then the node is moved
+ * to the free list. Caller must not hold tc_head->lock on put.
+ */
+static tcache_node *
+tcache_get_tcnode(tcache_node *tc_node)
+{
+	SpinLockAcquire(&tc_node->lock);
+	Assert(tc_node->refcnt > 0);
+	tc_node->refcnt++;
+	SpinLockRelease(&tc_node->lock);
+
+	return tc_node;
+}
+
 static void
-tcache_free_node_recurse(tcache_head *tc_head, tcache_node *tc_node)
+tcache_put_tcnode(tcache_head *tc_head, tcache_node *tc_node)
+{
+	bool	do_release = false;
+
+	SpinLockAcquire(&tc_node->lock);
+	Assert(tc_node->refcnt > 0);
+	if (--tc_node->refcnt == 0)
+		do_release = true;
+	SpinLockRelease(&tc_node->lock);
+
+	if (do_release)
+	{
+		if (tc_node->right)
+			tcache_put_tcnode(tc_head, tc_node->right);
+		if (tc_node->left)
+			tcache_put_tcnode(tc_head, tc_node->left);
+
+		SpinLockAcquire(&tc_head->lock);
+		tcache_free_node_nolock(tc_head, tc_node);
+		SpinLockRelease(&tc_head->lock);
+	}
+}
+
+/*
+ * tcache_cow_tcnode
+ *
+ * It makes a node pointed by *p_node writable on the working version.
+ * If it is a node already published, a copy of the node that shares
+ * the children and column-store of the original one replaces *p_node,
+ * and the reference of *p_node to the original one is released. Any
+ * node and pointers being modified by writer have to come from here.
+ *
+ * NOTE: caller must hold exclusive lwlock on tc_head.
+ */
+static tcache_node *
+tcache_cow_tcnode(tcache_head *tc_head, tcache_node **p_node)
 {
-	/* NOTE: caller must be responsible to hold tc_head->lock */
+	tcache_node	   *tc_old = *p_node;
+	tcache_node	   *tc_new;
 
-	if (tc_node->right)
-		tcache_free_node_recurse(tc_head, tc_node->right);
-	if (tc_node->left)
-		tcache_free_node_recurse(tc_head, tc_node->left);
-	tcache_free_node_nolock(tc_head, tc_node);
+	Assert(TCacheHeadLockedByMe(tc_head, true));
+	if (tc_old->version == tc_head->cow_version)
+		return tc_old;
+
+	tc_new = tcache_alloc_tcnode(tc_head, false);
+	tc_new->tv = tc_old->tv;
+	if (tc_old->right)
+		tc_new->right = tcache_get_tcnode(tc_old->right);
+	if (tc_old->left)
+		tc_new->left = tcache_get_tcnode(tc_old->left);
+	tc_new->r_depth = tc_old->r_depth;
+	tc_new->l_depth = tc_old->l_depth;
+
+	SpinLockAcquire(&tc_old->lock);
+	tc_new->tcs = tcache_get_column_store(tc_old->tcs);
+	SpinLockRelease(&tc_old->lock);
+
+	*p_node = tc_new;
+	tcache_put_tcnode(tc_head, tc_old);
+
+	return tc_new;
 }
 
-#if 0
+/*
+ * tcache_cow_column_store
+ *
+ * It makes the column-store of a node on the working version writable.
+ * If someone else (older version or scans) still references the column-
+ * store, or it is encoded, we replace it by a duplicated one. Toast
+ * buffers are shared, because writer only appends varlena datum on them.
+ *
+ * NOTE: caller must hold exclusive lwlock on tc_head.
+ */
+static tcache_column_store *
+tcache_cow_column_store(tcache_head *tc_head, tcache_node *tc_node)
+{
+	tcache_column_store *tcs_old = tc_node->tcs;
+	tcache_column_store *tcs_new;
+	bool		is_shared;
+
+	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(tc_node->version == tc_head->cow_version);
+
+	SpinLockAcquire(&tcs_old->refcnt_lock);
+	is_shared = (tcs_old->refcnt > 1);
+	SpinLockRelease(&tcs_old->refcnt_lock);
+	if (!is_shared && !tcs_old->is_encoded)
+		return tcs_old;
+
+	tcs_new = tcache_duplicate_column_store(tc_head, tcs_old, NULL, false);
+	SpinLockAcquire(&tc_node->lock);
+	tc_node->tcs = tcs_new;
+	SpinLockRelease(&tc_node->lock);
+	tcache_put_column_store(tcs_old);
+
+	return tcs_new;
+}
+
+/*
+ * tcache_cow_begin / tcache_cow_publish / tcache_cow_abort
+ *
+ * A writer starts a working version that references the latest version,
+ * then modifies it using copy-on-write. Once it gets completed, the working
+ * version replaces the latest version, with detach of the row-store that
+ * was columnized, if any. It is done within a same critical section, so
+ * scans always pin a consistent pair of column- and row-stores.
+ *
+ * NOTE: caller must hold exclusive lwlock on tc_head.
+ */
 static void
-tcache_free_node(tcache_head *tc_head, tcache_node *tc_node)
+tcache_cow_begin(tcache_head *tc_head)
+{
+	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(!tc_head->cow_root);
 
+	/* tcs_root is never replaced without exclusive lwlock */
+	tc_head->cow_root = tcache_get_tcnode(tc_head->tcs_root);
+	tc_head->cow_version = tc_head->tcs_version + 1;
+}
 
+static void
+tcache_cow_publish(tcache_head *tc_head, tcache_row_store *trs_done)
 {
+	tcache_node	   *tc_old;
+
+	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(tc_head->cow_root != NULL);
+
+	/* seal the column-stores being filled, prior to publish */
+	if (tcache_compression)
+		tcache_encode_tcnode_recurse(tc_head, tc_head->cow_root, true);
+
 	SpinLockAcquire(&tc_head->lock);
-	tcache_free_node_nolock(tc_head, tc_node);
+	tc_old = tc_head->tcs_root;
+	tc_head->tcs_root = tc_head->cow_root;
+	tc_head->tcs_version = tc_head->cow_version;
+	if (trs_done)
+	{
+		dlist_delete(&trs_done->chain);
+		memset(&trs_done->chain, 0, sizeof(dlist_node));
+	}
 	SpinLockRelease(&tc_head->lock);
+	tc_head->cow_root = NULL;
+
+	/* older version shall be released when nobody pins it */
+	tcache_put_tcnode(tc_head, tc_old);
+}
+
+static void
+tcache_cow_abort(tcache_head *tc_head)
+{
+	Assert(TCacheHeadLockedByMe(tc_head, true));
+
+	if (tc_head->cow_root)
+		tcache_put_tcnode(tc_head, tc_head->cow_root);
+	tc_head->cow_root = NULL;
+}
+
+/*
+ * tcache_cow_find_tcnode
+ *
+ * It walks down the working version to the node that covers the supplied
+ * block number, with copy-on-write of the nodes on the path.
+ */
+static tcache_node *
+tcache_cow_find_tcnode(tcache_head *tc_head, tcache_node **p_node,
+					   BlockNumber blkno)
+{
+	tcache_node	   *tc_node;
+
+	while (*p_node)
+	{
+		tc_node = tcache_cow_tcnode(tc_head, p_node);
+		if (blkno < tc_node->tcs->blkno_min)
+			p_node = &tc_node->left;
+		else if (blkno > tc_node->tcs->blkno_max)
+			p_node = &tc_node->right;
+		else
+			return tc_node;
+	}
+	return NULL;
 }
-#endif
 
 /*
  * tcache_find_next_record
@@ -865,6 +1992,7 @@ tcache_find_next_internal(tcache_node *tc_node, BlockNumber blkno_cur,
 static tcache_node *
 tcache_find_next_node(tcache_head *tc_head, BlockNumber blkno)
 {
+	/* lwlock prevents the latest version to be replaced */
 	Assert(TCacheHeadLockedByMe(tc_head, false));
 	if (!tc_head->tcs_root)
 		return NULL;
@@ -872,12 +2000,11 @@ tcache_find_next_node(tcache_head *tc_head, BlockNumber blkno)
 }
 
 static tcache_column_store *
-tcache_find_next_column_store(tcache_head *tc_head, BlockNumber blkno)
+tcache_find_next_column_store(tcache_node *tc_root, BlockNumber blkno)
 {
-	Assert(TCacheHeadLockedByMe(tc_head, false));
-	if (!tc_head->tcs_root)
+	if (!tc_root)
 		return NULL;
-	return tcache_find_next_internal(tc_head->tcs_root, blkno, true);
+	return tcache_find_next_internal(tc_root, blkno, true);
 }
 
 /*
@@ -961,12 +2088,11 @@ tcache_find_prev_node(tcache_head *tc_head, BlockNumber blkno)
 #endif
 
 static tcache_column_store *
-tcache_find_prev_column_store(tcache_head *tc_head, BlockNumber blkno)
+tcache_find_prev_column_store(tcache_node *tc_root, BlockNumber blkno)
 {
-	Assert(TCacheHeadLockedByMe(tc_head, false));
-	if (!tc_head->tcs_root)
+	if (!tc_root)
 		return NULL;
-	return tcache_find_prev_internal(tc_head->tcs_root, blkno, true);
+	return tcache_find_prev_internal(tc_root, blkno, true);
 }
 
 /*
@@ -1011,6 +2137,8 @@ tcache_sort_tcnode_internal(tcache_head *tc_head, tcache_node *tc_node,
 				j = tc_head->i_cached[i];
 				attr = tc_head->tupdesc->attrs[j];
 
+				if (!TCACHE_COLUMN_IS_RESIDENT(tcs, i))
+					continue;
 				attlen = (attr->attlen > 0
 						  ? attr->attlen
 						  : sizeof(cl_uint));
@@ -1038,14 +2166,18 @@ tcache_sort_tcnode(tcache_head *tc_head, tcache_node *tc_node, bool is_inplace)
 	tcache_column_store *tcs_new;
 
 	if (is_inplace)
+	{
+		Assert(!tc_node->tcs->is_encoded);
 		tcs_new = tc_node->tcs;
+	}
 	else
 	{
 		/*
 		 * even if duplication mode, sort does not move varlena data on
 		 * the toast buffer. So, we just reuse existing toast buffer,
 		 */
-		tcs_new = tcache_duplicate_column_store(tc_head, tc_node->tcs, false);
+		tcs_new = tcache_duplicate_column_store(tc_head, tc_node->tcs,
+												 NULL, false);
 		tcache_put_column_store(tc_node->tcs);
 		tc_node->tcs = tcs_new;
 	}
@@ -1083,11 +2215,18 @@ tcache_copy_cs_varlena(tcache_column_store *tcs_dst, int base_dst,
 		{
 			vptr = (char *)tbuf_src + src_ofs[base_src + i];
 			vsize = VARSIZE(vptr);
-			if (tbuf_dst->tbuf_usage + MAXALIGN(vsize) < tbuf_dst->tbuf_length)
+			if (!tbuf_dst)
+			{
+				tbuf_dst = tcache_create_toast_buffer(tbuf_src->tbuf_length);
+				tcs_dst->cdata[attidx].toast = tbuf_dst;
+			}
+			else if (tbuf_dst->tbuf_usage +
+					 MAXALIGN(vsize) >= tbuf_dst->tbuf_length)
 			{
 				tcs_dst->cdata[attidx].toast
 					= tcache_duplicate_toast_buffer(tbuf_dst,
 													2 * tbuf_dst->tbuf_length);
+				tcache_put_toast_buffer(tbuf_dst);
 				tbuf_dst = tcs_dst->cdata[attidx].toast;
 			}
 			memcpy((char *)tbuf_dst + tbuf_dst->tbuf_usage,
@@ -1107,6 +2246,8 @@ tcache_copy_cs_varlena(tcache_column_store *tcs_dst, int base_dst,
 /*
  * tcache_compaction_tcnode
  *
+ * It replaces the column-store of a node on the working version by new one
+ * without junk records. The older column-store is just dereferenced.
  *
  * NOTE: caller must hold exclusive lwlock on tc_head.
  */
@@ -1115,14 +2256,25 @@ tcache_compaction_tcnode(tcache_head *tc_head, tcache_node *tc_node)
 {
 	tcache_column_store	*tcs_new;
 	tcache_column_store *tcs_old = tc_node->tcs;
+	bool	   *resident;
+	int			i;
 
 	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(tc_node->version == tc_head->cow_version);
 
-	tcs_new = tcache_create_column_store(tc_head);
+	/* encoded column-store has to be decoded first */
+	if (tcs_old->is_encoded)
+		tcs_old = tcache_cow_column_store(tc_head, tc_node);
+
+	/* compacted one has same column arrays */
+	resident = alloca(sizeof(bool) * tcs_old->ncols);
+	for (i=0; i < tcs_old->ncols; i++)
+		resident[i] = TCACHE_COLUMN_IS_RESIDENT(tcs_old, i);
+	tcs_new = tcache_create_column_store(tc_head, resident);
 	PG_TRY();
 	{
 		Size	required;
-		int		i, j, k;
+		int		j, k;
 
 		/* assign a toast buffer first */
 		for (i=0; i < tcs_old->ncols; i++)
@@ -1176,6 +2328,8 @@ tcache_compaction_tcnode(tcache_head *tc_head, tcache_node *tc_node)
 				int		l = tc_head->i_cached[k];
 				int		attlen = tc_head->tupdesc->attrs[l]->attlen;
 
+				if (!TCACHE_COLUMN_IS_RESIDENT(tcs_old, k))
+					continue;
 				/* nullmap */
 				if (tcs_old->cdata[k].isnull)
 					bitmapcopy(tcs_new->cdata[k].isnull, j,
@@ -1196,11 +2350,16 @@ tcache_compaction_tcnode(tcache_head *tc_head, tcache_node *tc_node)
 		tcs_new->nrows = j;
 		tcs_new->njunks = 0;
 		tcs_new->is_sorted = tcs_old->is_sorted;
+		for (k=0; k < tcs_old->ncols; k++)
+			tcs_new->cdata[k].usage = tcs_old->cdata[k].usage;
+		tcache_zonemap_rebuild(tc_head, tcs_new);
 
 		Assert(tcs_old->nrows - tcs_old->njunks == tcs_new->nrows);
 
 		/* ok, replace it */
+		SpinLockAcquire(&tc_node->lock);
 		tc_node->tcs = tcs_new;
+		SpinLockRelease(&tc_node->lock);
 		tcache_put_column_store(tcs_old);
 
 		/*
@@ -1218,8 +2377,10 @@ tcache_compaction_tcnode(tcache_head *tc_head, tcache_node *tc_node)
 /*
  * tcache_try_merge_tcnode
  *
- *
- *
+ * It tries to merge a small node into neighbor node. Remember the tree is
+ * versioned; all the nodes being modified are copied on the working version
+ * using tcache_cow_tcnode() during the walk, and the node to be removed is
+ * just dereferenced, because older version may still reference it.
  */
 static bool
 do_try_merge_tcnode(tcache_head *tc_head,
@@ -1232,72 +2393,125 @@ do_try_merge_tcnode(tcache_head *tc_head,
 		 tc_child->tcs->nrows)  < ((2 * NUM_ROWS_PER_COLSTORE) / 3))
 	{
 		tcache_column_store *tcs_src = tc_child->tcs;
-		tcache_column_store *tcs_dst = tc_parent->tcs;
-		int		base = tcs_dst->nrows;
+		tcache_column_store *tcs_dst;
+		int		base;
 		int		nmoved = tcs_src->nrows;
 		int		i, j;
 
-		memcpy(tcs_dst->ctids + base,
-			   tcs_src->ctids,
-			   sizeof(ItemPointerData) * nmoved);
-		memcpy(tcs_dst->theads + base,
-			   tcs_src->theads,
-			   sizeof(HeapTupleHeaderData) * nmoved);
-		for (i=0; i < tc_head->ncols; i++)
+		tcs_dst = tcache_cow_column_store(tc_head, tc_parent);
+		base = tcs_dst->nrows;
+
+		/* rows on the encoded column-store are moved from decoded one */
+		if (tcs_src->is_encoded)
+			tcs_src = tcache_duplicate_column_store(tc_head, tcs_src,
+													NULL, false);
+		else
+			tcs_src = tcache_get_column_store(tcs_src);
+
+		PG_TRY();
 		{
-			Form_pg_attribute	attr;
+			memcpy(tcs_dst->ctids + base,
+				   tcs_src->ctids,
+				   sizeof(ItemPointerData) * nmoved);
+			memcpy(tcs_dst->theads + base,
+				   tcs_src->theads,
+				   sizeof(HeapTupleHeaderData) * nmoved);
+			for (i=0; i < tc_head->ncols; i++)
+			{
+				Form_pg_attribute	attr;
 
-			j = tc_head->i_cached[i];
-			attr = tc_head->tupdesc->attrs[j];
+				j = tc_head->i_cached[i];
+				attr = tc_head->tupdesc->attrs[j];
 
-			/* move nullmap */
-			if (!attr->attnotnull)
-				bitmapcopy(tcs_dst->cdata[i].isnull, base,
-						   tcs_src->cdata[i].isnull, 0,
-						   nmoved);
+				/* merged one has the columns resident on both */
+				if (!TCACHE_COLUMN_IS_RESIDENT(tcs_dst, i))
+					continue;
+				if (!TCACHE_COLUMN_IS_RESIDENT(tcs_src, i))
+				{
+					tcache_discard_column_array(tcs_dst, i);
+					continue;
+				}
 
-			if (attr->attlen > 0)
-			{
-				memcpy(tcs_dst->cdata[i].values + attr->attlen * base,
-					   tcs_src->cdata[i].values,
-					   attr->attlen * nmoved);
-			}
-			else
-			{
-				tcache_copy_cs_varlena(tcs_dst, base,
-									   tcs_src, 0,
-									   i, nmoved);
+				/* move nullmap */
+				if (!attr->attnotnull)
+					bitmapcopy(tcs_dst->cdata[i].isnull, base,
+							   tcs_src->cdata[i].isnull, 0,
+							   nmoved);
+
+				if (attr->attlen > 0)
+				{
+					memcpy(tcs_dst->cdata[i].values + attr->attlen * base,
+						   tcs_src->cdata[i].values,
+						   attr->attlen * nmoved);
+				}
+				else
+				{
+					tcache_copy_cs_varlena(tcs_dst, base,
+										   tcs_src, 0,
+										   i, nmoved);
+				}
 			}
+			tcache_zonemap_merge(tc_head, tcs_dst, tcs_src);
+			tcs_dst->nrows	+= tcs_src->nrows;
+			tcs_dst->njunks	+= tcs_src->njunks;
+			/* XXX - caller should set is_sorted */
+			tcs_dst->blkno_max = Max(tcs_dst->blkno_max, tcs_src->blkno_max);
+			tcs_dst->blkno_min = Min(tcs_dst->blkno_min, tcs_src->blkno_min);
 		}
-		tcs_dst->nrows	+= tcs_src->nrows;
-		tcs_dst->njunks	+= tcs_src->njunks;
-		/* XXX - caller should set is_sorted */
-		tcs_dst->blkno_max = Max(tcs_dst->blkno_max, tcs_src->blkno_max);
-		tcs_dst->blkno_min = Max(tcs_dst->blkno_min, tcs_src->blkno_min);
+		PG_CATCH();
+		{
+			tcache_put_column_store(tcs_src);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+		tcache_put_column_store(tcs_src);
 
 		return true;
 	}
 	return false;
 }
 
+/*
+ * tcache_unlink_tcnode
+ *
+ * It replaces *p_upper (that has at most one child) by its child, then
+ * releases the reference to the node being unlinked.
+ */
+static void
+tcache_unlink_tcnode(tcache_head *tc_head, tcache_node **p_upper)
+{
+	tcache_node	   *tc_node = *p_upper;
+	tcache_node	   *tc_child;
+
+	Assert(!tc_node->left || !tc_node->right);
+	tc_child = (tc_node->left ? tc_node->left : tc_node->right);
+	*p_upper = (!tc_child ? NULL : tcache_get_tcnode(tc_child));
+	tcache_put_tcnode(tc_head, tc_node);
+}
+
 static bool
 tcache_try_merge_left_recurse(tcache_head *tc_head,
 							  tcache_node *tc_node,
 							  tcache_node *target)
 {
+	Assert(tc_node->version == tc_head->cow_version);
+
 	if (!tc_node->left)
 		return true;	/* first left-open node; that is merginable */
-	else if (tcache_try_merge_left_recurse(tc_head, tc_node->left, target))
+	else if (tcache_try_merge_left_recurse(tc_head,
+										   tcache_cow_tcnode(tc_head,
+															 &tc_node->left),
+										   target))
 	{
+		bool	is_sorted = (target->tcs->is_sorted &&
+							 tc_node->left->tcs->is_sorted);
+
 		if (do_try_merge_tcnode(tc_head, target, tc_node->left))
 		{
-			tcache_node	*child = tc_node->left;
-
-			Assert(!child->left);
-			tc_node->left = child->right;
-			tc_node->l_depth = child->r_depth + 1;
-			tc_node->tcs->is_sorted = false;
-			tcache_free_node_nolock(tc_head, child);
+			Assert(!tc_node->left->left);
+			target->tcs->is_sorted = is_sorted;
+			tcache_unlink_tcnode(tc_head, &tc_node->left);
+			tc_node->l_depth = TCACHE_NODE_DEPTH(tc_node->left);
 		}
 	}
 	return false;
@@ -1308,20 +2522,21 @@ tcache_try_merge_right_recurse(tcache_head *tc_head,
 							   tcache_node *tc_node,
 							   tcache_node *target)
 {
+	Assert(tc_node->version == tc_head->cow_version);
+
 	if (!tc_node->right)
 		return true;	/* first right-open node; that is merginable */
-	else if (tcache_try_merge_left_recurse(tc_head, tc_node->right, target))
+	else if (tcache_try_merge_right_recurse(tc_head,
+											tcache_cow_tcnode(tc_head,
+															  &tc_node->right),
+											target))
 	{
 		if (do_try_merge_tcnode(tc_head, target, tc_node->right))
 		{
-			tcache_node	*child = tc_node->right;
-
-			Assert(!child->right);
-			tc_node->right = child->left;
-			tc_node->r_depth = child->l_depth + 1;
-			if (tc_node->tcs->is_sorted)
-				tc_node->tcs->is_sorted = child->tcs->is_sorted;
-			tcache_free_node_nolock(tc_head, child);
+			Assert(!tc_node->right->right);
+			target->tcs->is_sorted = false;
+			tcache_unlink_tcnode(tc_head, &tc_node->right);
+			tc_node->r_depth = TCACHE_NODE_DEPTH(tc_node->right);
 		}
 	}
 	return false;
@@ -1329,13 +2544,15 @@ tcache_try_merge_right_recurse(tcache_head *tc_head,
 
 static void
 tcache_try_merge_recurse(tcache_head *tc_head,
-						 tcache_node *tc_node,
 						 tcache_node **p_upper,
 						 tcache_node *l_candidate,
 						 tcache_node *r_candidate,
-						 tcache_node *target)
+						 BlockNumber blkno_min,
+						 BlockNumber blkno_max)
 {
-	if (tc_node->tcs->blkno_min > target->tcs->blkno_max)
+	tcache_node	   *tc_node = tcache_cow_tcnode(tc_head, p_upper);
+
+	if (tc_node->tcs->blkno_min > blkno_max)
 	{
 		/*
 		 * NOTE: target's block-number is less than this node, so
@@ -1345,8 +2562,9 @@ tcache_try_merge_recurse(tcache_head *tc_head,
 		 */
 		Assert(tc_node->left != NULL);
 		l_candidate = tc_node;	/* Last node that goes down left branch */
-		tcache_try_merge_recurse(tc_head, tc_node->left, &tc_node->left,
-								 l_candidate, r_candidate, target);
+		tcache_try_merge_recurse(tc_head, &tc_node->left,
+								 l_candidate, r_candidate,
+								 blkno_min, blkno_max);
 		if (!tc_node->left)
 			tc_node->l_depth = 0;
 		else
@@ -1356,7 +2574,7 @@ tcache_try_merge_recurse(tcache_head *tc_head,
 			tcache_rebalance_tree(tc_head, tc_node->left, &tc_node->left);
 		}
 	}
-	else if (tc_node->tcs->blkno_max < target->tcs->blkno_min)
+	else if (tc_node->tcs->blkno_max < blkno_min)
 	{
 		/*
 		 * NOTE: target's block-number is greater than this node,
@@ -1366,8 +2584,9 @@ tcache_try_merge_recurse(tcache_head *tc_head,
 		 */
 		Assert(tc_node->right != NULL);
 		r_candidate = tc_node;	/* Last node that goes down right branch */
-		tcache_try_merge_recurse(tc_head, tc_node->right, &tc_node->right,
-								 l_candidate, r_candidate, target);
+		tcache_try_merge_recurse(tc_head, &tc_node->right,
+								 l_candidate, r_candidate,
+								 blkno_min, blkno_max);
 		if (!tc_node->right)
 			tc_node->r_depth = 0;
 		else
@@ -1379,13 +2598,21 @@ tcache_try_merge_recurse(tcache_head *tc_head,
 	}
 	else
 	{
-		Assert(tc_node == target);
+		/* this node is the working copy of the target */
+		tcache_node	   *target = tc_node;
+
 		/* try to merge with the least greater node */
 		if (tc_node->right)
-			tcache_try_merge_left_recurse(tc_head, tc_node->right, target);
+			tcache_try_merge_left_recurse(tc_head,
+										  tcache_cow_tcnode(tc_head,
+															&tc_node->right),
+										  target);
 		/* try to merge with the greatest less node */
 		if (tc_node->left)
-			tcache_try_merge_right_recurse(tc_head, tc_node->left, target);
+			tcache_try_merge_right_recurse(tc_head,
+										   tcache_cow_tcnode(tc_head,
+															 &tc_node->left),
+										   target);
 
 		if (!tc_node->right && l_candidate &&
 			do_try_merge_tcnode(tc_head, l_candidate, tc_node))
@@ -1394,8 +2621,8 @@ tcache_try_merge_recurse(tcache_head *tc_head,
 			 * try to merge with the last upper node that goes down left-
 			 * branch, if target is right-open node.
 			 */
-			*p_upper = tc_node->left;
-			tcache_free_node_nolock(tc_head, tc_node);			
+			l_candidate->tcs->is_sorted = false;
+			tcache_unlink_tcnode(tc_head, p_upper);
 		}
 		else if (!tc_node->left && r_candidate &&
 				 do_try_merge_tcnode(tc_head, r_candidate, tc_node))
@@ -1404,8 +2631,9 @@ tcache_try_merge_recurse(tcache_head *tc_head,
 			 * try to merge with the last upper node that goes down right-
 			 * branch, if target is left-open node.
 			 */
-			*p_upper = tc_node->right;
-			tcache_free_node_nolock(tc_head, tc_node);
+			if (r_candidate->tcs->is_sorted)
+				r_candidate->tcs->is_sorted = tc_node->tcs->is_sorted;
+			tcache_unlink_tcnode(tc_head, p_upper);
 		}
 	}
 }
@@ -1414,20 +2642,24 @@ static void
 tcache_try_merge_tcnode(tcache_head *tc_head, tcache_node *tc_node)
 {
 	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(tc_head->cow_root != NULL);
 
 	/*
 	 * NOTE: no need to walk on the tree if target contains obviously
-	 * large enough number of records not to be merginable
+	 * large enough number of records not to be merginable.
+	 * The supplied node may be a node of older version, so we identify
+	 * the target on the working version by its block range.
 	 */
 	if (tc_node->tcs->nrows < NUM_ROWS_PER_COLSTORE / 2)
 	{
 		tcache_try_merge_recurse(tc_head,
-								 tc_head->tcs_root,
-								 &tc_head->tcs_root,
+								 &tc_head->cow_root,
 								 NULL,
 								 NULL,
-								 tc_node);
-		tcache_rebalance_tree(tc_head, tc_head->tcs_root, &tc_head->tcs_root);
+								 tc_node->tcs->blkno_min,
+								 tc_node->tcs->blkno_max);
+		tcache_rebalance_tree(tc_head, tc_head->cow_root,
+							  &tc_head->cow_root);
 	}
 }
 
@@ -1435,7 +2667,8 @@ tcache_try_merge_tcnode(tcache_head *tc_head, tcache_node *tc_node)
  * tcache_split_tcnode
  *
  * It creates a new tcache_node and move the largest one block of the records;
- * including varlena datum.
+ * including varlena datum. Both of the nodes belong to the working version,
+ * so scans on the published version never see the half-split state.
  *
  * NOTE: caller must hold exclusive lwlock on tc_head.
  */
@@ -1443,26 +2676,34 @@ static void
 tcache_split_tcnode(tcache_head *tc_head, tcache_node *tc_node_old)
 {
 	tcache_node *tc_node_new;
-    tcache_column_store *tcs_new;
-    tcache_column_store *tcs_old = tc_node_old->tcs;
+	tcache_column_store *tcs_new;
+	tcache_column_store *tcs_old;
 
 	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(tc_node_old->version == tc_head->cow_version);
 
-	tc_node_new = tcache_alloc_tcnode(tc_head);
-	tcs_new = tc_node_new->tcs;
+	tcs_old = tcache_cow_column_store(tc_head, tc_node_old);
+	tc_node_new = tcache_alloc_tcnode(tc_head, false);
 	PG_TRY();
 	{
 		Form_pg_attribute attr;
+		bool   *resident = alloca(sizeof(bool) * tcs_old->ncols);
 		int		nremain;
 		int		nmoved;
 		int		i, j;
 
+		/* larger half has same columns resident */
+		for (i=0; i < tcs_old->ncols; i++)
+			resident[i] = TCACHE_COLUMN_IS_RESIDENT(tcs_old, i);
+		tcs_new = tcache_create_column_store(tc_head, resident);
+		tc_node_new->tcs = tcs_new;
+
 		/* assign toast buffers first */
 		for (i=0; i < tcs_old->ncols; i++)
 		{
 			Size	required;
 
-			if (!tcs_old->cdata[i].toast)
+			if (!resident[i] || !tcs_old->cdata[i].toast)
 				continue;
 
 			required = tcs_old->cdata[i].toast->tbuf_length;
@@ -1471,8 +2712,8 @@ tcache_split_tcnode(tcache_head *tc_head, tcache_node *tc_node_old)
 
 		/*
 		 * We have to sort this column-store first, if not yet.
-		 * We assume this routine is called under the exclusive lock,
-		 * so in-place sorting is safe.
+		 * Column-store of the working version is private, so in-place
+		 * sorting is safe.
 		 */
 		if (!tcs_old->is_sorted)
 			tcache_sort_tcnode(tc_head, tc_node_old, true);
@@ -1518,6 +2759,9 @@ tcache_split_tcnode(tcache_head *tc_head, tcache_node *tc_node_old)
 			j = tc_head->i_cached[i];
 			attr = tc_head->tupdesc->attrs[j];
 
+			if (!resident[i])
+				continue;
+
 			/* nullmap */
 			if (!attr->attnotnull)
 			{
@@ -1548,6 +2792,7 @@ tcache_split_tcnode(tcache_head *tc_head, tcache_node *tc_node_old)
 		tcs_new->blkno_max
 			= ItemPointerGetBlockNumber(&tcs_new->ctids[nmoved - 1]);
 		Assert(tcs_new->blkno_min == tcs_new->blkno_max);
+		tcache_zonemap_rebuild(tc_head, tcs_new);
 
 		/*
 		 * OK, tc_node_new is ready to chain as larger half of
@@ -1564,7 +2809,7 @@ tcache_split_tcnode(tcache_head *tc_head, tcache_node *tc_node_old)
 	}
 	PG_CATCH();
 	{
-		tcache_free_node_nolock(tc_head, tc_node_new);
+		tcache_put_tcnode(tc_head, tc_node_new);
 		PG_RE_THROW();
 	}
 	PG_END_TRY();
@@ -1586,21 +2831,22 @@ tcache_split_tcnode(tcache_head *tc_head, tcache_node *tc_node_old)
  * tcache_rebalance_tree
  *
  * It rebalances the t-tree structure if supplied 'tc_node' was not
- * a balanced tree.
+ * a balanced tree. Nodes to be rotated are copied on the working version.
  */
-#define TCACHE_NODE_DEPTH(tc_node) \
-	(!(tc_node) ? 0 : Max((tc_node)->l_depth, (tc_node)->r_depth))
-
 static void
 tcache_rebalance_tree(tcache_head *tc_head, tcache_node *tc_node,
 					  tcache_node **p_upper)
 {
 	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(*p_upper == tc_node);
 
 	if (tc_node->l_depth + 1 < tc_node->r_depth)
 	{
 		/* anticlockwise rotation */
-		tcache_node *r_node = tc_node->right;
+		tcache_node *r_node;
+
+		tc_node = tcache_cow_tcnode(tc_head, p_upper);
+		r_node = tcache_cow_tcnode(tc_head, &tc_node->right);
 
 		tc_node->right = r_node->left;
 		r_node->left = tc_node;
@@ -1613,7 +2859,10 @@ tcache_rebalance_tree(tcache_head *tc_head, tcache_node *tc_node,
 	else if (tc_node->l_depth > tc_node->r_depth + 1)
 	{
 		/* clockwise rotation */
-		tcache_node	*l_node = tc_node->left;
+		tcache_node	*l_node;
+
+		tc_node = tcache_cow_tcnode(tc_head, p_upper);
+		l_node = tcache_cow_tcnode(tc_head, &tc_node->left);
 
 		tc_node->left = l_node->right;
 		l_node->right = tc_node;
@@ -1672,9 +2921,9 @@ static void
 tcache_insert_tuple_row(tcache_head *tc_head, HeapTuple tuple)
 {
 	tcache_row_store *trs = NULL;
+	bool		has_pending = false;
 
-	/* shared lwlock is sufficient to insert */
-	Assert(TCacheHeadLockedByMe(tc_head, false));
+	/* row-store is protected by tc_head->lock, no lwlock is needed */
 	SpinLockAcquire(&tc_head->lock);
 	PG_TRY();
 	{
@@ -1698,7 +2947,7 @@ tcache_insert_tuple_row(tcache_head *tc_head, HeapTuple tuple)
 			dlist_push_head(&tc_head->trs_list, &trs->chain);
 			tcache_put_row_store(trs);
 			tc_head->trs_curr = trs = NULL;
-			pgstrom_wakeup_columnizer(false);
+			has_pending = true;
 			goto retry;
 		}
 	}
@@ -1709,6 +2958,10 @@ tcache_insert_tuple_row(tcache_head *tc_head, HeapTuple tuple)
 	}
 	PG_END_TRY();
 	SpinLockRelease(&tc_head->lock);
+
+	/* tc_common->lock has to be acquired prior to tc_head->lock */
+	if (has_pending)
+		tcache_enqueue_pending(tc_head);
 }
 
 /*
@@ -1748,7 +3001,11 @@ tcache_update_tuple_hints(tcache_head *tc_head, HeapTuple tuple)
 	tcache_node	   *tc_node;
 	bool			hit_on_tcs = false;
 
-	Assert(TCacheHeadLockedByMe(tc_head, false));
+	/*
+	 * Hint updates are applied on the latest version in-place, so shared
+	 * lwlock prevents columnizer to copy the stores being updated.
+	 */
+	LWLockAcquire(&tc_head->lwlock, LW_SHARED);
 
 	tc_node = tcache_find_next_node(tc_head, blkno);
 	if (tc_node)
@@ -1793,26 +3050,116 @@ tcache_update_tuple_hints(tcache_head *tc_head, HeapTuple tuple)
 	out:		
 		SpinLockRelease(&tc_head->lock);
 	}
+	LWLockRelease(&tc_head->lwlock);
 }
 
+
 /*
- * tcache_insert_tuple
- *
- *
- *
+ * tcache_put_datum_tcs
  *
+ * It puts a datum on the 'rowidx'-th slot of the column array. Caller has
+ * to ensure the column is resident on the supplied column-store.
+ */
+static void
+tcache_put_datum_tcs(tcache_column_store *tcs, int cindex, int rowidx,
+					 Form_pg_attribute attr, Datum value, bool isnull)
+{
+	Assert(TCACHE_COLUMN_IS_RESIDENT(tcs, cindex));
+
+	/*
+	 * null-bitmap follows the convention of kern_column_store; a bit
+	 * is set if the value is valid, so it can be sent to the device
+	 * as is.
+	 */
+	if (tcs->cdata[cindex].isnull)
+	{
+		uint8  *nullmap = tcs->cdata[cindex].isnull;
+		int		bit = (1 << (rowidx % BITS_PER_BYTE));
+
+		if (isnull)
+			nullmap[rowidx / BITS_PER_BYTE] &= ~bit;
+		else
+			nullmap[rowidx / BITS_PER_BYTE] |= bit;
+	}
+	if (isnull)
+	{
+		/* null value is never referenced, so just put a zero */
+		if (attr->attlen > 0)
+			memset(tcs->cdata[cindex].values + attr->attlen * rowidx,
+				   0, attr->attlen);
+		else
+			((cl_uint *)tcs->cdata[cindex].values)[rowidx] = 0;
+	}
+	else if (attr->attlen > 0)
+	{
+		/* fixed-length variable is simple to put */
+		memcopy(tcs->cdata[cindex].values + attr->attlen * rowidx,
+				&value,
+				attr->attlen);
+	}
+	else
+	{
+		/*
+		 * varlena datum shall be copied into toast-buffer once,
+		 * and its offset (from the head of toast-buffer) shall be
+		 * put on the values array.
+		 */
+		tcache_toastbuf	*tbuf = tcs->cdata[cindex].toast;
+		Size		vsize = VARSIZE_ANY(value);
+
+		if (!tbuf)
+		{
+			tbuf = tcache_create_toast_buffer(MAXALIGN(vsize) +
+								offsetof(tcache_toastbuf, data[0]));
+			tcs->cdata[cindex].toast = tbuf;
+		}
+		else if (tbuf->tbuf_usage + MAXALIGN(vsize) >= tbuf->tbuf_length)
+		{
+			tcache_toastbuf	*tbuf_new;
+
+			/*
+			 * Needs to expand toast-buffer if no more room exist
+			 * to store new varlenas. Usually, twice amount of
+			 * toast buffer is best choice for buddy allocator.
+			 */
+			tbuf_new = tcache_create_toast_buffer(2 * tbuf->tbuf_length);
+			memcpy(tbuf_new->data,
+				   tbuf->data,
+				   tbuf->tbuf_usage - offsetof(tcache_toastbuf, data[0]));
+			tbuf_new->tbuf_usage = tbuf->tbuf_usage;
+			tbuf_new->tbuf_junk = tbuf->tbuf_junk;
+
+			/* replace older buffer by new (larger) one */
+			tcache_put_toast_buffer(tbuf);
+			tcs->cdata[cindex].toast = tbuf = tbuf_new;
+		}
+		Assert(tbuf->tbuf_usage + MAXALIGN(vsize) < tbuf->tbuf_length);
+
+		((cl_uint *)tcs->cdata[cindex].values)[rowidx] = tbuf->tbuf_usage;
+		memcpy((char *)tbuf + tbuf->tbuf_usage,
+			   DatumGetPointer(value),
+			   vsize);
+		tbuf->tbuf_usage += MAXALIGN(vsize);
+	}
+}
+
+/*
+ * tcache_put_tuple_tcs
  *
+ * It appends a tuple on the tail of the supplied column-store. Caller has
+ * to ensure the column-store is writable; either a store on the working
+ * version or a private one not linked to the tree yet.
  */
 static void
-do_insert_tuple(tcache_head *tc_head, tcache_node *tc_node, HeapTuple tuple)
+tcache_put_tuple_tcs(tcache_head *tc_head, tcache_column_store *tcs,
+					 HeapTuple tuple)
 {
-	tcache_column_store *tcs = tc_node->tcs;
 	TupleDesc	tupdesc = tc_head->tupdesc;
 	Datum	   *values = alloca(sizeof(Datum) * tupdesc->natts);
 	bool	   *isnull = alloca(sizeof(bool) * tupdesc->natts);
 	int			i, j;
 
-	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(!tcs->is_encoded);
 	Assert(tcs->nrows < NUM_ROWS_PER_COLSTORE);
 	Assert(tcs->nrows == 0 ||
 		   (ItemPointerGetBlockNumber(&tuple->t_self) >= tcs->blkno_min &&
@@ -1830,54 +3177,14 @@ do_insert_tuple(tcache_head *tc_head, tcache_node *tc_node, HeapTuple tuple)
 		Form_pg_attribute	attr;
 
 		j = tc_head->i_cached[i];
-		Assert(j >= 0 && j < tupdesc->natts);
-		attr = tupdesc->attrs[j];
-
-		if (attr->attlen > 0)
-		{
-			/* fixed-length variable is simple to put */
-			memcopy(tcs->cdata[i].values + attr->attlen * tcs->nrows,
-					&values[j],
-					attr->attlen);
-		}
-		else
-		{
-			/*
-			 * varlena datum shall be copied into toast-buffer once,
-			 * and its offset (from the head of toast-buffer) shall be
-			 * put on the values array.
-			 */
-			tcache_toastbuf	*tbuf = tcs->cdata[i].toast;
-			Size		vsize = VARSIZE_ANY(values[j]);
-
-			if (tbuf->tbuf_usage + MAXALIGN(vsize) < tbuf->tbuf_length)
-			{
-				tcache_toastbuf	*tbuf_new;
-
-				/*
-				 * Needs to expand toast-buffer if no more room exist
-				 * to store new varlenas. Usually, twice amount of
-				 * toast buffer is best choice for buddy allocator.
-				 */
-				tbuf_new = tcache_create_toast_buffer(2 * tbuf->tbuf_length);
-				memcpy(tbuf_new->data,
-					   tbuf->data,
-					   tbuf->tbuf_usage - offsetof(tcache_toastbuf, data[0]));
-				tbuf_new->tbuf_usage = tbuf->tbuf_usage;
-				tbuf_new->tbuf_junk = tbuf->tbuf_junk;
-
-				/* replace older buffer by new (larger) one */
-				tcache_put_toast_buffer(tbuf);
-				tcs->cdata[i].toast = tbuf = tbuf_new;
-			}
-			Assert(tbuf->tbuf_usage + MAXALIGN(vsize) < tbuf->tbuf_length);
+		Assert(j >= 0 && j < tupdesc->natts);
+		attr = tupdesc->attrs[j];
 
-			((cl_uint *)tcs->cdata[i].values)[tcs->nrows] = tbuf->tbuf_usage;
-			memcpy((char *)tbuf + tbuf->tbuf_usage,
-				   DatumGetPointer(values[j]),
-				   vsize);
-			tbuf->tbuf_usage += MAXALIGN(vsize);
-		}
+		/* non-resident column shall be loaded later on demand */
+		if (!TCACHE_COLUMN_IS_RESIDENT(tcs, i))
+			continue;
+		tcache_zonemap_update(tcs, i, attr, values[j], isnull[j]);
+		tcache_put_datum_tcs(tcs, i, tcs->nrows, attr, values[j], isnull[j]);
 	}
 
 	/*
@@ -1918,16 +3225,36 @@ do_insert_tuple(tcache_head *tc_head, tcache_node *tc_node, HeapTuple tuple)
 	tcs->nrows++;
 }
 
+/*
+ * tcache_insert_tuple
+ *
+ *
+ *
+ *
+ *
+ */
+static void
+do_insert_tuple(tcache_head *tc_head, tcache_node *tc_node, HeapTuple tuple)
+{
+	tcache_column_store *tcs = tcache_cow_column_store(tc_head, tc_node);
+
+	Assert(TCacheHeadLockedByMe(tc_head, true));
+	tcache_put_tuple_tcs(tc_head, tcs, tuple);
+}
+
 static void
 tcache_insert_tuple(tcache_head *tc_head,
-					tcache_node *tc_node,
+					tcache_node **p_node,
 					HeapTuple tuple)
 {
-	tcache_column_store *tcs = tc_node->tcs;
+	tcache_node	   *tc_node = tcache_cow_tcnode(tc_head, p_node);
+	tcache_column_store *tcs;
 	BlockNumber		blkno_cur = ItemPointerGetBlockNumber(&tuple->t_self);
 
 	Assert(TCacheHeadLockedByMe(tc_head, true));
 
+retry:
+	tcs = tc_node->tcs;
 	if (tcs->nrows == 0)
 	{
 		do_insert_tuple(tc_head, tc_node, tuple);
@@ -1935,7 +3262,6 @@ tcache_insert_tuple(tcache_head *tc_head,
 		return;
 	}
 
-retry:
 	if (blkno_cur < tcs->blkno_min)
 	{
 		if (!tc_node->left && tcs->nrows < NUM_ROWS_PER_COLSTORE)
@@ -1944,10 +3270,12 @@ retry:
 		{
 			if (!tc_node->left)
 			{
-				tc_node->left = tcache_alloc_tcnode(tc_head);
+				tc_node->left = tcache_alloc_tcnode(tc_head, true);
 				tc_node->l_depth = 1;
 			}
-			do_insert_tuple(tc_head, tc_node->left, tuple);
+			do_insert_tuple(tc_head,
+							tcache_cow_tcnode(tc_head, &tc_node->left),
+							tuple);
 			tc_node->l_depth = TCACHE_NODE_DEPTH(tc_node->left);
 			tcache_rebalance_tree(tc_head, tc_node->left, &tc_node->left);
 		}
@@ -1960,10 +3288,12 @@ retry:
 		{
 			if (!tc_node->right)
 			{
-				tc_node->right = tcache_alloc_tcnode(tc_head);
+				tc_node->right = tcache_alloc_tcnode(tc_head, true);
 				tc_node->r_depth = 1;
 			}
-			do_insert_tuple(tc_head, tc_node->right, tuple);
+			do_insert_tuple(tc_head,
+							tcache_cow_tcnode(tc_head, &tc_node->right),
+							tuple);
 			tc_node->r_depth = TCACHE_NODE_DEPTH(tc_node->right);
 			tcache_rebalance_tree(tc_head, tc_node->right, &tc_node->right);
 		}
@@ -1986,247 +3316,905 @@ retry:
 }
 
 /*
- * tcache_build_main
+ * tcache_stitch_tcnode
+ *
+ * It links a sorted column-store, built privately, on the working version
+ * as a whole. It is only possible when its block range does not overlap
+ * with any nodes on the tree; it returns false elsewhere, then caller has
+ * to insert the tuples one by one.
+ */
+static bool
+tcache_stitch_tcnode(tcache_head *tc_head, tcache_node **p_node,
+					 tcache_column_store *tcs)
+{
+	tcache_node	   *tc_node = tcache_cow_tcnode(tc_head, p_node);
+	tcache_column_store *tcs_cur = tc_node->tcs;
+	bool			result;
+
+	Assert(TCacheHeadLockedByMe(tc_head, true));
+	Assert(tcs->is_sorted && tcs->nrows > 0);
+
+	if (tcs_cur->nrows == 0 && !tc_node->left && !tc_node->right)
+	{
+		/* tree is empty, so the supplied one replaces the empty store */
+		SpinLockAcquire(&tc_node->lock);
+		tc_node->tcs = tcache_get_column_store(tcs);
+		SpinLockRelease(&tc_node->lock);
+		tcache_put_column_store(tcs_cur);
+		return true;
+	}
+
+	if (tcs->blkno_max < tcs_cur->blkno_min)
+	{
+		if (!tc_node->left)
+		{
+			tc_node->left = tcache_alloc_tcnode(tc_head, false);
+			tc_node->left->tcs = tcache_get_column_store(tcs);
+			result = true;
+		}
+		else
+			result = tcache_stitch_tcnode(tc_head, &tc_node->left, tcs);
+		tc_node->l_depth = TCACHE_NODE_DEPTH(tc_node->left) + 1;
+	}
+	else if (tcs->blkno_min > tcs_cur->blkno_max)
+	{
+		if (!tc_node->right)
+		{
+			tc_node->right = tcache_alloc_tcnode(tc_head, false);
+			tc_node->right->tcs = tcache_get_column_store(tcs);
+			result = true;
+		}
+		else
+			result = tcache_stitch_tcnode(tc_head, &tc_node->right, tcs);
+		tc_node->r_depth = TCACHE_NODE_DEPTH(tc_node->right) + 1;
+	}
+	else
+		return false;	/* block range overlaps */
+
+	tcache_rebalance_tree(tc_head, tc_node, p_node);
+
+	return result;
+}
+
+/*
+ * tcache_build_attach / tcache_build_detach
+ *
+ * A backend that scans the relation under construction attaches a build
+ * slot of tcache_head, then loads ranges of blocks being claimed. Slots
+ * owned by this backend are also tracked on tcache_build_entries, because
+ * the slot has to be detached on transaction abort. A range being loaded
+ * by an aborted loader is kept on the slot, then the next loader that
+ * attaches the slot will load it again.
+ * Once all the ranges are loaded and all the loaders are detached, the
+ * tcache_head becomes ready.
+ */
+static void
+tcache_build_try_finish_nolock(tcache_head *tc_head)
+{
+	int		i;
+
+	if (tc_head->state != TCACHE_STATE_NOW_BUILD ||
+		tc_head->build_next < tc_head->build_nblocks)
+		return;
+
+	for (i=0; i < TCACHE_BUILD_NLOADERS; i++)
+	{
+		if (tc_head->build_slot[i].owned ||
+			BlockNumberIsValid(tc_head->build_slot[i].blkno))
+			return;
+	}
+	tc_head->state = TCACHE_STATE_READY;
+}
+
+/*
+ * tcache_build_log_trim_nolock / tcache_build_log_release
+ *
+ * The build_log keeps references to the row-stores loaded by the build,
+ * only until every scan walking on the log passes them. Entries prior to
+ * the cursors of all the scans are detached from the log under the lock,
+ * then released out of the lock, so columnizers can free the row-stores
+ * once columnized. If no scans walk on the log, all the entries are
+ * released, and scans that begin later wait for completion of the build.
+ */
+static void
+tcache_build_log_trim_nolock(tcache_head *tc_head, dlist_head *trimmed)
+{
+	cl_uint		cursor_min = tc_head->build_log_tail;
+	int			i;
+
+	for (i=0; i < TCACHE_BUILD_NSCANS; i++)
+	{
+		if (tc_head->build_cursor[i] != TCACHE_BUILD_NO_CURSOR)
+			cursor_min = Min(cursor_min, tc_head->build_cursor[i]);
+	}
+
+	while (!dlist_is_empty(&tc_head->build_log))
+	{
+		dlist_node	   *dnode = dlist_head_node(&tc_head->build_log);
+		tcache_row_store *trs
+			= dlist_container(tcache_row_store, build_chain, dnode);
+
+		if (trs->build_seq >= cursor_min)
+			break;
+		dlist_delete(&trs->build_chain);
+		dlist_push_tail(trimmed, &trs->build_chain);
+	}
+	tc_head->build_log_head = Max(tc_head->build_log_head, cursor_min);
+}
+
+static void
+tcache_build_log_release(dlist_head *trimmed)
+{
+	dlist_mutable_iter iter;
+
+	dlist_foreach_modify(iter, trimmed)
+	{
+		tcache_row_store *trs
+			= dlist_container(tcache_row_store, build_chain, iter.cur);
+
+		dlist_delete(&trs->build_chain);
+		tcache_put_row_store(trs);
+	}
+}
+
+static tcache_build_entry *
+tcache_build_attach(tcache_head *tc_head)
+{
+	tcache_build_entry *entry;
+	MemoryContext	oldcxt;
+	int				slot = -1;
+	int				i;
+
+	/* registered prior to attach, so no error happen once attached */
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	entry = palloc(sizeof(tcache_build_entry));
+	entry->tc_head = tc_head;
+	entry->slot = -1;
+	tcache_build_entries = lappend(tcache_build_entries, entry);
+	MemoryContextSwitchTo(oldcxt);
+
+	SpinLockAcquire(&tc_head->lock);
+	if (tc_head->state == TCACHE_STATE_NOW_BUILD)
+	{
+		/* range abandoned by aborted loaders shall be loaded first */
+		for (i=0; i < TCACHE_BUILD_NLOADERS; i++)
+		{
+			if (!tc_head->build_slot[i].owned &&
+				BlockNumberIsValid(tc_head->build_slot[i].blkno))
+			{
+				slot = i;
+				break;
+			}
+		}
+		if (slot < 0 && tc_head->build_next < tc_head->build_nblocks)
+		{
+			for (i=0; i < TCACHE_BUILD_NLOADERS; i++)
+			{
+				if (!tc_head->build_slot[i].owned)
+				{
+					slot = i;
+					break;
+				}
+			}
+		}
+		if (slot >= 0)
+			tc_head->build_slot[slot].owned = true;
+		else
+			tcache_build_try_finish_nolock(tc_head);
+	}
+	SpinLockRelease(&tc_head->lock);
+
+	if (slot < 0)
+	{
+		tcache_build_entries = list_delete_ptr(tcache_build_entries, entry);
+		pfree(entry);
+		return NULL;
+	}
+	entry->slot = slot;
+	return entry;
+}
+
+static void
+tcache_build_detach(tcache_build_entry *entry)
+{
+	tcache_head	   *tc_head = entry->tc_head;
+
+	if (entry->slot >= 0)
+	{
+		SpinLockAcquire(&tc_head->lock);
+		Assert(tc_head->build_slot[entry->slot].owned);
+		tc_head->build_slot[entry->slot].owned = false;
+		tcache_build_try_finish_nolock(tc_head);
+		SpinLockRelease(&tc_head->lock);
+	}
+	tcache_build_entries = list_delete_ptr(tcache_build_entries, entry);
+	pfree(entry);
+}
+
+/*
+ * tcache_build_claim
+ *
+ * It returns the head of the next range to be loaded by the supplied slot,
+ * or InvalidBlockNumber if no more ranges to be claimed.
+ */
+static BlockNumber
+tcache_build_claim(tcache_build_entry *entry)
+{
+	tcache_head	   *tc_head = entry->tc_head;
+	BlockNumber		blkno;
+
+	SpinLockAcquire(&tc_head->lock);
+	Assert(tc_head->build_slot[entry->slot].owned);
+	blkno = tc_head->build_slot[entry->slot].blkno;
+	if (!BlockNumberIsValid(blkno) &&
+		tc_head->build_next < tc_head->build_nblocks)
+	{
+		blkno = tc_head->build_next;
+		tc_head->build_next += TCACHE_BUILD_NBLOCKS;
+		tc_head->build_slot[entry->slot].blkno = blkno;
+	}
+	SpinLockRelease(&tc_head->lock);
+
+	return blkno;
+}
+
+/* upper limit of row-store usage to load a block */
+#define TCACHE_BUILD_PAGE_ROOM									\
+	(BLCKSZ + MaxHeapTuplesPerPage * (MAXALIGN(sizeof(HeapTupleData)) +	\
+									  MAXIMUM_ALIGNOF + sizeof(cl_uint)))
+
+/*
+ * tcache_build_load_range
+ *
+ * It loads all the tuples in a range of blocks onto private row-stores,
+ * then moves them to the trs_list at once, for columnizers, and appends
+ * them to the build_log, for the scans under the build. Scans never pick
+ * up any tuples of the range until it gets published, so the range can
+ * be loaded again if this loader gets aborted.
+ *
+ * NOTE: page pruning between the load and move of row-stores is not
+ * reflected on them, but it only keeps dead tuples being invisible.
+ */
+static void
+tcache_build_load_range(tcache_build_entry *entry, Relation rel,
+						BlockNumber blkno_start)
+{
+	tcache_head	   *tc_head = entry->tc_head;
+	BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+	BlockNumber		blkno_end;
+	BlockNumber		blkno;
+	tcache_row_store *trs = NULL;
+	dlist_head		trs_local;
+	dlist_head		trimmed;
+	dlist_mutable_iter iter;
+	bool			has_pending;
+
+	blkno_end = Min(blkno_start + TCACHE_BUILD_NBLOCKS,
+					tc_head->build_nblocks);
+	dlist_init(&trs_local);
+	PG_TRY();
+	{
+		for (blkno = blkno_start; blkno < blkno_end; blkno++)
+		{
+			Buffer			buffer;
+			Page			page;
+			OffsetNumber	offnum;
+			OffsetNumber	maxoff;
+			HeapTupleData	tuple;
+
+			CHECK_FOR_INTERRUPTS();
+
+			/*
+			 * A block is never split into two row-stores, to keep block
+			 * ranges of the column-stores being disjoint.
+			 */
+			if (trs)
+			{
+				cl_uint	   *tupoffset = kern_rowstore_get_offset(&trs->kern);
+				Size		usage_head;
+
+				usage_head = ((uintptr_t)&tupoffset[trs->kern.nrows] -
+							  (uintptr_t)&trs->kern);
+				if (usage_head + TCACHE_BUILD_PAGE_ROOM > trs->usage)
+					trs = NULL;
+			}
+
+			buffer = ReadBufferExtended(rel, MAIN_FORKNUM, blkno,
+										RBM_NORMAL, strategy);
+			LockBuffer(buffer, BUFFER_LOCK_SHARE);
+			page = BufferGetPage(buffer);
+			maxoff = PageGetMaxOffsetNumber(page);
+			for (offnum = FirstOffsetNumber;
+				 offnum <= maxoff;
+				 offnum = OffsetNumberNext(offnum))
+			{
+				ItemId	itemid = PageGetItemId(page, offnum);
+
+				if (!ItemIdIsNormal(itemid))
+					continue;
+
+				tuple.t_data = (HeapTupleHeader) PageGetItem(page, itemid);
+				tuple.t_len = ItemIdGetLength(itemid);
+				tuple.t_tableOid = RelationGetRelid(rel);
+				ItemPointerSet(&tuple.t_self, blkno, offnum);
+
+				if (!trs || !tcache_row_store_insert_tuple(trs, &tuple))
+				{
+					trs = tcache_create_row_store(tc_head->tupdesc,
+												  tc_head->ncols,
+												  tc_head->i_cached);
+					dlist_push_tail(&trs_local, &trs->chain);
+					if (!tcache_row_store_insert_tuple(trs, &tuple))
+						elog(ERROR, "too large tuple to be cached");
+				}
+			}
+			UnlockReleaseBuffer(buffer);
+		}
+	}
+	PG_CATCH();
+	{
+		dlist_foreach_modify(iter, &trs_local)
+		{
+			trs = dlist_container(tcache_row_store, chain, iter.cur);
+			dlist_delete(&trs->chain);
+			tcache_put_row_store(trs);
+		}
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	FreeAccessStrategy(strategy);
+
+	has_pending = !dlist_is_empty(&trs_local);
+	dlist_init(&trimmed);
+	SpinLockAcquire(&tc_head->lock);
+	dlist_foreach_modify(iter, &trs_local)
+	{
+		trs = dlist_container(tcache_row_store, chain, iter.cur);
+		dlist_delete(&trs->chain);
+		dlist_push_tail(&tc_head->trs_list, &trs->chain);
+		trs->build_seq = tc_head->build_log_tail++;
+		dlist_push_tail(&tc_head->build_log,
+						&tcache_get_row_store(trs)->build_chain);
+	}
+	Assert(tc_head->build_slot[entry->slot].blkno == blkno_start);
+	tc_head->build_slot[entry->slot].blkno = InvalidBlockNumber;
+	tcache_build_log_trim_nolock(tc_head, &trimmed);
+	SpinLockRelease(&tc_head->lock);
+
+	tcache_build_log_release(&trimmed);
+
+	/* columnizers move the row-stores into column-stores in parallel */
+	if (has_pending)
+		tcache_enqueue_pending(tc_head);
+}
+
+/*
+ * tcache_pin_snapshot / tcache_unpin_snapshot
+ *
+ * A scan pins the root node of the latest version and the row-stores
+ * not columnized yet, within a same critical section. Columnizer moves
+ * a row-store into column-stores on the next version, then publishes the
+ * version and detaches the row-store at once, so tuples are neither
+ * missed nor fetched twice on the pinned snapshot.
+ */
+static void
+tcache_pin_snapshot(tcache_scandesc *tc_scan)
+{
+	tcache_head		   *tc_head = tc_scan->tc_head;
+	tcache_row_store  **trs_snap = NULL;
+	int					trs_size = 0;
+	int					trs_nums;
+	dlist_iter			iter;
+
+	Assert(!tc_scan->tc_root && !tc_scan->trs_snap);
+	while (true)
+	{
+		SpinLockAcquire(&tc_head->lock);
+		trs_nums = (tc_head->trs_curr ? 1 : 0);
+		dlist_foreach(iter, &tc_head->trs_list)
+			trs_nums++;
+
+		if (trs_nums <= trs_size)
+		{
+			trs_nums = 0;
+			dlist_foreach(iter, &tc_head->trs_list)
+			{
+				tcache_row_store   *trs
+					= dlist_container(tcache_row_store, chain, iter.cur);
+				trs_snap[trs_nums++] = tcache_get_row_store(trs);
+			}
+			if (tc_head->trs_curr)
+				trs_snap[trs_nums++] = tcache_get_row_store(tc_head->trs_curr);
+
+			tc_scan->tc_root = tcache_get_tcnode(tc_head->tcs_root);
+			tc_scan->tc_version = tc_head->tcs_version;
+			SpinLockRelease(&tc_head->lock);
+			break;
+		}
+		SpinLockRelease(&tc_head->lock);
+
+		/* expand the buffer, then retry */
+		if (trs_snap)
+			pfree(trs_snap);
+		trs_size = trs_nums + 4;
+		trs_snap = MemoryContextAlloc(tc_scan->memcxt,
+									  sizeof(tcache_row_store *) * trs_size);
+	}
+	tc_scan->trs_snap = trs_snap;
+	tc_scan->trs_nums = trs_nums;
+	tc_scan->trs_index = -1;
+}
+
+static void
+tcache_unpin_snapshot(tcache_scandesc *tc_scan)
+{
+	int		i;
+
+	if (tc_scan->tcs_curr)
+		tcache_put_column_store(tc_scan->tcs_curr);
+	tc_scan->tcs_curr = NULL;
+	tc_scan->trs_curr = NULL;
+
+	for (i=0; i < tc_scan->trs_nums; i++)
+		tcache_put_row_store(tc_scan->trs_snap[i]);
+	if (tc_scan->trs_snap)
+		pfree(tc_scan->trs_snap);
+	tc_scan->trs_snap = NULL;
+	tc_scan->trs_nums = 0;
+	tc_scan->trs_index = -1;
+
+	if (tc_scan->tc_root)
+		tcache_put_tcnode(tc_scan->tc_head, tc_scan->tc_root);
+	tc_scan->tc_root = NULL;
+}
+
+/*
+ * tcache_build_one_range
+ *
+ * It loads a range of the heap on behalf of the build, then returns true.
+ * Or, it returns false if no ranges are left to be claimed.
+ */
+static bool
+tcache_build_one_range(tcache_head *tc_head, Relation rel)
+{
+	tcache_build_entry *entry;
+	BlockNumber		blkno;
+
+	entry = tcache_build_attach(tc_head);
+	if (!entry)
+		return false;
+	blkno = tcache_build_claim(entry);
+	if (BlockNumberIsValid(blkno))
+		tcache_build_load_range(entry, rel, blkno);
+	tcache_build_detach(entry);
+
+	return BlockNumberIsValid(blkno);
+}
+
+/*
+ * tcache_launch_loaders
+ *
+ * It launches loader workers on beginning of the build, to load ranges
+ * of the heap in parallel with the scan that begins the build. Each worker
+ * puts its reference to the tcache_head acquired here, on exit.
+ */
+static void
+tcache_launch_loaders(tcache_head *tc_head, BlockNumber nblocks)
+{
+	BackgroundWorker	worker;
+	char	   *dbname;
+	int			nranges;
+	int			nloaders;
+	int			i;
+
+	nranges = (nblocks + TCACHE_BUILD_NBLOCKS - 1) / TCACHE_BUILD_NBLOCKS;
+	nloaders = Min(tcache_num_loaders, nranges - 1);
+	if (nloaders <= 0)
+		return;
+
+	dbname = get_database_name(MyDatabaseId);
+	if (!dbname)
+		return;
+	namestrcpy(&tc_head->build_dbname, dbname);
+
+	for (i=0; i < nloaders; i++)
+	{
+		memset(&worker, 0, sizeof(BackgroundWorker));
+		snprintf(worker.bgw_name, sizeof(worker.bgw_name),
+				 "PG-Strom tcache loader of relation %u", tc_head->reloid);
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		worker.bgw_main = NULL;
+		strcpy(worker.bgw_library_name, "pg_strom");
+		strcpy(worker.bgw_function_name, "pgstrom_tcache_loader_main");
+		worker.bgw_main_arg = PointerGetDatum(tc_head);
+		worker.bgw_notify_pid = 0;
+
+		SpinLockAcquire(&tc_common->lock);
+		tc_head->refcnt++;
+		SpinLockRelease(&tc_common->lock);
+
+		if (!RegisterDynamicBackgroundWorker(&worker, NULL))
+		{
+			tcache_put_tchead(tc_head);
+			elog(DEBUG1, "no room to launch tcache loader of relation %u",
+				 tc_head->reloid);
+			break;
+		}
+	}
+}
+
+/*
+ * pgstrom_tcache_loader_main
  *
- * main routine to construct columnar cache. It fully scans the heap
- * and insert the record into in-memory cache structure.
+ * Entrypoint of the loader workers. It connects to the database of the
+ * relation, then loads ranges of the heap until no ranges are left.
  */
-static void
-tcache_build_main(tcache_head *tc_head, HeapScanDesc heapscan)
+void
+pgstrom_tcache_loader_main(Datum main_arg)
 {
-	HeapTuple	tuple;
+	tcache_head	   *tc_head = (tcache_head *) DatumGetPointer(main_arg);
+	Relation		rel;
 
-	Assert(TCacheHeadLockedByMe(tc_head, true));
+	BackgroundWorkerUnblockSignals();
+	BackgroundWorkerInitializeConnection(NameStr(tc_head->build_dbname),
+										 NULL);
+	Assert(tc_head->datoid == MyDatabaseId);
 
-	while (true)
-	{
-		tuple = heap_getnext(heapscan, ForwardScanDirection);
-		if (!HeapTupleIsValid(tuple))
-			break;
+	StartTransactionCommand();
+	pgstrom_track_object(&tc_head->stag);
 
-		tcache_insert_tuple(tc_head, tc_head->tcs_root, tuple);
-		tcache_rebalance_tree(tc_head,
-							  tc_head->tcs_root,
-							  &tc_head->tcs_root);
+	rel = try_relation_open(tc_head->reloid, AccessShareLock);
+	if (rel)
+	{
+		while (tcache_build_one_range(tc_head, rel))
+			;
+		relation_close(rel, AccessShareLock);
 	}
+	pgstrom_untrack_object(&tc_head->stag);
+	tcache_put_tchead(tc_head);
+
+	CommitTransactionCommand();
+	proc_exit(0);
+}
+
+/*
+ * tcache_build_cursor_release
+ *
+ * A scan under the build leaves from the build_log, then entries being
+ * passed by all the other scans are released.
+ */
+static void
+tcache_build_cursor_release(tcache_build_entry *entry)
+{
+	tcache_head	   *tc_head = entry->tc_head;
+	dlist_head		trimmed;
+
+	dlist_init(&trimmed);
+	SpinLockAcquire(&tc_head->lock);
+	Assert(tc_head->build_cursor[entry->slot] != TCACHE_BUILD_NO_CURSOR);
+	tc_head->build_cursor[entry->slot] = TCACHE_BUILD_NO_CURSOR;
+	tcache_build_log_trim_nolock(tc_head, &trimmed);
+	SpinLockRelease(&tc_head->lock);
+
+	tcache_build_log_release(&trimmed);
+
+	tcache_build_scans = list_delete_ptr(tcache_build_scans, entry);
+	pfree(entry);
 }
 
+static void
+tcache_scan_build_leave(tcache_scandesc *tc_scan)
+{
+	ListCell   *cell;
+
+	if (tc_scan->trs_curr)
+		tcache_put_row_store(tc_scan->trs_curr);
+	tc_scan->trs_curr = NULL;
 
+	if (tc_scan->build_cursor < 0)
+		return;
 
+	foreach (cell, tcache_build_scans)
+	{
+		tcache_build_entry *entry = lfirst(cell);
 
+		if (entry->tc_head == tc_scan->tc_head &&
+			entry->slot == tc_scan->build_cursor)
+		{
+			tcache_build_cursor_release(entry);
+			break;
+		}
+	}
+	tc_scan->build_cursor = -1;
+}
 
 tcache_scandesc *
 tcache_begin_scan(Relation rel, Bitmapset *required)
 {
 	tcache_scandesc	   *tc_scan;
 	tcache_head		   *tc_head;
-	bool				has_wrlock = false;
+	tcache_build_entry *entry;
+	MemoryContext		oldcxt;
+	BlockNumber			nblocks;
+	bool				build_begin = false;
+	int					i;
 
 	tc_scan = palloc0(sizeof(tcache_scandesc));
 	tc_scan->rel = rel;
+	tc_scan->memcxt = CurrentMemoryContext;
+	tc_scan->trs_index = -1;
+	tc_scan->build_cursor = -1;
 	tc_head = tcache_get_tchead(RelationGetRelid(rel), required, true);
 	if (!tc_head)
 		elog(ERROR, "out of shared memory");
 	pgstrom_track_object(&tc_head->stag);
 	tc_scan->tc_head = tc_head;
 
-	LWLockAcquire(&tc_head->lwlock, LW_SHARED);
-retry:
+	/* relation size to be loaded, if we begin to build */
+	nblocks = RelationGetNumberOfBlocks(rel);
+
+	/* registered prior to join the build, so no error happen once joined */
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	entry = palloc(sizeof(tcache_build_entry));
+	entry->tc_head = tc_head;
+	entry->slot = -1;
+	tcache_build_scans = lappend(tcache_build_scans, entry);
+	MemoryContextSwitchTo(oldcxt);
+
 	SpinLockAcquire(&tc_head->lock);
 	if (tc_head->state == TCACHE_STATE_NOT_BUILT)
 	{
-		if (!has_wrlock)
+		tc_head->state = TCACHE_STATE_NOW_BUILD;
+		tc_head->build_nblocks = nblocks;
+		tc_head->build_next = 0;
+		for (i=0; i < TCACHE_BUILD_NLOADERS; i++)
 		{
-			SpinLockRelease(&tc_head->lock);
-			LWLockRelease(&tc_head->lwlock);
-			LWLockAcquire(&tc_head->lwlock, LW_EXCLUSIVE);
-			has_wrlock = true;
-			goto retry;
+			tc_head->build_slot[i].owned = false;
+			tc_head->build_slot[i].blkno = InvalidBlockNumber;
 		}
-		tc_head->state = TCACHE_STATE_NOW_BUILD;
-		SpinLockRelease(&tc_head->lock);
-		tc_scan->heapscan = heap_beginscan(rel, SnapshotAny, 0, NULL);
+		tc_head->build_log_head = 0;
+		tc_head->build_log_tail = 0;
+		for (i=0; i < TCACHE_BUILD_NSCANS; i++)
+			tc_head->build_cursor[i] = TCACHE_BUILD_NO_CURSOR;
+		build_begin = true;
 	}
-	else if (has_wrlock)
+
+	if (tc_head->state == TCACHE_STATE_NOW_BUILD)
 	{
+		/*
+		 * The cache is under construction. This scan walks on the
+		 * build_log from the head, and joins loading of the heap whenever
+		 * it runs out of ranges already published. If a part of the log
+		 * was already released, or no cursors are available, this scan
+		 * waits for completion of the build on the first fetch instead.
+		 */
+		if (tc_head->build_log_head == 0)
+		{
+			for (i=0; i < TCACHE_BUILD_NSCANS; i++)
+			{
+				if (tc_head->build_cursor[i] == TCACHE_BUILD_NO_CURSOR)
+				{
+					tc_head->build_cursor[i] = 0;
+					entry->slot = i;
+					break;
+				}
+			}
+		}
 		SpinLockRelease(&tc_head->lock);
-		LWLockRelease(&tc_head->lwlock);
-		LWLockAcquire(&tc_head->lwlock, LW_SHARED);
-		has_wrlock = false;
-		goto retry;
+		tc_scan->is_building = true;
+		tc_scan->build_cursor = entry->slot;
+
+		if (build_begin)
+			tcache_launch_loaders(tc_head, nblocks);
 	}
 	else
 	{
 		Assert(tc_head->state == TCACHE_STATE_READY);
 		SpinLockRelease(&tc_head->lock);
+		tcache_pin_snapshot(tc_scan);
+	}
+
+	if (entry->slot < 0)
+	{
+		tcache_build_scans = list_delete_ptr(tcache_build_scans, entry);
+		pfree(entry);
 	}
 	return tc_scan;
 }
 
-StromTag *
-tcache_scan_next(tcache_scandesc *tc_scan)
+/*
+ * tcache_scan_build_next
+ *
+ * In case when tcache_head is not built yet, a scan returns the row-stores
+ * on the build_log in order of publication, and loads ranges of the heap
+ * together with other scans and loaders when it runs out of the row-stores
+ * already published. Tuples in the ranges loaded are moved to column-stores
+ * by columnizers in parallel, and the row-stores on the build_log are
+ * released as soon as all the scans on the log pass them.
+ *
+ * NOTE: tuples inserted or updated concurrently are not visible on the
+ * build_log, as if they were not visible on the pinned snapshot.
+ */
+static StromTag *
+tcache_scan_build_next(tcache_scandesc *tc_scan)
 {
-	tcache_head		   *tc_head = tc_scan->tc_head;
-	tcache_row_store   *trs_prev;
-	tcache_row_store   *trs_curr;
-	dlist_node		   *dnode;
+	tcache_head	   *tc_head = tc_scan->tc_head;
+	tcache_row_store *trs_prev = tc_scan->trs_curr;
+	tcache_row_store *trs_next;
+	dlist_head		trimmed;
+	dlist_node	   *dnode;
+	int				state;
 
-	/*
-	 * NOTE: In case when tcache_head is not build yet, tc_scan will have
-	 * a valid 'heapscan'. Even though it is a bit ugly design, we try to
-	 * load contents of the heap once, then move to 
-	 */
-	if (tc_scan->heapscan)
-	{
-		tcache_build_main(tc_head, tc_scan->heapscan);
-		heap_endscan(tc_scan->heapscan);
-		tc_scan->heapscan = NULL;
-	}
-	/* at least, we have to hold shared-lwlock on tc_head here */
-	Assert(TCacheHeadLockedByMe(tc_head, false));
+	if (tc_scan->build_eof)
+		return NULL;
+	Assert(tc_scan->build_cursor >= 0);
 
-	if (!tc_scan->trs_curr)
+	while (true)
 	{
-		tcache_column_store *tcs_prev = tc_scan->tcs_curr;
-		BlockNumber		blkno = (tcs_prev ? tcs_prev->blkno_max + 1 : 0);
+		dnode = NULL;
+		trs_next = NULL;
+		dlist_init(&trimmed);
+		SpinLockAcquire(&tc_head->lock);
+		if (!trs_prev)
+		{
+			if (!dlist_is_empty(&tc_head->build_log))
+				dnode = dlist_head_node(&tc_head->build_log);
+		}
+		else if (dlist_has_next(&tc_head->build_log, &trs_prev->build_chain))
+			dnode = dlist_next_node(&tc_head->build_log,
+									&trs_prev->build_chain);
+		if (dnode)
+		{
+			trs_next = dlist_container(tcache_row_store, build_chain, dnode);
+			tcache_get_row_store(trs_next);
+			tc_head->build_cursor[tc_scan->build_cursor] = trs_next->build_seq;
+			tcache_build_log_trim_nolock(tc_head, &trimmed);
+		}
+		state = tc_head->state;
+		SpinLockRelease(&tc_head->lock);
 
-		tc_scan->tcs_curr
-			= tcache_find_next_column_store(tc_head, blkno);
-		if (tcs_prev)
-			tcache_put_column_store(tcs_prev);
-		if (tc_scan->tcs_curr)
-			return &tc_scan->tcs_curr->stag;
+		tcache_build_log_release(&trimmed);
+
+		if (trs_next || state == TCACHE_STATE_READY)
+			break;
+
+		if (!tcache_build_one_range(tc_head, tc_scan->rel))
+		{
+			/* wait for the other loaders to publish their ranges */
+			pg_usleep(10000L);	/* 10ms */
+			CHECK_FOR_INTERRUPTS();
+		}
 	}
-	/* no column-store entries, we also walks on row-stores */
-	trs_prev = tc_scan->trs_curr;
+	if (trs_prev)
+		tcache_put_row_store(trs_prev);
+	tc_scan->trs_curr = trs_next;
+	if (!trs_next)
+	{
+		/* all the entries are already passed */
+		tc_scan->build_eof = true;
+		tcache_scan_build_leave(tc_scan);
+		return NULL;
+	}
+	return &trs_next->stag;
+}
 
-	SpinLockAcquire(&tc_head->lock);
-	if (!trs_prev)
+/*
+ * tcache_scan_build_wait
+ *
+ * A scan that cannot walk on the build_log loads ranges of the heap
+ * together with other scans, until no ranges are left to be claimed.
+ * Then, it waits for completion of the other loaders, and pins the
+ * version just built.
+ */
+static void
+tcache_scan_build_wait(tcache_scandesc *tc_scan)
+{
+	tcache_head	   *tc_head = tc_scan->tc_head;
+	int				state;
+
+	Assert(tc_scan->build_cursor < 0 && !tc_scan->trs_curr);
+	while (true)
 	{
-		if (!dlist_is_empty(&tc_head->trs_list))
+		SpinLockAcquire(&tc_head->lock);
+		state = tc_head->state;
+		SpinLockRelease(&tc_head->lock);
+		if (state == TCACHE_STATE_READY)
+			break;
+
+		if (!tcache_build_one_range(tc_head, tc_scan->rel))
 		{
-			dnode = dlist_head_node(&tc_head->trs_list);
-			trs_curr = dlist_container(tcache_row_store, chain, dnode);
+			/* wait for the other loaders, or ranges being abandoned */
+			pg_usleep(10000L);	/* 10ms */
+			CHECK_FOR_INTERRUPTS();
 		}
-		else
-			trs_curr = tc_head->trs_curr;
-
-		if (trs_curr)
-			tc_scan->trs_curr = tcache_get_row_store(trs_curr);
 	}
-	else if (dnode_is_linked(&trs_prev->chain) &&
-			 dlist_has_next(&tc_head->trs_list, &trs_prev->chain))
+	tc_scan->is_building = false;
+	tc_scan->build_eof = false;
+
+	tcache_pin_snapshot(tc_scan);
+}
+
+StromTag *
+tcache_scan_next(tcache_scandesc *tc_scan)
+{
+	if (tc_scan->is_building)
 	{
-		dnode = dlist_next_node(&tc_head->trs_list, &trs_prev->chain);
-		trs_curr = dlist_container(tcache_row_store, chain, dnode);
-		tc_scan->trs_curr = tcache_get_row_store(trs_curr);
-		tcache_put_row_store(trs_prev);
+		if (tc_scan->build_cursor >= 0 || tc_scan->build_eof)
+			return tcache_scan_build_next(tc_scan);
+		tcache_scan_build_wait(tc_scan);
 	}
-	else
+
+	/* walks on the column-stores of the pinned snapshot first */
+	if (tc_scan->trs_index < 0)
 	{
-		if (tc_head->trs_curr)
-			tc_scan->trs_curr = tcache_get_row_store(tc_head->trs_curr);
+		tcache_column_store *tcs_prev = tc_scan->tcs_curr;
+		BlockNumber		blkno = (tcs_prev ? tcs_prev->blkno_max + 1 : 0);
+
+		if (tcs_prev && tcs_prev->blkno_max == MaxBlockNumber)
+			tc_scan->tcs_curr = NULL;
 		else
-			tc_scan->trs_curr = NULL;
-		tcache_put_row_store(trs_prev);
+			tc_scan->tcs_curr
+				= tcache_find_next_column_store(tc_scan->tc_root, blkno);
+		if (tcs_prev)
+			tcache_put_column_store(tcs_prev);
+		if (tc_scan->tcs_curr)
+			return &tc_scan->tcs_curr->stag;
+		tc_scan->trs_index = 0;
 	}
-	SpinLockRelease(&tc_head->lock);
 
-	if (tc_scan->trs_curr)
+	/* no column-store entries, we also walks on row-stores */
+	if (tc_scan->trs_index < tc_scan->trs_nums)
+	{
+		tc_scan->trs_curr = tc_scan->trs_snap[tc_scan->trs_index++];
 		return &tc_scan->trs_curr->stag;
+	}
+	tc_scan->trs_curr = NULL;
 	return NULL;
 }
 
 StromTag *
 tcache_scan_prev(tcache_scandesc *tc_scan)
 {
-	tcache_head		   *tc_head = tc_scan->tc_head;
 	tcache_column_store *tcs_prev;
 	BlockNumber		blkno;
-	dlist_node	   *dnode;
 
-	/*
-	 * NOTE: In case when tcache_head is not build yet, tc_scan will have
-	 * a valid 'heapscan'. Even though it is a bit ugly design, we try to
-	 * load contents of the heap once, then move to 
-	 */
-	if (tc_scan->heapscan)
+	if (tc_scan->is_building)
 	{
-		tcache_build_main(tc_head, tc_scan->heapscan);
-		heap_endscan(tc_scan->heapscan);
-		tc_scan->heapscan = NULL;
+		if (tc_scan->build_eof)
+			return NULL;
+		/* build_log is released on the way, so never walked backward */
+		tcache_scan_build_leave(tc_scan);
+		tcache_scan_build_wait(tc_scan);
 	}
-	/* at least, we have to hold shared-lwlock on tc_head here */
-	Assert(TCacheHeadLockedByMe(tc_head, false));
 
+	/* walks on the row-stores of the pinned snapshot in reverse order */
 	if (!tc_scan->tcs_curr)
 	{
-		tcache_row_store *trs_prev = tc_scan->trs_curr;
-		tcache_row_store *trs_curr;
-
-		SpinLockAcquire(&tc_head->lock);
-		if (!trs_prev)
-		{
-			if (tc_head->trs_curr)
-			{
-				trs_curr = tcache_get_row_store(tc_head->trs_curr);
-				Assert(!dnode_is_linked(&trs_curr->chain));
-			}
-			else if (!dlist_is_empty(&tc_head->trs_list))
-			{
-				dnode = dlist_tail_node(&tc_head->trs_list);
-				trs_curr = dlist_container(tcache_row_store, chain, dnode);
-				trs_curr = tcache_get_row_store(trs_curr);
-			}
-			else
-				trs_curr = NULL;
-		}
-		else if (!dnode_is_linked(&trs_prev->chain))
-		{
-			if (!dlist_is_empty(&tc_head->trs_list))
-			{
-				dnode = dlist_tail_node(&tc_head->trs_list);
-				trs_curr = dlist_container(tcache_row_store, chain, dnode);
-				trs_curr = tcache_get_row_store(trs_curr);
-			}
-			else
-				trs_curr = NULL;
-			tcache_put_row_store(trs_prev);
-		}
-		else
+		if (tc_scan->trs_index < 0)
+			tc_scan->trs_index = tc_scan->trs_nums;
+		if (tc_scan->trs_index > 0)
 		{
-			if (!dlist_has_prev(&tc_head->trs_list, &trs_prev->chain))
-			{
-				dnode = dlist_prev_node(&tc_head->trs_list,
-										&trs_prev->chain);
-				trs_curr = dlist_container(tcache_row_store, chain, dnode);
-				trs_curr = tcache_get_row_store(trs_curr);
-			}
-			else
-				trs_curr = NULL;
-			tcache_put_row_store(trs_prev);
-		}
-		tc_scan->trs_curr = trs_curr;
-		SpinLockRelease(&tc_head->lock);
-
-		/* if we have a row-store, return it */
-		if (tc_scan->trs_curr)
+			tc_scan->trs_curr = tc_scan->trs_snap[--tc_scan->trs_index];
 			return &tc_scan->trs_curr->stag;
+		}
+		tc_scan->trs_curr = NULL;
 	}
+
 	/* if we have no row-store, we also walks on column-stores */
 	tcs_prev = tc_scan->tcs_curr;
-
-	/* it's obvious we have no more column-store in this direction */
-	if (tcs_prev->blkno_min == 0)
+	if (tcs_prev && tcs_prev->blkno_min == 0)
 	{
+		/* it's obvious we have no more column-store in this direction */
 		tc_scan->tcs_curr = NULL;
 		tcache_put_column_store(tcs_prev);
 		return NULL;
 	}
-	Assert(tcs_prev->blkno_min > 0);
 	blkno = (tcs_prev ? tcs_prev->blkno_min - 1 : MaxBlockNumber);
 	tc_scan->tcs_curr
-		= tcache_find_prev_column_store(tc_head, blkno);
+		= tcache_find_prev_column_store(tc_scan->tc_root, blkno);
 	if (tcs_prev)
 		tcache_put_column_store(tcs_prev);
 	if (tc_scan->tcs_curr)
@@ -2239,38 +4227,12 @@ tcache_end_scan(tcache_scandesc *tc_scan)
 {
 	tcache_head	   *tc_head = tc_scan->tc_head;
 
-	/*
-	 * If scan is already reached end of the relation, tc_scan->scan shall
-	 * be already closed. If not, it implies scan is aborted in the middle.
-	 */
-	SpinLockAcquire(&tc_common->lock);
-	if (tc_scan->heapscan)
-	{
-		/*
-		 * tc_scan->heapscan should be already closed, if tcache is
-		 * successfully constructed. Elsewhere, it is under construction.
-		 */
-		tcache_free_node_recurse(tc_head, tc_head->tcs_root);
-		SpinLockRelease(&tc_common->lock);
-
-		heap_endscan(tc_scan->heapscan);
-	}
-	else if (tc_head->state == TCACHE_STATE_NOW_BUILD)
-	{
-		/* OK, cache was successfully built */
-		tc_head->state = TCACHE_STATE_READY;
-		SpinLockRelease(&tc_common->lock);
-	}
+	if (tc_scan->is_building)
+		tcache_scan_build_leave(tc_scan);
 	else
-	{
-		Assert(tc_head->state == TCACHE_STATE_READY);
-		SpinLockRelease(&tc_common->lock);
-	}
-	if (tc_scan->tcs_curr)
-		tcache_put_column_store(tc_scan->tcs_curr);
-	if (tc_scan->trs_curr)
-		tcache_put_row_store(tc_scan->trs_curr);
+		tcache_unpin_snapshot(tc_scan);
 
+	pgstrom_untrack_object(&tc_head->stag);
 	tcache_put_tchead(tc_head);
 	pfree(tc_scan);
 }
@@ -2278,25 +4240,181 @@ tcache_end_scan(tcache_scandesc *tc_scan)
 void
 tcache_rescan(tcache_scandesc *tc_scan)
 {
-	tcache_head	   *tc_head = tc_scan->tc_head;
+	/*
+	 * build_log is released on the way, so the scan under the build
+	 * restarts on the version being built, once the build is done.
+	 */
+	if (tc_scan->is_building)
+	{
+		tcache_scan_build_leave(tc_scan);
+		tc_scan->build_eof = false;
+		return;
+	}
 
+	/* rewind the cursor on the pinned snapshot */
 	if (tc_scan->tcs_curr)
 		tcache_put_column_store(tc_scan->tcs_curr);
 	tc_scan->tcs_curr = NULL;
-	if (tc_scan->trs_curr)
-		tcache_put_row_store(tc_scan->trs_curr);
 	tc_scan->trs_curr = NULL;
+	tc_scan->trs_index = -1;
+}
 
-	SpinLockAcquire(&tc_head->lock);
-	if (tc_head->state == TCACHE_STATE_NOW_BUILD)
+/*
+ * tcache_scan_load_columns
+ *
+ * It ensures all the referenced columns are resident on the column-store
+ * being returned. Columns evicted (or never loaded) are fetched from the
+ * heap using item-pointers, then the extended column-store replaces the
+ * original one on the tree, if nobody changed it in the meantime.
+ * The returned column-store has to be released by the caller.
+ */
+tcache_column_store *
+tcache_scan_load_columns(tcache_scandesc *tc_scan,
+						 tcache_column_store *tcs,
+						 cl_uint *cindex, int nrefs)
+{
+	tcache_head	   *tc_head = tc_scan->tc_head;
+	TupleDesc		tupdesc = tc_head->tupdesc;
+	tcache_column_store *tcs_new;
+	bool		   *resident = alloca(sizeof(bool) * tcs->ncols);
+	bool		   *missing = alloca(sizeof(bool) * tcs->ncols);
+	bool			has_missing = false;
+	bool			has_lwlock = false;
+	int				i, k;
+
+	for (k=0; k < tcs->ncols; k++)
+	{
+		resident[k] = TCACHE_COLUMN_IS_RESIDENT(tcs, k);
+		missing[k] = false;
+	}
+
+	for (i=0; i < nrefs; i++)
+	{
+		k = cindex[i];
+		Assert(k >= 0 && k < tcs->ncols);
+		if (resident[k])
+		{
+			/* usage counter is just a hint, so no locks here */
+			if (tcs->cdata[k].usage < UINT_MAX)
+				tcs->cdata[k].usage++;
+		}
+		else if (!missing[k])
+		{
+			resident[k] = true;
+			missing[k] = true;
+			has_missing = true;
+		}
+	}
+	if (!has_missing)
+		return tcache_get_column_store(tcs);
+
+	tcs_new = tcache_duplicate_column_store(tc_head, tcs, resident, false);
+	PG_TRY();
+	{
+		BufferAccessStrategy strategy = GetAccessStrategy(BAS_BULKREAD);
+		Buffer			buffer = InvalidBuffer;
+		BlockNumber		blkno_curr = InvalidBlockNumber;
+		Datum		   *values = palloc(sizeof(Datum) * tupdesc->natts);
+		bool		   *isnull = palloc(sizeof(bool) * tupdesc->natts);
+		tcache_node	   *tc_node;
+		int				index;
+		int				j;
+
+		for (index=0; index < tcs_new->nrows; index++)
+		{
+			ItemPointer		ctid = &tcs_new->ctids[index];
+			BlockNumber		blkno = ItemPointerGetBlockNumber(ctid);
+			OffsetNumber	offnum = ItemPointerGetOffsetNumber(ctid);
+			Page			page;
+			bool			is_valid = false;
+
+			if (blkno != blkno_curr)
+			{
+				if (BufferIsValid(buffer))
+					UnlockReleaseBuffer(buffer);
+				buffer = ReadBufferExtended(tc_scan->rel, MAIN_FORKNUM,
+											blkno, RBM_NORMAL, strategy);
+				LockBuffer(buffer, BUFFER_LOCK_SHARE);
+				blkno_curr = blkno;
+			}
+			page = BufferGetPage(buffer);
+
+			if (offnum <= PageGetMaxOffsetNumber(page))
+			{
+				ItemId		itemid = PageGetItemId(page, offnum);
+				HeapTupleData tuple;
+
+				if (ItemIdIsNormal(itemid))
+				{
+					tuple.t_data = (HeapTupleHeader) PageGetItem(page, itemid);
+					tuple.t_len = ItemIdGetLength(itemid);
+					tuple.t_self = *ctid;
+					tuple.t_tableOid = RelationGetRelid(tc_scan->rel);
+					heap_deform_tuple(&tuple, tupdesc, values, isnull);
+					is_valid = true;
+				}
+			}
+
+			/*
+			 * Record already pruned is never visible, so a null is
+			 * enough to fill up the slot.
+			 */
+			for (k=0; k < tcs_new->ncols; k++)
+			{
+				if (!missing[k])
+					continue;
+				j = tc_head->i_cached[k];
+				tcache_put_datum_tcs(tcs_new, k, index,
+									 tupdesc->attrs[j],
+									 is_valid ? values[j] : (Datum) 0,
+									 is_valid ? isnull[j] : true);
+			}
+		}
+		if (BufferIsValid(buffer))
+			UnlockReleaseBuffer(buffer);
+		FreeAccessStrategy(strategy);
+		pfree(values);
+		pfree(isnull);
+
+		/* also nnulls and zone map of the loaded columns */
+		tcache_zonemap_rebuild(tc_head, tcs_new);
+
+		/*
+		 * Replace the column-store on the tree by the extended one, if
+		 * it is still the latest one. Elsewhere, the extended one is
+		 * used for this scan only.
+		 */
+		LWLockAcquire(&tc_head->lwlock, LW_EXCLUSIVE);
+		has_lwlock = true;
+
+		tcache_cow_begin(tc_head);
+		tc_node = tcache_cow_find_tcnode(tc_head, &tc_head->cow_root,
+										 tcs->blkno_min);
+		if (tc_node && tc_node->tcs == tcs)
+		{
+			SpinLockAcquire(&tc_node->lock);
+			tc_node->tcs = tcache_get_column_store(tcs_new);
+			SpinLockRelease(&tc_node->lock);
+			tcache_put_column_store(tcs);
+			tcache_cow_publish(tc_head, NULL);
+		}
+		else
+			tcache_cow_abort(tc_head);
+		LWLockRelease(&tc_head->lwlock);
+	}
+	PG_CATCH();
 	{
-		/* XXX - how to handle half constructed cache? */
-		tcache_free_node_recurse(tc_head, tc_head->tcs_root);
+		if (has_lwlock)
+		{
+			tcache_cow_abort(tc_head);
+			LWLockRelease(&tc_head->lwlock);
+		}
+		tcache_put_column_store(tcs_new);
+		PG_RE_THROW();
 	}
-	SpinLockRelease(&tc_head->lock);
+	PG_END_TRY();
 
-	if (tc_scan->heapscan)
-		heap_rescan(tc_scan->heapscan, NULL);
+	return tcs_new;
 }
 
 
@@ -2324,13 +4442,14 @@ tcache_rescan(tcache_scandesc *tc_scan)
 /*
  * tcache_create_tchead
  *
- * It constructs an empty tcache_head that is capable to cache required
- * attributes. Usually, this routine is called by tcache_get_tchead with
- * on-demand creation. Caller has to acquire tc_common->lock on invocation.
+ * It constructs an empty tcache_head that is capable to cache all the
+ * valid (none dropped) attributes. Which columns are actually resident
+ * on column-stores is decided by col_usage. Usually, this routine is called
+ * by tcache_get_tchead with on-demand creation. Caller has to acquire
+ * tc_common->lock on invocation.
  */
 static tcache_head *
-tcache_create_tchead(Oid reloid, Bitmapset *required,
-					 tcache_head *tcache_old)
+tcache_create_tchead(Oid reloid)
 {
 	tcache_head	   *tc_head;
 	HeapTuple		reltup;
@@ -2339,8 +4458,7 @@ tcache_create_tchead(Oid reloid, Bitmapset *required,
 	TupleDesc		tupdesc;
 	Size			length;
 	Size			allocated;
-	Bitmapset	   *tempset;
-	int				i, j, k;
+	int				i, j;
 
 	/* calculation of the length */
 	reltup = SearchSysCache1(RELOID, ObjectIdGetDatum(reloid));
@@ -2352,7 +4470,8 @@ tcache_create_tchead(Oid reloid, Bitmapset *required,
 			  MAXALIGN(sizeof(*tupdesc)) +
 			  MAXALIGN(sizeof(Form_pg_attribute) * relform->relnatts) +
 			  MAXALIGN(sizeof(FormData_pg_attribute)) * relform->relnatts +
-			  MAXALIGN(sizeof(AttrNumber) * relform->relnatts));
+			  MAXALIGN(sizeof(AttrNumber) * relform->relnatts) +
+			  MAXALIGN(sizeof(uint32) * relform->relnatts));
 
 	/* allocation of a shared memory block (larger than length) */
 	tc_head = pgstrom_shmem_alloc_alap(length, &allocated);
@@ -2376,22 +4495,15 @@ tcache_create_tchead(Oid reloid, Bitmapset *required,
 		dlist_init(&tc_head->block_list);
 		dlist_init(&tc_head->pending_list);
 		dlist_init(&tc_head->trs_list);
+		dlist_init(&tc_head->build_log);
 		tc_head->datoid = MyDatabaseId;
 		tc_head->reloid = reloid;
 
-		tempset = bms_copy(required);
-		if (tcache_old)
-		{
-			for (i=0; i < tcache_old->ncols; i++)
-			{
-				j = (tcache_old->i_cached[i] + 1
-					 - FirstLowInvalidHeapAttributeNumber);
-				tempset = bms_add_member(tempset, j);
-			}
-		}
-		tc_head->ncols = bms_num_members(tempset);
 		tc_head->i_cached = (AttrNumber *)((char *)tc_head + offset);
 		offset += MAXALIGN(sizeof(AttrNumber) * relform->relnatts);
+		tc_head->col_usage = (uint32 *)((char *)tc_head + offset);
+		memset(tc_head->col_usage, 0, sizeof(uint32) * relform->relnatts);
+		offset += MAXALIGN(sizeof(uint32) * relform->relnatts);
 
 		tupdesc = (TupleDesc)((char *)tc_head + offset);
 		memset(tupdesc, 0, sizeof(*tupdesc));
@@ -2418,17 +4530,14 @@ tcache_create_tchead(Oid reloid, Bitmapset *required,
 			memcpy(tupdesc->attrs[i], GETSTRUCT(atttup),
 				   sizeof(FormData_pg_attribute));
 
-			k = ((Form_pg_attribute) GETSTRUCT(atttup))->attnum
-				- FirstLowInvalidHeapAttributeNumber;
-			if (bms_is_member(k, tempset))
+			if (!tupdesc->attrs[i]->attisdropped)
 				tc_head->i_cached[j++] = i;
 
 			ReleaseSysCache(atttup);
 		}
 		Assert(offset <= length);
-		Assert(tc_head->ncols == j);
+		tc_head->ncols = j;
 		tc_head->tupdesc = tupdesc;
-		bms_free(tempset);
 
 		/* remaining area shall be used to tcache_node */
 		while (offset + sizeof(tcache_node) < allocated)
@@ -2441,7 +4550,7 @@ tcache_create_tchead(Oid reloid, Bitmapset *required,
 		}
 
 		/* also, allocate first empty tcache node as root */
-		tc_head->tcs_root = tcache_alloc_tcnode(tc_head);
+		tc_head->tcs_root = tcache_alloc_tcnode(tc_head, true);
 	}
 	PG_CATCH();
 	{
@@ -2473,7 +4582,8 @@ tcache_put_tchead_nolock(tcache_head *tc_head)
 		Assert(!dnode_is_linked(&tc_head->lru_chain));
 
 		/* release tcache_node root recursively */
-		tcache_free_node_recurse(tc_head, tc_head->tcs_root);
+		Assert(!tc_head->cow_root);
+		tcache_put_tcnode(tc_head, tc_head->tcs_root);
 
 		/* release blocks allocated for tcache_node */
 		dlist_foreach_modify(iter, &tc_head->block_list)
@@ -2493,9 +4603,21 @@ tcache_put_tchead_nolock(tcache_head *tc_head)
 		}
 		/* TODO: also check tc_nodes behind of the tc_head */
 
-		/* also, all the row-store should be released */
-		Assert(dlist_is_empty(&tc_head->trs_list));
-		
+		/* also, release the row-stores not columnized yet */
+		dlist_foreach_modify(iter, &tc_head->trs_list)
+		{
+			tcache_row_store *trs
+				= dlist_container(tcache_row_store, chain, iter.cur);
+
+			dlist_delete(&trs->chain);
+			tcache_put_row_store(trs);
+		}
+		if (tc_head->trs_curr)
+			tcache_put_row_store(tc_head->trs_curr);
+
+		/* also, release the build_log if scans didn't release it */
+		tcache_build_log_release(&tc_head->build_log);
+
 		pgstrom_shmem_free(tc_head);
 	}
 }
@@ -2508,6 +4630,90 @@ tcache_put_tchead(tcache_head *tc_head)
 	SpinLockRelease(&tc_common->lock);
 }
 
+/*
+ * tcache_abort_tchead
+ *
+ * It puts a tcache_head tracked by the aborted transaction. If this backend
+ * was loading the heap for the initial build, the build slot is detached
+ * also, and the range being loaded is handed to the next loader. A scan
+ * under the build also leaves from the build_log.
+ */
+void
+tcache_abort_tchead(tcache_head *tc_head)
+{
+	ListCell   *cell;
+
+	foreach (cell, tcache_build_entries)
+	{
+		tcache_build_entry *entry = lfirst(cell);
+
+		if (entry->tc_head == tc_head)
+		{
+			tcache_build_detach(entry);
+			break;
+		}
+	}
+	foreach (cell, tcache_build_scans)
+	{
+		tcache_build_entry *entry = lfirst(cell);
+
+		if (entry->tc_head == tc_head)
+		{
+			tcache_build_cursor_release(entry);
+			break;
+		}
+	}
+	tcache_put_tchead(tc_head);
+}
+
+/*
+ * tcache_bump_col_usage
+ *
+ * It increments access frequency of the required columns. Note that
+ * whole-row reference is equivalent to references to all the columns,
+ * and system columns are always cached.
+ */
+static void
+tcache_bump_col_usage(tcache_head *tc_head, Bitmapset *required)
+{
+	Bitmapset  *tempset = bms_copy(required);
+	bool		whole_row = false;
+	int			i, j, k;
+
+	SpinLockAcquire(&tc_head->lock);
+	while ((k = bms_first_member(tempset)) >= 0)
+	{
+		k += FirstLowInvalidHeapAttributeNumber;
+		if (k < 0)
+			continue;
+		if (k == InvalidAttrNumber)
+		{
+			whole_row = true;
+			break;
+		}
+		for (i=0; i < tc_head->ncols; i++)
+		{
+			j = tc_head->i_cached[i];
+			if (tc_head->tupdesc->attrs[j]->attnum == k)
+			{
+				if (tc_head->col_usage[i] < UINT_MAX)
+					tc_head->col_usage[i]++;
+				break;
+			}
+		}
+	}
+	if (whole_row)
+	{
+		for (i=0; i < tc_head->ncols; i++)
+		{
+			if (tc_head->col_usage[i] < UINT_MAX)
+				tc_head->col_usage[i]++;
+		}
+	}
+	SpinLockRelease(&tc_head->lock);
+	bms_free(tempset);
+}
+
 /*
  * tcache_unlink_tchead(_nolock)
  *
@@ -2550,7 +4756,6 @@ tcache_get_tchead(Oid reloid, Bitmapset *required,
 {
 	dlist_iter		iter;
 	tcache_head	   *tc_head = NULL;
-	tcache_head	   *tc_old = NULL;
 	int				hindex = tcache_hash_index(MyDatabaseId, reloid);
 
 	SpinLockAcquire(&tc_common->lock);
@@ -2561,94 +4766,29 @@ tcache_get_tchead(Oid reloid, Bitmapset *required,
 			tcache_head	   *temp
 				= dlist_container(tcache_head, chain, iter.cur);
 
+			/*
+			 * All the valid columns are cacheable, so existing cache of
+			 * the target relation can be used as is. Columns being not
+			 * resident are loaded on demand.
+			 */
 			if (temp->datoid == MyDatabaseId &&
 				temp->reloid == reloid)
 			{
-				Bitmapset  *tempset = bms_copy(required);
-				int			i, j = 0;
-				int			k, l;
-
-				while ((i = bms_first_member(tempset)) >= 0 &&
-					   j < temp->tupdesc->natts)
-				{
-					i += FirstLowInvalidHeapAttributeNumber;
-
-					/* all the system attributes are cached in the default */
-					if (i < 0)
-						continue;
-
-					/*
-					 * whole row reference is equivalent to references to
-					 * all the valid (none dropped) columns.
-					 * also, row reference shall apear prior to all the
-					 * regular columns because of its attribute number
-					 */
-					if (i == InvalidAttrNumber)
-					{
-						for (k=0; k < temp->tupdesc->natts; k++)
-						{
-							if (temp->tupdesc->attrs[k]->attisdropped)
-								continue;
-
-							l = k - FirstLowInvalidHeapAttributeNumber;
-							tempset = bms_add_member(tempset, l);
-						}
-						continue;
-					}
-
-					/*
-					 * Is this regular column cached?
-					 */
-					while (j < temp->ncols)
-					{
-						k = temp->i_cached[j];
-						if (temp->tupdesc->attrs[k]->attnum != i)
-							break;
-						j++;
-					}
-				}
-				bms_free(tempset);
-
-				if (j < temp->ncols)
-				{
-					/*
-					 * Perfect! Cache of the target relation exists and all
-					 * the required columns are cached.
-					 */
-					temp->refcnt++;
-					dlist_move_head(&tc_common->lru_list, &temp->lru_chain);
-					tc_head = temp;
-				}
-				else
-				{
-					/*
-					 * Elsewhere, cache exists towards the required relation
-					 * but all the required columns are not cached in-memory.
-					 */
-					tc_old = temp;
-				}
+				temp->refcnt++;
+				dlist_move_head(&tc_common->lru_list, &temp->lru_chain);
+				tc_head = temp;
 				break;
 			}
 		}
 
 		if (!tc_head && create_on_demand)
 		{
-			tc_head = tcache_create_tchead(reloid, required, tc_old);
+			tc_head = tcache_create_tchead(reloid);
 			if (tc_head)
 			{
 				/* add this tcache_head to the hash table */
 				dlist_push_head(&tc_common->slot[hindex], &tc_head->chain);
 				dlist_push_head(&tc_common->lru_list, &tc_head->lru_chain);
-
-				/* also, old tcache_head is unlinked */
-				if (tc_old)
-				{
-					dlist_delete(&tc_old->chain);
-					dlist_delete(&tc_old->lru_chain);
-					memset(&tc_old->chain, 0, sizeof(dlist_node));
-					memset(&tc_old->lru_chain, 0, sizeof(dlist_node));
-					tcache_put_tchead_nolock(tc_old);
-				}
 			}
 		}
 	}
@@ -2658,6 +4798,11 @@ tcache_get_tchead(Oid reloid, Bitmapset *required,
 		PG_RE_THROW();
 	}
 	PG_END_TRY();
+	SpinLockRelease(&tc_common->lock);
+
+	/* columns being required become candidates to be resident */
+	if (tc_head && required)
+		tcache_bump_col_usage(tc_head, required);
 
 	return tc_head;
 }
@@ -2701,8 +4846,6 @@ pgstrom_tcache_synchronizer(PG_FUNCTION_ARGS)
 		 * store directly, in case when column-store has at least one
 		 * slot to store the new tuple.
 		 */
-		LWLockAcquire(&tc_head->lwlock, LW_SHARED);
-
 		if (TRIGGER_FIRED_AFTER(tg_event) &&
 			TRIGGER_FIRED_FOR_ROW(tg_event) &&
 			TRIGGER_FIRED_BY_INSERT(tg_event))
@@ -2741,12 +4884,10 @@ pgstrom_tcache_synchronizer(PG_FUNCTION_ARGS)
 	}
 	PG_CATCH();
 	{
-		LWLockRelease(&tc_head->lwlock);
 		tcache_put_tchead(tc_head);
 		PG_RE_THROW();
 	}
 	PG_END_TRY();
-	LWLockRelease(&tc_head->lwlock);
 	tcache_put_tchead(tc_head);
 
 	PG_RETURN_POINTER(result);
@@ -3113,7 +5254,7 @@ do_vacuum_row_store(tcache_row_store *trs, Buffer buffer)
 	Page			page;
 	cl_uint			index;
 
-	if (blknum < trs->blkno_min || trs->blkno_max > blknum)
+	if (blknum < trs->blkno_min || blknum > trs->blkno_max)
 		return;
 
 	page = BufferGetPage(buffer);
@@ -3149,6 +5290,8 @@ do_vacuum_row_store(tcache_row_store *trs, Buffer buffer)
 
 				tupoffset[index] = 0;
 			}
+			/* columnizer may be copying this row-store without locks */
+			trs->nvacuumed++;
 		}
 	}
 }
@@ -3196,10 +5339,11 @@ tcache_on_page_prune(Relation relation,
 		bool		has_lwlock = TCacheHeadLockedByMe(tc_head, false);
 
 		/*
-		 * At least, we need to acquire shared-lwlock on the tcache_head,
-		 * but no need for exclusive-lwlock because vacuum page never
-		 * create or drop tcache_nodes. Per node level spinlock is
-		 * sufficient to do.
+		 * At least, we need to acquire shared-lwlock on the tcache_head
+		 * to prevent columnizer to copy the stores being vacuumed, but
+		 * no need for exclusive-lwlock because vacuum page never create
+		 * or drop tcache_nodes. Per node level spinlock is sufficient
+		 * to do.
 		 * Note that, vacuumed records are marked as junk, then columnizer
 		 * actually removes them from the cache later, under the exclusive
 		 * lock.
@@ -3293,6 +5437,27 @@ tcache_on_object_access(ObjectAccessType access,
 
 
 
+/*
+ * tcache_enqueue_pending
+ *
+ * It links the tcache_head on the pending list, if not yet, then wakes up
+ * a columnizer. The pending list holds a reference to the tcache_head,
+ * and the columnizer that picks it up inherits the reference.
+ */
+static void
+tcache_enqueue_pending(tcache_head *tc_head)
+{
+	SpinLockAcquire(&tc_common->lock);
+	if (!tc_head->pending_chain.prev && !tc_head->pending_chain.next)
+	{
+		dlist_push_tail(&tc_common->pending_list, &tc_head->pending_chain);
+		tc_head->refcnt++;
+	}
+	SpinLockRelease(&tc_common->lock);
+
+	pgstrom_wakeup_columnizer(false);
+}
+
 static void
 pgstrom_wakeup_columnizer(bool wakeup_all)
 {
@@ -3311,6 +5476,232 @@ pgstrom_wakeup_columnizer(bool wakeup_all)
     SpinLockRelease(&tc_common->lock);
 }
 
+/*
+ * tcache_columnize_row_store
+ *
+ * It moves the tuples in a row-store claimed by this columnizer into the
+ * tree. The column-store is built and sorted privately without lwlock,
+ * so multiple columnizers can work on the same tcache_head concurrently;
+ * only stitching it on the tree is serialized by exclusive lwlock.
+ * Vacuum may update the row-store in-place during the copy, so we fall
+ * back to insert the tuples one by one if it happened (or the range of
+ * the row-store overlaps with nodes on the tree).
+ */
+static void
+tcache_columnize_row_store(tcache_head *tc_head, tcache_row_store *trs,
+						   cl_uint nvacuumed)
+{
+	tcache_column_store *tcs = NULL;
+	bool		has_lwlock = false;
+	int			index;
+
+	PG_TRY();
+	{
+		tcs = tcache_create_column_store(tc_head, NULL);
+		for (index=0; index < trs->kern.nrows; index++)
+		{
+			rs_tuple *rs_tup = kern_rowstore_get_tuple(&trs->kern, index);
+
+			if (!rs_tup)
+				continue;
+			if (tcs->nrows == NUM_ROWS_PER_COLSTORE)
+			{
+				tcache_put_column_store(tcs);
+				tcs = NULL;
+				break;
+			}
+			tcache_put_tuple_tcs(tc_head, tcs, &rs_tup->htup);
+		}
+		if (tcs && tcs->nrows == 0)
+		{
+			tcache_put_column_store(tcs);
+			tcs = NULL;
+		}
+		else if (tcs && !tcs->is_sorted)
+		{
+			tcache_sort_tcnode_internal(tc_head, NULL, tcs,
+										0, tcs->nrows - 1);
+			tcs->is_sorted = true;
+		}
+
+		LWLockAcquire(&tc_head->lwlock, LW_EXCLUSIVE);
+		has_lwlock = true;
+
+		/* nobody can vacuum the row-store under exclusive lwlock */
+		if (tcs && trs->nvacuumed != nvacuumed)
+		{
+			tcache_put_column_store(tcs);
+			tcs = NULL;
+		}
+
+		/*
+		 * The row-store is kept on the trs_list until the version gets
+		 * published, for scans that pin the current version.
+		 */
+		tcache_cow_begin(tc_head);
+		if (!tcs || !tcache_stitch_tcnode(tc_head, &tc_head->cow_root, tcs))
+		{
+			for (index=0; index < trs->kern.nrows; index++)
+			{
+				rs_tuple *rs_tup
+					= kern_rowstore_get_tuple(&trs->kern, index);
+				if (rs_tup)
+					tcache_insert_tuple(tc_head,
+										&tc_head->cow_root,
+										&rs_tup->htup);
+			}
+		}
+		tcache_rebalance_tree(tc_head,
+							  tc_head->cow_root,
+							  &tc_head->cow_root);
+		tcache_cow_publish(tc_head, trs);
+		LWLockRelease(&tc_head->lwlock);
+	}
+	PG_CATCH();
+	{
+		if (has_lwlock)
+		{
+			tcache_cow_abort(tc_head);
+			LWLockRelease(&tc_head->lwlock);
+		}
+		if (tcs)
+			tcache_put_column_store(tcs);
+		/* let other columnizer retry it */
+		SpinLockAcquire(&tc_head->lock);
+		trs->is_claimed = false;
+		SpinLockRelease(&tc_head->lock);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (tcs)
+		tcache_put_column_store(tcs);
+	/* row-store shall be released */
+	tcache_put_row_store(trs);
+}
+
+/*
+ * tcache_reclaim_tcnode_recurse
+ *
+ * It decays usage counter of the resident columns on the working version,
+ * then evicts column arrays not referenced for a while. The column-store
+ * is copied with the reduced residency, because the published one may be
+ * still referenced by scans or the OpenCL server.
+ */
+static void
+tcache_reclaim_tcnode_recurse(tcache_head *tc_head, tcache_node **p_node)
+{
+	tcache_node	   *tc_node;
+	tcache_column_store *tcs_old;
+	tcache_column_store *tcs_new;
+	bool		   *resident;
+	bool			has_evicted = false;
+	int				i;
+
+	if (!*p_node)
+		return;
+	tc_node = tcache_cow_tcnode(tc_head, p_node);
+	tcache_reclaim_tcnode_recurse(tc_head, &tc_node->left);
+	tcache_reclaim_tcnode_recurse(tc_head, &tc_node->right);
+
+	tcs_old = tc_node->tcs;
+	resident = alloca(sizeof(bool) * tcs_old->ncols);
+	for (i=0; i < tcs_old->ncols; i++)
+	{
+		resident[i] = TCACHE_COLUMN_IS_RESIDENT(tcs_old, i);
+		if (!resident[i])
+			continue;
+		/* usage counter is just a hint, so no locks here */
+		tcs_old->cdata[i].usage /= 2;
+		if (tcs_old->cdata[i].usage == 0 && tcs_old->nrows > 0)
+		{
+			resident[i] = false;
+			has_evicted = true;
+		}
+	}
+	if (!has_evicted)
+		return;
+
+	tcs_new = tcache_duplicate_column_store(tc_head, tcs_old,
+											resident, false);
+	SpinLockAcquire(&tc_node->lock);
+	tc_node->tcs = tcs_new;
+	SpinLockRelease(&tc_node->lock);
+	tcache_put_column_store(tcs_old);
+}
+
+/*
+ * tcache_reclaim_columns
+ *
+ * It is called by columnizers when column-stores consume shared memory
+ * more than pgstrom.tcache_reclaim_threshold. Least recently used caches
+ * are the first candidates, and columns rarely referenced are evicted
+ * prior to the frequently referenced ones. tcache_head being built or
+ * locked by others are skipped; we will revisit them next time.
+ */
+#define TCACHE_RECLAIM_NHEADS	64
+
+static void
+tcache_reclaim_columns(void)
+{
+	tcache_head	   *tc_heads[TCACHE_RECLAIM_NHEADS];
+	tcache_head	   *tc_head;
+	dlist_reverse_iter iter;
+	int				nheads = 0;
+	int				i, k;
+
+	SpinLockAcquire(&tc_common->lock);
+	dlist_reverse_foreach(iter, &tc_common->lru_list)
+	{
+		tc_head = dlist_container(tcache_head, lru_chain, iter.cur);
+		tc_head->refcnt++;
+		tc_heads[nheads++] = tc_head;
+		if (nheads == TCACHE_RECLAIM_NHEADS)
+			break;
+	}
+	SpinLockRelease(&tc_common->lock);
+
+	for (i=0; i < nheads; i++)
+	{
+		int		state;
+
+		tc_head = tc_heads[i];
+
+		SpinLockAcquire(&tc_head->lock);
+		state = tc_head->state;
+		SpinLockRelease(&tc_head->lock);
+
+		if (state == TCACHE_STATE_READY &&
+			tcache_usage_exceeds_threshold() &&
+			LWLockConditionalAcquire(&tc_head->lwlock, LW_EXCLUSIVE))
+		{
+			PG_TRY();
+			{
+				tcache_cow_begin(tc_head);
+				tcache_reclaim_tcnode_recurse(tc_head, &tc_head->cow_root);
+				tcache_cow_publish(tc_head, NULL);
+
+				SpinLockAcquire(&tc_head->lock);
+				for (k=0; k < tc_head->ncols; k++)
+					tc_head->col_usage[k] /= 2;
+				SpinLockRelease(&tc_head->lock);
+			}
+			PG_CATCH();
+			{
+				tcache_cow_abort(tc_head);
+				LWLockRelease(&tc_head->lwlock);
+				PG_RE_THROW();
+			}
+			PG_END_TRY();
+			LWLockRelease(&tc_head->lwlock);
+		}
+
+		SpinLockAcquire(&tc_common->lock);
+		tcache_put_tchead_nolock(tc_head);
+		SpinLockRelease(&tc_common->lock);
+	}
+}
+
 static void
 pgstrom_columnizer_main(Datum index)
 {
@@ -3334,79 +5725,123 @@ pgstrom_columnizer_main(Datum index)
 		tcache_head		   *tc_head = NULL;
 		tcache_node		   *tc_node;
 		tcache_row_store   *trs;
+		cl_uint				nvacuumed = 0;
+		bool				has_more;
 		dlist_node	*dnode;
+		dlist_iter	iter;
 
-		rc = WaitLatch(&MyProc->procLatch,
-					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
-					   15 * 1000);	/* wake up per 15s at least */
-		if (rc & WL_POSTMASTER_DEATH)
-			return;
+		ResetLatch(&MyProc->procLatch);
+
+		/* release rarely referenced columns under memory pressure */
+		if (tcache_usage_exceeds_threshold())
+			tcache_reclaim_columns();
 
 		SpinLockAcquire(&tc_common->lock);
 		if (!dlist_is_empty(&tc_common->pending_list))
 		{
 			dnode = dlist_pop_head_node(&tc_common->pending_list);
 			tc_head = dlist_container(tcache_head, pending_chain, dnode);
-			tc_head->refcnt++;
+			memset(&tc_head->pending_chain, 0, sizeof(dlist_node));
+			/* reference counter of the pending list is inherited */
 			columnizer->datoid = tc_head->datoid;
 			columnizer->reloid = tc_head->reloid;
+			/* makes wakeup reach another idle columnizer */
+			dlist_delete(&columnizer->chain);
 		}
 		SpinLockRelease(&tc_common->lock);
 
 		if (!tc_head)
+		{
+			rc = WaitLatch(&MyProc->procLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   15 * 1000);	/* wake up per 15s at least */
+			if (rc & WL_POSTMASTER_DEATH)
+				return;
 			continue;
+		}
 
 		/*
-		 * TODO: add error handler routine
+		 * Claim a row-store not being columnized by others, or a node
+		 * pending for compaction. If more works are left, the tcache_head
+		 * is linked to the pending list again for other columnizers.
 		 */
-		LWLockAcquire(&tc_head->lwlock, LW_EXCLUSIVE);
-		// SpinLockAcquire(&tc_head->lock);	/* probably unneeded */
-		PG_TRY();
+		trs = NULL;
+		tc_node = NULL;
+		has_more = false;
+		SpinLockAcquire(&tc_head->lock);
+		dlist_foreach(iter, &tc_head->trs_list)
 		{
-			if (!dlist_is_empty(&tc_head->trs_list))
+			tcache_row_store   *temp
+				= dlist_container(tcache_row_store, chain, iter.cur);
+
+			if (temp->is_claimed)
+				continue;
+			if (trs)
 			{
-				int		index;
+				has_more = true;
+				break;
+			}
+			trs = temp;
+			trs->is_claimed = true;
+			nvacuumed = trs->nvacuumed;
+		}
+		if (!trs && !dlist_is_empty(&tc_head->pending_list))
+		{
+			dnode = dlist_pop_head_node(&tc_head->pending_list);
+			tc_node = dlist_container(tcache_node, chain, dnode);
+			memset(&tc_node->chain, 0, sizeof(dlist_node));
+		}
+		if (!dlist_is_empty(&tc_head->pending_list))
+			has_more = true;
+		SpinLockRelease(&tc_head->lock);
 
-				dnode = dlist_pop_head_node(&tc_head->trs_list);
-				trs = dlist_container(tcache_row_store, chain, dnode);
-				memset(&trs->chain, 0, sizeof(dlist_node));
+		if (has_more)
+			tcache_enqueue_pending(tc_head);
 
+		if (trs)
+			tcache_columnize_row_store(tc_head, trs, nvacuumed);
+		else if (tc_node)
+		{
+			/*
+			 * Columnizer constructs the next version with copy-on-write,
+			 * so scans on the published version are never blocked.
+			 * Exclusive lwlock only serializes writers to the tree.
+			 */
+			LWLockAcquire(&tc_head->lwlock, LW_EXCLUSIVE);
+			PG_TRY();
+			{
 				/*
-				 * Move tuples in row-store into column-store
+				 * A node on the pending_list holds a reference to itself,
+				 * but it may be a node of older version. So, we pick up
+				 * its working copy according to the block range.
 				 */
-				for (index=0; index < trs->kern.nrows; index++)
-				{
-					rs_tuple *rs_tup
-						= kern_rowstore_get_tuple(&trs->kern, index);
-					if (rs_tup)
-						tcache_insert_tuple(tc_head,
-											tc_head->tcs_root,
-											&rs_tup->htup);
-				}
-				/* row-store shall be released */
-				tcache_put_row_store(trs);
+				tcache_node	   *tc_work;
+
+				tcache_cow_begin(tc_head);
+				tc_work = tcache_cow_find_tcnode(tc_head,
+												 &tc_head->cow_root,
+												 tc_node->tcs->blkno_min);
+				if (tc_work)
+					tcache_compaction_tcnode(tc_head, tc_work);
+				tcache_try_merge_tcnode(tc_head, tc_node);
+				tcache_cow_publish(tc_head, NULL);
+				tcache_put_tcnode(tc_head, tc_node);
 			}
-			else if (!dlist_is_empty(&tc_head->pending_list))
+			PG_CATCH();
 			{
-				dnode = dlist_pop_head_node(&tc_head->pending_list);
-				tc_node = dlist_container(tcache_node, chain, dnode);
-				memset(&tc_node->chain, 0, sizeof(dlist_node));
-
-				tcache_compaction_tcnode(tc_head, tc_node);
-				tcache_try_merge_tcnode(tc_head, tc_node);
+				tcache_cow_abort(tc_head);
+				LWLockRelease(&tc_head->lwlock);
+				PG_RE_THROW();
 			}
-		}
-		PG_CATCH();
-		{
+			PG_END_TRY();
 			LWLockRelease(&tc_head->lwlock);
-			PG_RE_THROW();
 		}
-		PG_END_TRY();
 
 		/* OK, release this tcache_head */
 		SpinLockAcquire(&tc_common->lock);
 		columnizer->datoid = InvalidOid;
 		columnizer->reloid = InvalidOid;
+		dlist_push_tail(&tc_common->inactive_list, &columnizer->chain);
 		tcache_put_tchead_nolock(tc_head);
 		SpinLockRelease(&tc_common->lock);
 	}
@@ -3437,6 +5872,8 @@ pgstrom_startup_tcache(void)
 	Assert(!found);
 	memset(tc_common, 0, length);
 	SpinLockInit(&tc_common->lock);
+	SpinLockInit(&tc_common->usage_lock);
+	tc_common->usage = 0;
 	dlist_init(&tc_common->lru_list);
 	dlist_init(&tc_common->pending_list);
 	for (i=0; i < TCACHE_HASH_SIZE; i++)
@@ -3463,6 +5900,39 @@ pgstrom_init_tcache(void)
 							GUC_NOT_IN_SAMPLE,
 							NULL, NULL, NULL);
 
+	DefineCustomBoolVariable("pgstrom.tcache_compression",
+							 "enables encoding of sealed column-stores",
+							 NULL,
+							 &tcache_compression,
+							 true,
+							 PGC_POSTMASTER,
+							 GUC_NOT_IN_SAMPLE,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgstrom.tcache_num_loaders",
+							"number of loader workers launched on the "
+							"initial build of tcache",
+							NULL,
+							&tcache_num_loaders,
+							4,
+							0,
+							TCACHE_BUILD_NLOADERS - 1,
+							PGC_USERSET,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pgstrom.tcache_reclaim_threshold",
+							"percentage of shared memory usage by tcache "
+							"to start eviction of columns",
+							NULL,
+							&tcache_reclaim_threshold,
+							75,
+							1,
+							100,
+							PGC_POSTMASTER,
+							GUC_NOT_IN_SAMPLE,
+							NULL, NULL, NULL);
+
 	/* launch background worker processes */
 	for (i=0; i < num_columnizers; i++)
 	{